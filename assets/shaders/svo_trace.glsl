@@ -0,0 +1,402 @@
+/*
+* File: svo_trace.glsl
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/1/2025
+*/
+
+// sub-chunk svo traversal, shared by intersect.rint and the ray query build of raygen.rgen (BLOK_RAY_QUERY).
+// everything is in chunk-local space, instances are rigid so t matches world space
+
+#ifdef BLOK_COMPACT_SVO_NODES
+// bits 0-7 child mask, bits 8-31 first child (leaves: 1 = filled, bricks: word offset + 2)
+struct SvoNode {
+    uint maskAndChild;
+    uint materialId;
+};
+
+uint nodeChildMask(SvoNode n) { return n.maskAndChild & 0xFFu; }
+uint nodeFirstChild(SvoNode n) { return n.maskAndChild >> 8; }
+bool nodeFilled(SvoNode n) { return (n.maskAndChild >> 8) != 0u; }
+bool nodeIsBrick(SvoNode n) { return (n.maskAndChild & 0xFFu) == 0u && (n.maskAndChild >> 8) >= 2u; }
+uint nodeBrickWord(SvoNode n) { return (n.maskAndChild >> 8) - 2u; }
+uint nodeVoxelCount(SvoNode n) { return n.materialId; }
+#else
+struct SvoNode {
+    uint childMask; // bit 8 = brick
+    uint firstChild;
+    uint materialId;
+    float occupancy;
+};
+
+uint nodeChildMask(SvoNode n) { return n.childMask & 0xFFu; }
+uint nodeFirstChild(SvoNode n) { return n.firstChild; }
+bool nodeFilled(SvoNode n) { return n.occupancy > 0.0; }
+bool nodeIsBrick(SvoNode n) { return (n.childMask & 0x100u) != 0u; }
+uint nodeBrickWord(SvoNode n) { return n.firstChild; }
+uint nodeVoxelCount(SvoNode n) { return n.materialId; }
+#endif
+
+// dag packing shares geometry between chunks, materialId then holds the subtree's filled voxel count
+// and materials come from a side channel in brickWords, indexed by voxel rank in octant order
+const uint NO_DAG_MATERIALS = 0xFFFFFFFFu;
+
+struct SubChunkGpu {
+    uint nodeOffset;     // Offset into global node array
+    uint rootNodeIndex;  // Sub-chunk's root node
+    uint nodeCount;      // Total nodes in parent chunk
+    uint startDepth;     // Depth at which sub-chunk starts
+    vec3 localMin;       // Chunk-local bounds of the filled voxels
+    float subChunkSize;  // svo cell size
+    vec3 localMax;
+    uint brickOffset;    // first brick word of the parent chunk
+    vec3 cellMin;        // svo cell corner
+    uint materialBase;   // dag: side-channel material of the root's first voxel, else NO_DAG_MATERIALS
+};
+
+layout(binding = 1, set = 0) readonly buffer SvoBuffer {
+    SvoNode nodes[];
+};
+
+layout(binding = 2, set = 0) readonly buffer SubChunkBuffer {
+    SubChunkGpu subChunks[];
+};
+
+// 4^3 leaf bricks: 64 bit occupancy (lo, hi; bit x + y*4 + z*16), then one material per set bit.
+// material words keep the id in their low 24 bits, baked chunks put the voxel's ao in the top byte (svo.hpp)
+const uint SVO_MATERIAL_MASK = 0x00FFFFFFu;
+const uint SVO_BAKED_AO_SHIFT = 24u;
+layout(binding = 10, set = 0) readonly buffer BrickBuffer {
+    uint brickWords[];
+};
+
+// per chunk chessboard distance from each storage brick to the nearest filled one, in bricks. a byte per brick,
+// four to a word, a chunk's block at slot * wordsPerChunk (EmptySpaceHeader)
+layout(binding = 17, set = 0) readonly buffer EmptySpaceBuffer {
+    uint emptyCellsPerAxis; // 0 = no field
+    uint emptyWordsPerChunk;
+    float emptyCellSize;
+    uint emptySubChunksPerChunk;
+    uint emptyWords[];
+};
+
+// front to back keeps at most 3 pending siblings per level (+1).
+// sub-chunks can start at the chunk root now, so size it for a whole 7 level (128^3) chunk
+// specialization constants (QualitySpecialization), the presets only move MAX_ITER.
+// raygen has 0 and 1 for itself, so the ray query build moves these past them
+#ifdef BLOK_RAY_QUERY
+layout(constant_id = 2) const uint MAX_ITER  = 256u;
+layout(constant_id = 3) const uint MAX_STACK = 22u;
+layout(constant_id = 4) const float EPSILON  = 1e-6;
+#else
+layout(constant_id = 0) const uint MAX_ITER  = 256u;
+layout(constant_id = 1) const uint MAX_STACK = 22u;
+layout(constant_id = 2) const float EPSILON  = 1e-6;
+#endif
+
+// raygen includes it itself, before these
+#ifndef TRAVERSAL_STATS_ID
+#define TRAVERSAL_STATS_ID 3
+#endif
+#include "traversal_stats.glsl"
+
+// Returns vec2(tNear, tFar); If tNear > tFar, missed
+vec2 intersectAABB_Root(vec3 origin, vec3 invDir, vec3 boxMin, vec3 boxMax) {
+    vec3 t0 = (boxMin - origin) * invDir;
+    vec3 t1 = (boxMax - origin) * invDir;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    float tNear = max(max(tmin.x, tmin.y), tmin.z);
+    float tFar  = min(min(tmax.x, tmax.y), tmax.z);
+    return vec2(tNear, tFar);
+}
+
+// Face normal helper for reporting intersection
+uint getHitFace(vec3 hitPos, vec3 center) {
+    vec3 diff = hitPos - center;
+    vec3 absDiff = abs(diff);
+
+    // Find dominant axis
+    if (absDiff.x >= absDiff.y && absDiff.x >= absDiff.z)
+        return diff.x > 0.0 ? 0u : 1u; // +X, -X
+    if (absDiff.y >= absDiff.z)
+        return diff.y > 0.0 ? 2u : 3u; // +Y, -Y
+    return diff.z > 0.0 ? 4u : 5u;     // +Z, -Z
+}
+
+// voxel DDA through one 4^3 brick between t0 and t1, bit tests only, no node fetches.
+// returns the entry t of the first filled voxel or -1, its bit index goes to 'bit'
+float traceBrick(uvec2 bits, vec3 brickMin, float voxelSize, vec3 rayOrg, vec3 dir, vec3 invDir, float t0, float t1, out uint bit) {
+    vec3 p = (rayOrg + dir * t0 - brickMin) / voxelSize;
+    ivec3 cell = clamp(ivec3(floor(p)), ivec3(0), ivec3(3));
+    ivec3 stepV = ivec3(sign(dir));
+    vec3 tMaxV = (brickMin + (vec3(cell) + vec3(greaterThan(dir, vec3(0.0)))) * voxelSize - rayOrg) * invDir;
+    vec3 tDelta = abs(invDir) * voxelSize;
+
+    // a ray crosses at most 4 + 3 + 3 cells of a 4^3 grid
+    float t = t0;
+    for (uint i = 0u; i < 10u; ++i) {
+        uint b = uint(cell.x) | (uint(cell.y) << 2) | (uint(cell.z) << 4);
+        uint word = b < 32u ? bits.x : bits.y;
+        if ((word & (1u << (b & 31u))) != 0u) {
+            bit = b;
+            return t;
+        }
+
+        if (tMaxV.x < tMaxV.y && tMaxV.x < tMaxV.z) { t = tMaxV.x; cell.x += stepV.x; tMaxV.x += tDelta.x; }
+        else if (tMaxV.y < tMaxV.z)                 { t = tMaxV.y; cell.y += stepV.y; tMaxV.y += tDelta.y; }
+        else                                        { t = tMaxV.z; cell.z += stepV.z; tMaxV.z += tDelta.z; }
+
+        if (t >= t1 || any(lessThan(cell, ivec3(0))) || any(greaterThan(cell, ivec3(3)))) break;
+    }
+
+    bit = 0u;
+    return -1.0;
+}
+
+// a ray hops at most this many empty cubes, each one at least a brick wide
+const uint MAX_EMPTY_SKIPS = 16u;
+
+// moves t past the empty space around the ray before any node is fetched. a brick at distance d has every brick
+// within d - 1 of it empty, so the ray can go straight to the far side of that cube
+float skipEmptySpace(uint instanceIndex, vec3 rayOrg, vec3 dir, vec3 invDir, float t, float tMax) {
+    int n = int(emptyCellsPerAxis);
+    uint block = (instanceIndex / emptySubChunksPerChunk) * emptyWordsPerChunk;
+
+    for (uint i = 0u; i < MAX_EMPTY_SKIPS && t < tMax; ++i) {
+        ivec3 cell = ivec3(floor((rayOrg + dir * t) / emptyCellSize));
+        if (any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, ivec3(n)))) break;
+
+        uint c = uint(cell.x + (cell.y + cell.z * n) * n);
+        int d = int((emptyWords[block + (c >> 2)] >> ((c & 3u) * 8u)) & 0xFFu);
+        if (d == 0) break;
+
+        // nudged past the face so the next lookup lands in the neighbouring brick
+        vec2 cube = intersectAABB_Root(rayOrg, invDir, vec3(cell - (d - 1)) * emptyCellSize, vec3(cell + d) * emptyCellSize);
+        t = max(t, cube.y + emptyCellSize * 1e-4);
+    }
+    return t;
+}
+
+// materials are packed in bit order, so voxel b's is after every set bit below it
+uint brickRank(uvec2 bits, uint b) {
+    return b < 32u
+        ? bitCount(bits.x & ((1u << b) - 1u))
+        : bitCount(bits.x) + bitCount(bits.y & ((1u << (b - 32u)) - 1u));
+}
+
+struct SvoHit {
+    float t;
+    uint face;       // 0..5 = +x -x +y -y +z -z, chunk-local
+    uint materialId; // not looked up for occlusion
+    uint bakedAo;    // top byte of a brick voxel's material word, 0 if it wasn't baked (or for leaves and lod hits)
+};
+
+// one sub-chunk aabb of a chunk instance: instanceIndex = the instance's custom index (first sub-chunk of its slot),
+// primitive = the aabb. the first filled leaf popped is the nearest hit, anything left on the stack is farther away.
+// lodFootprint = pixel spread angle * lod scale, camLocal = the camera in chunk-local space
+bool traceSubChunk(uint instanceIndex, uint primitive, vec3 rayOrg, vec3 rayDir, float rayTMin, float rayTMax,
+                   vec3 camLocal, float lodFootprint, bool skipEmpty, bool occlusionOnly, out SvoHit hit) {
+    hit = SvoHit(0.0, 0u, 0u, 0u);
+    if (TRAVERSAL_STATS) {
+        svoStatNodes = 0u;
+        svoStatStack = 0u;
+        svoStatCutOff = false;
+    }
+    SubChunkGpu sub = subChunks[instanceIndex + primitive];
+
+    // Precompute inverse direction for AABB/Plane tests
+    // Using a safe division to handle axis-aligned rays. the octant mask uses the same
+    // substituted direction so its sign always agrees with invDir
+    vec3 safeDir = mix(rayDir, vec3(1e-6), lessThan(abs(rayDir), vec3(1e-6)));
+    vec3 invDir = 1.0 / safeDir;
+
+    // Intersect SubChunk Root
+    vec2 rootT = intersectAABB_Root(rayOrg, invDir, sub.localMin, sub.localMax);
+
+    // Check against current ray T constraints
+    float tMin = max(rootT.x, rayTMin);
+    float tMax = min(rootT.y, rayTMax);
+
+    if (tMin > tMax) return false;
+
+    // lod leaves are whole nodes, with the skip they're entered a little past their face. they're below a pixel anyway
+    if (skipEmpty && emptyCellsPerAxis > 0u) {
+        tMin = skipEmptySpace(instanceIndex, rayOrg, safeDir, invDir, tMin, tMax);
+        if (tMin > tMax) return false;
+    }
+
+    // Prepare Traversal State
+    // "octantMask" XORs the child index so the ray always runs towards +x/+y/+z in mirrored
+    // child space. a ray then only ever moves from a child to one with a higher mirrored index
+    uint octantMask = 0u;
+    if (safeDir.x < 0.0) octantMask |= 1u;
+    if (safeDir.y < 0.0) octantMask |= 2u;
+    if (safeDir.z < 0.0) octantMask |= 4u;
+
+    // children are packed, child i sits at firstChild + bitCount(childMask below i)
+
+    // Stack Data
+    struct StackItem {
+        uint  nodeIndex;
+        vec3  center;
+        float halfSize; // size * 0.5
+        float tEntry;   // t-value where ray enters this node
+        float tExit;    // t-value where ray exits this node
+        uint  matIndex; // dag: side-channel index of the first voxel below this node
+    };
+
+    bool dag = sub.materialBase != NO_DAG_MATERIALS;
+
+    StackItem stack[MAX_STACK];
+    uint stackPtr = 0u;
+
+    // Push Root Node
+    // the cell is the node's full cube, the tight bounds above only clip its t range
+    float rootHalf = sub.subChunkSize * 0.5;
+    stack[stackPtr++] = StackItem(
+        sub.nodeOffset + sub.rootNodeIndex,
+        sub.cellMin + vec3(rootHalf),
+        rootHalf,
+        tMin,
+        tMax,
+        sub.materialBase
+    );
+
+    // Front to back traversal
+    uint iter = 0u;
+    while (stackPtr > 0u && iter++ < MAX_ITER) {
+        // Pop
+        StackItem item = stack[--stackPtr];
+
+        // Fetch Node Data
+        // Safety check for bounds
+        if (item.nodeIndex >= sub.nodeOffset + sub.nodeCount) continue;
+        SvoNode node = nodes[item.nodeIndex];
+        if (TRAVERSAL_STATS) svoStatNodes++;
+        uint childMask = nodeChildMask(node);
+
+        bool isBrick = nodeIsBrick(node);
+
+        // interior nodes (and bricks) only exist above something filled, small enough ones end the descent.
+        // LOD: a node narrower than the pixel footprint at its distance is hit as a solid cube
+        bool lodLeaf = (childMask != 0u || isBrick) &&
+            item.halfSize * 2.0 <= lodFootprint * distance(item.center, camLocal);
+
+        // BRICK: the last two levels are one occupancy mask, step through it with bit tests
+        if (isBrick && !lodLeaf) {
+            uint base = sub.brickOffset + nodeBrickWord(node);
+            uvec2 bits = uvec2(brickWords[base], brickWords[base + 1u]);
+            float voxelSize = item.halfSize * 0.5;
+            vec3 brickMin = item.center - vec3(item.halfSize);
+
+            uint bit;
+            float tHit = traceBrick(bits, brickMin, voxelSize, rayOrg, safeDir, invDir, item.tEntry, item.tExit, bit);
+            if (tHit >= 0.0) {
+                hit.t = tHit;
+                if (!occlusionOnly) {
+                    vec3 voxelCenter = brickMin + (vec3(bit & 3u, (bit >> 2) & 3u, bit >> 4) + 0.5) * voxelSize;
+                    uint rank = brickRank(bits, bit);
+                    uint word = dag ? brickWords[item.matIndex + rank] : brickWords[base + 2u + rank];
+                    hit.materialId = word & SVO_MATERIAL_MASK;
+                    hit.bakedAo = word >> SVO_BAKED_AO_SHIFT;
+                    hit.face = getHitFace(rayOrg + rayDir * tHit, voxelCenter);
+                }
+                return true;
+            }
+            continue;
+        }
+
+        // LEAF CHECK
+        if (childMask == 0u || lodLeaf) {
+            if (lodLeaf || nodeFilled(node)) {
+                hit.t = item.tEntry;
+                // shadow rays only need a yes/no, no face or material
+                if (!occlusionOnly) {
+                    hit.face = getHitFace(rayOrg + rayDir * item.tEntry, item.center);
+                    hit.materialId = (dag ? brickWords[item.matIndex] : node.materialId) & SVO_MATERIAL_MASK;
+                }
+                return true;
+            }
+            continue;
+        }
+
+        // t-values where the ray crosses the node's 3 split planes
+        vec3 tPlane = (item.center - rayOrg) * invDir;
+
+        float t0 = item.tEntry;
+        float t1 = item.tExit;
+
+        // DDA over the child cells: find the child the ray enters first, then step across
+        // whichever split plane it hits next. at most 4 children are pierced
+        uint c = 0u; // mirrored child index
+        if (tPlane.x <= t0) c |= 1u;
+        if (tPlane.y <= t0) c |= 2u;
+        if (tPlane.z <= t0) c |= 4u;
+
+        struct ChildSpan { float tMin; float tMax; uint index; };
+        ChildSpan spans[4]; // Max 4 voxels pierced
+        uint spanCount = 0u;
+
+        float tStart = t0;
+        for (uint k = 0u; k < 4u; ++k) {
+            // a child exits through its split plane on axes it hasn't crossed yet, else through the node
+            vec3 tExitV = vec3(
+                (c & 1u) != 0u ? t1 : tPlane.x,
+                (c & 2u) != 0u ? t1 : tPlane.y,
+                (c & 4u) != 0u ? t1 : tPlane.z
+            );
+            float tEnd = min(min(min(tExitV.x, tExitV.y), tExitV.z), t1);
+
+            // Apply ray-sign correction
+            uint childIdx = c ^ octantMask;
+            if ((childMask & (1u << childIdx)) != 0u && tStart < tEnd)
+                spans[spanCount++] = ChildSpan(tStart, tEnd, childIdx);
+
+            if (tEnd >= t1) break;
+
+            if (tEnd == tExitV.x) c |= 1u;
+            else if (tEnd == tExitV.y) c |= 2u;
+            else c |= 4u;
+            tStart = tEnd;
+        }
+
+        // dag: a child's first material comes after everything in its earlier siblings
+        uint childRank[8];
+        if (dag && spanCount > 0u) {
+            uint acc = item.matIndex;
+            uint first = sub.nodeOffset + nodeFirstChild(node);
+            uint stored = 0u;
+            for (uint o = 0u; o < 8u; ++o) {
+                childRank[o] = acc;
+                if ((childMask & (1u << o)) != 0u) acc += nodeVoxelCount(nodes[first + stored++]);
+            }
+        }
+
+        // push far to near so the nearest child pops first
+        float nextHalf = item.halfSize * 0.5;
+        for (uint k = spanCount; k > 0u; --k) {
+            ChildSpan span = spans[k - 1u];
+            if (span.tMin >= rayTMax || stackPtr >= MAX_STACK) continue;
+
+            // Calculate child center relative to parent center
+            vec3 childOff;
+            childOff.x = (span.index & 1u) != 0u ? nextHalf : -nextHalf;
+            childOff.y = (span.index & 2u) != 0u ? nextHalf : -nextHalf;
+            childOff.z = (span.index & 4u) != 0u ? nextHalf : -nextHalf;
+
+            stack[stackPtr++] = StackItem(
+                sub.nodeOffset + nodeFirstChild(node) + bitCount(childMask & ((1u << span.index) - 1u)),
+                item.center + childOff,
+                nextHalf,
+                span.tMin,
+                span.tMax,
+                dag ? childRank[span.index] : 0u
+            );
+        }
+        if (TRAVERSAL_STATS) svoStatStack = max(svoStatStack, stackPtr);
+    }
+    // anything still on the stack was given up on at MAX_ITER
+    if (TRAVERSAL_STATS) svoStatCutOff = stackPtr > 0u;
+    return false;
+}
@@ -0,0 +1,47 @@
+/*
+* File: traversal_stats.glsl
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+
+// traversal instrumentation (RayTracing::Settings::traversalStats), shared by intersect.rint and raygen.rgen.
+// TRAVERSAL_STATS is a specialization constant, built without it every counter below folds away.
+// TRAVERSAL_STATS_ID is set by whoever includes this first, the ids before it belong to the stage
+
+#ifndef TRAVERSAL_STATS_GLSL
+#define TRAVERSAL_STATS_GLSL
+
+layout(constant_id = TRAVERSAL_STATS_ID) const bool TRAVERSAL_STATS = false;
+
+// four words per entry, screenWidth * screenHeight entries per half. the first half is what raygen leaves per pixel:
+// nodes visited, sub-chunk traversals (intersection invocations), deepest stack | traversals cut off at MAX_ITER << 8,
+// rays | bounces << 16. the second half is scratch per launch id the svo walks add into while raygen traces:
+// nodes, traversals, deepest stack (max), cut off traversals.
+// the intersection shader's writes have to be visible to the raygen that traced the ray once traceRayEXT returns
+#ifdef BLOK_RAY_QUERY
+layout(binding = 19, set = 0) buffer TraversalStatsBuffer {
+#else
+layout(binding = 19, set = 0) shadercallcoherent buffer TraversalStatsBuffer {
+#endif
+    uint traversalWords[];
+};
+
+// per svo walk, traceSubChunk fills these and the caller adds them to its launch
+uint svoStatNodes = 0u;
+uint svoStatStack = 0u;
+bool svoStatCutOff = false;
+
+uint traversalScratchEntry(uvec2 launchID, uint launchWidth, uvec2 screen) {
+    return screen.x * screen.y + launchID.y * launchWidth + launchID.x;
+}
+
+void traversalStatsAdd(uint entry) {
+    if (!TRAVERSAL_STATS) return;
+    atomicAdd(traversalWords[entry * 4u], svoStatNodes);
+    atomicAdd(traversalWords[entry * 4u + 1u], 1u);
+    atomicMax(traversalWords[entry * 4u + 2u], svoStatStack);
+    if (svoStatCutOff) atomicAdd(traversalWords[entry * 4u + 3u], 1u);
+}
+
+#endif
@@ -0,0 +1,25 @@
+/*
+* File: visibility.frag
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+
+#version 460
+
+layout(push_constant) uniform VisibilityPC {
+    mat4 viewProj;
+    vec4 camPos;
+} pc;
+
+layout(location = 0) in vec3 inWorldPos;
+layout(location = 1) flat in uint inMaterialFace;
+layout(location = 2) flat in uint inSubChunk;
+layout(location = 3) flat in uint inNormal;
+
+// GBuffer::visibility, raygen's bounce 0 reads it back in place of the primary trace. the clear (0) is a miss
+layout(location = 0) out uvec4 outVisibility;
+
+void main() {
+    outVisibility = uvec4(inMaterialFace, inSubChunk, floatBitsToUint(distance(inWorldPos, pc.camPos.xyz)), inNormal);
+}
@@ -0,0 +1,34 @@
+/*
+* File: visibility.vert
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+
+#version 460
+
+// rasterized primary visibility, the world's surface mesh (buildSurfaceMesh) with the same jittered projection
+// raygen unprojects its center ray with, so a pixel here is that ray's first hit
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in uint inMaterialFace;
+layout(location = 2) in uint inSubChunk;
+layout(location = 3) in uint inNormal;
+
+layout(push_constant) uniform VisibilityPC {
+    mat4 viewProj;
+    vec4 camPos;
+} pc;
+
+layout(location = 0) out vec3 outWorldPos;
+layout(location = 1) flat out uint outMaterialFace;
+layout(location = 2) flat out uint outSubChunk;
+layout(location = 3) flat out uint outNormal;
+
+void main() {
+    outWorldPos = inPosition;
+    outMaterialFace = inMaterialFace;
+    outSubChunk = inSubChunk;
+    outNormal = inNormal;
+    gl_Position = pc.viewProj * vec4(inPosition, 1.0);
+}
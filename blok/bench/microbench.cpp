@@ -0,0 +1,445 @@
+/*
+* File: microbench.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+// cpu voxel core microbenchmarks, built as blok_microbench with -DBLOK_BUILD_MICROBENCH=ON.
+//
+//   blok_microbench [--sizes 32,64,128,256] [--filter substring] [--reps N] [--models dir] [--csv file]
+//
+// every case runs reps times on fresh data, the median goes in the table. ns/op is per voxel (or per
+// lookup / per coordinate) so different chunk sizes and patterns compare directly
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "brush.hpp"
+#include "chunk_manager.hpp"
+#include "mesh_voxelizer.hpp"
+#include "morton.hpp"
+#include "svo.hpp"
+#include "terrain.hpp"
+#include "vox_loader.hpp"
+
+using namespace blok;
+
+namespace {
+
+struct Options {
+    std::vector<uint32_t> sizes{ 32, 64, 128, 256 };
+    std::string filter;
+    uint32_t reps = 5;
+    std::string modelDir = "assets/models";
+    std::string csv;
+};
+
+struct Result {
+    std::string name;
+    std::string pattern;
+    uint32_t size = 0;
+    uint64_t ops = 0;
+    double medianMs = 0.0;
+    double minMs = 0.0;
+};
+
+std::vector<Result> g_results;
+Options g_options;
+
+// keeps results observable so the loops aren't optimised away
+volatile uint64_t g_sink = 0;
+
+// setup runs untimed before every rep, body is what gets measured. returns ops done by body
+void runCase(const std::string& name, const std::string& pattern, uint32_t size,
+             const std::function<void()>& setup, const std::function<uint64_t()>& body) {
+    const std::string full = name + "/" + pattern + "/" + std::to_string(size);
+    if (!g_options.filter.empty() && full.find(g_options.filter) == std::string::npos) return;
+
+    std::vector<double> ms;
+    uint64_t ops = 0;
+    for (uint32_t r = 0; r < g_options.reps; r++) {
+        if (setup) setup();
+        const auto t0 = std::chrono::steady_clock::now();
+        ops = body();
+        const auto t1 = std::chrono::steady_clock::now();
+        ms.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+    std::sort(ms.begin(), ms.end());
+
+    Result res{ name, pattern, size, ops, ms[ms.size() / 2], ms.front() };
+    const double nsPerOp = ops ? res.medianMs * 1e6 / static_cast<double>(ops) : 0.0;
+    std::printf("%-24s %-12s %5u  %12llu ops  %10.3f ms  %8.2f ns/op\n", name.c_str(), pattern.c_str(), size,
+                static_cast<unsigned long long>(ops), res.medianMs, nsPerOp);
+    g_results.push_back(res);
+}
+
+// ---- occupancy patterns ----
+
+enum class Pattern { Solid, Shell, Terrain };
+
+const char* patternName(Pattern p) {
+    switch (p) {
+    case Pattern::Solid: return "solid";
+    case Pattern::Shell: return "shell";
+    case Pattern::Terrain: return "terrain";
+    }
+    return "?";
+}
+
+// integer hash value noise, fixed so every run sees the same terrain
+float hashNoise(int32_t x, int32_t z) {
+    uint32_t h = static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(z) * 0xd8163841u;
+    h = (h ^ (h >> 13)) * 0x85ebca6bu;
+    h ^= h >> 16;
+    return static_cast<float>(h & 0xFFFFu) / 65535.0f;
+}
+
+float valueNoise(float x, float z) {
+    const int32_t ix = static_cast<int32_t>(std::floor(x));
+    const int32_t iz = static_cast<int32_t>(std::floor(z));
+    const float fx = x - static_cast<float>(ix);
+    const float fz = z - static_cast<float>(iz);
+    const float sx = fx * fx * (3.0f - 2.0f * fx);
+    const float sz = fz * fz * (3.0f - 2.0f * fz);
+    const float a = hashNoise(ix, iz), b = hashNoise(ix + 1, iz);
+    const float c = hashNoise(ix, iz + 1), d = hashNoise(ix + 1, iz + 1);
+    return (a + (b - a) * sx) + ((c + (d - c) * sx) - (a + (b - a) * sx)) * sz;
+}
+
+bool patternVoxel(Pattern p, uint32_t C, uint32_t x, uint32_t y, uint32_t z, uint32_t& materialId) {
+    switch (p) {
+    case Pattern::Solid:
+        materialId = 1;
+        return true;
+    case Pattern::Shell: {
+        const uint32_t last = C - 1;
+        materialId = 2;
+        return x == 0 || y == 0 || z == 0 || x == last || y == last || z == last;
+    }
+    case Pattern::Terrain: {
+        // three octaves, features scale with the chunk so every size has the same shape
+        const float u = static_cast<float>(x) / static_cast<float>(C) * 4.0f;
+        const float v = static_cast<float>(z) / static_cast<float>(C) * 4.0f;
+        const float n = valueNoise(u, v) * 0.57f + valueNoise(u * 2.0f, v * 2.0f) * 0.29f + valueNoise(u * 4.0f, v * 4.0f) * 0.14f;
+        const auto height = static_cast<uint32_t>(static_cast<float>(C) * (0.2f + 0.6f * n));
+        materialId = y + 3 >= height ? 3 : 4;
+        return y < height;
+    }
+    }
+    return false;
+}
+
+// one C^3 chunk at the origin
+std::unique_ptr<ChunkManager> makePatternWorld(Pattern p, uint32_t C) {
+    auto mgr = std::make_unique<ChunkManager>(C, 1.0f);
+    const glm::ivec3 hi(static_cast<int32_t>(C));
+    mgr->writeRegion(glm::ivec3(0), hi, [&](const glm::ivec3& gv, uint32_t& materialId, float& density) {
+        density = 1.0f;
+        return patternVoxel(p, C, gv.x, gv.y, gv.z, materialId);
+    });
+    return mgr;
+}
+
+std::unique_ptr<ChunkManager> makeModelWorld(const VoxFile& vox, uint32_t C) {
+    auto mgr = std::make_unique<ChunkManager>(C, 1.0f);
+    importVoxToChunks(vox, *mgr, glm::vec3(0.0f), 0);
+    return mgr;
+}
+
+uint64_t filledVoxels(const ChunkManager& mgr) {
+    uint64_t n = 0;
+    for (const auto& kv : mgr.chunks) {
+        const ChunkStorage& s = kv.second->voxels;
+        const uint32_t B = s.bricksPerAxis();
+        for (uint32_t bz = 0; bz < B; bz++)
+            for (uint32_t by = 0; by < B; by++)
+                for (uint32_t bx = 0; bx < B; bx++)
+                    if (const auto* b = s.brick(bx, by, bz)) n += b->filled;
+    }
+    return n;
+}
+
+// ---- cases ----
+
+void benchMorton() {
+    constexpr uint32_t N = 1u << 22;
+    std::vector<uint64_t> codes(N);
+    runCase("morton3d::encode", "-", 0, nullptr, [&] {
+        uint32_t i = 0;
+        for (int32_t z = 0; z < 256; z++)
+            for (int32_t y = 0; y < 128; y++)
+                for (int32_t x = 0; x < 128; x++)
+                    codes[i++] = morton3d::encode(x, y, z);
+        g_sink = g_sink + codes[N / 3];
+        return static_cast<uint64_t>(N);
+    });
+    runCase("morton3d::decode", "-", 0, nullptr, [&] {
+        uint64_t acc = 0;
+        for (uint64_t c : codes) {
+            int32_t x, y, z;
+            morton3d::decode(c, x, y, z);
+            acc += static_cast<uint64_t>(x + y + z);
+        }
+        g_sink = g_sink + acc;
+        return static_cast<uint64_t>(N);
+    });
+
+    // same coordinates as soa arrays through the runtime dispatched batch kernels
+    std::vector<int32_t> xs(N), ys(N), zs(N);
+    for (uint32_t i = 0; i < N; i++) morton3d::decode(codes[i], xs[i], ys[i], zs[i]);
+    const std::string kernel = morton3d::batchUsesBmi2() ? "bmi2" : "masks";
+    runCase("morton3d::encodeBatch", kernel, 0, nullptr, [&] {
+        morton3d::encodeBatch(xs.data(), ys.data(), zs.data(), codes.data(), N);
+        g_sink = g_sink + codes[N / 3];
+        return static_cast<uint64_t>(N);
+    });
+    runCase("morton3d::decodeBatch", kernel, 0, nullptr, [&] {
+        morton3d::decodeBatch(codes.data(), xs.data(), ys.data(), zs.data(), N);
+        g_sink = g_sink + static_cast<uint64_t>(xs[N / 3]);
+        return static_cast<uint64_t>(N);
+    });
+}
+
+// the per-world cases, the same set runs over the synthetic patterns and the vox models
+void benchWorld(const std::string& pattern, uint32_t C, const std::function<std::unique_ptr<ChunkManager>()>& make) {
+    std::unique_ptr<ChunkManager> world = make();
+    const uint64_t filled = filledVoxels(*world);
+    if (filled == 0) return;
+
+    std::unique_ptr<SvoTree> tree;
+    const Chunk* first = world->chunks.begin()->second;
+    runCase("SvoTree::insertVoxel", pattern, C,
+        [&] { tree = std::make_unique<SvoTree>(world->maxDepth, glm::vec3(0.0f), 1.0f); },
+        [&] {
+            const ChunkStorage& s = first->voxels;
+            uint64_t ops = 0;
+            for (uint32_t z = 0; z < C; z++)
+                for (uint32_t y = 0; y < C; y++)
+                    for (uint32_t x = 0; x < C; x++) {
+                        if (s.density(x, y, z) <= 0.0f) continue;
+                        tree->insertVoxel(x, y, z, s.material(x, y, z));
+                        ops++;
+                    }
+            return ops;
+        });
+
+    // findLeaf doesn't exist, findVoxel is the point query the cpu side has
+    runCase("SvoTree::findVoxel", pattern, C,
+        [&] {
+            tree = std::make_unique<SvoTree>(world->maxDepth, glm::vec3(0.0f), 1.0f);
+            tree->buildFromStorage(first->voxels);
+        },
+        [&] {
+            constexpr uint32_t LOOKUPS = 1u << 20;
+            std::mt19937 rng(1234);
+            std::uniform_int_distribution<uint32_t> coord(0, C - 1);
+            uint64_t hits = 0;
+            for (uint32_t i = 0; i < LOOKUPS; i++) {
+                uint32_t m = 0;
+                hits += tree->findVoxel(coord(rng), coord(rng), coord(rng), &m) ? m : 0;
+            }
+            g_sink = g_sink + hits;
+            return static_cast<uint64_t>(LOOKUPS);
+        });
+
+    runCase("buildSvoFromDensity", pattern, C, nullptr, [&] {
+        for (auto& kv : world->chunks) buildSvoFromDensity(kv.second, C);
+        return filled;
+    });
+
+    // full repack into an empty gpu world every rep, an unchanged world would skip every chunk
+    std::unique_ptr<WorldSvoGpu> gpuWorld;
+    runCase("packChunksToGpuSvo", pattern, C,
+        [&] { gpuWorld = std::make_unique<WorldSvoGpu>(); },
+        [&] {
+            packChunksToGpuSvo(*world, *gpuWorld);
+            return filled;
+        });
+
+    // a sphere a quarter of the chunk across, carved out of the middle then put back
+    runCase("applyBrush", pattern, C, nullptr, [&] {
+        Brush b{};
+        b.centerWS = glm::vec3(static_cast<float>(C) * 0.5f);
+        b.radiusWS = static_cast<float>(C) * 0.25f;
+        b.value = 1.0f;
+        b.mode = Brush::SUBTRACT;
+        applyBrush(*world, b);
+        b.mode = Brush::ADD;
+        applyBrush(*world, b);
+        const double r = b.radiusWS;
+        return static_cast<uint64_t>(2.0 * 4.0 / 3.0 * 3.14159265 * r * r * r);
+    });
+
+    // per voxel writes through the world api, into a fresh manager
+    std::unique_ptr<ChunkManager> target;
+    runCase("setVoxelMaterial", pattern, C,
+        [&] { target = std::make_unique<ChunkManager>(C, 1.0f); },
+        [&] {
+            uint64_t ops = 0;
+            for (const auto& kv : world->chunks) {
+                const Chunk& ch = *kv.second;
+                const glm::vec3 base(ch.cx * static_cast<int32_t>(C), ch.cy * static_cast<int32_t>(C), ch.cz * static_cast<int32_t>(C));
+                for (uint32_t z = 0; z < C; z++)
+                    for (uint32_t y = 0; y < C; y++)
+                        for (uint32_t x = 0; x < C; x++) {
+                            const float d = ch.voxels.density(x, y, z);
+                            if (d <= 0.0f) continue;
+                            target->setVoxelMaterial(base + glm::vec3(x, y, z) + 0.5f, ch.voxels.material(x, y, z), d);
+                            ops++;
+                        }
+            }
+            return ops;
+        });
+}
+
+// every chunk a 4x4 patch of terrain columns generates, the surface layers streaming spends its time on.
+// ns/op is per chunk, serial on this thread and then as jobs across the pool
+void benchTerrain(uint32_t C) {
+    MaterialLibrary lib;
+    JobSystem jobs;
+    TerrainGenerator gen(TerrainSettings{}, lib, C, jobs);
+
+    const auto c = static_cast<int32_t>(C);
+    auto floorDiv = [&](int32_t v) { return v >= 0 ? v / c : -((-v + c - 1) / c); };
+    std::vector<ChunkCoord> coords;
+    for (int32_t y = floorDiv(gen.minY()); y <= floorDiv(gen.maxY()); y++)
+        for (int32_t z = 0; z < 4; z++)
+            for (int32_t x = 0; x < 4; x++) coords.push_back({x, y, z});
+
+    runCase("TerrainGenerator", "serial", C, nullptr, [&] {
+        for (const ChunkCoord& cc : coords) {
+            ChunkStorage s(C);
+            if (gen.generate(cc, s)) g_sink = g_sink + s.allocatedBricks();
+        }
+        return static_cast<uint64_t>(coords.size());
+    });
+    runCase("TerrainGenerator", "jobs", C, nullptr, [&] {
+        for (const ChunkCoord& cc : coords) gen.request(cc);
+        std::vector<LoadedChunk> done;
+        while (done.size() < coords.size()) {
+            gen.collect(done);
+            std::this_thread::yield();
+        }
+        for (const LoadedChunk& l : done)
+            if (l.voxels) g_sink = g_sink + l.voxels->allocatedBricks();
+        return static_cast<uint64_t>(coords.size());
+    });
+}
+
+// a uv sphere of ~250k triangles voxelized at twice the chunk size, ns/op is per triangle
+void benchVoxelizer(uint32_t C) {
+    constexpr uint32_t RINGS = 256;
+    constexpr uint32_t SEGMENTS = 512;
+    TriangleMesh sphere;
+    for (uint32_t r = 0; r <= RINGS; r++)
+        for (uint32_t s = 0; s <= SEGMENTS; s++) {
+            const float theta = 3.14159265f * static_cast<float>(r) / RINGS;
+            const float phi = 6.28318531f * static_cast<float>(s) / SEGMENTS;
+            sphere.positions.emplace_back(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+        }
+    for (uint32_t r = 0; r < RINGS; r++)
+        for (uint32_t s = 0; s < SEGMENTS; s++) {
+            const uint32_t a = r * (SEGMENTS + 1) + s, b = a + SEGMENTS + 1;
+            sphere.indices.insert(sphere.indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+            sphere.triangleColors.insert(sphere.triangleColors.end(), { 0x808080u, 0x808080u });
+        }
+
+    std::unique_ptr<ChunkManager> target;
+    VoxelizeSettings settings;
+    settings.resolution = C * 2;
+    runCase("voxelizeMeshToChunks", "sphere", C,
+        [&] { target = std::make_unique<ChunkManager>(C, 1.0f); },
+        [&] {
+            g_sink = g_sink + voxelizeMeshToChunks(sphere, *target, settings);
+            return static_cast<uint64_t>(sphere.triangleCount());
+        });
+}
+
+void benchModels(const std::vector<std::string>& models) {
+    for (const std::string& file : models) {
+        const std::string path = g_options.modelDir + "/" + file;
+        VoxFile vox;
+        std::string err;
+        if (!loadVoxFile(path, vox, err)) {
+            std::cerr << "skipping " << path << ": " << err << "\n";
+            continue;
+        }
+
+        runCase("loadVoxFile", file, 0, nullptr, [&] {
+            VoxFile v;
+            std::string e;
+            g_sink = g_sink + (loadVoxFile(path, v, e) ? v.models.size() : 0);
+            return uint64_t{1};
+        });
+
+        for (uint32_t C : g_options.sizes) {
+            benchWorld(file, C, [&] { return makeModelWorld(vox, C); });
+        }
+    }
+}
+
+std::vector<uint32_t> parseSizes(const char* s) {
+    std::vector<uint32_t> out;
+    while (*s) {
+        char* end = nullptr;
+        const auto v = static_cast<uint32_t>(std::strtoul(s, &end, 10));
+        if (end == s) break;
+        if (v >= 4 && (v & (v - 1)) == 0) out.push_back(v);
+        s = *end == ',' ? end + 1 : end;
+    }
+    return out;
+}
+
+void writeCsv(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "couldn't write " << path << "\n";
+        return;
+    }
+    out << "case,pattern,size,ops,median_ms,min_ms,ns_per_op\n";
+    for (const auto& r : g_results) {
+        const double nsPerOp = r.ops ? r.medianMs * 1e6 / static_cast<double>(r.ops) : 0.0;
+        out << r.name << ',' << r.pattern << ',' << r.size << ',' << r.ops << ','
+            << r.medianMs << ',' << r.minMs << ',' << nsPerOp << '\n';
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--sizes") == 0 && hasValue) g_options.sizes = parseSizes(argv[++i]);
+        else if (std::strcmp(argv[i], "--filter") == 0 && hasValue) g_options.filter = argv[++i];
+        else if (std::strcmp(argv[i], "--reps") == 0 && hasValue) g_options.reps = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--models") == 0 && hasValue) g_options.modelDir = argv[++i];
+        else if (std::strcmp(argv[i], "--csv") == 0 && hasValue) g_options.csv = argv[++i];
+    }
+
+    benchMorton();
+
+    for (uint32_t C : g_options.sizes) {
+        for (Pattern p : { Pattern::Solid, Pattern::Shell, Pattern::Terrain }) {
+            benchWorld(patternName(p), C, [&] { return makePatternWorld(p, C); });
+        }
+        benchTerrain(C);
+        benchVoxelizer(C);
+    }
+
+    benchModels({ "castle.vox", "menger.vox", "room.vox", "chr_knight.vox", "teapot.vox" });
+
+    if (!g_options.csv.empty()) writeCsv(g_options.csv);
+    return 0;
+}
@@ -8,7 +8,10 @@
 #define BLOK_APP_HPP
 
 #include <memory>
+#include <string>
 #include "backend.hpp"
+#include "benchmark.hpp"
+#include "offline_render.hpp"
 
 namespace blok {
 struct WorldSvoGpu;
@@ -17,6 +20,11 @@ class Window;
 class Renderer;
 class RendererGL;
 class CudaTracer;
+class MaterialLibrary;
+class WorldThread;
+class TerrainGenerator;
+class RegionStore;
+class ChunkRasterGL;
 
 class App {
 public:
@@ -25,19 +33,89 @@ public:
 
     void run();
 
+    // render fixed frames over every sub-chunk layout and print the timings instead of running interactively
+    void setSubChunkSweep(bool enabled) { m_subChunkSweep = enabled; }
+    // fly the benchmark camera path over each scene with fixed seeds and write the results, see benchmark.hpp
+    void setBenchmark(const BenchmarkConfig& config) { m_benchmark = true; m_benchmarkConfig = config; }
+    // vulkan backend: render the startup scene's still (this worker's tiles of it) to an exr and quit, see offline_render.hpp
+    void setOfflineRender(const OfflineRenderConfig& config) { m_offline = true; m_offlineConfig = config; }
+    // start from the packed world next to the scene file when it's still valid (see world_cache.hpp), on by default
+    void setWorldCache(bool enabled) { m_worldCache = enabled; }
+    // rebuild pipelines when files under assets/shaders change, on by default
+    void setShaderHotReload(bool enabled) { m_shaderHotReload = enabled; }
+    // cuda backend: wavefront kernels instead of the per pixel megakernel, off by default
+    void setCudaWavefront(bool enabled) { m_cudaWavefront = enabled; }
+    // vulkan backend: the cuda tracer fills the gbuffer and the vulkan denoiser + post chain present it, see CudaInterop
+    void setCudaInVulkan(bool enabled) { m_cudaInVulkan = enabled; }
+    // gl backend: rasterize greedy meshed chunks instead of running the cuda tracer, off by default
+    void setGlRaster(bool enabled) { m_glRaster = enabled; }
+    // vulkan backend: streaming, chunk rebuilds and packing on a WorldThread instead of between frames, on by default
+    void setWorldThread(bool enabled) { m_worldThreadEnabled = enabled; }
+    // vulkan backend: trace with inline ray queries from compute instead of the rt pipeline when the device has them, off by default
+    void setRayQuery(bool enabled) { m_rayQuery = enabled; }
+    // vulkan backend: frames recorded ahead of the gpu (1-3) and low latency pacing, 2 and off by default
+    void setFramesInFlight(uint32_t frames) { m_framesInFlight = frames; }
+    void setLowLatency(bool enabled) { m_lowLatency = enabled; }
+    // bake per voxel ao into the chunk svos for the raytracer's baked lighting modes (ChunkManager::bakeAmbientOcclusion), off by default
+    void setBakedAo(bool enabled) { m_bakedAo = enabled; }
+    // stream procedural terrain around the camera instead of loading the startup scene, off by default
+    void setTerrain(bool enabled) { m_terrainEnabled = enabled; }
+    // terrain: chunks are loaded from and saved to region files under path, the generator fills in the rest
+    void setWorldDirectory(const std::string& path) { m_worldDirectory = path; }
+    // voxelize an obj as the startup scene, resolution voxels along its longest axis
+    void setStartupMesh(const std::string& path, uint32_t resolution) { m_meshPath = path; m_meshResolution = resolution; }
+    // vulkan backend: light the scene with an hdr/exr equirect sky instead of the analytic one, see Renderer::setEnvironmentMap
+    void setEnvironmentMap(const std::string& path) { m_environmentPath = path; }
+
 private:
     void init();
     void update();
     void shutdown();
 
+    void runSubChunkSweep();
+    void runBenchmark();
+    void runOfflineRender();
+    // import + pack the startup scene into m_gpuWorld, or load it from the world cache
+    void loadStartupWorld(const std::string& path);
+    // hook a TerrainGenerator up to streaming, chunks show up once the residency updates request them
+    void startTerrain(MaterialLibrary& matLib);
+    // voxelize + pack m_meshPath into m_gpuWorld
+    void loadStartupMesh();
+
     GraphicsApi m_backend;
+    bool m_subChunkSweep = false;
+    bool m_benchmark = false;
+    bool m_offline = false;
+    bool m_worldCache = true;
+    bool m_shaderHotReload = true;
+    bool m_cudaWavefront = false;
+    bool m_cudaInVulkan = false;
+    bool m_glRaster = false;
+    bool m_worldThreadEnabled = true;
+    bool m_rayQuery = false;
+    uint32_t m_framesInFlight = 2;
+    bool m_lowLatency = false;
+    bool m_terrainEnabled = false;
+    bool m_bakedAo = false;
+    std::string m_worldDirectory;
+    std::string m_meshPath;
+    uint32_t m_meshResolution = 256;
+    std::string m_environmentPath;
+    BenchmarkConfig m_benchmarkConfig;
+    OfflineRenderConfig m_offlineConfig;
 
     std::shared_ptr<Window>  m_window;
     std::unique_ptr<Renderer> m_renderer;
     std::unique_ptr<RendererGL> m_rendererGL;
     std::unique_ptr<CudaTracer> m_cudaTracer;
+    std::unique_ptr<ChunkRasterGL> m_raster; // replaces the cuda tracer when m_glRaster is set
+    std::unique_ptr<MaterialLibrary> m_cudaMaterials; // the cuda backend has no Renderer to own them
 
     std::unique_ptr<WorldSvoGpu> m_gpuWorld;
+    // owns g_mgr while the interactive vulkan loop runs, null with the cuda tracer (it reads m_gpuWorld directly)
+    std::unique_ptr<WorldThread> m_worldThread;
+    std::unique_ptr<TerrainGenerator> m_terrain; // g_mgr's async loader while it exists
+    std::unique_ptr<RegionStore> m_regions; // in front of m_terrain and g_mgr's saver with m_worldDirectory set
 };
 
 } // namespace blok
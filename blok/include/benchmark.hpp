@@ -0,0 +1,65 @@
+/*
+* File: benchmark.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm.hpp>
+
+#include "camera.hpp"
+
+namespace blok {
+
+// blok --bench [scene.vox ...] [--bench-frames N] [--bench-warmup N] [--bench-seed N] [--bench-out file]
+// scenes are looked up in assets/models when they're not a path
+struct BenchmarkConfig {
+    std::vector<std::string> scenes;
+    uint32_t warmupFrames = 60;
+    uint32_t frames = 600;
+    uint32_t seed = 1337;
+    std::string output = "bench_results.json";
+
+    // castle, menger and room when nothing was given
+    void setDefaultScenes();
+};
+
+struct FrameTimeSummary {
+    float mean = 0.0f;
+    float p50 = 0.0f;
+    float p90 = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+};
+
+struct BenchmarkSceneResult {
+    std::string scene;
+    bool loaded = false;
+    uint32_t frames = 0;
+    uint32_t renderWidth = 0;
+    uint32_t renderHeight = 0;
+    FrameTimeSummary cpuMs;
+    FrameTimeSummary gpuMs;
+    double primaryRaysPerSecond = 0.0; // one primary ray per render pixel per frame, over the gpu time
+    size_t chunks = 0;
+    size_t svoNodes = 0;
+    size_t brickWords = 0;
+    uint64_t deviceBytes = 0; // vma usage over all heaps at the end of the run
+    bool rayQuery = false; // traced with the ray query compute tracer instead of the rt pipeline
+};
+
+// the recorded path: one orbit around the scene bounds with a slow height/radius sway, t in [0, 1)
+Camera benchmarkCamera(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float t);
+
+FrameTimeSummary summarizeFrameTimes(std::vector<float> ms);
+
+// one json object, the config plus one entry per scene
+bool writeBenchmarkResults(const std::string& path, const BenchmarkConfig& config, const std::vector<BenchmarkSceneResult>& results);
+
+}
+
+#endif //BENCHMARK_HPP
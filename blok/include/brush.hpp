@@ -6,20 +6,54 @@
 */
 #ifndef BRUSH_HPP
 #define BRUSH_HPP
+#include <cstdint>
 #include <vec3.hpp>
 
 namespace blok {
 class ChunkManager;
+struct Chunk;
 
 struct Brush {
     glm::vec3 centerWS;
     float radiusWS;
     float value;
     enum Mode { ADD, SUBTRACT } mode;
+    // box is a cube radiusWS from the center to each face, cylinder stands along y, radiusWS around and half tall
+    enum Shape { SPHERE, BOX, CYLINDER } shape = SPHERE;
+    float falloff = 0.0f; // outer fraction of the radius the strength fades out over, 0 is a hard edge
+    float noiseAmplitude = 0.0f; // value noise on the surface, in fractions of the radius
+    float noiseScale = 0.25f; // noise cells per voxel
 };
 
+// one brush in a chunk's local voxel space, laid out like svo_build.comp reads it (8 words)
+struct ChunkBrushOp {
+    glm::vec3 center; // chunk-local, in voxels
+    float radius; // in voxels
+    uint32_t density; // quantized target density
+    uint32_t mode; // Brush::Mode
+    uint32_t pad0 = 0;
+    uint32_t pad1 = 0;
+};
+static_assert(sizeof(ChunkBrushOp) == 32, "expected 32 bytes");
+
+// local voxel box [lo, hi) the op can touch, clipped to the chunk
+void chunkBrushBounds(const ChunkBrushOp& op, uint32_t C, glm::ivec3& lo, glm::ivec3& hi);
+
+// cpu path, one storage brick at a time with the rows vectorised (avx2 picked at runtime on x86).
+// only bricks and chunks whose voxels actually changed are written and marked dirty.
+// one undo step of its own unless the caller has one open (see ChunkManager::beginEdit)
 void applyBrush(ChunkManager& mgr, const Brush& brush);
 
+// gpu path: no per voxel work on the cpu, the brush is queued on every chunk it touches and those
+// chunks are flagged for a gpu svo build (see ChunkManager::gpuSvoBuild), which applies it to the
+// uploaded voxels first. the gpu pass only knows hard edged spheres, anything else (and no gpuSvoBuild)
+// goes through applyBrush
+void applyBrushGpu(ChunkManager& mgr, const Brush& brush);
+
+// applies the chunk's gpu-only brushes to its cpu storage. done lazily, before anything
+// reads or writes the storage on the cpu (cpu svo builds, setVoxel, saving)
+void flushGpuBrushes(Chunk& ch);
+
 }
 
 #endif
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <vector>
 #include <vec3.hpp>
 
+#include "brush.hpp"
+#include "chunk_storage.hpp"
 #include "svo.hpp"
 
 namespace blok {
@@ -20,25 +22,47 @@ struct ChunkCoord {
     }
 };
 
+// the low bits have to be good on their own, ChunkMap masks them off for its slot
 struct ChunkCoordHash {
     size_t operator()(const ChunkCoord &c) const noexcept {
-        uint64_t h = 146527u;
-        h = (h * 16777619ull) ^ static_cast<uint64_t>(c.x);
-        h = (h * 16777619ull) ^ static_cast<uint64_t>(c.y);
-        h = (h * 16777619ull) ^ static_cast<uint64_t>(c.z);
+        uint64_t h = static_cast<uint32_t>(c.x) * 0x9E3779B97F4A7C15ull;
+        h ^= static_cast<uint32_t>(c.y) * 0xC2B2AE3D27D4EB4Full;
+        h ^= static_cast<uint32_t>(c.z) * 0x165667B19E3779F9ull;
+        // murmur3 finalizer
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
         return static_cast<size_t>(h);
     }
 };
 
+// coarsest level of ChunkManager::lodChunks, 8x the voxel edge
+static constexpr uint32_t MAX_CHUNK_LOD = 3;
+
 struct Chunk {
     int32_t cx, cy, cz; // chunk index
-    std::vector<float> density; // size C*C*C
-    std::vector<uint32_t> materialIds;
+    ChunkStorage voxels; // sparse C^3 material + density, only non-empty bricks are allocated. (C >> lod)^3 for lod chunks
     bool dirty;
+    bool rebuilding; // an async svo rebuild is in flight
+    uint32_t svoVersion; // bumped every time svo is rebuilt, lets the gpu packer skip unchanged chunks
+    bool resident; // wanted on the gpu, the packer drops chunks without it (see updateChunkResidency)
+    bool gpuSvo; // svo isn't built on the cpu, the packer has the gpu build it from voxels instead
+    std::vector<ChunkBrushOp> gpuBrushes; // applied on the gpu only so far, voxels doesn't have them yet (see flushGpuBrushes)
+    uint64_t savedEdits; // voxels.editCount() when it was last loaded or saved, unchanged chunks aren't written back
     SvoTree svo;
+    // in place edits to svo since its last rebuild, oldest first. the packer uploads just these when it
+    // has everything before them (see ChunkManager::setVoxelMaterial)
+    std::vector<SvoPatch> svoPatches;
+    // 0 for a full res chunk. lod chunks cover the same C^3 voxels with 2^lod wide ones, their svo is
+    // (maxDepth - lod) levels deep with 2^lod times the voxel size, so it still spans the whole chunk
+    uint32_t lod = 0;
 
     Chunk(int32_t cx_, int32_t cy_, int32_t cz_, uint32_t C, uint32_t maxDepth, const glm::vec3& origin, float voxelSize)
-        : cx(cx_), cy(cy_), cz(cz_), density(C*C*C, 0.0f), materialIds(C*C*C, 0u), dirty(true), svo(maxDepth, origin, voxelSize) {}
+        : cx(cx_), cy(cy_), cz(cz_), voxels(C), dirty(true), rebuilding(false), svoVersion(0), resident(true), gpuSvo(false), savedEdits(0), svo(maxDepth, origin, voxelSize) {}
+
+    [[nodiscard]] bool editedSinceSave() const { return voxels.editCount() != savedEdits || !gpuBrushes.empty(); }
 };
 
 }
@@ -6,35 +6,186 @@
 */
 #ifndef CHUNK_MANAGER_HPP
 #define CHUNK_MANAGER_HPP
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "chunk.hpp"
+#include "chunk_map.hpp"
+#include "job_system.hpp"
 #include "resources.hpp"
 
 namespace blok {
 
+// an svo rebuild running on the job system.
+// works on its own snapshot of the voxel data (shared until the chunk is written again) so edits can't race it
+// the tree's arrays come from the manager's SvoStoragePool, and the chunk's old ones go back to it once swapped in
+struct PendingChunkRebuild {
+    Chunk* chunk;
+    ChunkStorage voxels;
+    SvoTree tree;
+    std::atomic<bool> done{false};
+
+    PendingChunkRebuild(Chunk* ch, SvoStoragePool& pool)
+        : chunk(ch), voxels(ch->voxels),
+          tree(ch->svo.maxDepth, ch->svo.origin, ch->svo.voxelSize) {
+        pool.acquire(tree);
+    }
+};
+
+// a chunk's voxels as they were before an edit step touched it, see ChunkManager::beginEdit.
+// the svo isn't kept, it's rebuilt from the voxels like after any other edit
+struct ChunkSnapshot {
+    ChunkCoord coord;
+    ChunkStorage voxels;
+    std::vector<ChunkBrushOp> gpuBrushes;
+};
+
+// one undo step, every chunk it changed
+struct EditStep {
+    std::vector<ChunkSnapshot> chunks;
+};
+
+// one write for ChunkManager::writeVoxels, in global voxel coords
+struct VoxelWrite {
+    glm::ivec3 voxel;
+    uint32_t materialId;
+    float density = 1.0f;
+};
+
+// streaming residency around a point (usually the camera).
+// off by default, then every chunk stays resident for the whole run
+struct StreamingSettings {
+    bool enabled = false;
+    int viewRadius = 8; // in chunks, chunks within this get packed to the gpu
+    int hysteresis = 1; // extra chunks before a resident chunk is evicted, stops thrashing at the edge
+    size_t gpuBudgetBytes = size_t(512) << 20; // node heap + sub-chunk table, nearest chunks win
+    size_t deviceBudgetBytes = SIZE_MAX; // the same bytes by what the device heap has left, the vulkan renderer sets it
+    size_t cpuBudgetBytes = size_t(2048) << 20; // dense + svo data, only enforced when there's a loader
+    int maxLoadsPerUpdate = 4;
+    // far chunks are kept as coarse stand-ins (ChunkManager::lodChunks) instead of at full res, 0 turns it off.
+    // full res out to lodRadius chunks, one level coarser (2x the voxel edge) every time the distance doubles,
+    // up to this many levels (see ChunkManager::maxChunkLod). hysteresis applies to every level boundary
+    uint32_t lodLevels = 0;
+    int lodRadius = 4;
+};
+
+// fills a freshly created chunk, returns false if there's nothing there
+using ChunkLoader = std::function<bool(Chunk&)>;
+// called right before a chunk with edits since its last load/save is dropped from cpu memory, to write them back out
+using ChunkSaver = std::function<void(const Chunk&)>;
+
+// a chunk read off the main thread, voxels is empty when nothing is stored at coord. a stored chunk
+// without voxels comes back engaged but with no bricks
+struct LoadedChunk {
+    ChunkCoord coord;
+    std::optional<ChunkStorage> voxels;
+    uint32_t lod = 0; // what requestLod asked for, voxels is (C >> lod)^3
+};
+
+// background chunk source for streaming, used instead of loader when set (see RegionStore).
+// request queues a read, collect appends every read that finished since the last call. both run on the main thread
+struct AsyncChunkLoader {
+    std::function<void(const ChunkCoord&)> request;
+    std::function<void(std::vector<LoadedChunk>&)> collect;
+    // optional, a coarse chunk straight from the source (a generator). without it lod chunks are
+    // loaded at full res through request and downsampled
+    std::function<void(const ChunkCoord&, uint32_t lod)> requestLod;
+
+    explicit operator bool() const { return request && collect; }
+};
+
 class ChunkManager {
 public:
-    uint32_t C; // voxels per chunk edge
+    uint32_t C; // voxels per chunk edge, a power of two. 32, 64 and 128 get svo builders compiled for their size
     float voxelSize; // world units per voxel
     uint32_t maxDepth;
 
-    std::unordered_map<ChunkCoord, Chunk*, ChunkCoordHash> chunks;
+    // every chunk in cpu memory. they come from chunkPool, so they're only ever made and dropped through
+    // getOrCreateChunk + releaseChunk
+    ChunkMap chunks;
+    // coarse read-only stand-ins for far chunks, at most one per coord (see StreamingSettings::lodLevels).
+    // kept apart from chunks so edits, saving, replication and undo never see them, they're only ever
+    // made and dropped through setLodChunk + releaseLodChunk. the packer picks between the two with packedChunk
+    ChunkMap lodChunks;
+    ChunkPool chunkPool;
+    // svo arrays of replaced and dropped trees, the next rebuilds take them (see SvoStoragePool)
+    SvoStoragePool svoPool;
 
     MaterialLibrary* materialLib = nullptr;
 
+    // sub-chunk layout for packChunksToGpuSvo, changing it repacks every chunk
+    SubChunkLayout subChunks;
+    // run compressGpuSvoDag after every pack. every pack is then a full repack, meant for mostly static worlds
+    bool svoDag = false;
+    // dirty chunks skip the cpu svo build and get built on the gpu at the next pack (see SvoBuilder).
+    // needs C >= SVO_BRICK_SIZE, gpu built chunks always use the uniform sub-chunk layout
+    bool gpuSvoBuild = false;
+    // cpu rebuilds bake neighbourhood ao into the brick words (SvoTree::bakeAmbientOcclusion) for raygen's baked
+    // lighting modes. baked chunks aren't patched, every edit rebuilds (and rebakes) just the chunk it touched.
+    // gpu built chunks go without
+    bool bakeAmbientOcclusion = false;
+
+    // rebuild workers, created on first use
+    std::unique_ptr<JobSystem> jobs;
+    std::vector<std::unique_ptr<PendingChunkRebuild>> pendingRebuilds;
+
+    // streaming, see updateChunkResidency. without a loader (or asyncLoader) chunks are never dropped from cpu memory
+    StreamingSettings streaming;
+    ChunkLoader loader;
+    AsyncChunkLoader asyncLoader;
+    ChunkSaver saver;
+    std::unordered_set<ChunkCoord, ChunkCoordHash> pendingLoads; // requested from asyncLoader, not back yet
+    std::unordered_set<ChunkCoord, ChunkCoordHash> emptyChunks; // loader said empty, forgotten once out of range
+
+    // instanced chunk blocks (see ChunkInstanceSet), packChunksToGpuSvo hands them to the tlas build.
+    // the source chunks are ordinary chunks parked at INSTANCE_SOURCE_CHUNK_Y, edits to them show up in every placement
+    std::vector<ChunkInstanceSet> instanceSets;
+    static constexpr int32_t INSTANCE_SOURCE_CHUNK_Y = -(1 << 12);
+    int32_t instanceSourceCursor = 0; // next free chunk x in the parking row
+
+    // undo history. snapshots share their bricks with the live chunk until it's written, so a step only
+    // costs the chunks it actually changed. the oldest steps go past maxUndoSteps
+    std::vector<EditStep> undoSteps;
+    std::vector<EditStep> redoSteps;
+    EditStep openEdit; // the step between beginEdit and endEdit
+    uint32_t editDepth = 0;
+    size_t maxUndoSteps = 64;
+
 public:
     ChunkManager(uint32_t C, float voxelSize);
     ~ChunkManager();
 
     void setMaterialLibrary(MaterialLibrary* lib) { materialLib = lib; }
 
+    JobSystem& jobSystem();
+
     glm::ivec3 worldToGlobalVoxel(const glm::vec3& p) const;
     ChunkCoord globalVoxelToChunk(const glm::ivec3& gv) const;
     glm::ivec3 globalVoxelToLocal(const glm::ivec3& gv, const ChunkCoord& cc) const;
     size_t localIndex(int lx, int ly, int lz) const;
 
     Chunk* getOrCreateChunk(const ChunkCoord& cc);
+    // takes ch out of chunks and gives its memory back to the pool
+    void releaseChunk(Chunk* ch);
+
+    // the coarsest lod streaming uses. sub-chunk roots of the coarse tree have to stay above its brick levels
+    [[nodiscard]] uint32_t maxChunkLod() const;
+    // voxels ((C >> lod)^3) become cc's lod chunk, replacing the one there. it's dirty until its svo is built
+    Chunk* setLodChunk(const ChunkCoord& cc, uint32_t lod, ChunkStorage&& voxels);
+    void releaseLodChunk(Chunk* ch);
+    // what gets packed at cc: the full res chunk once its svo is built, the lod chunk until then,
+    // otherwise whichever of them exists
+    [[nodiscard]] const Chunk* packedChunk(const ChunkCoord& cc) const;
+
+    // min chunk of a free block of chunkExtent chunks in the parking row, far below anything a scene uses.
+    // blocks are never handed out twice, with a gap so their sub-chunk aabbs can't touch
+    ChunkCoord allocateInstanceSource(const glm::ivec3& chunkExtent);
 
     void setVoxel(const glm::vec3& worldPos, uint32_t materialId, float density = 1.0f);
 
@@ -46,11 +197,117 @@ public:
     // will return 0 if material empty or not found
     uint32_t getVoxelMaterial(const glm::vec3& worldPos) const;
 
+    // batched setVoxelMaterial. writes are binned by chunk and storage brick first, so every chunk is looked up
+    // once and written brick by brick. same result as writing them one by one in order
+    void writeVoxels(std::span<const VoxelWrite> writes);
+
+    // fn(chunk, lo, hi) once per chunk overlapping the global voxel box [minGV, maxGV), lo/hi is the
+    // part of the box inside it in local coords. missing chunks are created if create is set, skipped otherwise.
+    // for cpu edits, pending gpu brushes are flushed first
+    using RegionFn = std::function<void(Chunk&, const glm::ivec3& lo, const glm::ivec3& hi)>;
+    void forEachChunkInRegion(const glm::ivec3& minGV, const glm::ivec3& maxGV, bool create, const RegionFn& fn);
+
+    // groups every edit until endEdit into one undo step (a brush stroke, say). calls nest, the outermost pair counts.
+    // edits outside a step (world generation, loading) aren't undoable
+    void beginEdit();
+    void endEdit();
+    // snapshots ch into the open step the first time the step touches it, called before writing to it
+    void recordEdit(const Chunk& ch);
+    // false if there's nothing to undo / redo. the chunks are marked dirty and rebuilt like after any edit
+    bool undo();
+    bool redo();
+
+    // fn(globalVoxel, materialId&, density&) for every voxel of [minGV, maxGV), returns false to leave it alone.
+    // goes chunk by chunk in local z/y/x order, chunks in the box are created
+    template<typename Fn>
+    void writeRegion(const glm::ivec3& minGV, const glm::ivec3& maxGV, Fn&& fn);
 };
 
+template<typename Fn>
+void ChunkManager::writeRegion(const glm::ivec3& minGV, const glm::ivec3& maxGV, Fn&& fn) {
+    std::vector<ChunkStorage::Write> batch;
+    forEachChunkInRegion(minGV, maxGV, true, [&](Chunk& ch, const glm::ivec3& lo, const glm::ivec3& hi) {
+        const glm::ivec3 base(ch.cx * static_cast<int32_t>(C), ch.cy * static_cast<int32_t>(C), ch.cz * static_cast<int32_t>(C));
+
+        batch.clear();
+        for (int z = lo.z; z < hi.z; z++)
+        for (int y = lo.y; y < hi.y; y++)
+        for (int x = lo.x; x < hi.x; x++) {
+            uint32_t materialId = 0;
+            float density = 0.0f;
+            if (!fn(glm::ivec3(base.x + x, base.y + y, base.z + z), materialId, density)) continue;
+            batch.push_back({static_cast<uint32_t>(x), static_cast<uint32_t>(y), static_cast<uint32_t>(z), materialId, density});
+        }
+        if (batch.empty()) return;
+
+        ch.voxels.set(batch.data(), batch.size());
+        ch.dirty = true;
+    });
+}
+
+// cpu svo rebuild of one chunk from its storage, what the rebuild jobs run
+void buildSvoFromDensity(Chunk* ch, uint32_t C, bool bakeAo = false);
+
+// one lod step, half fine's edge. a coarse voxel is filled if any voxel of its 2^3 block is, with the
+// block's most common material and its mean density
+ChunkStorage downsampleChunkStorage(const ChunkStorage& fine);
+
+// true if ch's cpu svo matches its voxels, edits can then patch it in place (see SvoTree::patchFromStorage)
+// instead of marking the chunk dirty
+bool svoPatchable(const Chunk& ch);
+// bumps ch's svoVersion and logs patch for the packer, which then uploads just its spans
+void commitSvoPatch(Chunk& ch, SvoPatch&& patch);
+
+// rebuilds up to maxPerFrame dirty chunks in parallel, returns once they're all done.
+// with gpuSvoBuild set the chunks are only flagged for a gpu build
 void rebuildDirtyChunks(ChunkManager& mgr, int maxPerFrame);
+
+// kicks off up to maxPerFrame rebuilds in the background and returns right away.
+// call collectRebuiltChunks on the main thread (before packChunksToGpuSvo) to swap finished trees in
+void rebuildDirtyChunksAsync(ChunkManager& mgr, int maxPerFrame);
+
+// swaps in every finished async rebuild, returns how many chunks got a new tree
+int collectRebuiltChunks(ChunkManager& mgr);
 void packChunksToGpuSvo(const ChunkManager& mgr, WorldSvoGpu& gpuWorld);
 
+// optional stage after packChunksToGpuSvo. rewrites the node + brick heaps as one dag shared by every chunk:
+// identical subtrees (geometry only) are stored once, materials move to a per-chunk side channel.
+// the per-chunk ranges are gone afterwards, so the next packChunksToGpuSvo repacks everything
+void compressGpuSvoDag(const ChunkManager& mgr, WorldSvoGpu& gpuWorld);
+
+// rebuilds gpuWorld's emissive light list when a packed chunk changed, called at the end of packChunksToGpuSvo.
+// only voxels with an open face count, instanced chunks get one light per placement
+void gatherEmissiveLights(const ChunkManager& mgr, WorldSvoGpu& gpuWorld);
+
+// rebuilds gpuWorld's surface mesh (the rasterized primary visibility) when a packed chunk changed, called next to
+// gatherEmissiveLights. greedy quads over the open voxel faces, never crossing a sub-chunk so each keeps its cell
+void buildSurfaceMesh(const ChunkManager& mgr, WorldSvoGpu& gpuWorld);
+
+// one greedy rectangle of open voxel faces, chunk-local. the plane is at 'plane' along the face's axis (face / 2),
+// the rectangle covers [u, u + w) x [v, v + h) along the next two axes, (axis + 1) % 3 and (axis + 2) % 3
+struct GreedyQuad {
+    uint32_t material; // material id + 1
+    uint32_t face; // +X -X +Y -Y +Z -Z, hit.rchit's order
+    int32_t plane, u, v, w, h;
+};
+
+// every open face of the chunk merged into rectangles of one material, never crossing a multiple of cellSize.
+// buildSurfaceMesh cuts at the sub-chunks, the gl raster path at nothing (cellSize = C)
+void greedyMeshChunk(const ChunkStorage& storage, uint32_t cellSize, std::vector<GreedyQuad>& out);
+
+// rebuilds gpuWorld's empty space distance field when a packed chunk changed, called next to gatherEmissiveLights.
+// intersect.rint leapfrogs through the empty bricks it promises before the first node fetch
+void buildEmptySpaceField(const ChunkManager& mgr, WorldSvoGpu& gpuWorld);
+
+// loads chunks around center through mgr.loader, marks the nearest ones that fit the gpu budget
+// resident and evicts far chunks from cpu memory when over budget. with streaming.lodLevels set, chunks past
+// lodRadius are swapped for lod chunks (downsampled, or from asyncLoader.requestLod) and loaded back as they come closer.
+// returns true if the resident set changed, the caller should repack + upload
+bool updateChunkResidency(ChunkManager& mgr, const glm::vec3& center);
+
+// hands every chunk with edits since its last load/save to mgr.saver, e.g. before shutdown. returns how many
+size_t saveEditedChunks(ChunkManager& mgr);
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,167 @@
+/*
+* File: chunk_map.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef CHUNK_MAP_HPP
+#define CHUNK_MAP_HPP
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "chunk.hpp"
+
+namespace blok {
+
+// ChunkCoord -> Chunk* in one flat array, linear probing, for ChunkManager::chunks.
+// erase shifts the rest of the probe run back instead of leaving tombstones, so a lookup never walks dead slots.
+// find remembers the slot it last hit, a run of voxel writes into the same chunk doesn't probe at all.
+// finds may run on several threads at once (the brush + import workers), anything that modifies it may not
+class ChunkMap {
+public:
+    // an empty slot holds nullptr, a stored chunk never is
+    using value_type = std::pair<ChunkCoord, Chunk*>;
+
+    class iterator {
+    public:
+        iterator(const value_type* at, const value_type* end) : m_at(at), m_end(end) { skip(); }
+
+        const value_type& operator*() const { return *m_at; }
+        const value_type* operator->() const { return m_at; }
+        iterator& operator++() { ++m_at; skip(); return *this; }
+        bool operator==(const iterator& o) const { return m_at == o.m_at; }
+        bool operator!=(const iterator& o) const { return m_at != o.m_at; }
+
+    private:
+        void skip() { while (m_at != m_end && !m_at->second) ++m_at; }
+        const value_type* m_at;
+        const value_type* m_end;
+    };
+
+    ChunkMap() = default;
+    ChunkMap(const ChunkMap&) = delete;
+    ChunkMap& operator=(const ChunkMap&) = delete;
+
+    [[nodiscard]] size_t size() const { return m_size; }
+    [[nodiscard]] bool empty() const { return m_size == 0; }
+
+    iterator begin() const { return { m_slots.data(), m_slots.data() + m_slots.size() }; }
+    iterator end() const { return { m_slots.data() + m_slots.size(), m_slots.data() + m_slots.size() }; }
+
+    iterator find(const ChunkCoord& key) const {
+        const size_t slot = locate(key);
+        return slot == NONE ? end() : iterator{ m_slots.data() + slot, m_slots.data() + m_slots.size() };
+    }
+    [[nodiscard]] size_t count(const ChunkCoord& key) const { return locate(key) == NONE ? 0 : 1; }
+
+    // key must not be stored yet
+    void insert(const ChunkCoord& key, Chunk* chunk) {
+        // grows at 3/4 full, linear probing falls apart past that
+        if ((m_size + 1) * 4 > m_slots.size() * 3) rehash(m_slots.empty() ? MIN_SLOTS : m_slots.size() * 2);
+
+        size_t i = home(key);
+        while (m_slots[i].second) i = (i + 1) & m_mask;
+        m_slots[i] = { key, chunk };
+        m_size++;
+    }
+
+    size_t erase(const ChunkCoord& key) {
+        size_t i = locate(key);
+        if (i == NONE) return 0;
+
+        // pull every later entry of the run whose home isn't between the hole and it back into the hole
+        for (size_t j = (i + 1) & m_mask; m_slots[j].second; j = (j + 1) & m_mask) {
+            if (((j - home(m_slots[j].first)) & m_mask) >= ((j - i) & m_mask)) {
+                m_slots[i] = m_slots[j];
+                i = j;
+            }
+        }
+        m_slots[i] = { {}, nullptr };
+        m_size--;
+        return 1;
+    }
+
+    void clear() {
+        m_slots.clear();
+        m_mask = 0;
+        m_size = 0;
+    }
+
+private:
+    static constexpr size_t MIN_SLOTS = 64;
+    static constexpr size_t NONE = ~size_t{0};
+
+    size_t home(const ChunkCoord& key) const { return ChunkCoordHash{}(key) & m_mask; }
+
+    size_t locate(const ChunkCoord& key) const {
+        if (m_size == 0) return NONE;
+
+        // a stale slot from before an erase or a rehash just fails the key test
+        const size_t last = m_last.load(std::memory_order_relaxed);
+        if (last < m_slots.size() && m_slots[last].second && m_slots[last].first == key) return last;
+
+        for (size_t i = home(key); m_slots[i].second; i = (i + 1) & m_mask) {
+            if (m_slots[i].first == key) {
+                m_last.store(i, std::memory_order_relaxed);
+                return i;
+            }
+        }
+        return NONE;
+    }
+
+    void rehash(size_t slots) {
+        std::vector<value_type> old = std::move(m_slots);
+        m_slots.assign(slots, { {}, nullptr });
+        m_mask = slots - 1;
+        m_size = 0;
+        for (const value_type& e : old)
+            if (e.second) insert(e.first, e.second);
+    }
+
+    std::vector<value_type> m_slots;
+    size_t m_mask = 0;
+    size_t m_size = 0;
+    mutable std::atomic<size_t> m_last{ NONE };
+};
+
+// chunks are carved out of fixed size blocks and go back on a free list, a streamed world keeps reusing the same
+// memory instead of a heap allocation per load
+class ChunkPool {
+public:
+    ChunkPool() = default;
+    ChunkPool(const ChunkPool&) = delete;
+    ChunkPool& operator=(const ChunkPool&) = delete;
+
+    template <typename... Args>
+    Chunk* create(Args&&... args) {
+        if (m_free.empty()) {
+            m_blocks.push_back(std::make_unique<Slot[]>(BLOCK_CHUNKS));
+            Slot* block = m_blocks.back().get();
+            for (size_t i = BLOCK_CHUNKS; i > 0; --i) m_free.push_back(block + i - 1);
+        }
+        Slot* slot = m_free.back();
+        m_free.pop_back();
+        return new (slot->storage) Chunk(std::forward<Args>(args)...);
+    }
+
+    void destroy(Chunk* chunk) {
+        chunk->~Chunk();
+        m_free.push_back(reinterpret_cast<Slot*>(chunk));
+    }
+
+private:
+    static constexpr size_t BLOCK_CHUNKS = 64;
+    struct Slot {
+        alignas(Chunk) std::byte storage[sizeof(Chunk)];
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> m_blocks;
+    std::vector<Slot*> m_free;
+};
+
+}
+#endif //CHUNK_MAP_HPP
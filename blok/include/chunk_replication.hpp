@@ -0,0 +1,75 @@
+/*
+* File: chunk_replication.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef CHUNK_REPLICATION_HPP
+#define CHUNK_REPLICATION_HPP
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_manager.hpp"
+
+namespace blok {
+
+static constexpr uint32_t REPLICATION_VERSION = 1;
+// remote edits up to this many voxels per chunk are patched into an up to date svo, bigger ones rebuild it
+static constexpr size_t REPLICATION_PATCH_MAX_VOXELS = 256;
+
+// how messages get to the other editors, anything reliable and ordered. send goes to every peer,
+// receive appends every message that came in since the last call. both on the thread that owns the manager
+struct ReplicationTransport {
+    std::function<void(const std::vector<uint8_t>&)> send;
+    std::function<void(std::vector<std::vector<uint8_t>>&)> receive;
+
+    explicit operator bool() const { return send && receive; }
+};
+
+// keeps several editors' copies of one world in step by trading chunk edits.
+// a message is a batch of chunk deltas keyed by ChunkCoord: the storage bricks written since the peers last heard
+// of the chunk (gap coded brick indices) and each of them as material/density runs, all of it varint coded. what a
+// delta costs to send and to apply follows the bricks the edit touched, not what the chunk holds.
+// every peer has to start from the same world (markAllSynced after loading it). bricks are the unit of conflict,
+// the last delta a peer applies to a brick wins. remote edits aren't undo steps
+class ChunkReplicator {
+public:
+    explicit ChunkReplicator(ChunkManager& mgr) : m_mgr(mgr) {}
+
+    // what's in mgr now counts as known to every peer
+    void markAllSynced();
+
+    // one message with every chunk edited locally since the last collect, false (out untouched) if there's nothing.
+    // chunks with pending gpu brushes are flushed to their voxels first
+    bool collect(std::vector<uint8_t>& out);
+
+    // writes a peer's message through the batched storage writes. small edits patch the chunk's svo in place
+    // (see svoPatchable), the rest mark it dirty. false (nothing applied) if the message is corrupt or for another C
+    bool apply(const uint8_t* data, size_t size);
+
+    // collect + send, then receive + apply. returns how many messages were applied
+    size_t exchange(const ReplicationTransport& transport);
+
+    struct Stats {
+        uint64_t sentBytes = 0;
+        uint64_t sentBricks = 0;
+        uint64_t receivedBytes = 0;
+        uint64_t receivedBricks = 0;
+        uint64_t rejected = 0; // messages apply turned down
+    };
+    [[nodiscard]] const Stats& stats() const { return m_stats; }
+
+private:
+    // the chunk's edit count the peers are known to have, everything after it still has to go out
+    [[nodiscard]] uint64_t syncedEdits(const Chunk& ch) const;
+
+    ChunkManager& m_mgr;
+    std::unordered_map<ChunkCoord, uint64_t, ChunkCoordHash> m_synced;
+    Stats m_stats;
+};
+
+}
+
+#endif //CHUNK_REPLICATION_HPP
@@ -0,0 +1,151 @@
+/*
+* File: chunk_storage.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef CHUNK_STORAGE_HPP
+#define CHUNK_STORAGE_HPP
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace blok {
+
+// sparse voxel storage for one chunk.
+// the chunk is split into 8^3 bricks, all-empty bricks take no memory (just an entry in the brick table).
+// materials are 16 bit indices into a per chunk palette, density is quantized to 8 bits (0 = empty).
+// copies are snapshots: they share the bricks until one side writes, which then clones them for itself.
+// a snapshot can be read on another thread while the original keeps getting written
+class ChunkStorage {
+public:
+    static constexpr uint32_t MAX_BRICK_SHIFT = 3;
+    static constexpr uint32_t MAX_BRICK_VOXELS = 1u << (3 * MAX_BRICK_SHIFT);
+    static constexpr uint32_t EMPTY_BRICK = 0xFFFFFFFFu;
+
+    struct Brick {
+        uint16_t material[MAX_BRICK_VOXELS]; // palette index, index x + y*B + z*B*B
+        uint8_t density[MAX_BRICK_VOXELS];
+        uint32_t filled; // voxels with density > 0, the brick is freed when this drops to 0
+    };
+
+    // one write for the batched set(), local coords
+    struct Write {
+        uint32_t x, y, z;
+        uint32_t materialId;
+        float density;
+    };
+
+    // C = voxels per chunk edge (power of two)
+    explicit ChunkStorage(uint32_t C);
+    ChunkStorage(const ChunkStorage& other);
+    ChunkStorage(ChunkStorage&& other) noexcept = default;
+    ChunkStorage& operator=(const ChunkStorage& other);
+    ChunkStorage& operator=(ChunkStorage&& other) noexcept;
+    ~ChunkStorage();
+
+    // density <= 0 clears the voxel
+    void set(uint32_t x, uint32_t y, uint32_t z, uint32_t materialId, float density);
+    // set() for every write in order, the palette is only looked up when the material changes
+    void set(const Write* writes, size_t count);
+    // keeps the voxel's material, for brushes
+    void setDensity(uint32_t x, uint32_t y, uint32_t z, float density);
+
+    // bulk density edits one brick at a time: read the brick's quantized densities (brickSize()^3, index
+    // x + y*B + z*B*B, all 0 for an empty brick), change them, write them back. materials are kept like setDensity.
+    // the write allocates or frees the brick as needed and returns false (touching nothing) if nothing changed
+    void readBrickDensity(uint32_t bx, uint32_t by, uint32_t bz, uint8_t* out) const;
+    bool writeBrickDensity(uint32_t bx, uint32_t by, uint32_t bz, const uint8_t* density);
+
+    [[nodiscard]] float density(uint32_t x, uint32_t y, uint32_t z) const;
+    // 0 for voxels in empty bricks
+    [[nodiscard]] uint32_t material(uint32_t x, uint32_t y, uint32_t z) const;
+
+    void clear();
+    // back to snapshot's voxels, the edit count keeps going up so savers still see a change
+    void restore(const ChunkStorage& snapshot);
+
+    [[nodiscard]] uint32_t size() const { return m_C; }
+    [[nodiscard]] uint32_t brickShift() const { return m_brickShift; }
+    [[nodiscard]] uint32_t brickSize() const { return 1u << m_brickShift; }
+    [[nodiscard]] uint32_t bricksPerAxis() const { return m_bricksPerAxis; }
+    [[nodiscard]] uint32_t allocatedBricks() const {
+        return static_cast<uint32_t>(m_content->bricks.size() - m_content->freeBricks.size());
+    }
+    // bumped by every write and clear, tells a saver whether anything changed since it last looked
+    [[nodiscard]] uint64_t editCount() const { return m_edits; }
+    // brick table indices (bx + by*n + bz*n*n, ascending) of the bricks written after editCount() was since. every
+    // brick after a clear or restore since then. a scan of the brick table, the voxels aren't looked at
+    void changedBricks(uint64_t since, std::vector<uint32_t>& out) const;
+    // true while neither side has written since one was copied from the other
+    [[nodiscard]] bool sharesContent(const ChunkStorage& other) const { return m_content == other.m_content; }
+
+    // nullptr if every voxel in the brick is empty
+    [[nodiscard]] const Brick* brick(uint32_t bx, uint32_t by, uint32_t bz) const {
+        const uint32_t b = m_content->brickIndex[brickTableIndex(bx, by, bz)];
+        return b == EMPTY_BRICK ? nullptr : &m_content->bricks[b];
+    }
+    [[nodiscard]] uint32_t paletteMaterial(uint16_t index) const { return m_content->palette[index]; }
+
+    [[nodiscard]] static uint8_t quantizeDensity(float d);
+    [[nodiscard]] static float dequantizeDensity(uint8_t q) { return static_cast<float>(q) * (1.0f / 255.0f); }
+
+    // heap bytes held, for memory budgets
+    [[nodiscard]] size_t memoryBytes() const;
+
+private:
+    [[nodiscard]] uint32_t brickTableIndex(uint32_t bx, uint32_t by, uint32_t bz) const {
+        return bx + by * m_bricksPerAxis + bz * m_bricksPerAxis * m_bricksPerAxis;
+    }
+    [[nodiscard]] uint32_t voxelIndex(uint32_t x, uint32_t y, uint32_t z) const {
+        const uint32_t mask = (1u << m_brickShift) - 1u;
+        return (x & mask) | ((y & mask) << m_brickShift) | ((z & mask) << (2 * m_brickShift));
+    }
+
+    // how many storages hold a Content. not shared_ptr::use_count(), that's a relaxed read: a snapshot dropped on a
+    // rebuild thread releases here and mutableContent acquires, so the snapshot's last reads happen before the
+    // owner writes in place. every holder is counted in through holdContent, a copied Content starts with none
+    struct HolderCount {
+        std::atomic<uint32_t> count{0};
+        HolderCount() = default;
+        HolderCount(const HolderCount&) {}
+        HolderCount& operator=(const HolderCount&) { return *this; }
+    };
+
+    // everything a write can touch, shared between copies
+    struct Content {
+        std::vector<uint32_t> brickIndex; // bricksPerAxis^3, EMPTY_BRICK or index into bricks
+        std::vector<Brick> bricks;
+        std::vector<uint32_t> freeBricks;
+        std::vector<uint64_t> brickEdits; // bricksPerAxis^3, editCount() right after the last write to each brick
+
+        std::vector<uint32_t> palette; // palette index -> material id
+        std::unordered_map<uint32_t, uint16_t> paletteLookup;
+
+        HolderCount holders;
+    };
+
+    // m_content, cloned first if a snapshot still holds it. only the owner ever copies a storage, so a count
+    // of 1 can't go back up behind its back
+    Content& mutableContent();
+    [[nodiscard]] bool contentShared() const { return m_content->holders.count.load(std::memory_order_acquire) > 1; }
+    // m_content becomes content (one more holder), or nothing. the old one loses this holder
+    void holdContent(std::shared_ptr<Content> content);
+    static uint16_t paletteIndex(Content& content, uint32_t materialId);
+    void writeVoxel(Content& content, uint32_t x, uint32_t y, uint32_t z, const uint16_t* material, uint8_t density);
+
+    uint32_t m_C;
+    uint32_t m_brickShift;
+    uint32_t m_bricksPerAxis;
+    uint64_t m_edits = 0;
+    uint64_t m_lastReset = 0; // editCount() after the last clear or restore
+
+    std::shared_ptr<Content> m_content;
+};
+
+}
+
+#endif
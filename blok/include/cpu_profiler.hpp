@@ -0,0 +1,101 @@
+/*
+* File: cpu_profiler.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef CPU_PROFILER_HPP
+#define CPU_PROFILER_HPP
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// define to compile every BLOK_PROFILE_* out, the profiler class stays but nothing records into it
+// #define BLOK_NO_CPU_PROFILER
+
+namespace blok {
+
+// scoped cpu timings from any thread, exported as chrome trace json (chrome://tracing, ui.perfetto.dev).
+// meant for the world pipeline (load, rebuild, pack, upload, as builds), a handful of events per frame.
+// one mutex around the event list, the scopes here are long enough that it doesn't show up
+class CpuProfiler {
+public:
+    // events past this are dropped until clear(), keeps a forgotten recording from eating memory
+    static constexpr size_t MAX_EVENTS = 1u << 18;
+
+    struct Event {
+        const char* name = nullptr; // string literal
+        std::string detail;         // free form, shows up as args.detail
+        uint64_t startUs = 0;
+        uint64_t durationUs = 0;
+        uint32_t thread = 0;
+    };
+
+    static CpuProfiler& instance();
+
+    void setRecording(bool on) { m_recording.store(on, std::memory_order_relaxed); }
+    bool recording() const { return m_recording.load(std::memory_order_relaxed); }
+
+    void record(const char* name, std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end, std::string detail = {});
+    void clear();
+    size_t eventCount() const;
+
+    bool exportChromeTrace(const std::string& path) const;
+
+    // small stable id per thread, the main thread is whichever asks first
+    static uint32_t threadIndex();
+
+private:
+    CpuProfiler() : m_epoch(std::chrono::steady_clock::now()) {}
+
+    std::chrono::steady_clock::time_point m_epoch;
+    std::atomic<bool> m_recording{ true };
+    mutable std::mutex m_mutex;
+    std::vector<Event> m_events;
+};
+
+// times its own lifetime
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name) : m_name(name), m_start(std::chrono::steady_clock::now()) {}
+    ScopedTimer(const char* name, std::string detail)
+        : m_name(name), m_detail(std::move(detail)), m_start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        CpuProfiler& p = CpuProfiler::instance();
+        if (p.recording()) p.record(m_name, m_start, std::chrono::steady_clock::now(), std::move(m_detail));
+    }
+
+    // for details only known once the work is done (node counts, ...)
+    void setDetail(std::string detail) { m_detail = std::move(detail); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    const char* m_name;
+    std::string m_detail;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+}
+
+#define BLOK_PROFILE_CONCAT_INNER(a, b) a##b
+#define BLOK_PROFILE_CONCAT(a, b) BLOK_PROFILE_CONCAT_INNER(a, b)
+
+#ifndef BLOK_NO_CPU_PROFILER
+// BLOK_PROFILE_SCOPE("name") for the rest of the block, BLOK_PROFILE_NAMED(var, "name") when the
+// detail gets filled in later through BLOK_PROFILE_DETAIL(var, expr)
+#define BLOK_PROFILE_SCOPE(name) ::blok::ScopedTimer BLOK_PROFILE_CONCAT(blokProfileScope, __LINE__){ name }
+#define BLOK_PROFILE_NAMED(var, name) ::blok::ScopedTimer var{ name }
+#define BLOK_PROFILE_DETAIL(var, expr) var.setDetail(expr)
+#else
+#define BLOK_PROFILE_SCOPE(name) ((void)0)
+#define BLOK_PROFILE_NAMED(var, name) ((void)0)
+#define BLOK_PROFILE_DETAIL(var, expr) ((void)0)
+#endif
+
+#endif //CPU_PROFILER_HPP
@@ -13,9 +13,11 @@
 
 // forward decl so non-CUDA TUs don't need CUDA headers
 struct float4;
+struct CUstream_st; // cudaStream_t
 
 namespace blok {
 struct Scene;
+struct WorldSvoGpu;
 
 class Window;
 class RendererGL;
@@ -23,7 +25,7 @@ class RendererGL;
 class CudaTracer {
 public:
     CudaTracer(unsigned int width, unsigned int height);
-    ~CudaTracer() = default;
+    ~CudaTracer();
 
     void init();
     void drawFrame(Camera& cam, const Scene& scene);
@@ -35,18 +37,56 @@ public:
     unsigned int getGLTex() const { return m_glTex; }
     void resetAccum();
 
+    // trace this voxel world instead of the analytic scene, nullptr goes back to the scene.
+    // the tracer consumes the world's dirty ranges like Renderer::uploadSvoBuffers does,
+    // so only one backend may draw a given world
+    void setWorld(WorldSvoGpu* world);
+
+    // separate generate / extend / shade / shadow kernels with compacted queues instead of one
+    // thread per pixel looping over every bounce. same estimator, so the image doesn't restart
+    void setWavefront(bool enabled) { m_useWavefront = enabled; }
+    bool wavefront() const { return m_useWavefront; }
+
+    // Renderer::setExternalTracer target: traces the world into the renderer's exported gbuffer slot and signals
+    // its semaphore, the vulkan denoiser + post chain present it. no init() (no gl), the first frame picks the
+    // cuda device the renderer runs on
+    void traceToVulkan(const ExternalTraceFrame& frame);
+
     struct CamSig { float pos[3], fwd[3], right[3], up[3], fov; };
 
 private:
+    // persistent device copies of the scene and the voxel world, defined in the .cu
+    struct DeviceScene;
+    struct DeviceWorld;
+    struct Wavefront;
+    struct VulkanTargets;
+
     void cleanup();
+    void createPbos();
+    void destroyPbos();
+    void uploadScene(const Scene& scene);
+    void uploadWorld();
+    void importVulkan(const ExternalTraceFrame& frame);
 
     unsigned int m_width  = 0;
     unsigned int m_height = 0;
 
-    unsigned int m_pbo    = 0;
+    // double buffered: cuda writes m_pbo[m_pboIndex] while gl uploads last frame's from the other one
+    static constexpr int PBO_COUNT = 2;
+    unsigned int m_pbo[PBO_COUNT] = {};
     unsigned int m_glTex  = 0;
 
-    struct cudaGraphicsResource* m_cudaPBO = nullptr;
+    struct cudaGraphicsResource* m_cudaPBO[PBO_COUNT] = {};
+    uint32_t m_pboIndex = 0;
+    bool m_pboReady = false; // the other pbo holds a finished frame
+
+    CUstream_st* m_stream = nullptr; // everything cuda does goes on this, in order
+    std::unique_ptr<DeviceScene> m_scene;
+    std::unique_ptr<DeviceWorld> m_deviceWorld;
+    WorldSvoGpu* m_world = nullptr;
+    std::unique_ptr<Wavefront> m_wavefront;
+    bool m_useWavefront = false;
+    std::unique_ptr<VulkanTargets> m_vulkan;
 
     float4*   m_dAccum     = nullptr; // xyz=sum, w=spp
     uint32_t  m_frameIndex = 0;
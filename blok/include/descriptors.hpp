@@ -6,7 +6,9 @@
 */
 #ifndef DESCRIPTORS_HPP
 #define DESCRIPTORS_HPP
+#include <cstring>
 #include <deque>
+#include <initializer_list>
 #include <unordered_map>
 #include <span>
 #include "vulkan_context.hpp"
@@ -25,6 +27,25 @@ struct DescriptorWriter {
     void updateSet(vk::Device device, vk::DescriptorSet set);
 };
 
+// what a descriptor set was last written with. per-frame updaters build one from the handles they bind
+// and only call updateDescriptorSets when it changed
+struct DescriptorSetKey {
+    std::vector<uint64_t> values;
+
+    // true if values differs from last time, remembers it either way
+    bool changed(std::initializer_list<uint64_t> now);
+    void reset() { values.clear(); }
+};
+
+// vk handle -> key value
+template<typename Handle>
+uint64_t descriptorKey(Handle h) {
+    const auto raw = static_cast<typename Handle::CType>(h);
+    uint64_t key = 0;
+    std::memcpy(&key, &raw, sizeof(raw));
+    return key;
+}
+
 struct DescriptorAllocatorGrowable {
 public:
     struct PoolSizeRatio {
@@ -0,0 +1,50 @@
+/*
+* File: dynamic_resolution.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef DYNAMIC_RESOLUTION_HPP
+#define DYNAMIC_RESOLUTION_HPP
+#include "vulkan_context.hpp"
+
+namespace blok {
+
+// picks the ray tracing/denoise resolution from measured gpu frame time. the scale is snapped to settings.step
+// and only moves after cooldownFrames, every change drops the denoiser history so it shouldn't flicker
+class DynamicResolution {
+public:
+    struct Settings {
+        bool enabled = false;
+        float targetMs = 16.6f;
+        float minScale = 0.5f;
+        float maxScale = 1.0f;
+        float step = 0.05f;
+        int cooldownFrames = 30;
+        // fraction of the budget the frame has to drop under before scaling back up
+        float headroom = 0.85f;
+        // scale while disabled, the upscaler preset (PostProcess::upscaleScale)
+        float baseScale = 1.0f;
+    } settings;
+
+    // one gpu frame time, true when scale() changed
+    bool update(float gpuMs);
+
+    // back to maxScale (baseScale when disabled), true when that changed it
+    bool reset();
+
+    float scale() const { return m_scale; }
+    float averageMs() const { return m_averageMs; }
+
+    // output extent scaled, never below 1x1
+    vk::Extent2D renderExtent(vk::Extent2D output) const;
+
+private:
+    float m_scale = 1.0f;
+    float m_averageMs = 0.0f;
+    int m_cooldown = 0;
+};
+
+}
+
+#endif //DYNAMIC_RESOLUTION_HPP
@@ -0,0 +1,35 @@
+/*
+* File: environment_map.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef ENVIRONMENT_MAP_HPP
+#define ENVIRONMENT_MAP_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "resources.hpp"
+
+namespace blok {
+
+// an equirectangular hdr sky. rows go from +y (top) down to -y, u = 0.5 looks down -z and u grows towards +x
+struct EnvironmentMap {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<glm::vec3> radiance; // width * height, rows top down
+
+    [[nodiscard]] bool empty() const { return width == 0 || height == 0; }
+};
+
+// radiance .hdr (rgbe, flat or rle scanlines, -Y H +X W only) or anything readExr takes, by extension
+bool loadEnvironmentMap(const std::string& path, EnvironmentMap& out, std::string* err = nullptr);
+
+// one texel per pixel: its radiance plus a walker alias table over luminance * sin(theta), the solid angle a row covers.
+// raygen picks a texel in O(1) from that and samples inside it uniformly in uv, see sampleEnvironment
+void buildEnvironmentTexels(const EnvironmentMap& env, std::vector<EnvironmentTexelGpu>& out);
+
+}
+
+#endif //ENVIRONMENT_MAP_HPP
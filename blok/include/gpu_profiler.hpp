@@ -0,0 +1,81 @@
+/*
+* File: gpu_profiler.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef GPU_PROFILER_HPP
+#define GPU_PROFILER_HPP
+#include <array>
+#include <string>
+#include <vector>
+#include "vulkan_context.hpp"
+
+namespace blok {
+
+// timestamp queries around named scopes, one query pool per frame in flight. a frame's results are read
+// back once its fence signalled, so the numbers are always a couple of frames old.
+// scopes nest, the top level ones (one per queue submit) add up to the frame's gpu time
+class GpuProfiler {
+public:
+    static constexpr uint32_t MAX_SCOPES = 64;
+    static constexpr uint32_t HISTORY_SIZE = 120;
+    static constexpr uint32_t NO_SCOPE = ~0u;
+
+    struct PassHistory {
+        std::string name;
+        uint32_t depth = 0;
+        std::array<float, HISTORY_SIZE> ms{}; // oldest first, 0 when the pass didn't run
+        float averageMs = 0.0f;
+        bool active = false; // ran in the latest resolved frame
+    };
+
+    // queueFamilies: every family scopes get recorded on, all need timestamp bits
+    void init(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t framesInFlight, std::initializer_list<uint32_t> queueFamilies);
+    void cleanup();
+
+    bool supported() const { return !m_pools.empty(); }
+
+    // first command buffer of the frame, resets the frame's queries
+    void beginFrame(vk::CommandBuffer cmd, uint32_t frameIndex);
+    uint32_t begin(vk::CommandBuffer cmd, const char* name);
+    void end(vk::CommandBuffer cmd, uint32_t scope);
+
+    // after frameIndex's fence, reads what it recorded. false when there was nothing
+    bool resolve(uint32_t frameIndex);
+
+    float frameMs() const { return m_frameMs; }
+    const std::array<float, HISTORY_SIZE>& frameHistory() const { return m_frameHistory; }
+    const std::vector<PassHistory>& passes() const { return m_passes; }
+
+    // frame,total,<one column per pass> for the whole history, oldest row first
+    bool exportCsv(const std::string& path) const;
+
+private:
+    struct Scope {
+        const char* name = nullptr;
+        uint32_t depth = 0;
+    };
+    struct FrameQueries {
+        std::vector<Scope> scopes;
+        bool recorded = false;
+    };
+
+    PassHistory& history(const char* name, uint32_t depth);
+
+    vk::Device m_device{};
+    float m_timestampPeriod = 1.0f; // ns per tick
+    std::vector<vk::QueryPool> m_pools;
+    std::vector<FrameQueries> m_frames;
+    uint32_t m_recordingFrame = 0;
+    uint32_t m_depth = 0;
+
+    float m_frameMs = 0.0f;
+    std::array<float, HISTORY_SIZE> m_frameHistory{};
+    std::vector<PassHistory> m_passes;
+    uint64_t m_resolvedFrames = 0;
+};
+
+}
+
+#endif //GPU_PROFILER_HPP
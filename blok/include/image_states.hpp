@@ -20,7 +20,8 @@ struct ImageState {
 
 class ImageTransitions {
 public:
-    explicit ImageTransitions(vk::CommandBuffer cmd) : cmd(cmd) {}
+    // computeQueue: cmd goes to a compute only queue, graphics and ray tracing stages get widened to all commands
+    explicit ImageTransitions(vk::CommandBuffer cmd, bool computeQueue = false) : cmd(cmd), computeQueue(computeQueue) {}
 
     void ensure(Image& img, Role dst) {
         auto desired = toLayout(dst);
@@ -29,9 +30,9 @@ public:
         vk::ImageMemoryBarrier2 b{};
         b.oldLayout = img.currentLayout;
         b.newLayout = desired.layout;
-        b.srcStageMask = stagesFor(img.currentLayout);
+        b.srcStageMask = queueStages(stagesFor(img.currentLayout));
         b.srcAccessMask = accessFor(img.currentLayout);
-        b.dstStageMask = stagesFor(desired.layout);
+        b.dstStageMask = queueStages(stagesFor(desired.layout));
         b.dstAccessMask = accessFor(desired.layout);
         b.image = img.handle;
         b.subresourceRange = { desired.aspect, 0, img.mipLevels, 0, img.layers };
@@ -41,8 +42,13 @@ public:
         img.currentLayout = desired.layout;
     }
 
-private:
-    vk::CommandBuffer cmd;
+    // stages a compute only queue accepts, anything else turns into all commands
+    static vk::PipelineStageFlags2 computeQueueStages(vk::PipelineStageFlags2 s) {
+        s &= vk::PipelineStageFlagBits2::eTopOfPipe | vk::PipelineStageFlagBits2::eBottomOfPipe |
+             vk::PipelineStageFlagBits2::eComputeShader | vk::PipelineStageFlagBits2::eTransfer |
+             vk::PipelineStageFlagBits2::eDrawIndirect;
+        return s ? s : vk::PipelineStageFlagBits2::eAllCommands;
+    }
 
     static ImageState toLayout(Role r) {
         switch (r) {
@@ -59,6 +65,7 @@ private:
         return {};
     }
 
+    // best guess at who used a layout last, for images with no recorded access
     static vk::PipelineStageFlags2 stagesFor(vk::ImageLayout l){
         if (l==vk::ImageLayout::eUndefined) return vk::PipelineStageFlagBits2::eTopOfPipe;
         if (l==vk::ImageLayout::eGeneral) return vk::PipelineStageFlagBits2::eRayTracingShaderKHR;
@@ -81,6 +88,14 @@ private:
         if (l==vk::ImageLayout::ePresentSrcKHR) return {};
         return {};
     }
+
+private:
+    vk::CommandBuffer cmd;
+    bool computeQueue = false;
+
+    vk::PipelineStageFlags2 queueStages(vk::PipelineStageFlags2 s) const {
+        return computeQueue ? computeQueueStages(s) : s;
+    }
 };
 
 }
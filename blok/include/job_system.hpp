@@ -0,0 +1,78 @@
+/*
+* File: job_system.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace blok {
+
+// counts outstanding jobs, a group of jobs is done when this hits 0
+struct JobCounter {
+    std::atomic<uint32_t> value{0};
+
+    [[nodiscard]] bool done() const { return value.load(std::memory_order_acquire) == 0; }
+};
+
+// fixed pool of workers, one deque per worker.
+// owners pop from the back, idle workers steal from the front of someone else's
+class JobSystem {
+public:
+    using Job = std::function<void()>;
+
+    // 0 = hardware_concurrency - 1 (the main thread helps out in wait())
+    explicit JobSystem(uint32_t threadCount = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // counter (optional) is bumped now and dropped once the job has run
+    void submit(Job job, JobCounter* counter = nullptr);
+
+    // blocks until counter is done, runs queued jobs on the calling thread meanwhile
+    void wait(const JobCounter& counter);
+
+    [[nodiscard]] uint32_t workerCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+private:
+    struct Task {
+        Job job;
+        JobCounter* counter = nullptr;
+    };
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(uint32_t index);
+
+    // pops from queue 'home' first, then tries to steal. false if everything was empty
+    bool tryRunOne(uint32_t home);
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::atomic<uint32_t> m_nextQueue{0};
+    std::atomic<uint32_t> m_queued{0};
+    std::atomic<bool> m_stop{false};
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCv;
+};
+
+}
+
+#endif
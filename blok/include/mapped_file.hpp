@@ -0,0 +1,46 @@
+/*
+* File: mapped_file.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace blok {
+
+// read only view of a whole file, mmap / MapViewOfFile. move only, unmapped on destruction
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(MappedFile&& o) noexcept;
+    MappedFile& operator=(MappedFile&& o) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // false (and errorMsg) if the file can't be opened or mapped. empty files map to an empty view
+    bool open(const std::string& path, std::string& errorMsg);
+    void close();
+
+    [[nodiscard]] const uint8_t* data() const { return m_data; }
+    [[nodiscard]] size_t size() const { return m_size; }
+    [[nodiscard]] bool isOpen() const { return m_open; }
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
+
+}
+
+#endif //MAPPED_FILE_HPP
@@ -11,12 +11,16 @@
 #include <array>
 #include <cstdint>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "common.hpp"
 #include "vec3.hpp"
 
 namespace blok {
 
+struct GpuRange;
+
 enum class MaterialType : uint8_t {
     Diffuse = 0,
     Metallic = 1,
@@ -124,6 +128,7 @@ public:
 
     [[nodiscard]]
     const Material* getMaterial(uint32_t id) const;
+    // mutable access counts as a change, the entry is repacked by the next packChangedForGpu
     Material* getMaterial(uint32_t id);
 
     [[nodiscard]]
@@ -131,9 +136,14 @@ public:
     [[nodiscard]]
     uint32_t getMaterialIdByName(const std::string& name) const;
 
+    // per voxel path (ChunkManager::setVoxel). colour materials get no name, materialName builds it when asked
     uint32_t getOrCreateFromColor(uint8_t r, uint8_t g, uint8_t b);
     uint32_t getOrCreateFromColor(uint32_t packedRGB);
 
+    // the stored name, or "color_RRGGBB" for a colour material
+    [[nodiscard]]
+    std::string materialName(uint32_t id) const;
+
     void setVoxPaletteMapping(uint8_t paletteIndex, uint32_t materialId);
     [[nodiscard]]
     uint32_t getMaterialFromVoxPalette(uint8_t paletteIndex) const;
@@ -144,6 +154,10 @@ public:
     [[nodiscard]]
     std::vector<MaterialGpu> packForGpu() const;
 
+    // brings packed (the consumer's copy of packForGpu) up to date: only materials added or touched since the last
+    // call are repacked, their ranges are appended to dirty. one consumer per library, the first call packs everything
+    void packChangedForGpu(std::vector<MaterialGpu>& packed, std::vector<GpuRange>& dirty);
+
     [[nodiscard]]
     size_t size() const { return m_materials.size(); }
 
@@ -155,11 +169,30 @@ public:
 private:
     std::vector<Material> m_materials;
     std::unordered_map<std::string, uint32_t> m_nameToId;
-    std::unordered_map<uint32_t, uint32_t> m_colorToId;
+
+    // colour -> material, open addressing with linear probing. power of two slots, at most half full
+    struct ColorSlot {
+        uint32_t color = EMPTY_COLOR;
+        uint32_t id = 0;
+    };
+    static constexpr uint32_t EMPTY_COLOR = 0xFFFFFFFFu; // colours are 24 bit
+    std::vector<ColorSlot> m_colorSlots;
+    uint32_t m_colorShift = 32; // hash >> shift is the home slot
+    uint32_t m_colorCount = 0;
+    // voxels come in runs of one colour
+    uint32_t m_lastColor = EMPTY_COLOR;
+    uint32_t m_lastColorId = 0;
+
+    // packChangedForGpu state
+    uint32_t m_gpuPacked = 0; // materials below this were handed out already
+    std::vector<uint32_t> m_touched; // ids below m_gpuPacked changed since
 
     std::array<uint32_t, 256> m_voxPaletteMap{};
 
     void createDefaultMaterials();
+    uint32_t colorSlot(uint32_t packedRGB) const; // its slot, or the empty one it would go in
+    void growColorMap();
+    bool findByName(const std::string& name, uint32_t& id) const;
 };
 
 }
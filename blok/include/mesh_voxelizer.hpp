@@ -0,0 +1,51 @@
+/*
+* File: mesh_voxelizer.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef MESH_VOXELIZER_HPP
+#define MESH_VOXELIZER_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vec3.hpp"
+
+namespace blok {
+
+class ChunkManager;
+
+// triangle soup with colours, what the voxelizer reads
+struct TriangleMesh {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> colors; // 0xRRGGBB per position, empty if the file had none
+    std::vector<uint32_t> indices; // 3 per triangle
+    std::vector<uint32_t> triangleColors; // 0xRRGGBB per triangle, its material's diffuse colour
+
+    [[nodiscard]] size_t triangleCount() const { return indices.size() / 3; }
+};
+
+// wavefront obj: v (with the optional r g b after xyz), f (polygons are fanned, negative indices work),
+// usemtl + mtllib for the Kd colour of each face. textures aren't sampled
+bool loadObjFile(const std::string& filepath, TriangleMesh& outMesh, std::string& errorMsg);
+
+struct VoxelizeSettings {
+    uint32_t resolution = 256; // voxels along the mesh's longest axis
+    glm::vec3 worldOffset{0.0f}; // where the mesh's bounding box min goes
+};
+
+// conservative surface voxelization (Schwarz & Seidel 2010): every voxel a triangle overlaps is filled.
+// the mesh is cut into tiles that voxelize as jobs on the chunk manager's pool, each tile's voxels come out
+// in morton order and tiles follow in morton order, then everything goes through one writeVoxels.
+// colours are quantized before they become materials so interpolated vertex colours stay a small palette.
+// returns number of voxels written
+uint32_t voxelizeMeshToChunks(const TriangleMesh& mesh, ChunkManager& chunkMgr, const VoxelizeSettings& settings = {});
+
+// convenience, load + voxelize
+bool loadAndVoxelizeObj(const std::string& filepath, ChunkManager& chunkMgr, const VoxelizeSettings& settings = {},
+                        std::string* errorMsg = nullptr);
+
+}
+
+#endif //MESH_VOXELIZER_HPP
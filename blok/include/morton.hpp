@@ -6,10 +6,23 @@
 */
 #ifndef MORTON_HPP
 #define MORTON_HPP
+#include <array>
+#include <cstddef>
 #include <cstdint>
+
+// built with bmi2 available (-mbmi2, -march=haswell+, /arch:AVX2) the scalar kernels are pdep/pext.
+// otherwise spreading goes through a byte table, the batch functions below pick bmi2 at runtime either way
+#if defined(__BMI2__)
+#include <immintrin.h>
+#define BLOK_MORTON_BMI2
+#endif
+
 namespace blok::morton3d {
 
-inline uint64_t spreadBits(uint32_t v)
+static constexpr uint64_t SPREAD_MASK = 0x1249249249249249ULL; // every third bit, 21 of them
+
+// the 5 step magic mask versions, what the table and the vectorised batch path are built from
+constexpr uint64_t spreadBitsMagic(uint32_t v)
 {
     uint64_t x = v & 0x1fffff; // 21 bits
     x = (x | (x << 32)) & 0x1f00000000ffffULL;
@@ -20,6 +33,35 @@ inline uint64_t spreadBits(uint32_t v)
     return x;
 }
 
+constexpr uint32_t compactBitsMagic(uint64_t v)
+{
+    v &= 0x1249249249249249ULL;
+    v = (v ^ (v >> 2))  & 0x10c30c30c30c30c3ULL;
+    v = (v ^ (v >> 4))  & 0x100f00f00f00f00fULL;
+    v = (v ^ (v >> 8))  & 0x1f0000ff0000ffULL;
+    v = (v ^ (v >> 16)) & 0x1f00000000ffffULL;
+    v = (v ^ (v >> 32)) & 0x1fffffULL;
+    return static_cast<uint32_t>(v);
+}
+
+// byte -> its 8 bits two apart, 24 bits wide
+inline constexpr std::array<uint32_t, 256> SPREAD_LUT = [] {
+    std::array<uint32_t, 256> lut{};
+    for (uint32_t i = 0; i < 256; i++) lut[i] = static_cast<uint32_t>(spreadBitsMagic(i));
+    return lut;
+}();
+
+inline uint64_t spreadBits(uint32_t v)
+{
+#ifdef BLOK_MORTON_BMI2
+    return _pdep_u64(v & 0x1fffff, SPREAD_MASK);
+#else
+    return  static_cast<uint64_t>(SPREAD_LUT[v & 0xff]) |
+           (static_cast<uint64_t>(SPREAD_LUT[(v >> 8) & 0xff]) << 24) |
+           (static_cast<uint64_t>(SPREAD_LUT[(v >> 16) & 0x1f]) << 48);
+#endif
+}
+
 inline uint64_t encode(int32_t x, int32_t y, int32_t z)
 {
     static constexpr int32_t BIAS = 1 << 20; // i.e 1,048,576
@@ -32,15 +74,14 @@ inline uint64_t encode(int32_t x, int32_t y, int32_t z)
            (spreadBits(zs) << 2);
 }
 
+// no table here, gathering every third bit takes 7 lookups of 9 bits and isn't faster than the masks
 inline uint32_t compactBits(uint64_t v)
 {
-    v &= 0x1249249249249249ULL;
-    v = (v ^ (v >> 2))  & 0x10c30c30c30c30c3ULL;
-    v = (v ^ (v >> 4))  & 0x100f00f00f00f00fULL;
-    v = (v ^ (v >> 8))  & 0x1f0000ff0000ffULL;
-    v = (v ^ (v >> 16)) & 0x1f00000000ffffULL;
-    v = (v ^ (v >> 32)) & 0x1fffffULL;
-    return static_cast<uint32_t>(v);
+#ifdef BLOK_MORTON_BMI2
+    return static_cast<uint32_t>(_pext_u64(v, SPREAD_MASK));
+#else
+    return compactBitsMagic(v);
+#endif
 }
 
 inline void decode(uint64_t code, int32_t& x, int32_t& y, int32_t& z)
@@ -57,5 +98,13 @@ inline uint32_t octantFromCode(uint64_t mortonCode, uint32_t maxDepth, uint32_t
     return static_cast<uint32_t>((mortonCode >> shift) & 0x7ull);
 }
 
+// bulk versions for the builders, same results as encode/decode per element. these check for bmi2 once at
+// runtime (pdep is microcoded and slow before zen 3, those get the vectorised mask path too), see morton.cpp
+void encodeBatch(const int32_t* x, const int32_t* y, const int32_t* z, uint64_t* out, size_t count);
+void decodeBatch(const uint64_t* codes, int32_t* x, int32_t* y, int32_t* z, size_t count);
+
+// true when the batch functions run on pdep/pext
+bool batchUsesBmi2();
+
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+/*
+* File: offline_render.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef OFFLINE_RENDER_HPP
+#define OFFLINE_RENDER_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm.hpp>
+
+#include "camera.hpp"
+
+namespace blok {
+
+// blok --offline out.exr [--offline-spp N] [--offline-size W H] [--offline-camera x y z yaw pitch fov]
+//                        [--offline-gpus N] [--offline-device I] [--offline-worker I N]
+// blok --offline-merge out.exr part.exr ...
+// a still of the startup scene at a fixed sample count, written as a float exr. the image is cut into tiles the size of
+// the render extent, each traced with the rt pipeline through progressive accumulation under the part of the projection
+// it covers. worker I of N renders tiles I, I + N, ... and leaves the rest zero, so the parts of any split sum to the
+// image: --offline-gpus starts one worker process per device and merges them, workers on other machines are the same
+// command with their own --offline-worker, merged by hand
+struct OfflineRenderConfig {
+    std::string output = "render.exr";
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    uint32_t spp = 1024;
+    bool hasCamera = false; // the startup camera otherwise
+    Camera camera;
+    int device = -1; // index among the devices the renderer can use, -1 picks as usual
+    uint32_t worker = 0;
+    uint32_t workers = 1;
+    uint32_t gpus = 1; // > 1: this process only starts and merges the workers
+};
+
+struct OfflineTile {
+    uint32_t index = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0; // the part inside the image, the tile itself is always tileWidth x tileHeight
+    uint32_t height = 0;
+};
+
+// row major over the image, edge tiles cut off at the border
+std::vector<OfflineTile> splitOfflineTiles(uint32_t width, uint32_t height, uint32_t tileWidth, uint32_t tileHeight);
+
+// round robin, the same split on every machine as long as image and tile size agree
+inline bool ownsOfflineTile(const OfflineTile& tile, uint32_t worker, uint32_t workers) {
+    return workers <= 1 || tile.index % workers == worker;
+}
+
+// proj narrowed to a tileWidth x tileHeight window at (tile.x, tile.y) of the width x height image it was made for
+glm::mat4 offlineTileProjection(const glm::mat4& proj, uint32_t width, uint32_t height, const OfflineTile& tile,
+                                uint32_t tileWidth, uint32_t tileHeight);
+
+// single part scanline exr, uncompressed 32 bit float RGBA. rgba holds width * height pixels, rows top down
+bool writeExr(const std::string& path, uint32_t width, uint32_t height, const std::vector<float>& rgba);
+// reads back what writeExr writes (any uncompressed float scanline image), missing channels come out 0
+bool readExr(const std::string& path, uint32_t& width, uint32_t& height, std::vector<float>& rgba, std::string* err = nullptr);
+
+// sums same sized parts into one image
+bool mergeExrParts(const std::string& output, const std::vector<std::string>& parts, std::string* err = nullptr);
+
+// runs config.gpus copies of this executable, worker i on device i, then merges their parts into config.output.
+// args are passed on (scene, --offline-spp/size/camera, ...), everything but --offline, --offline-gpus, --offline-device
+// and --offline-worker
+bool runOfflineWorkers(const std::string& exe, const std::vector<std::string>& args, const OfflineRenderConfig& config);
+
+}
+
+#endif //OFFLINE_RENDER_HPP
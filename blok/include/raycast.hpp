@@ -0,0 +1,46 @@
+/*
+* File: raycast.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef RAYCAST_HPP
+#define RAYCAST_HPP
+#include <cstdint>
+#include <span>
+#include <glm.hpp>
+
+namespace blok {
+class ChunkManager;
+
+// cpu ray casts against the voxel world, for picking, brush placement, collision and line of sight.
+// rays are in world space (one unit per voxel, see ChunkManager::worldToGlobalVoxel), t counts in lengths of dir.
+// chunks are walked with a dda, each one through its svo when that's current and through its sparse storage
+// otherwise (dirty, rebuilding or gpu built). brushes only queued for the gpu (Chunk::gpuBrushes) aren't seen.
+// read only: any number of threads can cast while nothing edits, streams or rebuilds the manager
+struct RayHit {
+    bool hit = false;
+    float t = 0.0f; // entry into the voxel, 0 when the ray starts inside it
+    glm::ivec3 voxel{0}; // global voxel coords
+    glm::ivec3 normal{0}; // outward normal of the face the ray came in through, 0 when it started inside
+    uint32_t materialId = 0;
+};
+
+RayHit raycast(const ChunkManager& mgr, const glm::vec3& origin, const glm::vec3& dir, float maxT);
+
+// up to RAY_PACKET_MAX rays traced together, padded to a packet of 4, 8 or 16. every chunk any of them crosses is
+// walked once for the whole packet, and each svo node is tested against all its rays at once (fixed width loops,
+// avx2 picked at runtime on x86). pays off for coherent rays (a cursor footprint, a line of sight fan),
+// incoherent ones come out the same as raycast but gain nothing
+static constexpr uint32_t RAY_PACKET_MAX = 16;
+void raycastPacket(const ChunkManager& mgr, const glm::vec3* origins, const glm::vec3* dirs, const float* maxT, uint32_t count,
+                   RayHit* out);
+
+// any number of rays in packets of RAY_PACKET_MAX, spread over the manager's job system (the caller helps out).
+// neighbouring rays share a packet, so order them coherently. out has one hit per ray
+void raycastBatch(ChunkManager& mgr, std::span<const glm::vec3> origins, std::span<const glm::vec3> dirs, float maxT,
+                  std::span<RayHit> out);
+
+}
+
+#endif
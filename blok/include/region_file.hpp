@@ -0,0 +1,93 @@
+/*
+* File: region_file.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef REGION_FILE_HPP
+#define REGION_FILE_HPP
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_manager.hpp"
+
+namespace blok {
+
+// a region file holds REGION_SIZE^3 chunks
+static constexpr int32_t REGION_SIZE = 8;
+static constexpr uint32_t REGION_FILE_VERSION = 1;
+
+// directory of region files, chunks addressed by ChunkCoord.
+// every file starts with a fixed index (offset, size, capacity per chunk), payloads follow. a rewrite that
+// fits its old capacity goes in place, anything bigger is appended and the old space is abandoned.
+// a payload is the chunk's non-empty bricks, each run-length encoded.
+// all file access happens on one io thread in queue order, so a load queued after a store sees the stored chunk
+class RegionStore {
+public:
+    // C = voxels per chunk edge, regions written with a different C are treated as empty
+    RegionStore(std::string directory, uint32_t C);
+    ~RegionStore(); // finishes everything queued first
+
+    RegionStore(const RegionStore&) = delete;
+    RegionStore& operator=(const RegionStore&) = delete;
+
+    // queue a read, it comes back through collect
+    void requestLoad(const ChunkCoord& c);
+    // appends every read that finished since the last call
+    void collect(std::vector<LoadedChunk>& out);
+
+    // encodes the chunk's voxels now, the write happens on the io thread
+    void store(const Chunk& ch);
+
+    // blocks until everything queued so far is done
+    void flush();
+
+    // for ChunkManager::asyncLoader / saver, the store has to outlive them
+    AsyncChunkLoader asyncLoader();
+    ChunkSaver saver();
+
+    // payload format, public for tools and the microbench
+    static std::vector<uint8_t> encodeChunk(const ChunkStorage& voxels);
+    // false if the payload is corrupt or was written for another chunk size
+    static bool decodeChunk(const uint8_t* data, size_t size, ChunkStorage& out);
+
+private:
+    struct Region;
+
+    struct Op {
+        bool store = false;
+        ChunkCoord coord{};
+        std::vector<uint8_t> payload; // stores only
+    };
+
+    void ioLoop();
+    void runOp(Op& op);
+    Region* region(const ChunkCoord& regionCoord); // io thread only, nullptr if the file can't be used
+
+    std::string m_directory;
+    uint32_t m_C;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv; // new ops or stop
+    std::condition_variable m_idleCv; // queue drained
+    std::deque<Op> m_queue;
+    std::vector<LoadedChunk> m_done;
+    bool m_busy = false;
+    bool m_stop = false;
+
+    // io thread only
+    std::unordered_map<ChunkCoord, std::unique_ptr<Region>, ChunkCoordHash> m_regions;
+
+    std::thread m_thread;
+};
+
+}
+
+#endif //REGION_FILE_HPP
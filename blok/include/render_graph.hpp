@@ -0,0 +1,92 @@
+/*
+* File: render_graph.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef RENDER_GRAPH_HPP
+#define RENDER_GRAPH_HPP
+#include <vector>
+#include "gpu_profiler.hpp"
+#include "image_states.hpp"
+#include "resources.hpp"
+
+namespace blok {
+
+// records passes into one command buffer. each pass declares what it reads and writes, run() then puts
+// every layout transition and hazard in front of it into a single pipelineBarrier2 and drops the ones that
+// are already covered (read after read, a second reader in a stage that already saw the write, ...).
+// the last access lives on the Image/Buffer so it carries over between frames and command buffers.
+//
+//   graph.pass(vk::PipelineStageFlagBits2::eComputeShader)
+//        .read(gbuffer.color)
+//        .write(gbuffer.variance)
+//        .run([&](vk::CommandBuffer cmd) { ... });
+class RenderGraph {
+public:
+    // computeQueue: cmd goes to a compute only queue, see ImageTransitions
+    // profiler: named passes get a timestamp scope around their commands
+    explicit RenderGraph(vk::CommandBuffer cmd, bool computeQueue = false, GpuProfiler* profiler = nullptr)
+        : cmd(cmd), computeQueue(computeQueue), profiler(profiler) {}
+
+    vk::CommandBuffer commandBuffer() const { return cmd; }
+
+    // starts declaring the next pass, stage is where its commands run. name is what the profiler shows,
+    // it has to outlive the frame (string literal)
+    RenderGraph& pass(vk::PipelineStageFlags2 stage, const char* name = nullptr);
+
+    RenderGraph& read(Image& img, Role role = Role::General);
+    RenderGraph& write(Image& img, Role role = Role::General);
+    RenderGraph& read(Buffer& buf);
+    RenderGraph& write(Buffer& buf);
+
+    // image first touched after a semaphore wait (swapchain acquire), its transition chains off waitStage
+    RenderGraph& imported(Image& img, vk::PipelineStageFlags2 waitStage);
+
+    // emits the pass barrier then records the pass
+    template<typename Record>
+    void run(Record&& record) {
+        flush();
+        const uint32_t scope = profiler && name ? profiler->begin(cmd, name) : GpuProfiler::NO_SCOPE;
+        record(cmd);
+        if (scope != GpuProfiler::NO_SCOPE) profiler->end(cmd, scope);
+    }
+
+    // emits the pass barrier only, for a trailing transition like present
+    void flush();
+
+    // barriers actually recorded so far
+    uint32_t barrierCount() const { return barriers; }
+
+private:
+    struct Use {
+        Image* image = nullptr;
+        Buffer* buffer = nullptr;
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+        vk::ImageAspectFlags aspect{};
+        vk::AccessFlags2 access{};
+        bool write = false;
+    };
+
+    vk::CommandBuffer cmd;
+    bool computeQueue = false;
+    GpuProfiler* profiler = nullptr;
+
+    vk::PipelineStageFlags2 stage{};
+    const char* name = nullptr;
+    std::vector<Use> uses;
+    std::vector<Image*> importedImages;
+    std::vector<vk::PipelineStageFlags2> importedStages;
+    std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+    uint32_t barriers = 0;
+
+    void add(Image* img, Buffer* buf, Role role, bool write);
+    vk::AccessFlags2 accessFor(bool write) const;
+    vk::PipelineStageFlags2 queueStages(vk::PipelineStageFlags2 s) const {
+        return computeQueue ? ImageTransitions::computeQueueStages(s) : s;
+    }
+};
+
+}
+
+#endif //RENDER_GRAPH_HPP
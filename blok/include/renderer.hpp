@@ -8,16 +8,27 @@
 #define RENDERER_HPP
 #include "vulkan_context.hpp"
 #define GLFW_INCLUDE_NONE
+#include <chrono>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
 #include <GLFW/glfw3.h>
 #include <vk_mem_alloc.h>
 
 #include "camera.hpp"
 #include "descriptors.hpp"
+#include "dynamic_resolution.hpp"
+#include "environment_map.hpp"
+#include "gpu_profiler.hpp"
+#include "job_system.hpp"
+#include "renderer_cuda_interop.hpp"
 #include "renderer_raytracing.hpp"
 #include "renderer_denoising.hpp"
 #include "renderer_postprocess.hpp"
+#include "renderer_svo_build.hpp"
 #include "resources.hpp"
 #include "shader_manager.hpp"
 
@@ -28,7 +39,9 @@ extern bool resizeNeeded;
 
 class Renderer {
 public:
-    explicit Renderer(int width, int height);
+    // deviceIndex: the nth device that has everything the renderer needs (in enumeration order), -1 takes the first
+    // discrete one as usual
+    explicit Renderer(int width, int height, int deviceIndex = -1);
     ~Renderer();
 
     void render(const Camera& c, float dt);
@@ -39,42 +52,132 @@ public:
     // TODO will probably remove this function and refactor this later
     void addWorld(WorldSvoGpu& gpuWorld) {
         m_world = &gpuWorld;
+        updateWorld();
+    }
+    // records the world upload + blas/tlas builds and submits without waiting.
+    // frames wait on m_timeline before tracing, old buffers are retired not destroyed
+    void updateWorld();
+    void cleanupWorld(WorldSvoGpu& gpuWorld);
 
-        // Upload all SVO buffers
-        uploadSvoBuffers(*m_world);
+    MaterialLibrary& getMaterialLibrary() { return m_materialLib; }
 
-        // Build BLAS/TLAS
-        buildChunkBlas(*m_world);
-        buildChunkTlas(*m_world);
+    // gui
+    void updatePerformanceData(float fps, float ms);
 
-        // Update descriptor sets
-        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-            m_raytracer.updateDescriptorSet(*m_world, i);
-        }
-    }
-    void updateWorld() {
-        if (!m_world) return;
+    // restarts everything a frame's noise depends on (rand, the shader frame counter, TAA jitter, both
+    // temporal histories) so the same camera path renders the same frames, see App::runBenchmark
+    void resetFrameSeed(uint32_t seed);
 
-        m_device.waitIdle();
+    struct FrameStats {
+        float gpuMs = 0.0f; // last frame the profiler resolved, 0 without timestamps
+        vk::Extent2D renderExtent{};
+        uint64_t deviceBytes = 0;
+    };
+    [[nodiscard]]
+    FrameStats frameStats() const;
 
-        // Reupload SVO buffers
-        uploadSvoBuffers(*m_world);
+    // bytes the svo heaps may grow to before the device local heap runs past its VK_EXT_memory_budget budget.
+    // what they hold now plus what's left, minus a reserve for everything else. the streaming gpu budget is capped at it
+    [[nodiscard]]
+    size_t streamingBudget() const;
 
-        // Rebuild BLAS/TLAS
-        buildChunkBlas(*m_world);
-        buildChunkTlas(*m_world);
+    // runs each frame's denoise/post chain on m_asyncComputeQueue so it overlaps the next frame's trace.
+    // takes effect at the next frame boundary (the size dependent images are recreated), ignored without an async queue
+    void setAsyncCompute(bool enabled);
+    [[nodiscard]]
+    bool asyncComputeAvailable() const { return static_cast<bool>(m_asyncComputeQueue); }
 
-        // Update descriptor sets
-        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-            m_raytracer.updateDescriptorSet(*m_world, i);
-        }
-    }
-    void cleanupWorld(WorldSvoGpu& gpuWorld);
+    // trace with inline ray queries from a compute shader instead of the ray tracing pipeline, takes effect next frame.
+    // ignored on devices without VK_KHR_ray_query
+    void setRayQueryTracer(bool enabled) { m_raytracer.settings.rayQuery = enabled; }
+    [[nodiscard]]
+    bool rayQueryAvailable() const { return m_rayQuery; }
+    // the tracer the last frame used
+    [[nodiscard]]
+    bool rayQueryActive() const { return m_raytracer.frameQuery; }
+
+    // what the primary ray hit under a pixel, read back from the gbuffer
+    struct PickResult {
+        uint64_t id = 0; // from requestPick
+        bool hit = false; // false on sky
+        glm::vec3 position{0.0f}; // world space surface point
+        glm::vec3 normal{0.0f};
+        float depth = 0.0f; // primary hit distance
+        glm::ivec3 voxel{0}; // global voxel behind the surface, ChunkManager::getVoxelMaterial has its material
+        glm::vec4 albedoMetallic{0.0f}; // what the gbuffer shaded it with, emission for emissive voxels
+    };
+    // queues a pick at a window pixel, the next drawFrame copies its gbuffer texels into a readback buffer.
+    // returns the id its result comes back with. picks past PICK_MAX_PER_FRAME wait for the frame after
+    uint64_t requestPick(const glm::vec2& windowPixel);
+    // appends the results of every frame the gpu has finished since the last call, polls m_timeline
+    // and never waits. a pick usually comes back one or two frames after it was requested
+    void takePickResults(std::vector<PickResult>& out);
+    static constexpr uint32_t PICK_MAX_PER_FRAME = 16;
+
+    // totals of the last frame the gpu finished that traced with RayTracing::Settings::traversalStats on
+    struct TraversalStats {
+        uint64_t pixels = 0;
+        uint64_t rays = 0; // scene + shadow rays raygen traced
+        uint64_t nodes = 0; // svo nodes the walks visited
+        uint64_t traversals = 0; // sub-chunk walks, one per intersection shader invocation
+        uint64_t bounces = 0;
+        uint64_t cutOff = 0; // walks that ran into MAX_ITER
+        uint32_t maxStack = 0;
+        uint32_t maxNodes = 0; // most one pixel visited
+    };
+    [[nodiscard]]
+    const TraversalStats& traversalStats() const { return m_traversalStats; }
 
-    MaterialLibrary& getMaterialLibrary() { return m_materialLib; }
+    // frames the cpu records ahead of the gpu, 1..FRAMES_IN_FLIGHT_MAX. more keeps the gpu fed, fewer shortens the
+    // time from input to display. applied at the next frame boundary, async compute and the external tracer stay at 2
+    // (their per frame targets come in pairs)
+    void setFramesInFlight(uint32_t frames);
+    [[nodiscard]]
+    uint32_t framesInFlight() const { return m_framesInFlight; }
+    // paceFrame sleeps until just before the gpu needs the next frame, so the input read after it is as fresh as it
+    // gets. times it off VK_KHR_present_wait when the device has it, off the profiler's gpu time otherwise
+    void setLowLatency(bool enabled) { m_lowLatency = enabled; }
+    [[nodiscard]]
+    bool lowLatency() const { return m_lowLatency; }
+    // blocks until the next frame's slot is free, and with low latency until it's time to start it. call right
+    // before polling input, drawFrame waits for the slot itself when it wasn't called
+    void paceFrame();
+    // what the surface offers, a switch recreates the swapchain at the next frame boundary
+    [[nodiscard]]
+    const std::vector<vk::PresentModeKHR>& presentModes() const { return m_presentModes; }
+    [[nodiscard]]
+    vk::PresentModeKHR presentMode() const { return m_presentMode; }
+    void setPresentMode(vk::PresentModeKHR mode);
 
-    // gui
-    void updatePerformanceData(float fps, float ms);
+    // rebuilds the specialized rt + a-trous pipelines at the next frame boundary
+    void setQualityPreset(QualityPreset preset) { m_qualityWanted = preset; }
+    [[nodiscard]]
+    QualityPreset qualityPreset() const { return m_qualityWanted; }
+
+    // watches assets/shaders and rebuilds just the pipelines whose sources changed, on by default
+    void setShaderHotReload(bool enabled) { m_shaderHotReload = enabled; }
+
+    // the gbuffer comes from tracer (CudaTracer::traceToVulkan) instead of the ray tracing pipeline, see CudaInterop.
+    // false when the device can't export memory + semaphores. an empty tracer switches back
+    bool setExternalTracer(ExternalTracer tracer);
+
+    // offline stills (App::runOfflineRender): progressive accumulation up to targetSpp with the plain mean from the
+    // first frame on, and the render extent held at what the swapchain gives
+    void setOfflineRender(uint32_t targetSpp);
+    // replaces the camera's projection in drawFrame (e.g. offlineTileProjection), the camera's own again with nullopt.
+    // a change only restarts accumulation together with Camera::cameraChanged
+    void setProjectionOverride(const std::optional<glm::mat4>& proj) { m_projectionOverride = proj; }
+    // the last frame was the one that reached progressiveTargetSpp
+    [[nodiscard]]
+    bool progressiveConverged() const { return m_denoiser.progressiveActive() && !m_denoiser.progressiveTracing; }
+    // the progressive mean as rgba float rows of the render extent, top down. waits for the device to go idle
+    void readProgressiveImage(std::vector<float>& rgba);
+
+    // the hdr sky raygen lights with and samples next to the emissive voxels, an empty map goes back to the
+    // analytic one. builds the alias table and uploads it, waits for the device to go idle
+    void setEnvironmentMap(const EnvironmentMap& env);
+    [[nodiscard]]
+    bool hasEnvironmentMap() const { return m_environmentHeader.width != 0; }
 
 private:
     // Device creation
@@ -95,6 +198,14 @@ private:
     void createSyncObjects();
     void createPerFrameUniforms();
     void queryRayTracingProperties();
+    // pipeline cache, seeded from the shader cache dir when the blob was written by this device + driver
+    void createPipelineCache();
+    void savePipelineCache();
+    // while the constructor runs, pipeline creation fans out over m_startupJobs. without the pool the job runs inline.
+    // finishStartupJobs waits for all of it, drops the pool and rethrows the first error
+    void startupJob(std::function<void()> job);
+    void finishStartupJobs();
+    void applyQualityPreset();
 
     // gui
     void createGui();
@@ -103,9 +214,49 @@ private:
     void renderOptionsPanel();
 
     // Upload
-    Buffer createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaAllocationCreateFlags allocFlags, VmaMemoryUsage memUsage = VMA_MEMORY_USAGE_AUTO, bool mapped = false);
+    // sharedFamilies: queue families for concurrent sharing, exclusive if empty
+    Buffer createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaAllocationCreateFlags allocFlags, VmaMemoryUsage memUsage = VMA_MEMORY_USAGE_AUTO, bool mapped = false, std::span<const uint32_t> sharedFamilies = {});
+    // blocking upload, for setup. staged through the ring when dst isn't mapped
     void uploadToBuffer(const void* src, vk::DeviceSize size, Buffer& dst, vk::DeviceSize dstOffset = 0);
-    void copyBuffer(Buffer& src, Buffer& dst, vk::DeviceSize size);
+    void copyBuffer(Buffer& src, Buffer& dst, vk::DeviceSize size, vk::DeviceSize dstOffset = 0, vk::DeviceSize srcOffset = 0);
+    // bump allocates size bytes from the current frame's mapped ring, aligned for uniform binding.
+    // only valid between the fence wait in drawFrame and its submit, the gpu may still be reading it otherwise
+    FrameAllocation allocateFrameData(vk::DeviceSize size);
+    // size bytes of mapped staging for a copy read by the submit with timeline value 'value'.
+    // from the staging ring when there's room, otherwise a one off buffer retired with the next submit
+    FrameAllocation allocateStaging(vk::DeviceSize size, uint64_t value);
+    // device local + host visible (rebar / unified memory) when the device has it, plain device memory otherwise.
+    // mapped is set only in the first case
+    Buffer createDirectWriteBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage);
+    // recorded variants for world updates, staging comes from the ring and is reused once the update is done
+    void recordUpload(vk::CommandBuffer cmd, const void* src, vk::DeviceSize size, Buffer& dst, vk::DeviceSize dstOffset = 0);
+    // memcpy when dst is mapped, recordUpload otherwise. only for buffers no submitted work uses yet
+    void recordDirectUpload(vk::CommandBuffer cmd, const void* src, vk::DeviceSize size, Buffer& dst);
+    // uploads only the given element ranges of base into the same offsets of dst, one staging buffer for all
+    void recordRangesUpload(vk::CommandBuffer cmd, const void* base, vk::DeviceSize elemSize, const std::vector<GpuRange>& ranges, Buffer& dst);
+    // world buffers (svo heaps, blas/tlas, scratch, ...), suballocated from m_worldMemory and counted under category
+    Buffer createWorldBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryCategory category);
+    bool ensureBufferCapacity(Buffer& buf, vk::DeviceSize bytes, vk::BufferUsageFlags usage, MemoryCategory category);
+    // world heap update: grows buf keeping its contents on the gpu, then uploads just the dirty ranges.
+    // a brand new buffer gets all of data
+    void recordHeapUpload(vk::CommandBuffer cmd, Buffer& buf, vk::DeviceSize bytes, const void* data, vk::DeviceSize elemSize, const std::vector<GpuRange>& dirty, MemoryCategory category);
+
+    // deferred destruction, freed once m_timeline passes the next submit
+    void retireBuffer(Buffer& buf);
+    void retireAccelerationStructure(AccelerationStructure& as);
+    // only between frames, the async compute chain of submitted frames is covered as well
+    void retirePipeline(vk::Pipeline& pipeline, vk::PipelineLayout& layout);
+    void collectRetired();
+    // right away, only once the gpu is done with buf. keeps the category stats in step
+    void destroyBuffer(Buffer& buf);
+
+    // shader hot reload. create fills pipeline + layout again, the old pair is retired once that worked.
+    // on a compile error the error is printed, the old pair stays and false comes back
+    bool rebuildPipeline(vk::Pipeline& pipeline, vk::PipelineLayout& layout, const std::function<void()>& create);
+    void pollShaderChanges(); // end of frame, rate limited
+
+    vk::CommandBuffer beginWorldUpdate();
+    void submitWorldUpdate(vk::CommandBuffer cmd);
 
     Image createImage(uint32_t w, uint32_t h, vk::Format fmt, vk::ImageUsageFlags usage, vk::ImageTiling tiling = vk::ImageTiling::eOptimal, vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1, uint32_t mipLevels = 1, uint32_t layers = 1, VmaMemoryUsage memUsage = VMA_MEMORY_USAGE_AUTO);
     void copyBufferToImage(vk::CommandBuffer cmd, Buffer& staging, Image& img, uint32_t w, uint32_t h, uint32_t baseLayer = 0, uint32_t layerCount = 1);
@@ -114,19 +265,55 @@ private:
     vk::Buffer uploadVertexBuffer(const void* data, vk::DeviceSize sizeBytes, uint32_t vertexCount);
     vk::Buffer uploadIndexBuffer(const uint32_t* data, uint32_t indexCount);
 
-    void uploadSvoBuffers(WorldSvoGpu& gpuWorld);
-    void uploadMaterialBuffer(WorldSvoGpu& gpuWorld);
+    void uploadSvoBuffers(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd);
+    // the node heap through a sparse svoBuffer: (un)binds pages to match what the heap uses, then uploads the
+    // dirty ranges. false when the device can't or the heap outgrew the reservation, the dense path takes over
+    bool recordSparseNodeUpload(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd, vk::DeviceSize bytes);
+    // immediate, with the world idle. frees every bound page
+    void destroySparseNodeBuffer(WorldSvoGpu& gpuWorld);
+    void uploadMaterialBuffer(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd);
+    void uploadLightBuffer(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd);
+    void uploadSurfaceBuffer(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd);
+    void uploadEmptySpaceBuffer(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd);
+    void resetRadianceCache(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd);
 
     // Rendering
     void beginFrame();
     void drawFrame(const Camera& c, float dt);
+    // the three parts of a frame, back to back in one command buffer or split over queues by submitFrameAsync
+    void recordRayTracing(RenderGraph& graph);
+    // swapTarget: the fused post pass writes the swapchain image itself, recordPresent then skips the blit
+    void recordDenoiseAndPost(RenderGraph& graph, Image* swapTarget = nullptr);
+    void recordPresent(RenderGraph& graph, Image& sw, bool blitOutput = true);
+    void submitFrameAsync(FrameResources& fr, Image& sw, uint32_t imageIndex);
+    // copies the queued picks' gbuffer texels into the frame's readback buffer, right after the trace
+    void recordPicks(RenderGraph& graph, FrameResources& fr);
+    // decodes fr's picks into m_pickResults, only once m_timeline has reached fr.doneValue
+    void resolvePicks(FrameResources& fr);
+    // fr's traversal totals into m_traversalStats and cleared for the next frame in the slot, same condition
+    void resolveTraversalStats(FrameResources& fr);
+    void flushPendingPresent();
+    // host side wait until m_timeline reaches value
+    void waitTimeline(uint64_t value);
+    // with the device idle: the frame count setFramesInFlight asked for as far as the current mode allows,
+    // frame slots start over at 0
+    void applyFramesInFlight();
+    void presentImage(uint32_t imageIndex);
+    // moves the denoiser to m_dynamicResolution's extent, inside the pooled targets that's only a history reset
+    void applyRenderScale();
+    // size the denoiser and post targets are allocated at: the largest monitor mode, grown to wanted when something
+    // bigger shows up. they trace and filter into the top left m_renderExtent / m_swapExtent of it
+    vk::Extent2D renderTargetExtent(vk::Extent2D wanted);
     void cmdBeginRendering(vk::CommandBuffer cmd, vk::ImageView colorView, vk::ImageView depthView, vk::Extent2D extent, const std::array<float,4>& clearColor, float clearDepth = 1.0f, uint32_t clearStencil = 0);
     void cmdEndRendering(vk::CommandBuffer cmd);
     void endFrame();
 
     // Raytracing
-    vk::AccelerationStructureKHR buildChunkBlas(WorldSvoGpu& gpuWorld);
-    vk::AccelerationStructureKHR buildChunkTlas(WorldSvoGpu& gpuWorld);
+    // builds or refits the blas of every chunk repacked since the last update
+    void buildChunkBlases(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd);
+    vk::AccelerationStructureKHR buildChunkTlas(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd);
+    // grows the shared scratch buffer if needed, returns an address aligned for AS builds
+    vk::DeviceAddress ensureScratch(WorldSvoGpu& gpuWorld, vk::DeviceSize size);
 
     // Cleanup and Recreation
     void cleanupSwapChain();
@@ -142,6 +329,7 @@ private:
 
 private:
     int m_width = 800, m_height = 600;
+    int m_deviceIndex = -1;
     GLFWwindow* m_window = nullptr;
 
     vk::Instance m_instance{};
@@ -152,13 +340,33 @@ private:
         std::optional<uint32_t> graphics;
         std::optional<uint32_t> present;
         std::optional<uint32_t> compute;
+        std::optional<uint32_t> asyncCompute; // compute family without graphics, if there is one
         bool complete() const { return graphics && present && compute; }
     } m_qfi;
     vk::Queue m_graphicsQueue{};
     vk::Queue m_presentQueue{};
     vk::Queue m_computeQueue{};
+    // separate queue for the denoise/post chain: a compute only family, else a second graphics queue. null if neither
+    vk::Queue m_asyncComputeQueue{};
+    uint32_t m_asyncComputeFamily = 0;
 
     VmaAllocator m_allocator = nullptr;
+    // device local blocks the world buffers are suballocated from, freed ranges are reused by the next grow
+    // instead of each buffer getting (and handing back) its own allocation. null if no memory type fits them all
+    VmaPool m_worldMemory = nullptr;
+    uint32_t m_worldMemoryHeap = 0;
+    bool m_memoryBudget = false; // VK_EXT_memory_budget is on, vma's heap budgets come from the driver
+    // sparseResidencyBuffer + sparse binds on the world queue, the svo node heap is a sparse reservation then
+    bool m_sparseNodes = false;
+    // page (un)binds recordSparseNodeUpload queued for the next world update, bound ahead of its submit
+    std::vector<vk::SparseMemoryBind> m_pendingNodeBinds;
+    vk::Buffer m_pendingNodeBuffer{};
+    vk::Semaphore m_sparseBound{}; // binary, the bind -> the world update it's for
+    struct MemoryCategoryStats {
+        vk::DeviceSize current = 0;
+        vk::DeviceSize peak = 0;
+    };
+    std::array<MemoryCategoryStats, size_t(MemoryCategory::Count)> m_memoryStats{};
 
     vk::SwapchainKHR m_swapchain{};
     std::vector<vk::Image> m_swapImages{};
@@ -167,12 +375,45 @@ private:
     vk::Format m_depthFormat{vk::Format::eD32Sfloat};
     vk::Format m_outputFormat {vk::Format::eR32G32B32A32Sfloat};
     vk::Extent2D m_swapExtent{};
+    // ray tracing + denoise resolution, the post chain upsamples to m_swapExtent
+    vk::Extent2D m_renderExtent{};
+    vk::Extent2D m_targetExtent{}; // see renderTargetExtent
+    DynamicResolution m_dynamicResolution;
+    // per pass gpu times, also the frame time dynamic resolution works from
+    GpuProfiler m_profiler;
     vk::ColorSpaceKHR m_colorSpace{vk::ColorSpaceKHR::eSrgbNonlinear};
     vk::PresentModeKHR m_presentMode{vk::PresentModeKHR::eMailbox};
+    vk::PresentModeKHR m_presentModeWanted{vk::PresentModeKHR::eMailbox}; // applied at the next recreateSwapChain
+    std::vector<vk::PresentModeKHR> m_presentModes;
+    // VK_KHR_present_id + VK_KHR_present_wait, every present carries an id paceFrame can wait on
+    bool m_presentWait = false;
+    uint64_t m_presentId = 0; // last id presented on the current swapchain
     bool m_swapchainDirty = false;
+    // swapchain images can be compute storage targets (surface usage + format support), see PostProcess::fusedActive
+    bool m_swapchainStorage = false;
+    bool m_storageWriteWithoutFormat = false;
+    // VK_*_ray_tracing_invocation_reorder, raygen is compiled with BLOK_SER (+ BLOK_SER_EXT) when set
+    InvocationReorder m_invocationReorder = InvocationReorder::None;
+    // VK_KHR_ray_query, raygen is also built as a compute shader with BLOK_RAY_QUERY
+    bool m_rayQuery = false;
+    // bumped whenever the size dependent images are recreated. part of every per-frame descriptor key,
+    // a new image can get a destroyed one's handle back
+    uint64_t m_resizeGeneration = 0;
+    bool m_asyncCompute = false;
+    bool m_asyncComputeWanted = false; // applied at the next recreateSwapChain
+    // queue families every image is shared with, set when async compute runs on a different family than graphics
+    std::vector<uint32_t> m_imageSharingFamilies;
+    // async compute: a frame's blit/gui/present is submitted behind the next frame's trace,
+    // so the graphics queue never sits on a compute wait in front of the next trace
+    struct PendingPresent {
+        FrameResources* frame = nullptr;
+        uint32_t imageIndex = 0;
+        uint64_t postValue = 0; // m_computeTimeline value of the chain it blits
+    } m_pendingPresent;
 
     std::vector<vk::Semaphore> m_presentSignals;
-    std::vector<vk::Fence> m_imagesInFlight;
+    // m_timeline value of the last frame that rendered into each swapchain image
+    std::vector<uint64_t> m_imageValues;
     std::vector<vk::ImageLayout> m_swapImageLayouts;
 
     // Rendering resources
@@ -182,27 +423,105 @@ private:
     DescriptorAllocatorGrowable m_descAlloc;
     vk::DescriptorPool m_guiDescriptorPool{};
 
-    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+    // requestPick -> recordPicks -> resolvePicks -> takePickResults
+    std::vector<PickRequest> m_pickQueue;
+    std::vector<PickResult> m_pickResults;
+    uint64_t m_nextPickId = 1;
+    // per pick in FrameResources::pickReadback: position texel, normal texel at +16, albedo texel at +32
+    static constexpr vk::DeviceSize PICK_STRIDE = 48;
+
+    TraversalStats m_traversalStats{};
+
+    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = FRAMES_IN_FLIGHT_MAX;
     uint32_t m_frameIndex = 0;
+    // slots in use, m_frameIndex cycles through the first m_framesInFlight of m_frames
+    uint32_t m_framesInFlight = 2;
+    uint32_t m_framesInFlightWanted = 2;
     std::array<FrameResources, MAX_FRAMES_IN_FLIGHT> m_frames{};
 
+    // low latency pacing (setLowLatency)
+    static constexpr float LOW_LATENCY_SLACK_MS = 1.0f; // wakes this much before the estimate says it has to
+    static constexpr uint64_t PRESENT_WAIT_TIMEOUT_NS = 100'000'000;
+    bool m_lowLatency = false;
+    std::chrono::steady_clock::time_point m_paceEnd{}; // paceFrame returned, the frame's cpu work starts
+    std::chrono::steady_clock::time_point m_lastSubmit{};
+    std::chrono::steady_clock::time_point m_lastPresentDone{};
+    float m_cpuFrameMs = 0.0f; // paceFrame to submit, smoothed
+    float m_refreshMs = 0.0f; // between present completions, tracks the shortest
+    vk::DeviceSize m_uboAlign = 256; // minUniformBufferOffsetAlignment
+
     vk::CommandPool m_uploadPool{};
     vk::CommandBuffer m_uploadCmd{};
     vk::Fence m_uploadFence{};
+    static constexpr vk::DeviceSize STAGING_RING_BYTES = vk::DeviceSize(64) << 20;
+    static constexpr vk::DeviceSize DIRECT_WRITE_MAX_BYTES = vk::DeviceSize(1) << 20; // small buffers only, rebar is a few hundred MB at best
+    StagingRing m_staging{};
+
+    // async world updates. frames and world updates share one timeline:
+    // an update waits on the last submitted frame, the next frame waits on the update
+    struct WorldUpdateCmd {
+        vk::CommandBuffer cmd{};
+        uint64_t value = 0; // timeline value that signals this buffer is free again
+    };
+    struct RetiredResource {
+        uint64_t value = 0;
+        uint64_t computeValue = 0; // m_computeTimeline has to pass this too (pipelines the async chain may use)
+        Buffer buffer{};
+        vk::AccelerationStructureKHR as{};
+        vk::Pipeline pipeline{};
+        vk::PipelineLayout layout{};
+        VmaAllocation memory{}; // an unbound sparse page
+    };
+    vk::Semaphore m_timeline{};
+    // signalled by the async compute queue only, m_timeline is graphics only so its signals stay in order
+    vk::Semaphore m_computeTimeline{};
+    uint64_t m_computeTimelineValue = 0;
+    uint64_t m_timelineValue = 0; // last value handed to a submit
+    uint64_t m_worldReadyValue = 0; // value of the last world update
+    // what progressive accumulation starts over on besides the camera, see Denoiser::updateProgressive
+    DescriptorSetKey m_progressiveKey;
+    std::optional<glm::mat4> m_projectionOverride;
+    // EnvironmentHeader + EnvironmentTexelGpu, raygen binding 18. a header without texels when there's no map
+    Buffer m_environmentBuffer{};
+    EnvironmentHeader m_environmentHeader{};
+    uint32_t m_environmentGeneration = 0; // bumped per setEnvironmentMap, accumulation starts over
+    vk::Queue m_worldQueue{};
+    vk::CommandPool m_worldPool{};
+    std::vector<WorldUpdateCmd> m_worldCmds;
+    std::vector<RetiredResource> m_retired;
 
     ShaderManager m_shaderManager;
+    vk::PipelineCache m_pipelineCache{}; // every pipeline is created through this
+    QualityPreset m_quality = QualityPreset::High; // what the live pipelines were specialized with
+    QualityPreset m_qualityWanted = QualityPreset::High;
+    bool m_shaderHotReload = true;
+    double m_shaderPollTime = 0.0;
+    static constexpr double SHADER_POLL_INTERVAL = 0.5; // seconds
 
     WorldSvoGpu* m_world = nullptr;
     MaterialLibrary m_materialLib{};
 
     vk::PhysicalDeviceRayTracingPipelinePropertiesKHR m_rtProps{};
+    vk::PhysicalDeviceAccelerationStructurePropertiesKHR m_asProps{};
     RayTracing m_raytracer;
     uint32_t m_frameCount = 0;
     Denoiser m_denoiser;
     PostProcess m_postProcess;
+    SvoBuilder m_svoBuilder;
+    CudaInterop m_cudaInterop;
+    uint64_t m_traceValue = 0; // what this frame's copy waits on, from m_cudaInterop.trace
+
+    // last so its workers are joined before anything a startup job touches goes away
+    std::unique_ptr<JobSystem> m_startupJobs;
+    JobCounter m_startupCounter;
+    std::mutex m_startupErrorMutex;
+    std::exception_ptr m_startupError;
+
     friend class RayTracing;
     friend class Denoiser;
     friend class PostProcess;
+    friend class SvoBuilder;
+    friend class CudaInterop;
 };
 
 }
@@ -0,0 +1,105 @@
+/*
+* File: renderer_cuda_interop.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+
+#ifndef RENDERER_CUDA_INTEROP_HPP
+#define RENDERER_CUDA_INTEROP_HPP
+
+#include <array>
+#include <functional>
+#include <vector>
+#include "resources.hpp"
+
+namespace blok {
+
+class Renderer;
+class RenderGraph;
+
+#ifdef _WIN32
+using ExternalHandle = void*; // NT HANDLE, stays owned by the renderer
+#else
+using ExternalHandle = int; // opaque fd, ownership moves to whoever imports it (cuda closes it itself)
+#endif
+
+// everything an external tracer needs to write one frame straight into the renderer's gbuffer, see Renderer::setExternalTracer.
+// targets are tightly packed rows of 'width' texels in the GBUFFER_* formats (albedo rgba8, motion rg16f)
+struct ExternalTraceFrame {
+    struct Slot {
+        ExternalHandle memory{};
+        uint64_t size = 0; // of the whole dedicated allocation
+        uint64_t colorOffset = 0;
+        uint64_t positionOffset = 0;
+        uint64_t normalOffset = 0;
+        uint64_t albedoOffset = 0;
+        uint64_t motionOffset = 0;
+    };
+    // one per frame in flight (the renderer keeps two while a tracer is set). a slot is only handed out again once
+    // the frame that covered its copy is done, so the tracer never has to wait before writing it
+    std::array<Slot, 2> slots{};
+    // timeline semaphore, the tracer signals 'value' once slot 'slot' is written, the copy waits on it
+    ExternalHandle traceDone{};
+    uint8_t deviceUuid[VK_UUID_SIZE]{}; // pick the matching cuda device with this
+    // bumped whenever the handles above are new (swapchain resize), the tracer drops its imports and takes these
+    uint64_t generation = 0;
+
+    uint64_t value = 0;
+    uint32_t slot = 0;
+    uint32_t width = 0, height = 0; // render extent
+    const FrameUBO* ubo = nullptr;
+};
+
+using ExternalTracer = std::function<void(const ExternalTraceFrame&)>;
+
+// exportable memory + semaphore (VK_KHR_external_memory_fd / _win32) so an external tracer (CudaTracer) fills the
+// gbuffer instead of the ray tracing pipeline. the frame then goes through the denoiser and post chain unchanged,
+// the only extra work on the vulkan side is one buffer to image copy per target
+class CudaInterop {
+public:
+    Renderer* renderer;
+
+    // device extensions are there, set by createLogicalDevice
+    bool supported = false;
+
+public:
+    explicit CudaInterop(Renderer* r);
+
+    // enabled next to the required ones when the device has all of them
+    static std::vector<const char*> deviceExtensions();
+
+    // both only after setExternalTracer, sized for the swap extent so dynamic resolution never reallocates
+    void init(uint32_t width, uint32_t height);
+    void cleanup();
+    void resize(uint32_t width, uint32_t height);
+
+    bool active() const { return static_cast<bool>(m_tracer); }
+    void setTracer(ExternalTracer tracer) { m_tracer = std::move(tracer); }
+
+    // hands the frame to the tracer, between acquire and record. returns the value the frame's copy waits on
+    uint64_t trace(const FrameUBO& ubo, uint32_t slot, uint32_t width, uint32_t height);
+    vk::Semaphore traceDone() const { return m_traceDone; }
+
+    // copies slot into the gbuffer targets, in place of the ray tracing pass
+    void record(RenderGraph& graph, uint32_t slot);
+
+private:
+    struct SlotTargets {
+        vk::DeviceMemory memory{};
+        Buffer buffer{}; // alloc stays null, memory above is the dedicated exportable allocation
+    };
+    std::array<SlotTargets, 2> m_slots{};
+    vk::Semaphore m_traceDone{};
+    ExternalTracer m_tracer;
+    ExternalTraceFrame m_frame{};
+
+    void createTargets(uint32_t width, uint32_t height);
+    void destroyTargets();
+    ExternalHandle exportMemory(vk::DeviceMemory memory) const;
+    void closeHandles();
+};
+
+}
+
+#endif //RENDERER_CUDA_INTEROP_HPP
@@ -8,13 +8,17 @@
 #ifndef RENDERER_TEMPORAL_REPROJECTION_HPP
 #define RENDERER_TEMPORAL_REPROJECTION_HPP
 #include <array>
+#include <string>
+#include <vector>
+#include "descriptors.hpp"
 #include "resources.hpp"
 namespace blok {
 
 class Renderer;
+class RenderGraph;
 
 struct DenoiserPipeline {
-    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = FRAMES_IN_FLIGHT_MAX;
     static constexpr int MAX_ATROUS_ITERATIONS = 5;
 
     // temporal accumulation pass
@@ -35,8 +39,42 @@ struct DenoiserPipeline {
     vk::PipelineLayout atrousPipelineLayout;
     vk::Pipeline atrousPipeline;
 
+    // variance + atrous iterations 0 and 1 in one tiled dispatch, see atrous_fused.comp
+    vk::DescriptorSetLayout fusedSetLayout;
+    std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> fusedSets;
+    vk::PipelineLayout fusedPipelineLayout;
+    vk::Pipeline fusedPipeline;
+    bool fusedSupported = false;
+
+    // half resolution denoising, the a-trous sets above with the half res images instead, see
+    // denoise_downsample.comp / denoise_upsample.comp
+    std::array<std::array<vk::DescriptorSet, MAX_ATROUS_ITERATIONS>, MAX_FRAMES_IN_FLIGHT> halfAtrousSets;
+    vk::DescriptorSetLayout downsampleSetLayout;
+    std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> downsampleSets;
+    vk::PipelineLayout downsamplePipelineLayout;
+    vk::Pipeline downsamplePipeline;
+    vk::DescriptorSetLayout upsampleSetLayout;
+    std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> upsampleSets;
+    vk::PipelineLayout upsamplePipelineLayout;
+    vk::Pipeline upsamplePipeline;
+
+    // adaptive a-trous tile classification, see atrous_classify.comp
+    vk::DescriptorSetLayout classifySetLayout;
+    std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> classifySets;
+    vk::PipelineLayout classifyPipelineLayout;
+    vk::Pipeline classifyPipeline;
+
+    // progressive accumulation pass, see progressive.comp
+    vk::DescriptorSetLayout progressiveSetLayout;
+    std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> progressiveSets;
+    vk::PipelineLayout progressivePipelineLayout;
+    vk::Pipeline progressivePipeline;
+
     vk::Sampler linearSampler;
     vk::Sampler nearestSampler;
+
+    // covers all the passes' sets of a frame
+    std::array<DescriptorSetKey, MAX_FRAMES_IN_FLIGHT> setKeys;
 };
 
 class Denoiser {
@@ -69,32 +107,71 @@ public:
         float phiNormal = 128.0f;
         float phiDepth = 0.1f;
         int atrousIterations = 4;
+        // fuse variance and the first two iterations when the device has the shared memory for it
+        bool fusedAtrous = true;
+        // a-trous on demodulated irradiance at half resolution, then a depth/normal guided upsample that puts the
+        // albedo back. temporal and variance stay full res (history and the sample budget are per pixel).
+        // takes over from fusedAtrous
+        bool halfResolution = false;
+        // iterations from adaptiveFromIteration on only filter the 8x8 tiles where some pixel's accumulated variance
+        // is above adaptiveVarianceThreshold or its history is under minHistoryLength, the rest are copied through.
+        // full resolution only
+        bool adaptiveAtrous = false;
+        int adaptiveFromIteration = 2;
+        float adaptiveVarianceThreshold = 1e-4f;
 
         // Variance estimation
         float varianceBoost = 1.5f;
         int minHistoryLength = 4;
+
+        // with the camera and world standing still, every frame is summed into gbuffer.accumulation instead of only
+        // the temporal blend. the a-trous output fades out over the first progressiveDenoiseFrames, after that the
+        // filters are skipped, and tracing stops altogether at progressiveTargetSpp
+        bool progressive = false;
+        int progressiveDenoiseFrames = 32;
+        int progressiveTargetSpp = 4096;
     } settings;
 
+    // frames summed into gbuffer.accumulation, counting this one. 0 = not accumulating
+    uint32_t progressiveFrames = 0;
+    // false once progressiveTargetSpp is reached, nothing is traced or denoised and post gets the last mean again
+    bool progressiveTracing = true;
+
 public:
     explicit Denoiser(Renderer* r);
 
     void init(uint32_t width, uint32_t height);
     void cleanup();
 
-    // called on swapchain recreate specifically
+    // swapchain recreate and render scale changes. the targets are allocated at Renderer::renderTargetExtent and
+    // everything runs in their top left width x height, a size that fits only drops the history
     void resize(uint32_t width, uint32_t height);
 
+    // the a-trous kernel is specialized per quality preset, the gpu must be idle
+    void rebuildAtrousPipeline();
+    // hot reload, rebuilds the passes whose source changed
+    void reloadShaders(const std::vector<std::string>& changed);
+
     void updatePreviousFrameData(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& camPos);
 
-    void fillFrameUBO(FrameUBO& ubo, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& camPos, float deltaTime, int depth, uint32_t frameCount, uint32_t screenWidth, uint32_t screenHeight, int atrousIteration = 0);
+    void fillFrameUBO(FrameUBO& ubo, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& camPos, float deltaTime, uint32_t frameCount, uint32_t screenWidth, uint32_t screenHeight, int atrousIteration = 0);
 
-    void denoise(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
+    void denoise(RenderGraph& graph, uint32_t width, uint32_t height, uint32_t frameIndex);
 
     void swapHistoryBuffers(); // call after dispatch
 
+    // once per frame before recording. restart when anything the image depends on changed since the last one
+    void updateProgressive(bool restart, uint32_t samplesPerFrame);
+    bool progressiveActive() const { return settings.progressive && progressiveFrames > 0; }
+
     Image& getOutputImage();
 
 private:
+    // what the gbuffer was allocated for, resize reallocates when any of it no longer holds
+    vk::Extent2D capacity{};
+    bool capacityAsync = false;
+    bool capacityStats = false;
+
     void createGBuffer(uint32_t width, uint32_t height);
     void destroyGBuffer();
     void createSamplers();
@@ -102,6 +179,11 @@ private:
     void createTemporalPipeline();
     void createVariancePipeline();
     void createAtrousPipeline();
+    void createFusedAtrousPipeline();
+    void createDownsamplePipeline();
+    void createUpsamplePipeline();
+    void createClassifyPipeline();
+    void createProgressivePipeline();
 
     void createDescriptorSetLayouts();
     void allocateDescriptorSets();
@@ -109,9 +191,25 @@ private:
 
     void dispatchTemporalAccumulation(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
     void dispatchVarianceEstimation(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
-    void dispatchAtrousFilter(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex, int iteration);
-
-    void copyCurrentGeometryToHistory(vk::CommandBuffer cmd);
+    // width/height of the filtered image, half the screen's with halfRes
+    void dispatchAtrousFilter(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex, int iteration,
+                              bool halfRes = false);
+    // indirect over the tiles atrous_classify.comp left active, the converged ones copied through first
+    void dispatchAtrousTiles(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex, int iteration,
+                             bool copyConverged);
+    void dispatchClassify(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
+    void dispatchFusedAtrous(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
+    // width/height of the image the pass writes
+    void dispatchResample(vk::CommandBuffer cmd, vk::Pipeline pipe, vk::PipelineLayout layout, vk::DescriptorSet set,
+                          uint32_t width, uint32_t height);
+    void dispatchProgressive(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
+    // variance and the a-trous iterations, the part of denoise progressive accumulation skips once it has enough frames
+    void filterAtrous(RenderGraph& graph, uint32_t width, uint32_t height, uint32_t frameIndex);
+
+    // where the a-trous iterations end, ping or pong (filterPing after the upsample at half resolution)
+    Image& atrousOutput();
+    // where the half res iterations end, halfPong when there are none
+    Image& halfAtrousOutput();
 
     friend class Renderer;
 };
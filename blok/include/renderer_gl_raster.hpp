@@ -0,0 +1,107 @@
+/*
+* File: renderer_gl_raster.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef RENDERER_GL_RASTER_HPP
+#define RENDERER_GL_RASTER_HPP
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_manager.hpp"
+
+namespace blok {
+
+struct Camera;
+
+// 8 bytes per vertex: chunk-local corner x | y << 9 | z << 18 | face << 27, then the material id
+struct RasterVertex {
+    uint32_t positionFace;
+    uint32_t material;
+};
+static_assert(sizeof(RasterVertex) == 8, "RasterVertex must stay packed");
+
+// rasterized view of a ChunkManager for the gl backend, no ray tracing hardware needed.
+// chunks are greedy meshed on the chunk manager's job system and only remeshed when their voxels change.
+// every mesh lives in one vertex buffer, the chunks in the frustum go out as one multi-draw indirect
+// (one draw per chunk on contexts older than 4.3)
+class ChunkRasterGL {
+public:
+    ChunkRasterGL() = default;
+    ~ChunkRasterGL();
+
+    ChunkRasterGL(const ChunkRasterGL&) = delete;
+    ChunkRasterGL& operator=(const ChunkRasterGL&) = delete;
+
+    // needs the gl context current
+    void init();
+    void shutdown();
+
+    // on the thread that owns mgr: queues meshing for chunks that changed, uploads finished meshes,
+    // frees the ranges of chunks that are gone
+    void update(ChunkManager& mgr);
+    // materials changed since the last call
+    void updateMaterials(MaterialLibrary& lib);
+    void draw(const Camera& cam, uint32_t width, uint32_t height);
+
+    [[nodiscard]] size_t chunkCount() const { return m_meshes.size(); }
+    [[nodiscard]] size_t drawnChunks() const { return m_drawn; }
+    [[nodiscard]] size_t vertexCount() const { return m_vertexCount; }
+    [[nodiscard]] size_t meshesInFlight() const { return m_inFlight; }
+
+private:
+    struct ChunkMesh {
+        const Chunk* chunk = nullptr; // chunks are pooled, a new one at the same coord is a new mesh
+        uint64_t editCount = 0;
+        bool meshing = false; // a job for this chunk hasn't come back yet
+        glm::vec3 origin{0.0f};
+        uint32_t first = 0, count = 0; // vertex range in the shared buffer
+    };
+
+    struct MeshResult {
+        ChunkCoord coord;
+        const Chunk* chunk;
+        uint64_t editCount;
+        std::vector<RasterVertex> vertices;
+    };
+
+    // vertex ranges in the shared buffer, first fit like the packer's heaps. grows (and copies) when full
+    uint32_t allocVertices(uint32_t count);
+    void freeVertices(uint32_t first, uint32_t count);
+    void growVertexBuffer(uint32_t minCapacity);
+
+    std::unordered_map<ChunkCoord, ChunkMesh, ChunkCoordHash> m_meshes;
+
+    JobSystem* m_jobs = nullptr;
+    JobCounter m_pending;
+    size_t m_inFlight = 0;
+    std::mutex m_mutex;
+    std::vector<MeshResult> m_finished;
+
+    uint32_t m_vertexCapacity = 0;
+    uint32_t m_vertexTop = 0;
+    std::vector<GpuRange> m_freeVertices;
+    size_t m_vertexCount = 0;
+    size_t m_drawn = 0;
+    float m_voxelSize = 1.0f;
+    float m_chunkSize = 0.0f; // world units per chunk edge
+
+    std::vector<MaterialGpu> m_materials;
+    std::vector<GpuRange> m_dirtyMaterials;
+
+    unsigned int m_prog = 0;
+    unsigned int m_vao = 0;
+    unsigned int m_vertexBuffer = 0;
+    unsigned int m_originBuffer = 0; // per draw chunk origin, read through the base instance
+    unsigned int m_indirectBuffer = 0;
+    unsigned int m_materialBuffer = 0;
+    unsigned int m_materialTex = 0;
+    bool m_active = false;
+};
+
+}
+
+#endif //RENDERER_GL_RASTER_HPP
@@ -9,14 +9,18 @@
 #define RENDERER_POSTPROCESS_HPP
 
 #include <array>
+#include <string>
+#include <vector>
+#include "descriptors.hpp"
 #include "resources.hpp"
 
 namespace blok {
 
 class Renderer;
+class RenderGraph;
 
 struct PostProcessPipeline {
-    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = FRAMES_IN_FLIGHT_MAX;
 
     // TAA pass
     vk::DescriptorSetLayout taaSetLayout;
@@ -36,8 +40,26 @@ struct PostProcessPipeline {
     vk::PipelineLayout sharpenPipelineLayout;
     vk::Pipeline sharpenPipeline;
 
+    // TAA + tonemap + sharpen in one pass, see post_fused.comp
+    vk::DescriptorSetLayout fusedSetLayout;
+    std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> fusedSets;
+    vk::PipelineLayout fusedPipelineLayout;
+    vk::Pipeline fusedPipeline;
+
+    // traversal stats heatmap over the final output, see traversal_heatmap.comp
+    vk::DescriptorSetLayout heatmapSetLayout;
+    std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> heatmapSets;
+    vk::PipelineLayout heatmapPipelineLayout;
+    vk::Pipeline heatmapPipeline;
+
     vk::Sampler linearSampler;
     vk::Sampler nearestSampler;
+
+    // covers all three passes' sets of a frame
+    std::array<DescriptorSetKey, MAX_FRAMES_IN_FLIGHT> setKeys;
+    // the fused set, its output can be a different swapchain image every frame
+    std::array<DescriptorSetKey, MAX_FRAMES_IN_FLIGHT> fusedSetKeys;
+    std::array<DescriptorSetKey, MAX_FRAMES_IN_FLIGHT> heatmapSetKeys;
 };
 
 struct PostProcessBuffers {
@@ -48,6 +70,7 @@ struct PostProcessBuffers {
     Image taaOutput;
     Image tonemapOutput;
     Image sharpenOutput;
+    Image heatmapOutput;
 
     uint32_t historyIndex = 0;
 
@@ -57,11 +80,16 @@ struct PostProcessBuffers {
     void swapHistory() { historyIndex = 1 - historyIndex; }
 };
 
+// the post images are pooled at Renderer::renderTargetExtent, output sizes are the part of them in use
+
 struct TAAPushConstants {
     float jitterX;
     float jitterY;
     float feedbackMin;
     float feedbackMax;
+    uint32_t outputWidth;
+    uint32_t outputHeight;
+    uint32_t historyValid; // 0 after a resize, the history holds the old size's pixels
 };
 
 struct TonemapPushConstants {
@@ -69,11 +97,34 @@ struct TonemapPushConstants {
     float saturationBoost;
     int tonemapOperator;
     float whitePoint;
+    // used part of the input over its allocated size, it's the denoiser's render sized image without TAA
+    float inputScaleX;
+    float inputScaleY;
+    uint32_t outputWidth;
+    uint32_t outputHeight;
 };
 
 struct SharpenPushConstants {
     float sharpenStrength; // 0.0 - 1.0
-    float padding[3];
+    uint32_t outputWidth;
+    uint32_t outputHeight;
+    float padding;
+};
+
+struct HeatmapPushConstants {
+    uint32_t renderWidth;
+    uint32_t renderHeight;
+    uint32_t mode; // TraversalHeatmap
+    float maxValue;
+    float opacity;
+    uint32_t outputWidth;
+    uint32_t outputHeight;
+};
+
+struct FusedPostPushConstants {
+    TAAPushConstants taa;
+    TonemapPushConstants tonemap;
+    float sharpenStrength;
 };
 
 enum class TonemapOperator : int {
@@ -81,6 +132,25 @@ enum class TonemapOperator : int {
     KhronosPBRNeutral = 1,
 };
 
+// which traversal counter the heatmap shows, needs RayTracing::Settings::traversalStats
+enum class TraversalHeatmap : int {
+    Off = 0,
+    NodesPerRay = 1,
+    TraversalsPerRay = 2,
+    StackDepth = 3,
+    CutOffs = 4,
+    Rays = 5,
+    Bounces = 6,
+};
+
+// temporal upscaling presets, the render resolution TAA reconstructs the output from
+enum class UpscaleMode : int {
+    Native = 0,
+    Quality = 1,     // 67%
+    Balanced = 2,    // 58%
+    Performance = 3, // 50%
+};
+
 class PostProcess {
 public:
     Renderer* renderer;
@@ -88,8 +158,8 @@ public:
     PostProcessPipeline pipeline;
     PostProcessBuffers buffers;
 
-    // TAA jitter sequence
-    static constexpr int JITTER_SEQUENCE_LENGTH = 16;
+    // TAA jitter sequence, only the first jitterPhaseCount() are used
+    static constexpr int JITTER_SEQUENCE_LENGTH = 64;
     glm::vec2 jitterSequence[JITTER_SEQUENCE_LENGTH];
     uint32_t jitterIndex = 0;
 
@@ -105,6 +175,8 @@ public:
         float feedbackMin = 0.93f;
         float feedbackMax = 0.98f;
         float velocityRejectionScale = 1.0f;
+        // needs TAA, it's the reconstruction filter
+        UpscaleMode upscaleMode = UpscaleMode::Native;
 
         // Tonemap settings
         bool enableTonemapping = true;
@@ -116,6 +188,14 @@ public:
         // Sharpening settings
         bool enableSharpening = true;
         float sharpenStrength = 0.5f;
+
+        // one dispatch for all three when they're all on
+        bool fusedPost = true;
+
+        // blended over the output before it's presented, heatmapMax maps to the top of the ramp
+        TraversalHeatmap heatmap = TraversalHeatmap::Off;
+        float heatmapMax = 64.0f;
+        float heatmapOpacity = 0.75f;
     } settings;
 
 public:
@@ -124,25 +204,44 @@ public:
     void init(uint32_t width, uint32_t height);
     void cleanup();
 
+    // allocated at Renderer::renderTargetExtent, a size that fits only drops the TAA history
     void resize(uint32_t width, uint32_t height);
 
+    // hot reload, rebuilds the passes whose source changed
+    void reloadShaders(const std::vector<std::string>& changed);
+
     glm::vec2 getJitterOffset() const;
 
     glm::vec2 getJitterClipSpace(uint32_t width, uint32_t height) const;
 
     void advanceJitter();
 
+    // render scale the upscaler wants, 1 at native or without TAA
+    float upscaleScale() const;
+
+    // more phases the fewer render pixels each output pixel gets, 8 per covered render pixel
+    uint32_t jitterPhaseCount() const;
+
     void updatePreviousFrameData(const glm::mat4& view, const glm::mat4& proj);
 
     glm::mat4 getJitteredProjection(const glm::mat4& proj, uint32_t width, uint32_t height) const;
 
-    void process(vk::CommandBuffer cmd, Image& inputColor, uint32_t width, uint32_t height, uint32_t frameIndex);
+    // target: where the fused pass writes instead of sharpenOutput (the swapchain image), needs fusedActive()
+    void process(RenderGraph& graph, Image& inputColor, uint32_t width, uint32_t height, uint32_t frameIndex, Image* target = nullptr);
+
+    // TAA, tonemap and sharpen run as the single fused dispatch this frame
+    bool fusedActive() const;
+
+    // the traversal heatmap pass runs after the others this frame and getOutputImage is its output
+    bool heatmapActive() const;
 
     Image& getOutputImage();
 
     void swapHistoryBuffers();
 
 private:
+    vk::Extent2D capacity{}; // what buffers were allocated at
+
     void createBuffers(uint32_t width, uint32_t height);
     void destroyBuffers();
     void createSamplers();
@@ -153,14 +252,23 @@ private:
     void createTAAPipeline();
     void createTonemapPipeline();
     void createSharpenPipeline();
+    void createFusedPipeline();
+    void createHeatmapPipeline();
 
     void createDescriptorSetLayouts();
     void allocateDescriptorSets();
     void updateDescriptorSets(uint32_t frameIndex, Image& inputColor);
+    void updateFusedDescriptorSet(uint32_t frameIndex, Image& inputColor, Image& target);
+    void updateHeatmapDescriptorSet(uint32_t frameIndex, Image& scene);
 
     void dispatchTAA(vk::CommandBuffer cmd, Image& inputColor, uint32_t width, uint32_t height, uint32_t frameIndex);
-    void dispatchTonemap(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
+    void dispatchTonemap(vk::CommandBuffer cmd, Image& inputColor, uint32_t width, uint32_t height, uint32_t frameIndex);
     void dispatchSharpen(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
+    void dispatchFused(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
+    void dispatchHeatmap(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex);
+
+    // what the enabled passes leave, before the heatmap
+    Image& passOutput();
 
     friend class Renderer;
 };
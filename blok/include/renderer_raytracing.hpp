@@ -7,12 +7,25 @@
 #ifndef RENDERER_RAYTRACING_HPP
 #define RENDERER_RAYTRACING_HPP
 #include <array>
+#include <string>
+#include <vector>
+#include "descriptors.hpp"
 #include "resources.hpp"
 #include "vulkan_context.hpp"
 
 namespace blok {
 class Renderer;
 
+// which shader execution reordering raygen uses to sort hit shading by material
+enum class InvocationReorder { None, NV, EXT };
+
+// pixels that run the full path each frame, the others are reconstructed by the denoiser's temporal pass
+enum class TracePattern : uint32_t { Full, Checkerboard, Quarter };
+
+// what raygen does with the ao baked into the svo (ChunkManager::bakeAmbientOcclusion): nothing, end paths at the
+// first bounce with sky light through the baked openness, or the same at the primary hit (sun + baked ambient only)
+enum class BakedLighting : uint32_t { Off, Bounces, Preview };
+
 struct RayTracingPipeline {
     vk::Pipeline pipeline{};
     vk::PipelineLayout layout{};
@@ -20,8 +33,15 @@ struct RayTracingPipeline {
     Buffer rgenSBT;
     Buffer missSBT;
     Buffer hitSBT;
+    Buffer restirSBT; // restir_spatial.rgen, a second raygen sharing the miss + hit records
+    Buffer radianceCacheSBT; // radiance_cache.rgen, traces nothing
+
+    // raygen.rgen built as a compute shader with BLOK_RAY_QUERY, same layout. null without VK_KHR_ray_query
+    vk::Pipeline queryPipeline{};
 
     vk::StridedDeviceAddressRegionKHR rgenRegion;
+    vk::StridedDeviceAddressRegionKHR restirRegion;
+    vk::StridedDeviceAddressRegionKHR radianceCacheRegion;
     vk::StridedDeviceAddressRegionKHR missRegion;
     vk::StridedDeviceAddressRegionKHR hitRegion;
     vk::StridedDeviceAddressRegionKHR callRegion;
@@ -31,24 +51,126 @@ class RayTracing {
 public:
     Renderer* r;
 
-    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = FRAMES_IN_FLIGHT_MAX;
 
     vk::DescriptorSetLayout rtSetLayout{};
     std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> rtSets{};
+    std::array<DescriptorSetKey, MAX_FRAMES_IN_FLIGHT> rtSetKeys{};
 
     RayTracingPipeline rtPipeline{};
 
+    struct Settings {
+        // lod traversal, interior nodes below a pixel footprint are hit as solid cubes
+        bool enableLod = true;
+        float lodScale = 1.0f; // footprint multiplier, >1 stops earlier
+        // emissive direct light on the primary hit through reservoir resampling (one shadow ray per pixel)
+        // instead of the per sample next event estimation
+        bool restirDI = true;
+        // paths end in the world space radiance cache after the first bounce, it carries the rest of the bounces
+        bool radianceCache = true;
+        // per pixel sample count from the denoiser's variance + history length (GBuffer::sampleBudget),
+        // between 1 and twice the preset's, instead of the preset's everywhere
+        bool adaptiveSampling = false;
+        float adaptiveNoiseTarget = 0.05f; // relative noise of the accumulated color a pixel at the preset count has
+        TracePattern tracePattern = TracePattern::Full;
+        // primary hits from the world's surface mesh rasterized into GBuffer::visibility, the trace starts at the
+        // first bounce. falls back to the primary ray when the world has no valid mesh (see buildSurfaceMesh)
+        bool rasterPrimary = false;
+        // rays jump over the empty bricks of the chunk distance field (see buildEmptySpaceField) before the svo descent
+        bool emptySpaceSkipping = true;
+        // voxels without a bake (gpu built chunks, edits still rebuilding) are traced as usual
+        BakedLighting bakedLighting = BakedLighting::Off;
+        // the sky is Renderer::setEnvironmentMap's hdr when one is set, sampled directly (alias table, mis with the
+        // bounces) wherever the emissive voxels are. off falls back to the analytic sky + sun
+        bool environmentMap = true;
+        float environmentIntensity = 1.0f;
+        // paths from rouletteStartBounce on survive with their throughput as the odds and are reweighted
+        bool russianRoulette = true;
+        uint32_t rouletteStartBounce = 1;
+        // average bounce rays per pixel and frame, split over the samples. a sample past its share keeps
+        // rolling with halving odds per extra bounce, so the spend stays near it without biasing. 0 = no budget
+        uint32_t rayBudget = 0;
+        // tlas_cull.comp masks out the chunk instances past cullDistance (0 = no limit), and with frustumCulling
+        // the ones outside the view further than giRadius, which stay in for the bounces. the tlas is refit each frame
+        bool tlasCulling = false;
+        float cullDistance = 0.0f;
+        bool frustumCulling = true;
+        float giRadius = 64.0f;
+        // the main trace runs as rayQuery compute (queryPipeline) with the svo walked inline, no sbt.
+        // restir spatial and the radiance cache resolve stay on the rt pipeline
+        bool rayQuery = false;
+        // hit.rchit returns a 16 byte hit record (visibility.frag's layout) and raygen fetches the material itself,
+        // instead of the 60 byte shaded payload. a switch rebuilds the rt pipeline, the ray query build has no payload
+        bool slimPayload = false;
+        // raygen and the svo walks count rays, bounces, node visits, stack depth and MAX_ITER cut offs per pixel into
+        // GBuffer::traversalStats (the heatmaps) and the frame totals (Renderer::traversalStats). a specialization
+        // constant, a switch rebuilds the rt pipeline and the gbuffer
+        bool traversalStats = false;
+    } settings;
+    // what the live rt pipeline was compiled with, endFrame rebuilds it when settings.slimPayload or
+    // settings.traversalStats moves away
+    bool pipelineSlimPayload = false;
+    bool pipelineTraversalStats = false;
+    // last frame traced with restirDI, its reservoirs are only reused if so
+    bool restirLastFrame = false;
+    // pattern this frame's FrameUBO asked for, the launch size follows it rather than a settings change mid frame
+    TracePattern framePattern = TracePattern::Full;
+    // this frame's FrameUBO has rasterPrimary set, the visibility pass runs before the trace
+    bool frameRaster = false;
+    // this frame traces with queryPipeline, the trace pass is a compute one then
+    bool frameQuery = false;
+
+    // visibility.vert/.frag, the surface mesh into GBuffer::visibility against the renderer's depth buffer
+    vk::PipelineLayout visibilityLayout{};
+    vk::Pipeline visibilityPipeline{};
+    VisibilityPC visibilityPC{};
+
+    // tlas_cull.comp, instance masks of the world's tlas
+    vk::DescriptorSetLayout cullSetLayout{};
+    std::array<vk::DescriptorSet, MAX_FRAMES_IN_FLIGHT> cullSets{};
+    std::array<DescriptorSetKey, MAX_FRAMES_IN_FLIGHT> cullSetKeys{};
+    vk::PipelineLayout cullLayout{};
+    vk::Pipeline cullPipeline{};
+    TlasCullPC cullPC{};
+    // the tlas was last refit with masks, a pass with enabled = 0 puts them back once culling is turned off
+    bool tlasCulled = false;
+
 public:
     explicit RayTracing(Renderer* r);
 
     void createDescriptorSetLayout();
     void allocateDescriptorSet();
+    // no-op unless something the set points at changed since it was last written
     void updateDescriptorSet(const WorldSvoGpu&, uint32_t frameIndex);
 
+    // both read the renderer's current quality preset
     void createPipeline();
     void createSBT();
+    // pipeline, layout and sbt, the gpu must be done with them
+    void destroyPipeline();
+    // hot reload: new pipeline + sbt if one of the rt stages changed, the old ones are retired
+    void reloadShaders(const std::vector<std::string>& changed);
+
+    // independent of the quality preset, created once
+    void createVisibilityPipeline();
+    void destroyVisibilityPipeline();
+    // also created once, the set layout + sets come with the rt ones
+    void createCullPipeline();
+    void destroyCullPipeline();
+
+    // budget map the trace of frameIndex reads. the previous frame's, except with async compute where that one
+    // may still be in the denoiser, then the one this frame in flight wrote last time
+    uint32_t sampleBudgetSlot(uint32_t frameIndex) const;
 
+    // draws the world's surface mesh, inside the renderer's cmdBeginRendering on GBuffer::visibility
+    void drawVisibility(vk::CommandBuffer cmd, const WorldSvoGpu& gpu);
+    // cullPC's masks into the instance buffer, then an in place update of the tlas with them
+    void recordTlasCull(vk::CommandBuffer cmd, WorldSvoGpu& gpu, uint32_t frameIndex);
     void dispatchRayTracing(vk::CommandBuffer cmd, uint32_t w, uint32_t h, uint32_t frameIndex);
+    // spatial reuse over the reservoirs dispatchRayTracing wrote, shades them into gbuffer.color
+    void dispatchRestirSpatial(vk::CommandBuffer cmd, uint32_t w, uint32_t h, uint32_t frameIndex);
+    // folds this frame's radiance cache samples into the cells, one invocation per cell
+    void dispatchRadianceCache(vk::CommandBuffer cmd, uint32_t cellCount, uint32_t frameIndex);
 };
 
 }
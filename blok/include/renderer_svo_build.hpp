@@ -0,0 +1,96 @@
+/*
+* File: renderer_svo_build.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+
+#ifndef RENDERER_SVO_BUILD_HPP
+#define RENDERER_SVO_BUILD_HPP
+
+#include <string>
+#include <vector>
+#include "resources.hpp"
+
+namespace blok {
+
+class Renderer;
+
+// one pipeline per pass of svo_build.comp, all share the layout
+struct SvoBuildPipeline {
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+
+    vk::Pipeline brushPipeline;
+    vk::Pipeline bricksPipeline;
+    vk::Pipeline reducePipeline;
+    vk::Pipeline scanPipeline;
+    vk::Pipeline emitPipeline;
+    vk::Pipeline subChunksPipeline;
+};
+
+// offsets are in uint32 words, input ones into svoBuildInput, scratch ones into svoBuildScratch
+struct SvoBuildPushConstants {
+    uint32_t tableOffset;
+    uint32_t voxelOffset;
+    uint32_t cellOffset;
+    uint32_t maskOffset;
+    uint32_t prefixOffset;
+    uint32_t wordPrefixOffset;
+    uint32_t headerOffset;
+    uint32_t boundsOffset;
+    uint32_t aabbOffset;
+    uint32_t nodeOffset; // chunk's range in the world heaps
+    uint32_t brickOffset;
+    uint32_t subChunkOffset;
+    uint32_t maxDepth;
+    uint32_t storageShift;
+    uint32_t level; // reduce pass only
+    uint32_t divisions;
+    float voxelSize;
+    uint32_t cellCount; // threads the pass needs
+    uint32_t brushBrickOffset;
+    uint32_t brushOffset;
+    uint32_t brushCount;
+};
+
+// builds chunk svos on the gpu from their uploaded sparse storage (WorldSvoGpu::gpuBuilds):
+// pending brushes are applied to the voxels, then leaf bricks, then one reduction per level up to the root, a scan for the packed child
+// indices, and the nodes + bricks + sub-chunks go straight into the world heaps
+class SvoBuilder {
+public:
+    Renderer* renderer;
+
+    SvoBuildPipeline pipeline;
+
+public:
+    explicit SvoBuilder(Renderer* r);
+
+    void init();
+    void cleanup();
+
+    // hot reload, every pass is a variant of svo_build.comp so they all get rebuilt
+    void reloadShaders(const std::vector<std::string>& changed);
+
+    // records every queued build into cmd and clears the queue.
+    // goes after uploadSvoBuffers (the heaps have to be big enough) and before the blas builds
+    void record(vk::CommandBuffer cmd, WorldSvoGpu& gpuWorld);
+
+private:
+    // descriptor sets are rewritten per update, so one per world update in flight
+    struct BuildSet {
+        vk::DescriptorSet set{};
+        uint64_t value = 0; // timeline value after which it's free again
+    };
+    std::vector<BuildSet> m_sets;
+
+    void createDescriptorSetLayout();
+    void createPipelines();
+    vk::DescriptorSet acquireSet();
+
+    void dispatch(vk::CommandBuffer cmd, vk::Pipeline pass, const SvoBuildPushConstants& pc, uint32_t groups);
+};
+
+}
+
+#endif //RENDERER_SVO_BUILD_HPP
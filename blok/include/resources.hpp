@@ -9,16 +9,34 @@
 #include "vulkan_context.hpp"
 #include <vk_mem_alloc.h>
 
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "chunk.hpp"
 #include "material.hpp"
 #include "svo.hpp"
 
 namespace blok {
 
+// last gpu access recorded through RenderGraph, what the next pass touching the resource waits on
+struct AccessState {
+    vk::PipelineStageFlags2 writeStages{};
+    vk::AccessFlags2        writeAccess{};
+    vk::PipelineStageFlags2 readStages{}; // reads since that write, already made visible to these
+};
+
+// what a world buffer holds, for the per category memory stats. Untracked is everything createBuffer makes directly
+enum class MemoryCategory : uint8_t { Untracked, Svo, Materials, Lighting, Aabbs, Blas, Tlas, Scratch, Other, Count };
+
 struct Buffer {
     vk::Buffer     handle{};
     VmaAllocation  alloc{};
     void*          mapped = nullptr;
     vk::DeviceSize size = 0;
+    AccessState    access{};
+    MemoryCategory category = MemoryCategory::Untracked;
 };
 
 enum class ImageKind { Color, Depth, Storage };
@@ -33,33 +51,99 @@ struct Image {
     uint32_t                layers = 1;
     vk::SampleCountFlagBits samples{vk::SampleCountFlagBits::e1};
     vk::ImageLayout         currentLayout{vk::ImageLayout::eUndefined};
+    AccessState             access{};
 };
 
 struct Sampler {
     vk::Sampler handle{};
 };
 
+// define to trace into a compact G-buffer: RGBA16F color and filter ping-pong, the primary hit distance in
+// R32F instead of the world position (rebuilt from invView/invProj) and an octahedral normal + roughness
+// packed into one R32_UINT. the ray tracing, denoiser and TAA shaders are compiled with the same define
+// #define BLOK_COMPACT_GBUFFER
+
+#ifdef BLOK_COMPACT_GBUFFER
+static constexpr vk::Format GBUFFER_COLOR_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+static constexpr vk::Format GBUFFER_POSITION_FORMAT = vk::Format::eR32Sfloat;
+static constexpr vk::Format GBUFFER_NORMAL_FORMAT = vk::Format::eR32Uint;
+static constexpr const char* GBUFFER_SHADER_DEFINES = "#define BLOK_COMPACT_GBUFFER\n";
+#else
+static constexpr vk::Format GBUFFER_COLOR_FORMAT = vk::Format::eR32G32B32A32Sfloat;
+static constexpr vk::Format GBUFFER_POSITION_FORMAT = vk::Format::eR32G32B32A32Sfloat;
+static constexpr vk::Format GBUFFER_NORMAL_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+static constexpr const char* GBUFFER_SHADER_DEFINES = "";
+#endif
+
+// one ReSTIR DI reservoir (Reservoir in raygen.rgen / restir_spatial.rgen), five vec4s per pixel
+static constexpr vk::DeviceSize RESTIR_RESERVOIR_BYTES = 80;
+
+// upper bound of Renderer::setFramesInFlight, every per frame array is sized for it
+static constexpr uint32_t FRAMES_IN_FLIGHT_MAX = 3;
+
 struct GBuffer {
     // Current frame output
-    Image color; // RGBA32F
-    Image worldPosition; // RGBA32F
-    Image normalRoughness; // RGBA16F
+    Image color; // GBUFFER_COLOR_FORMAT
     Image albedoMetallic; // RGBA8
     Image motionVectors; // RG16F
 
-    // Geometry Validation
-    Image worldPositionHistory[2];
-    Image normalRoughnessHistory[2];
+    // Geometry, traced straight into a slot that is current this frame and previous the next one.
+    // async compute uses a third slot so the next trace never writes what the denoiser is still reading
+    static constexpr uint32_t MAX_GEOMETRY_SLOTS = 3;
+    Image worldPositionHistory[MAX_GEOMETRY_SLOTS]; // GBUFFER_POSITION_FORMAT
+    Image normalRoughnessHistory[MAX_GEOMETRY_SLOTS]; // GBUFFER_NORMAL_FORMAT
+    uint32_t geometrySlots = 2;
+    uint32_t geometryIndex = 0;
 
     // History buffers
     Image historyColor[2];
     Image historyMoments[2]; // RG32F
     Image historyLength[2]; // R16F
+    // ReSTIR DI, raygen writes the current one and reuses the previous one temporally
+    Buffer reservoirs[2];
 
     Image variance; // R32F
 
-    Image filterPing; // RGBA32F
-    Image filterPong; // RGBA32F
+    // R8 unorm, share of the adaptive sample maximum raygen spends per pixel. written next to the variance,
+    // one per frame in flight so a trace never reads the one the denoiser is writing (see RayTracing::sampleBudgetSlot)
+    Image sampleBudget[FRAMES_IN_FLIGHT_MAX];
+    bool sampleBudgetWritten[FRAMES_IN_FLIGHT_MAX] = {};
+
+    Image filterPing; // GBUFFER_COLOR_FORMAT
+    Image filterPong; // GBUFFER_COLOR_FORMAT
+
+    // half resolution denoising (Denoiser::Settings::halfResolution), demodulated irradiance and its variance at
+    // half the extent each way. the a-trous iterations ping-pong between these and the upsample lands in filterPing
+    Image halfPing; // GBUFFER_COLOR_FORMAT
+    Image halfPong; // GBUFFER_COLOR_FORMAT
+    Image halfVariance; // R32F
+
+    // adaptive a-trous (Denoiser::Settings::adaptiveAtrous), tile lists atrous_classify.comp fills: the dispatch
+    // args for the active tiles and the converged ones, then the tiles packed x | y << 16, active ones from the
+    // start, converged ones from tile count on. see ATROUS_TILE_HEADER_BYTES
+    Buffer atrousTiles;
+
+    // progressive accumulation (Denoiser::Settings::progressive), sum of every traced frame since the view last
+    // changed and the mean of it that goes to post
+    Image accumulation; // RGBA32F
+    Image progressive; // GBUFFER_COLOR_FORMAT
+
+    // rasterized primary hits (RayTracing::Settings::rasterPrimary), RGBA32 uint: (material id + 1) | face << 29
+    // (0 = sky), global sub-chunk, hit distance bits, snorm8 world normal
+    Image visibility;
+
+    // RayTracing::Settings::traversalStats, four words per pixel and then four per launch id of scratch, see
+    // traversal_stats.glsl. one entry when the stats are off
+    Buffer traversalStats;
+
+    // the other frame in flight's ray tracing outputs, only allocated with async compute.
+    // a frame traces into its own set while the previous one is still being denoised from the other
+    struct RayTargets {
+        Image color;
+        Image albedoMetallic;
+        Image motionVectors;
+    } parked;
+    uint32_t targetsFrame = 0; // frame in flight the live set belongs to
 
     uint32_t historyIndex = 0;
 
@@ -69,12 +153,26 @@ struct GBuffer {
     Image& previousMoments() { return historyMoments[1 - historyIndex]; }
     Image& currentHistoryLength() { return historyLength[historyIndex]; }
     Image& previousHistoryLength() { return historyLength[1 - historyIndex]; }
-    Image& currentWorldPosition() { return worldPositionHistory[historyIndex]; }
-    Image& previousWorldPosition() { return worldPositionHistory[1 - historyIndex]; }
-    Image& currentNormalRoughness() { return normalRoughnessHistory[historyIndex]; }
-    Image& previousNormalRoughness() { return normalRoughnessHistory[1 - historyIndex]; }
-
-    void swapHistory() { historyIndex = 1 - historyIndex; }
+    Buffer& currentReservoirs() { return reservoirs[historyIndex]; }
+    Buffer& previousReservoirs() { return reservoirs[1 - historyIndex]; }
+    Image& currentWorldPosition() { return worldPositionHistory[geometryIndex]; }
+    Image& previousWorldPosition() { return worldPositionHistory[(geometryIndex + geometrySlots - 1) % geometrySlots]; }
+    Image& currentNormalRoughness() { return normalRoughnessHistory[geometryIndex]; }
+    Image& previousNormalRoughness() { return normalRoughnessHistory[(geometryIndex + geometrySlots - 1) % geometrySlots]; }
+
+    void swapHistory() {
+        historyIndex = 1 - historyIndex;
+        geometryIndex = (geometryIndex + 1) % geometrySlots;
+    }
+
+    // makes the live ray targets frameIndex's own, no-op without a parked set
+    void useFrameTargets(uint32_t frameIndex) {
+        if (!parked.color.handle || frameIndex == targetsFrame) return;
+        std::swap(color, parked.color);
+        std::swap(albedoMetallic, parked.albedoMetallic);
+        std::swap(motionVectors, parked.motionVectors);
+        targetsFrame = frameIndex;
+    }
 };
 
 struct AtrousPC {
@@ -82,23 +180,158 @@ struct AtrousPC {
     float phiColor;
     float phiNormal;
     float phiDepth;
+    int guideScale = 1; // g-buffer texels per filtered texel each way, 2 at half resolution
+    int tileMode = 0; // 0 full screen, 1 the tiles in GBuffer::atrousTiles from tileOffset on, 2 copy those through
+    uint32_t tileOffset = 0;
+};
+
+// GBuffer::atrousTiles layout, two VkDispatchIndirectCommand (active, converged) padded to 32 bytes, then the tiles
+static constexpr uint32_t ATROUS_TILE_SIZE = 8;
+static constexpr vk::DeviceSize ATROUS_TILE_HEADER_BYTES = 32;
+static constexpr vk::DeviceSize ATROUS_CONVERGED_ARGS_OFFSET = sizeof(vk::DispatchIndirectCommand);
+
+struct AtrousClassifyPC {
+    float varianceThreshold;
+    int minHistoryLength;
+    uint32_t tileCount;
+    uint32_t width; // the gbuffer is pooled bigger, the part in use
+    uint32_t height;
+};
+
+struct TemporalPC {
+    uint32_t historyValid; // 0 after a resize, the pooled history holds the old size's pixels
+};
+
+struct ProgressivePC {
+    uint32_t frames;
+    float denoisedWeight;
+    uint32_t width;
+    uint32_t height;
+};
+
+// instance culling (RayTracing::Settings::tlasCulling), one plane test per frustum side + the distance policy
+struct TlasCullPC {
+    glm::vec4 planes[6]; // world space, xyz normal pointing in, w offset
+    glm::vec4 camPos; // w = cull distance, 0 keeps every distance
+    float giRadius; // frustum culled instances closer than this stay for bounces, < 0 frustum test off
+    uint32_t instanceCount;
+    uint32_t enabled; // 0 turns every mask back on
+    uint32_t pad;
+};
+static_assert(sizeof(TlasCullPC) == 128, "push constant range, expected 128 bytes");
+
+// vk::AccelerationStructureInstanceKHR's world box for tlas_cull.comp
+struct TlasInstanceBounds {
+    glm::vec4 lo;
+    glm::vec4 hi;
+};
+
+struct VisibilityPC {
+    glm::mat4 viewProj; // jittered, same as the FrameUBO raygen unprojects with
+    glm::vec4 camPos;
+};
+
+// a pixel Renderer::requestPick asked for, copied out of the gbuffer by the frame it was recorded in
+struct PickRequest {
+    uint64_t id = 0;
+    glm::vec2 uv{0.0f}; // 0..1 over the window
+    uint32_t x = 0, y = 0; // render resolution pixel, set when the copy is recorded
 };
 
 struct FrameResources {
     // Sync
     vk::Semaphore imageAvailable{};
     vk::Semaphore renderFinished{};
-    vk::Fence     inFlight{};
+    // Renderer::m_timeline value the frame's last submit signals, the slot is free again once it's reached
+    uint64_t      doneValue = 0;
 
     // Commands
     vk::CommandPool   cmdPool{};
     vk::CommandBuffer cmd{};
+    // async compute only: blit + gui + present on graphics, denoise + post on the async compute family
+    vk::CommandBuffer presentCmd{};
+    vk::CommandPool   computePool{};
+    vk::CommandBuffer computeCmd{};
 
-    // Uniforms
+    // Uniforms. persistently mapped linear ring for everything the frame uploads per draw,
+    // FrameUBO always sits at offset 0. rewound once doneValue has been reached, see Renderer::allocateFrameData
     Buffer frameUBO{};
     vk::DeviceSize uboHead = 0;
+
+    // Picks. the gbuffer texels of picks land in the host visible pickReadback and are decoded once doneValue
+    // has been reached, with the camera this frame traced with (the compact gbuffer keeps only the hit distance)
+    Buffer pickReadback{};
+    std::vector<PickRequest> picks;
+    glm::mat4 pickInvView{1.0f};
+    glm::mat4 pickInvProj{1.0f};
+    glm::vec3 pickCamPos{0.0f};
+    vk::Extent2D pickExtent{};
+
+    // RayTracing::Settings::traversalStats, raygen adds the frame's totals in, host visible. read and cleared
+    // once doneValue has been reached
+    Buffer traversalTotals{};
+};
+
+// traversalTotals as raygen.rgen's TraversalTotalsBuffer writes it. sums are 64 bit as lo, hi word pairs
+struct TraversalTotalsGpu {
+    uint32_t pixels;
+    uint32_t maxStack; // deepest svo stack any walk needed
+    uint32_t maxNodes; // most nodes one pixel visited
+    uint32_t pad0;
+    uint32_t rays[2];
+    uint32_t nodes[2];
+    uint32_t traversals[2]; // sub-chunk walks, one per intersection shader invocation
+    uint32_t bounces[2];
+    uint32_t cutOff[2]; // walks that gave up at MAX_ITER
+    uint32_t pad1[2];
+};
+static_assert(sizeof(TraversalTotalsGpu) == 64, "std430 layout of TraversalTotalsBuffer, expected 64 bytes");
+
+// a piece of the current frame's uniform ring (or of the staging ring)
+struct FrameAllocation {
+    vk::Buffer buffer{};
+    vk::DeviceSize offset = 0;
+    void* mapped = nullptr;
 };
 
+// persistent mapped staging memory for uploads, handed out front to back and wrapped at the end.
+// every span is tagged with the timeline value of the submit that reads it and reused once that has passed
+struct StagingRing {
+    struct Span {
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize end = 0;
+        uint64_t value = 0;
+    };
+
+    Buffer buffer{};
+    vk::DeviceSize head = 0; // next free byte
+    std::deque<Span> inFlight; // oldest first
+};
+
+// quality presets, each one is a set of specialization constants baked into the rt and a-trous pipelines
+enum class QualityPreset : uint32_t { Low, Medium, High, Ultra };
+
+// one block for every stage, each stage maps the fields it declares (see the layout(constant_id) lines)
+struct QualitySpecialization {
+    uint32_t sampleCount; // raygen.rgen id 0
+    uint32_t maxBounces; // raygen.rgen id 1
+    uint32_t maxIter; // intersect.rint id 0 (raygen.rgen id 2 in the ray query build), traversal steps before a ray gives up
+    int32_t atrousRadius; // atrous.comp id 0, 1 = 3x3, 2 = 5x5
+    // not part of a preset, RayTracing::Settings::traversalStats. raygen.rgen id 2 (5 in the ray query build), intersect.rint id 3
+    uint32_t traversalStats = 0;
+};
+
+// High is what the shaders defaulted to before the presets
+inline QualitySpecialization qualitySpecialization(QualityPreset preset) {
+    switch (preset) {
+    case QualityPreset::Low:    return {1, 1, 160, 1};
+    case QualityPreset::Medium: return {4, 2, 224, 2};
+    default:
+    case QualityPreset::High:   return {8, 2, 256, 2};
+    case QualityPreset::Ultra:  return {8, 4, 256, 2};
+    }
+}
+
 // TODO I can offload a chunk of this to a PC for the raygen shader
 struct alignas(16) FrameUBO {
     // Cam
@@ -118,7 +351,8 @@ struct alignas(16) FrameUBO {
     float delta_time = 0.0f;
 
     glm::vec3 prevCamPos{};
-    int depth = 1; // TODO not used anymore, replaced with sample_count
+    // bounce rays per pixel and frame raygen's roulette aims for (RayTracing::Settings::rayBudget), 0 = no budget
+    uint32_t rayBudget = 0;
 
     // Pathtracing
     uint32_t frame_count = 0; // increment each frame
@@ -146,7 +380,40 @@ struct alignas(16) FrameUBO {
 
     // TAA variables (used in raygen)
     glm::vec2 jitterOffset;
-    glm::vec2 _padding;
+
+    // lod (used in intersection). a node stops the descent once it's smaller than
+    // pixelSpreadAngle * distance to the camera * lodScale, 0 = always go down to the leaves
+    float pixelSpreadAngle = 0.0f;
+    float lodScale = 0.0f;
+
+    // ReSTIR DI (raygen + restir_spatial.rgen). bit 0 = on, bit 1 = the previous reservoirs are this pixel grid's
+    uint32_t restirDI = 0;
+    // secondary hits end in the radiance cache and primary hits feed it, 0 = trace every bounce
+    uint32_t radianceCache = 0;
+
+    // adaptive sampling, relative noise of the accumulated color the budget map aims for (variance.comp) and
+    // whether raygen takes its sample count from that map this frame
+    float adaptiveNoiseTarget = 0.0f;
+    uint32_t adaptiveSampling = 0;
+
+    // interleaved tracing, 0 = every pixel, 1 = checkerboard, 2 = one pixel of each 2x2 block. the rest only get a
+    // primary ray for the gbuffer and temporal_reproject.comp fills their color from history
+    uint32_t traceInterleave = 0;
+
+    // bounce 0 comes from GBuffer::visibility (the world's surface mesh rasterized) instead of a primary ray
+    uint32_t rasterPrimary = 0;
+
+    // intersect.rint leapfrogs through WorldSvoGpu::emptySpaceBuffer's empty bricks before the first node
+    uint32_t emptySpaceSkip = 0;
+
+    // raygen ends paths on voxels with baked ao, 0 = off, 1 = from the first bounce on, 2 = at the primary hit
+    uint32_t bakedLighting = 0;
+
+    // scale of the hdr environment (Renderer::setEnvironmentMap) raygen lights with and samples, 0 = the analytic sky
+    float environmentIntensity = 0.0f;
+
+    // raygen's throughput russian roulette, 0 = off, otherwise paths roll from bounce roulette - 1 on
+    uint32_t roulette = 0;
 };
 
 }
@@ -166,6 +433,9 @@ struct alignas(16) ChunkGpu {
 };
 static_assert(sizeof(ChunkGpu) == 48, "expected 48 bytes");
 
+// SubChunkGpu::materialBase for sub-chunks whose nodes carry their own materials (everything but dag packing)
+static constexpr uint32_t NO_DAG_MATERIALS = 0xFFFFFFFFu;
+
 // Each sub-chunk represents a portion of a chunk's SVO
 struct alignas(16) SubChunkGpu {
     // SVO navigation
@@ -174,39 +444,324 @@ struct alignas(16) SubChunkGpu {
     uint32_t nodeCount; // Total nodes in parent chunk (for bounds checking)
     uint32_t startDepth; // Depth at which this sub-chunk starts (for LOD)
 
-    // World-space bounds of this sub-chunk
-    glm::vec3 worldMin;
-    float subChunkSize; // Size of this sub-chunk in world units
+    // Chunk-local bounds of the filled voxels in this sub-chunk (the chunk's TLAS instance places it in the world)
+    // this is what goes into the blas aabb, so empty space around the geometry never reaches the intersection shader
+    glm::vec3 localMin;
+    float subChunkSize; // Size of this sub-chunk's svo cell in world units
 
-    glm::vec3 worldMax;
-    float pad0;
+    glm::vec3 localMax;
+    uint32_t brickOffset; // Offset into global brick words (start of parent chunk's bricks)
+
+    glm::vec3 cellMin; // chunk-local corner of the svo cell rootNodeIndex covers, traversal starts here
+    // dag packing: index in global brick words of the material of the root's first filled voxel
+    uint32_t materialBase = NO_DAG_MATERIALS;
+};
+static_assert(sizeof(SubChunkGpu) == 64, "expected 64 bytes");
+
+// how chunks are cut into sub-chunks (blas primitives)
+struct SubChunkLayout {
+    uint32_t divisions = 8; // per axis, power of two <= C / SVO_BRICK_SIZE. every chunk slot holds divisions^3 sub-chunks
+    // split only cells with more than leafThreshold filled voxels, down to 'divisions' at most.
+    // sparse cells stay whole as one bigger aabb, empty ones are dropped
+    bool adaptive = false;
+    uint32_t leafThreshold = 512;
+
+    bool operator==(const SubChunkLayout&) const = default;
 };
-static_assert(sizeof(SubChunkGpu) == 48, "expected 48 bytes");
 
 }
 
 namespace blok {
 
+// define to upload svo nodes as 8 byte SvoNodeCompact instead of the 16 byte SvoNode.
+// the intersection shader is compiled with the same define
+// #define BLOK_COMPACT_SVO_NODES
+
+// 8 byte gpu node.
+// bits 0-7 child mask, bits 8-31 first child relative to the chunk's node range.
+// leaves (mask 0) store 1 in the child bits when filled, 0 when empty.
+// bricks (mask 0) store their word offset + 2
+struct SvoNodeCompact {
+    uint32_t maskAndChild;
+    uint32_t materialId;
+};
+static_assert(sizeof(SvoNodeCompact) == 8, "expected 8 bytes");
+
+static constexpr uint32_t COMPACT_MAX_CHILD = 0xFFFFFFu;
+static constexpr uint32_t COMPACT_BRICK_BIAS = 2u;
+
+inline SvoNodeCompact packSvoNodeCompact(const SvoNode& n) {
+    SvoNodeCompact c{};
+    const uint32_t mask = svoChildBits(n);
+    uint32_t child = 0u;
+    if (svoIsBrick(n)) child = n.firstChild + COMPACT_BRICK_BIAS;
+    else if (mask != 0u) child = n.firstChild;
+    else if (n.occupancy > 0.0f) child = 1u;
+    c.maskAndChild = mask | (child << 8);
+    c.materialId = n.materialId;
+    return c;
+}
+
+#ifdef BLOK_COMPACT_SVO_NODES
+using GpuSvoNode = SvoNodeCompact;
+inline GpuSvoNode toGpuSvoNode(const SvoNode& n) { return packSvoNodeCompact(n); }
+#else
+using GpuSvoNode = SvoNode;
+inline GpuSvoNode toGpuSvoNode(const SvoNode& n) { return n; }
+#endif
+
 struct AccelerationStructure {
     vk::AccelerationStructureKHR handle{};
     Buffer buffer{};
 };
 
+// [first, first + count) in elements of whatever array it refers to
+struct GpuRange {
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+// an emissive voxel with at least one open face, chunk-local center (see gatherEmissiveLights)
+struct EmissiveVoxel {
+    glm::vec3 center;
+    uint32_t materialId;
+};
+
+// one light of the list raygen samples for next event estimation, the voxel cube around center
+struct alignas(16) EmissiveLightGpu {
+    glm::vec3 center; // world space
+    uint32_t materialId;
+    float cdf; // running pmf sum up to and including this light, raygen binary searches it
+    float pmf; // weight / EmissiveLightHeader::totalWeight
+    float pad0 = 0.0f;
+    float pad1 = 0.0f;
+};
+static_assert(sizeof(EmissiveLightGpu) == 32, "expected 32 bytes");
+
+// in front of the lights in WorldSvoGpu::lightBuffer
+struct alignas(16) EmissiveLightHeader {
+    uint32_t count = 0;
+    // a light's weight is its emitted luminance (every voxel has the same area). raygen turns a bsdf hit's
+    // emission back into the pmf with this for the mis weight
+    float totalWeight = 0.0f;
+    float voxelSize = 0.0f;
+    uint32_t pad = 0;
+};
+static_assert(sizeof(EmissiveLightHeader) == 16, "expected 16 bytes");
+
+// one corner of the world's greedy meshed voxel surface (see buildSurfaceMesh), six per quad
+struct SurfaceVertexGpu {
+    glm::vec3 position; // world space, chunk-local until buildSurfaceMesh places it
+    uint32_t materialFace; // (material id + 1) | face << 29, face as hit.rchit numbers them
+    uint32_t subChunk; // global sub-chunk the quad lies in, local until placed
+    uint32_t normal; // snorm8 xyz, world space
+};
+static_assert(sizeof(SurfaceVertexGpu) == 24, "expected 24 bytes");
+
+// in front of the distance field words in WorldSvoGpu::emptySpaceBuffer. a chunk's cells are its storage bricks,
+// x fastest, a byte each, four to a word. its block starts at slot * wordsPerChunk
+struct alignas(16) EmptySpaceHeader {
+    uint32_t cellsPerAxis = 0; // 0 = no field, intersect.rint skips nothing
+    uint32_t wordsPerChunk = 0;
+    float cellSize = 0.0f; // chunk-local units
+    uint32_t subChunksPerChunk = 0; // instance custom index -> slot
+};
+static_assert(sizeof(EmptySpaceHeader) == 16, "expected 16 bytes");
+
+// one pixel of the equirect environment raygen samples (buildEnvironmentTexels). a texel is picked by taking bucket i
+// uniformly, then i with probability prob and alias otherwise, which lands on texel j with probability pmf
+struct alignas(16) EnvironmentTexelGpu {
+    glm::vec3 radiance;
+    float pmf = 0.0f;
+    float prob = 1.0f;
+    uint32_t alias = 0;
+    float pad0 = 0.0f;
+    float pad1 = 0.0f;
+};
+static_assert(sizeof(EnvironmentTexelGpu) == 32, "expected 32 bytes");
+
+// in front of the texels in Renderer's environment buffer
+struct alignas(16) EnvironmentHeader {
+    uint32_t width = 0; // 0 = no map, raygen keeps the analytic sky
+    uint32_t height = 0;
+    uint32_t pad0 = 0;
+    uint32_t pad1 = 0;
+};
+static_assert(sizeof(EnvironmentHeader) == 16, "expected 16 bytes");
+
+// world space radiance cache, one cell per sub-chunk face (global sub-chunk index * 6 + chunk-local face).
+// raygen adds primary hit irradiance samples to accum, radiance_cache.rgen folds them into irradiance once a frame
+static constexpr uint32_t RADIANCE_CACHE_FACES = 6;
+
+struct alignas(16) RadianceCacheCell {
+    uint32_t accum[4]; // rgb fixed point sums + sample count, atomics
+    glm::vec3 irradiance;
+    float samples; // behind irradiance, capped so the cache keeps following the lighting
+};
+static_assert(sizeof(RadianceCacheCell) == 32, "expected 32 bytes");
+
+// a chunk's suballocated slice of the world arrays
+struct ChunkGpuRange {
+    uint32_t nodeOffset = 0; // first node in globalNodes
+    uint32_t nodeCapacity = 0; // nodes reserved, rebuilds that fit are written in place
+    uint32_t nodeCount = 0; // nodes actually used
+    uint32_t brickOffset = 0; // first word in globalBrickWords
+    uint32_t brickCapacity = 0;
+    uint32_t brickWordCount = 0;
+    uint32_t slot = 0; // sub-chunks live at [slot * subChunksPerChunk, +subChunksPerChunk)
+    uint32_t svoVersion = 0; // Chunk::svoVersion that was last packed
+    uint32_t packSerial = 0; // WorldSvoGpu::packSerial when this was last written
+    uint32_t lod = 0; // Chunk::lod of the tree that was packed, full res or one of ChunkManager::lodChunks
+    glm::vec3 origin{}; // world-space min corner, the chunk's instance translation
+    bool gpuBuilt = false; // nodes, bricks + sub-chunks were written by SvoBuilder, the cpu copies are stale
+};
+
+// a block of chunks drawn somewhere else, once per transform (vox scene instancing).
+// chunks in [sourceMin, sourceMax] are never drawn at their own origin, every placement reuses their blases
+struct ChunkInstanceSet {
+    ChunkCoord sourceMin{}; // inclusive
+    ChunkCoord sourceMax{};
+    std::vector<glm::mat4> transforms; // source world space -> world space, rigid (rotation + translation)
+
+    [[nodiscard]] bool contains(const ChunkCoord& c) const {
+        return c.x >= sourceMin.x && c.y >= sourceMin.y && c.z >= sourceMin.z &&
+               c.x <= sourceMax.x && c.y <= sourceMax.y && c.z <= sourceMax.z;
+    }
+};
+
+// a chunk whose svo gets built on the gpu (see SvoBuilder), queued by packChunksToGpuSvo.
+// the chunk's sparse storage as is: brick table, then the voxels of every allocated brick
+struct GpuSvoBuildJob {
+    ChunkCoord coord{};
+    uint32_t maxDepth = 0; // chunk edge is 2^maxDepth voxels
+    float voxelSize = 1.0f;
+    uint32_t storageShift = 0; // log2 of the storage brick size
+    std::vector<uint32_t> brickTable; // ChunkStorage::EMPTY_BRICK or index of the brick in voxels
+    std::vector<uint32_t> voxels; // density << 24 | material, brick voxel order
+    std::vector<ChunkBrushOp> brushes; // Chunk::gpuBrushes, applied to the voxels before the build
+    std::vector<uint32_t> brushBricks; // brick table entries the brushes reach
+};
+
+// a chunk's own blas, built in chunk-local space over its sub-chunk slot
+struct ChunkBlas {
+    AccelerationStructure as{};
+    Buffer aabbBuffer{};
+
+    // last aabbs this was built/refit from, decides between skip, refit and rebuild
+    std::vector<vk::AabbPositionsKHR> aabbs;
+    uint32_t refits = 0; // refits since the last full build
+    uint32_t packSerial = 0; // ChunkGpuRange::packSerial it was built for
+};
+
+// a chunk's tlas instance carries its first sub-chunk (slot * subChunksPerChunk) in the 24 bit
+// instanceCustomIndex, globalSubChunks can't grow past what that addresses
+static constexpr uint32_t MAX_PACKED_SUB_CHUNKS = 1u << 24;
+
 struct WorldSvoGpu {
-    std::vector<SvoNode> globalNodes;
+    // persistent node heap, each chunk owns a range (see chunkRanges). gaps are unreferenced
+    std::vector<GpuSvoNode> globalNodes;
+    // same for the leaf brick words (see SVO_BRICK_FLAG), brick nodes point into their chunk's range
+    std::vector<uint32_t> globalBrickWords;
+    // fixed block of sub-chunks per chunk slot, empty ones have nodeCount = 0 and are inactive in the chunk's blas
     std::vector<SubChunkGpu> globalSubChunks;
 
+    // packing state, owned by packChunksToGpuSvo
+    std::unordered_map<ChunkCoord, ChunkGpuRange, ChunkCoordHash> chunkRanges;
+    std::vector<GpuRange> freeNodeRanges; // sorted by first, coalesced
+    std::vector<GpuRange> freeBrickRanges; // same
+    std::vector<uint32_t> freeSlots;
+    uint32_t subChunksPerChunk = 0;
+    SubChunkLayout subChunkLayout{}; // layout everything was packed with, a change repacks all chunks
+    uint32_t packSerial = 0; // bumped for every chunk write
+    bool dagPacked = false; // compressGpuSvoDag rewrote the heaps, the next pack starts over
+
+    // gpu svo builds for the next world update, their ranges are already reserved
+    std::vector<GpuSvoBuildJob> gpuBuilds;
+    Buffer svoBuildInput{};
+    Buffer svoBuildScratch{};
+
+    // written since the last upload, uploadSvoBuffers consumes these
+    std::vector<GpuRange> dirtyNodeRanges;
+    std::vector<GpuRange> dirtyBrickRanges;
+    std::vector<GpuRange> dirtySubChunkRanges;
+
     Buffer svoBuffer{};
+    // svoBuffer as a sparse reservation (Renderer::recordSparseNodeUpload). pages are bound as the heap reaches
+    // them and unbound once they're all free range, the buffer never moves or grows
+    bool svoSparse = false;
+    vk::DeviceSize svoPageSize = 0;
+    uint32_t svoPageTypeBits = 0;
+    std::vector<VmaAllocation> svoPages; // null where unbound
+    Buffer brickBuffer{};
     Buffer subChunkBuffer{};
 
     std::vector<MaterialGpu> materials;
+    std::vector<GpuRange> dirtyMaterialRanges; // from MaterialLibrary::packChangedForGpu, same as the heaps above
     Buffer materialBuffer{};
 
-    AccelerationStructure blas{};
+    // emissive voxels per packed chunk, regathered when the chunk's svo version moves
+    struct ChunkLights {
+        uint32_t svoVersion = 0;
+        std::vector<EmissiveVoxel> voxels;
+    };
+    std::unordered_map<ChunkCoord, ChunkLights, ChunkCoordHash> chunkLights;
+    // the world's light list, rebuilt whole from chunkLights and uploaded whole (header + lights)
+    EmissiveLightHeader lightHeader{};
+    std::vector<EmissiveLightGpu> lights;
+    bool lightsDirty = true;
+    Buffer lightBuffer{};
+
+    // exposed voxel faces per packed chunk, greedy merged within each sub-chunk and remeshed when the chunk changes
+    struct ChunkSurface {
+        uint32_t svoVersion = 0;
+        uint64_t editCount = 0;
+        std::vector<SurfaceVertexGpu> vertices; // chunk-local
+    };
+    std::unordered_map<ChunkCoord, ChunkSurface, ChunkCoordHash> chunkSurfaces;
+    // every placement of every chunk's surface, rebuilt whole like the lights. not valid with the adaptive
+    // sub-chunk layout (a voxel has no fixed cell) or while a chunk has gpu only brushes the cpu voxels miss
+    std::vector<SurfaceVertexGpu> surfaceVertices;
+    bool surfaceValid = false;
+    bool surfaceDirty = true;
+    Buffer surfaceBuffer{};
+    // what surfaceBuffer holds, the packer's state above can be ahead of the last upload
+    uint32_t surfaceDrawCount = 0;
+    bool surfaceDrawable = false;
+
+    // per packed chunk chessboard distance from each storage brick to the nearest allocated one, in bricks
+    struct ChunkDistanceField {
+        uint32_t svoVersion = 0;
+        uint64_t editCount = 0;
+        bool valid = false; // no gpu only brushes when it was built
+        std::vector<uint8_t> cells;
+    };
+    std::unordered_map<ChunkCoord, ChunkDistanceField, ChunkCoordHash> chunkDistanceFields;
+    // every slot's field, rebuilt whole like the lights and uploaded whole (header + words)
+    EmptySpaceHeader emptySpaceHeader{};
+    std::vector<uint32_t> emptySpaceWords;
+    bool emptySpaceDirty = true;
+    Buffer emptySpaceBuffer{};
+
+    // RadianceCacheCell per sub-chunk face, sized with globalSubChunks. repacked sub-chunks drop their cells
+    Buffer radianceCache{};
+
+    // ChunkManager::instanceSets as of the last pack
+    std::vector<ChunkInstanceSet> instanceSets;
+
+    // one blas per packed chunk, one tlas instance each (one per transform for instanced chunks)
+    std::unordered_map<ChunkCoord, ChunkBlas, ChunkCoordHash> chunkBlas;
     AccelerationStructure tlas{};
 
-    Buffer blasAabbBuffer{};
     Buffer tlasInstanceBuffer{};
+    // world space box of every tlas instance, same order, for tlas_cull.comp
+    Buffer tlasInstanceBounds{};
+    uint32_t tlasInstanceCount = 0;
+    // the per frame culling refits the tlas in place, on its own scratch so it never meets a world build's
+    Buffer tlasUpdateScratch{};
+    vk::DeviceSize tlasUpdateScratchSize = 0;
+
+    // shared by blas + tlas builds, only grows (high water mark)
+    Buffer scratchBuffer{};
 };
 
 }
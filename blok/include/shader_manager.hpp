@@ -6,8 +6,16 @@
 */
 #ifndef SHADER_MANAGER_HPP
 #define SHADER_MANAGER_HPP
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include "job_system.hpp"
 #include "vulkan_context.hpp"
 
 namespace blok {
@@ -15,12 +23,13 @@ namespace blok {
 struct ShaderKey {
     std::string path;
     vk::ShaderStageFlagBits stage;
-    bool operator==(const ShaderKey& o) const noexcept { return stage==o.stage && path==o.path; }
+    std::string preamble;
+    bool operator==(const ShaderKey& o) const noexcept { return stage==o.stage && path==o.path && preamble==o.preamble; }
 };
 
 struct ShaderKeyHash {
     size_t operator()(const ShaderKey& k) const noexcept {
-        return std::hash<std::string>{}(k.path) ^ (static_cast<size_t>(k.stage) << 1);
+        return std::hash<std::string>{}(k.path) ^ (static_cast<size_t>(k.stage) << 1) ^ (std::hash<std::string>{}(k.preamble) << 2);
     }
 };
 
@@ -29,19 +38,61 @@ struct ShaderModuleEntry {
     vk::ShaderModule module;
 };
 
+struct ShaderRequest {
+    std::string path;
+    vk::ShaderStageFlagBits stage;
+    std::string preamble;
+};
+
+// for the pipeline owners, whether pollChanges reported this source
+inline bool shaderChanged(const std::vector<std::string>& changed, std::string_view path) {
+    return std::find(changed.begin(), changed.end(), path) != changed.end();
+}
+
+// compiled spir-v is kept in cacheDir as <hash>.spv, the hash covers the source, everything it #includes,
+// the preamble, the stage and the glslang version + targets. an empty cacheDir turns the disk cache off
 class ShaderManager {
 public:
-    explicit ShaderManager(vk::Device device);
+    explicit ShaderManager(vk::Device device, std::string cacheDir = "shader_cache");
     ~ShaderManager();
 
-    const ShaderModuleEntry& loadModule(const std::string& glslPath, vk::ShaderStageFlagBits stage);
+    ShaderManager(const ShaderManager&) = delete;
+    ShaderManager& operator=(const ShaderManager&) = delete;
+
+    void setDevice(vk::Device device) { m_device = device; }
+
+    // preamble is glsl inserted after #version, e.g. "#define FOO\n". each preamble is its own module.
+    // the spir-v is cached, the module is created fresh every call and belongs to the caller (destroy it after
+    // pipeline creation). safe to call from several threads, misses compile outside the lock
+    ShaderModuleEntry loadModule(const std::string& glslPath, vk::ShaderStageFlagBits stage, const std::string& preamble = {});
+
+    // loads a batch, the misses compile in parallel on jobs (one after another without it).
+    // results are in request order, the first compile error is rethrown once the batch is done
+    std::vector<ShaderModuleEntry> loadModules(std::span<const ShaderRequest> requests, JobSystem* jobs);
+
+    const std::string& cacheDir() const { return m_cacheDir; }
+
+    // hot reload. every source loadModule has read is watched along with what it includes.
+    // returns the sources that changed on disk since the last poll (directly or through an include) and drops
+    // their spir-v, so the next loadModule recompiles them
+    std::vector<std::string> pollChanges();
 
 private:
     static std::string loadFile(const std::string& path);
-    std::vector<uint32_t> compileShader(const std::string& source, vk::ShaderStageFlagBits stage);
+    std::vector<uint32_t> compileShader(const std::string& path, const std::string& source, vk::ShaderStageFlagBits stage,
+                                        const std::string& preamble);
+
+    // folds path's text and its #include "..." files (relative to it, each once) into h
+    static uint64_t hashSource(const std::string& path, const std::string& source, uint64_t h, std::unordered_set<std::string>& seen);
+    bool loadCachedSpirv(uint64_t hash, std::vector<uint32_t>& out) const;
+    void storeCachedSpirv(uint64_t hash, const std::vector<uint32_t>& spirv) const;
 
     vk::Device m_device{};
-    std::unordered_map<ShaderKey, ShaderModuleEntry, ShaderKeyHash> m_cache{};
+    std::string m_cacheDir;
+    std::mutex m_cacheMutex; // guards m_cache
+    std::unordered_map<ShaderKey, std::vector<uint32_t>, ShaderKeyHash> m_cache{};
+    std::unordered_map<std::string, std::vector<std::string>> m_dependencies; // source -> itself + includes
+    std::unordered_map<std::string, std::filesystem::file_time_type> m_stamps; // per watched file
 };
 
 }
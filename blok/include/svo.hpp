@@ -6,6 +6,7 @@
 */
 #ifndef SVO_HPP
 #define SVO_HPP
+#include <bit>
 #include <cassert>
 #include <cstdint>
 #include <vector>
@@ -14,21 +15,78 @@
 #include "morton.hpp"
 
 namespace blok {
+class ChunkStorage;
 
 // unsigned 32 bit max
 // means 'no children'
 static constexpr uint32_t INVALID_NODE_INDEX = 0xFFFFFFFFu;
 
 // std430 friendly
+// children are packed: only octants with their childMask bit set are stored, back to back in octant order
 struct alignas(16) SvoNode {
-    uint32_t childMask; // bits 0-7 tell which children are empty
-    uint32_t firstChild; // index of first child in nodes[], or INVALID
-    uint32_t materialId; // index into material buffer
-    float    occupancy; // 0 = empty, >0 = filled
+    uint32_t childMask; // bits 0-7 tell which children exist (are non empty)
+    uint32_t firstChild; // index of the first stored child in nodes[], or INVALID
+    uint32_t materialId; // index into material buffer. interior nodes: material of the fullest child (lod)
+    float    occupancy; // leaves: 0 = empty, >0 = filled. interior nodes: filled fraction of the volume (lod)
+};
+
+// index of child 'oct', only valid if its childMask bit is set
+inline uint32_t svoChildIndex(const SvoNode& n, uint32_t oct) {
+    return n.firstChild + static_cast<uint32_t>(std::popcount(n.childMask & ((1u << oct) - 1u)));
+}
+
+// the lowest SVO_BRICK_LEVELS levels are stored as 4^3 bitmask bricks instead of nodes.
+// a brick node has childMask = SVO_BRICK_FLAG and firstChild = its word offset in SvoTree::brickWords.
+// brick words: 64 bit occupancy (lo, hi; bit x + y*4 + z*16), then one material id per set bit, in bit order
+static constexpr uint32_t SVO_BRICK_LEVELS = 2;
+static constexpr uint32_t SVO_BRICK_SIZE = 1u << SVO_BRICK_LEVELS;
+static constexpr uint32_t SVO_BRICK_VOXELS = SVO_BRICK_SIZE * SVO_BRICK_SIZE * SVO_BRICK_SIZE;
+static constexpr uint32_t SVO_BRICK_FLAG = 1u << 8;
+
+inline bool svoIsBrick(const SvoNode& n) { return (n.childMask & SVO_BRICK_FLAG) != 0u; }
+// octant bits only, 0 for leaves and bricks
+inline uint32_t svoChildBits(const SvoNode& n) { return n.childMask & 0xFFu; }
+
+inline uint64_t svoBrickBits(const uint32_t* brick) {
+    return static_cast<uint64_t>(brick[0]) | (static_cast<uint64_t>(brick[1]) << 32);
+}
+// the material words only use their low 24 bits for the id. trees baked with SvoTree::bakeAmbientOcclusion
+// keep the voxel's ao in the top byte: SVO_BAKED_AO_FLAG, then how open its neighbourhood is in bits 24-27
+// (0 = buried .. SVO_BAKED_AO_LEVELS = nothing in reach above a flat surface). unbaked words have it all 0
+static constexpr uint32_t SVO_MATERIAL_MASK = 0x00FFFFFFu;
+static constexpr uint32_t SVO_BAKED_AO_FLAG = 1u << 31;
+static constexpr uint32_t SVO_BAKED_AO_SHIFT = 24;
+static constexpr uint32_t SVO_BAKED_AO_LEVELS = 15;
+static constexpr uint32_t SVO_BAKED_AO_RADIUS = 4; // voxels, what the bake looks at around each voxel
+
+// material of voxel 'bit', only valid if it's set
+inline uint32_t svoBrickMaterial(const uint32_t* brick, uint32_t bit) {
+    const uint64_t below = svoBrickBits(brick) & ((uint64_t{1} << bit) - 1u);
+    return brick[2 + std::popcount(below)] & SVO_MATERIAL_MASK;
+}
+
+// a run of SvoTree::nodes or brickWords
+struct SvoSpan {
+    uint32_t first;
+    uint32_t count;
+};
+
+// what one SvoTree::patchFromStorage rewrote, the rest of the arrays is as it was
+struct SvoPatch {
+    uint32_t version = 0; // Chunk::svoVersion the patch made
+    std::vector<SvoSpan> nodes;
+    std::vector<SvoSpan> words;
 };
 
 struct SvoTree {
     std::vector<SvoNode> nodes;
+    std::vector<uint32_t> brickWords; // leaf bricks, see SVO_BRICK_FLAG
+    uint32_t brickCount = 0;
+    // left behind unreferenced by patchFromStorage, a rebuild drops them
+    uint32_t staleNodes = 0;
+    uint32_t staleWords = 0;
+    // bakeAmbientOcclusion ran since the last clear. patches don't redo the ao, so baked trees get rebuilt instead
+    bool aoBaked = false;
 
     uint32_t rootIndex;
     uint32_t maxDepth; // leaf level depth; 2^maxDepth cells per axis
@@ -37,12 +95,74 @@ struct SvoTree {
 
     SvoTree(uint32_t maxDepth, const glm::vec3& origin, float voxelSize);
     void clear(); // clears to the single empty root
+    // no voxels at all, the builders still leave a root behind: an empty leaf
+    [[nodiscard]] bool empty() const {
+        return nodes.empty() || (nodes[rootIndex].childMask == 0u && nodes[rootIndex].occupancy <= 0.0f);
+    }
 
-    // insert a single filled voxel
+    // insert a single filled voxel. this path makes plain leaf nodes, no bricks. density <= 0 removes it.
+    // 8 identical leaves under one parent are merged into it, the lod aggregates up the path are redone
     void insertVoxel(uint32_t x, uint32_t y, uint32_t z, uint32_t materialId, float density = 1.0f);
 
-    // find leaf node for the given voxel coordinate (if it exists and non-empty)
-    [[nodiscard]] const SvoNode* findLeaf(uint32_t x, uint32_t y, uint32_t z) const;
+    // clears one voxel, plain leaf or brick bit. subtrees left empty are pruned from their parents (the later
+    // siblings move up, the freed slots go stale) and the aggregates up the path are redone.
+    // false if it wasn't filled. the spans written go to patch if there is one
+    bool removeVoxel(uint32_t x, uint32_t y, uint32_t z, SvoPatch* patch = nullptr);
+
+    // rebuild the whole tree from dense C^3 arrays (C = 2^maxDepth, index x + y*C + z*C*C)
+    // single bottom-up pass in morton order, no unreferenced nodes (insertVoxel leaves some behind).
+    // the lowest levels come out as bitmask bricks, chunks smaller than a brick use insertVoxel
+    void buildFromDense(const float* density, const uint32_t* materialIds, uint32_t C);
+
+    // same, straight from sparse chunk storage. empty bricks are skipped without touching their voxels.
+    // 32, 64 and 128 voxel chunks (maxDepth 5-7) get a build compiled for their size, others a generic one
+    void buildFromStorage(const ChunkStorage& storage);
+
+    // brings the 4^3 brick around voxel (x, y, z) up to date with storage without a rebuild: grows the path down
+    // to it, rewrites its words, or drops it and collapses parents it leaves empty. the lod aggregates up the
+    // path are redone. blocks and bricks that have to move go to the end of the arrays, the old ones go stale.
+    // everything written is appended to patch. false for trees without bricks, rebuild those
+    bool patchFromStorage(const ChunkStorage& storage, uint32_t x, uint32_t y, uint32_t z, SvoPatch& patch);
+
+    // bakes neighbourhood ao into every brick voxel's material word (see SVO_BAKED_AO_FLAG), from the dense
+    // occupancy of the storage the tree was just built from. each voxel marches its 26 neighbour directions up to
+    // SVO_BAKED_AO_RADIUS voxels, outside the chunk counts as open. plain leaves (trees without bricks) aren't baked.
+    // meant for the rebuild jobs, a 128^3 chunk is a few ms
+    void bakeAmbientOcclusion(const ChunkStorage& storage);
+
+    // true if the voxel is filled, its material (without the baked ao bits) goes to materialId
+    [[nodiscard]] bool findVoxel(uint32_t x, uint32_t y, uint32_t z, uint32_t* materialId = nullptr) const;
+
+private:
+    void collapsePath(const uint32_t* path, uint32_t level, uint64_t code, SvoPatch* patch);
+};
+
+// node + brick word arrays passed on from tree to tree, so a rebuild grows into the capacity of the tree it
+// replaces instead of going back to the global allocator. one per ChunkManager, main thread only
+class SvoStoragePool {
+public:
+    // past this the oldest arrays are freed on release, the streaming budget can trim further
+    static constexpr size_t MAX_POOLED_BYTES = size_t(64) << 20;
+
+    // tree gets the most recently pooled arrays (if any), cleared to the single empty root
+    void acquire(SvoTree& tree);
+    // takes tree's arrays with their capacity, tree is left with none (clear() gives it a root again)
+    void release(SvoTree& tree);
+    // frees pooled arrays, oldest first, until at most maxBytes of capacity is left. returns the bytes freed
+    size_t trim(size_t maxBytes);
+    [[nodiscard]] size_t bytes() const { return m_bytes; }
+
+private:
+    struct Entry {
+        std::vector<SvoNode> nodes;
+        std::vector<uint32_t> brickWords;
+    };
+    static size_t capacityBytes(const Entry& e) {
+        return e.nodes.capacity() * sizeof(SvoNode) + e.brickWords.capacity() * sizeof(uint32_t);
+    }
+
+    std::vector<Entry> m_free;
+    size_t m_bytes = 0;
 };
 
 }
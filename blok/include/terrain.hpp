@@ -0,0 +1,102 @@
+/*
+* File: terrain.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef TERRAIN_HPP
+#define TERRAIN_HPP
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "chunk_manager.hpp"
+#include "job_system.hpp"
+
+namespace blok {
+
+// surface colours of one biome, picked by the moisture noise
+struct TerrainBiome {
+    float maxMoisture; // moisture in [-1, 1], the first biome whose bound is above it wins
+    uint32_t surfaceColor; // 0xRRGGBB, the top voxel of a column
+    uint32_t soilColor; // the soilDepth voxels under it
+};
+
+struct TerrainSettings {
+    uint32_t seed = 1337;
+    float baseHeight = -32.0f; // global voxel y the heightmap is centered on
+    float heightScale = 96.0f; // the surface stays within baseHeight +- this
+    float frequency = 1.0f / 256.0f; // of the lowest heightmap octave, per voxel
+    uint32_t octaves = 5;
+    float moistureFrequency = 1.0f / 512.0f;
+
+    // 3d noise carving caves, everywhere the noise is above caveThreshold
+    float caveFrequency = 1.0f / 40.0f;
+    float caveThreshold = 0.45f;
+
+    // voxels below the surface that get filled, deeper is left empty (it's hidden behind the crust)
+    uint32_t crustDepth = 48;
+    uint32_t soilDepth = 4;
+    float snowHeight = 40.0f; // global voxel y above which every surface is snow
+    uint32_t stoneColor = 0x7a7a7a;
+    uint32_t snowColor = 0xf2f5f8;
+
+    std::vector<TerrainBiome> biomes = {
+        {-0.35f, 0xd8c384, 0xc2a865}, // desert
+        {0.25f, 0x5a9a3c, 0x7a5535}, // grassland
+        {1.0f, 0x2f6b2a, 0x5c4026}, // forest
+    };
+};
+
+// procedural chunks for streaming: an fbm heightmap with biomes and 3d cave noise, evaluated 8 voxels at a time
+// (avx2 when the cpu has it). each chunk is a job on the ChunkManager's pool, plug asyncLoader() into
+// ChunkManager::asyncLoader and the residency update keeps them coming around the camera
+class TerrainGenerator {
+public:
+    // biome materials are created in lib up front, the jobs only ever see their ids
+    TerrainGenerator(const TerrainSettings& settings, MaterialLibrary& lib, uint32_t C, JobSystem& jobs);
+    ~TerrainGenerator(); // waits for the chunks still being generated
+
+    TerrainGenerator(const TerrainGenerator&) = delete;
+    TerrainGenerator& operator=(const TerrainGenerator&) = delete;
+
+    // fills out (a chunk of size C >> lod) for coord on the calling thread, false if nothing's there.
+    // lod > 0 samples the noise once per 2^lod voxel cell instead of downsampling a full res chunk
+    bool generate(const ChunkCoord& coord, ChunkStorage& out, uint32_t lod = 0) const;
+
+    // generate() as a job, the chunk comes back through collect
+    void request(const ChunkCoord& coord, uint32_t lod = 0);
+    // appends every chunk that finished since the last call
+    void collect(std::vector<LoadedChunk>& out);
+
+    // for ChunkManager::loader / asyncLoader, the generator has to outlive them
+    ChunkLoader loader();
+    AsyncChunkLoader asyncLoader();
+
+    // chunks below or above this global voxel y range are always empty
+    [[nodiscard]] int32_t minY() const;
+    [[nodiscard]] int32_t maxY() const;
+
+private:
+    struct BiomeMaterials {
+        float maxMoisture;
+        uint32_t surface;
+        uint32_t soil;
+    };
+
+    TerrainSettings m_settings;
+    uint32_t m_C;
+    JobSystem& m_jobs;
+
+    std::vector<BiomeMaterials> m_biomes;
+    uint32_t m_stone = 0;
+    uint32_t m_snow = 0;
+
+    JobCounter m_inFlight;
+    std::mutex m_mutex;
+    std::vector<LoadedChunk> m_finished;
+};
+
+}
+
+#endif
@@ -8,10 +8,13 @@
 #define VOX_LOADER_HPP
 
 #include <cstdint>
+#include <span>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "material.hpp"
+#include "mat3x3.hpp"
 #include "vec3.hpp"
 
 namespace blok {
@@ -23,6 +26,8 @@ struct VoxVoxel {
     uint8_t x, y, z;
     uint8_t colorIndex; // (1-255); 0 means empty
 };
+// XYZI is copied straight into these
+static_assert(sizeof(VoxVoxel) == 4, "VoxVoxel must match the XYZI layout");
 
 // from MATL chunk
 struct VoxMaterial {
@@ -44,9 +49,39 @@ struct VoxModel {
     std::vector<VoxVoxel> voxels;
 };
 
+// scene graph node from nTRN / nGRP / nSHP, only the first animation frame is kept
+struct VoxSceneNode {
+    enum class Type : uint8_t { Transform, Group, Shape };
+    Type type{Type::Transform};
+    bool hidden{false};
+
+    // transform: x_parent = rotation * x + translation, in vox space (z up)
+    glm::mat3 rotation{1.0f}; // signed permutation from _r
+    glm::ivec3 translation{0}; // _t
+    int32_t child{-1};
+
+    std::vector<int32_t> children; // group
+    std::vector<uint32_t> models; // shape, indices into VoxFile::models
+};
+
+// one model somewhere in the scene, the graph flattened.
+// voxel v covers rotation * (cell of v) + translation in vox space, the model's pivot is folded into translation
+struct VoxPlacement {
+    uint32_t modelIndex;
+    glm::mat3 rotation{1.0f};
+    glm::ivec3 translation{0};
+};
+
+// how importVoxScene puts placements into the world
+enum class VoxSceneImport : uint8_t {
+    Copy, // every placement writes its voxels into the chunks
+    Instanced // models placed more than once are stored once and drawn through tlas instances (ChunkInstanceSet)
+};
+
 // an entire file of vox models
 struct VoxFile {
     std::vector<VoxModel> models;
+    std::unordered_map<int32_t, VoxSceneNode> sceneNodes; // by node id, the root is 0. empty for old files
 
     uint32_t palette[256]; // note: format is ABGR for all colors
     VoxMaterial materials[256];
@@ -69,7 +104,7 @@ struct VoxFile {
     Material getMaterial(uint8_t paletteIndex) const;
 };
 
-// load a vox file from disk
+// load a vox file from disk. the file is mapped and parsed in place, voxel data is one copy per model
 bool loadVoxFile(const std::string& filepath, VoxFile& outVox, std::string& errorMsg);
 
 void importVoxMaterials(
@@ -89,6 +124,26 @@ uint32_t importVoxToChunks(
     uint32_t modelIndex = 0
 );
 
+// every model i < offsets.size() at offsets[i]. models convert to writes in parallel on the chunk
+// manager's job system, then go through one writeVoxels. same result as importVoxToChunks per model in order
+uint32_t importVoxModelsToChunks(
+    const VoxFile& vox,
+    ChunkManager& chunkMgr,
+    std::span<const glm::vec3> offsets
+);
+
+// walks the scene graph from the root. files without one get every model once, untransformed
+std::vector<VoxPlacement> flattenVoxScene(const VoxFile& vox);
+
+// every placement of the scene, mapped to engine space (vox z up -> our y up) at worldOffset.
+// returns number of voxels written, instanced models count once
+uint32_t importVoxScene(
+    const VoxFile& vox,
+    ChunkManager& chunkMgr,
+    const glm::vec3& worldOffset = glm::vec3(0.0f),
+    VoxSceneImport mode = VoxSceneImport::Instanced
+);
+
 // convinience. assumes a single model.
 bool loadAndImportVox(
     const std::string& filepath,
@@ -99,6 +154,16 @@ bool loadAndImportVox(
     std::string* errorMsg = nullptr
 );
 
+// same, but the whole scene through importVoxScene
+bool loadAndImportVoxScene(
+    const std::string& filepath,
+    ChunkManager& chunkMgr,
+    MaterialLibrary* materialLib = nullptr,
+    const glm::vec3& worldOffset = glm::vec3(0.0f),
+    VoxSceneImport mode = VoxSceneImport::Instanced,
+    std::string* errorMsg = nullptr
+);
+
 }
 
 #endif //VOX_LOADER_HPP
\ No newline at end of file
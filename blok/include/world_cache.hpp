@@ -0,0 +1,56 @@
+/*
+* File: world_cache.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef WORLD_CACHE_HPP
+#define WORLD_CACHE_HPP
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace blok {
+
+class ChunkManager;
+class MaterialLibrary;
+struct VoxFile;
+struct WorldSvoGpu;
+
+// bumped whenever the file layout or anything it dumps (GpuSvoNode, SubChunkGpu, ChunkGpuRange) changes
+static constexpr uint32_t WORLD_CACHE_VERSION = 2;
+
+// fnv-1a over the whole source file, 0 if it can't be read
+uint64_t hashWorldSource(const std::string& path);
+
+// where the cache for a source file goes, next to it
+std::string worldCachePath(const std::string& sourcePath);
+
+// dumps a packed world: node, brick and sub-chunk heaps, per-chunk ranges, packing state, instance sets and
+// the vox palette + materials it was imported with. native endian, every array 16 byte aligned so it can be
+// used in place from a mapping. worlds with gpu built chunks can't be saved, their cpu heaps are stale
+bool saveWorldCache(
+    const std::string& path,
+    uint64_t sourceHash,
+    const ChunkManager& mgr,
+    const WorldSvoGpu& world,
+    const VoxFile& vox,
+    const std::array<uint32_t, 256>& paletteToMaterial,
+    std::string& errorMsg
+);
+
+// maps the cache and fills world + mgr.instanceSets, ready for addWorld. fails (and leaves both alone) if the
+// version, source hash or packing parameters don't match, or if the material library isn't in the state the
+// cache was saved from. mgr gets no chunks, so a cached world is for viewing: edits and streaming need the import
+bool loadWorldCache(
+    const std::string& path,
+    uint64_t sourceHash,
+    ChunkManager& mgr,
+    WorldSvoGpu& world,
+    MaterialLibrary* materialLib,
+    std::string& errorMsg
+);
+
+}
+
+#endif //WORLD_CACHE_HPP
@@ -0,0 +1,133 @@
+/*
+* File: world_thread.hpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#ifndef WORLD_THREAD_HPP
+#define WORLD_THREAD_HPP
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "resources.hpp"
+
+namespace blok {
+
+class ChunkManager;
+
+// bounded single producer / single consumer ring, lock free. push fails when full, pop when empty
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "SpscQueue: N must be a power of two");
+public:
+    bool push(T&& value) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == N) return false;
+        m_slots[tail & (N - 1)] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::optional<T> pop() {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) return std::nullopt;
+        std::optional<T> out(std::move(m_slots[head & (N - 1)]));
+        m_slots[head & (N - 1)] = T{};
+        m_head.store(head + 1, std::memory_order_release);
+        return out;
+    }
+
+private:
+    std::array<T, N> m_slots{};
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+// what one pack changed, everything the renderer reads out of a WorldSvoGpu's cpu side.
+// the heaps travel as their dirty ranges only, the rest is small enough to go whole
+struct WorldDelta {
+    size_t nodeCount = 0;
+    size_t brickWordCount = 0;
+    size_t subChunkCount = 0;
+    std::vector<GpuRange> nodeRanges;
+    std::vector<GpuRange> brickRanges;
+    std::vector<GpuRange> subChunkRanges;
+    // the ranges' contents back to back, in range order
+    std::vector<GpuSvoNode> nodes;
+    std::vector<uint32_t> brickWords;
+    std::vector<SubChunkGpu> subChunks;
+
+    std::unordered_map<ChunkCoord, ChunkGpuRange, ChunkCoordHash> chunkRanges;
+    std::vector<GpuRange> freeNodeRanges;
+    uint32_t subChunksPerChunk = 0;
+    SubChunkLayout subChunkLayout{};
+    std::vector<ChunkInstanceSet> instanceSets;
+    std::vector<GpuSvoBuildJob> gpuBuilds;
+
+    // only set when the packer rebuilt them
+    bool lights = false;
+    EmissiveLightHeader lightHeader{};
+    std::vector<EmissiveLightGpu> lightList;
+    bool surface = false;
+    bool surfaceValid = false;
+    std::vector<SurfaceVertexGpu> surfaceVertices;
+    bool emptySpace = false;
+    EmptySpaceHeader emptySpaceHeader{};
+    std::vector<uint32_t> emptySpaceWords;
+};
+
+// copies a delta into the render side's world, appending its ranges to the dirty lists Renderer::updateWorld uploads
+void applyWorldDelta(WorldDelta& delta, WorldSvoGpu& gpuWorld);
+
+// owns the ChunkManager while it runs: streaming residency, chunk rebuilds and packing happen on its thread
+// into a world of its own, the render thread only ever sees the deltas. an edit shows up in the frame after
+// its pack finished, at most MAX_DELTAS packs can be waiting before the world thread holds off
+class WorldThread {
+public:
+    using Edit = std::function<void(ChunkManager&)>;
+    static constexpr size_t MAX_DELTAS = 4;
+    static constexpr size_t MAX_EDITS = 64;
+
+    // gpuWorld is the packed world as of now, its cpu side is copied (dirty ranges excluded, those are
+    // the renderer's to upload)
+    WorldThread(ChunkManager& mgr, const WorldSvoGpu& gpuWorld);
+    ~WorldThread();
+
+    WorldThread(const WorldThread&) = delete;
+    WorldThread& operator=(const WorldThread&) = delete;
+
+    // render thread side
+    void setCamera(const glm::vec3& position);
+    void setDeviceBudget(size_t bytes) { m_deviceBudget.store(bytes, std::memory_order_relaxed); }
+    // runs edit on the world thread before its next pack. false when the queue is full, try again next frame
+    bool submit(Edit edit) { return m_edits.push(std::move(edit)); }
+    // applies every delta that's ready, true if the world changed and needs an updateWorld
+    bool consume(WorldSvoGpu& gpuWorld);
+
+private:
+    void run();
+    std::unique_ptr<WorldDelta> takeDelta();
+
+    ChunkManager& m_mgr;
+    WorldSvoGpu m_packed; // cpu side only, its buffers are never created
+
+    std::atomic<float> m_cameraX{0.0f}, m_cameraY{0.0f}, m_cameraZ{0.0f};
+    std::atomic<size_t> m_deviceBudget{SIZE_MAX};
+
+    SpscQueue<std::unique_ptr<WorldDelta>, MAX_DELTAS> m_deltas;
+    SpscQueue<Edit, MAX_EDITS> m_edits;
+
+    std::atomic<bool> m_running{true};
+    std::thread m_thread;
+};
+
+}
+
+#endif
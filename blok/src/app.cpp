@@ -6,7 +6,9 @@
 */
 #include "app.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <limits>
 #include <stdexcept>
 #include <iostream>
 
@@ -14,6 +16,7 @@
 
 #include "renderer.hpp"
 #include "renderer_gl.hpp"
+#include "renderer_gl_raster.hpp"
 #include "cuda_tracer.hpp"
 
 #define GLFW_INCLUDE_NONE
@@ -25,8 +28,13 @@
 #include "camera.hpp"
 #include "chunk_manager.hpp"
 #include "imgui_impl_glfw.h"
+#include "mesh_voxelizer.hpp"
+#include "region_file.hpp"
 #include "scene.hpp"
+#include "terrain.hpp"
 #include "vox_loader.hpp"
+#include "world_cache.hpp"
+#include "world_thread.hpp"
 
 #define VKR reinterpret_cast<VulkanRenderer*>(m_renderer.get())
 
@@ -71,6 +79,7 @@ void App::run() {
 }
 
 void App::init() {
+    g_mgr.bakeAmbientOcclusion = m_bakedAo;
 
     switch (m_backend) {
         case GraphicsApi::OpenGL: {
@@ -87,12 +96,41 @@ void App::init() {
             m_rendererGL->init();
             reinterpret_cast<RendererGL*>(m_rendererGL.get())->setUI(g_ui);
 
-            m_cudaTracer = std::make_unique<CudaTracer>(m_window->getWidth(), m_window->getHeight());
-            m_cudaTracer->init();
+            if (m_glRaster) {
+                m_raster = std::make_unique<ChunkRasterGL>();
+                m_raster->init();
+            }
+            else {
+                m_cudaTracer = std::make_unique<CudaTracer>(m_window->getWidth(), m_window->getHeight());
+                m_cudaTracer->init();
+                m_cudaTracer->setWavefront(m_cudaWavefront);
+            }
+
+            // same world as the vulkan backend, traced by the cuda svo kernel
+            m_cudaMaterials = std::make_unique<MaterialLibrary>();
+            g_mgr.setMaterialLibrary(m_cudaMaterials.get());
+            m_gpuWorld = std::make_unique<WorldSvoGpu>();
+            if (m_terrainEnabled) startTerrain(*m_cudaMaterials);
+            else if (!m_meshPath.empty()) loadStartupMesh();
+            else loadStartupWorld("assets/models/chr_knight.vox");
+            // the raster path packs its own materials and meshes g_mgr's chunks directly
+            if (m_raster) break;
+            m_cudaMaterials->packChangedForGpu(m_gpuWorld->materials, m_gpuWorld->dirtyMaterialRanges);
+            m_cudaTracer->setWorld(m_gpuWorld.get());
             break;
         }
         case GraphicsApi::Vulkan: {
-            m_renderer = std::make_unique<Renderer>(1280, 720);
+            m_renderer = std::make_unique<Renderer>(1280, 720, m_offline ? m_offlineConfig.device : -1);
+            m_renderer->setShaderHotReload(m_shaderHotReload);
+            m_renderer->setRayQueryTracer(m_rayQuery);
+            m_renderer->setFramesInFlight(m_framesInFlight);
+            m_renderer->setLowLatency(m_lowLatency);
+            if (!m_environmentPath.empty()) {
+                EnvironmentMap env;
+                std::string err;
+                if (loadEnvironmentMap(m_environmentPath, env, &err)) m_renderer->setEnvironmentMap(env);
+                else std::cerr << "Environment map " << m_environmentPath << ": " << err << ", keeping the analytic sky\n";
+            }
             auto gw = m_renderer->getWindow();
             glfwSetCursorPosCallback(gw, mouse_callback);
             glfwSetInputMode(gw, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -100,25 +138,29 @@ void App::init() {
             blok::MaterialLibrary& matLib = m_renderer->getMaterialLibrary();
             g_mgr.setMaterialLibrary(&matLib);
 
-            VoxFile vox;
-            std::string err;
-            bool success = blok::loadAndImportVox(
-                "assets/models/chr_knight.vox",
-                g_mgr,
-                &matLib,
-                glm::vec3(0, 0, 0),
-                0,
-                &err
-            );
-
-            if (!success) {
-                std::cerr << "Failed to load VOX: " << err << "\n";
+            // the benchmark loads its own scenes
+            if (m_benchmark) {
+                m_gpuWorld = std::make_unique<WorldSvoGpu>();
+                break;
             }
 
             // Prepare GPU world SVO
             m_gpuWorld = std::make_unique<WorldSvoGpu>();
-            rebuildDirtyChunks(g_mgr, 16);
-            packChunksToGpuSvo(g_mgr, *m_gpuWorld);
+            if (m_terrainEnabled) startTerrain(matLib);
+            else if (!m_meshPath.empty()) loadStartupMesh();
+            else loadStartupWorld("assets/models/chr_knight.vox");
+
+            // cuda traces the world instead and the renderer never gets it, the two would split its dirty ranges
+            if (m_cudaInVulkan) {
+                m_cudaTracer = std::make_unique<CudaTracer>(1280, 720);
+                matLib.packChangedForGpu(m_gpuWorld->materials, m_gpuWorld->dirtyMaterialRanges);
+                m_cudaTracer->setWorld(m_gpuWorld.get());
+                CudaTracer* tracer = m_cudaTracer.get();
+                if (m_renderer->setExternalTracer([tracer](const ExternalTraceFrame& f) { tracer->traceToVulkan(f); }))
+                    break;
+                std::cerr << "[App] device can't share memory with cuda, tracing with vulkan\n";
+                m_cudaTracer.reset();
+            }
 
             // Upload world to Renderer
             m_renderer->addWorld(*m_gpuWorld);
@@ -148,6 +190,40 @@ void App::update() {
 
             if (glfwGetKey(win, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(win, true);
 
+            // the tracer picks up the repacked ranges in drawFrame
+            if (g_mgr.streaming.enabled) {
+                bool changed = updateChunkResidency(g_mgr, g_camera.position);
+                rebuildDirtyChunksAsync(g_mgr, 8);
+                if (collectRebuiltChunks(g_mgr) > 0) changed = true;
+
+                if (changed && !m_raster) {
+                    packChunksToGpuSvo(g_mgr, *m_gpuWorld);
+                    if (g_mgr.svoDag) compressGpuSvoDag(g_mgr, *m_gpuWorld);
+                    m_cudaMaterials->packChangedForGpu(m_gpuWorld->materials, m_gpuWorld->dirtyMaterialRanges);
+                }
+            }
+
+            if (m_raster) {
+                // chunks that changed this frame get remeshed on the job system, the old mesh draws until then
+                m_raster->update(g_mgr);
+                m_raster->updateMaterials(*m_cudaMaterials);
+
+                int fbw = 0, fbh = 0;
+                glfwGetFramebufferSize(win, &fbw, &fbh);
+                m_rendererGL->beginFrame();
+                m_raster->draw(g_camera, uint32_t(fbw), uint32_t(fbh));
+
+                g_ui->beginWindow("Raster");
+                ImGui::Text("chunks %zu (%zu drawn, %zu meshing)", m_raster->chunkCount(), m_raster->drawnChunks(), m_raster->meshesInFlight());
+                ImGui::Text("vertices %zu", m_raster->vertexCount());
+                g_ui->handleCameraControls(&g_camera);
+                g_ui->endWindow();
+                g_ui->displayData(dt);
+
+                m_rendererGL->endFrame();
+                continue;
+            }
+
             // ImGui + present path (one swap inside endFrame)
             m_cudaTracer->drawFrame(g_camera, g_scene);
             m_rendererGL->beginFrame();
@@ -163,7 +239,26 @@ void App::update() {
     }
 
     case GraphicsApi::Vulkan: {
+        if (m_subChunkSweep) {
+            runSubChunkSweep();
+            break;
+        }
+        if (m_benchmark) {
+            runBenchmark();
+            break;
+        }
+        if (m_offline) {
+            runOfflineRender();
+            break;
+        }
+
+        // the startup world is packed and uploaded, from here on the world thread owns g_mgr
+        if (m_worldThreadEnabled && !m_cudaTracer) m_worldThread = std::make_unique<WorldThread>(g_mgr, *m_gpuWorld);
+
         while (!glfwWindowShouldClose(m_renderer->getWindow())) {
+            // input is read after the frame slot frees up (and with low latency as late as it can be)
+            m_renderer->paceFrame();
+
             auto now = clock::now();
             double dt = std::chrono::duration<double>(now - last).count();
             last = now;
@@ -180,23 +275,350 @@ void App::update() {
 
             if (glfwGetKey(win, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(win, true);
 
+            // whatever the world thread packed since the last frame, uploaded in one world update
+            if (m_worldThread) {
+                m_worldThread->setCamera(g_camera.position);
+                m_worldThread->setDeviceBudget(m_renderer->streamingBudget());
+                if (m_worldThread->consume(*m_gpuWorld)) m_renderer->updateWorld();
+            }
+            // stream chunks around the camera, repack + upload whenever residency or a tree changed
+            else if (g_mgr.streaming.enabled) {
+                g_mgr.streaming.deviceBudgetBytes = m_renderer->streamingBudget();
+                bool changed = updateChunkResidency(g_mgr, g_camera.position);
+                rebuildDirtyChunksAsync(g_mgr, 8);
+                if (collectRebuiltChunks(g_mgr) > 0) changed = true;
+
+                if (changed) {
+                    packChunksToGpuSvo(g_mgr, *m_gpuWorld);
+                    if (g_mgr.svoDag) compressGpuSvoDag(g_mgr, *m_gpuWorld);
+                    if (m_cudaTracer) m_renderer->getMaterialLibrary().packChangedForGpu(m_gpuWorld->materials, m_gpuWorld->dirtyMaterialRanges);
+                    else m_renderer->updateWorld();
+                }
+            }
+
             float fps = 1.0f / dt;
             float ms = dt * 1000.0f;
             m_renderer->updatePerformanceData((int)fps, ms);
 
             m_renderer->render(g_camera, dt);
         }
+        m_worldThread.reset();
         break;
     }
     }
 }
 
+void App::loadStartupWorld(const std::string& path) {
+    blok::MaterialLibrary& matLib = m_renderer ? m_renderer->getMaterialLibrary() : *m_cudaMaterials;
+
+    // the cache has no cpu chunks, so streaming and the sub-chunk sweep always import
+    const bool useCache = m_worldCache && !g_mgr.streaming.enabled && !m_subChunkSweep && !g_mgr.gpuSvoBuild;
+    const uint64_t sourceHash = useCache ? hashWorldSource(path) : 0;
+    const std::string cachePath = worldCachePath(path);
+    std::string err;
+    if (useCache && loadWorldCache(cachePath, sourceHash, g_mgr, *m_gpuWorld, &matLib, err)) return;
+    if (useCache) std::cout << "World cache miss (" << err << "), importing " << path << "\n";
+
+    VoxFile vox;
+    if (!loadVoxFile(path, vox, err)) {
+        std::cerr << "Failed to load VOX: " << err << "\n";
+        return;
+    }
+    std::array<uint32_t, 256> paletteMapping;
+    importVoxMaterials(vox, matLib, paletteMapping);
+    importVoxToChunks(vox, g_mgr, glm::vec3(0, 0, 0), 0);
+
+    rebuildDirtyChunks(g_mgr, 16);
+    packChunksToGpuSvo(g_mgr, *m_gpuWorld);
+    if (g_mgr.svoDag) compressGpuSvoDag(g_mgr, *m_gpuWorld);
+
+    if (useCache && sourceHash != 0 && !saveWorldCache(cachePath, sourceHash, g_mgr, *m_gpuWorld, vox, paletteMapping, err))
+        std::cerr << "Failed to write world cache: " << err << "\n";
+}
+
+void App::loadStartupMesh() {
+    VoxelizeSettings settings;
+    settings.resolution = m_meshResolution;
+    std::string err;
+    if (!loadAndVoxelizeObj(m_meshPath, g_mgr, settings, &err)) return;
+
+    rebuildDirtyChunks(g_mgr, 16);
+    packChunksToGpuSvo(g_mgr, *m_gpuWorld);
+    if (g_mgr.svoDag) compressGpuSvoDag(g_mgr, *m_gpuWorld);
+}
+
+void App::startTerrain(MaterialLibrary& matLib) {
+    m_terrain = std::make_unique<TerrainGenerator>(TerrainSettings{}, matLib, g_mgr.C, g_mgr.jobSystem());
+    g_mgr.asyncLoader = m_terrain->asyncLoader();
+    if (!m_worldDirectory.empty()) {
+        // stored chunks win, the ones never stored are passed on to the generator
+        m_regions = std::make_unique<RegionStore>(m_worldDirectory, g_mgr.C);
+        AsyncChunkLoader generated = g_mgr.asyncLoader;
+        AsyncChunkLoader loader;
+        loader.request = [this](const ChunkCoord& c) { m_regions->requestLoad(c); };
+        loader.collect = [this, generated](std::vector<LoadedChunk>& out) {
+            std::vector<LoadedChunk> stored;
+            m_regions->collect(stored);
+            for (LoadedChunk& l : stored) {
+                if (l.voxels) out.push_back(std::move(l));
+                else generated.request(l.coord);
+            }
+            generated.collect(out);
+        };
+        // lod chunks come straight from the generator, edits show up once their chunk is in full res range
+        loader.requestLod = generated.requestLod;
+        g_mgr.asyncLoader = loader;
+        g_mgr.saver = m_regions->saver();
+    }
+    g_mgr.streaming.enabled = true;
+    // flying at full speed a new layer of chunks comes into range every C / 40 seconds, enough requests in
+    // flight to keep every worker on them
+    g_mgr.streaming.maxLoadsPerUpdate = std::max(g_mgr.streaming.maxLoadsPerUpdate, static_cast<int>(g_mgr.jobSystem().workerCount()) * 2);
+    // the horizon comes from coarse chunks generated straight at their lod, which is what lets the view reach this far.
+    // the gl raster path only meshes full res chunks
+    if (!m_raster) {
+        g_mgr.streaming.lodLevels = MAX_CHUNK_LOD;
+        g_mgr.streaming.viewRadius = std::max(g_mgr.streaming.viewRadius, 4 * g_mgr.streaming.lodRadius);
+    }
+
+    // start above the highest hill, the residency updates fill in the world around the camera
+    g_camera.position.y = static_cast<float>(m_terrain->maxY()) + 16.0f;
+    packChunksToGpuSvo(g_mgr, *m_gpuWorld);
+}
+
+void App::runSubChunkSweep() {
+    using clock = std::chrono::steady_clock;
+    constexpr int WARMUP_FRAMES = 30;
+    constexpr int TIMED_FRAMES = 120;
+    const SubChunkLayout original = g_mgr.subChunks;
+    GLFWwindow* win = m_renderer->getWindow();
+
+    // false once the window is closed, that ends the whole sweep and the configuration it was in isn't reported
+    auto renderFrames = [&](int count) {
+        for (int i = 0; i < count && !glfwWindowShouldClose(win); ++i) {
+            glfwPollEvents();
+            m_renderer->render(g_camera, 1.0f / 60.0f);
+        }
+        return !glfwWindowShouldClose(win);
+    };
+
+    std::cout << "divisions  adaptive  active sub-chunks  BLAS bytes  ms/frame\n";
+
+    bool closed = glfwWindowShouldClose(win);
+    for (uint32_t divisions = 1; !closed && divisions <= 16 && divisions * SVO_BRICK_SIZE <= g_mgr.C; divisions *= 2) {
+        for (bool adaptive : {false, true}) {
+            g_mgr.subChunks.divisions = divisions;
+            g_mgr.subChunks.adaptive = adaptive;
+            packChunksToGpuSvo(g_mgr, *m_gpuWorld);
+            if (g_mgr.svoDag) compressGpuSvoDag(g_mgr, *m_gpuWorld);
+            m_renderer->updateWorld();
+
+            if (!renderFrames(WARMUP_FRAMES)) { closed = true; break; }
+
+            auto start = clock::now();
+            if (!renderFrames(TIMED_FRAMES)) { closed = true; break; }
+            double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / TIMED_FRAMES;
+
+            size_t active = 0;
+            for (const auto& sub : m_gpuWorld->globalSubChunks)
+                if (sub.nodeCount > 0) active++;
+
+            vk::DeviceSize blasBytes = 0;
+            for (const auto& kv : m_gpuWorld->chunkBlas)
+                blasBytes += kv.second.as.buffer.size;
+
+            std::cout << divisions << "  " << (adaptive ? "on " : "off") << "  "
+                      << active << "  " << blasBytes << "  " << ms << "\n";
+        }
+    }
+
+    g_mgr.subChunks = original;
+    glfwSetWindowShouldClose(win, true);
+}
+
+void App::runBenchmark() {
+    using clock = std::chrono::steady_clock;
+    BenchmarkConfig& config = m_benchmarkConfig;
+    config.setDefaultScenes();
+
+    // fixed dt so the simulation side doesn't depend on how fast the previous frame was
+    constexpr float BENCH_DT = 1.0f / 60.0f;
+    GLFWwindow* win = m_renderer->getWindow();
+    glfwSetInputMode(win, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+    glfwSetCursorPosCallback(win, nullptr);
+
+    std::vector<BenchmarkSceneResult> results;
+    for (const std::string& scene : config.scenes) {
+        if (glfwWindowShouldClose(win)) break;
+
+        BenchmarkSceneResult result;
+        result.scene = scene;
+
+        // fresh chunks + gpu world per scene, the renderer keeps its pipelines and material library
+        if (m_gpuWorld) m_renderer->cleanupWorld(*m_gpuWorld);
+        m_gpuWorld = std::make_unique<WorldSvoGpu>();
+        ChunkManager mgr(g_mgr.C, g_mgr.voxelSize);
+        mgr.setMaterialLibrary(&m_renderer->getMaterialLibrary());
+
+        const std::string path = scene.find('/') == std::string::npos && scene.find('\\') == std::string::npos
+            ? "assets/models/" + scene : scene;
+        std::string err;
+        result.loaded = loadAndImportVox(path, mgr, &m_renderer->getMaterialLibrary(), glm::vec3(0.0f), 0, &err);
+        if (!result.loaded) {
+            std::cerr << "Benchmark: failed to load " << path << ": " << err << "\n";
+            results.push_back(result);
+            continue;
+        }
+
+        rebuildDirtyChunks(mgr, static_cast<int>(mgr.chunks.size()));
+        packChunksToGpuSvo(mgr, *m_gpuWorld);
+        if (mgr.svoDag) compressGpuSvoDag(mgr, *m_gpuWorld);
+        m_renderer->addWorld(*m_gpuWorld);
+
+        // chunk bounds, good enough to aim an orbit at
+        glm::vec3 boundsMin(std::numeric_limits<float>::max());
+        glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+        const float chunkSize = static_cast<float>(mgr.C) * mgr.voxelSize;
+        for (const auto& kv : mgr.chunks) {
+            const glm::vec3 origin = glm::vec3(kv.first.x, kv.first.y, kv.first.z) * chunkSize;
+            boundsMin = glm::min(boundsMin, origin);
+            boundsMax = glm::max(boundsMax, origin + glm::vec3(chunkSize));
+        }
+        if (mgr.chunks.empty()) { boundsMin = glm::vec3(0.0f); boundsMax = glm::vec3(chunkSize); }
+
+        m_renderer->resetFrameSeed(config.seed);
+
+        std::vector<float> cpuMs, gpuMs;
+        cpuMs.reserve(config.frames);
+        gpuMs.reserve(config.frames);
+        uint64_t pixels = 0;
+        const uint32_t total = config.warmupFrames + config.frames;
+        for (uint32_t i = 0; i < total && !glfwWindowShouldClose(win); ++i) {
+            glfwPollEvents();
+            // warmup flies the start of the path so the histories are warm where the timed part begins
+            const uint32_t pathFrame = i < config.warmupFrames ? i : i - config.warmupFrames;
+            const Camera cam = benchmarkCamera(boundsMin, boundsMax,
+                static_cast<float>(pathFrame) / static_cast<float>(std::max(config.frames, 1u)));
+
+            const auto start = clock::now();
+            m_renderer->render(cam, BENCH_DT);
+            const float ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+            m_renderer->updatePerformanceData(ms > 0.0f ? 1000.0f / ms : 0.0f, ms);
+            if (i < config.warmupFrames) continue;
+
+            const Renderer::FrameStats stats = m_renderer->frameStats();
+            cpuMs.push_back(ms);
+            if (stats.gpuMs > 0.0f) {
+                gpuMs.push_back(stats.gpuMs);
+                pixels += static_cast<uint64_t>(stats.renderExtent.width) * stats.renderExtent.height;
+            }
+        }
+
+        const Renderer::FrameStats stats = m_renderer->frameStats();
+        result.frames = static_cast<uint32_t>(cpuMs.size());
+        result.renderWidth = stats.renderExtent.width;
+        result.renderHeight = stats.renderExtent.height;
+        result.cpuMs = summarizeFrameTimes(cpuMs);
+        result.gpuMs = summarizeFrameTimes(gpuMs);
+        double gpuSeconds = 0.0;
+        for (float ms : gpuMs) gpuSeconds += ms * 1e-3;
+        result.primaryRaysPerSecond = gpuSeconds > 0.0 ? static_cast<double>(pixels) / gpuSeconds : 0.0;
+        result.chunks = mgr.chunks.size();
+        result.svoNodes = m_gpuWorld->globalNodes.size();
+        result.brickWords = m_gpuWorld->globalBrickWords.size();
+        result.deviceBytes = stats.deviceBytes;
+        result.rayQuery = m_renderer->rayQueryActive();
+
+        std::cout << "Benchmark " << scene << ": cpu p50 " << result.cpuMs.p50 << " / p99 " << result.cpuMs.p99
+                  << " ms, gpu p50 " << result.gpuMs.p50 << " / p99 " << result.gpuMs.p99 << " ms, "
+                  << result.svoNodes << " svo nodes\n";
+        results.push_back(result);
+
+        // the local chunk manager goes away, nothing may still reference it
+        m_renderer->cleanupWorld(*m_gpuWorld);
+    }
+
+    if (!writeBenchmarkResults(config.output, config, results))
+        std::cerr << "Benchmark: couldn't write " << config.output << "\n";
+    else
+        std::cout << "Benchmark results written to " << config.output << "\n";
+
+    glfwSetWindowShouldClose(win, true);
+}
+
+void App::runOfflineRender() {
+    const OfflineRenderConfig& config = m_offlineConfig;
+    constexpr float OFFLINE_DT = 1.0f / 60.0f;
+    GLFWwindow* win = m_renderer->getWindow();
+    glfwSetInputMode(win, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+    glfwSetCursorPosCallback(win, nullptr);
+
+    m_renderer->setOfflineRender(config.spp);
+    Camera cam = config.hasCamera ? config.camera : g_camera;
+
+    // one frame to settle the render extent, the tiles are cut at it
+    m_renderer->render(cam, OFFLINE_DT);
+    const vk::Extent2D extent = m_renderer->frameStats().renderExtent;
+
+    // same planes as drawFrame, at the whole image's aspect
+    const glm::mat4 proj = cam.projection(static_cast<float>(config.width) / static_cast<float>(config.height), 0.1f, 10000.0f);
+    const std::vector<OfflineTile> tiles = splitOfflineTiles(config.width, config.height, extent.width, extent.height);
+    const auto owned = std::count_if(tiles.begin(), tiles.end(),
+        [&](const OfflineTile& t) { return ownsOfflineTile(t, config.worker, config.workers); });
+
+    // tiles this worker doesn't own stay zero, see mergeExrParts
+    std::vector<float> image(static_cast<size_t>(config.width) * config.height * 4, 0.0f);
+    std::vector<float> tileRgba;
+    uint32_t done = 0;
+    for (const OfflineTile& tile : tiles) {
+        if (!ownsOfflineTile(tile, config.worker, config.workers)) continue;
+        if (glfwWindowShouldClose(win)) break;
+
+        // seeded by the tile, so a tile's noise doesn't depend on how the image was split up
+        m_renderer->setProjectionOverride(offlineTileProjection(proj, config.width, config.height, tile, extent.width, extent.height));
+        m_renderer->resetFrameSeed(tile.index);
+        cam.cameraChanged = true;
+        do {
+            glfwPollEvents();
+            m_renderer->render(cam, OFFLINE_DT);
+        } while (!m_renderer->progressiveConverged() && !glfwWindowShouldClose(win));
+
+        m_renderer->readProgressiveImage(tileRgba);
+        for (uint32_t y = 0; y < tile.height; ++y) {
+            std::copy_n(tileRgba.begin() + static_cast<std::ptrdiff_t>(static_cast<size_t>(y) * extent.width * 4), tile.width * 4,
+                        image.begin() + static_cast<std::ptrdiff_t>((static_cast<size_t>(tile.y + y) * config.width + tile.x) * 4));
+        }
+        std::cout << "Offline: tile " << ++done << "/" << owned << "\n";
+    }
+    m_renderer->setProjectionOverride(std::nullopt);
+
+    if (done < owned)
+        std::cerr << "Offline: window closed after " << done << " of " << owned << " tiles, nothing written\n";
+    else if (!writeExr(config.output, config.width, config.height, image))
+        std::cerr << "Offline: couldn't write " << config.output << "\n";
+    else
+        std::cout << "Offline render written to " << config.output << "\n";
+
+    glfwSetWindowShouldClose(win, true);
+}
+
 void App::shutdown() {
+    // the world thread is gone, nothing asks for chunks anymore. edits still in memory go out to the
+    // region files, the store finishes its writes and the generator the chunks it's still on
+    if (m_regions) saveEditedChunks(g_mgr);
+    g_mgr.asyncLoader = {};
+    g_mgr.saver = {};
+    m_regions.reset();
+    m_terrain.reset();
+    // the renderer goes first so no frame is still waiting on the cuda tracer
     if (m_renderer) {
         m_renderer.reset();
         m_gpuWorld.reset();
     }
-    if (m_cudaTracer) { m_cudaTracer->~CudaTracer(); m_cudaTracer.reset(); }
+    if (m_cudaTracer) { m_cudaTracer.reset(); } // the destructor cleans up, the gl context is still alive here
+    if (m_raster) { m_raster.reset(); } // same, waits for meshing jobs still reading chunks
+    m_gpuWorld.reset();
+    m_cudaMaterials.reset();
     if (g_ui != nullptr) { delete g_ui; }
     if (m_backend == GraphicsApi::Vulkan) {
         m_window.reset();
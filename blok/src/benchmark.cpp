@@ -0,0 +1,94 @@
+/*
+* File: benchmark.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace blok {
+
+void BenchmarkConfig::setDefaultScenes() {
+    if (scenes.empty()) scenes = { "castle.vox", "menger.vox", "room.vox" };
+}
+
+Camera benchmarkCamera(const glm::vec3& boundsMin, const glm::vec3& boundsMax, float t) {
+    const glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    const glm::vec3 extent = boundsMax - boundsMin;
+    const float radius = std::max(extent.x, extent.z) * (0.9f + 0.2f * std::sin(t * 4.0f * glm::pi<float>()));
+    const float angle = t * 2.0f * glm::pi<float>();
+
+    Camera cam;
+    cam.position = center + glm::vec3(
+        std::cos(angle) * radius,
+        extent.y * (0.35f + 0.25f * std::sin(t * 2.0f * glm::pi<float>())),
+        std::sin(angle) * radius);
+
+    // yaw/pitch in degrees, same convention as Camera::forward
+    const glm::vec3 dir = glm::normalize(center - cam.position);
+    cam.yaw = glm::degrees(std::atan2(dir.z, dir.x));
+    cam.pitch = glm::degrees(std::asin(glm::clamp(dir.y, -1.0f, 1.0f)));
+    cam.cameraChanged = true;
+    return cam;
+}
+
+FrameTimeSummary summarizeFrameTimes(std::vector<float> ms) {
+    FrameTimeSummary s;
+    if (ms.empty()) return s;
+
+    std::sort(ms.begin(), ms.end());
+    // nearest rank
+    auto at = [&](float p) {
+        const auto rank = static_cast<size_t>(std::ceil(p * static_cast<float>(ms.size())));
+        return ms[std::clamp<size_t>(rank, 1, ms.size()) - 1];
+    };
+
+    double sum = 0.0;
+    for (float v : ms) sum += v;
+    s.mean = static_cast<float>(sum / static_cast<double>(ms.size()));
+    s.p50 = at(0.50f);
+    s.p90 = at(0.90f);
+    s.p99 = at(0.99f);
+    s.max = ms.back();
+    return s;
+}
+
+static void writeSummary(std::ofstream& out, const char* name, const FrameTimeSummary& s) {
+    out << "\"" << name << "\":{\"mean\":" << s.mean << ",\"p50\":" << s.p50 << ",\"p90\":" << s.p90
+        << ",\"p99\":" << s.p99 << ",\"max\":" << s.max << "}";
+}
+
+bool writeBenchmarkResults(const std::string& path, const BenchmarkConfig& config, const std::vector<BenchmarkSceneResult>& results) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    // scene names are file names, nothing in them needs escaping except a windows path
+    auto str = [](const std::string& s) {
+        std::string r;
+        for (char c : s) r += (c == '\\') ? '/' : c;
+        return "\"" + r + "\"";
+    };
+
+    out << "{\n\"config\":{\"warmupFrames\":" << config.warmupFrames << ",\"frames\":" << config.frames
+        << ",\"seed\":" << config.seed << "},\n\"scenes\":[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        out << "{\"scene\":" << str(r.scene) << ",\"loaded\":" << (r.loaded ? "true" : "false")
+            << ",\"frames\":" << r.frames
+            << ",\"renderWidth\":" << r.renderWidth << ",\"renderHeight\":" << r.renderHeight << ",";
+        writeSummary(out, "cpuMs", r.cpuMs);
+        out << ",";
+        writeSummary(out, "gpuMs", r.gpuMs);
+        out << ",\"primaryRaysPerSecond\":" << r.primaryRaysPerSecond
+            << ",\"chunks\":" << r.chunks << ",\"svoNodes\":" << r.svoNodes << ",\"brickWords\":" << r.brickWords
+            << ",\"deviceBytes\":" << r.deviceBytes << ",\"rayQuery\":" << (r.rayQuery ? "true" : "false") << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]\n}\n";
+    return static_cast<bool>(out);
+}
+
+}
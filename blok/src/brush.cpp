@@ -6,60 +6,289 @@
 */
 #include "brush.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 #include "chunk_manager.hpp"
 
 namespace blok {
 
+// more than this many unflushed brushes on one chunk and they're folded into the cpu storage,
+// every gpu build replays all of them
+static constexpr size_t MAX_GPU_BRUSHES = 64;
+
+namespace {
+
+// the brush in one chunk's local voxel space, what the row kernels read
+struct BrushKernel {
+    glm::vec3 center; // chunk-local, in voxels
+    float invRadius;
+    float invFalloff; // 0 for a hard edge
+    float value;
+    float noiseAmplitude;
+    float noiseScale;
+    uint32_t shape; // Brush::Shape
+    uint32_t mode; // Brush::Mode
+};
+
+#if defined(_MSC_VER)
+#define BLOK_BRUSH_INLINE __forceinline
+#else
+#define BLOK_BRUSH_INLINE inline __attribute__((always_inline))
+#endif
+
+// lattice hash for the noise, integer only so it vectorises
+BLOK_BRUSH_INLINE float latticeValue(int32_t x, int32_t y, int32_t z) {
+    uint32_t h = static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(y) * 0xd8163841u ^ static_cast<uint32_t>(z) * 0xcb1ab31fu;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return static_cast<float>(h & 0xFFFFu) * (2.0f / 65535.0f) - 1.0f;
+}
+
+// trilinear value noise in [-1, 1], smoothstepped between lattice points
+BLOK_BRUSH_INLINE float valueNoise(float x, float y, float z) {
+    const float fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+    const auto ix = static_cast<int32_t>(fx), iy = static_cast<int32_t>(fy), iz = static_cast<int32_t>(fz);
+    float tx = x - fx, ty = y - fy, tz = z - fz;
+    tx = tx * tx * (3.0f - 2.0f * tx);
+    ty = ty * ty * (3.0f - 2.0f * ty);
+    tz = tz * tz * (3.0f - 2.0f * tz);
+
+    auto lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+    const float x00 = lerp(latticeValue(ix, iy, iz), latticeValue(ix + 1, iy, iz), tx);
+    const float x10 = lerp(latticeValue(ix, iy + 1, iz), latticeValue(ix + 1, iy + 1, iz), tx);
+    const float x01 = lerp(latticeValue(ix, iy, iz + 1), latticeValue(ix + 1, iy, iz + 1), tx);
+    const float x11 = lerp(latticeValue(ix, iy + 1, iz + 1), latticeValue(ix + 1, iy + 1, iz + 1), tx);
+    return lerp(lerp(x00, x10, ty), lerp(x01, x11, ty), tz);
+}
+
+constexpr uint32_t ROW = 8; // lanes per row, one avx2 register of floats and a whole storage brick row
+
+// one brick row, voxel centers at (x0 + i + 0.5, y + 0.5, z + 0.5) for i < count. fixed width float loops
+// without branches, the compiler vectorises them (sse / neon as built, avx2 in the clone below)
+BLOK_BRUSH_INLINE void brushRow(const BrushKernel& k, uint32_t x0, uint32_t y, uint32_t z, uint32_t count, uint8_t* density) {
+    const float dy = static_cast<float>(y) + 0.5f - k.center.y;
+    const float dz = static_cast<float>(z) + 0.5f - k.center.z;
+
+    float d[ROW], r[ROW];
+    for (uint32_t i = 0; i < ROW; ++i)
+        d[i] = static_cast<float>(density[std::min(i, count - 1)]) * (1.0f / 255.0f);
+
+    // distance through the shape, 1 on its surface
+    for (uint32_t i = 0; i < ROW; ++i) {
+        const float dx = static_cast<float>(x0 + i) + 0.5f - k.center.x;
+        const float sphere = std::sqrt(dx * dx + dy * dy + dz * dz);
+        const float box = std::max(std::max(std::abs(dx), std::abs(dy)), std::abs(dz));
+        const float cylinder = std::max(std::sqrt(dx * dx + dz * dz), std::abs(dy));
+        r[i] = (k.shape == Brush::BOX ? box : k.shape == Brush::CYLINDER ? cylinder : sphere) * k.invRadius;
+    }
+    if (k.noiseAmplitude > 0.0f) {
+        for (uint32_t i = 0; i < ROW; ++i) {
+            const float n = valueNoise((static_cast<float>(x0 + i) + 0.5f) * k.noiseScale,
+                                       (static_cast<float>(y) + 0.5f) * k.noiseScale,
+                                       (static_cast<float>(z) + 0.5f) * k.noiseScale);
+            r[i] -= n * k.noiseAmplitude;
+        }
+    }
+
+    uint8_t out[ROW];
+    for (uint32_t i = 0; i < ROW; ++i) {
+        // strength 1 inside, fading to 0 across the falloff band, 0 outside
+        const float w = k.invFalloff > 0.0f ? std::clamp((1.0f - r[i]) * k.invFalloff, 0.0f, 1.0f) : (r[i] <= 1.0f ? 1.0f : 0.0f);
+        const float t = d[i] + (k.value - d[i]) * w;
+        const float v = k.mode == Brush::ADD ? std::max(d[i], t) : std::min(d[i], t);
+        // ChunkStorage::quantizeDensity, branch free
+        const float q = std::clamp(v * 255.0f + 0.5f, 1.0f, 255.0f);
+        out[i] = v > 0.0f ? static_cast<uint8_t>(q) : uint8_t{0};
+    }
+    for (uint32_t i = 0; i < count; ++i) density[i] = out[i];
+}
+
+// every row of one storage brick inside [lo, hi) (brick-local), base is the brick's min voxel in the chunk
+BLOK_BRUSH_INLINE void brushBrick(const BrushKernel& k, const glm::uvec3& base, const glm::uvec3& lo, const glm::uvec3& hi,
+                                  uint32_t B, uint8_t* density) {
+    for (uint32_t z = lo.z; z < hi.z; ++z)
+        for (uint32_t y = lo.y; y < hi.y; ++y) {
+            uint8_t* row = density + (y + z * B) * B;
+            for (uint32_t x = lo.x; x < hi.x; x += ROW)
+                brushRow(k, base.x + x, base.y + y, base.z + z, std::min(ROW, hi.x - x), row + x);
+        }
+}
+
+void brushBrickDefault(const BrushKernel& k, const glm::uvec3& base, const glm::uvec3& lo, const glm::uvec3& hi,
+                       uint32_t B, uint8_t* density) {
+    brushBrick(k, base, lo, hi, B, density);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(_MSC_VER)
+__attribute__((target("avx2,fma")))
+void brushBrickAvx2(const BrushKernel& k, const glm::uvec3& base, const glm::uvec3& lo, const glm::uvec3& hi,
+                    uint32_t B, uint8_t* density) {
+    brushBrick(k, base, lo, hi, B, density);
+}
+#define BLOK_BRUSH_AVX2
+#endif
+
+using BrushBrickFn = void (*)(const BrushKernel&, const glm::uvec3&, const glm::uvec3&, const glm::uvec3&, uint32_t, uint8_t*);
+
+BrushBrickFn brushBrickKernel() {
+    static const BrushBrickFn fn = [] {
+#ifdef BLOK_BRUSH_AVX2
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return &brushBrickAvx2;
+#endif
+        return &brushBrickDefault;
+    }();
+    return fn;
+}
+
+}
+
 void applyBrush(ChunkManager& mgr, const Brush& brush) {
-    // get bounding box in world space
-    glm::vec3 bbMin = brush.centerWS - glm::vec3(brush.radiusWS);
-    glm::vec3 bbMax = brush.centerWS + glm::vec3(brush.radiusWS);
-
-    // convert to voxel coords
-    glm::ivec3 gvMin = mgr.worldToGlobalVoxel(bbMin);
-    glm::ivec3 gvMax = mgr.worldToGlobalVoxel(bbMax);
-
-    gvMax += glm::ivec3(1); // TODO: remove this if std::floor works fine and doesnt clip near edges
-
-    // iterate voxel space bb
-    for (int gz = gvMin.z; gz < gvMax.z; gz++)
-    for (int gy = gvMin.y; gy < gvMax.y; gy++)
-    for (int gx = gvMin.x; gx < gvMax.x; gx++) {
-        glm::ivec3 gv(gx, gy, gz);
-
-        // determine chunk
-        ChunkCoord cc = mgr.globalVoxelToChunk(gv);
-        Chunk* ch = mgr.getOrCreateChunk(cc);
-
-        // convert to local
-        glm::ivec3 lv = mgr.globalVoxelToLocal(gv, cc);
-        if (lv.x < 0 || lv.x >= static_cast<int>(mgr.C) ||
-            lv.y < 0 || lv.y >= static_cast<int>(mgr.C) ||
-            lv.z < 0 || lv.z >= static_cast<int>(mgr.C)) continue;
-
-        // get voxel world pos
-        glm::vec3 voxelWS = ch->svo.origin + glm::vec3(static_cast<float>(lv.x) + 0.5f * mgr.voxelSize,
-                                                       static_cast<float>(lv.y) + 0.5f * mgr.voxelSize,
-                                                       static_cast<float>(lv.z) + 0.5f * mgr.voxelSize);
-
-        // check if inside brush
-        float dist = glm::distance(voxelWS, brush.centerWS);
-        if (dist > brush.radiusWS) continue;
-
-        // apply value
-        float& d = ch->density[mgr.localIndex(lv.x, lv.y, lv.z)];
-        switch (brush.mode) {
-        case Brush::ADD:
-            d = std::max(d, brush.value);
-            break;
-        case Brush::SUBTRACT:
-            d = std::min(d, brush.value);
-            break;
+    if (!(brush.radiusWS > 0.0f)) return;
+
+    // noise can push the surface out past the radius
+    const float extent = brush.radiusWS * (1.0f + std::max(brush.noiseAmplitude, 0.0f));
+    const glm::ivec3 gvMin = mgr.worldToGlobalVoxel(brush.centerWS - glm::vec3(extent));
+    const glm::ivec3 gvMax = mgr.worldToGlobalVoxel(brush.centerWS + glm::vec3(extent)) + glm::ivec3(1);
+
+    BrushKernel k{};
+    k.invRadius = 1.0f / brush.radiusWS;
+    k.invFalloff = brush.falloff > 0.0f ? 1.0f / std::min(brush.falloff, 1.0f) : 0.0f;
+    k.value = brush.value;
+    k.noiseAmplitude = std::max(brush.noiseAmplitude, 0.0f);
+    k.noiseScale = brush.noiseScale;
+    k.shape = brush.shape;
+    k.mode = brush.mode;
+
+    // only adding can put voxels into chunks that don't exist yet
+    const bool creates = brush.mode == Brush::ADD && ChunkStorage::quantizeDensity(brush.value) > 0;
+    // a hard edged subtract down to nothing clears voxels outright, that comes off an up to date svo in place
+    const bool clears = brush.mode == Brush::SUBTRACT && ChunkStorage::quantizeDensity(brush.value) == 0 && k.invFalloff == 0.0f;
+    const BrushBrickFn kernel = brushBrickKernel();
+    const auto C = static_cast<int32_t>(mgr.C);
+
+    // one undo step unless the caller has a stroke open
+    mgr.beginEdit();
+
+    uint8_t before[ChunkStorage::MAX_BRICK_VOXELS];
+    uint8_t after[ChunkStorage::MAX_BRICK_VOXELS];
+    mgr.forEachChunkInRegion(gvMin, gvMax, creates, [&](Chunk& ch, const glm::ivec3& lo, const glm::ivec3& hi) {
+        // same 1:1 world to voxel mapping as worldToGlobalVoxel, voxel centers at +0.5 like the gpu pass
+        k.center = brush.centerWS - glm::vec3(glm::ivec3(ch.cx, ch.cy, ch.cz) * C);
+
+        const bool patch = clears && svoPatchable(ch);
+        SvoPatch svoPatch;
+        bool changed = false;
+
+        const auto shift = static_cast<int>(ch.voxels.brickShift());
+        const uint32_t B = ch.voxels.brickSize();
+        const uint32_t voxels = B * B * B;
+        const glm::ivec3 bLo = lo >> shift;
+        const glm::ivec3 bHi = (hi - 1) >> shift;
+        for (int bz = bLo.z; bz <= bHi.z; bz++)
+        for (int by = bLo.y; by <= bHi.y; by++)
+        for (int bx = bLo.x; bx <= bHi.x; bx++) {
+            const glm::ivec3 base = glm::ivec3(bx, by, bz) << shift;
+            const glm::uvec3 rowLo(glm::max(lo - base, glm::ivec3(0)));
+            const glm::uvec3 rowHi(glm::min(hi - base, glm::ivec3(static_cast<int>(B))));
+
+            ch.voxels.readBrickDensity(bx, by, bz, before);
+            std::memcpy(after, before, voxels);
+            kernel(k, glm::uvec3(base), rowLo, rowHi, B, after);
+            if (!ch.voxels.writeBrickDensity(bx, by, bz, after)) continue;
+            changed = true;
+
+            if (!patch) continue;
+            for (uint32_t i = 0; i < voxels; ++i) {
+                if (before[i] == 0 || after[i] != 0) continue;
+                const glm::uvec3 v = glm::uvec3(base) + glm::uvec3(i & (B - 1), (i >> shift) & (B - 1), i >> (2 * shift));
+                ch.svo.removeVoxel(v.x, v.y, v.z, &svoPatch);
+            }
+        }
+
+        if (!changed) return;
+        if (patch) commitSvoPatch(ch, std::move(svoPatch));
+        else ch.dirty = true;
+    });
+
+    mgr.endEdit();
+}
+
+void chunkBrushBounds(const ChunkBrushOp& op, uint32_t C, glm::ivec3& lo, glm::ivec3& hi) {
+    const int size = static_cast<int>(C);
+    for (int a = 0; a < 3; ++a) {
+        // voxel centers sit at +0.5
+        lo[a] = std::clamp(static_cast<int>(std::floor(op.center[a] - op.radius - 0.5f)), 0, size);
+        hi[a] = std::clamp(static_cast<int>(std::ceil(op.center[a] + op.radius + 0.5f)), 0, size);
+    }
+}
+
+void applyBrushGpu(ChunkManager& mgr, const Brush& brush) {
+    const bool plainSphere = brush.shape == Brush::SPHERE && brush.falloff <= 0.0f && brush.noiseAmplitude <= 0.0f;
+    if (!mgr.gpuSvoBuild || !plainSphere) {
+        applyBrush(mgr, brush);
+        return;
+    }
+
+    const ChunkCoord ccMin = mgr.globalVoxelToChunk(mgr.worldToGlobalVoxel(brush.centerWS - glm::vec3(brush.radiusWS)));
+    const ChunkCoord ccMax = mgr.globalVoxelToChunk(mgr.worldToGlobalVoxel(brush.centerWS + glm::vec3(brush.radiusWS)));
+
+    ChunkBrushOp op{};
+    op.radius = brush.radiusWS;
+    op.density = ChunkStorage::quantizeDensity(brush.value);
+    op.mode = brush.mode;
+
+    // only adding can put voxels into chunks that don't exist yet
+    const bool creates = brush.mode == Brush::ADD && op.density > 0;
+    const auto C = static_cast<int32_t>(mgr.C);
+
+    // one entry per chunk, the voxels themselves are only touched on the gpu
+    mgr.beginEdit();
+    for (int32_t cz = ccMin.z; cz <= ccMax.z; cz++)
+    for (int32_t cy = ccMin.y; cy <= ccMax.y; cy++)
+    for (int32_t cx = ccMin.x; cx <= ccMax.x; cx++) {
+        const ChunkCoord cc{cx, cy, cz};
+        Chunk* ch = nullptr;
+        if (creates) {
+            ch = mgr.getOrCreateChunk(cc);
+        } else {
+            auto it = mgr.chunks.find(cc);
+            if (it == mgr.chunks.end()) continue;
+            ch = it->second;
         }
 
-        // mark chunk dirty
+        // same 1:1 world to voxel mapping as worldToGlobalVoxel
+        op.center = brush.centerWS - glm::vec3(glm::ivec3(cx, cy, cz) * C);
+        mgr.recordEdit(*ch);
+        ch->gpuBrushes.push_back(op);
         ch->dirty = true;
+
+        if (ch->gpuBrushes.size() > MAX_GPU_BRUSHES) flushGpuBrushes(*ch);
+    }
+    mgr.endEdit();
+}
+
+void flushGpuBrushes(Chunk& ch) {
+    const uint32_t C = ch.voxels.size();
+    for (const ChunkBrushOp& op : ch.gpuBrushes) {
+        glm::ivec3 lo, hi;
+        chunkBrushBounds(op, C, lo, hi);
+        const float value = ChunkStorage::dequantizeDensity(static_cast<uint8_t>(op.density));
+
+        for (int z = lo.z; z < hi.z; z++)
+        for (int y = lo.y; y < hi.y; y++)
+        for (int x = lo.x; x < hi.x; x++) {
+            // same test as the gpu pass
+            const glm::vec3 p(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f, static_cast<float>(z) + 0.5f);
+            if (glm::distance(p, op.center) > op.radius) continue;
+
+            const float d = ch.voxels.density(x, y, z);
+            ch.voxels.setDensity(x, y, z, op.mode == Brush::ADD ? std::max(d, value) : std::min(d, value));
+        }
     }
+    ch.gpuBrushes.clear();
 }
 
 }
@@ -5,27 +5,42 @@
 * Created on: 12/2/2025
 */
 #include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 
 namespace blok {
 
-// Number of subdivisions per axis
-// MUST be a power of two
-// TODO in a way, this is the beginning outline for LODs, lower numbers would mean coarser traversals
-static constexpr uint32_t SUB_CHUNK_DIVISIONS = 8;
-
 ChunkManager::ChunkManager(uint32_t C_, float voxelSize_)
     : C(C_), voxelSize(voxelSize_) {
-    maxDepth = 0;
-    // require C = 2^maxDepth
-    while ((1u << maxDepth) < C)
-        maxDepth++;
+    // coords and indices are shifts by maxDepth, and the svo builders are compiled for the common depths
+    if (C == 0 || (C & (C - 1u)) != 0)
+        throw std::runtime_error("ChunkManager: chunk size must be a power of two");
+    maxDepth = static_cast<uint32_t>(std::countr_zero(C));
 }
 
 ChunkManager::~ChunkManager() {
-    for (auto& kv : chunks) delete kv.second;
+    // let in-flight rebuilds finish before their chunks go away
+    jobs.reset();
+    pendingRebuilds.clear();
+
+    for (const auto& kv : chunks) chunkPool.destroy(kv.second);
+    for (const auto& kv : lodChunks) chunkPool.destroy(kv.second);
+}
+
+JobSystem& ChunkManager::jobSystem() {
+    if (!jobs)
+        jobs = std::make_unique<JobSystem>();
+    return *jobs;
 }
 
 glm::ivec3 ChunkManager::worldToGlobalVoxel(const glm::vec3 &p) const {
@@ -38,24 +53,23 @@ glm::ivec3 ChunkManager::worldToGlobalVoxel(const glm::vec3 &p) const {
     };
 }
 
+// C = 2^maxDepth, so chunk and local coords are shifts and masks (>> on negative ints floors in c++20)
 ChunkCoord ChunkManager::globalVoxelToChunk(const glm::ivec3 &gv) const {
-    return {
-        gv.x >= 0 ? gv.x / static_cast<int32_t>(C) : (gv.x - static_cast<int32_t>(C) + 1) / static_cast<int32_t>(C),
-        gv.y >= 0 ? gv.y / static_cast<int32_t>(C) : (gv.y - static_cast<int32_t>(C) + 1) / static_cast<int32_t>(C),
-        gv.z >= 0 ? gv.z / static_cast<int32_t>(C) : (gv.z - static_cast<int32_t>(C) + 1) / static_cast<int32_t>(C)
-    };
+    const auto shift = static_cast<int32_t>(maxDepth);
+    return { gv.x >> shift, gv.y >> shift, gv.z >> shift };
 }
 
 glm::ivec3 ChunkManager::globalVoxelToLocal(const glm::ivec3 &gv, const ChunkCoord &cc) const {
+    const auto shift = static_cast<int32_t>(maxDepth);
     return {
-        gv.x - cc.x * static_cast<int32_t>(C),
-        gv.y - cc.y * static_cast<int32_t>(C),
-        gv.z - cc.z * static_cast<int32_t>(C)
+        gv.x - (cc.x << shift),
+        gv.y - (cc.y << shift),
+        gv.z - (cc.z << shift)
     };
 }
 
 size_t ChunkManager::localIndex(int lx, int ly, int lz) const {
-    return static_cast<size_t>(lx) + static_cast<size_t>(ly) * C + static_cast<size_t>(lz) * C * C;
+    return static_cast<size_t>(lx) | (static_cast<size_t>(ly) << maxDepth) | (static_cast<size_t>(lz) << (2 * maxDepth));
 }
 
 Chunk *ChunkManager::getOrCreateChunk(const ChunkCoord &cc) {
@@ -68,24 +82,128 @@ Chunk *ChunkManager::getOrCreateChunk(const ChunkCoord &cc) {
         static_cast<float>(cc.y * static_cast<int32_t>(C)) * voxelSize,
         static_cast<float>(cc.z * static_cast<int32_t>(C)) * voxelSize
     );
-    auto* ch = new Chunk(cc.x, cc.y, cc.z, C, maxDepth, origin, voxelSize);
+    Chunk* ch = chunkPool.create(cc.x, cc.y, cc.z, C, maxDepth, origin, voxelSize);
 
-    chunks[cc] = ch;
+    chunks.insert(cc, ch);
     return ch;
 }
 
+void ChunkManager::releaseChunk(Chunk* ch) {
+    chunks.erase(ChunkCoord{ch->cx, ch->cy, ch->cz});
+    svoPool.release(ch->svo);
+    chunkPool.destroy(ch);
+}
+
+uint32_t ChunkManager::maxChunkLod() const {
+    uint32_t subDepth = 0;
+    while ((1u << subDepth) < subChunks.divisions) subDepth++;
+    const uint32_t finest = subDepth + SVO_BRICK_LEVELS;
+    return std::min({streaming.lodLevels, MAX_CHUNK_LOD, maxDepth > finest ? maxDepth - finest : 0u});
+}
+
+Chunk* ChunkManager::setLodChunk(const ChunkCoord& cc, uint32_t lod, ChunkStorage&& voxels) {
+    // the packer tells a replaced tree by its version, the new one carries on from the old one's
+    uint32_t svoVersion = 0;
+    auto it = lodChunks.find(cc);
+    if (it != lodChunks.end()) {
+        svoVersion = it->second->svoVersion;
+        releaseLodChunk(it->second);
+    }
+
+    // same origin and extent as the full res chunk, (C >> lod)^3 voxels 2^lod times the size
+    glm::vec3 origin = glm::vec3(
+        static_cast<float>(cc.x * static_cast<int32_t>(C)) * voxelSize,
+        static_cast<float>(cc.y * static_cast<int32_t>(C)) * voxelSize,
+        static_cast<float>(cc.z * static_cast<int32_t>(C)) * voxelSize
+    );
+    Chunk* ch = chunkPool.create(cc.x, cc.y, cc.z, C >> lod, maxDepth - lod, origin, voxelSize * static_cast<float>(1u << lod));
+    ch->voxels = std::move(voxels);
+    ch->savedEdits = ch->voxels.editCount();
+    ch->svoVersion = svoVersion;
+    ch->lod = lod;
+
+    lodChunks.insert(cc, ch);
+    return ch;
+}
+
+void ChunkManager::releaseLodChunk(Chunk* ch) {
+    lodChunks.erase(ChunkCoord{ch->cx, ch->cy, ch->cz});
+    svoPool.release(ch->svo);
+    chunkPool.destroy(ch);
+}
+
+const Chunk* ChunkManager::packedChunk(const ChunkCoord& cc) const {
+    auto full = chunks.find(cc);
+    const Chunk* ch = full != chunks.end() ? full->second : nullptr;
+    if (ch && !ch->dirty && !ch->rebuilding) return ch;
+
+    auto lod = lodChunks.find(cc);
+    return lod != lodChunks.end() ? lod->second : ch;
+}
+
+ChunkCoord ChunkManager::allocateInstanceSource(const glm::ivec3& chunkExtent) {
+    const ChunkCoord min{ instanceSourceCursor, INSTANCE_SOURCE_CHUNK_Y, 0 };
+    instanceSourceCursor += std::max(chunkExtent.x, 1) + 1;
+    return min;
+}
+
+// patches past this are dropped oldest first, a chunk that many edits behind on the gpu is repacked in full
+static constexpr size_t MAX_SVO_PATCHES = 64;
+
+bool svoPatchable(const Chunk& ch) {
+    // rebuild pending or in flight, gpu built, baked ao a patch would leave stale, or too much garbage from earlier patches
+    return !ch.dirty && !ch.rebuilding && !ch.gpuSvo && ch.gpuBrushes.empty() && !ch.svo.aoBaked
+        && ch.svo.staleNodes * 2 <= ch.svo.nodes.size() && ch.svo.staleWords * 2 <= ch.svo.brickWords.size();
+}
+
+// sorted, overlapping and touching spans merged. a brush's patch walks the same paths over and over
+static void coalesceSpans(std::vector<SvoSpan>& spans) {
+    if (spans.size() < 2) return;
+    std::sort(spans.begin(), spans.end(), [](const SvoSpan& a, const SvoSpan& b) { return a.first < b.first; });
+    size_t out = 0;
+    for (size_t i = 1; i < spans.size(); ++i) {
+        SvoSpan& last = spans[out];
+        if (spans[i].first <= last.first + last.count) {
+            last.count = std::max(last.count, spans[i].first + spans[i].count - last.first);
+        } else {
+            spans[++out] = spans[i];
+        }
+    }
+    spans.resize(out + 1);
+}
+
+void commitSvoPatch(Chunk& ch, SvoPatch&& patch) {
+    if (patch.nodes.empty() && patch.words.empty()) return; // the svo didn't change
+    coalesceSpans(patch.nodes);
+    coalesceSpans(patch.words);
+
+    patch.version = ++ch.svoVersion;
+    if (ch.svoPatches.size() >= MAX_SVO_PATCHES) ch.svoPatches.erase(ch.svoPatches.begin());
+    ch.svoPatches.push_back(std::move(patch));
+}
+
+// single voxel edits go straight into a chunk's up to date cpu svo instead of waiting for a rebuild
+static void patchOrMarkDirty(Chunk* ch, const glm::ivec3& lv) {
+    SvoPatch patch;
+    if (!svoPatchable(*ch) || !ch->svo.patchFromStorage(ch->voxels, lv.x, lv.y, lv.z, patch)) {
+        ch->dirty = true;
+        return;
+    }
+    commitSvoPatch(*ch, std::move(patch));
+}
+
 void ChunkManager::setVoxel(const glm::vec3& worldPos, uint32_t materialId, float density) {
     glm::ivec3 gv = worldToGlobalVoxel(worldPos);
     ChunkCoord cc = globalVoxelToChunk(gv);
     glm::ivec3 lv = globalVoxelToLocal(gv, cc);
 
     Chunk* ch = getOrCreateChunk(cc);
+    if (!ch->gpuBrushes.empty()) flushGpuBrushes(*ch); // keeps edits in order
+    recordEdit(*ch);
 
-    size_t idx = localIndex(lv.x, lv.y, lv.z);
-    ch->density[idx] = density;
-    ch->materialIds[idx] = materialId;
+    ch->voxels.set(lv.x, lv.y, lv.z, materialId, density);
 
-    ch->dirty = true;
+    patchOrMarkDirty(ch, lv);
 }
 
 void ChunkManager::setVoxel(const glm::vec3& worldPos, uint8_t r, uint8_t g, uint8_t b, float density) {
@@ -101,42 +219,215 @@ void ChunkManager::setVoxel(const glm::vec3& worldPos, uint8_t r, uint8_t g, uin
     setVoxelMaterial(worldPos, materialId, density);
 }
 
+// define to time the bottom-up builder against the old per-voxel insert path on every rebuild
+// #define BLOK_COMPARE_SVO_BUILDERS
+
 // helper to rebuild svo
-// TODO: this is a testing version. update to make less naive.
-void buildSvoFromDensity(Chunk* ch, uint32_t C) {
+void buildSvoFromDensity(Chunk* ch, uint32_t C, bool bakeAo) {
+    assert(ch->voxels.size() == C);
+    ch->svo.buildFromStorage(ch->voxels);
+    if (bakeAo) ch->svo.bakeAmbientOcclusion(ch->voxels);
+    ch->svoPatches.clear();
+    ch->gpuSvo = false;
+    ch->svoVersion++;
+}
+
+ChunkStorage downsampleChunkStorage(const ChunkStorage& fine) {
+    assert(fine.size() >= 2);
+    ChunkStorage coarse(fine.size() / 2);
+
+    // storage bricks are an even number of voxels across, so no 2^3 block straddles two of them
+    const uint32_t shift = fine.brickShift();
+    const uint32_t B = fine.brickSize();
+    const uint32_t perAxis = fine.bricksPerAxis();
+    std::vector<ChunkStorage::Write> writes;
+    for (uint32_t bz = 0; bz < perAxis; ++bz)
+        for (uint32_t by = 0; by < perAxis; ++by)
+            for (uint32_t bx = 0; bx < perAxis; ++bx) {
+                const ChunkStorage::Brick* brick = fine.brick(bx, by, bz);
+                if (!brick) continue;
+
+                writes.clear();
+                for (uint32_t z = 0; z < B; z += 2)
+                    for (uint32_t y = 0; y < B; y += 2)
+                        for (uint32_t x = 0; x < B; x += 2) {
+                            uint16_t materials[8];
+                            uint32_t filled = 0, densitySum = 0;
+                            for (uint32_t o = 0; o < 8; ++o) {
+                                const uint32_t i = (x + (o & 1u)) | ((y + ((o >> 1) & 1u)) << shift) | ((z + (o >> 2)) << (2 * shift));
+                                if (brick->density[i] == 0) continue;
+                                materials[filled++] = brick->material[i];
+                                densitySum += brick->density[i];
+                            }
+                            if (filled == 0) continue;
+
+                            // most common palette entry, ties go to the first one seen
+                            uint16_t material = materials[0];
+                            uint32_t best = 0;
+                            for (uint32_t a = 0; a < filled; ++a) {
+                                const auto votes = static_cast<uint32_t>(std::count(materials, materials + filled, materials[a]));
+                                if (votes > best) { best = votes; material = materials[a]; }
+                            }
+
+                            // never rounds down to empty
+                            const float density = std::max(static_cast<float>(densitySum) / (8.0f * 255.0f), 1.0f / 255.0f);
+                            writes.push_back({(bx * B + x) / 2, (by * B + y) / 2, (bz * B + z) / 2, fine.paletteMaterial(material), density});
+                        }
+                if (!writes.empty()) coarse.set(writes.data(), writes.size());
+            }
+    return coarse;
+}
+
+// the gpu builder works on 4^3 bricks, smaller chunks stay on the cpu
+static bool useGpuSvoBuild(const ChunkManager& mgr) {
+    return mgr.gpuSvoBuild && mgr.maxDepth >= SVO_BRICK_LEVELS;
+}
+
+// no cpu tree, the packer queues a gpu build from the voxels instead. the old tree is dropped, it's stale now
+static void flagGpuSvoBuild(ChunkManager& mgr, Chunk* ch) {
+    mgr.svoPool.release(ch->svo);
+    ch->svo.clear();
+    ch->svoPatches.clear();
+    ch->gpuSvo = true;
+    ch->svoVersion++;
+}
+
+#ifdef BLOK_COMPARE_SVO_BUILDERS
+// old path, one insertVoxel per filled cell. kept around for comparison
+static void buildSvoFromDensityInsert(Chunk* ch, uint32_t C) {
     ch->svo.clear();
 
     for (uint32_t z = 0; z < C; ++z)
         for (uint32_t y = 0; y < C; ++y)
             for (uint32_t x = 0; x < C; ++x) {
-                size_t idx = x + y*C + z*C*C;
-                float d = ch->density[idx];
+                float d = ch->voxels.density(x, y, z);
                 if (d > 0.0f) {
-                    uint32_t materialId = ch->materialIds[idx];
+                    uint32_t materialId = ch->voxels.material(x, y, z);
                     ch->svo.insertVoxel(x, y, z, materialId, d);
                 }
             }
 }
 
-void rebuildDirtyChunks(ChunkManager& mgr, int maxPerFrame) {
-    int count = 0;
+static void compareSvoBuilders(Chunk* ch, uint32_t C) {
+    using clock = std::chrono::high_resolution_clock;
+
+    auto t0 = clock::now();
+    buildSvoFromDensityInsert(ch, C);
+    auto t1 = clock::now();
+    const size_t insertNodes = ch->svo.nodes.size();
+
+    buildSvoFromDensity(ch, C);
+    auto t2 = clock::now();
+
+    const double insertMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    const double bottomUpMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+    std::cout << "SVO build (" << ch->cx << "," << ch->cy << "," << ch->cz << "): insert "
+              << insertMs << " ms / " << insertNodes << " nodes, bottom-up "
+              << bottomUpMs << " ms / " << ch->svo.nodes.size() << " nodes\n";
+}
+#endif
+
+// picks up to maxPerFrame dirty chunks that don't already have a rebuild in flight
+static std::vector<Chunk*> takeDirtyChunks(ChunkManager& mgr, int maxPerFrame) {
+    std::vector<Chunk*> out;
     for (auto& kv : mgr.chunks) {
         Chunk* ch = kv.second;
-        if (!ch->dirty) continue;
-        if (count >= maxPerFrame) break;
+        if (!ch->dirty || ch->rebuilding) continue;
+        if (static_cast<int>(out.size()) >= maxPerFrame) break;
 
-        ch->svo.clear();
+        ch->dirty = false;
+        out.push_back(ch);
+    }
+    return out;
+}
 
-        // rebuild
-        buildSvoFromDensity(ch, mgr.C);
+void rebuildDirtyChunks(ChunkManager& mgr, int maxPerFrame) {
+    std::vector<Chunk*> work = takeDirtyChunks(mgr, maxPerFrame);
+    if (work.empty()) return;
+    BLOK_PROFILE_SCOPE("rebuildDirtyChunks");
 
-        ch->dirty = false;
+    if (useGpuSvoBuild(mgr)) {
+        for (Chunk* ch : work) flagGpuSvoBuild(mgr, ch);
+        return;
+    }
+
+    // every chunk owns its tree so these are independent, main thread helps out in wait()
+    JobSystem& jobs = mgr.jobSystem();
+    JobCounter counter;
+    const uint32_t C = mgr.C;
+    const bool bakeAo = mgr.bakeAmbientOcclusion;
+    for (Chunk* ch : work) {
+        jobs.submit([ch, C, bakeAo] {
+            BLOK_PROFILE_NAMED(timer, "rebuildChunk");
+            flushGpuBrushes(*ch);
+#ifdef BLOK_COMPARE_SVO_BUILDERS
+            compareSvoBuilders(ch, C);
+#else
+            buildSvoFromDensity(ch, C, bakeAo);
+#endif
+            BLOK_PROFILE_DETAIL(timer, "(" + std::to_string(ch->cx) + "," + std::to_string(ch->cy) + "," +
+                std::to_string(ch->cz) + ") " + std::to_string(ch->svo.nodes.size()) + " nodes");
+        }, &counter);
+    }
+    jobs.wait(counter);
+}
+
+void rebuildDirtyChunksAsync(ChunkManager& mgr, int maxPerFrame) {
+    std::vector<Chunk*> work = takeDirtyChunks(mgr, maxPerFrame);
+
+    if (useGpuSvoBuild(mgr)) {
+        // nothing to wait for, the flag is all there is to it
+        for (Chunk* ch : work) flagGpuSvoBuild(mgr, ch);
+        return;
+    }
+
+    JobSystem& jobs = mgr.jobSystem();
+    const bool bakeAo = mgr.bakeAmbientOcclusion;
+    for (Chunk* ch : work) {
+        ch->rebuilding = true;
+        flushGpuBrushes(*ch);
+
+        // snapshot now, any edit after this marks the chunk dirty again and it gets picked up next time
+        auto pending = std::make_unique<PendingChunkRebuild>(ch, mgr.svoPool);
+        PendingChunkRebuild* p = pending.get();
+        mgr.pendingRebuilds.push_back(std::move(pending));
+
+        jobs.submit([p, bakeAo] {
+            BLOK_PROFILE_SCOPE("rebuildChunkAsync");
+            p->tree.buildFromStorage(p->voxels);
+            if (bakeAo) p->tree.bakeAmbientOcclusion(p->voxels);
+            p->done.store(true, std::memory_order_release);
+        });
+    }
+}
+
+int collectRebuiltChunks(ChunkManager& mgr) {
+    int count = 0;
+    auto& pending = mgr.pendingRebuilds;
+    for (size_t i = 0; i < pending.size();) {
+        PendingChunkRebuild& p = *pending[i];
+        if (!p.done.load(std::memory_order_acquire)) { ++i; continue; }
+
+        p.chunk->svo.nodes.swap(p.tree.nodes);
+        p.chunk->svo.brickWords.swap(p.tree.brickWords);
+        p.chunk->svo.brickCount = p.tree.brickCount;
+        p.chunk->svo.rootIndex = p.tree.rootIndex;
+        p.chunk->svo.staleNodes = 0;
+        p.chunk->svo.staleWords = 0;
+        p.chunk->svo.aoBaked = p.tree.aoBaked;
+        p.chunk->svoPatches.clear();
+        p.chunk->gpuSvo = false;
+        p.chunk->svoVersion++;
+        p.chunk->rebuilding = false;
+        // the tree holds the chunk's previous arrays now
+        mgr.svoPool.release(p.tree);
         count++;
 
-        // TODO: debug print. establish macro or delete
-        std::cout << "Chunk (" << ch->cx << "," << ch->cy << "," << ch->cz
-          << ") - SVO node count: " << ch->svo.nodes.size() << "\n";
+        pending[i] = std::move(pending.back());
+        pending.pop_back();
     }
+    return count;
 }
 
 // Check if a sub-region of the SVO contains any geometry
@@ -180,7 +471,7 @@ static bool subChunkHasGeometry(
             return false;  // Invalid child pointer
         }
 
-        nodeIndex = node.firstChild + octant;
+        nodeIndex = svoChildIndex(node, octant);
 
         if (nodeIndex >= nodes.size()) {
             return false;  // Out of bounds
@@ -217,11 +508,11 @@ static uint32_t findSubChunkRootNode(
         uint32_t octZ = (subZ / cellSize) & 1;
         uint32_t octant = octX | (octY << 1) | (octZ << 2);
 
-        if (node.firstChild == 0xFFFFFFFFu) {
+        if (node.firstChild == 0xFFFFFFFFu || (node.childMask & (1u << octant)) == 0) {
             return nodeIndex;  // Can't go deeper, return current
         }
 
-        nodeIndex = node.firstChild + octant;
+        nodeIndex = svoChildIndex(node, octant);
 
         if (nodeIndex >= nodes.size()) {
             return 0;
@@ -231,86 +522,907 @@ static uint32_t findSubChunkRootNode(
     return nodeIndex;
 }
 
-void packChunksToGpuSvo(const ChunkManager& mgr, WorldSvoGpu& gpuWorld) {
-    gpuWorld.globalNodes.clear();
-    gpuWorld.globalSubChunks.clear();
+// heap allocator for the node + brick arrays. first fit over the free list, otherwise grow the heap
+template <typename T>
+static uint32_t allocRange(std::vector<T>& heap, std::vector<GpuRange>& freeList, uint32_t count) {
+    for (size_t i = 0; i < freeList.size(); ++i) {
+        GpuRange& r = freeList[i];
+        if (r.count < count) continue;
+
+        const uint32_t first = r.first;
+        r.first += count;
+        r.count -= count;
+        if (r.count == 0) freeList.erase(freeList.begin() + static_cast<std::ptrdiff_t>(i));
+        return first;
+    }
+
+    const auto first = static_cast<uint32_t>(heap.size());
+    heap.resize(heap.size() + count);
+    return first;
+}
+
+static void freeRange(std::vector<GpuRange>& freeList, uint32_t first, uint32_t count) {
+    if (count == 0) return;
 
-    gpuWorld.globalNodes.reserve(1024);
-    gpuWorld.globalSubChunks.reserve(mgr.chunks.size() * SUB_CHUNK_DIVISIONS * SUB_CHUNK_DIVISIONS);
+    auto it = std::lower_bound(freeList.begin(), freeList.end(), first,
+        [](const GpuRange& r, uint32_t v) { return r.first < v; });
+    it = freeList.insert(it, {first, count});
 
-    uint32_t nodeOffset = 0;
-    uint32_t totalSubChunks = 0;
-    uint32_t emptySubChunks = 0;
+    // merge with the next range, then the previous one
+    auto next = it + 1;
+    if (next != freeList.end() && it->first + it->count == next->first) {
+        it->count += next->count;
+        freeList.erase(next);
+    }
+    if (it != freeList.begin()) {
+        auto prev = it - 1;
+        if (prev->first + prev->count == it->first) {
+            prev->count += it->count;
+            freeList.erase(it);
+        }
+    }
+}
+
+// leave some headroom so small edits can be written back in place
+static uint32_t capacityFor(uint32_t count) {
+    const uint32_t withSlack = count + count / 4;
+    return (withSlack + 63u) & ~63u;
+}
+
+// grows outMin/outMax (chunk-local) to cover every filled leaf below a node.
+// children whose cell is already inside the bounds are skipped, dense regions end early
+static void occupiedBounds(const SvoTree& tree, uint32_t index, const glm::vec3& cellMin, float cellSize,
+                           glm::vec3& outMin, glm::vec3& outMax) {
+    const glm::vec3 cellMax = cellMin + glm::vec3(cellSize);
+    if (cellMin.x >= outMin.x && cellMin.y >= outMin.y && cellMin.z >= outMin.z &&
+        cellMax.x <= outMax.x && cellMax.y <= outMax.y && cellMax.z <= outMax.z)
+        return;
+
+    const SvoNode& node = tree.nodes[index];
+    if (svoIsBrick(node)) {
+        const uint64_t bits = svoBrickBits(tree.brickWords.data() + node.firstChild);
+        const float voxel = cellSize / static_cast<float>(SVO_BRICK_SIZE);
+        for (uint32_t i = 0; i < SVO_BRICK_VOXELS; ++i) {
+            if ((bits & (uint64_t{1} << i)) == 0) continue;
+            const glm::vec3 vmin = cellMin + glm::vec3(
+                static_cast<float>(i & 3u),
+                static_cast<float>((i >> 2) & 3u),
+                static_cast<float>(i >> 4)
+            ) * voxel;
+            outMin = glm::min(outMin, vmin);
+            outMax = glm::max(outMax, vmin + glm::vec3(voxel));
+        }
+        return;
+    }
+
+    if (node.childMask == 0u) {
+        if (node.occupancy > 0.0f) {
+            outMin = glm::min(outMin, cellMin);
+            outMax = glm::max(outMax, cellMax);
+        }
+        return;
+    }
+
+    const float half = cellSize * 0.5f;
+    for (uint32_t oct = 0; oct < 8; ++oct) {
+        if ((node.childMask & (1u << oct)) == 0u) continue;
+        const glm::vec3 childMin = cellMin + glm::vec3(
+            (oct & 1u) ? half : 0.0f,
+            (oct & 2u) ? half : 0.0f,
+            (oct & 4u) ? half : 0.0f
+        );
+        occupiedBounds(tree, svoChildIndex(node, oct), childMin, half, outMin, outMax);
+    }
+}
+
+// fills in the cell + tight bounds of a sub-chunk rooted at 'index'. false if nothing below it is filled
+static bool setSubChunkBounds(const SvoTree& tree, uint32_t index, const glm::vec3& cellMin, float cellSize, SubChunkGpu& sub) {
+    glm::vec3 bmin(std::numeric_limits<float>::max());
+    glm::vec3 bmax(-std::numeric_limits<float>::max());
+    occupiedBounds(tree, index, cellMin, cellSize, bmin, bmax);
+    if (bmin.x > bmax.x) return false;
+
+    sub.cellMin = cellMin;
+    sub.subChunkSize = cellSize;
+    sub.localMin = bmin;
+    sub.localMax = bmax;
+    return true;
+}
+
+// writes every sub-chunk of one chunk into its slot, empty sub-chunks are left inactive
+// returns the number of active sub-chunks
+static uint32_t writeUniformSubChunks(const ChunkManager& mgr, const Chunk* ch, const ChunkGpuRange& range, SubChunkGpu* block) {
+    const auto& nodes = ch->svo.nodes;
+    const uint32_t divisions = mgr.subChunks.divisions;
 
     // Calculate sub-chunk depth (how many SVO levels to skip)
     uint32_t subChunkDepth = 0;
-    while ((1u << subChunkDepth) < SUB_CHUNK_DIVISIONS) subChunkDepth++;
+    while ((1u << subChunkDepth) < divisions) subChunkDepth++;
+
+    float chunkWorldSize = static_cast<float>(mgr.C) * mgr.voxelSize;
+    float subChunkWorldSize = chunkWorldSize / static_cast<float>(divisions);
+
+    uint32_t active = 0;
+
+    // Iterate over all sub-chunk positions
+    for (uint32_t sz = 0; sz < divisions; sz++) {
+        for (uint32_t sy = 0; sy < divisions; sy++) {
+            for (uint32_t sx = 0; sx < divisions; sx++) {
+                // Calculate chunk-local bounds
+                glm::vec3 subMin = glm::vec3(
+                    static_cast<float>(sx) * subChunkWorldSize,
+                    static_cast<float>(sy) * subChunkWorldSize,
+                    static_cast<float>(sz) * subChunkWorldSize
+                );
+
+                SubChunkGpu sub{};
+                sub.nodeOffset = range.nodeOffset;
+                sub.brickOffset = range.brickOffset;
+                sub.startDepth = subChunkDepth;
+
+                // Check if this sub-chunk has any geometry, nodeCount 0 marks it inactive
+                if (subChunkHasGeometry(nodes, sx, sy, sz, divisions, mgr.maxDepth)) {
+                    sub.rootNodeIndex = findSubChunkRootNode(
+                        nodes, sx, sy, sz, divisions, mgr.maxDepth
+                    );
+                    if (setSubChunkBounds(ch->svo, sub.rootNodeIndex, subMin, subChunkWorldSize, sub)) {
+                        sub.nodeCount = range.nodeCount;
+                        active++;
+                    }
+                }
 
-    for (auto& kv : mgr.chunks) {
+                block[sx + sy * divisions + sz * divisions * divisions] = sub;
+            }
+        }
+    }
+
+    return active;
+}
+
+// filled leaves (brick voxels) below every node, written into counts[]
+static uint32_t countFilledLeaves(const SvoTree& tree, uint32_t index, std::vector<uint32_t>& counts) {
+    const SvoNode& node = tree.nodes[index];
+    uint32_t count = 0;
+    if (svoIsBrick(node)) {
+        count = static_cast<uint32_t>(std::popcount(svoBrickBits(tree.brickWords.data() + node.firstChild)));
+    } else if (node.childMask == 0u) {
+        count = node.occupancy > 0.0f ? 1u : 0u;
+    } else {
+        for (uint32_t oct = 0; oct < 8; ++oct)
+            if (node.childMask & (1u << oct))
+                count += countFilledLeaves(tree, svoChildIndex(node, oct), counts);
+    }
+    counts[index] = count;
+    return count;
+}
+
+struct AdaptiveCellContext {
+    const SvoTree& tree;
+    const std::vector<uint32_t>& counts;
+    const ChunkGpuRange& range;
+    uint32_t maxSplitDepth;
+    uint32_t leafThreshold;
+    SubChunkGpu* block;
+    uint32_t written;
+};
+
+// emits the cell of node 'index' as one sub-chunk, or recurses into its children if it's dense
+static void emitAdaptiveCell(AdaptiveCellContext& ctx, uint32_t index, uint32_t depth, const glm::vec3& cellMin, float cellSize) {
+    if (ctx.counts[index] == 0u) return; // nothing to hit
+
+    const SvoNode& node = ctx.tree.nodes[index];
+    if (depth < ctx.maxSplitDepth && svoChildBits(node) != 0u && ctx.counts[index] > ctx.leafThreshold) {
+        const float half = cellSize * 0.5f;
+        for (uint32_t oct = 0; oct < 8; ++oct) {
+            if ((node.childMask & (1u << oct)) == 0u) continue;
+            const glm::vec3 childMin = cellMin + glm::vec3(
+                (oct & 1u) ? half : 0.0f,
+                (oct & 2u) ? half : 0.0f,
+                (oct & 4u) ? half : 0.0f
+            );
+            emitAdaptiveCell(ctx, svoChildIndex(node, oct), depth + 1, childMin, half);
+        }
+        return;
+    }
+
+    SubChunkGpu sub{};
+    sub.nodeOffset = ctx.range.nodeOffset;
+    sub.rootNodeIndex = index;
+    sub.nodeCount = ctx.range.nodeCount;
+    sub.startDepth = depth;
+    sub.brickOffset = ctx.range.brickOffset;
+    setSubChunkBounds(ctx.tree, index, cellMin, cellSize, sub); // counts > 0, always has bounds
+    ctx.block[ctx.written++] = sub;
+}
+
+// adaptive layout, cells come from the svo itself. never more than divisions^3 of them,
+// so they fit the same slot. unused entries stay inactive
+static uint32_t writeAdaptiveSubChunks(const ChunkManager& mgr, const Chunk* ch, const ChunkGpuRange& range, SubChunkGpu* block, uint32_t slotSize) {
+    std::vector<uint32_t> counts(ch->svo.nodes.size(), 0u);
+    countFilledLeaves(ch->svo, ch->svo.rootIndex, counts);
+
+    uint32_t maxSplitDepth = 0;
+    while ((1u << maxSplitDepth) < mgr.subChunks.divisions) maxSplitDepth++;
+
+    AdaptiveCellContext ctx{ch->svo, counts, range, maxSplitDepth, mgr.subChunks.leafThreshold, block, 0};
+    emitAdaptiveCell(ctx, ch->svo.rootIndex, 0, glm::vec3(0.0f), static_cast<float>(mgr.C) * mgr.voxelSize);
+
+    for (uint32_t i = ctx.written; i < slotSize; ++i)
+        block[i] = SubChunkGpu{};
+
+    return ctx.written;
+}
+
+static uint32_t writeChunkSubChunks(const ChunkManager& mgr, const Chunk* ch, const ChunkGpuRange& range, WorldSvoGpu& gpuWorld) {
+    SubChunkGpu* block = gpuWorld.globalSubChunks.data() + static_cast<size_t>(range.slot) * gpuWorld.subChunksPerChunk;
+    if (mgr.subChunks.adaptive)
+        return writeAdaptiveSubChunks(mgr, ch, range, block, gpuWorld.subChunksPerChunk);
+    return writeUniformSubChunks(mgr, ch, range, block);
+}
+
+static void clearChunkSlot(WorldSvoGpu& gpuWorld, uint32_t slot) {
+    SubChunkGpu* block = gpuWorld.globalSubChunks.data() + static_cast<size_t>(slot) * gpuWorld.subChunksPerChunk;
+    for (uint32_t i = 0; i < gpuWorld.subChunksPerChunk; ++i)
+        block[i] = SubChunkGpu{};
+    gpuWorld.dirtySubChunkRanges.push_back({slot * gpuWorld.subChunksPerChunk, gpuWorld.subChunksPerChunk});
+}
+
+// moves the chunk's node + brick ranges if they can't hold count / wordCount anymore
+static void reserveChunkRange(WorldSvoGpu& gpuWorld, ChunkGpuRange& range, uint32_t count, uint32_t wordCount) {
+    // outgrew its range, move it. sub-chunks get the new offset
+    if (count > range.nodeCapacity) {
+        freeRange(gpuWorld.freeNodeRanges, range.nodeOffset, range.nodeCapacity);
+        range.nodeCapacity = capacityFor(count);
+        range.nodeOffset = allocRange(gpuWorld.globalNodes, gpuWorld.freeNodeRanges, range.nodeCapacity);
+    }
+    if (wordCount > range.brickCapacity) {
+        freeRange(gpuWorld.freeBrickRanges, range.brickOffset, range.brickCapacity);
+        range.brickCapacity = capacityFor(wordCount);
+        range.brickOffset = allocRange(gpuWorld.globalBrickWords, gpuWorld.freeBrickRanges, range.brickCapacity);
+    }
+
+    range.nodeCount = count;
+    range.brickWordCount = wordCount;
+
+#ifdef BLOK_COMPACT_SVO_NODES
+    if (count > COMPACT_MAX_CHILD || wordCount + COMPACT_BRICK_BIAS > COMPACT_MAX_CHILD)
+        throw std::runtime_error("packChunksToGpuSvo: chunk has too many nodes for 24 bit child pointers");
+#endif
+}
+
+// per storage brick, what the chunk's pending gpu brushes do to it
+static constexpr uint8_t BRUSH_TOUCHES = 1; // in some brush's bounds, gets the brush pass
+static constexpr uint8_t BRUSH_GROWS = 2; // in an adding brush's bounds, may fill up completely
+
+static std::vector<uint8_t> brushedBricks(const ChunkStorage& storage, const std::vector<ChunkBrushOp>& brushes) {
+    const uint32_t perAxis = storage.bricksPerAxis();
+    const uint32_t shift = storage.brickShift();
+    std::vector<uint8_t> out;
+    if (brushes.empty()) return out;
+
+    out.assign(static_cast<size_t>(perAxis) * perAxis * perAxis, 0);
+    for (const ChunkBrushOp& op : brushes) {
+        glm::ivec3 lo, hi;
+        chunkBrushBounds(op, storage.size(), lo, hi);
+        if (lo.x >= hi.x || lo.y >= hi.y || lo.z >= hi.z) continue;
+
+        const uint8_t flags = BRUSH_TOUCHES | (op.mode == Brush::ADD && op.density > 0 ? BRUSH_GROWS : 0);
+        const glm::ivec3 bLo = lo >> static_cast<int>(shift);
+        const glm::ivec3 bHi = (hi - 1) >> static_cast<int>(shift);
+        for (int bz = bLo.z; bz <= bHi.z; ++bz)
+            for (int by = bLo.y; by <= bHi.y; ++by)
+                for (int bx = bLo.x; bx <= bHi.x; ++bx)
+                    out[bx + by * perAxis + bz * perAxis * perAxis] |= flags;
+    }
+    return out;
+}
+
+// what a gpu build of this storage can need at most, from the storage brick table alone:
+// every allocated storage brick is taken to fill all of its svo bricks, levels above are capped at 8^level.
+// bricks an adding brush reaches count as full
+static void gpuBuildCapacity(const ChunkManager& mgr, const ChunkStorage& storage, const std::vector<uint8_t>& brushed,
+                             uint32_t& nodes, uint32_t& words) {
+    const uint32_t sub = 1u << (storage.brickShift() - SVO_BRICK_LEVELS);
+    const uint64_t subBricks = static_cast<uint64_t>(sub) * sub * sub;
+    const uint32_t perAxis = storage.bricksPerAxis();
+    const uint32_t brickVoxels = 1u << (3 * storage.brickShift());
+
+    uint64_t bricks = 0;
+    uint64_t wordCount = 0;
+    for (uint32_t bz = 0; bz < perAxis; ++bz)
+        for (uint32_t by = 0; by < perAxis; ++by)
+            for (uint32_t bx = 0; bx < perAxis; ++bx) {
+                const ChunkStorage::Brick* brick = storage.brick(bx, by, bz);
+                const bool grows = !brushed.empty() && (brushed[bx + by * perAxis + bz * perAxis * perAxis] & BRUSH_GROWS);
+                if (!brick && !grows) continue;
+                bricks += subBricks;
+                wordCount += 2 * subBricks + (grows ? brickVoxels : brick->filled);
+            }
+
+    uint64_t nodeCount = 0;
+    for (uint32_t level = 0; level <= mgr.maxDepth - SVO_BRICK_LEVELS; ++level)
+        nodeCount += std::min<uint64_t>(uint64_t{1} << (3 * level), std::max<uint64_t>(bricks, 1));
+
+    nodes = static_cast<uint32_t>(nodeCount);
+    words = static_cast<uint32_t>(wordCount);
+}
+
+// reserves the chunk's ranges and queues a gpu build from its storage, SvoBuilder writes
+// the nodes, bricks and sub-chunks on the next world update
+static void queueGpuSvoBuild(const ChunkManager& mgr, const Chunk* ch, const ChunkCoord& cc, ChunkGpuRange& range, WorldSvoGpu& gpuWorld) {
+    const ChunkStorage& storage = ch->voxels;
+    const std::vector<uint8_t> brushed = brushedBricks(storage, ch->gpuBrushes);
+
+    uint32_t nodes = 0;
+    uint32_t words = 0;
+    gpuBuildCapacity(mgr, storage, brushed, nodes, words);
+    reserveChunkRange(gpuWorld, range, nodes, words);
+    range.svoVersion = ch->svoVersion;
+    range.packSerial = ++gpuWorld.packSerial;
+    range.gpuBuilt = true;
+
+    // the cpu copy of the slot means nothing now, keep it from looking valid
+    SubChunkGpu* block = gpuWorld.globalSubChunks.data() + static_cast<size_t>(range.slot) * gpuWorld.subChunksPerChunk;
+    for (uint32_t i = 0; i < gpuWorld.subChunksPerChunk; ++i)
+        block[i] = SubChunkGpu{};
+
+    GpuSvoBuildJob job;
+    job.coord = cc;
+    job.maxDepth = mgr.maxDepth;
+    job.voxelSize = mgr.voxelSize;
+    job.storageShift = storage.brickShift();
+    job.brushes = ch->gpuBrushes;
+
+    const uint32_t perAxis = storage.bricksPerAxis();
+    const uint32_t brickVoxels = 1u << (3 * job.storageShift);
+    job.brickTable.assign(static_cast<size_t>(perAxis) * perAxis * perAxis, ChunkStorage::EMPTY_BRICK);
+    job.voxels.reserve(static_cast<size_t>(storage.allocatedBricks()) * brickVoxels);
+
+    uint32_t allocated = 0;
+    for (uint32_t bz = 0; bz < perAxis; ++bz)
+        for (uint32_t by = 0; by < perAxis; ++by)
+            for (uint32_t bx = 0; bx < perAxis; ++bx) {
+                const uint32_t entry = bx + by * perAxis + bz * perAxis * perAxis;
+                const uint8_t flags = brushed.empty() ? 0 : brushed[entry];
+                const ChunkStorage::Brick* brick = storage.brick(bx, by, bz);
+                if (!brick && !(flags & BRUSH_GROWS)) continue;
+
+                job.brickTable[entry] = allocated++;
+                if (flags & BRUSH_TOUCHES) job.brushBricks.push_back(entry);
+
+                // adding brushes get an empty brick to fill
+                if (!brick) {
+                    job.voxels.insert(job.voxels.end(), brickVoxels, 0u);
+                    continue;
+                }
+
+                // material goes along for empty voxels too, a brush keeps it like setDensity does
+                for (uint32_t i = 0; i < brickVoxels; ++i) {
+                    job.voxels.push_back((static_cast<uint32_t>(brick->density[i]) << 24)
+                        | (storage.paletteMaterial(brick->material[i]) & 0xFFFFFFu));
+                }
+            }
+
+    // a newer snapshot replaces one that hasn't been built yet
+    auto queued = std::find_if(gpuWorld.gpuBuilds.begin(), gpuWorld.gpuBuilds.end(),
+        [&](const GpuSvoBuildJob& j) { return j.coord == cc; });
+    if (queued != gpuWorld.gpuBuilds.end()) *queued = std::move(job);
+    else gpuWorld.gpuBuilds.push_back(std::move(job));
+}
+
+// copies what the chunk's svo patches after packedVersion touched into its ranges, returns the nodes written
+static uint32_t uploadSvoPatches(const Chunk* ch, uint32_t packedVersion, const ChunkGpuRange& range, WorldSvoGpu& gpuWorld) {
+    const auto& nodes = ch->svo.nodes;
+    const auto& words = ch->svo.brickWords;
+    uint32_t written = 0;
+    for (const SvoPatch& patch : ch->svoPatches) {
+        if (patch.version <= packedVersion) continue;
+        for (const SvoSpan& s : patch.nodes) {
+            std::transform(nodes.begin() + s.first, nodes.begin() + s.first + s.count,
+                           gpuWorld.globalNodes.begin() + range.nodeOffset + s.first, toGpuSvoNode);
+            gpuWorld.dirtyNodeRanges.push_back({range.nodeOffset + s.first, s.count});
+            written += s.count;
+        }
+        for (const SvoSpan& s : patch.words) {
+            std::copy_n(words.begin() + s.first, s.count, gpuWorld.globalBrickWords.begin() + range.brickOffset + s.first);
+            gpuWorld.dirtyBrickRanges.push_back({range.brickOffset + s.first, s.count});
+        }
+    }
+    return written;
+}
+
+// all air chunks get no slot, blas or node range. gpu built chunks have no cpu tree yet, their voxels tell
+static bool chunkHasVoxels(const Chunk& ch) {
+    if (ch.gpuSvo) return ch.voxels.allocatedBricks() > 0 || !ch.gpuBrushes.empty();
+    return !ch.svo.empty();
+}
+
+void packChunksToGpuSvo(const ChunkManager& mgr, WorldSvoGpu& gpuWorld) {
+    BLOK_PROFILE_NAMED(timer, "packChunksToGpuSvo");
+    // sub-chunk roots have to be nodes, so they can't go below the brick level
+    const uint32_t divisions = mgr.subChunks.divisions;
+    const uint32_t maxDivisions = mgr.C >= SVO_BRICK_SIZE ? mgr.C / SVO_BRICK_SIZE : mgr.C;
+    if (divisions == 0 || (divisions & (divisions - 1)) != 0 || divisions > maxDivisions)
+        throw std::runtime_error("packChunksToGpuSvo: sub-chunk divisions must be a power of two <= C / brick size");
+
+    const uint32_t subChunksPerChunk = divisions * divisions * divisions;
+
+    // first pack (or the sub-chunk layout changed), start from an empty heap
+    if (gpuWorld.subChunksPerChunk != subChunksPerChunk || !(gpuWorld.subChunkLayout == mgr.subChunks) || gpuWorld.dagPacked) {
+        gpuWorld.globalNodes.clear();
+        gpuWorld.globalSubChunks.clear();
+        gpuWorld.chunkRanges.clear();
+        gpuWorld.freeNodeRanges.clear();
+        gpuWorld.globalBrickWords.clear();
+        gpuWorld.freeBrickRanges.clear();
+        gpuWorld.dirtyBrickRanges.clear();
+        gpuWorld.freeSlots.clear();
+        gpuWorld.dirtyNodeRanges.clear();
+        gpuWorld.dirtySubChunkRanges.clear();
+        gpuWorld.gpuBuilds.clear();
+        gpuWorld.subChunksPerChunk = subChunksPerChunk;
+        gpuWorld.subChunkLayout = mgr.subChunks;
+        gpuWorld.dagPacked = false;
+
+        gpuWorld.globalNodes.reserve(1024);
+        gpuWorld.globalSubChunks.reserve(mgr.chunks.size() * subChunksPerChunk);
+    }
+
+    gpuWorld.instanceSets = mgr.instanceSets;
+
+    // drop chunks that went away, became empty or were streamed out
+    for (auto it = gpuWorld.chunkRanges.begin(); it != gpuWorld.chunkRanges.end();) {
+        const Chunk* found = mgr.packedChunk(it->first);
+        if (found && found->resident && chunkHasVoxels(*found)) { ++it; continue; }
+
+        freeRange(gpuWorld.freeNodeRanges, it->second.nodeOffset, it->second.nodeCapacity);
+        freeRange(gpuWorld.freeBrickRanges, it->second.brickOffset, it->second.brickCapacity);
+        clearChunkSlot(gpuWorld, it->second.slot);
+        gpuWorld.freeSlots.push_back(it->second.slot);
+        it = gpuWorld.chunkRanges.erase(it);
+    }
+
+    uint32_t packedChunks = 0;
+    uint32_t gpuBuilds = 0;
+    uint32_t activeSubChunks = 0;
+    uint32_t packedNodes = 0;
+    uint32_t packedBricks = 0;
+    size_t packedBrickWords = 0;
+
+    // full res chunks, and lod chunks standing in for the ones that are missing or not built yet
+    std::vector<std::pair<ChunkCoord, const Chunk*>> packable;
+    packable.reserve(mgr.chunks.size() + mgr.lodChunks.size());
+    for (const ChunkMap* map : {&mgr.chunks, &mgr.lodChunks})
+        for (const auto& kv : *map)
+            if (mgr.packedChunk(kv.first) == kv.second) packable.push_back({kv.first, kv.second});
+
+    for (const auto& kv : packable) {
         const Chunk* ch = kv.second;
         const auto& nodes = ch->svo.nodes;
-        if (nodes.empty()) continue;
+        if (!ch->resident || !chunkHasVoxels(*ch)) continue;
+
+        auto it = gpuWorld.chunkRanges.find(kv.first);
+        const bool isNew = it == gpuWorld.chunkRanges.end();
+        // unchanged since the last pack. versions only count within one lod, the full res and lod chunks keep their own
+        if (!isNew && it->second.svoVersion == ch->svoVersion && it->second.lod == ch->lod) continue;
+
+        if (isNew) {
+            ChunkGpuRange range{};
+            range.origin = glm::vec3(
+                static_cast<float>(ch->cx * static_cast<int32_t>(mgr.C)),
+                static_cast<float>(ch->cy * static_cast<int32_t>(mgr.C)),
+                static_cast<float>(ch->cz * static_cast<int32_t>(mgr.C))
+            ) * mgr.voxelSize;
+
+            if (!gpuWorld.freeSlots.empty()) {
+                range.slot = gpuWorld.freeSlots.back();
+                gpuWorld.freeSlots.pop_back();
+            } else {
+                if (gpuWorld.globalSubChunks.size() + subChunksPerChunk > MAX_PACKED_SUB_CHUNKS)
+                    throw std::runtime_error("packChunksToGpuSvo: more chunk slots than a tlas instance custom index addresses, "
+                                             "lower the view radius or the sub-chunk divisions");
+                range.slot = static_cast<uint32_t>(gpuWorld.globalSubChunks.size() / subChunksPerChunk);
+                gpuWorld.globalSubChunks.resize(gpuWorld.globalSubChunks.size() + subChunksPerChunk);
+            }
+            it = gpuWorld.chunkRanges.emplace(kv.first, range).first;
+        }
 
-        // Chunk's world-space origin
-        glm::vec3 chunkOrigin(
-            static_cast<float>(ch->cx * static_cast<int32_t>(mgr.C)),
-            static_cast<float>(ch->cy * static_cast<int32_t>(mgr.C)),
-            static_cast<float>(ch->cz * static_cast<int32_t>(mgr.C))
-        );
-        chunkOrigin *= mgr.voxelSize;
+        ChunkGpuRange& range = it->second;
 
-        float chunkWorldSize = static_cast<float>(mgr.C) * mgr.voxelSize;
-        float subChunkWorldSize = chunkWorldSize / static_cast<float>(SUB_CHUNK_DIVISIONS);
+        // another tree took the coord over, whatever was derived from the old one's voxels goes with it.
+        // buildEmptySpaceField drops lod chunks' fields itself
+        const bool lodChanged = !isNew && range.lod != ch->lod;
+        if (lodChanged) {
+            gpuWorld.chunkSurfaces.erase(kv.first);
+            gpuWorld.chunkLights.erase(kv.first);
+        }
+        range.lod = ch->lod;
 
-        // Iterate over all sub-chunk positions
-        for (uint32_t sz = 0; sz < SUB_CHUNK_DIVISIONS; sz++) {
-            for (uint32_t sy = 0; sy < SUB_CHUNK_DIVISIONS; sy++) {
-                for (uint32_t sx = 0; sx < SUB_CHUNK_DIVISIONS; sx++) {
-                    totalSubChunks++;
+        if (ch->gpuSvo) {
+            queueGpuSvoBuild(mgr, ch, kv.first, range, gpuWorld);
+            packedChunks++;
+            gpuBuilds++;
+            continue;
+        }
 
-                    // Check if this sub-chunk has any geometry
-                    if (!subChunkHasGeometry(nodes, sx, sy, sz, SUB_CHUNK_DIVISIONS, mgr.maxDepth)) {
-                        emptySubChunks++;
-                        continue;  // Skip empty sub-chunks
-                    }
+        const auto count = static_cast<uint32_t>(nodes.size());
+        const auto& words = ch->svo.brickWords;
+        const auto wordCount = static_cast<uint32_t>(words.size());
+
+        // only patched since the last pack and still fits where it is, just the patched spans go up
+        const uint32_t packedVersion = range.svoVersion;
+        const bool patched = !isNew && !lodChanged && !range.gpuBuilt && !ch->svoPatches.empty()
+            && ch->svoPatches.front().version <= packedVersion + 1 && ch->svoPatches.back().version == ch->svoVersion
+            && count <= range.nodeCapacity && wordCount <= range.brickCapacity;
+
+        reserveChunkRange(gpuWorld, range, count, wordCount);
+        range.svoVersion = ch->svoVersion;
+        range.packSerial = ++gpuWorld.packSerial;
+        range.gpuBuilt = false;
+        if (patched) {
+            packedNodes += uploadSvoPatches(ch, packedVersion, range, gpuWorld);
+        } else {
+            // the full size node is the gpu one unless BLOK_COMPACT_SVO_NODES, then it's a plain copy
+            if constexpr (std::is_same_v<GpuSvoNode, SvoNode>)
+                std::memcpy(gpuWorld.globalNodes.data() + range.nodeOffset, nodes.data(), count * sizeof(SvoNode));
+            else
+                std::transform(nodes.begin(), nodes.end(), gpuWorld.globalNodes.begin() + range.nodeOffset, toGpuSvoNode);
+            gpuWorld.dirtyNodeRanges.push_back({range.nodeOffset, count});
+
+            if (wordCount > 0) {
+                std::copy(words.begin(), words.end(), gpuWorld.globalBrickWords.begin() + range.brickOffset);
+                gpuWorld.dirtyBrickRanges.push_back({range.brickOffset, wordCount});
+            }
+            packedNodes += count;
+        }
 
-                    // Find the root node for this sub-chunk
-                    uint32_t subRootNode = findSubChunkRootNode(
-                        nodes, sx, sy, sz, SUB_CHUNK_DIVISIONS, mgr.maxDepth
-                    );
+        // sub-chunk nodeCount is the whole chunk's, a patch that grew it touches every slot anyway
+        activeSubChunks += writeChunkSubChunks(mgr, ch, range, gpuWorld);
+        gpuWorld.dirtySubChunkRanges.push_back({range.slot * subChunksPerChunk, subChunksPerChunk});
 
-                    // Calculate world-space bounds
-                    glm::vec3 subMin = chunkOrigin + glm::vec3(
-                        static_cast<float>(sx) * subChunkWorldSize,
-                        static_cast<float>(sy) * subChunkWorldSize,
-                        static_cast<float>(sz) * subChunkWorldSize
-                    );
-                    glm::vec3 subMax = subMin + glm::vec3(subChunkWorldSize);
-
-                    // Create sub-chunk entry
-                    SubChunkGpu sub{};
-                    sub.nodeOffset = nodeOffset;
-                    sub.rootNodeIndex = subRootNode;
-                    sub.nodeCount = static_cast<uint32_t>(nodes.size());
-                    sub.startDepth = subChunkDepth;
-                    sub.worldMin = subMin;
-                    sub.subChunkSize = subChunkWorldSize;
-                    sub.worldMax = subMax;
-
-                    gpuWorld.globalSubChunks.push_back(sub);
+        packedChunks++;
+        packedBricks += ch->svo.brickCount;
+        packedBrickWords += wordCount;
+    }
+
+    gatherEmissiveLights(mgr, gpuWorld);
+    buildSurfaceMesh(mgr, gpuWorld);
+    buildEmptySpaceField(mgr, gpuWorld);
+
+    if (packedChunks == 0) return;
+
+    // every streaming update repacks, the numbers go to the profiler instead of stdout
+    BLOK_PROFILE_DETAIL(timer, std::to_string(packedChunks) + " chunks repacked (" + std::to_string(gpuBuilds) + " gpu builds), "
+        + std::to_string(activeSubChunks) + " active sub-chunks, " + std::to_string(packedNodes) + " nodes written, "
+        + std::to_string(packedBricks) + " bricks (" + std::to_string(packedBrickWords * sizeof(uint32_t)) + " bytes), "
+        + std::to_string(gpuWorld.globalNodes.size()) + " nodes total (" + std::to_string(gpuWorld.freeNodeRanges.size())
+        + " free ranges), " + std::to_string(gpuWorld.globalBrickWords.size()) + " brick words ("
+        + std::to_string(gpuWorld.freeBrickRanges.size()) + " free ranges)");
+}
+
+static size_t chunkCpuBytes(const Chunk* ch) {
+    return ch->voxels.memoryBytes() + ch->svo.nodes.capacity() * sizeof(SvoNode)
+         + ch->svo.brickWords.capacity() * sizeof(uint32_t);
+}
+
+// what packing this chunk costs, matches the packer's node + brick ranges + sub-chunk slot
+static size_t chunkGpuBytes(const ChunkManager& mgr, const Chunk* ch) {
+    const uint32_t d = mgr.subChunks.divisions;
+    const size_t subChunksPerChunk = static_cast<size_t>(d) * d * d;
+    auto count = static_cast<uint32_t>(ch->svo.nodes.size());
+    auto words = static_cast<uint32_t>(ch->svo.brickWords.size());
+    if (ch->gpuSvo) gpuBuildCapacity(mgr, ch->voxels, brushedBricks(ch->voxels, ch->gpuBrushes), count, words);
+    return static_cast<size_t>(capacityFor(count)) * sizeof(GpuSvoNode)
+         + static_cast<size_t>(capacityFor(words)) * sizeof(uint32_t)
+         + subChunksPerChunk * sizeof(SubChunkGpu);
+}
+
+static int64_t chunkDistSq(const ChunkCoord& a, const ChunkCoord& b) {
+    const int64_t dx = a.x - b.x;
+    const int64_t dy = a.y - b.y;
+    const int64_t dz = a.z - b.z;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// the lod streaming wants at squared chunk distance d2, 0 is full res. level boundaries sit at lodRadius, then at every
+// doubling of it. a coord held at cur only goes coarser once it's hysteresis chunks past a boundary
+static uint32_t wantedChunkLod(const StreamingSettings& s, uint32_t maxLod, int64_t d2, uint32_t cur) {
+    const int64_t hysteresis = std::max(s.hysteresis, 0);
+    int64_t edge = std::max(s.lodRadius, 1);
+    uint32_t lod = 0;
+    for (; lod < maxLod; ++lod, edge *= 2) {
+        const int64_t r = lod < cur ? edge : edge + hysteresis;
+        if (d2 <= r * r) break;
+    }
+    return lod;
+}
+
+bool updateChunkResidency(ChunkManager& mgr, const glm::vec3& center) {
+    const StreamingSettings& s = mgr.streaming;
+    if (!s.enabled) return false;
+    BLOK_PROFILE_NAMED(timer, "updateChunkResidency");
+
+    const ChunkCoord cc = mgr.globalVoxelToChunk(mgr.worldToGlobalVoxel(center));
+    const int r = std::max(s.viewRadius, 0);
+    const int64_t loadR2 = static_cast<int64_t>(r) * r;
+    const int64_t keepR = r + std::max(s.hysteresis, 0);
+    const int64_t keepR2 = keepR * keepR;
+
+    // the pooled svo arrays count against the budget too, they're the first thing to go over it
+    size_t cpuBytes = mgr.svoPool.bytes();
+    for (auto& kv : mgr.chunks) cpuBytes += chunkCpuBytes(kv.second);
+    for (auto& kv : mgr.lodChunks) cpuBytes += chunkCpuBytes(kv.second);
+    if (cpuBytes > s.cpuBudgetBytes) cpuBytes -= mgr.svoPool.trim(0);
+
+    // forget known empty coords once they're out of range so the set doesn't grow forever
+    for (auto it = mgr.emptyChunks.begin(); it != mgr.emptyChunks.end();) {
+        if (chunkDistSq(*it, cc) > keepR2) it = mgr.emptyChunks.erase(it);
+        else ++it;
+    }
+
+    // finished background reads. a chunk that got created meanwhile (an edit) keeps what it has
+    int loaded = 0;
+    const bool canLoad = mgr.loader || static_cast<bool>(mgr.asyncLoader);
+    // lod chunks only make sense when the full res ones can come back
+    const uint32_t maxLod = canLoad ? mgr.maxChunkLod() : 0;
+    int lodChanged = 0;
+    if (mgr.asyncLoader) {
+        std::vector<LoadedChunk> finished;
+        mgr.asyncLoader.collect(finished);
+        for (LoadedChunk& l : finished) {
+            mgr.pendingLoads.erase(l.coord);
+            if (mgr.chunks.count(l.coord)) continue;
+            if (l.lod > 0) {
+                // an empty result still becomes a (tiny) lod chunk, the coord may have voxels at full res
+                if (l.lod > maxLod) continue;
+                const uint32_t lodC = mgr.C >> l.lod;
+                Chunk* ch = mgr.setLodChunk(l.coord, l.lod, l.voxels && l.voxels->size() == lodC ? std::move(*l.voxels) : ChunkStorage(lodC));
+                cpuBytes += chunkCpuBytes(ch);
+                lodChanged++;
+                continue;
+            }
+            if (!l.voxels || l.voxels->size() != mgr.C || l.voxels->allocatedBricks() == 0) {
+                mgr.emptyChunks.insert(l.coord);
+                continue;
+            }
+
+            Chunk* ch = mgr.getOrCreateChunk(l.coord);
+            ch->voxels = std::move(*l.voxels);
+            ch->savedEdits = ch->voxels.editCount();
+            ch->dirty = true;
+            cpuBytes += chunkCpuBytes(ch);
+            loaded++;
+        }
+    }
+
+    // load missing chunks in range, nearest first, a few per update. a coord whose lod chunk is as fine as
+    // its distance wants isn't missing
+    if (canLoad) {
+        struct Missing {
+            int64_t d2;
+            ChunkCoord coord;
+            uint32_t lod;
+        };
+        std::vector<Missing> missing;
+        for (int dz = -r; dz <= r; ++dz)
+            for (int dy = -r; dy <= r; ++dy)
+                for (int dx = -r; dx <= r; ++dx) {
+                    const ChunkCoord c{cc.x + dx, cc.y + dy, cc.z + dz};
+                    const int64_t d2 = chunkDistSq(c, cc);
+                    if (d2 > loadR2) continue;
+                    if (mgr.chunks.count(c) || mgr.emptyChunks.count(c) || mgr.pendingLoads.count(c)) continue;
+
+                    uint32_t lod = 0;
+                    if (maxLod > 0) {
+                        auto held = mgr.lodChunks.find(c);
+                        const uint32_t cur = held != mgr.lodChunks.end() ? held->second->lod : maxLod;
+                        lod = wantedChunkLod(s, maxLod, d2, cur);
+                        if (held != mgr.lodChunks.end() && lod > 0 && held->second->lod <= lod) continue;
+                    }
+                    missing.push_back({d2, c, lod});
                 }
+
+        std::sort(missing.begin(), missing.end(),
+            [](const Missing& a, const Missing& b) { return a.d2 < b.d2; });
+
+        // async requests count against the same per-update limit, in flight ones included
+        int requested = static_cast<int>(mgr.pendingLoads.size());
+        for (const Missing& m : missing) {
+            if (cpuBytes >= s.cpuBudgetBytes) break;
+
+            // without requestLod the full res chunk comes in and is downsampled below
+            if (mgr.asyncLoader) {
+                if (requested >= s.maxLoadsPerUpdate) break;
+                if (m.lod > 0 && mgr.asyncLoader.requestLod) mgr.asyncLoader.requestLod(m.coord, m.lod);
+                else mgr.asyncLoader.request(m.coord);
+                mgr.pendingLoads.insert(m.coord);
+                requested++;
+                continue;
+            }
+
+            if (loaded >= s.maxLoadsPerUpdate) break;
+            Chunk* ch = mgr.getOrCreateChunk(m.coord);
+            loaded++;
+
+            if (!mgr.loader(*ch)) {
+                mgr.releaseChunk(ch);
+                mgr.emptyChunks.insert(m.coord);
+                continue;
             }
+
+            ch->savedEdits = ch->voxels.editCount();
+            ch->dirty = true;
+            cpuBytes += chunkCpuBytes(ch);
         }
+    }
 
-        // Append this chunk's nodes to global array
-        gpuWorld.globalNodes.insert(gpuWorld.globalNodes.end(), nodes.begin(), nodes.end());
-        nodeOffset += static_cast<uint32_t>(nodes.size());
+    // lod chunks out of range or past maxLod (all of them once it's off), and the ones whose full res chunk
+    // is built and can take over
+    std::vector<Chunk*> staleLods;
+    for (auto& kv : mgr.lodChunks) {
+        auto full = mgr.chunks.find(kv.first);
+        const bool replaced = full != mgr.chunks.end() && !full->second->dirty && !full->second->rebuilding;
+        if (replaced || chunkDistSq(kv.first, cc) > keepR2 || kv.second->lod > maxLod) staleLods.push_back(kv.second);
+    }
+    for (Chunk* ch : staleLods) {
+        cpuBytes -= chunkCpuBytes(ch);
+        mgr.releaseLodChunk(ch);
+        lodChanged++;
     }
 
-    std::cout << "Sub-chunk packing: " << gpuWorld.globalSubChunks.size()
-              << " active sub-chunks out of " << totalSubChunks
-              << " total (" << emptySubChunks << " culled)\n";
-    std::cout << "Total SVO nodes: " << gpuWorld.globalNodes.size() << "\n";
+    if (maxLod > 0) {
+
+        // full res chunks past lodRadius are swapped for a downsampled copy, lod chunks for a coarser one.
+        // edits are saved first, a chunk with edits and nowhere to save them stays as it is.
+        // lod chunks go first, a full res chunk after them may replace the one at its coord
+        std::vector<std::pair<ChunkCoord, Chunk*>> coarsen;
+        for (const ChunkMap* map : {&mgr.lodChunks, &mgr.chunks})
+            for (const auto& kv : *map) {
+                Chunk* ch = kv.second;
+                const int64_t d2 = chunkDistSq(kv.first, cc);
+                if (d2 > keepR2 || ch->rebuilding || wantedChunkLod(s, maxLod, d2, ch->lod) <= ch->lod) continue;
+                if (ch->lod == 0 && ch->editedSinceSave() && !mgr.saver) continue;
+                coarsen.push_back({kv.first, ch});
+            }
+
+        int built = 0;
+        for (auto& [coord, ch] : coarsen) {
+            if (built >= s.maxLoadsPerUpdate) break;
+            const uint32_t lod = wantedChunkLod(s, maxLod, chunkDistSq(coord, cc), ch->lod);
+
+            // a full res chunk loaded back in while its lod chunk was still around just goes, if that one's fine enough
+            auto held = mgr.lodChunks.find(coord);
+            const bool keepHeld = ch->lod == 0 && held != mgr.lodChunks.end() && held->second->lod <= lod;
+
+            if (ch->lod == 0) flushGpuBrushes(*ch);
+            std::optional<ChunkStorage> coarse;
+            if (!keepHeld) {
+                coarse = ch->voxels;
+                for (uint32_t l = ch->lod; l < lod; ++l) coarse = downsampleChunkStorage(*coarse);
+            }
+
+            cpuBytes -= chunkCpuBytes(ch);
+            if (ch->lod == 0) {
+                if (mgr.saver && ch->editedSinceSave()) mgr.saver(*ch);
+                mgr.releaseChunk(ch);
+            }
+            // replaces ch when it's a lod chunk
+            if (coarse) cpuBytes += chunkCpuBytes(mgr.setLodChunk(coord, lod, std::move(*coarse)));
+            built++;
+            lodChanged++;
+        }
+
+        // the coarse trees are small, they're built right here
+        std::vector<Chunk*> dirtyLods;
+        for (auto& kv : mgr.lodChunks)
+            if (kv.second->dirty) dirtyLods.push_back(kv.second);
+        if (!dirtyLods.empty()) {
+            JobSystem& jobs = mgr.jobSystem();
+            JobCounter counter;
+            const bool bakeAo = mgr.bakeAmbientOcclusion;
+            for (Chunk* ch : dirtyLods) {
+                ch->dirty = false;
+                jobs.submit([ch, bakeAo] {
+                    BLOK_PROFILE_SCOPE("rebuildLodChunk");
+                    buildSvoFromDensity(ch, ch->voxels.size(), bakeAo);
+                }, &counter);
+            }
+            jobs.wait(counter);
+        }
+    }
+
+    // rank everything by distance, the nearest chunks get the gpu budget. lod chunks compete for it like the rest
+    std::vector<std::pair<int64_t, Chunk*>> ranked;
+    ranked.reserve(mgr.chunks.size() + mgr.lodChunks.size());
+    for (auto& kv : mgr.chunks)
+        ranked.push_back({chunkDistSq(kv.first, cc), kv.second});
+    for (auto& kv : mgr.lodChunks)
+        ranked.push_back({chunkDistSq(kv.first, cc), kv.second});
+    std::sort(ranked.begin(), ranked.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    // whichever is smaller, the fixed budget or what's left on the device
+    const size_t gpuBudget = std::min(s.gpuBudgetBytes, s.deviceBudgetBytes);
+    bool changed = false;
+    bool budgetFull = false;
+    size_t gpuBytes = 0;
+    uint32_t residentCount = 0;
+    for (auto& [d2, ch] : ranked) {
+        bool want = !budgetFull && d2 <= (ch->resident ? keepR2 : loadR2);
+
+        // hard budget, once a chunk doesn't fit nothing farther away gets in either
+        if (want) {
+            const size_t bytes = chunkHasVoxels(*ch) ? chunkGpuBytes(mgr, ch) : 0;
+            if (gpuBytes + bytes > gpuBudget) {
+                budgetFull = true;
+                want = false;
+            } else {
+                gpuBytes += bytes;
+            }
+        }
+
+        if (want) residentCount++;
+        if (want != ch->resident) {
+            ch->resident = want;
+            changed = true;
+        }
+    }
+
+    // cpu eviction, farthest first. only when a loader can bring chunks back
+    int evicted = 0;
+    if (canLoad && cpuBytes > s.cpuBudgetBytes) {
+        for (auto it = ranked.rbegin(); it != ranked.rend() && cpuBytes > s.cpuBudgetBytes; ++it) {
+            Chunk* ch = it->second;
+            if (ch->resident || ch->rebuilding) continue; // async rebuilds hold a pointer to it
+
+            if (ch->lod > 0) {
+                cpuBytes -= chunkCpuBytes(ch);
+                mgr.releaseLodChunk(ch);
+                evicted++;
+                changed = true;
+                continue;
+            }
+
+            flushGpuBrushes(*ch);
+            if (mgr.saver && ch->editedSinceSave()) mgr.saver(*ch);
+
+            cpuBytes -= chunkCpuBytes(ch);
+            mgr.releaseChunk(ch);
+            evicted++;
+            changed = true;
+        }
+
+        // the evicted trees went to the pool, it keeps only what still fits under the budget
+        mgr.svoPool.trim(cpuBytes < s.cpuBudgetBytes ? s.cpuBudgetBytes - cpuBytes : 0);
+        cpuBytes += mgr.svoPool.bytes();
+    }
+
+    // a lod chunk swapped in or out changes what's packed even when residency didn't
+    if (lodChanged > 0) changed = true;
+
+    if (changed || loaded > 0) {
+        BLOK_PROFILE_DETAIL(timer, std::to_string(residentCount) + " resident chunks (" + std::to_string(gpuBytes >> 20)
+            + " MB gpu), " + std::to_string(loaded) + " loaded, " + std::to_string(evicted) + " evicted, "
+            + std::to_string(mgr.lodChunks.size()) + " lod chunks (" + std::to_string(cpuBytes >> 20) + " MB cpu)");
+    }
+
+    return changed;
+}
+
+size_t saveEditedChunks(ChunkManager& mgr) {
+    if (!mgr.saver) return 0;
+
+    size_t saved = 0;
+    for (auto& kv : mgr.chunks) {
+        Chunk* ch = kv.second;
+        if (!ch->editedSinceSave()) continue;
+
+        flushGpuBrushes(*ch);
+        mgr.saver(*ch);
+        ch->savedEdits = ch->voxels.editCount();
+        saved++;
+    }
+    return saved;
 }
 
 void ChunkManager::setVoxelMaterial(const glm::vec3& worldPos, uint32_t materialId, float density) {
@@ -319,12 +1431,177 @@ void ChunkManager::setVoxelMaterial(const glm::vec3& worldPos, uint32_t material
     glm::ivec3 lv = globalVoxelToLocal(gv, cc);
 
     Chunk* ch = getOrCreateChunk(cc);
+    if (!ch->gpuBrushes.empty()) flushGpuBrushes(*ch); // keeps edits in order
+    recordEdit(*ch);
+
+    ch->voxels.set(lv.x, lv.y, lv.z, materialId, density);
+
+    patchOrMarkDirty(ch, lv);
+}
+
+void ChunkManager::writeVoxels(std::span<const VoxelWrite> writes) {
+    if (writes.empty()) return;
+
+    // sort key per write: its chunk, then its storage brick (8^3, see ChunkStorage) inside the chunk
+    struct Binned {
+        ChunkCoord cc;
+        uint32_t brick;
+        uint32_t index;
+    };
+    const uint32_t brickShift = std::min(ChunkStorage::MAX_BRICK_SHIFT, maxDepth);
+    const uint32_t bricksPerAxis = C >> brickShift;
+
+    std::vector<Binned> binned(writes.size());
+    for (size_t i = 0; i < writes.size(); ++i) {
+        const ChunkCoord cc = globalVoxelToChunk(writes[i].voxel);
+        const glm::ivec3 lv = globalVoxelToLocal(writes[i].voxel, cc);
+        const uint32_t bx = static_cast<uint32_t>(lv.x) >> brickShift;
+        const uint32_t by = static_cast<uint32_t>(lv.y) >> brickShift;
+        const uint32_t bz = static_cast<uint32_t>(lv.z) >> brickShift;
+        binned[i] = {cc, bx + by * bricksPerAxis + bz * bricksPerAxis * bricksPerAxis, static_cast<uint32_t>(i)};
+    }
+
+    // stable, later writes to the same voxel still win
+    std::stable_sort(binned.begin(), binned.end(), [](const Binned& a, const Binned& b) {
+        if (a.cc.x != b.cc.x) return a.cc.x < b.cc.x;
+        if (a.cc.y != b.cc.y) return a.cc.y < b.cc.y;
+        if (a.cc.z != b.cc.z) return a.cc.z < b.cc.z;
+        return a.brick < b.brick;
+    });
+
+    // chunks are created (map insert) up front on this thread, then every chunk's run is written on its own
+    struct ChunkRun {
+        Chunk* chunk;
+        size_t first, last;
+    };
+    std::vector<ChunkRun> runs;
+    for (size_t first = 0; first < binned.size();) {
+        const ChunkCoord cc = binned[first].cc;
+        size_t last = first;
+        while (last < binned.size() && binned[last].cc == cc) last++;
+
+        Chunk* ch = getOrCreateChunk(cc);
+        if (!ch->gpuBrushes.empty()) flushGpuBrushes(*ch);
+        recordEdit(*ch);
+        runs.push_back({ch, first, last});
+
+        first = last;
+    }
+
+    auto writeRun = [&](const ChunkRun& run) {
+        Chunk* ch = run.chunk;
+        const glm::ivec3 base(ch->cx * static_cast<int32_t>(C), ch->cy * static_cast<int32_t>(C), ch->cz * static_cast<int32_t>(C));
+        std::vector<ChunkStorage::Write> batch;
+        batch.reserve(run.last - run.first);
+        for (size_t i = run.first; i < run.last; ++i) {
+            const VoxelWrite& w = writes[binned[i].index];
+            batch.push_back({static_cast<uint32_t>(w.voxel.x - base.x), static_cast<uint32_t>(w.voxel.y - base.y),
+                             static_cast<uint32_t>(w.voxel.z - base.z), w.materialId, w.density});
+        }
+        ch->voxels.set(batch.data(), batch.size());
+        ch->dirty = true;
+    };
+
+    // small edits (brushes, single voxels) aren't worth waking the workers for
+    if (runs.size() == 1 || writes.size() < 4096) {
+        for (const ChunkRun& run : runs) writeRun(run);
+        return;
+    }
+    JobSystem& pool = jobSystem();
+    JobCounter counter;
+    for (const ChunkRun& run : runs) pool.submit([&writeRun, &run] { writeRun(run); }, &counter);
+    pool.wait(counter);
+}
+
+void ChunkManager::forEachChunkInRegion(const glm::ivec3& minGV, const glm::ivec3& maxGV, bool create, const RegionFn& fn) {
+    if (minGV.x >= maxGV.x || minGV.y >= maxGV.y || minGV.z >= maxGV.z) return;
+
+    const auto size = static_cast<int32_t>(C);
+    const ChunkCoord lo = globalVoxelToChunk(minGV);
+    const ChunkCoord hi = globalVoxelToChunk(glm::ivec3(maxGV.x - 1, maxGV.y - 1, maxGV.z - 1));
+
+    for (int32_t cz = lo.z; cz <= hi.z; cz++)
+    for (int32_t cy = lo.y; cy <= hi.y; cy++)
+    for (int32_t cx = lo.x; cx <= hi.x; cx++) {
+        const ChunkCoord cc{cx, cy, cz};
+        Chunk* ch = nullptr;
+        if (create) {
+            ch = getOrCreateChunk(cc);
+        } else {
+            auto it = chunks.find(cc);
+            if (it == chunks.end()) continue;
+            ch = it->second;
+        }
+        if (!ch->gpuBrushes.empty()) flushGpuBrushes(*ch);
+        recordEdit(*ch);
 
-    size_t idx = localIndex(lv.x, lv.y, lv.z);
-    ch->density[idx] = density;
-    ch->materialIds[idx] = materialId;
+        const glm::ivec3 base(cx * size, cy * size, cz * size);
+        const glm::ivec3 l(std::max(minGV.x - base.x, 0), std::max(minGV.y - base.y, 0), std::max(minGV.z - base.z, 0));
+        const glm::ivec3 h(std::min(maxGV.x - base.x, size), std::min(maxGV.y - base.y, size), std::min(maxGV.z - base.z, size));
+        fn(*ch, l, h);
+    }
+}
+
+void ChunkManager::beginEdit() {
+    editDepth++;
+}
+
+void ChunkManager::endEdit() {
+    if (editDepth == 0 || --editDepth > 0) return;
+
+    // chunks the step only looked at (a brush box corner, say) still share everything with their snapshot
+    std::erase_if(openEdit.chunks, [&](const ChunkSnapshot& s) {
+        auto it = chunks.find(s.coord);
+        return it != chunks.end() && it->second->voxels.sharesContent(s.voxels)
+            && it->second->gpuBrushes.size() == s.gpuBrushes.size();
+    });
+    if (openEdit.chunks.empty()) return;
+
+    undoSteps.push_back(std::move(openEdit));
+    openEdit = {};
+    redoSteps.clear();
+    if (undoSteps.size() > maxUndoSteps)
+        undoSteps.erase(undoSteps.begin(), undoSteps.begin() + static_cast<ptrdiff_t>(undoSteps.size() - maxUndoSteps));
+}
+
+void ChunkManager::recordEdit(const Chunk& ch) {
+    if (editDepth == 0) return;
+
+    const ChunkCoord cc{ch.cx, ch.cy, ch.cz};
+    for (const ChunkSnapshot& s : openEdit.chunks)
+        if (s.coord == cc) return;
+    openEdit.chunks.push_back({cc, ch.voxels, ch.gpuBrushes});
+}
+
+// puts step's snapshots back and leaves what they replaced in step, so the same call goes the other way
+static void swapEditStep(ChunkManager& mgr, EditStep& step) {
+    for (ChunkSnapshot& s : step.chunks) {
+        // streaming may have dropped the chunk since, it comes back with the snapshot and gets saved again
+        Chunk* ch = mgr.getOrCreateChunk(s.coord);
+        ChunkStorage current = ch->voxels;
+        ch->voxels.restore(s.voxels);
+        s.voxels = std::move(current);
+        std::swap(ch->gpuBrushes, s.gpuBrushes);
+        ch->dirty = true;
+    }
+}
+
+bool ChunkManager::undo() {
+    if (undoSteps.empty() || editDepth > 0) return false;
+    EditStep step = std::move(undoSteps.back());
+    undoSteps.pop_back();
+    swapEditStep(*this, step);
+    redoSteps.push_back(std::move(step));
+    return true;
+}
 
-    ch->dirty = true;
+bool ChunkManager::redo() {
+    if (redoSteps.empty() || editDepth > 0) return false;
+    EditStep step = std::move(redoSteps.back());
+    redoSteps.pop_back();
+    swapEditStep(*this, step);
+    undoSteps.push_back(std::move(step));
+    return true;
 }
 
 uint32_t ChunkManager::getVoxelMaterial(const glm::vec3& worldPos) const {
@@ -337,14 +1614,13 @@ uint32_t ChunkManager::getVoxelMaterial(const glm::vec3& worldPos) const {
     }
 
     glm::ivec3 lv = globalVoxelToLocal(gv, cc);
-    size_t idx = localIndex(lv.x, lv.y, lv.z);
 
     const Chunk* ch = it->second;
-    if (ch->density[idx] <= 0.0f) {
+    if (ch->voxels.density(lv.x, lv.y, lv.z) <= 0.0f) {
         return 0; // Empty
     }
 
-    return ch->materialIds[idx];
+    return ch->voxels.material(lv.x, lv.y, lv.z);
 }
 
 }
@@ -0,0 +1,256 @@
+/*
+* File: chunk_replication.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "chunk_replication.hpp"
+
+#include <algorithm>
+
+#include "brush.hpp"
+#include "cpu_profiler.hpp"
+
+namespace blok {
+
+// LEB128, most of what goes out (gaps, run lengths, small coords) fits a byte
+static void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80u) {
+        out.push_back(static_cast<uint8_t>(v | 0x80u));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        if (p == end) return false;
+        const uint8_t b = *p++;
+        v |= static_cast<uint64_t>(b & 0x7Fu) << shift;
+        if (!(b & 0x80u)) return true;
+    }
+    return false;
+}
+
+static bool getVarint32(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    uint64_t wide = 0;
+    if (!getVarint(p, end, wide) || wide > 0xFFFFFFFFu) return false;
+    v = static_cast<uint32_t>(wide);
+    return true;
+}
+
+// zigzag, chunk coords go negative
+static void putSigned(std::vector<uint8_t>& out, int32_t v) {
+    putVarint(out, (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31));
+}
+
+static bool getSigned(const uint8_t*& p, const uint8_t* end, int32_t& v) {
+    uint32_t u = 0;
+    if (!getVarint32(p, end, u)) return false;
+    v = static_cast<int32_t>((u >> 1) ^ (0u - (u & 1u)));
+    return true;
+}
+
+// same voxel value as the region files: density << 24 | material, 0 for every empty voxel
+static uint32_t voxelValue(const ChunkStorage& voxels, const ChunkStorage::Brick* b, uint32_t i) {
+    if (!b || b->density[i] == 0) return 0u;
+    return (static_cast<uint32_t>(b->density[i]) << 24) | (voxels.paletteMaterial(b->material[i]) & 0xFFFFFFu);
+}
+
+uint64_t ChunkReplicator::syncedEdits(const Chunk& ch) const {
+    auto it = m_synced.find(ChunkCoord{ch.cx, ch.cy, ch.cz});
+    // never sent, or dropped and loaded again since: what it was loaded with is what the peers have too
+    if (it == m_synced.end() || it->second > ch.voxels.editCount()) return ch.savedEdits;
+    return it->second;
+}
+
+void ChunkReplicator::markAllSynced() {
+    for (const auto& kv : m_mgr.chunks) m_synced[kv.first] = kv.second->voxels.editCount();
+}
+
+bool ChunkReplicator::collect(std::vector<uint8_t>& out) {
+    BLOK_PROFILE_SCOPE("ChunkReplicator::collect");
+    const uint32_t shift = std::min(ChunkStorage::MAX_BRICK_SHIFT, m_mgr.maxDepth);
+    const uint32_t brickVoxels = 1u << (3 * shift);
+    const uint32_t bpa = m_mgr.C >> shift;
+
+    // C, brick shift, chunk count, then per chunk: coord, brick count, per brick: gap to the previous brick index,
+    // run count, (value, length) runs in the brick's voxel order
+    std::vector<uint8_t> body;
+    std::vector<uint32_t> bricks;
+    std::vector<uint32_t> runs;
+    uint32_t chunks = 0;
+    uint64_t brickTotal = 0;
+    for (const auto& kv : m_mgr.chunks) {
+        Chunk& ch = *kv.second;
+        if (!ch.gpuBrushes.empty()) flushGpuBrushes(ch);
+
+        const uint64_t edits = ch.voxels.editCount();
+        const uint64_t synced = syncedEdits(ch);
+        if (edits == synced) continue;
+        m_synced[kv.first] = edits;
+
+        bricks.clear();
+        ch.voxels.changedBricks(synced, bricks);
+        if (bricks.empty()) continue;
+
+        putSigned(body, kv.first.x);
+        putSigned(body, kv.first.y);
+        putSigned(body, kv.first.z);
+        putVarint(body, bricks.size());
+        uint32_t next = 0;
+        for (uint32_t table : bricks) {
+            putVarint(body, table - next);
+            next = table + 1;
+
+            const ChunkStorage::Brick* b = ch.voxels.brick(table % bpa, (table / bpa) % bpa, table / (bpa * bpa));
+            runs.clear();
+            uint32_t value = voxelValue(ch.voxels, b, 0), length = 1;
+            for (uint32_t i = 1; i < brickVoxels; i++) {
+                const uint32_t v = voxelValue(ch.voxels, b, i);
+                if (v == value) { length++; continue; }
+                runs.push_back(value);
+                runs.push_back(length);
+                value = v;
+                length = 1;
+            }
+            runs.push_back(value);
+            runs.push_back(length);
+
+            putVarint(body, runs.size() / 2);
+            for (uint32_t r : runs) putVarint(body, r);
+        }
+        chunks++;
+        brickTotal += bricks.size();
+    }
+    if (chunks == 0) return false;
+
+    out.clear();
+    putVarint(out, REPLICATION_VERSION);
+    putVarint(out, m_mgr.C);
+    putVarint(out, shift);
+    putVarint(out, chunks);
+    out.insert(out.end(), body.begin(), body.end());
+
+    m_stats.sentBytes += out.size();
+    m_stats.sentBricks += brickTotal;
+    return true;
+}
+
+bool ChunkReplicator::apply(const uint8_t* data, size_t size) {
+    BLOK_PROFILE_SCOPE("ChunkReplicator::apply");
+    const uint32_t shift = std::min(ChunkStorage::MAX_BRICK_SHIFT, m_mgr.maxDepth);
+    const uint32_t B = 1u << shift;
+    const uint32_t brickVoxels = 1u << (3 * shift);
+    const uint32_t bpa = m_mgr.C >> shift;
+
+    // decoded whole before anything is written, a corrupt message leaves the world alone
+    struct DecodedChunk {
+        ChunkCoord coord;
+        std::vector<uint32_t> bricks;
+        std::vector<uint32_t> values; // brickVoxels per brick
+    };
+    std::vector<DecodedChunk> decoded;
+    auto reject = [&] {
+        m_stats.rejected++;
+        return false;
+    };
+
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    uint32_t version, C, msgShift, chunks;
+    if (!getVarint32(p, end, version) || !getVarint32(p, end, C) || !getVarint32(p, end, msgShift) || !getVarint32(p, end, chunks))
+        return reject();
+    if (version != REPLICATION_VERSION || C != m_mgr.C || msgShift != shift) return reject();
+
+    uint64_t brickTotal = 0;
+    for (uint32_t c = 0; c < chunks; c++) {
+        DecodedChunk dc;
+        uint32_t count;
+        if (!getSigned(p, end, dc.coord.x) || !getSigned(p, end, dc.coord.y) || !getSigned(p, end, dc.coord.z) ||
+            !getVarint32(p, end, count) || count > bpa * bpa * bpa)
+            return reject();
+
+        dc.bricks.resize(count);
+        dc.values.resize(static_cast<size_t>(count) * brickVoxels);
+        uint64_t next = 0;
+        for (uint32_t b = 0; b < count; b++) {
+            uint32_t gap, runCount;
+            if (!getVarint32(p, end, gap) || next + gap >= bpa * bpa * bpa || !getVarint32(p, end, runCount)) return reject();
+            dc.bricks[b] = static_cast<uint32_t>(next + gap);
+            next += gap + 1;
+
+            uint32_t* values = dc.values.data() + static_cast<size_t>(b) * brickVoxels;
+            uint32_t i = 0;
+            for (uint32_t r = 0; r < runCount; r++) {
+                uint32_t value, length;
+                if (!getVarint32(p, end, value) || !getVarint32(p, end, length) || length > brickVoxels - i) return reject();
+                std::fill_n(values + i, length, value);
+                i += length;
+            }
+            if (i != brickVoxels) return reject();
+        }
+        brickTotal += count;
+        decoded.push_back(std::move(dc));
+    }
+    if (p != end) return reject();
+
+    std::vector<ChunkStorage::Write> batch;
+    for (const DecodedChunk& dc : decoded) {
+        Chunk* ch = m_mgr.getOrCreateChunk(dc.coord);
+        if (!ch->gpuBrushes.empty()) flushGpuBrushes(*ch);
+        // local edits still waiting for collect keep the chunk behind, they go out (with these bricks) next time
+        const bool upToDate = syncedEdits(*ch) == ch->voxels.editCount();
+
+        // only the voxels that differ, a brick that went out because one voxel changed writes one voxel here
+        batch.clear();
+        for (size_t b = 0; b < dc.bricks.size(); b++) {
+            const uint32_t table = dc.bricks[b];
+            const uint32_t bx = table % bpa, by = (table / bpa) % bpa, bz = table / (bpa * bpa);
+            const ChunkStorage::Brick* current = ch->voxels.brick(bx, by, bz);
+            const uint32_t* values = dc.values.data() + b * brickVoxels;
+            for (uint32_t i = 0; i < brickVoxels; i++) {
+                const uint32_t v = values[i];
+                if (v == voxelValue(ch->voxels, current, i)) continue;
+                batch.push_back({ bx * B + (i & (B - 1u)), by * B + ((i >> shift) & (B - 1u)), bz * B + (i >> (2 * shift)),
+                                  v & 0xFFFFFFu, ChunkStorage::dequantizeDensity(static_cast<uint8_t>(v >> 24)) });
+            }
+        }
+
+        if (!batch.empty()) {
+            const bool patchable = batch.size() <= REPLICATION_PATCH_MAX_VOXELS && svoPatchable(*ch);
+            ch->voxels.set(batch.data(), batch.size());
+
+            SvoPatch patch;
+            bool patched = patchable;
+            for (size_t i = 0; patched && i < batch.size(); i++)
+                patched = ch->svo.patchFromStorage(ch->voxels, batch[i].x, batch[i].y, batch[i].z, patch);
+            if (patched) commitSvoPatch(*ch, std::move(patch));
+            else ch->dirty = true;
+        }
+
+        if (upToDate) m_synced[dc.coord] = ch->voxels.editCount();
+    }
+
+    m_stats.receivedBytes += size;
+    m_stats.receivedBricks += brickTotal;
+    return true;
+}
+
+size_t ChunkReplicator::exchange(const ReplicationTransport& transport) {
+    if (!transport) return 0;
+
+    // local edits go out before remote ones land on the same bricks
+    std::vector<uint8_t> out;
+    if (collect(out)) transport.send(out);
+
+    std::vector<std::vector<uint8_t>> in;
+    transport.receive(in);
+    size_t applied = 0;
+    for (const auto& msg : in)
+        if (apply(msg.data(), msg.size())) applied++;
+    return applied;
+}
+
+}
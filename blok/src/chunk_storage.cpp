@@ -0,0 +1,269 @@
+/*
+* File: chunk_storage.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "chunk_storage.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace blok {
+
+ChunkStorage::ChunkStorage(uint32_t C)
+    : m_C(C), m_brickShift(0) {
+    // bricks are 8^3, or the whole chunk if it's smaller than that
+    while (m_brickShift < MAX_BRICK_SHIFT && (1u << (m_brickShift + 1)) <= C)
+        m_brickShift++;
+
+    m_bricksPerAxis = C >> m_brickShift;
+    holdContent(std::make_shared<Content>());
+    m_content->brickIndex.assign(static_cast<size_t>(m_bricksPerAxis) * m_bricksPerAxis * m_bricksPerAxis, EMPTY_BRICK);
+    m_content->brickEdits.assign(m_content->brickIndex.size(), 0);
+
+    // palette entry 0 is material 0, what empty voxels read back as
+    m_content->palette.push_back(0u);
+    m_content->paletteLookup[0u] = 0;
+}
+
+ChunkStorage::ChunkStorage(const ChunkStorage& other)
+    : m_C(other.m_C), m_brickShift(other.m_brickShift), m_bricksPerAxis(other.m_bricksPerAxis),
+      m_edits(other.m_edits), m_lastReset(other.m_lastReset) {
+    holdContent(other.m_content);
+}
+
+ChunkStorage& ChunkStorage::operator=(const ChunkStorage& other) {
+    if (this == &other) return *this;
+    m_C = other.m_C;
+    m_brickShift = other.m_brickShift;
+    m_bricksPerAxis = other.m_bricksPerAxis;
+    m_edits = other.m_edits;
+    m_lastReset = other.m_lastReset;
+    holdContent(other.m_content);
+    return *this;
+}
+
+ChunkStorage& ChunkStorage::operator=(ChunkStorage&& other) noexcept {
+    if (this == &other) return *this;
+    holdContent(nullptr);
+    m_C = other.m_C;
+    m_brickShift = other.m_brickShift;
+    m_bricksPerAxis = other.m_bricksPerAxis;
+    m_edits = other.m_edits;
+    m_lastReset = other.m_lastReset;
+    m_content = std::move(other.m_content); // other's hold moves with it
+    return *this;
+}
+
+ChunkStorage::~ChunkStorage() {
+    holdContent(nullptr);
+}
+
+void ChunkStorage::holdContent(std::shared_ptr<Content> content) {
+    if (content == m_content) return;
+    if (content) content->holders.count.fetch_add(1, std::memory_order_relaxed);
+    if (m_content) m_content->holders.count.fetch_sub(1, std::memory_order_release);
+    m_content = std::move(content);
+}
+
+ChunkStorage::Content& ChunkStorage::mutableContent() {
+    if (contentShared()) holdContent(std::make_shared<Content>(*m_content));
+    return *m_content;
+}
+
+uint8_t ChunkStorage::quantizeDensity(float d) {
+    if (!(d > 0.0f)) return 0;
+    // anything filled stays filled, no matter how small
+    return static_cast<uint8_t>(std::clamp(std::lround(d * 255.0f), 1l, 255l));
+}
+
+uint16_t ChunkStorage::paletteIndex(Content& content, uint32_t materialId) {
+    auto it = content.paletteLookup.find(materialId);
+    if (it != content.paletteLookup.end())
+        return it->second;
+
+    if (content.palette.size() > 0xFFFFu)
+        throw std::runtime_error("ChunkStorage: more than 65536 materials in one chunk");
+
+    const auto index = static_cast<uint16_t>(content.palette.size());
+    content.palette.push_back(materialId);
+    content.paletteLookup[materialId] = index;
+    return index;
+}
+
+void ChunkStorage::writeVoxel(Content& content, uint32_t x, uint32_t y, uint32_t z, const uint16_t* material, uint8_t density) {
+    if (x >= m_C || y >= m_C || z >= m_C)
+        return; // OUT OF BOUNDS
+    m_edits++;
+
+    const uint32_t table = brickTableIndex(x >> m_brickShift, y >> m_brickShift, z >> m_brickShift);
+    uint32_t& slot = content.brickIndex[table];
+
+    if (slot == EMPTY_BRICK) {
+        if (density == 0) return; // clearing an empty brick, nothing to do
+
+        if (!content.freeBricks.empty()) {
+            slot = content.freeBricks.back();
+            content.freeBricks.pop_back();
+        } else {
+            slot = static_cast<uint32_t>(content.bricks.size());
+            content.bricks.emplace_back();
+        }
+
+        Brick& b = content.bricks[slot];
+        std::memset(b.material, 0, sizeof(b.material));
+        std::memset(b.density, 0, sizeof(b.density));
+        b.filled = 0;
+    }
+
+    content.brickEdits[table] = m_edits;
+    Brick& b = content.bricks[slot];
+    const uint32_t i = voxelIndex(x, y, z);
+
+    if (material) b.material[i] = *material;
+
+    const bool wasFilled = b.density[i] != 0;
+    b.density[i] = density;
+    if (density != 0 && !wasFilled) b.filled++;
+    if (density == 0 && wasFilled) b.filled--;
+
+    if (b.filled == 0) {
+        content.freeBricks.push_back(slot);
+        slot = EMPTY_BRICK;
+    }
+}
+
+void ChunkStorage::set(uint32_t x, uint32_t y, uint32_t z, uint32_t materialId, float density) {
+    Content& content = mutableContent();
+    const uint16_t material = paletteIndex(content, materialId);
+    writeVoxel(content, x, y, z, &material, quantizeDensity(density));
+}
+
+void ChunkStorage::set(const Write* writes, size_t count) {
+    if (count == 0) return;
+    Content& content = mutableContent();
+    uint32_t lastMaterial = 0;
+    uint16_t material = 0; // palette entry 0 is material 0
+    for (size_t i = 0; i < count; ++i) {
+        const Write& w = writes[i];
+        if (w.materialId != lastMaterial) {
+            material = paletteIndex(content, w.materialId);
+            lastMaterial = w.materialId;
+        }
+        writeVoxel(content, w.x, w.y, w.z, &material, quantizeDensity(w.density));
+    }
+}
+
+void ChunkStorage::setDensity(uint32_t x, uint32_t y, uint32_t z, float density) {
+    writeVoxel(mutableContent(), x, y, z, nullptr, quantizeDensity(density));
+}
+
+void ChunkStorage::readBrickDensity(uint32_t bx, uint32_t by, uint32_t bz, uint8_t* out) const {
+    const uint32_t count = 1u << (3 * m_brickShift);
+    const Brick* b = brick(bx, by, bz);
+    if (b) std::memcpy(out, b->density, count);
+    else std::memset(out, 0, count);
+}
+
+bool ChunkStorage::writeBrickDensity(uint32_t bx, uint32_t by, uint32_t bz, const uint8_t* density) {
+    const uint32_t count = 1u << (3 * m_brickShift);
+    const Brick* current = brick(bx, by, bz);
+    uint32_t filled = 0;
+    for (uint32_t i = 0; i < count; ++i) filled += density[i] != 0 ? 1u : 0u;
+
+    if (current ? std::memcmp(current->density, density, count) == 0 : filled == 0)
+        return false;
+
+    Content& content = mutableContent();
+    m_edits++;
+    const uint32_t table = brickTableIndex(bx, by, bz);
+    content.brickEdits[table] = m_edits;
+    uint32_t& slot = content.brickIndex[table];
+    if (slot == EMPTY_BRICK) {
+        if (!content.freeBricks.empty()) {
+            slot = content.freeBricks.back();
+            content.freeBricks.pop_back();
+        } else {
+            slot = static_cast<uint32_t>(content.bricks.size());
+            content.bricks.emplace_back();
+        }
+        std::memset(content.bricks[slot].material, 0, sizeof(Brick::material));
+        std::memset(content.bricks[slot].density, 0, sizeof(Brick::density));
+    }
+
+    Brick& b = content.bricks[slot];
+    std::memcpy(b.density, density, count);
+    b.filled = filled;
+    if (filled == 0) {
+        content.freeBricks.push_back(slot);
+        slot = EMPTY_BRICK;
+    }
+    return true;
+}
+
+float ChunkStorage::density(uint32_t x, uint32_t y, uint32_t z) const {
+    if (x >= m_C || y >= m_C || z >= m_C) return 0.0f;
+
+    const Brick* b = brick(x >> m_brickShift, y >> m_brickShift, z >> m_brickShift);
+    return b ? dequantizeDensity(b->density[voxelIndex(x, y, z)]) : 0.0f;
+}
+
+uint32_t ChunkStorage::material(uint32_t x, uint32_t y, uint32_t z) const {
+    if (x >= m_C || y >= m_C || z >= m_C) return 0u;
+
+    const Brick* b = brick(x >> m_brickShift, y >> m_brickShift, z >> m_brickShift);
+    return b ? m_content->palette[b->material[voxelIndex(x, y, z)]] : 0u;
+}
+
+void ChunkStorage::clear() {
+    m_edits++;
+    m_lastReset = m_edits;
+    // a shared content is left to its snapshots, no point copying bricks just to drop them
+    if (contentShared()) {
+        holdContent(std::make_shared<Content>());
+        m_content->brickIndex.assign(static_cast<size_t>(m_bricksPerAxis) * m_bricksPerAxis * m_bricksPerAxis, EMPTY_BRICK);
+        m_content->brickEdits.assign(m_content->brickIndex.size(), 0);
+        m_content->palette.push_back(0u);
+        m_content->paletteLookup[0u] = 0;
+        return;
+    }
+    Content& c = *m_content;
+    std::fill(c.brickIndex.begin(), c.brickIndex.end(), EMPTY_BRICK);
+    std::fill(c.brickEdits.begin(), c.brickEdits.end(), 0);
+    c.bricks.clear();
+    c.freeBricks.clear();
+    c.palette.resize(1);
+    c.paletteLookup.clear();
+    c.paletteLookup[0u] = 0;
+}
+
+void ChunkStorage::restore(const ChunkStorage& snapshot) {
+    if (snapshot.m_C != m_C)
+        throw std::runtime_error("ChunkStorage: snapshot of a different chunk size");
+    holdContent(snapshot.m_content);
+    m_edits = std::max(m_edits, snapshot.m_edits) + 1;
+    // the snapshot's brick stamps count another storage's edits
+    m_lastReset = m_edits;
+}
+
+void ChunkStorage::changedBricks(uint64_t since, std::vector<uint32_t>& out) const {
+    const std::vector<uint64_t>& edits = m_content->brickEdits;
+    const bool all = m_lastReset > since;
+    for (uint32_t i = 0; i < edits.size(); ++i)
+        if (all || edits[i] > since) out.push_back(i);
+}
+
+size_t ChunkStorage::memoryBytes() const {
+    const Content& c = *m_content;
+    return c.brickIndex.capacity() * sizeof(uint32_t)
+         + c.bricks.capacity() * sizeof(Brick)
+         + c.freeBricks.capacity() * sizeof(uint32_t)
+         + c.brickEdits.capacity() * sizeof(uint64_t)
+         + c.palette.capacity() * sizeof(uint32_t)
+         + c.paletteLookup.size() * (sizeof(uint32_t) + sizeof(uint16_t) + 2 * sizeof(void*));
+}
+
+}
@@ -0,0 +1,88 @@
+/*
+* File: cpu_profiler.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "cpu_profiler.hpp"
+
+#include <fstream>
+
+namespace blok {
+
+namespace {
+
+// names and details are ours, but a path in a detail can still have a backslash or quote in it
+void writeJsonString(std::ofstream& out, const char* s) {
+    out << '"';
+    for (; *s; ++s) {
+        const char c = *s;
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+}
+
+CpuProfiler& CpuProfiler::instance() {
+    static CpuProfiler profiler;
+    return profiler;
+}
+
+uint32_t CpuProfiler::threadIndex() {
+    static std::atomic<uint32_t> next{ 0 };
+    thread_local const uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+void CpuProfiler::record(const char* name, std::chrono::steady_clock::time_point start,
+                         std::chrono::steady_clock::time_point end, std::string detail) {
+    using us = std::chrono::microseconds;
+    Event e;
+    e.name = name;
+    e.detail = std::move(detail);
+    e.startUs = static_cast<uint64_t>(std::chrono::duration_cast<us>(start - m_epoch).count());
+    e.durationUs = static_cast<uint64_t>(std::chrono::duration_cast<us>(end - start).count());
+    e.thread = threadIndex();
+
+    std::lock_guard lock(m_mutex);
+    if (m_events.size() >= MAX_EVENTS) return;
+    m_events.push_back(std::move(e));
+}
+
+void CpuProfiler::clear() {
+    std::lock_guard lock(m_mutex);
+    m_events.clear();
+}
+
+size_t CpuProfiler::eventCount() const {
+    std::lock_guard lock(m_mutex);
+    return m_events.size();
+}
+
+bool CpuProfiler::exportChromeTrace(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    std::lock_guard lock(m_mutex);
+    out << "{\"traceEvents\":[\n";
+    for (size_t i = 0; i < m_events.size(); i++) {
+        const Event& e = m_events[i];
+        out << "{\"name\":";
+        writeJsonString(out, e.name);
+        out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+            << ",\"ts\":" << e.startUs << ",\"dur\":" << e.durationUs;
+        if (!e.detail.empty()) {
+            out << ",\"args\":{\"detail\":";
+            writeJsonString(out, e.detail.c_str());
+            out << '}';
+        }
+        out << (i + 1 < m_events.size() ? "},\n" : "}\n");
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+}
+
+}
@@ -7,6 +7,8 @@
 
 #include "cuda_tracer.hpp"
 #include "camera.hpp"
+#include "material.hpp"
+#include "resources.hpp"
 #include "scene.hpp"
 
 #define GLFW_INCLUDE_NONE
@@ -15,12 +17,16 @@
 
 #include <cuda_runtime.h>
 #include <cuda_gl_interop.h>
+#include <cuda_fp16.h>
+#include <cooperative_groups.h>
 
 #include <stdexcept>
 #include <iostream>
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <cstring>
+#include <limits>
 
 using namespace blok;
 
@@ -48,6 +54,22 @@ struct PlaneCUDA {
     int    matId;
 };
 
+// binary bvh node, built on the host by buildBvh over whatever the primitives are (spheres, sub-chunk refs).
+// the primitives sit in leaf order so a leaf is a contiguous run of them
+struct BvhNodeCUDA {
+    float3   bmin;
+    uint32_t leftOrFirst; // interior: left child, the right one follows it. leaf: first primitive
+    float3   bmax;
+    uint32_t count;       // primitives in the leaf, 0 for interior nodes
+};
+
+// the spheres' bvh, rebuilt whenever the scene changes. planes are unbounded and stay a flat list
+struct SphereBvhCUDA {
+    const SphereCUDA*  spheres;
+    const BvhNodeCUDA* nodes;
+    int                numNodes;
+};
+
 struct CameraCUDA {
     float3 pos;
     float3 forward;
@@ -98,6 +120,22 @@ __device__ inline unsigned char toSRGB8(float x) {
     return (unsigned char)(g * 255.0f + 0.5f);
 }
 
+// vec2(tNear, tFar), missed if tNear > tFar
+__device__ inline float2 intersectAabb(float3 o, float3 invDir, float3 bmin, float3 bmax) {
+    float tx0 = (bmin.x - o.x) * invDir.x, tx1 = (bmax.x - o.x) * invDir.x;
+    float ty0 = (bmin.y - o.y) * invDir.y, ty1 = (bmax.y - o.y) * invDir.y;
+    float tz0 = (bmin.z - o.z) * invDir.z, tz1 = (bmax.z - o.z) * invDir.z;
+    float tNear = fmaxf(fmaxf(fminf(tx0, tx1), fminf(ty0, ty1)), fminf(tz0, tz1));
+    float tFar  = fminf(fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1)), fmaxf(tz0, tz1));
+    return make_float2(tNear, tFar);
+}
+
+__device__ inline float3 safeDirection(float3 d) {
+    return make_float3(fabsf(d.x) < 1e-6f ? 1e-6f : d.x,
+                       fabsf(d.y) < 1e-6f ? 1e-6f : d.y,
+                       fabsf(d.z) < 1e-6f ? 1e-6f : d.z);
+}
+
 // rng
 struct RNG {
     uint32_t state;
@@ -226,19 +264,65 @@ struct HitInfo {
     bool   hit;
 };
 
+static constexpr int BVH_STACK = 64;
+
+// nearer child first, subtrees outside [tMin, tMax] are skipped. tMax is the closest hit so far, the leaf
+// callback moves it. leaf(first, count) tests a leaf's primitives and returns true to stop the walk (any hit)
+template<typename Leaf>
+__device__ void traverseBvh(const BvhNodeCUDA* nodes, int numNodes, float3 ro, float3 rd, float tMin, const float& tMax, Leaf&& leaf) {
+    if (numNodes == 0) return;
+
+    float3 dir = safeDirection(rd);
+    float3 invDir = make_float3(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+
+    uint32_t stack[BVH_STACK];
+    int stackPtr = 0;
+    stack[stackPtr++] = 0u;
+
+    while (stackPtr > 0) {
+        const BvhNodeCUDA node = nodes[stack[--stackPtr]];
+        float2 tb = intersectAabb(ro, invDir, node.bmin, node.bmax);
+        if (tb.x > tb.y || tb.y < tMin || tb.x > tMax) continue;
+
+        if (node.count == 0u) {
+            // nearer child on top
+            uint32_t l = node.leftOrFirst, r = l + 1u;
+            float tl = intersectAabb(ro, invDir, nodes[l].bmin, nodes[l].bmax).x;
+            float tr = intersectAabb(ro, invDir, nodes[r].bmin, nodes[r].bmax).x;
+            if (stackPtr + 2 > BVH_STACK) continue;
+            if (tl < tr) { stack[stackPtr++] = r; stack[stackPtr++] = l; }
+            else         { stack[stackPtr++] = l; stack[stackPtr++] = r; }
+            continue;
+        }
+
+        if (leaf(node.leftOrFirst, node.count)) return;
+    }
+}
+
+// anyHit returns at the first sphere hit
+__device__ bool traceSpheres(const SphereBvhCUDA& b, float3 ro, float3 rd, bool anyHit, HitInfo& h) {
+    bool hit = false;
+    traverseBvh(b.nodes, b.numNodes, ro, rd, 0.f, h.t, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            float tHit; float3 n; int mid;
+            if (!hit_sphere(b.spheres[first + i], ro, rd, tHit, n, mid) || tHit >= h.t) continue;
+            hit = true;
+            if (anyHit) return true;
+            h.t = tHit; h.n = n; h.matId = mid; h.hit = true;
+        }
+        return false;
+    });
+    return hit;
+}
+
 __device__ HitInfo traceClosest(
     float3 ro, float3 rd,
-    const SphereCUDA* spheres, int numSpheres,
+    const SphereBvhCUDA& spheres,
     const PlaneCUDA*  planes,  int numPlanes)
 {
     HitInfo h; h.t = 1e20f; h.hit = false; h.n = make_float3(0,1,0); h.matId = 0;
 
-    for (int i=0; i<numSpheres; ++i) {
-        float tHit; float3 n; int mid;
-        if (hit_sphere(spheres[i], ro, rd, tHit, n, mid) && tHit < h.t) {
-            h.t = tHit; h.n = n; h.matId = mid; h.hit = true;
-        }
-    }
+    traceSpheres(spheres, ro, rd, false, h);
     for (int i=0; i<numPlanes; ++i) {
         float tHit; float3 n; int mid;
         if (hit_plane(planes[i], ro, rd, tHit, n, mid) && tHit < h.t) {
@@ -248,11 +332,43 @@ __device__ HitInfo traceClosest(
     return h;
 }
 
+// shadow rays, any hit at all blocks
+__device__ bool occludedAnalytic(
+    float3 ro, float3 rd,
+    const SphereBvhCUDA& spheres,
+    const PlaneCUDA*  planes,  int numPlanes)
+{
+    HitInfo h; h.t = 1e20f; h.hit = false;
+    if (traceSpheres(spheres, ro, rd, true, h)) return true;
+    for (int i=0; i<numPlanes; ++i) {
+        float tHit; float3 n; int mid;
+        if (hit_plane(planes[i], ro, rd, tHit, n, mid)) return true;
+    }
+    return false;
+}
+
+// progressive accumulation, then tonemap + sRGB of the running average
+__device__ void accumulatePixel(uchar4* pixels, float4* accum, int idx, float3 Lavg) {
+    float4 prev = accum[idx];
+    float3 sum = make_float3(prev.x, prev.y, prev.z);
+    float spp = prev.w;
+
+    sum = add3(sum, Lavg);
+    spp += 1.f;
+
+    accum[idx] = make_float4(sum.x, sum.y, sum.z, spp);
+
+    float3 avg = mul3(sum, 1.0f / spp);
+
+    float3 tm  = tonemapACES(avg);
+    pixels[idx] = make_uchar4(toSRGB8(tm.x), toSRGB8(tm.y), toSRGB8(tm.z), 255);
+}
+
 __global__ void pathtrace_kernel(
     uchar4* pixels, float4* accum,
     int width, int height,
     CameraCUDA cam,
-    const SphereCUDA* spheres, int numSpheres,
+    SphereBvhCUDA spheres,
     const PlaneCUDA* planes,  int numPlanes,
     const MaterialCUDA* materials, int numMaterials,
     int frameIndex, int maxDepth)
@@ -286,7 +402,7 @@ __global__ void pathtrace_kernel(
         float3 T = make_float3(1,1,1);
 
         for (int depth=0; depth<maxDepth; ++depth) {
-            HitInfo h = traceClosest(ro, rd, spheres, numSpheres, planes, numPlanes);
+            HitInfo h = traceClosest(ro, rd, spheres, planes, numPlanes);
             if (!h.hit) {
                 L = add3(L, mul3(T, skyGradient(rd)));             // environment
                 break;
@@ -308,16 +424,7 @@ __global__ void pathtrace_kernel(
                 if (cosNL > 0.f) {
                     // shadow ray; any hit = blocked
                     float3 roL = add3(P, mul3(wiL, 1e-3f));       // offset to avoid self-hit
-                    bool occluded = false;
-                    for (int i=0;i<numSpheres && !occluded;++i) {
-                        float tHit; float3 nTmp; int mTmp;
-                        if (hit_sphere(spheres[i], roL, wiL, tHit, nTmp, mTmp)) { occluded = true; }
-                    }
-                    for (int i=0;i<numPlanes && !occluded;++i) {
-                        float tHit; float3 nTmp; int mTmp;
-                        if (hit_plane(planes[i], roL, wiL, tHit, nTmp, mTmp)) { occluded = true; }
-                    }
-                    if (!occluded) {
+                    if (!occludedAnalytic(roL, wiL, spheres, planes, numPlanes)) {
                         float bsdfPdf = cosNL / _pi();            // cosine / pi
                         float wLight  = (lightPdf*lightPdf) / (lightPdf*lightPdf + bsdfPdf*bsdfPdf); // power heuristic
                         float3 contrib = mul3(m.albedo, (cosNL / lightPdf));
@@ -367,23 +474,857 @@ __global__ void pathtrace_kernel(
         Lsum = add3(Lsum, L);
     }
 
-    float3 Lavg = mul3(Lsum, 1.0f / (float)SPP_PER_FRAME);
+    accumulatePixel(pixels, accum, idx, mul3(Lsum, 1.0f / (float)SPP_PER_FRAME));
+}
+
+// voxel world. same layouts as the vulkan buffers (resources.hpp, material.hpp), the heaps are copied byte for byte
+// and traversed the way intersect.rint does it
+#ifdef BLOK_COMPACT_SVO_NODES
+struct SvoNodeCUDA {
+    uint32_t maskAndChild; // bits 0-7 child mask, bits 8-31 first child (leaves: 1 = filled, bricks: word offset + 2)
+    uint32_t materialId;
+};
+__device__ inline uint32_t nodeChildMask(const SvoNodeCUDA& n) { return n.maskAndChild & 0xFFu; }
+__device__ inline uint32_t nodeFirstChild(const SvoNodeCUDA& n) { return n.maskAndChild >> 8; }
+__device__ inline bool nodeFilled(const SvoNodeCUDA& n) { return (n.maskAndChild >> 8) != 0u; }
+__device__ inline bool nodeIsBrick(const SvoNodeCUDA& n) { return (n.maskAndChild & 0xFFu) == 0u && (n.maskAndChild >> 8) >= 2u; }
+__device__ inline uint32_t nodeBrickWord(const SvoNodeCUDA& n) { return (n.maskAndChild >> 8) - 2u; }
+#else
+struct SvoNodeCUDA {
+    uint32_t childMask; // bit 8 = brick
+    uint32_t firstChild;
+    uint32_t materialId;
+    float    occupancy;
+};
+__device__ inline uint32_t nodeChildMask(const SvoNodeCUDA& n) { return n.childMask & 0xFFu; }
+__device__ inline uint32_t nodeFirstChild(const SvoNodeCUDA& n) { return n.firstChild; }
+__device__ inline bool nodeFilled(const SvoNodeCUDA& n) { return n.occupancy > 0.0f; }
+__device__ inline bool nodeIsBrick(const SvoNodeCUDA& n) { return (n.childMask & 0x100u) != 0u; }
+__device__ inline uint32_t nodeBrickWord(const SvoNodeCUDA& n) { return n.firstChild; }
+#endif
+// dag packing: filled voxel count of the subtree, materials come from the brick word side channel
+__device__ inline uint32_t nodeVoxelCount(const SvoNodeCUDA& n) { return n.materialId; }
+
+struct SubChunkCUDA {
+    uint32_t nodeOffset;
+    uint32_t rootNodeIndex;
+    uint32_t nodeCount;
+    uint32_t startDepth;
+    float3   localMin;
+    float    subChunkSize;
+    float3   localMax;
+    uint32_t brickOffset;
+    float3   cellMin;
+    uint32_t materialBase;
+};
+
+struct MaterialGpuCUDA {
+    float3   albedo;
+    uint32_t flags; // bits 12-15 = MaterialType
+    float3   emission;
+    float    ior;
+};
+
+static_assert(sizeof(SvoNodeCUDA) == sizeof(GpuSvoNode), "must match the uploaded node layout");
+static_assert(sizeof(SubChunkCUDA) == sizeof(SubChunkGpu), "must match SubChunkGpu");
+static_assert(sizeof(MaterialGpuCUDA) == sizeof(MaterialGpu), "must match MaterialGpu");
+
+// one placement of a chunk, the tlas instance of the vulkan backend. rigid, so t is the same in both spaces
+struct SvoInstanceCUDA {
+    float4 toLocal[3]; // rows of world -> chunk-local
+    float4 toWorld[3]; // rows of chunk-local -> world, only the rotation is used (normals)
+};
+
+// an active sub-chunk in one placement, what a blas primitive is on the vulkan side
+struct SvoRefCUDA {
+    uint32_t subChunk; // index into subChunks
+    uint32_t instance;
+};
+
+struct SvoWorldCUDA {
+    const SvoNodeCUDA*     nodes;
+    const uint32_t*        brickWords;
+    const SubChunkCUDA*    subChunks;
+    const MaterialGpuCUDA* materials;
+    int                    numMaterials;
+    const SvoInstanceCUDA* instances;
+    const SvoRefCUDA*      refs;
+    const BvhNodeCUDA*     bvh; // top level, over the world space bounds of every ref
+    int                    numBvhNodes;
+};
+
+static constexpr uint32_t SVO_NO_DAG_MATERIALS = 0xFFFFFFFFu;
+// same budget as the default quality preset of intersect.rint
+static constexpr uint32_t SVO_MAX_ITER  = 256u;
+static constexpr uint32_t SVO_MAX_STACK = 22u;
+
+__device__ inline float3 transformRow3(const float4* rows, float3 p, float w) {
+    return make_float3(rows[0].x*p.x + rows[0].y*p.y + rows[0].z*p.z + rows[0].w*w,
+                       rows[1].x*p.x + rows[1].y*p.y + rows[1].z*p.z + rows[1].w*w,
+                       rows[2].x*p.x + rows[2].y*p.y + rows[2].z*p.z + rows[2].w*w);
+}
+
+// 0/1 = +x/-x, 2/3 = +y/-y, 4/5 = +z/-z, same as getHitFace in intersect.rint
+__device__ inline uint32_t hitFace(float3 hitPos, float3 center) {
+    float3 d = sub3(hitPos, center);
+    float ax = fabsf(d.x), ay = fabsf(d.y), az = fabsf(d.z);
+    if (ax >= ay && ax >= az) return d.x > 0.f ? 0u : 1u;
+    if (ay >= az)             return d.y > 0.f ? 2u : 3u;
+    return d.z > 0.f ? 4u : 5u;
+}
+__device__ inline float3 faceNormal(uint32_t face) {
+    float s = (face & 1u) ? -1.f : 1.f;
+    return face < 2u ? make_float3(s, 0, 0) : (face < 4u ? make_float3(0, s, 0) : make_float3(0, 0, s));
+}
+
+// voxel dda through one 4^3 brick between t0 and t1. entry t of the first filled voxel or -1
+__device__ float traceBrick(uint32_t lo, uint32_t hi, float3 brickMin, float voxelSize,
+                            float3 o, float3 dir, float3 invDir, float t0, float t1, uint32_t& bit) {
+    float3 p = mul3(sub3(add3(o, mul3(dir, t0)), brickMin), 1.0f / voxelSize);
+    int cx = min(max((int)floorf(p.x), 0), 3);
+    int cy = min(max((int)floorf(p.y), 0), 3);
+    int cz = min(max((int)floorf(p.z), 0), 3);
+    int sx = dir.x > 0.f ? 1 : -1, sy = dir.y > 0.f ? 1 : -1, sz = dir.z > 0.f ? 1 : -1;
+    float tMx = (brickMin.x + (cx + (dir.x > 0.f ? 1 : 0)) * voxelSize - o.x) * invDir.x;
+    float tMy = (brickMin.y + (cy + (dir.y > 0.f ? 1 : 0)) * voxelSize - o.y) * invDir.y;
+    float tMz = (brickMin.z + (cz + (dir.z > 0.f ? 1 : 0)) * voxelSize - o.z) * invDir.z;
+    float dx = fabsf(invDir.x) * voxelSize, dy = fabsf(invDir.y) * voxelSize, dz = fabsf(invDir.z) * voxelSize;
+
+    // a ray crosses at most 4 + 3 + 3 cells of a 4^3 grid
+    float t = t0;
+    for (int i = 0; i < 10; ++i) {
+        uint32_t b = (uint32_t)cx | ((uint32_t)cy << 2) | ((uint32_t)cz << 4);
+        uint32_t word = b < 32u ? lo : hi;
+        if (word & (1u << (b & 31u))) { bit = b; return t; }
+
+        if (tMx < tMy && tMx < tMz) { t = tMx; cx += sx; tMx += dx; }
+        else if (tMy < tMz)         { t = tMy; cy += sy; tMy += dy; }
+        else                        { t = tMz; cz += sz; tMz += dz; }
+
+        if (t >= t1 || cx < 0 || cy < 0 || cz < 0 || cx > 3 || cy > 3 || cz > 3) break;
+    }
+    bit = 0u;
+    return -1.f;
+}
+
+// materials are packed in bit order, voxel b's comes after every set bit below it
+__device__ inline uint32_t brickRank(uint32_t lo, uint32_t hi, uint32_t b) {
+    return b < 32u ? __popc(lo & ((1u << b) - 1u))
+                   : __popc(lo) + __popc(hi & ((1u << (b - 32u)) - 1u));
+}
 
-    // progressive accumulation
-    float4 prev = accum[idx];
-    float3 sum = make_float3(prev.x, prev.y, prev.z);
-    float spp = prev.w;
+struct SvoHit {
+    float    t;
+    uint32_t face;
+    uint32_t materialId;
+};
 
-    sum = add3(sum, Lavg);
-    spp += 1.f;
+// front to back descent of one sub-chunk in chunk-local space, the first filled leaf popped is the nearest.
+// no lod here, every ray goes down to the leaves
+__device__ bool traceSubChunk(const SvoWorldCUDA& w, const SubChunkCUDA& sub, float3 o, float3 d,
+                              float tRayMin, float tRayMax, bool anyHit, SvoHit& hit) {
+    float3 dir = safeDirection(d);
+    float3 invDir = make_float3(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+
+    float2 rootT = intersectAabb(o, invDir, sub.localMin, sub.localMax);
+    float tMin = fmaxf(rootT.x, tRayMin);
+    float tMax = fminf(rootT.y, tRayMax);
+    if (tMin > tMax) return false;
+
+    // mirrored child space, the ray always runs towards +x/+y/+z
+    uint32_t octantMask = (dir.x < 0.f ? 1u : 0u) | (dir.y < 0.f ? 2u : 0u) | (dir.z < 0.f ? 4u : 0u);
+    const bool dag = sub.materialBase != SVO_NO_DAG_MATERIALS;
+
+    struct StackItem {
+        uint32_t nodeIndex;
+        float3   center;
+        float    halfSize;
+        float    tEntry;
+        float    tExit;
+        uint32_t matIndex; // dag: side-channel index of the first voxel below this node
+    };
+    StackItem stack[SVO_MAX_STACK];
+    uint32_t stackPtr = 0u;
+
+    float rootHalf = sub.subChunkSize * 0.5f;
+    stack[stackPtr++] = { sub.nodeOffset + sub.rootNodeIndex,
+                          add3(sub.cellMin, make_float3(rootHalf, rootHalf, rootHalf)),
+                          rootHalf, tMin, tMax, sub.materialBase };
+
+    uint32_t iter = 0u;
+    while (stackPtr > 0u && iter++ < SVO_MAX_ITER) {
+        StackItem item = stack[--stackPtr];
+        if (item.nodeIndex >= sub.nodeOffset + sub.nodeCount) continue;
+        const SvoNodeCUDA node = w.nodes[item.nodeIndex];
+        const uint32_t childMask = nodeChildMask(node);
+
+        if (nodeIsBrick(node)) {
+            uint32_t base = sub.brickOffset + nodeBrickWord(node);
+            uint32_t lo = w.brickWords[base], hi = w.brickWords[base + 1u];
+            float voxelSize = item.halfSize * 0.5f;
+            float3 brickMin = sub3(item.center, make_float3(item.halfSize, item.halfSize, item.halfSize));
+
+            uint32_t bit;
+            float tHit = traceBrick(lo, hi, brickMin, voxelSize, o, dir, invDir, item.tEntry, item.tExit, bit);
+            if (tHit >= 0.f) {
+                hit.t = tHit;
+                if (!anyHit) {
+                    float3 voxelCenter = add3(brickMin, mul3(make_float3((float)(bit & 3u) + 0.5f,
+                                                                         (float)((bit >> 2) & 3u) + 0.5f,
+                                                                         (float)(bit >> 4) + 0.5f), voxelSize));
+                    uint32_t rank = brickRank(lo, hi, bit);
+                    // baked ao in the top byte isn't used here
+                    hit.materialId = (dag ? w.brickWords[item.matIndex + rank] : w.brickWords[base + 2u + rank]) & 0x00FFFFFFu;
+                    hit.face = hitFace(add3(o, mul3(d, tHit)), voxelCenter);
+                }
+                return true;
+            }
+            continue;
+        }
 
-    accum[idx] = make_float4(sum.x, sum.y, sum.z, spp);
+        if (childMask == 0u) {
+            if (nodeFilled(node)) {
+                hit.t = item.tEntry;
+                if (!anyHit) {
+                    hit.materialId = dag ? w.brickWords[item.matIndex] : node.materialId;
+                    hit.face = hitFace(add3(o, mul3(d, item.tEntry)), item.center);
+                }
+                return true;
+            }
+            continue;
+        }
 
-    float3 avg = mul3(sum, 1.0f / spp);
+        // dda over the child cells between the node's split planes, at most 4 are pierced
+        float3 tPlane = make_float3((item.center.x - o.x) * invDir.x,
+                                    (item.center.y - o.y) * invDir.y,
+                                    (item.center.z - o.z) * invDir.z);
+        const float t0 = item.tEntry;
+        const float t1 = item.tExit;
+
+        uint32_t c = 0u;
+        if (tPlane.x <= t0) c |= 1u;
+        if (tPlane.y <= t0) c |= 2u;
+        if (tPlane.z <= t0) c |= 4u;
+
+        float spanMin[4], spanMax[4];
+        uint32_t spanIndex[4];
+        uint32_t spanCount = 0u;
+
+        float tStart = t0;
+        for (int k = 0; k < 4; ++k) {
+            float ex = (c & 1u) ? t1 : tPlane.x;
+            float ey = (c & 2u) ? t1 : tPlane.y;
+            float ez = (c & 4u) ? t1 : tPlane.z;
+            float tEnd = fminf(fminf(fminf(ex, ey), ez), t1);
+
+            uint32_t childIdx = c ^ octantMask;
+            if ((childMask & (1u << childIdx)) && tStart < tEnd) {
+                spanMin[spanCount] = tStart;
+                spanMax[spanCount] = tEnd;
+                spanIndex[spanCount] = childIdx;
+                ++spanCount;
+            }
 
-    // tonemap + sRGB
-    float3 tm  = tonemapACES(avg);
-    pixels[idx] = make_uchar4(toSRGB8(tm.x), toSRGB8(tm.y), toSRGB8(tm.z), 255);
+            if (tEnd >= t1) break;
+
+            if (tEnd == ex) c |= 1u;
+            else if (tEnd == ey) c |= 2u;
+            else c |= 4u;
+            tStart = tEnd;
+        }
+
+        // dag: a child's first material comes after everything in its earlier siblings
+        uint32_t childRank[8];
+        if (dag && spanCount > 0u) {
+            uint32_t acc = item.matIndex;
+            uint32_t first = sub.nodeOffset + nodeFirstChild(node);
+            uint32_t stored = 0u;
+            for (uint32_t oct = 0u; oct < 8u; ++oct) {
+                childRank[oct] = acc;
+                if (childMask & (1u << oct)) acc += nodeVoxelCount(w.nodes[first + stored++]);
+            }
+        }
+
+        // far to near, the nearest child pops first
+        float nextHalf = item.halfSize * 0.5f;
+        for (uint32_t k = spanCount; k > 0u; --k) {
+            uint32_t s = k - 1u;
+            if (spanMin[s] >= tRayMax || stackPtr >= SVO_MAX_STACK) continue;
+
+            uint32_t idx = spanIndex[s];
+            float3 childOff = make_float3((idx & 1u) ? nextHalf : -nextHalf,
+                                          (idx & 2u) ? nextHalf : -nextHalf,
+                                          (idx & 4u) ? nextHalf : -nextHalf);
+            stack[stackPtr++] = { sub.nodeOffset + nodeFirstChild(node) + __popc(childMask & ((1u << idx) - 1u)),
+                                  add3(item.center, childOff), nextHalf,
+                                  spanMin[s], spanMax[s],
+                                  dag ? childRank[idx] : 0u };
+        }
+    }
+    return false;
+}
+
+struct WorldHit {
+    float    t;
+    float3   n; // world space face normal
+    uint32_t materialId;
+    bool     hit;
+};
+
+// top level bvh, then every sub-chunk it reaches in its placement's local space.
+// anyHit stops at the first hit and leaves n / materialId alone (shadow rays)
+__device__ WorldHit traceWorld(const SvoWorldCUDA& w, float3 ro, float3 rd, float tMin, float tMax, bool anyHit) {
+    WorldHit h; h.t = tMax; h.hit = false; h.n = make_float3(0, 1, 0); h.materialId = 0;
+    traverseBvh(w.bvh, w.numBvhNodes, ro, rd, tMin, h.t, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            const SvoRefCUDA ref = w.refs[first + i];
+            const SvoInstanceCUDA& inst = w.instances[ref.instance];
+            float3 lo = transformRow3(inst.toLocal, ro, 1.f);
+            float3 ld = transformRow3(inst.toLocal, rd, 0.f);
+
+            SvoHit sh;
+            if (!traceSubChunk(w, w.subChunks[ref.subChunk], lo, ld, tMin, h.t, anyHit, sh)) continue;
+            h.hit = true;
+            h.t = sh.t;
+            if (anyHit) return true;
+            h.n = normalize3(transformRow3(inst.toWorld, faceNormal(sh.face), 0.f));
+            h.materialId = sh.materialId;
+        }
+        return false;
+    });
+    return h;
+}
+
+// MaterialType -> the tracer's three lobes. roughness, metallic and alpha aren't modelled here
+__device__ inline MaterialCUDA toMaterialCUDA(const SvoWorldCUDA& w, uint32_t id) {
+    MaterialCUDA m{};
+    if (w.numMaterials == 0) {
+        m.type = MAT_LAMBERT; m.albedo = make_float3(0.8f, 0.8f, 0.8f); m.eta = 1.5f;
+        return m;
+    }
+    const MaterialGpuCUDA g = w.materials[id < (uint32_t)w.numMaterials ? id : 0u];
+    m.albedo = g.albedo;
+    m.emission = make_float3(0, 0, 0);
+    m.eta = 1.5f;
+    switch ((g.flags >> 12) & 0xFu) {
+        case 1: m.type = MAT_MIRROR; break;
+        case 2: m.type = MAT_DIELECTRIC; m.eta = g.ior; break;
+        case 3: m.type = MAT_LAMBERT; m.emission = g.emission; break;
+        default: m.type = MAT_LAMBERT; break;
+    }
+    return m;
+}
+
+// first surface a path hit, what the vulkan gbuffer wants next to the radiance
+struct PrimaryHitCUDA {
+    float3   pos;
+    float3   n; // facing the ray
+    float    t;
+    uint32_t materialId;
+    bool     hit;
+};
+
+// one path through the voxel world, same integrator as pathtrace_kernel. first is filled at depth 0 when given
+__device__ float3 traceSvoPath(const SvoWorldCUDA& world, const SunCUDA& sun, RNG& rng,
+                               float3 ro, float3 rd, int maxDepth, PrimaryHitCUDA* first)
+{
+    float3 L = make_float3(0,0,0);
+    float3 T = make_float3(1,1,1);
+
+    for (int depth=0; depth<maxDepth; ++depth) {
+        WorldHit h = traceWorld(world, ro, rd, 1e-4f, 1e20f, false);
+        if (!h.hit) {
+            L = add3(L, mul3(T, skyGradient(rd)));
+            break;
+        }
+
+        float3 P = add3(ro, mul3(rd, h.t));
+        const MaterialCUDA m = toMaterialCUDA(world, h.materialId);
+        float3 N = (dot3(h.n, rd) < 0) ? h.n : mul3(h.n, -1.f);
+
+        if (first && depth == 0) {
+            first->pos = P; first->n = N; first->t = h.t;
+            first->materialId = h.materialId; first->hit = true;
+        }
+
+        if (m.emission.x>0 || m.emission.y>0 || m.emission.z>0) {
+            L = add3(L, mul3(T, m.emission));
+        }
+
+        // voxel faces are axis aligned, so leaving along the normal instead of the ray
+        // keeps grazing bounces from hitting the face they start on
+        float3 Poff = add3(P, mul3(N, 1e-3f));
+
+        if (m.type == MAT_LAMBERT) {
+            float lightPdf;
+            float3 wiL = sampleSunDir(rng, sun, lightPdf);
+            float cosNL = fmaxf(0.f, dot3(N, wiL));
+            if (cosNL > 0.f && !traceWorld(world, Poff, wiL, 0.f, 1e20f, true).hit) {
+                float bsdfPdf = cosNL / _pi();
+                float wLight  = (lightPdf*lightPdf) / (lightPdf*lightPdf + bsdfPdf*bsdfPdf);
+                float3 contrib = mul3(m.albedo, (cosNL / lightPdf));
+                contrib = mul3(contrib, sun.color);
+                contrib = mul3(contrib, wLight);
+                float Y = luminance(contrib);
+                const float maxY = 10.0f;
+                if (Y > maxY) contrib = mul3(contrib, maxY / (Y + 1e-6f));
+                L = add3(L, mul3(T, contrib));
+            }
+        }
+
+        if (m.type == MAT_LAMBERT) {
+            rd = cosineSampleHemisphere(rng, N);
+            ro = Poff;
+            T  = mul3(T, m.albedo);
+        } else if (m.type == MAT_MIRROR) {
+            rd = reflect3(rd, N);
+            ro = Poff;
+            T  = mul3(T, m.albedo);
+        } else {
+            bool into = (dot3(h.n, rd) < 0.f);
+            float3 Nn = into ? h.n : mul3(h.n, -1.f);
+            float eta = into ? (1.f / fmaxf(m.eta, 1e-3f)) : fmaxf(m.eta, 1.0001f);
+            float cosi = -dot3(rd, Nn);
+            float3 wt;
+            float Fr = refract3(rd, Nn, eta, wt) ? schlick(fabsf(cosi), eta) : 1.f;
+            if (rng.f32() < Fr) {
+                rd = reflect3(rd, Nn);
+                ro = add3(P, mul3(Nn, 1e-3f));
+            } else {
+                rd = normalize3(wt);
+                ro = sub3(P, mul3(Nn, 1e-3f));
+            }
+            T  = mul3(T, m.albedo);
+        }
+
+        if (depth >= 3) {
+            float p = fmaxf(T.x, fmaxf(T.y, T.z));
+            p = fminf(p, 0.99f);
+            if (rng.f32() > p) break;
+            T = mul3(T, 1.0f/p);
+        }
+    }
+    return L;
+}
+
+// same integrator as pathtrace_kernel over the voxel world
+__global__ void svo_pathtrace_kernel(
+    uchar4* pixels, float4* accum,
+    int width, int height,
+    CameraCUDA cam,
+    SvoWorldCUDA world,
+    int frameIndex, int maxDepth)
+{
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) return;
+    int idx = y * width + x;
+
+    SunCUDA sun = makeSun(normalize3(make_float3(0.6f, 1.0f, -0.4f)),
+                          make_float3(3.0f, 2.8f, 2.6f),
+                          0.5f);
+
+    uint32_t baseSeed = 2166136261u ^ (x*16777619u) ^ (y*374761393u) ^ (frameIndex*668265263u);
+    RNG rng(baseSeed);
+
+    float3 Lsum = make_float3(0,0,0);
+
+    for (int s = 0; s < SPP_PER_FRAME; ++s) {
+        float jx = rng.f32() - 0.5f;
+        float jy = rng.f32() - 0.5f;
+
+        float u = (2.0f * ((x + 0.5f + jx) / width) - 1.0f) * cam.fovScale * cam.aspect;
+        float v = (1.0f - 2.0f * ((y + 0.5f + jy) / height)) * cam.fovScale;
+
+        float3 rd = normalize3(add3(add3(cam.forward, mul3(cam.right, u)), mul3(cam.up, v)));
+        Lsum = add3(Lsum, traceSvoPath(world, sun, rng, cam.pos, rd, maxDepth, nullptr));
+    }
+
+    accumulatePixel(pixels, accum, idx, mul3(Lsum, 1.0f / (float)SPP_PER_FRAME));
+}
+
+// vulkan interop: the gbuffer targets CudaInterop exported, GBUFFER_* formats, rows of 'width' texels
+struct GBufferCUDA {
+#ifdef BLOK_COMPACT_GBUFFER
+    ushort4*  color;           // rgba16f
+    float*    depth;           // r32f, primary hit distance
+    uint32_t* normalRoughness; // octahedral 12+12, roughness in the top 8
+#else
+    float4*   color;           // rgba32f
+    float4*   position;        // xyz + hit distance
+    ushort4*  normalRoughness; // rgba16f
+#endif
+    uchar4*   albedoMetallic;  // rgba8 unorm
+    ushort2*  motion;          // rg16f
+};
+
+// the FrameUBO matrices the raygen shader uses, glm column major
+struct FrameCUDA {
+    float4   invView[4];
+    float4   invProj[4];
+    float4   prevViewProj[4];
+    float3   camPos;
+    uint32_t frameCount;
+};
+
+__device__ inline float4 mulCols(const float4* m, float4 v) {
+    return make_float4(m[0].x*v.x + m[1].x*v.y + m[2].x*v.z + m[3].x*v.w,
+                       m[0].y*v.x + m[1].y*v.y + m[2].y*v.z + m[3].y*v.w,
+                       m[0].z*v.x + m[1].z*v.y + m[2].z*v.z + m[3].z*v.w,
+                       m[0].w*v.x + m[1].w*v.y + m[2].w*v.z + m[3].w*v.w);
+}
+
+__device__ inline unsigned short toHalf(float x) { return __half_as_ushort(__float2half(x)); }
+__device__ inline unsigned char toUnorm8(float x) { return (unsigned char)(fminf(fmaxf(x, 0.f), 1.f) * 255.0f + 0.5f); }
+
+#ifdef BLOK_COMPACT_GBUFFER
+// same packing as raygen.rgen
+__device__ inline uint32_t packNormalRoughness(float3 n, float roughness) {
+    float s = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float ex = n.x / s, ey = n.y / s;
+    if (n.z < 0.f) {
+        float wx = (1.f - fabsf(ey)) * (ex >= 0.f ? 1.f : -1.f);
+        float wy = (1.f - fabsf(ex)) * (ey >= 0.f ? 1.f : -1.f);
+        ex = wx; ey = wy;
+    }
+    uint32_t qx = (uint32_t)rintf(fminf(fmaxf(ex * 0.5f + 0.5f, 0.f), 1.f) * 4095.0f);
+    uint32_t qy = (uint32_t)rintf(fminf(fmaxf(ey * 0.5f + 0.5f, 0.f), 1.f) * 4095.0f);
+    return qx | (qy << 12) | ((uint32_t)rintf(fminf(fmaxf(roughness, 0.f), 1.f) * 255.0f) << 24);
+}
+#endif
+
+// one path per pixel with the raygen shader's camera, then the same gbuffer the ray tracing pipeline writes.
+// no accumulation here, the vulkan denoiser does the temporal part
+__global__ void svo_gbuffer_kernel(GBufferCUDA out, int width, int height, FrameCUDA f, SvoWorldCUDA world, int maxDepth) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) return;
+    int idx = y * width + x;
+
+    SunCUDA sun = makeSun(normalize3(make_float3(0.6f, 1.0f, -0.4f)),
+                          make_float3(3.0f, 2.8f, 2.6f),
+                          0.5f);
+    RNG rng(2166136261u ^ (x*16777619u) ^ (y*374761393u) ^ (f.frameCount*668265263u));
+
+    const float uvx = (x + 0.5f) / width, uvy = (y + 0.5f) / height;
+    float4 target = mulCols(f.invProj, make_float4(uvx * 2.f - 1.f, uvy * 2.f - 1.f, 1.f, 1.f));
+    float3 dirView = normalize3(make_float3(target.x, target.y, target.z));
+    float4 dirWorld = mulCols(f.invView, make_float4(dirView.x, dirView.y, dirView.z, 0.f));
+    float3 rd = normalize3(make_float3(dirWorld.x, dirWorld.y, dirWorld.z));
+
+    PrimaryHitCUDA first{};
+    float3 color = traceSvoPath(world, sun, rng, f.camPos, rd, maxDepth, &first);
+
+    // firefly clamp, as raygen
+    float maxVal = fmaxf(color.x, fmaxf(color.y, color.z));
+    if (maxVal > 100.f) color = mul3(color, 100.f / maxVal);
+
+    float3 albedo = make_float3(0,0,0);
+    float roughness = 0.f, metallic = 0.f;
+    if (first.hit) {
+        const MaterialCUDA m = toMaterialCUDA(world, first.materialId);
+        albedo = (m.emission.x + m.emission.y + m.emission.z > 0.01f) ? m.emission : m.albedo;
+        if (world.numMaterials > 0) {
+            const uint32_t flags = world.materials[first.materialId < (uint32_t)world.numMaterials ? first.materialId : 0u].flags;
+            roughness = ((flags >> 16) & 0xFFu) / 255.0f;
+            metallic = ((flags >> 24) & 0xFFu) / 255.0f;
+        }
+    } else {
+        // sky, far along the view axis
+        float4 fwd = mulCols(f.invView, make_float4(0.f, 0.f, -1.f, 0.f));
+        float3 fw = normalize3(make_float3(fwd.x, fwd.y, fwd.z));
+        first.t = 10000.0f;
+        first.pos = add3(f.camPos, mul3(fw, first.t));
+        first.n = make_float3(0, 1, 0);
+        albedo = skyGradient(fw);
+    }
+
+#ifdef BLOK_COMPACT_GBUFFER
+    out.color[idx] = make_ushort4(toHalf(color.x), toHalf(color.y), toHalf(color.z), toHalf(1.f));
+    out.depth[idx] = first.t;
+    out.normalRoughness[idx] = packNormalRoughness(first.n, roughness);
+#else
+    out.color[idx] = make_float4(color.x, color.y, color.z, 1.f);
+    out.position[idx] = make_float4(first.pos.x, first.pos.y, first.pos.z, first.t);
+    out.normalRoughness[idx] = make_ushort4(toHalf(first.n.x), toHalf(first.n.y), toHalf(first.n.z), toHalf(roughness));
+#endif
+    out.albedoMetallic[idx] = make_uchar4(toUnorm8(albedo.x), toUnorm8(albedo.y), toUnorm8(albedo.z), toUnorm8(metallic));
+
+    float2 mv = make_float2(0.f, 0.f);
+    if (first.hit) {
+        float4 prevClip = mulCols(f.prevViewProj, make_float4(first.pos.x, first.pos.y, first.pos.z, 1.f));
+        mv.x = uvx - (prevClip.x / prevClip.w * 0.5f + 0.5f);
+        mv.y = uvy - (prevClip.y / prevClip.w * 0.5f + 0.5f);
+    }
+    out.motion[idx] = make_ushort2(toHalf(mv.x), toHalf(mv.y));
+}
+
+// wavefront mode: one kernel per stage instead of one thread looping over the whole path.
+// the stages talk through queues of path indices that are compacted with warp aggregated atomics,
+// hits are binned per material lobe before shading and the trace stages run persistent threads
+// that pull warp sized batches until their queue is empty, so no stage needs its count on the host
+namespace cg = cooperative_groups;
+
+static constexpr int WAVEFRONT_BLOCK = 128;
+static constexpr uint32_t WAVEFRONT_BINS = 3; // MAT_LAMBERT, MAT_MIRROR, MAT_DIELECTRIC
+
+struct PathStateCUDA {
+    float3   ro, rd;
+    float3   T;           // throughput
+    float3   L;           // radiance so far
+    float3   n;           // last hit, written by extend for shade
+    float    t;
+    uint32_t materialId;
+    uint32_t rng;
+};
+
+struct ShadowRayCUDA {
+    uint32_t path;
+    float3   ro;
+    float3   dir;
+    float3   contrib;     // added to the path's L if the sun is visible
+};
+
+// device side counters of one frame, the host never reads them back
+struct WavefrontCounters {
+    uint32_t rays[2];     // ray queue sizes, by bounce parity
+    uint32_t hits[WAVEFRONT_BINS];
+    uint32_t shadows;
+    uint32_t work[3];     // extend, shade, shadow batch cursors
+};
+
+// the analytic scene as a wavefront scene, the voxel world is the other one (SvoWorldCUDA)
+struct AnalyticSceneCUDA {
+    SphereBvhCUDA       spheres;
+    const PlaneCUDA*    planes;    int numPlanes;
+    const MaterialCUDA* materials; int numMaterials;
+};
+
+__device__ inline WorldHit sceneClosest(const AnalyticSceneCUDA& s, float3 ro, float3 rd) {
+    HitInfo h = traceClosest(ro, rd, s.spheres, s.planes, s.numPlanes);
+    WorldHit w; w.t = h.t; w.n = h.n; w.materialId = (uint32_t)h.matId; w.hit = h.hit;
+    return w;
+}
+__device__ inline bool sceneOccluded(const AnalyticSceneCUDA& s, float3 ro, float3 rd) {
+    return occludedAnalytic(ro, rd, s.spheres, s.planes, s.numPlanes);
+}
+__device__ inline MaterialCUDA sceneMaterial(const AnalyticSceneCUDA& s, uint32_t id) {
+    return s.materials[id < (uint32_t)s.numMaterials ? id : 0u];
+}
+
+__device__ inline WorldHit sceneClosest(const SvoWorldCUDA& w, float3 ro, float3 rd) {
+    return traceWorld(w, ro, rd, 1e-4f, 1e20f, false);
+}
+__device__ inline bool sceneOccluded(const SvoWorldCUDA& w, float3 ro, float3 rd) {
+    return traceWorld(w, ro, rd, 0.f, 1e20f, true).hit;
+}
+__device__ inline MaterialCUDA sceneMaterial(const SvoWorldCUDA& w, uint32_t id) {
+    return toMaterialCUDA(w, id);
+}
+
+// slot in a queue for every calling thread, one atomic per converged group
+__device__ inline uint32_t queueAppend(uint32_t* counter) {
+    cg::coalesced_group g = cg::coalesced_threads();
+    uint32_t base = 0;
+    if (g.thread_rank() == 0) base = atomicAdd(counter, g.size());
+    return g.shfl(base, 0) + g.thread_rank();
+}
+
+// persistent threads: each warp takes the next 32 items until 'total' is used up.
+// the whole warp leaves together, the shuffle never sees a partial warp
+template <typename F>
+__device__ inline void forEachQueued(uint32_t* cursor, uint32_t total, F&& f) {
+    const uint32_t lane = threadIdx.x & 31u;
+    for (;;) {
+        uint32_t base = 0;
+        if (lane == 0) base = atomicAdd(cursor, 32u);
+        base = __shfl_sync(0xFFFFFFFFu, base, 0);
+        if (base >= total) break;
+        if (base + lane < total) f(base + lane);
+    }
+}
+
+__global__ void wavefront_generate_kernel(
+    PathStateCUDA* paths, uint32_t* rayQueue, WavefrontCounters* counters,
+    int width, int height, CameraCUDA cam, int frameIndex, int sample)
+{
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= width * height) return;
+    int x = i % width, y = i / width;
+
+    uint32_t baseSeed = 2166136261u ^ (x*16777619u) ^ (y*374761393u) ^ (frameIndex*668265263u) ^ (sample*2246822519u);
+    RNG rng(baseSeed);
+    float jx = rng.f32() - 0.5f;
+    float jy = rng.f32() - 0.5f;
+    float u = (2.0f * ((x + 0.5f + jx) / width) - 1.0f) * cam.fovScale * cam.aspect;
+    float v = (1.0f - 2.0f * ((y + 0.5f + jy) / height)) * cam.fovScale;
+
+    PathStateCUDA& p = paths[i];
+    p.ro = cam.pos;
+    p.rd = normalize3(add3(add3(cam.forward, mul3(cam.right, u)), mul3(cam.up, v)));
+    p.T = make_float3(1,1,1);
+    p.L = make_float3(0,0,0);
+    p.rng = rng.state;
+
+    // every path starts alive, no compaction needed for the first wave
+    rayQueue[i] = (uint32_t)i;
+    if (i == 0) counters->rays[0] = (uint32_t)(width * height);
+}
+
+// closest hit for every queued ray. misses pick up the sky and end, hits go to their material's bin
+template <typename SceneT>
+__global__ void wavefront_extend_kernel(
+    SceneT scene, PathStateCUDA* paths, const uint32_t* rayQueue, uint32_t* hitQueue,
+    WavefrontCounters* counters, uint32_t parity, uint32_t capacity)
+{
+    forEachQueued(&counters->work[0], counters->rays[parity], [&](uint32_t q) {
+        const uint32_t pi = rayQueue[q];
+        PathStateCUDA& p = paths[pi];
+        WorldHit h = sceneClosest(scene, p.ro, p.rd);
+        if (!h.hit) {
+            p.L = add3(p.L, mul3(p.T, skyGradient(p.rd)));
+            return;
+        }
+        p.t = h.t;
+        p.n = h.n;
+        p.materialId = h.materialId;
+
+        const uint32_t bin = (uint32_t)sceneMaterial(scene, h.materialId).type;
+        hitQueue[bin * capacity + queueAppend(&counters->hits[bin])] = pi;
+    });
+}
+
+// emission, sun sample and scattering, bin after bin so a warp mostly runs one lobe.
+// survivors are compacted into the other ray queue
+template <typename SceneT>
+__global__ void wavefront_shade_kernel(
+    SceneT scene, PathStateCUDA* paths, const uint32_t* hitQueue, uint32_t* nextRayQueue,
+    ShadowRayCUDA* shadowQueue, WavefrontCounters* counters,
+    uint32_t parity, uint32_t capacity, int depth, int maxDepth)
+{
+    const uint32_t c0 = counters->hits[0], c1 = counters->hits[1], c2 = counters->hits[2];
+    SunCUDA sun = makeSun(normalize3(make_float3(0.6f, 1.0f, -0.4f)),
+                          make_float3(3.0f, 2.8f, 2.6f),
+                          0.5f);
+
+    forEachQueued(&counters->work[1], c0 + c1 + c2, [&](uint32_t q) {
+        const uint32_t bin = q < c0 ? 0u : (q < c0 + c1 ? 1u : 2u);
+        const uint32_t offset = q - (bin == 0u ? 0u : (bin == 1u ? c0 : c0 + c1));
+        const uint32_t pi = hitQueue[bin * capacity + offset];
+
+        PathStateCUDA& p = paths[pi];
+        RNG rng(p.rng);
+        const MaterialCUDA m = sceneMaterial(scene, p.materialId);
+        float3 rd = p.rd;
+        float3 T = p.T;
+        float3 P = add3(p.ro, mul3(rd, p.t));
+        float3 N = (dot3(p.n, rd) < 0) ? p.n : mul3(p.n, -1.f);
+        float3 Poff = add3(P, mul3(N, 1e-3f));
+
+        if (m.emission.x>0 || m.emission.y>0 || m.emission.z>0) {
+            p.L = add3(p.L, mul3(T, m.emission));
+        }
+
+        if (m.type == MAT_LAMBERT) {
+            float lightPdf;
+            float3 wiL = sampleSunDir(rng, sun, lightPdf);
+            float cosNL = fmaxf(0.f, dot3(N, wiL));
+            if (cosNL > 0.f) {
+                float bsdfPdf = cosNL / _pi();
+                float wLight  = (lightPdf*lightPdf) / (lightPdf*lightPdf + bsdfPdf*bsdfPdf);
+                float3 contrib = mul3(m.albedo, (cosNL / lightPdf));
+                contrib = mul3(contrib, sun.color);
+                contrib = mul3(contrib, wLight);
+                float Y = luminance(contrib);
+                const float maxY = 10.0f;
+                if (Y > maxY) contrib = mul3(contrib, maxY / (Y + 1e-6f));
+
+                ShadowRayCUDA& s = shadowQueue[queueAppend(&counters->shadows)];
+                s.path = pi;
+                s.ro = Poff;
+                s.dir = wiL;
+                s.contrib = mul3(T, contrib);
+            }
+        }
+
+        if (m.type == MAT_LAMBERT) {
+            rd = cosineSampleHemisphere(rng, N);
+            p.ro = Poff;
+            T  = mul3(T, m.albedo);
+        } else if (m.type == MAT_MIRROR) {
+            rd = reflect3(rd, N);
+            p.ro = Poff;
+            T  = mul3(T, m.albedo);
+        } else {
+            bool into = (dot3(p.n, rd) < 0.f);
+            float3 Nn = into ? p.n : mul3(p.n, -1.f);
+            float eta = into ? (1.f / fmaxf(m.eta, 1e-3f)) : fmaxf(m.eta, 1.0001f);
+            float cosi = -dot3(rd, Nn);
+            float3 wt;
+            float Fr = refract3(rd, Nn, eta, wt) ? schlick(fabsf(cosi), eta) : 1.f;
+            if (rng.f32() < Fr) {
+                rd = reflect3(rd, Nn);
+                p.ro = add3(P, mul3(Nn, 1e-3f));
+            } else {
+                rd = normalize3(wt);
+                p.ro = sub3(P, mul3(Nn, 1e-3f));
+            }
+            T  = mul3(T, m.albedo);
+        }
+
+        bool alive = depth + 1 < maxDepth;
+        if (alive && depth >= 3) {
+            float pr = fminf(fmaxf(T.x, fmaxf(T.y, T.z)), 0.99f);
+            if (rng.f32() > pr) alive = false;
+            else T = mul3(T, 1.0f/pr);
+        }
+
+        p.rd = rd;
+        p.T = T;
+        p.rng = rng.state;
+        if (alive) nextRayQueue[queueAppend(&counters->rays[parity ^ 1u])] = pi;
+    });
+}
+
+// any hit for every queued sun sample. a path has at most one per bounce, so L is written without atomics
+template <typename SceneT>
+__global__ void wavefront_shadow_kernel(
+    SceneT scene, PathStateCUDA* paths, const ShadowRayCUDA* shadowQueue, WavefrontCounters* counters)
+{
+    forEachQueued(&counters->work[2], counters->shadows, [&](uint32_t q) {
+        const ShadowRayCUDA s = shadowQueue[q];
+        if (!sceneOccluded(scene, s.ro, s.dir)) {
+            PathStateCUDA& p = paths[s.path];
+            p.L = add3(p.L, s.contrib);
+        }
+    });
+}
+
+__global__ void wavefront_finalize_kernel(uchar4* pixels, float4* accum, const PathStateCUDA* paths, int count) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count) return;
+    accumulatePixel(pixels, accum, i, paths[i].L);
+}
+
+// enough blocks to fill the device once, the persistent kernels loop over their queue themselves
+template <typename K>
+static int persistentBlocks(K kernel) {
+    static const int blocks = [kernel] {
+        int device = 0, sms = 0, perSm = 0;
+        cudaGetDevice(&device);
+        cudaDeviceGetAttribute(&sms, cudaDevAttrMultiProcessorCount, device);
+        cudaOccupancyMaxActiveBlocksPerMultiprocessor(&perSm, kernel, WAVEFRONT_BLOCK, 0);
+        return std::max(1, sms * perSm);
+    }();
+    return blocks;
+}
+
+__global__ void wavefront_reset_kernel(WavefrontCounters* counters, uint32_t parity) {
+    // the other ray queue is written by this bounce's shade stage, the current one is being read
+    counters->rays[parity ^ 1u] = 0u;
+    for (uint32_t b = 0; b < WAVEFRONT_BINS; ++b) counters->hits[b] = 0u;
+    counters->shadows = 0u;
+    for (uint32_t& w : counters->work) w = 0u;
 }
 
 // host-side helpers
@@ -422,18 +1363,401 @@ static MaterialCUDA makeLambert(float r, float g, float b) {
     return m;
 }
 
+// last uploaded scene and the device arrays holding it. the arrays only grow,
+// and nothing is copied unless the converted scene differs from what's already there
+template <typename T>
+struct DeviceArray {
+    std::vector<T> host;
+    T* device = nullptr;
+    size_t capacity = 0;
+
+    // false if it was already up to date
+    bool upload(const std::vector<T>& src, cudaStream_t stream) {
+        if (src.size() == host.size() && (src.empty() || std::memcmp(src.data(), host.data(), src.size() * sizeof(T)) == 0))
+            return false;
+        host = src;
+        if (host.size() > capacity) {
+            // anything still reading the old array is on the same stream
+            if (device) { cudaStreamSynchronize(stream); cudaFree(device); }
+            capacity = std::max<size_t>(host.size(), capacity * 2);
+            cudaMalloc(&device, capacity * sizeof(T));
+        }
+        // pageable source: the call has staged it by the time it returns, so host can change afterwards
+        if (!host.empty()) cudaMemcpyAsync(device, host.data(), host.size() * sizeof(T), cudaMemcpyHostToDevice, stream);
+        return true;
+    }
+
+    void release() {
+        if (device) cudaFree(device);
+        device = nullptr;
+        capacity = 0;
+        host.clear();
+    }
+};
+
+struct CudaTracer::DeviceScene {
+    DeviceArray<SphereCUDA> spheres; // leaf order of sphereBvh
+    DeviceArray<BvhNodeCUDA> sphereBvh;
+    DeviceArray<PlaneCUDA> planes;
+    DeviceArray<MaterialCUDA> materials;
+
+    // converted every frame (it's a handful of structs), compared against what the device has
+    std::vector<SphereCUDA> hSpheres;
+    std::vector<PlaneCUDA> hPlanes;
+    std::vector<MaterialCUDA> hMats;
+
+    // scene order spheres the bvh was last built from, the build only reruns when they change
+    std::vector<SphereCUDA> builtSpheres;
+    std::vector<SphereCUDA> hBvhSpheres;
+    std::vector<BvhNodeCUDA> hSphereBvh;
+
+    [[nodiscard]] SphereBvhCUDA sphereView() const {
+        return { spheres.device, sphereBvh.device, (int)sphereBvh.host.size() };
+    }
+};
+
+// grow-only device copy of one of the world heaps, the cuda side of Renderer::uploadSvoBuffers:
+// a grown allocation gets the old contents copied over on the device, then only the dirty ranges go up
+template <typename T>
+struct DeviceHeap {
+    T* device = nullptr;
+    size_t capacity = 0;
+    size_t count = 0;
+
+    // false if nothing was copied
+    bool upload(const void* src, size_t n, const std::vector<GpuRange>& dirty, cudaStream_t stream) {
+        const T* data = static_cast<const T*>(src);
+        if (!device) {
+            // brand new, nothing on the device to keep
+            if (n == 0) return false;
+            capacity = n;
+            count = n;
+            cudaMalloc(&device, capacity * sizeof(T));
+            cudaMemcpyAsync(device, data, n * sizeof(T), cudaMemcpyHostToDevice, stream);
+            return true;
+        }
+        if (n > capacity) {
+            T* grown = nullptr;
+            const size_t newCapacity = std::max(n, capacity * 2);
+            cudaMalloc(&grown, newCapacity * sizeof(T));
+            cudaMemcpyAsync(grown, device, count * sizeof(T), cudaMemcpyDeviceToDevice, stream);
+            // the copy and anything still reading the old heap are on the same stream
+            cudaStreamSynchronize(stream);
+            cudaFree(device);
+            device = grown;
+            capacity = newCapacity;
+        }
+        count = n;
+
+        bool copied = false;
+        for (const GpuRange& r : dirty) {
+            if (r.first >= n) continue;
+            const size_t c = std::min<size_t>(r.count, n - r.first);
+            cudaMemcpyAsync(device + r.first, data + r.first, c * sizeof(T), cudaMemcpyHostToDevice, stream);
+            copied = true;
+        }
+        return copied;
+    }
+
+    void release() {
+        if (device) cudaFree(device);
+        device = nullptr;
+        capacity = 0;
+        count = 0;
+    }
+};
+
+struct CudaTracer::DeviceWorld {
+    DeviceHeap<SvoNodeCUDA> nodes;
+    DeviceHeap<uint32_t> brickWords;
+    DeviceHeap<SubChunkCUDA> subChunks;
+    DeviceHeap<MaterialGpuCUDA> materials;
+
+    // top level, rebuilt on the host whenever a chunk was packed (WorldSvoGpu::packSerial moved)
+    DeviceArray<SvoInstanceCUDA> instances;
+    DeviceArray<SvoRefCUDA> refs;
+    DeviceArray<BvhNodeCUDA> bvh;
+    uint32_t packSerial = 0;
+    bool topLevelBuilt = false;
+
+    std::vector<SvoInstanceCUDA> hInstances;
+    std::vector<SvoRefCUDA> hRefs;
+    std::vector<BvhNodeCUDA> hBvh;
+
+    SvoWorldCUDA view() const {
+        SvoWorldCUDA w{};
+        w.nodes = nodes.device;
+        w.brickWords = brickWords.device;
+        w.subChunks = subChunks.device;
+        w.materials = materials.device;
+        w.numMaterials = (int)materials.count;
+        w.instances = instances.device;
+        w.refs = refs.device;
+        w.bvh = bvh.device;
+        w.numBvhNodes = (int)bvh.host.size();
+        return w;
+    }
+
+    void release() {
+        nodes.release();
+        brickWords.release();
+        subChunks.release();
+        materials.release();
+        instances.release();
+        refs.release();
+        bvh.release();
+        topLevelBuilt = false;
+    }
+};
+
+// queues and path state of the wavefront mode, one path per pixel
+struct CudaTracer::Wavefront {
+    PathStateCUDA* paths = nullptr;
+    uint32_t* rayQueues[2] = {};
+    uint32_t* hitQueue = nullptr; // WAVEFRONT_BINS sections of 'capacity'
+    ShadowRayCUDA* shadowQueue = nullptr;
+    WavefrontCounters* counters = nullptr;
+    uint32_t capacity = 0;
+
+    void ensure(uint32_t pixels, cudaStream_t stream) {
+        if (pixels <= capacity) return;
+        // the last frame's stages may still be using the old queues
+        cudaStreamSynchronize(stream);
+        release();
+        capacity = pixels;
+        cudaMalloc(&paths, sizeof(PathStateCUDA) * capacity);
+        cudaMalloc(&rayQueues[0], sizeof(uint32_t) * capacity);
+        cudaMalloc(&rayQueues[1], sizeof(uint32_t) * capacity);
+        cudaMalloc(&hitQueue, sizeof(uint32_t) * capacity * WAVEFRONT_BINS);
+        cudaMalloc(&shadowQueue, sizeof(ShadowRayCUDA) * capacity);
+        cudaMalloc(&counters, sizeof(WavefrontCounters));
+    }
+
+    void release() {
+        cudaFree(paths);
+        cudaFree(rayQueues[0]);
+        cudaFree(rayQueues[1]);
+        cudaFree(hitQueue);
+        cudaFree(shadowQueue);
+        cudaFree(counters);
+        *this = Wavefront{};
+    }
+
+    // everything is queued on the stream, the host never waits on a queue size
+    template <typename SceneT>
+    void trace(const SceneT& scene, uchar4* pixels, float4* accum, int width, int height,
+               const CameraCUDA& cam, int frameIndex, int maxDepth, cudaStream_t stream) {
+        const int count = width * height;
+        const int blocks = (count + WAVEFRONT_BLOCK - 1) / WAVEFRONT_BLOCK;
+        const int extendBlocks = persistentBlocks(wavefront_extend_kernel<SceneT>);
+        const int shadeBlocks = persistentBlocks(wavefront_shade_kernel<SceneT>);
+        const int shadowBlocks = persistentBlocks(wavefront_shadow_kernel<SceneT>);
+
+        // each sample is accumulated on its own, unlike the megakernel's per frame average
+        for (int s = 0; s < SPP_PER_FRAME; ++s) {
+            wavefront_generate_kernel<<<blocks, WAVEFRONT_BLOCK, 0, stream>>>(
+                paths, rayQueues[0], counters, width, height, cam, frameIndex, s);
+
+            for (int depth = 0; depth < maxDepth; ++depth) {
+                const uint32_t parity = (uint32_t)depth & 1u;
+                wavefront_reset_kernel<<<1, 1, 0, stream>>>(counters, parity);
+                wavefront_extend_kernel<<<extendBlocks, WAVEFRONT_BLOCK, 0, stream>>>(
+                    scene, paths, rayQueues[parity], hitQueue, counters, parity, capacity);
+                wavefront_shade_kernel<<<shadeBlocks, WAVEFRONT_BLOCK, 0, stream>>>(
+                    scene, paths, hitQueue, rayQueues[parity ^ 1u], shadowQueue, counters,
+                    parity, capacity, depth, maxDepth);
+                wavefront_shadow_kernel<<<shadowBlocks, WAVEFRONT_BLOCK, 0, stream>>>(
+                    scene, paths, shadowQueue, counters);
+            }
+
+            wavefront_finalize_kernel<<<blocks, WAVEFRONT_BLOCK, 0, stream>>>(pixels, accum, paths, count);
+        }
+    }
+};
+
+// the renderer's exported gbuffer slots + semaphore, imported once per ExternalTraceFrame::generation
+struct CudaTracer::VulkanTargets {
+    cudaExternalMemory_t memory[2] = {};
+    unsigned char* mapped[2] = {};
+    cudaExternalSemaphore_t traceDone = nullptr;
+    uint64_t generation = 0;
+    bool imported = false;
+
+    void release() {
+        for (int i = 0; i < 2; ++i) {
+            if (mapped[i]) cudaFree(mapped[i]);
+            if (memory[i]) cudaDestroyExternalMemory(memory[i]);
+            mapped[i] = nullptr;
+            memory[i] = nullptr;
+        }
+        if (traceDone) cudaDestroyExternalSemaphore(traceDone);
+        traceDone = nullptr;
+        imported = false;
+    }
+};
+
+namespace {
+
+// what buildBvh sorts: a primitive's bounds and its index in the caller's own array
+struct BvhBuildPrim {
+    glm::vec3 bmin;
+    glm::vec3 bmax;
+    glm::vec3 centroid;
+    uint32_t index;
+};
+
+constexpr uint32_t BVH_LEAF_SIZE = 4;
+constexpr int BVH_BINS = 12;
+
+float surfaceArea(const glm::vec3& bmin, const glm::vec3& bmax) {
+    const glm::vec3 e = glm::max(bmax - bmin, glm::vec3(0.0f));
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+// binned sah over centroids, fills nodes[index]. a node stays a leaf when no split beats intersecting all of it,
+// past BVH_LEAF_SIZE a degenerate split falls back to the median. the prims end up in leaf order
+void buildBvh(std::vector<BvhBuildPrim>& prims, uint32_t begin, uint32_t end,
+              std::vector<BvhNodeCUDA>& nodes, uint32_t index) {
+    glm::vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+    glm::vec3 cmin = bmin, cmax = bmax;
+    for (uint32_t i = begin; i < end; ++i) {
+        bmin = glm::min(bmin, prims[i].bmin);
+        bmax = glm::max(bmax, prims[i].bmax);
+        cmin = glm::min(cmin, prims[i].centroid);
+        cmax = glm::max(cmax, prims[i].centroid);
+    }
+
+    BvhNodeCUDA node{};
+    node.bmin = make_float3(bmin.x, bmin.y, bmin.z);
+    node.bmax = make_float3(bmax.x, bmax.y, bmax.z);
+    const uint32_t n = end - begin;
+
+    auto makeLeaf = [&] {
+        node.leftOrFirst = begin;
+        node.count = n;
+        nodes[index] = node;
+    };
+    if (n <= 1) { makeLeaf(); return; }
+
+    // cost in units of one primitive test, a node visit counts as one as well
+    int bestAxis = -1, bestSplit = 0;
+    float bestCost = std::numeric_limits<float>::max();
+    const float parentArea = surfaceArea(bmin, bmax);
+    for (int axis = 0; axis < 3; ++axis) {
+        const float lo = cmin[axis], extent = cmax[axis] - lo;
+        if (extent <= 0.0f) continue;
+
+        struct Bin { glm::vec3 bmin{std::numeric_limits<float>::max()}, bmax{-std::numeric_limits<float>::max()}; uint32_t count = 0; };
+        Bin bins[BVH_BINS];
+        const float scale = BVH_BINS / extent;
+        for (uint32_t i = begin; i < end; ++i) {
+            const int b = std::min(BVH_BINS - 1, (int)((prims[i].centroid[axis] - lo) * scale));
+            bins[b].bmin = glm::min(bins[b].bmin, prims[i].bmin);
+            bins[b].bmax = glm::max(bins[b].bmax, prims[i].bmax);
+            bins[b].count++;
+        }
+
+        // right to left sweep first, then the left side is grown while picking the split
+        float rightArea[BVH_BINS];
+        uint32_t rightCount[BVH_BINS];
+        Bin acc;
+        for (int b = BVH_BINS - 1; b > 0; --b) {
+            acc.bmin = glm::min(acc.bmin, bins[b].bmin);
+            acc.bmax = glm::max(acc.bmax, bins[b].bmax);
+            acc.count += bins[b].count;
+            rightArea[b] = acc.count ? surfaceArea(acc.bmin, acc.bmax) : 0.0f;
+            rightCount[b] = acc.count;
+        }
+        acc = Bin{};
+        for (int b = 0; b < BVH_BINS - 1; ++b) {
+            acc.bmin = glm::min(acc.bmin, bins[b].bmin);
+            acc.bmax = glm::max(acc.bmax, bins[b].bmax);
+            acc.count += bins[b].count;
+            if (acc.count == 0 || rightCount[b + 1] == 0) continue;
+            const float cost = surfaceArea(acc.bmin, acc.bmax) * acc.count + rightArea[b + 1] * rightCount[b + 1];
+            if (cost < bestCost) { bestCost = cost; bestAxis = axis; bestSplit = b + 1; }
+        }
+    }
+
+    uint32_t mid = begin;
+    if (bestAxis >= 0) {
+        const float leafCost = (float)n;
+        const float splitCost = 1.0f + (parentArea > 0.0f ? bestCost / parentArea : leafCost);
+        if (n <= BVH_LEAF_SIZE && splitCost >= leafCost) { makeLeaf(); return; }
+
+        const float lo = cmin[bestAxis], scale = BVH_BINS / (cmax[bestAxis] - lo);
+        mid = (uint32_t)(std::partition(prims.begin() + begin, prims.begin() + end,
+            [&](const BvhBuildPrim& p) {
+                return std::min(BVH_BINS - 1, (int)((p.centroid[bestAxis] - lo) * scale)) < bestSplit;
+            }) - prims.begin());
+    }
+    if (mid == begin || mid == end) {
+        // every centroid in one spot
+        if (n <= BVH_LEAF_SIZE) { makeLeaf(); return; }
+        mid = begin + n / 2;
+    }
+
+    // children sit next to each other, the node only stores the left one
+    node.leftOrFirst = static_cast<uint32_t>(nodes.size());
+    node.count = 0;
+    nodes[index] = node;
+    nodes.resize(nodes.size() + 2);
+    buildBvh(prims, begin, mid, nodes, node.leftOrFirst);
+    buildBvh(prims, mid, end, nodes, node.leftOrFirst + 1);
+}
+
+// rigid chunk placement, the same transform buildChunkTlas gives the chunk's tlas instance
+SvoInstanceCUDA makeSvoInstance(const glm::mat4& toWorld, const glm::vec3& chunkOrigin) {
+    const glm::vec3 o = glm::vec3(toWorld * glm::vec4(chunkOrigin, 1.0f));
+    SvoInstanceCUDA inst{};
+    for (int r = 0; r < 3; ++r) {
+        // the inverse of a rotation is its transpose: row r of it is column r of toWorld
+        const glm::vec3 col = glm::vec3(toWorld[r]);
+        inst.toLocal[r] = make_float4(col.x, col.y, col.z, -glm::dot(col, o));
+        inst.toWorld[r] = make_float4(toWorld[0][r], toWorld[1][r], toWorld[2][r], o[r]);
+    }
+    return inst;
+}
+
+}
+
 CudaTracer::CudaTracer(unsigned int width, unsigned int height)
     : m_width(width), m_height(height) {}
 
-void CudaTracer::init() {
-    glGenBuffers(1, &m_pbo);
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
-    glBufferData(GL_PIXEL_UNPACK_BUFFER,
-                 static_cast<GLsizeiptr>(m_width) * m_height * 4,
-                 nullptr, GL_DYNAMIC_DRAW);
+CudaTracer::~CudaTracer() {
+    cleanup();
+}
+
+void CudaTracer::createPbos() {
+    glGenBuffers(PBO_COUNT, m_pbo);
+    for (int i = 0; i < PBO_COUNT; ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER,
+                     static_cast<GLsizeiptr>(m_width) * m_height * 4,
+                     nullptr, GL_DYNAMIC_DRAW);
+        cudaGraphicsGLRegisterBuffer(&m_cudaPBO[i], m_pbo[i], cudaGraphicsMapFlagsWriteDiscard);
+    }
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_pboIndex = 0;
+    m_pboReady = false;
+}
+
+void CudaTracer::destroyPbos() {
+    for (int i = 0; i < PBO_COUNT; ++i) {
+        if (m_cudaPBO[i]) { cudaGraphicsUnregisterResource(m_cudaPBO[i]); m_cudaPBO[i] = nullptr; }
+    }
+    if (m_pbo[0]) { glDeleteBuffers(PBO_COUNT, m_pbo); }
+    for (auto& p : m_pbo) p = 0;
+    m_pboReady = false;
+}
+
+void CudaTracer::init() {
+    cudaStreamCreateWithFlags(&m_stream, cudaStreamNonBlocking);
+    m_scene = std::make_unique<DeviceScene>();
+    m_deviceWorld = std::make_unique<DeviceWorld>();
+    m_wavefront = std::make_unique<Wavefront>();
 
-    cudaGraphicsGLRegisterBuffer(&m_cudaPBO, m_pbo, cudaGraphicsMapFlagsWriteDiscard);
+    createPbos();
 
     glGenTextures(1, &m_glTex);
     glBindTexture(GL_TEXTURE_2D, m_glTex);
@@ -448,7 +1772,7 @@ void CudaTracer::init() {
     glBindTexture(GL_TEXTURE_2D, 0);
 
     cudaMalloc(&m_dAccum, sizeof(float4) * m_width * m_height);
-    cudaMemset(m_dAccum, 0, sizeof(float4) * m_width * m_height);
+    cudaMemsetAsync(m_dAccum, 0, sizeof(float4) * m_width * m_height, m_stream);
     m_frameIndex = 0;
     m_hasPrevCam = false;
 }
@@ -477,69 +1801,212 @@ static inline void cacheCam(CudaTracer::CamSig& dst, bool& hasPrev, const Camera
 
 void CudaTracer::resetAccum() {
     if (!m_dAccum) return;
-    cudaMemset(m_dAccum, 0, sizeof(float4) * m_width * m_height);
+    cudaMemsetAsync(m_dAccum, 0, sizeof(float4) * m_width * m_height, m_stream);
     m_frameIndex = 0;
 }
 
-void CudaTracer::drawFrame(Camera& cam, const Scene& scene) {
-    if (camChanged(m_prevCam, m_hasPrevCam, cam)) resetAccum();
-    cacheCam(m_prevCam, m_hasPrevCam, cam);
+void CudaTracer::uploadScene(const Scene& scene) {
+    DeviceScene& ds = *m_scene;
 
     // per-primitive lambert from scene colors
-    std::vector<MaterialCUDA> hMats;
-    hMats.reserve(scene.spheres.size() + scene.planes.size());
-
-    std::vector<SphereCUDA> hS;
-    hS.reserve(scene.spheres.size());
+    ds.hMats.clear();
+    ds.hSpheres.clear();
+    ds.hPlanes.clear();
     for (auto& s : scene.spheres) {
-        int matId = (int)hMats.size();
-        hMats.push_back(makeLambert((float)s.color.r, (float)s.color.g, (float)s.color.b));
-        hS.push_back(toDevice(s, matId));
+        int matId = (int)ds.hMats.size();
+        ds.hMats.push_back(makeLambert((float)s.color.r, (float)s.color.g, (float)s.color.b));
+        ds.hSpheres.push_back(toDevice(s, matId));
     }
-
-    std::vector<PlaneCUDA> hP;
-    hP.reserve(scene.planes.size());
     for (auto& p : scene.planes) {
-        int matId = (int)hMats.size();
-        hMats.push_back(makeLambert((float)p.color.r, (float)p.color.g, (float)p.color.b));
-        hP.push_back(toDevice(p, matId));
+        int matId = (int)ds.hMats.size();
+        ds.hMats.push_back(makeLambert((float)p.color.r, (float)p.color.g, (float)p.color.b));
+        ds.hPlanes.push_back(toDevice(p, matId));
+    }
+
+    // the spheres are moved into leaf order, so the bvh is only rebuilt when what the scene gave us changes
+    const bool spheresMoved = ds.hSpheres.size() != ds.builtSpheres.size() ||
+        (!ds.hSpheres.empty() && std::memcmp(ds.hSpheres.data(), ds.builtSpheres.data(), ds.hSpheres.size() * sizeof(SphereCUDA)) != 0);
+    if (spheresMoved) {
+        ds.builtSpheres = ds.hSpheres;
+        ds.hBvhSpheres.clear();
+        ds.hSphereBvh.clear();
+        if (!ds.hSpheres.empty()) {
+            std::vector<BvhBuildPrim> prims(ds.hSpheres.size());
+            for (size_t i = 0; i < prims.size(); ++i) {
+                const SphereCUDA& s = ds.hSpheres[i];
+                const glm::vec3 c(s.center.x, s.center.y, s.center.z);
+                const float r = std::fabs(s.radius);
+                prims[i] = { c - glm::vec3(r), c + glm::vec3(r), c, static_cast<uint32_t>(i) };
+            }
+            ds.hSphereBvh.reserve(2 * prims.size());
+            ds.hSphereBvh.resize(1);
+            buildBvh(prims, 0, static_cast<uint32_t>(prims.size()), ds.hSphereBvh, 0);
+            ds.hBvhSpheres.reserve(prims.size());
+            for (const BvhBuildPrim& prim : prims) ds.hBvhSpheres.push_back(ds.hSpheres[prim.index]);
+        }
+    }
+
+    bool changed = ds.spheres.upload(ds.hBvhSpheres, m_stream);
+    changed |= ds.sphereBvh.upload(ds.hSphereBvh, m_stream);
+    changed |= ds.planes.upload(ds.hPlanes, m_stream);
+    changed |= ds.materials.upload(ds.hMats, m_stream);
+    // the accumulated samples are of the old scene
+    if (changed && m_frameIndex > 0) resetAccum();
+}
+
+void CudaTracer::setWorld(WorldSvoGpu* world) {
+    if (world == m_world) return;
+    // a different world, nothing of the old one may survive on the device
+    if (m_stream) cudaStreamSynchronize(m_stream);
+    if (m_deviceWorld) m_deviceWorld->release();
+    m_world = world;
+    resetAccum();
+}
+
+void CudaTracer::uploadWorld() {
+    WorldSvoGpu& world = *m_world;
+    DeviceWorld& dw = *m_deviceWorld;
+
+    // nothing else uploads this world, so its dirty ranges are ours to consume
+    bool changed = dw.nodes.upload(world.globalNodes.data(), world.globalNodes.size(), world.dirtyNodeRanges, m_stream);
+    changed |= dw.brickWords.upload(world.globalBrickWords.data(), world.globalBrickWords.size(), world.dirtyBrickRanges, m_stream);
+    changed |= dw.subChunks.upload(world.globalSubChunks.data(), world.globalSubChunks.size(), world.dirtySubChunkRanges, m_stream);
+    changed |= dw.materials.upload(world.materials.data(), world.materials.size(), world.dirtyMaterialRanges, m_stream);
+    world.dirtyNodeRanges.clear();
+    world.dirtyBrickRanges.clear();
+    world.dirtySubChunkRanges.clear();
+    world.dirtyMaterialRanges.clear();
+
+    if (!dw.topLevelBuilt || dw.packSerial != world.packSerial) {
+        dw.topLevelBuilt = true;
+        dw.packSerial = world.packSerial;
+
+        // one instance per chunk placement, like buildChunkTlas, one prim per active sub-chunk in it
+        std::vector<BvhBuildPrim> prims;
+        std::vector<SvoRefCUDA> refs; // scene order, prims index into it
+        dw.hInstances.clear();
+        const uint32_t count = world.subChunksPerChunk;
+        auto addInstance = [&](const ChunkGpuRange& range, const glm::mat4& toWorld) {
+            const uint32_t instance = static_cast<uint32_t>(dw.hInstances.size());
+            dw.hInstances.push_back(makeSvoInstance(toWorld, range.origin));
+            const glm::mat3 rot(toWorld);
+            const glm::vec3 o = glm::vec3(toWorld * glm::vec4(range.origin, 1.0f));
+
+            for (uint32_t i = 0; i < count; ++i) {
+                const uint32_t subIndex = range.slot * count + i;
+                const SubChunkGpu& sub = world.globalSubChunks[subIndex];
+                if (sub.nodeCount == 0) continue;
+
+                BvhBuildPrim prim{};
+                prim.bmin = glm::vec3(std::numeric_limits<float>::max());
+                prim.bmax = glm::vec3(-std::numeric_limits<float>::max());
+                for (uint32_t k = 0; k < 8; ++k) {
+                    const glm::vec3 corner((k & 1u) ? sub.localMax.x : sub.localMin.x,
+                                           (k & 2u) ? sub.localMax.y : sub.localMin.y,
+                                           (k & 4u) ? sub.localMax.z : sub.localMin.z);
+                    const glm::vec3 p = rot * corner + o;
+                    prim.bmin = glm::min(prim.bmin, p);
+                    prim.bmax = glm::max(prim.bmax, p);
+                }
+                prim.centroid = (prim.bmin + prim.bmax) * 0.5f;
+                prim.index = static_cast<uint32_t>(refs.size());
+                prims.push_back(prim);
+                refs.push_back(SvoRefCUDA{ subIndex, instance });
+            }
+        };
+
+        for (const auto& kv : world.chunkRanges) {
+            // SvoBuilder wrote these on the vulkan device, the cpu heaps don't have them
+            if (kv.second.gpuBuilt) continue;
+
+            bool instanced = false;
+            for (const ChunkInstanceSet& set : world.instanceSets) {
+                if (!set.contains(kv.first)) continue;
+                for (const glm::mat4& m : set.transforms) addInstance(kv.second, m);
+                instanced = true;
+            }
+            if (!instanced) addInstance(kv.second, glm::mat4(1.0f));
+        }
+
+        dw.hBvh.clear();
+        if (!prims.empty()) {
+            dw.hBvh.resize(1);
+            dw.hBvh.reserve(2 * prims.size());
+            buildBvh(prims, 0, static_cast<uint32_t>(prims.size()), dw.hBvh, 0);
+        }
+        dw.hRefs.resize(prims.size());
+        for (size_t i = 0; i < prims.size(); ++i) dw.hRefs[i] = refs[prims[i].index];
+
+        changed |= dw.instances.upload(dw.hInstances, m_stream);
+        changed |= dw.refs.upload(dw.hRefs, m_stream);
+        changed |= dw.bvh.upload(dw.hBvh, m_stream);
     }
 
-    SphereCUDA*   dSpheres = nullptr;
-    PlaneCUDA*    dPlanes  = nullptr;
-    MaterialCUDA* dMats    = nullptr;
+    // the accumulated samples are of the old world
+    if (changed && m_frameIndex > 0) resetAccum();
+}
 
-    if (!hS.empty())   cudaMalloc(&dSpheres, hS.size() * sizeof(SphereCUDA));
-    if (!hP.empty())   cudaMalloc(&dPlanes,  hP.size() * sizeof(PlaneCUDA));
-    if (!hMats.empty())cudaMalloc(&dMats,    hMats.size() * sizeof(MaterialCUDA));
+void CudaTracer::drawFrame(Camera& cam, const Scene& scene) {
+    if (camChanged(m_prevCam, m_hasPrevCam, cam)) resetAccum();
+    cacheCam(m_prevCam, m_hasPrevCam, cam);
 
-    if (!hS.empty())   cudaMemcpy(dSpheres, hS.data(), hS.size()*sizeof(SphereCUDA), cudaMemcpyHostToDevice);
-    if (!hP.empty())   cudaMemcpy(dPlanes,  hP.data(), hP.size()*sizeof(PlaneCUDA),  cudaMemcpyHostToDevice);
-    if (!hMats.empty())cudaMemcpy(dMats,    hMats.data(), hMats.size()*sizeof(MaterialCUDA), cudaMemcpyHostToDevice);
+    if (m_world) uploadWorld();
+    else uploadScene(scene);
 
     CameraCUDA dCam = toDevice(cam, m_width, m_height);
 
+    // this frame goes into m_pbo[cur], the previous one is in m_pbo[prev]
+    const uint32_t cur = m_pboIndex;
+    const uint32_t prev = cur ^ 1u;
+
     uchar4* devPtr = nullptr; size_t size = 0;
-    cudaGraphicsMapResources(1, &m_cudaPBO, 0);
-    cudaGraphicsResourceGetMappedPointer((void**)&devPtr, &size, m_cudaPBO);
+    cudaGraphicsMapResources(1, &m_cudaPBO[cur], m_stream);
+    cudaGraphicsResourceGetMappedPointer((void**)&devPtr, &size, m_cudaPBO[cur]);
 
     dim3 block(16, 16);
     dim3 grid((m_width + 15) / 16, (m_height + 15) / 16);
 
     int maxDepth = 6;
-    pathtrace_kernel<<<grid, block>>>(
-        devPtr, m_dAccum,
-        (int)m_width, (int)m_height,
-        dCam,
-        dSpheres, (int)hS.size(),
-        dPlanes,  (int)hP.size(),
-        dMats,    (int)hMats.size(),
-        (int)m_frameIndex, maxDepth);
-
-    cudaDeviceSynchronize();
-    cudaGraphicsUnmapResources(1, &m_cudaPBO, 0);
-
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+    if (m_useWavefront) m_wavefront->ensure(m_width * m_height, m_stream);
+
+    if (m_world) {
+        const SvoWorldCUDA w = m_deviceWorld->view();
+
+        if (m_useWavefront) {
+            m_wavefront->trace(w, devPtr, m_dAccum, (int)m_width, (int)m_height, dCam, (int)m_frameIndex, maxDepth, m_stream);
+        } else {
+            svo_pathtrace_kernel<<<grid, block, 0, m_stream>>>(
+                devPtr, m_dAccum,
+                (int)m_width, (int)m_height,
+                dCam, w,
+                (int)m_frameIndex, maxDepth);
+        }
+    } else {
+        const DeviceScene& ds = *m_scene;
+        if (m_useWavefront) {
+            AnalyticSceneCUDA s{};
+            s.spheres = ds.sphereView();
+            s.planes = ds.planes.device;       s.numPlanes = (int)ds.planes.host.size();
+            s.materials = ds.materials.device; s.numMaterials = (int)ds.materials.host.size();
+            m_wavefront->trace(s, devPtr, m_dAccum, (int)m_width, (int)m_height, dCam, (int)m_frameIndex, maxDepth, m_stream);
+        } else {
+            pathtrace_kernel<<<grid, block, 0, m_stream>>>(
+                devPtr, m_dAccum,
+                (int)m_width, (int)m_height,
+                dCam,
+                ds.sphereView(),
+                ds.planes.device,  (int)ds.planes.host.size(),
+                ds.materials.device, (int)ds.materials.host.size(),
+                (int)m_frameIndex, maxDepth);
+        }
+    }
+
+    // no host sync: the unmap orders the kernel before any later gl use of this pbo
+    cudaGraphicsUnmapResources(1, &m_cudaPBO[cur], m_stream);
+
+    // gl uploads last frame's pbo while the kernel runs. the very first frame has nothing older, so it waits for its own
+    const uint32_t show = m_pboReady ? prev : cur;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[show]);
     glBindTexture(GL_TEXTURE_2D, m_glTex);
     glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
                     static_cast<GLsizei>(m_width),
@@ -547,10 +2014,108 @@ void CudaTracer::drawFrame(Camera& cam, const Scene& scene) {
                     GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-    if (dSpheres) cudaFree(dSpheres);
-    if (dPlanes)  cudaFree(dPlanes);
-    if (dMats)    cudaFree(dMats);
+    m_pboReady = true;
+    m_pboIndex = prev;
+    ++m_frameIndex;
+}
+
+void CudaTracer::importVulkan(const ExternalTraceFrame& frame) {
+    // the renderer went idle before it made new targets, so only our own stream can still touch the old ones
+    cudaStreamSynchronize(m_stream);
+    VulkanTargets& vk = *m_vulkan;
+    vk.release();
+
+    for (int i = 0; i < 2; ++i) {
+        const ExternalTraceFrame::Slot& slot = frame.slots[i];
+        cudaExternalMemoryHandleDesc desc{};
+#ifdef _WIN32
+        desc.type = cudaExternalMemoryHandleTypeOpaqueWin32;
+        desc.handle.win32.handle = slot.memory;
+#else
+        desc.type = cudaExternalMemoryHandleTypeOpaqueFd;
+        desc.handle.fd = slot.memory;
+#endif
+        desc.size = slot.size;
+        desc.flags = cudaExternalMemoryDedicated;
+        if (cudaImportExternalMemory(&vk.memory[i], &desc) != cudaSuccess)
+            throw std::runtime_error("CudaTracer: importing the vulkan gbuffer failed");
+
+        cudaExternalMemoryBufferDesc buf{};
+        buf.offset = 0;
+        buf.size = slot.size;
+        if (cudaExternalMemoryGetMappedBuffer(reinterpret_cast<void**>(&vk.mapped[i]), vk.memory[i], &buf) != cudaSuccess)
+            throw std::runtime_error("CudaTracer: mapping the vulkan gbuffer failed");
+    }
+
+    cudaExternalSemaphoreHandleDesc sem{};
+#ifdef _WIN32
+    sem.type = cudaExternalSemaphoreHandleTypeTimelineSemaphoreWin32;
+    sem.handle.win32.handle = frame.traceDone;
+#else
+    sem.type = cudaExternalSemaphoreHandleTypeTimelineSemaphoreFd;
+    sem.handle.fd = frame.traceDone;
+#endif
+    if (cudaImportExternalSemaphore(&vk.traceDone, &sem) != cudaSuccess)
+        throw std::runtime_error("CudaTracer: importing the vulkan semaphore failed");
+
+    vk.generation = frame.generation;
+    vk.imported = true;
+}
+
+void CudaTracer::traceToVulkan(const ExternalTraceFrame& frame) {
+    if (!m_stream) {
+        // the cuda device the renderer runs on, the memory can't be imported anywhere else
+        int count = 0;
+        cudaGetDeviceCount(&count);
+        for (int i = 0; i < count; ++i) {
+            cudaDeviceProp props{};
+            cudaGetDeviceProperties(&props, i);
+            if (std::memcmp(props.uuid.bytes, frame.deviceUuid, sizeof(props.uuid.bytes)) == 0) {
+                cudaSetDevice(i);
+                break;
+            }
+        }
+        cudaStreamCreateWithFlags(&m_stream, cudaStreamNonBlocking);
+        m_deviceWorld = std::make_unique<DeviceWorld>();
+        m_vulkan = std::make_unique<VulkanTargets>();
+    }
+    if (!m_vulkan->imported || m_vulkan->generation != frame.generation) importVulkan(frame);
+
+    // no world is an empty one, every pixel sees the sky
+    if (m_world) uploadWorld();
+    const SvoWorldCUDA w = m_world ? m_deviceWorld->view() : SvoWorldCUDA{};
+
+    const ExternalTraceFrame::Slot& slot = frame.slots[frame.slot];
+    unsigned char* base = m_vulkan->mapped[frame.slot];
+    GBufferCUDA out{};
+#ifdef BLOK_COMPACT_GBUFFER
+    out.color = reinterpret_cast<ushort4*>(base + slot.colorOffset);
+    out.depth = reinterpret_cast<float*>(base + slot.positionOffset);
+    out.normalRoughness = reinterpret_cast<uint32_t*>(base + slot.normalOffset);
+#else
+    out.color = reinterpret_cast<float4*>(base + slot.colorOffset);
+    out.position = reinterpret_cast<float4*>(base + slot.positionOffset);
+    out.normalRoughness = reinterpret_cast<ushort4*>(base + slot.normalOffset);
+#endif
+    out.albedoMetallic = reinterpret_cast<uchar4*>(base + slot.albedoOffset);
+    out.motion = reinterpret_cast<ushort2*>(base + slot.motionOffset);
+
+    FrameCUDA f{};
+    static_assert(sizeof(glm::mat4) == sizeof(f.invView), "glm::mat4 is four float4 columns");
+    std::memcpy(f.invView, &frame.ubo->invView, sizeof(f.invView));
+    std::memcpy(f.invProj, &frame.ubo->invProj, sizeof(f.invProj));
+    std::memcpy(f.prevViewProj, &frame.ubo->prevViewProj, sizeof(f.prevViewProj));
+    f.camPos = make_float3(frame.ubo->camPos.x, frame.ubo->camPos.y, frame.ubo->camPos.z);
+    f.frameCount = frame.ubo->frame_count;
+
+    dim3 block(16, 16);
+    dim3 grid((frame.width + 15) / 16, (frame.height + 15) / 16);
+    svo_gbuffer_kernel<<<grid, block, 0, m_stream>>>(out, (int)frame.width, (int)frame.height, f, w, 6);
 
+    // the renderer's copy of this slot waits on this value
+    cudaExternalSemaphoreSignalParams signal{};
+    signal.params.fence.value = frame.value;
+    cudaSignalExternalSemaphoresAsync(&m_vulkan->traceDone, &signal, 1, m_stream);
     ++m_frameIndex;
 }
 
@@ -561,15 +2126,12 @@ void CudaTracer::resize(unsigned int w, unsigned int h) {
     if (w == 0 || h == 0) return;
     m_width = w; m_height = h;
 
-    if (m_cudaPBO) { cudaGraphicsUnregisterResource(m_cudaPBO); m_cudaPBO = nullptr; }
+    // the kernel of the last frame may still be writing
+    if (m_stream) cudaStreamSynchronize(m_stream);
+
+    destroyPbos();
+    createPbos();
 
-    if (m_pbo) {
-        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
-        glBufferData(GL_PIXEL_UNPACK_BUFFER,
-                     static_cast<GLsizeiptr>(m_width) * m_height * 4,
-                     nullptr, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-    }
     if (m_glTex) {
         glBindTexture(GL_TEXTURE_2D, m_glTex);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
@@ -578,11 +2140,9 @@ void CudaTracer::resize(unsigned int w, unsigned int h) {
                      0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     }
 
-    cudaGraphicsGLRegisterBuffer(&m_cudaPBO, m_pbo, cudaGraphicsMapFlagsWriteDiscard);
-
     if (m_dAccum) { cudaFree(m_dAccum); m_dAccum = nullptr; }
     cudaMalloc(&m_dAccum, sizeof(float4) * m_width * m_height);
-    cudaMemset(m_dAccum, 0, sizeof(float4) * m_width * m_height);
+    cudaMemsetAsync(m_dAccum, 0, sizeof(float4) * m_width * m_height, m_stream);
     m_frameIndex = 0;
 }
 
@@ -591,12 +2151,31 @@ void CudaTracer::shutdown() {
 }
 
 void CudaTracer::cleanup() {
-    if (m_cudaPBO) {
-        cudaGraphicsUnregisterResource(m_cudaPBO);
-        m_cudaPBO = nullptr;
-    }
-    if (m_pbo) { glDeleteBuffers(1, &m_pbo); m_pbo = 0; }
+    if (m_stream) cudaStreamSynchronize(m_stream);
+
+    destroyPbos();
     if (m_glTex) { glDeleteTextures(1, &m_glTex); m_glTex = 0; }
     if (m_dAccum) { cudaFree(m_dAccum); m_dAccum = nullptr; }
+    if (m_scene) {
+        m_scene->spheres.release();
+        m_scene->sphereBvh.release();
+        m_scene->builtSpheres.clear();
+        m_scene->planes.release();
+        m_scene->materials.release();
+        m_scene.reset();
+    }
+    if (m_deviceWorld) {
+        m_deviceWorld->release();
+        m_deviceWorld.reset();
+    }
+    if (m_wavefront) {
+        m_wavefront->release();
+        m_wavefront.reset();
+    }
+    if (m_vulkan) {
+        m_vulkan->release();
+        m_vulkan.reset();
+    }
+    if (m_stream) { cudaStreamDestroy(m_stream); m_stream = nullptr; }
     m_frameIndex = 0; m_hasPrevCam = false;
 }
@@ -6,6 +6,8 @@
 */
 #include "descriptors.hpp"
 
+#include <algorithm>
+
 namespace blok {
 
 void DescriptorAllocatorGrowable::init(vk::Device device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios) {
@@ -160,4 +162,11 @@ void DescriptorWriter::updateSet(vk::Device device, vk::DescriptorSet set) {
     device.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
+bool DescriptorSetKey::changed(std::initializer_list<uint64_t> now) {
+    if (values.size() == now.size() && std::equal(now.begin(), now.end(), values.begin()))
+        return false;
+    values.assign(now.begin(), now.end());
+    return true;
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+/*
+* File: dynamic_resolution.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "dynamic_resolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace blok {
+
+bool DynamicResolution::update(float gpuMs) {
+    // smoothed so a single spike doesn't trigger a reallocation
+    m_averageMs = m_averageMs > 0.0f ? m_averageMs + (gpuMs - m_averageMs) * 0.1f : gpuMs;
+    if (!settings.enabled) return reset();
+
+    if (m_cooldown > 0) {
+        m_cooldown--;
+        return false;
+    }
+
+    // pixel count goes with scale^2, so does most of the frame
+    float wanted = m_scale;
+    if (m_averageMs > settings.targetMs || m_averageMs < settings.targetMs * settings.headroom) {
+        wanted = m_scale * std::sqrt(settings.targetMs / std::max(m_averageMs, 0.01f));
+    }
+
+    const float step = std::max(settings.step, 0.01f);
+    wanted = std::round(wanted / step) * step;
+    wanted = std::clamp(wanted, settings.minScale, settings.maxScale);
+    if (std::abs(wanted - m_scale) < step * 0.5f) return false;
+
+    m_scale = wanted;
+    m_cooldown = settings.cooldownFrames;
+    return true;
+}
+
+bool DynamicResolution::reset() {
+    const float scale = settings.enabled ? settings.maxScale : settings.baseScale;
+    if (m_scale == scale) return false;
+    m_scale = scale;
+    m_cooldown = settings.cooldownFrames;
+    return true;
+}
+
+vk::Extent2D DynamicResolution::renderExtent(vk::Extent2D output) const {
+    return {
+        std::max(1u, static_cast<uint32_t>(std::lround(static_cast<float>(output.width) * m_scale))),
+        std::max(1u, static_cast<uint32_t>(std::lround(static_cast<float>(output.height) * m_scale)))
+    };
+}
+
+}
@@ -0,0 +1,148 @@
+/*
+* File: emissive_lights.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+#include "material.hpp"
+
+#include <algorithm>
+#include <string>
+
+namespace blok {
+
+namespace {
+
+// past this the weakest lights are dropped. their bsdf hits still get a light pdf in raygen,
+// so a world this bright comes out a little dark around its dimmest lamps
+constexpr size_t MAX_EMISSIVE_LIGHTS = 1u << 18;
+
+// emitted luminance of what MaterialGpu::pack writes, 0 for anything raygen's isEmissive rejects
+float emissiveWeight(const Material* mat) {
+    if (!mat) return 0.0f;
+    const glm::vec3 e = mat->emission * mat->emissionPower;
+    if (e.x + e.y + e.z <= 0.01f) return 0.0f;
+    return glm::dot(e, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// outside the chunk counts as open, the neighbour chunk isn't looked at
+bool filled(const ChunkStorage& storage, int x, int y, int z) {
+    const int C = static_cast<int>(storage.size());
+    if (x < 0 || y < 0 || z < 0 || x >= C || y >= C || z >= C) return false;
+    return storage.density(x, y, z) > 0.0f;
+}
+
+void gatherChunk(const ChunkStorage& storage, const MaterialLibrary& lib, float voxelSize, std::vector<EmissiveVoxel>& out) {
+    out.clear();
+    const uint32_t shift = storage.brickShift();
+    const uint32_t B = storage.brickSize();
+    const uint32_t mask = B - 1u;
+    const uint32_t perAxis = storage.bricksPerAxis();
+
+    for (uint32_t bz = 0; bz < perAxis; ++bz)
+        for (uint32_t by = 0; by < perAxis; ++by)
+            for (uint32_t bx = 0; bx < perAxis; ++bx) {
+                const ChunkStorage::Brick* brick = storage.brick(bx, by, bz);
+                if (!brick) continue;
+
+                for (uint32_t i = 0; i < B * B * B; ++i) {
+                    if (brick->density[i] == 0) continue;
+                    const uint32_t materialId = storage.paletteMaterial(brick->material[i]);
+                    if (emissiveWeight(lib.getMaterial(materialId)) <= 0.0f) continue;
+
+                    const int x = static_cast<int>(bx * B + (i & mask));
+                    const int y = static_cast<int>(by * B + ((i >> shift) & mask));
+                    const int z = static_cast<int>(bz * B + (i >> (2 * shift)));
+
+                    // enclosed voxels can't light anything, a sample on them is always shadowed
+                    if (filled(storage, x - 1, y, z) && filled(storage, x + 1, y, z) &&
+                        filled(storage, x, y - 1, z) && filled(storage, x, y + 1, z) &&
+                        filled(storage, x, y, z - 1) && filled(storage, x, y, z + 1))
+                        continue;
+
+                    out.push_back({(glm::vec3(x, y, z) + 0.5f) * voxelSize, materialId});
+                }
+            }
+}
+
+}
+
+void gatherEmissiveLights(const ChunkManager& mgr, WorldSvoGpu& gpuWorld) {
+    BLOK_PROFILE_NAMED(timer, "gatherEmissiveLights");
+    if (!mgr.materialLib) return;
+
+    bool changed = false;
+    for (auto it = gpuWorld.chunkLights.begin(); it != gpuWorld.chunkLights.end();) {
+        if (gpuWorld.chunkRanges.count(it->first)) { ++it; continue; }
+        it = gpuWorld.chunkLights.erase(it);
+        changed = true;
+    }
+
+    for (const auto& kv : gpuWorld.chunkRanges) {
+        const Chunk* ch = mgr.packedChunk(kv.first);
+        if (!ch) continue;
+
+        auto [it, isNew] = gpuWorld.chunkLights.try_emplace(kv.first);
+        if (!isNew && it->second.svoVersion == ch->svoVersion) continue;
+
+        it->second.svoVersion = ch->svoVersion;
+        // lod chunks give one light per coarse voxel, sampled with the full res voxel's size
+        gatherChunk(ch->voxels, *mgr.materialLib, ch->svo.voxelSize, it->second.voxels);
+        changed = true;
+    }
+    if (!changed) return;
+
+    // pmf holds the raw weight until the total is known
+    std::vector<EmissiveLightGpu>& lights = gpuWorld.lights;
+    lights.clear();
+    auto emit = [&](const glm::vec3& center, uint32_t materialId) {
+        EmissiveLightGpu light{};
+        light.center = center;
+        light.materialId = materialId;
+        light.pmf = emissiveWeight(mgr.materialLib->getMaterial(materialId));
+        lights.push_back(light);
+    };
+
+    for (const auto& kv : gpuWorld.chunkLights) {
+        if (kv.second.voxels.empty()) continue;
+        const glm::vec3 origin = gpuWorld.chunkRanges.at(kv.first).origin;
+
+        const ChunkInstanceSet* set = nullptr;
+        for (const ChunkInstanceSet& s : gpuWorld.instanceSets)
+            if (s.contains(kv.first)) { set = &s; break; }
+
+        for (const EmissiveVoxel& v : kv.second.voxels) {
+            const glm::vec3 p = origin + v.center;
+            if (!set) { emit(p, v.materialId); continue; }
+            for (const glm::mat4& t : set->transforms) emit(glm::vec3(t * glm::vec4(p, 1.0f)), v.materialId);
+        }
+    }
+
+    if (lights.size() > MAX_EMISSIVE_LIGHTS) {
+        std::nth_element(lights.begin(), lights.begin() + MAX_EMISSIVE_LIGHTS, lights.end(),
+            [](const EmissiveLightGpu& a, const EmissiveLightGpu& b) { return a.pmf > b.pmf; });
+        lights.resize(MAX_EMISSIVE_LIGHTS);
+    }
+
+    float total = 0.0f;
+    for (const EmissiveLightGpu& l : lights) total += l.pmf;
+
+    float cdf = 0.0f;
+    for (EmissiveLightGpu& l : lights) {
+        l.pmf /= total;
+        cdf += l.pmf;
+        l.cdf = cdf;
+    }
+    if (!lights.empty()) lights.back().cdf = 1.0f; // rounding, a sample of 1 has to land somewhere
+
+    gpuWorld.lightHeader.count = static_cast<uint32_t>(lights.size());
+    gpuWorld.lightHeader.totalWeight = total;
+    gpuWorld.lightHeader.voxelSize = mgr.voxelSize;
+    gpuWorld.lightsDirty = true;
+
+    BLOK_PROFILE_DETAIL(timer, std::to_string(lights.size()) + " voxels (total weight " + std::to_string(total) + ")");
+}
+
+}
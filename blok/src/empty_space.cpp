@@ -0,0 +1,128 @@
+/*
+* File: empty_space.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+
+#include <algorithm>
+#include <string>
+
+namespace blok {
+
+namespace {
+
+// the field is a byte per cell, anything further counts as this far
+constexpr uint8_t FAR_CELL = 255;
+
+// chessboard distance (in storage bricks) from every brick to the nearest allocated one. a 26 neighbour chamfer with
+// unit weights is exact for it in one forward and one backward sweep. outside the chunk counts as empty, the rays
+// there are in another instance
+void distanceField(const ChunkStorage& storage, std::vector<uint8_t>& out) {
+    const int n = static_cast<int>(storage.bricksPerAxis());
+    out.assign(size_t(n) * n * n, FAR_CELL);
+    auto index = [n](int x, int y, int z) { return size_t(x) + size_t(y) * n + size_t(z) * n * n; };
+
+    for (int z = 0; z < n; ++z)
+        for (int y = 0; y < n; ++y)
+            for (int x = 0; x < n; ++x)
+                if (storage.brick(x, y, z)) out[index(x, y, z)] = 0;
+
+    auto sweep = [&](int x, int y, int z, int dir) {
+        uint8_t& d = out[index(x, y, z)];
+        if (d == 0) return;
+        for (int dz = -1; dz <= 1; ++dz)
+            for (int dy = -1; dy <= 1; ++dy)
+                for (int dx = -1; dx <= 1; ++dx) {
+                    // only the half of the neighbourhood this sweep has already visited
+                    const int order = dz != 0 ? dz : dy != 0 ? dy : dx;
+                    if (order != dir) continue;
+                    const int nx = x + dx, ny = y + dy, nz = z + dz;
+                    if (nx < 0 || ny < 0 || nz < 0 || nx >= n || ny >= n || nz >= n) continue;
+                    const uint8_t via = out[index(nx, ny, nz)];
+                    if (via < FAR_CELL) d = std::min<uint8_t>(d, via + 1);
+                }
+    };
+
+    for (int z = 0; z < n; ++z)
+        for (int y = 0; y < n; ++y)
+            for (int x = 0; x < n; ++x) sweep(x, y, z, -1);
+    for (int z = n - 1; z >= 0; --z)
+        for (int y = n - 1; y >= 0; --y)
+            for (int x = n - 1; x >= 0; --x) sweep(x, y, z, 1);
+}
+
+}
+
+void buildEmptySpaceField(const ChunkManager& mgr, WorldSvoGpu& gpuWorld) {
+    BLOK_PROFILE_NAMED(timer, "buildEmptySpaceField");
+
+    bool changed = false;
+    for (auto it = gpuWorld.chunkDistanceFields.begin(); it != gpuWorld.chunkDistanceFields.end();) {
+        if (gpuWorld.chunkRanges.count(it->first)) { ++it; continue; }
+        it = gpuWorld.chunkDistanceFields.erase(it);
+        changed = true;
+    }
+
+    uint32_t cellsPerAxis = 0;
+    uint32_t brickSize = 0;
+    for (const auto& kv : gpuWorld.chunkRanges) {
+        // lod chunks have fewer, bigger bricks than the field's cells. they get none and are traversed from their first node
+        const Chunk* ch = mgr.packedChunk(kv.first);
+        if (!ch) continue;
+        if (ch->lod > 0) {
+            if (gpuWorld.chunkDistanceFields.erase(kv.first)) changed = true;
+            continue;
+        }
+        cellsPerAxis = ch->voxels.bricksPerAxis();
+        brickSize = ch->voxels.brickSize();
+
+        // same key as the surface mesh, flushGpuBrushes moves the voxels without a new svo. a chunk with gpu only
+        // brushes has geometry the cpu voxels don't, it gets no field and is traversed from its first node
+        auto [it, isNew] = gpuWorld.chunkDistanceFields.try_emplace(kv.first);
+        const bool usable = ch->gpuBrushes.empty();
+        if (!isNew && it->second.svoVersion == ch->svoVersion && it->second.editCount == ch->voxels.editCount() &&
+            it->second.valid == usable)
+            continue;
+
+        it->second.svoVersion = ch->svoVersion;
+        it->second.editCount = ch->voxels.editCount();
+        it->second.valid = usable;
+        if (usable) distanceField(ch->voxels, it->second.cells);
+        else it->second.cells.clear();
+        changed = true;
+    }
+
+    // the slot count follows globalSubChunks, a grown world needs room for its new slots even with nothing changed
+    const uint32_t slots = gpuWorld.subChunksPerChunk ? static_cast<uint32_t>(gpuWorld.globalSubChunks.size() / gpuWorld.subChunksPerChunk) : 0u;
+    const uint32_t wordsPerChunk = (cellsPerAxis * cellsPerAxis * cellsPerAxis + 3u) / 4u;
+    if (!changed && gpuWorld.emptySpaceWords.size() == size_t(slots) * wordsPerChunk) return;
+
+    // 0 everywhere a chunk has no field, the trace then starts at the first node as before
+    EmptySpaceHeader& header = gpuWorld.emptySpaceHeader;
+    header.cellsPerAxis = cellsPerAxis;
+    header.wordsPerChunk = wordsPerChunk;
+    header.cellSize = static_cast<float>(brickSize) * mgr.voxelSize;
+    header.subChunksPerChunk = gpuWorld.subChunksPerChunk;
+
+    std::vector<uint32_t>& words = gpuWorld.emptySpaceWords;
+    words.assign(size_t(slots) * wordsPerChunk, 0u);
+    size_t skippable = 0;
+    for (const auto& kv : gpuWorld.chunkDistanceFields) {
+        const std::vector<uint8_t>& cells = kv.second.cells;
+        if (!kv.second.valid || cells.size() != size_t(cellsPerAxis) * cellsPerAxis * cellsPerAxis) continue;
+
+        uint32_t* block = words.data() + size_t(gpuWorld.chunkRanges.at(kv.first).slot) * wordsPerChunk;
+        for (size_t c = 0; c < cells.size(); ++c) {
+            block[c >> 2] |= uint32_t(cells[c]) << ((c & 3u) * 8u);
+            if (cells[c] > 0) skippable++;
+        }
+    }
+
+    gpuWorld.emptySpaceDirty = true;
+    BLOK_PROFILE_DETAIL(timer, std::to_string(gpuWorld.chunkDistanceFields.size()) + " chunks, " + std::to_string(skippable) + " empty bricks");
+}
+
+}
@@ -0,0 +1,185 @@
+/*
+* File: environment_map.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "environment_map.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "offline_render.hpp"
+
+namespace blok {
+
+static bool loadRadianceHdr(const std::string& path, EnvironmentMap& out, std::string* err) {
+    auto fail = [&](const char* what) {
+        if (err) *err = what;
+        return false;
+    };
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return fail("can't open file");
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // header lines up to an empty one, then the resolution line
+    size_t p = 0;
+    auto readLine = [&](std::string& line) {
+        const auto end = std::find(data.begin() + static_cast<std::ptrdiff_t>(p), data.end(), '\n');
+        if (end == data.end()) return false;
+        line.assign(data.begin() + static_cast<std::ptrdiff_t>(p), end);
+        p = static_cast<size_t>(end - data.begin()) + 1;
+        return true;
+    };
+    std::string line;
+    if (!readLine(line) || line.rfind("#?", 0) != 0) return fail("not a radiance hdr");
+    for (;;) {
+        if (!readLine(line)) return fail("truncated header");
+        if (line.empty()) break;
+        if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe") return fail("only rgbe hdrs are supported");
+    }
+    if (!readLine(line)) return fail("truncated header");
+    std::istringstream res(line);
+    std::string yAxis, xAxis;
+    int64_t h = 0, w = 0;
+    if (!(res >> yAxis >> h >> xAxis >> w) || yAxis != "-Y" || xAxis != "+X") return fail("only -Y H +X W hdrs are supported");
+    if (w <= 0 || h <= 0 || w > 65536 || h > 65536) return fail("bad resolution");
+
+    const uint32_t width = static_cast<uint32_t>(w);
+    const uint32_t height = static_cast<uint32_t>(h);
+    std::vector<uint8_t> scan(static_cast<size_t>(width) * 4);
+    out.width = width;
+    out.height = height;
+    out.radiance.resize(static_cast<size_t>(width) * height);
+
+    for (uint32_t y = 0; y < height; ++y) {
+        // new style rle: 2 2 hi lo, then each channel of the row as runs. anything else is a flat row
+        if (width >= 8 && width < 0x8000 && p + 4 <= data.size() && data[p] == 2 && data[p + 1] == 2 &&
+            ((data[p + 2] << 8) | data[p + 3]) == static_cast<int>(width)) {
+            p += 4;
+            for (uint32_t c = 0; c < 4; ++c) {
+                uint32_t x = 0;
+                while (x < width) {
+                    if (p >= data.size()) return fail("truncated scanline");
+                    uint32_t count = data[p++];
+                    if (count > 128) {
+                        count -= 128;
+                        if (count > width - x || p >= data.size()) return fail("bad scanline run");
+                        for (uint32_t i = 0; i < count; ++i) scan[(x++) * 4 + c] = data[p];
+                        p++;
+                    } else {
+                        if (count == 0 || count > width - x || p + count > data.size()) return fail("bad scanline run");
+                        for (uint32_t i = 0; i < count; ++i) scan[(x++) * 4 + c] = data[p++];
+                    }
+                }
+            }
+        } else {
+            if (p + scan.size() > data.size()) return fail("truncated scanline");
+            // the old 1 1 1 n repeat encoding isn't written by anything current
+            if (data[p] == 1 && data[p + 1] == 1 && data[p + 2] == 1) return fail("old style rle hdrs aren't supported");
+            std::memcpy(scan.data(), data.data() + p, scan.size());
+            p += scan.size();
+        }
+
+        for (uint32_t x = 0; x < width; ++x) {
+            const uint8_t* rgbe = &scan[x * 4];
+            glm::vec3& texel = out.radiance[static_cast<size_t>(y) * width + x];
+            if (rgbe[3] == 0) {
+                texel = glm::vec3(0.0f);
+                continue;
+            }
+            const float f = std::ldexp(1.0f, static_cast<int>(rgbe[3]) - (128 + 8));
+            texel = glm::vec3(rgbe[0] + 0.5f, rgbe[1] + 0.5f, rgbe[2] + 0.5f) * f;
+        }
+    }
+    return true;
+}
+
+bool loadEnvironmentMap(const std::string& path, EnvironmentMap& out, std::string* err) {
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    EnvironmentMap env;
+    if (ext == ".exr") {
+        std::vector<float> rgba;
+        if (!readExr(path, env.width, env.height, rgba, err)) return false;
+        env.radiance.resize(static_cast<size_t>(env.width) * env.height);
+        for (size_t i = 0; i < env.radiance.size(); ++i)
+            env.radiance[i] = glm::vec3(rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2]);
+    } else if (!loadRadianceHdr(path, env, err)) {
+        return false;
+    }
+
+    // nan/inf/negative texels would poison the alias table and every pixel that samples them
+    for (glm::vec3& c : env.radiance)
+        for (int i = 0; i < 3; ++i)
+            if (!std::isfinite(c[i]) || c[i] < 0.0f) c[i] = 0.0f;
+
+    if (env.empty()) {
+        if (err) *err = "empty image";
+        return false;
+    }
+    out = std::move(env);
+    return true;
+}
+
+void buildEnvironmentTexels(const EnvironmentMap& env, std::vector<EnvironmentTexelGpu>& out) {
+    const size_t n = static_cast<size_t>(env.width) * env.height;
+    out.assign(n, EnvironmentTexelGpu{});
+    if (n == 0) return;
+
+    // luminance times the solid angle of the row, a black map falls back to uniform over the sphere
+    std::vector<double> weight(n);
+    double total = 0.0;
+    for (uint32_t y = 0; y < env.height; ++y) {
+        const double sinTheta = std::sin((y + 0.5) * 3.14159265358979323846 / env.height);
+        for (uint32_t x = 0; x < env.width; ++x) {
+            const size_t i = static_cast<size_t>(y) * env.width + x;
+            const glm::vec3& c = env.radiance[i];
+            weight[i] = (0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b) * sinTheta;
+            total += weight[i];
+        }
+    }
+    if (!(total > 0.0)) {
+        total = 0.0;
+        for (uint32_t y = 0; y < env.height; ++y) {
+            const double sinTheta = std::sin((y + 0.5) * 3.14159265358979323846 / env.height);
+            for (uint32_t x = 0; x < env.width; ++x) weight[static_cast<size_t>(y) * env.width + x] = sinTheta;
+            total += sinTheta * env.width;
+        }
+    }
+
+    // vose's alias method: every bucket holds 1/n of the mass, its own texel's share up to prob and the alias's after
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+        out[i].radiance = env.radiance[i];
+        out[i].pmf = static_cast<float>(weight[i] / total);
+        out[i].alias = static_cast<uint32_t>(i);
+        scaled[i] = weight[i] / total * static_cast<double>(n);
+        (scaled[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+    while (!small.empty() && !large.empty()) {
+        const uint32_t s = small.back();
+        small.pop_back();
+        const uint32_t l = large.back();
+        out[s].prob = static_cast<float>(scaled[s]);
+        out[s].alias = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // what's left is 1 up to rounding
+    for (uint32_t i : large) out[i].prob = 1.0f;
+    for (uint32_t i : small) out[i].prob = 1.0f;
+}
+
+}
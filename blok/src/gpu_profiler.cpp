@@ -0,0 +1,134 @@
+/*
+* File: gpu_profiler.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "gpu_profiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace blok {
+
+void GpuProfiler::init(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t framesInFlight, std::initializer_list<uint32_t> queueFamilies) {
+    m_device = device;
+    m_timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+
+    const auto families = physicalDevice.getQueueFamilyProperties();
+    for (uint32_t f : queueFamilies) {
+        if (families[f].timestampValidBits == 0) return;
+    }
+
+    vk::QueryPoolCreateInfo qci{};
+    qci.queryType = vk::QueryType::eTimestamp;
+    qci.queryCount = MAX_SCOPES * 2;
+    for (uint32_t i = 0; i < framesInFlight; i++) {
+        m_pools.push_back(m_device.createQueryPool(qci));
+    }
+    m_frames.resize(framesInFlight);
+}
+
+void GpuProfiler::cleanup() {
+    for (auto pool : m_pools) m_device.destroyQueryPool(pool);
+    m_pools.clear();
+    m_frames.clear();
+}
+
+void GpuProfiler::beginFrame(vk::CommandBuffer cmd, uint32_t frameIndex) {
+    if (!supported()) return;
+    m_recordingFrame = frameIndex;
+    m_depth = 0;
+    m_frames[frameIndex].scopes.clear();
+    m_frames[frameIndex].recorded = true;
+    cmd.resetQueryPool(m_pools[frameIndex], 0, MAX_SCOPES * 2);
+}
+
+uint32_t GpuProfiler::begin(vk::CommandBuffer cmd, const char* name) {
+    if (!supported()) return NO_SCOPE;
+    auto& frame = m_frames[m_recordingFrame];
+    if (frame.scopes.size() >= MAX_SCOPES) return NO_SCOPE;
+
+    const auto scope = static_cast<uint32_t>(frame.scopes.size());
+    frame.scopes.push_back({ name, m_depth++ });
+    cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eNone, m_pools[m_recordingFrame], scope * 2);
+    return scope;
+}
+
+void GpuProfiler::end(vk::CommandBuffer cmd, uint32_t scope) {
+    if (scope == NO_SCOPE) return;
+    m_depth--;
+    cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, m_pools[m_recordingFrame], scope * 2 + 1);
+}
+
+GpuProfiler::PassHistory& GpuProfiler::history(const char* name, uint32_t depth) {
+    auto it = std::find_if(m_passes.begin(), m_passes.end(), [&](const PassHistory& p) {
+        return p.depth == depth && p.name == name;
+    });
+    if (it != m_passes.end()) return *it;
+    m_passes.push_back({ name, depth });
+    return m_passes.back();
+}
+
+bool GpuProfiler::resolve(uint32_t frameIndex) {
+    if (!supported() || !m_frames[frameIndex].recorded) return false;
+    auto& frame = m_frames[frameIndex];
+    frame.recorded = false;
+    if (frame.scopes.empty()) return false;
+
+    const auto count = static_cast<uint32_t>(frame.scopes.size()) * 2;
+    std::array<uint64_t, MAX_SCOPES * 2> ticks{};
+    const auto res = m_device.getQueryPoolResults(m_pools[frameIndex], 0, count,
+        sizeof(uint64_t) * count, ticks.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if (res != vk::Result::eSuccess) return false;
+
+    // every history moves one frame, passes that didn't run get 0
+    for (auto& p : m_passes) {
+        std::memmove(p.ms.data(), p.ms.data() + 1, sizeof(float) * (HISTORY_SIZE - 1));
+        p.ms[HISTORY_SIZE - 1] = 0.0f;
+        p.active = false;
+    }
+
+    m_frameMs = 0.0f;
+    for (uint32_t i = 0; i < frame.scopes.size(); i++) {
+        const auto& scope = frame.scopes[i];
+        const float ms = static_cast<float>(static_cast<double>(ticks[i * 2 + 1] - ticks[i * 2]) * m_timestampPeriod * 1e-6);
+
+        // the same name twice in a frame adds up
+        PassHistory& p = history(scope.name, scope.depth);
+        p.ms[HISTORY_SIZE - 1] += ms;
+        p.active = true;
+        if (scope.depth == 0) m_frameMs += ms;
+    }
+
+    const float n = static_cast<float>(std::min<uint64_t>(++m_resolvedFrames, HISTORY_SIZE));
+    for (auto& p : m_passes) {
+        float sum = 0.0f;
+        for (uint32_t i = HISTORY_SIZE - static_cast<uint32_t>(n); i < HISTORY_SIZE; i++) sum += p.ms[i];
+        p.averageMs = sum / n;
+    }
+
+    std::memmove(m_frameHistory.data(), m_frameHistory.data() + 1, sizeof(float) * (HISTORY_SIZE - 1));
+    m_frameHistory[HISTORY_SIZE - 1] = m_frameMs;
+    return true;
+}
+
+bool GpuProfiler::exportCsv(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    out << "frame,total";
+    for (const auto& p : m_passes) out << ',' << p.name;
+    out << '\n';
+
+    const auto rows = static_cast<uint32_t>(std::min<uint64_t>(m_resolvedFrames, HISTORY_SIZE));
+    for (uint32_t r = HISTORY_SIZE - rows; r < HISTORY_SIZE; r++) {
+        out << (m_resolvedFrames - (HISTORY_SIZE - r)) << ',' << m_frameHistory[r];
+        for (const auto& p : m_passes) out << ',' << p.ms[r];
+        out << '\n';
+    }
+    return true;
+}
+
+}
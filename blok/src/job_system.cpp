@@ -0,0 +1,131 @@
+/*
+* File: job_system.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "job_system.hpp"
+
+namespace blok {
+
+// pool + queue index owned by this thread, null/~0 for non-workers (main thread)
+static thread_local const JobSystem* t_workerPool = nullptr;
+static thread_local uint32_t t_workerIndex = ~0u;
+
+JobSystem::JobSystem(uint32_t threadCount) {
+    if (threadCount == 0) {
+        const uint32_t hw = std::thread::hardware_concurrency();
+        threadCount = hw > 1 ? hw - 1 : 1;
+    }
+
+    m_queues.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; ++i)
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+
+    m_threads.reserve(threadCount);
+    for (uint32_t i = 0; i < threadCount; ++i)
+        m_threads.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stop.store(true);
+    }
+    m_sleepCv.notify_all();
+
+    for (auto& t : m_threads)
+        if (t.joinable()) t.join();
+}
+
+void JobSystem::submit(Job job, JobCounter* counter) {
+    if (counter)
+        counter->value.fetch_add(1, std::memory_order_relaxed);
+
+    // workers push onto their own queue so nested jobs stay local, everyone else round robins
+    uint32_t q = t_workerPool == this ? t_workerIndex : ~0u;
+    if (q >= m_queues.size())
+        q = m_nextQueue.fetch_add(1, std::memory_order_relaxed) % static_cast<uint32_t>(m_queues.size());
+
+    // count before pushing so a fast thief can never drive m_queued below zero
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_queued.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_queues[q]->mutex);
+        m_queues[q]->tasks.push_back({std::move(job), counter});
+    }
+    m_sleepCv.notify_one();
+}
+
+bool JobSystem::tryRunOne(uint32_t home) {
+    const auto count = static_cast<uint32_t>(m_queues.size());
+
+    Task task;
+    bool found = false;
+
+    // own queue, newest first (still hot in cache)
+    if (home < count) {
+        WorkerQueue& q = *m_queues[home];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            found = true;
+        }
+    }
+
+    // steal the oldest job from someone else
+    for (uint32_t i = 1; i <= count && !found; ++i) {
+        WorkerQueue& q = *m_queues[(home + i) % count];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            found = true;
+        }
+    }
+
+    if (!found)
+        return false;
+
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+
+    task.job();
+
+    if (task.counter)
+        task.counter->value.fetch_sub(1, std::memory_order_release);
+
+    return true;
+}
+
+void JobSystem::workerLoop(uint32_t index) {
+    t_workerPool = this;
+    t_workerIndex = index;
+
+    while (true) {
+        if (tryRunOne(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_sleepCv.wait(lock, [this] {
+            return m_stop.load() || m_queued.load(std::memory_order_relaxed) > 0;
+        });
+
+        if (m_stop.load() && m_queued.load(std::memory_order_relaxed) == 0)
+            return;
+    }
+}
+
+void JobSystem::wait(const JobCounter& counter) {
+    const uint32_t home = t_workerPool == this ? t_workerIndex : 0;
+
+    while (!counter.done()) {
+        if (!tryRunOne(home))
+            std::this_thread::yield();
+    }
+}
+
+}
@@ -6,15 +6,99 @@
 * Created on: 9/4/2025
 */
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
 #include "app.hpp"
 #include "backend.hpp"
 
-int main() {
+int main(int argc, char** argv) {
     try {
+        // blok --offline-merge out.exr part.exr ..., no window or device needed
+        if (argc > 2 && std::strcmp(argv[1], "--offline-merge") == 0) {
+            std::string err;
+            if (blok::mergeExrParts(argv[2], std::vector<std::string>(argv + 3, argv + argc), &err)) return 0;
+            std::cerr << "[FATAL] merge failed: " << err << "\n";
+            return 1;
+        }
+
         blok::GraphicsApi backend = blok::GraphicsApi::Vulkan;
+        // the backend is fixed before the app exists: gl window + cuda path tracer (or the chunk rasterizer)
+        for (int i = 1; i < argc; ++i)
+            if (std::strcmp(argv[i], "--cuda") == 0 || std::strcmp(argv[i], "--gl-raster") == 0) backend = blok::GraphicsApi::OpenGL;
 
         blok::App app(backend);
+        bool bench = false;
+        blok::BenchmarkConfig benchConfig;
+        bool offline = false;
+        blok::OfflineRenderConfig offlineConfig;
+        const char* meshPath = nullptr;
+        uint32_t meshResolution = 256;
+        for (int i = 1; i < argc; ++i) {
+            const bool hasValue = i + 1 < argc;
+            if (std::strcmp(argv[i], "--sweep-subchunks") == 0) app.setSubChunkSweep(true);
+            else if (std::strcmp(argv[i], "--no-world-cache") == 0) app.setWorldCache(false);
+            else if (std::strcmp(argv[i], "--no-shader-reload") == 0) app.setShaderHotReload(false);
+            else if (std::strcmp(argv[i], "--no-world-thread") == 0) app.setWorldThread(false);
+            else if (std::strcmp(argv[i], "--terrain") == 0) app.setTerrain(true);
+            else if (std::strcmp(argv[i], "--world-dir") == 0 && hasValue) app.setWorldDirectory(argv[++i]);
+            else if (std::strcmp(argv[i], "--baked-ao") == 0) app.setBakedAo(true);
+            else if (std::strcmp(argv[i], "--ray-query") == 0) app.setRayQuery(true);
+            else if (std::strcmp(argv[i], "--frames-in-flight") == 0 && hasValue) app.setFramesInFlight(std::strtoul(argv[++i], nullptr, 10));
+            else if (std::strcmp(argv[i], "--low-latency") == 0) app.setLowLatency(true);
+            else if (std::strcmp(argv[i], "--mesh") == 0 && hasValue) meshPath = argv[++i];
+            else if (std::strcmp(argv[i], "--mesh-resolution") == 0 && hasValue) meshResolution = std::strtoul(argv[++i], nullptr, 10);
+            else if (std::strcmp(argv[i], "--env") == 0 && hasValue) app.setEnvironmentMap(argv[++i]);
+            else if (std::strcmp(argv[i], "--cuda-wavefront") == 0) app.setCudaWavefront(true);
+            else if (std::strcmp(argv[i], "--cuda-vulkan") == 0) app.setCudaInVulkan(true);
+            else if (std::strcmp(argv[i], "--gl-raster") == 0) app.setGlRaster(true);
+            else if (std::strcmp(argv[i], "--bench") == 0) bench = true;
+            else if (std::strcmp(argv[i], "--bench-frames") == 0 && hasValue) benchConfig.frames = std::strtoul(argv[++i], nullptr, 10);
+            else if (std::strcmp(argv[i], "--bench-warmup") == 0 && hasValue) benchConfig.warmupFrames = std::strtoul(argv[++i], nullptr, 10);
+            else if (std::strcmp(argv[i], "--bench-seed") == 0 && hasValue) benchConfig.seed = std::strtoul(argv[++i], nullptr, 10);
+            else if (std::strcmp(argv[i], "--bench-out") == 0 && hasValue) benchConfig.output = argv[++i];
+            else if (std::strcmp(argv[i], "--offline") == 0 && hasValue) { offline = true; offlineConfig.output = argv[++i]; }
+            else if (std::strcmp(argv[i], "--offline-spp") == 0 && hasValue) offlineConfig.spp = std::strtoul(argv[++i], nullptr, 10);
+            else if (std::strcmp(argv[i], "--offline-size") == 0 && i + 2 < argc) {
+                offlineConfig.width = std::max<uint32_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+                offlineConfig.height = std::max<uint32_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+            }
+            else if (std::strcmp(argv[i], "--offline-camera") == 0 && i + 6 < argc) {
+                blok::Camera& cam = offlineConfig.camera;
+                cam.position.x = std::strtof(argv[++i], nullptr);
+                cam.position.y = std::strtof(argv[++i], nullptr);
+                cam.position.z = std::strtof(argv[++i], nullptr);
+                cam.yaw = std::strtof(argv[++i], nullptr);
+                cam.pitch = std::strtof(argv[++i], nullptr);
+                cam.fov = std::strtof(argv[++i], nullptr);
+                offlineConfig.hasCamera = true;
+            }
+            else if (std::strcmp(argv[i], "--offline-gpus") == 0 && hasValue) offlineConfig.gpus = std::max<uint32_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+            else if (std::strcmp(argv[i], "--offline-device") == 0 && hasValue) offlineConfig.device = std::atoi(argv[++i]);
+            else if (std::strcmp(argv[i], "--offline-worker") == 0 && i + 2 < argc) {
+                offlineConfig.worker = std::strtoul(argv[++i], nullptr, 10);
+                offlineConfig.workers = std::max<uint32_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+            }
+            // anything else after --bench is a scene
+            else if (bench && argv[i][0] != '-') benchConfig.scenes.emplace_back(argv[i]);
+        }
+        if (bench) app.setBenchmark(benchConfig);
+        if (offline && offlineConfig.gpus > 1) {
+            // a worker process per device, each gets everything but the flags that make it a worker
+            std::vector<std::string> args;
+            for (int i = 1; i < argc; ++i) {
+                if (std::strcmp(argv[i], "--offline") == 0 || std::strcmp(argv[i], "--offline-gpus") == 0 ||
+                    std::strcmp(argv[i], "--offline-device") == 0) { ++i; continue; }
+                if (std::strcmp(argv[i], "--offline-worker") == 0) { i += 2; continue; }
+                args.emplace_back(argv[i]);
+            }
+            return blok::runOfflineWorkers(argv[0], args, offlineConfig) ? 0 : 1;
+        }
+        if (offline) app.setOfflineRender(offlineConfig);
+        if (meshPath) app.setStartupMesh(meshPath, meshResolution);
         app.run();
     } catch (const std::exception& e) {
         std::cerr << "[FATAL] " << e.what() << "\n";
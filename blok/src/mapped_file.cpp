@@ -0,0 +1,132 @@
+/*
+* File: mapped_file.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "mapped_file.hpp"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace blok {
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& o) noexcept {
+    *this = std::move(o);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& o) noexcept {
+    if (this == &o) return *this;
+    close();
+    m_data = std::exchange(o.m_data, nullptr);
+    m_size = std::exchange(o.m_size, 0);
+    m_open = std::exchange(o.m_open, false);
+#ifdef _WIN32
+    m_file = std::exchange(o.m_file, nullptr);
+    m_mapping = std::exchange(o.m_mapping, nullptr);
+#endif
+    return *this;
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path, std::string& errorMsg) {
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        errorMsg = "Failed to open file " + path;
+        return false;
+    }
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        errorMsg = "Failed to stat file " + path;
+        return false;
+    }
+    m_file = file;
+    m_open = true;
+    m_size = static_cast<size_t>(size.QuadPart);
+    // CreateFileMapping refuses empty files
+    if (m_size == 0) return true;
+
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping) m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data) {
+        close();
+        errorMsg = "Failed to map file " + path;
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file) CloseHandle(m_file);
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+#else
+bool MappedFile::open(const std::string& path, std::string& errorMsg) {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        errorMsg = "Failed to open file " + path;
+        return false;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        errorMsg = "Failed to stat file " + path;
+        return false;
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    m_open = true;
+    if (m_size == 0) {
+        ::close(fd);
+        return true;
+    }
+
+    // the mapping keeps its own reference, the fd isn't needed past this
+    void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        m_size = 0;
+        m_open = false;
+        errorMsg = "Failed to map file " + path;
+        return false;
+    }
+    // parsed front to back once
+    madvise(p, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const uint8_t*>(p);
+    return true;
+}
+
+void MappedFile::close() {
+    if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+#endif
+
+}
@@ -6,7 +6,10 @@
 */
 
 #include "material.hpp"
+#include "resources.hpp"
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 
 namespace blok {
@@ -40,11 +43,9 @@ uint32_t MaterialLibrary::addMaterial(const Material& mat) {
 }
 
 uint32_t MaterialLibrary::addOrFindMaterial(const Material& mat) {
-    if (!mat.name.empty()) {
-        auto it = m_nameToId.find(mat.name);
-        if (it != m_nameToId.end()) {
-            return it->second;
-        }
+    uint32_t id = 0;
+    if (!mat.name.empty() && findByName(mat.name, id)) {
+        return id;
     }
 
     return addMaterial(mat);
@@ -59,25 +60,48 @@ const Material* MaterialLibrary::getMaterial(uint32_t id) const {
 
 Material* MaterialLibrary::getMaterial(uint32_t id) {
     if (id >= m_materials.size()) {
-        return &m_materials[MATERIAL_DEFAULT];
+        id = MATERIAL_DEFAULT;
+    }
+    if (id < m_gpuPacked && (m_touched.empty() || m_touched.back() != id)) {
+        m_touched.push_back(id);
     }
     return &m_materials[id];
 }
 
 const Material* MaterialLibrary::getMaterialByName(const std::string& name) const {
-    auto it = m_nameToId.find(name);
-    if (it != m_nameToId.end()) {
-        return &m_materials[it->second];
+    uint32_t id = 0;
+    if (findByName(name, id)) {
+        return &m_materials[id];
     }
     return nullptr;
 }
 
 uint32_t MaterialLibrary::getMaterialIdByName(const std::string& name) const {
+    uint32_t id = 0;
+    if (findByName(name, id)) {
+        return id;
+    }
+    return MATERIAL_DEFAULT;
+}
+
+bool MaterialLibrary::findByName(const std::string& name, uint32_t& id) const {
     auto it = m_nameToId.find(name);
     if (it != m_nameToId.end()) {
-        return it->second;
+        id = it->second;
+        return true;
     }
-    return MATERIAL_DEFAULT;
+
+    // colour materials aren't in m_nameToId, their name is the colour
+    if (name.size() == 12 && name.compare(0, 6, "color_") == 0 && !m_colorSlots.empty()) {
+        char* end = nullptr;
+        const unsigned long packed = std::strtoul(name.c_str() + 6, &end, 16);
+        if (end != name.c_str() + name.size()) return false;
+        const ColorSlot& slot = m_colorSlots[colorSlot(static_cast<uint32_t>(packed))];
+        if (slot.color == EMPTY_COLOR) return false;
+        id = slot.id;
+        return true;
+    }
+    return false;
 }
 
 uint32_t MaterialLibrary::getOrCreateFromColor(uint8_t r, uint8_t g, uint8_t b) {
@@ -88,10 +112,18 @@ uint32_t MaterialLibrary::getOrCreateFromColor(uint8_t r, uint8_t g, uint8_t b)
 }
 
 uint32_t MaterialLibrary::getOrCreateFromColor(uint32_t packedRGB) {
+    packedRGB &= 0xFFFFFFu;
+    if (packedRGB == m_lastColor) {
+        return m_lastColorId;
+    }
+
     // Check if we already have a material for this color
-    auto it = m_colorToId.find(packedRGB);
-    if (it != m_colorToId.end()) {
-        return it->second;
+    if (m_colorSlots.empty()) growColorMap();
+    uint32_t slot = colorSlot(packedRGB);
+    if (m_colorSlots[slot].color == packedRGB) {
+        m_lastColor = packedRGB;
+        m_lastColorId = m_colorSlots[slot].id;
+        return m_lastColorId;
     }
 
     // Create new material from color
@@ -104,18 +136,57 @@ uint32_t MaterialLibrary::getOrCreateFromColor(uint32_t packedRGB) {
     mat.roughness = 0.5f;
     mat.metallic = 0.0f;
     mat.type = MaterialType::Diffuse;
-
-    // Generate a name based on color
-    char nameBuf[32];
-    snprintf(nameBuf, sizeof(nameBuf), "color_%06X", packedRGB);
-    mat.name = nameBuf;
+    // no name, materialName builds it from the colour
 
     uint32_t id = addMaterial(mat);
-    m_colorToId[packedRGB] = id;
+    if ((m_colorCount + 1) * 2 > m_colorSlots.size()) {
+        growColorMap();
+        slot = colorSlot(packedRGB);
+    }
+    m_colorSlots[slot] = { packedRGB, id };
+    m_colorCount++;
 
+    m_lastColor = packedRGB;
+    m_lastColorId = id;
     return id;
 }
 
+uint32_t MaterialLibrary::colorSlot(uint32_t packedRGB) const {
+    const uint32_t mask = static_cast<uint32_t>(m_colorSlots.size()) - 1;
+    uint32_t slot = (packedRGB * 0x9E3779B1u) >> m_colorShift;
+    while (m_colorSlots[slot].color != EMPTY_COLOR && m_colorSlots[slot].color != packedRGB) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void MaterialLibrary::growColorMap() {
+    std::vector<ColorSlot> old = std::move(m_colorSlots);
+    const size_t capacity = old.empty() ? 64 : old.size() * 2;
+    m_colorSlots.assign(capacity, ColorSlot{});
+    m_colorShift = 32;
+    for (size_t c = capacity; c > 1; c >>= 1) m_colorShift--;
+
+    for (const ColorSlot& s : old) {
+        if (s.color != EMPTY_COLOR) m_colorSlots[colorSlot(s.color)] = s;
+    }
+}
+
+std::string MaterialLibrary::materialName(uint32_t id) const {
+    const Material* mat = getMaterial(id);
+    if (!mat->name.empty() || m_colorSlots.empty()) return mat->name;
+
+    // colour materials keep their colour exactly as albedo = c / 255
+    const glm::uvec3 c = glm::uvec3(glm::round(glm::clamp(mat->albedo, 0.0f, 1.0f) * 255.0f));
+    const uint32_t packed = (c.r << 16) | (c.g << 8) | c.b;
+    const ColorSlot& slot = m_colorSlots[colorSlot(packed)];
+    if (slot.color != packed || slot.id != id) return mat->name;
+
+    char nameBuf[32];
+    snprintf(nameBuf, sizeof(nameBuf), "color_%06X", packed);
+    return nameBuf;
+}
+
 void MaterialLibrary::setVoxPaletteMapping(uint8_t paletteIndex, uint32_t materialId) {
     m_voxPaletteMap[paletteIndex] = materialId;
 }
@@ -135,10 +206,35 @@ std::vector<MaterialGpu> MaterialLibrary::packForGpu() const {
     return packed;
 }
 
+void MaterialLibrary::packChangedForGpu(std::vector<MaterialGpu>& packed, std::vector<GpuRange>& dirty) {
+    const uint32_t count = static_cast<uint32_t>(m_materials.size());
+    // anything the consumer doesn't hold yet is new to it
+    const uint32_t from = std::min<uint32_t>(m_gpuPacked, static_cast<uint32_t>(packed.size()));
+    packed.resize(count);
+
+    for (uint32_t id : m_touched) {
+        if (id >= from) continue;
+        packed[id] = MaterialGpu::pack(m_materials[id]);
+        dirty.push_back({id, 1});
+    }
+    if (from < count) {
+        for (uint32_t id = from; id < count; ++id) packed[id] = MaterialGpu::pack(m_materials[id]);
+        dirty.push_back({from, count - from});
+    }
+
+    m_touched.clear();
+    m_gpuPacked = count;
+}
+
 void MaterialLibrary::clear() {
     m_materials.clear();
     m_nameToId.clear();
-    m_colorToId.clear();
+    m_colorSlots.clear();
+    m_colorShift = 32;
+    m_colorCount = 0;
+    m_lastColor = EMPTY_COLOR;
+    m_touched.clear();
+    m_gpuPacked = 0;
     m_voxPaletteMap.fill(MATERIAL_DEFAULT);
     createDefaultMaterials();
 }
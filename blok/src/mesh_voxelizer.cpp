@@ -0,0 +1,443 @@
+/*
+* File: mesh_voxelizer.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "mesh_voxelizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include <unordered_map>
+
+#include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+#include "mapped_file.hpp"
+#include "material.hpp"
+#include "morton.hpp"
+
+namespace blok {
+
+static constexpr uint32_t DEFAULT_MESH_COLOR = 0xc8c8c8;
+
+// tiles are the unit of work, 32^3 voxels of occupancy fit in l2 comfortably
+static constexpr uint32_t TILE_SHIFT = 5;
+static constexpr uint32_t TILE = 1u << TILE_SHIFT;
+static constexpr uint32_t TILE_VOXELS = TILE * TILE * TILE;
+
+// bits kept per colour channel, at most 4096 materials however the vertex colours interpolate
+static constexpr uint32_t COLOR_BITS = 4;
+
+// ---- obj ----
+
+static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static std::string_view nextToken(std::string_view& line) {
+    size_t start = 0;
+    while (start < line.size() && isSpace(line[start])) start++;
+    size_t end = start;
+    while (end < line.size() && !isSpace(line[end])) end++;
+    std::string_view token = line.substr(start, end - start);
+    line.remove_prefix(end);
+    return token;
+}
+
+static bool parseFloat(std::string_view token, float& out) {
+    if (!token.empty() && token.front() == '+') token.remove_prefix(1);
+    return std::from_chars(token.data(), token.data() + token.size(), out).ec == std::errc{};
+}
+
+static uint32_t packColor(const glm::vec3& c) {
+    const glm::vec3 b = glm::clamp(c, glm::vec3(0.0f), glm::vec3(1.0f)) * 255.0f + 0.5f;
+    return (static_cast<uint32_t>(b.x) << 16) | (static_cast<uint32_t>(b.y) << 8) | static_cast<uint32_t>(b.z);
+}
+
+// newmtl -> Kd of every material in an mtl file, missing files are ignored
+static void loadMtlColors(const std::string& path, std::unordered_map<std::string, uint32_t>& out) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open MTL: " << path << "\n";
+        return;
+    }
+
+    std::string current;
+    std::string text;
+    while (std::getline(file, text)) {
+        std::string_view line(text);
+        const std::string_view key = nextToken(line);
+        if (key == "newmtl") {
+            current = std::string(nextToken(line));
+            out[current] = DEFAULT_MESH_COLOR;
+        } else if (key == "Kd" && !current.empty()) {
+            glm::vec3 kd(0.0f);
+            for (int i = 0; i < 3; ++i) parseFloat(nextToken(line), kd[i]);
+            out[current] = packColor(kd);
+        }
+    }
+}
+
+// obj index (1 based, negative counts back from the end) -> 0 based, false if out of range
+static bool resolveIndex(std::string_view token, size_t count, uint32_t& out) {
+    int64_t i = 0;
+    const auto slash = token.find('/');
+    if (slash != std::string_view::npos) token = token.substr(0, slash);
+    if (std::from_chars(token.data(), token.data() + token.size(), i).ec != std::errc{} || i == 0) return false;
+    i = i > 0 ? i - 1 : static_cast<int64_t>(count) + i;
+    if (i < 0 || i >= static_cast<int64_t>(count)) return false;
+    out = static_cast<uint32_t>(i);
+    return true;
+}
+
+bool loadObjFile(const std::string& filepath, TriangleMesh& outMesh, std::string& errorMsg) {
+    BLOK_PROFILE_NAMED(timer, "loadObjFile");
+    BLOK_PROFILE_DETAIL(timer, filepath);
+    MappedFile mapped;
+    if (!mapped.open(filepath, errorMsg)) return false;
+
+    outMesh = {};
+    const std::string directory = filepath.substr(0, filepath.find_last_of("/\\") + 1);
+    std::unordered_map<std::string, uint32_t> materials;
+    uint32_t faceColor = DEFAULT_MESH_COLOR;
+    bool vertexColors = false;
+
+    const auto* begin = reinterpret_cast<const char*>(mapped.data());
+    std::string_view rest(begin, mapped.size());
+    std::vector<uint32_t> polygon;
+    size_t lineNumber = 0;
+    while (!rest.empty()) {
+        const size_t eol = rest.find('\n');
+        std::string_view line = rest.substr(0, eol);
+        rest.remove_prefix(eol == std::string_view::npos ? rest.size() : eol + 1);
+        lineNumber++;
+
+        const std::string_view key = nextToken(line);
+        if (key == "v") {
+            glm::vec3 p(0.0f);
+            for (int i = 0; i < 3; ++i) {
+                if (!parseFloat(nextToken(line), p[i])) {
+                    errorMsg = "Invalid OBJ vertex on line " + std::to_string(lineNumber);
+                    return false;
+                }
+            }
+            outMesh.positions.push_back(p);
+
+            // the common "v x y z r g b" extension
+            glm::vec3 c(1.0f);
+            bool hasColor = true;
+            for (int i = 0; i < 3 && hasColor; ++i) hasColor = parseFloat(nextToken(line), c[i]);
+            vertexColors |= hasColor;
+            outMesh.colors.push_back(hasColor ? packColor(c) : 0xffffff);
+        } else if (key == "f") {
+            polygon.clear();
+            for (std::string_view token = nextToken(line); !token.empty(); token = nextToken(line)) {
+                uint32_t index = 0;
+                if (!resolveIndex(token, outMesh.positions.size(), index)) {
+                    errorMsg = "Invalid OBJ face index on line " + std::to_string(lineNumber);
+                    return false;
+                }
+                polygon.push_back(index);
+            }
+            for (size_t i = 2; i < polygon.size(); ++i) {
+                outMesh.indices.insert(outMesh.indices.end(), {polygon[0], polygon[i - 1], polygon[i]});
+                outMesh.triangleColors.push_back(faceColor);
+            }
+        } else if (key == "usemtl") {
+            auto found = materials.find(std::string(nextToken(line)));
+            faceColor = found != materials.end() ? found->second : DEFAULT_MESH_COLOR;
+        } else if (key == "mtllib") {
+            for (std::string_view name = nextToken(line); !name.empty(); name = nextToken(line))
+                loadMtlColors(directory + std::string(name), materials);
+        }
+    }
+
+    if (!vertexColors) outMesh.colors.clear();
+    if (outMesh.indices.empty()) {
+        errorMsg = "OBJ has no faces";
+        return false;
+    }
+    return true;
+}
+
+// ---- voxelization ----
+
+// one triangle's overlap test against unit voxels (Schwarz & Seidel 2010, section 3.1), vertices in voxel space.
+// the voxel at p overlaps when its box straddles the triangle's plane and all three axis projections overlap
+struct TriangleSetup {
+    glm::vec3 v0, n;
+    float d1, d2;
+    glm::vec2 nXY[3], nYZ[3], nZX[3];
+    float dXY[3], dYZ[3], dZX[3];
+    glm::ivec3 lo, hi; // voxel bounds, hi exclusive
+
+    // barycentric weights of the triangle, for vertex colours
+    glm::vec3 e0, e1;
+    float d00, d01, d11, invDenom;
+};
+
+static bool setupTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, TriangleSetup& t) {
+    const glm::vec3 v[3] = {a, b, c};
+    const glm::vec3 e[3] = {b - a, c - b, a - c};
+    t.v0 = a;
+    t.n = glm::cross(e[0], e[1]);
+    if (glm::dot(t.n, t.n) <= 0.0f) return false;
+
+    // the box corner furthest along the normal and the one opposite it
+    const glm::vec3 corner(t.n.x > 0.0f ? 1.0f : 0.0f, t.n.y > 0.0f ? 1.0f : 0.0f, t.n.z > 0.0f ? 1.0f : 0.0f);
+    t.d1 = glm::dot(t.n, corner - a);
+    t.d2 = glm::dot(t.n, glm::vec3(1.0f) - corner - a);
+
+    const float sXY = t.n.z >= 0.0f ? 1.0f : -1.0f;
+    const float sYZ = t.n.x >= 0.0f ? 1.0f : -1.0f;
+    const float sZX = t.n.y >= 0.0f ? 1.0f : -1.0f;
+    for (int i = 0; i < 3; ++i) {
+        t.nXY[i] = glm::vec2(-e[i].y, e[i].x) * sXY;
+        t.dXY[i] = -glm::dot(t.nXY[i], glm::vec2(v[i].x, v[i].y)) + std::max(0.0f, t.nXY[i].x) + std::max(0.0f, t.nXY[i].y);
+        t.nYZ[i] = glm::vec2(-e[i].z, e[i].y) * sYZ;
+        t.dYZ[i] = -glm::dot(t.nYZ[i], glm::vec2(v[i].y, v[i].z)) + std::max(0.0f, t.nYZ[i].x) + std::max(0.0f, t.nYZ[i].y);
+        t.nZX[i] = glm::vec2(-e[i].x, e[i].z) * sZX;
+        t.dZX[i] = -glm::dot(t.nZX[i], glm::vec2(v[i].z, v[i].x)) + std::max(0.0f, t.nZX[i].x) + std::max(0.0f, t.nZX[i].y);
+    }
+
+    t.lo = glm::ivec3(glm::floor(glm::min(a, glm::min(b, c))));
+    t.hi = glm::ivec3(glm::floor(glm::max(a, glm::max(b, c)))) + 1;
+
+    t.e0 = b - a;
+    t.e1 = c - a;
+    t.d00 = glm::dot(t.e0, t.e0);
+    t.d01 = glm::dot(t.e0, t.e1);
+    t.d11 = glm::dot(t.e1, t.e1);
+    const float denom = t.d00 * t.d11 - t.d01 * t.d01;
+    t.invDenom = denom != 0.0f ? 1.0f / denom : 0.0f;
+    return true;
+}
+
+// weights of the three vertices for the point closest to p on the triangle's plane
+static glm::vec3 barycentric(const TriangleSetup& t, const glm::vec3& p) {
+    const glm::vec3 d = p - t.v0;
+    const float d20 = glm::dot(d, t.e0);
+    const float d21 = glm::dot(d, t.e1);
+    const float v = std::clamp((t.d11 * d20 - t.d01 * d21) * t.invDenom, 0.0f, 1.0f);
+    const float w = std::clamp((t.d00 * d21 - t.d01 * d20) * t.invDenom, 0.0f, 1.0f - v);
+    return {1.0f - v - w, v, w};
+}
+
+static uint32_t quantizeColor(uint32_t rgb) {
+    constexpr uint32_t levels = (1u << COLOR_BITS) - 1u;
+    uint32_t out = 0;
+    for (uint32_t channel = 0; channel < 3; ++channel) {
+        // rescaled so full intensity stays 255
+        const uint32_t q = ((rgb >> (channel * 8)) & 0xffu) >> (8 - COLOR_BITS);
+        out |= (q * 255u / levels) << (channel * 8);
+    }
+    return out;
+}
+
+static glm::vec3 unpackColor(uint32_t rgb) {
+    return glm::vec3((rgb >> 16) & 0xffu, (rgb >> 8) & 0xffu, rgb & 0xffu) * (1.0f / 255.0f);
+}
+
+// tile voxel offsets in morton order, packed x | y << 5 | z << 10
+static const std::array<uint16_t, TILE_VOXELS>& tileMortonOrder() {
+    static const std::array<uint16_t, TILE_VOXELS> order = [] {
+        std::array<uint16_t, TILE_VOXELS> o{};
+        for (uint32_t i = 0; i < TILE_VOXELS; ++i) {
+            const uint32_t x = morton3d::compactBits(i);
+            const uint32_t y = morton3d::compactBits(static_cast<uint64_t>(i) >> 1);
+            const uint32_t z = morton3d::compactBits(static_cast<uint64_t>(i) >> 2);
+            o[i] = static_cast<uint16_t>(x | (y << TILE_SHIFT) | (z << (2 * TILE_SHIFT)));
+        }
+        return o;
+    }();
+    return order;
+}
+
+// every triangle binned to the tile, later triangles win a voxel. writes carry the quantized colour as material
+static void voxelizeTile(const TriangleMesh& mesh, const std::vector<glm::vec3>& voxelPositions, const uint32_t* triangles,
+                         size_t triangleCount, const glm::ivec3& tileMin, std::vector<VoxelWrite>& out) {
+    // colour + 1 per voxel, 0 empty
+    std::vector<uint32_t> cells(TILE_VOXELS, 0u);
+    const glm::ivec3 tileMax = tileMin + glm::ivec3(TILE);
+    const bool vertexColors = !mesh.colors.empty();
+
+    TriangleSetup t;
+    for (size_t k = 0; k < triangleCount; ++k) {
+        const uint32_t tri = triangles[k];
+        const uint32_t i0 = mesh.indices[tri * 3], i1 = mesh.indices[tri * 3 + 1], i2 = mesh.indices[tri * 3 + 2];
+        if (!setupTriangle(voxelPositions[i0], voxelPositions[i1], voxelPositions[i2], t)) continue;
+
+        const glm::ivec3 lo = glm::max(t.lo, tileMin);
+        const glm::ivec3 hi = glm::min(t.hi, tileMax);
+        const uint32_t flat = quantizeColor(tri < mesh.triangleColors.size() ? mesh.triangleColors[tri] : DEFAULT_MESH_COLOR) + 1u;
+        const glm::vec3 c0 = vertexColors ? unpackColor(mesh.colors[i0]) : glm::vec3(0.0f);
+        const glm::vec3 c1 = vertexColors ? unpackColor(mesh.colors[i1]) : glm::vec3(0.0f);
+        const glm::vec3 c2 = vertexColors ? unpackColor(mesh.colors[i2]) : glm::vec3(0.0f);
+
+        for (int z = lo.z; z < hi.z; ++z)
+            for (int y = lo.y; y < hi.y; ++y) {
+                // the yz projection doesn't depend on x, the whole row goes if it fails
+                const glm::vec2 pYZ(static_cast<float>(y), static_cast<float>(z));
+                bool row = true;
+                for (int i = 0; i < 3 && row; ++i) row = glm::dot(t.nYZ[i], pYZ) + t.dYZ[i] >= 0.0f;
+                if (!row) continue;
+
+                for (int x = lo.x; x < hi.x; ++x) {
+                    const glm::vec3 p(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+                    const float np = glm::dot(t.n, p);
+                    if ((np + t.d1) * (np + t.d2) > 0.0f) continue;
+
+                    bool overlap = true;
+                    for (int i = 0; i < 3 && overlap; ++i) {
+                        overlap = glm::dot(t.nXY[i], glm::vec2(p.x, p.y)) + t.dXY[i] >= 0.0f &&
+                                  glm::dot(t.nZX[i], glm::vec2(p.z, p.x)) + t.dZX[i] >= 0.0f;
+                    }
+                    if (!overlap) continue;
+
+                    uint32_t color = flat;
+                    if (vertexColors) {
+                        const glm::vec3 w = barycentric(t, p + 0.5f);
+                        color = quantizeColor(packColor(c0 * w.x + c1 * w.y + c2 * w.z)) + 1u;
+                    }
+                    const glm::ivec3 l = glm::ivec3(x, y, z) - tileMin;
+                    cells[l.x + (l.y << TILE_SHIFT) + (l.z << (2 * TILE_SHIFT))] = color;
+                }
+            }
+    }
+
+    const std::array<uint16_t, TILE_VOXELS>& order = tileMortonOrder();
+    for (uint16_t local : order) {
+        const uint32_t color = cells[local];
+        if (!color) continue;
+        const glm::ivec3 l(local & (TILE - 1), (local >> TILE_SHIFT) & (TILE - 1), local >> (2 * TILE_SHIFT));
+        out.push_back({tileMin + l, color - 1u, 1.0f});
+    }
+}
+
+uint32_t voxelizeMeshToChunks(const TriangleMesh& mesh, ChunkManager& chunkMgr, const VoxelizeSettings& settings) {
+    BLOK_PROFILE_SCOPE("voxelizeMeshToChunks");
+    const size_t triangleCount = mesh.triangleCount();
+    if (triangleCount == 0 || mesh.positions.empty() || settings.resolution == 0) return 0;
+
+    // voxel space: the bounding box min at the origin, the longest axis resolution voxels long
+    glm::vec3 bmin(mesh.positions[0]), bmax(mesh.positions[0]);
+    for (const glm::vec3& p : mesh.positions) {
+        bmin = glm::min(bmin, p);
+        bmax = glm::max(bmax, p);
+    }
+    const glm::vec3 extent = bmax - bmin;
+    const float longest = std::max(extent.x, std::max(extent.y, extent.z));
+    const float scale = longest > 0.0f ? static_cast<float>(settings.resolution) / longest : 1.0f;
+    // the far faces sit exactly on resolution, keep them inside the last voxel
+    const float inset = 1.0f - 1e-4f;
+
+    std::vector<glm::vec3> voxelPositions(mesh.positions.size());
+    for (size_t i = 0; i < mesh.positions.size(); ++i) voxelPositions[i] = (mesh.positions[i] - bmin) * scale * inset;
+
+    const glm::ivec3 dims = glm::max(glm::ivec3(glm::ceil(extent * scale)), glm::ivec3(1));
+    const glm::ivec3 tiles = (dims + glm::ivec3(TILE - 1)) >> static_cast<int>(TILE_SHIFT);
+    const size_t tileCount = size_t(tiles.x) * tiles.y * tiles.z;
+    auto tileIndex = [&](int x, int y, int z) { return size_t(x) + size_t(y) * tiles.x + size_t(z) * tiles.x * tiles.y; };
+
+    // counting sort of the triangles into every tile their bounds touch
+    auto tileBounds = [&](size_t tri, glm::ivec3& lo, glm::ivec3& hi) {
+        const glm::vec3& a = voxelPositions[mesh.indices[tri * 3]];
+        const glm::vec3& b = voxelPositions[mesh.indices[tri * 3 + 1]];
+        const glm::vec3& c = voxelPositions[mesh.indices[tri * 3 + 2]];
+        lo = glm::clamp(glm::ivec3(glm::floor(glm::min(a, glm::min(b, c)))) >> static_cast<int>(TILE_SHIFT), glm::ivec3(0), tiles - 1);
+        hi = glm::clamp(glm::ivec3(glm::floor(glm::max(a, glm::max(b, c)))) >> static_cast<int>(TILE_SHIFT), glm::ivec3(0), tiles - 1);
+    };
+    std::vector<uint32_t> tileStart(tileCount + 1, 0u);
+    for (size_t tri = 0; tri < triangleCount; ++tri) {
+        glm::ivec3 lo, hi;
+        tileBounds(tri, lo, hi);
+        for (int z = lo.z; z <= hi.z; ++z)
+            for (int y = lo.y; y <= hi.y; ++y)
+                for (int x = lo.x; x <= hi.x; ++x) tileStart[tileIndex(x, y, z) + 1]++;
+    }
+    for (size_t i = 0; i < tileCount; ++i) tileStart[i + 1] += tileStart[i];
+    std::vector<uint32_t> binned(tileStart[tileCount]);
+    {
+        std::vector<uint32_t> cursor(tileStart.begin(), tileStart.end() - 1);
+        for (size_t tri = 0; tri < triangleCount; ++tri) {
+            glm::ivec3 lo, hi;
+            tileBounds(tri, lo, hi);
+            for (int z = lo.z; z <= hi.z; ++z)
+                for (int y = lo.y; y <= hi.y; ++y)
+                    for (int x = lo.x; x <= hi.x; ++x) binned[cursor[tileIndex(x, y, z)]++] = static_cast<uint32_t>(tri);
+        }
+    }
+
+    // non-empty tiles in morton order, their voxels concatenate into one morton sorted list
+    struct TileJob {
+        uint64_t code;
+        glm::ivec3 tile;
+        size_t index;
+    };
+    std::vector<TileJob> jobs;
+    for (int z = 0; z < tiles.z; ++z)
+        for (int y = 0; y < tiles.y; ++y)
+            for (int x = 0; x < tiles.x; ++x) {
+                const size_t i = tileIndex(x, y, z);
+                if (tileStart[i] != tileStart[i + 1]) jobs.push_back({morton3d::encode(x, y, z), {x, y, z}, i});
+            }
+    std::sort(jobs.begin(), jobs.end(), [](const TileJob& a, const TileJob& b) { return a.code < b.code; });
+
+    std::vector<std::vector<VoxelWrite>> perTile(jobs.size());
+    {
+        BLOK_PROFILE_SCOPE("voxelizeTiles");
+        JobSystem& jobSystem = chunkMgr.jobSystem();
+        JobCounter counter;
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            jobSystem.submit([&, j] {
+                const TileJob& job = jobs[j];
+                voxelizeTile(mesh, voxelPositions, binned.data() + tileStart[job.index],
+                             tileStart[job.index + 1] - tileStart[job.index], job.tile * static_cast<int>(TILE), perTile[j]);
+            }, &counter);
+        }
+        jobSystem.wait(counter);
+    }
+
+    // colours become materials here, the library isn't thread safe. without one the colour is the material,
+    // same packing as setVoxel
+    const glm::ivec3 origin = chunkMgr.worldToGlobalVoxel(settings.worldOffset);
+    size_t total = 0;
+    for (const auto& w : perTile) total += w.size();
+    std::vector<VoxelWrite> writes;
+    writes.reserve(total);
+    std::unordered_map<uint32_t, uint32_t> colorMaterial;
+    for (auto& tileWrites : perTile) {
+        for (VoxelWrite w : tileWrites) {
+            if (chunkMgr.materialLib) {
+                auto [it, isNew] = colorMaterial.try_emplace(w.materialId, 0u);
+                if (isNew) it->second = chunkMgr.materialLib->getOrCreateFromColor(w.materialId);
+                w.materialId = it->second;
+            }
+            w.voxel += origin;
+            writes.push_back(w);
+        }
+        std::vector<VoxelWrite>().swap(tileWrites);
+    }
+    chunkMgr.writeVoxels(writes);
+
+    std::cout << "Voxelized " << triangleCount << " triangles into " << writes.size() << " voxels ("
+              << colorMaterial.size() << " materials)\n";
+    return static_cast<uint32_t>(writes.size());
+}
+
+bool loadAndVoxelizeObj(const std::string& filepath, ChunkManager& chunkMgr, const VoxelizeSettings& settings,
+                        std::string* errorMsg) {
+    TriangleMesh mesh;
+    std::string err;
+    if (!loadObjFile(filepath, mesh, err)) {
+        if (errorMsg) *errorMsg = err;
+        std::cerr << "Failed to load OBJ: " << err << "\n";
+        return false;
+    }
+    return voxelizeMeshToChunks(mesh, chunkMgr, settings) > 0;
+}
+
+}
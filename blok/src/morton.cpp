@@ -0,0 +1,141 @@
+/*
+* File: morton.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "morton.hpp"
+
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#define BLOK_BMI2_TARGET
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define BLOK_BMI2_TARGET __attribute__((target("bmi2")))
+#endif
+
+namespace blok::morton3d {
+
+namespace {
+
+static constexpr int32_t BIAS = 1 << 20; // same as encode/decode
+
+// 8 at a time through the mask sequence, plain shifts and ands so the compiler vectorises the inner loops
+void encodeMasks(const int32_t* x, const int32_t* y, const int32_t* z, uint64_t* out, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        for (size_t j = 0; j < 8; j++) {
+            out[i + j] = spreadBitsMagic(static_cast<uint32_t>(x[i + j] + BIAS)) |
+                        (spreadBitsMagic(static_cast<uint32_t>(y[i + j] + BIAS)) << 1) |
+                        (spreadBitsMagic(static_cast<uint32_t>(z[i + j] + BIAS)) << 2);
+        }
+    }
+    for (; i < count; i++) out[i] = encode(x[i], y[i], z[i]);
+}
+
+void decodeMasks(const uint64_t* codes, int32_t* x, int32_t* y, int32_t* z, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        for (size_t j = 0; j < 8; j++) {
+            const uint64_t c = codes[i + j];
+            x[i + j] = static_cast<int32_t>(compactBitsMagic(c     )) - BIAS;
+            y[i + j] = static_cast<int32_t>(compactBitsMagic(c >> 1)) - BIAS;
+            z[i + j] = static_cast<int32_t>(compactBitsMagic(c >> 2)) - BIAS;
+        }
+    }
+    for (; i < count; i++) decode(codes[i], x[i], y[i], z[i]);
+}
+
+#ifdef BLOK_BMI2_TARGET
+BLOK_BMI2_TARGET void encodeBmi2(const int32_t* x, const int32_t* y, const int32_t* z, uint64_t* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = _pdep_u64(static_cast<uint32_t>(x[i] + BIAS), SPREAD_MASK) |
+                 _pdep_u64(static_cast<uint32_t>(y[i] + BIAS), SPREAD_MASK << 1) |
+                 _pdep_u64(static_cast<uint32_t>(z[i] + BIAS), SPREAD_MASK << 2);
+    }
+}
+
+BLOK_BMI2_TARGET void decodeBmi2(const uint64_t* codes, int32_t* x, int32_t* y, int32_t* z, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t c = codes[i];
+        x[i] = static_cast<int32_t>(_pext_u64(c, SPREAD_MASK)) - BIAS;
+        y[i] = static_cast<int32_t>(_pext_u64(c, SPREAD_MASK << 1)) - BIAS;
+        z[i] = static_cast<int32_t>(_pext_u64(c, SPREAD_MASK << 2)) - BIAS;
+    }
+}
+
+void cpuid(uint32_t leaf, uint32_t sub, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, static_cast<int>(leaf), static_cast<int>(sub));
+    std::memcpy(regs, r, sizeof(r));
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// bmi2 and a pdep that isn't microcoded (zen 1/2 take ~250 cycles for one)
+bool detectFastBmi2() {
+    uint32_t r[4];
+    cpuid(0, 0, r);
+    const uint32_t maxLeaf = r[0];
+    char vendor[13] = {};
+    std::memcpy(vendor + 0, &r[1], 4);
+    std::memcpy(vendor + 4, &r[3], 4);
+    std::memcpy(vendor + 8, &r[2], 4);
+    if (maxLeaf < 7) return false;
+
+    cpuid(7, 0, r);
+    if (!(r[1] & (1u << 8))) return false; // ebx bit 8
+
+    if (std::strcmp(vendor, "AuthenticAMD") == 0) {
+        cpuid(1, 0, r);
+        const uint32_t family = ((r[0] >> 8) & 0xf) + ((r[0] >> 20) & 0xff);
+        return family >= 0x19;
+    }
+    return true;
+}
+#else
+bool detectFastBmi2() { return false; }
+#endif
+
+struct Kernels {
+    void (*encode)(const int32_t*, const int32_t*, const int32_t*, uint64_t*, size_t) = encodeMasks;
+    void (*decode)(const uint64_t*, int32_t*, int32_t*, int32_t*, size_t) = decodeMasks;
+    bool bmi2 = false;
+};
+
+const Kernels& kernels() {
+    static const Kernels k = [] {
+        Kernels out;
+#ifdef BLOK_BMI2_TARGET
+        if (detectFastBmi2()) {
+            out.encode = encodeBmi2;
+            out.decode = decodeBmi2;
+            out.bmi2 = true;
+        }
+#endif
+        return out;
+    }();
+    return k;
+}
+
+}
+
+void encodeBatch(const int32_t* x, const int32_t* y, const int32_t* z, uint64_t* out, size_t count) {
+    kernels().encode(x, y, z, out, count);
+}
+
+void decodeBatch(const uint64_t* codes, int32_t* x, int32_t* y, int32_t* z, size_t count) {
+    kernels().decode(codes, x, y, z, count);
+}
+
+bool batchUsesBmi2() {
+    return kernels().bmi2;
+}
+
+}
@@ -0,0 +1,314 @@
+/*
+* File: offline_render.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "offline_render.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace blok {
+
+std::vector<OfflineTile> splitOfflineTiles(uint32_t width, uint32_t height, uint32_t tileWidth, uint32_t tileHeight) {
+    std::vector<OfflineTile> tiles;
+    if (tileWidth == 0 || tileHeight == 0) return tiles;
+    for (uint32_t y = 0; y < height; y += tileHeight) {
+        for (uint32_t x = 0; x < width; x += tileWidth) {
+            OfflineTile t;
+            t.index = static_cast<uint32_t>(tiles.size());
+            t.x = x;
+            t.y = y;
+            t.width = std::min(tileWidth, width - x);
+            t.height = std::min(tileHeight, height - y);
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
+
+glm::mat4 offlineTileProjection(const glm::mat4& proj, uint32_t width, uint32_t height, const OfflineTile& tile,
+                                uint32_t tileWidth, uint32_t tileHeight) {
+    // the tile's ndc rect in the full image (pixel rows go down with y, same as the raygen's uv), stretched back to -1..1.
+    // scales x/y after the projection, so the tile keeps the full image's pixel density
+    const float w = static_cast<float>(width);
+    const float h = static_cast<float>(height);
+    const float x0 = 2.0f * static_cast<float>(tile.x) / w - 1.0f;
+    const float x1 = 2.0f * static_cast<float>(tile.x + tileWidth) / w - 1.0f;
+    const float y0 = 2.0f * static_cast<float>(tile.y) / h - 1.0f;
+    const float y1 = 2.0f * static_cast<float>(tile.y + tileHeight) / h - 1.0f;
+
+    glm::mat4 crop(1.0f);
+    crop[0][0] = 2.0f / (x1 - x0);
+    crop[3][0] = -(x1 + x0) / (x1 - x0);
+    crop[1][1] = 2.0f / (y1 - y0);
+    crop[3][1] = -(y1 + y0) / (y1 - y0);
+    return crop * proj;
+}
+
+// exr is little endian throughout
+static void put32(std::vector<char>& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((v >> (i * 8)) & 0xFFu));
+}
+
+static void putFloat(std::vector<char>& out, float v) {
+    uint32_t bits = 0;
+    std::memcpy(&bits, &v, sizeof(bits));
+    put32(out, bits);
+}
+
+static void putAttribute(std::vector<char>& out, const char* name, const char* type, const std::vector<char>& value) {
+    out.insert(out.end(), name, name + std::strlen(name) + 1);
+    out.insert(out.end(), type, type + std::strlen(type) + 1);
+    put32(out, static_cast<uint32_t>(value.size()));
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+static uint32_t get32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (i * 8);
+    return v;
+}
+
+static constexpr uint32_t EXR_MAGIC = 20000630;
+static constexpr uint32_t EXR_PIXEL_FLOAT = 2;
+
+bool writeExr(const std::string& path, uint32_t width, uint32_t height, const std::vector<float>& rgba) {
+    if (width == 0 || height == 0 || rgba.size() < static_cast<size_t>(width) * height * 4) return false;
+
+    std::vector<char> header;
+    put32(header, EXR_MAGIC);
+    put32(header, 2); // version 2, single part scanline
+
+    // channels sorted by name, which is also the order they're stored in per line
+    std::vector<char> channels;
+    for (const char* name : { "A", "B", "G", "R" }) {
+        channels.insert(channels.end(), name, name + 2);
+        put32(channels, EXR_PIXEL_FLOAT);
+        put32(channels, 0); // pLinear + reserved
+        put32(channels, 1); // x sampling
+        put32(channels, 1); // y sampling
+    }
+    channels.push_back(0);
+    putAttribute(header, "channels", "chlist", channels);
+    putAttribute(header, "compression", "compression", { 0 });
+
+    std::vector<char> window;
+    put32(window, 0);
+    put32(window, 0);
+    put32(window, width - 1);
+    put32(window, height - 1);
+    putAttribute(header, "dataWindow", "box2i", window);
+    putAttribute(header, "displayWindow", "box2i", window);
+    putAttribute(header, "lineOrder", "lineOrder", { 0 }); // increasing y
+
+    std::vector<char> one;
+    putFloat(one, 1.0f);
+    putAttribute(header, "pixelAspectRatio", "float", one);
+    std::vector<char> center;
+    putFloat(center, 0.0f);
+    putFloat(center, 0.0f);
+    putAttribute(header, "screenWindowCenter", "v2f", center);
+    putAttribute(header, "screenWindowWidth", "float", one);
+    header.push_back(0);
+
+    // one line per chunk without compression, the offset table points at each
+    const uint64_t lineBytes = static_cast<uint64_t>(width) * 4 * sizeof(float);
+    const uint64_t chunkBytes = 8 + lineBytes;
+    const uint64_t firstChunk = header.size() + static_cast<uint64_t>(height) * 8;
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint64_t offset = firstChunk + y * chunkBytes;
+        put32(header, static_cast<uint32_t>(offset));
+        put32(header, static_cast<uint32_t>(offset >> 32));
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out.write(header.data(), static_cast<std::streamsize>(header.size()));
+
+    static constexpr int channelOrder[4] = { 3, 2, 1, 0 }; // A B G R out of rgba
+    std::vector<char> line;
+    line.reserve(chunkBytes);
+    for (uint32_t y = 0; y < height; ++y) {
+        line.clear();
+        put32(line, y);
+        put32(line, static_cast<uint32_t>(lineBytes));
+        const float* row = rgba.data() + static_cast<size_t>(y) * width * 4;
+        for (int c : channelOrder)
+            for (uint32_t x = 0; x < width; ++x) putFloat(line, row[x * 4 + c]);
+        out.write(line.data(), static_cast<std::streamsize>(line.size()));
+    }
+    return static_cast<bool>(out);
+}
+
+bool readExr(const std::string& path, uint32_t& width, uint32_t& height, std::vector<float>& rgba, std::string* err) {
+    auto fail = [&](const char* what) {
+        if (err) *err = what;
+        return false;
+    };
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return fail("can't open file");
+    const std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.size() < 8 || get32(data.data()) != EXR_MAGIC) return fail("not an exr");
+    // tiled, deep and multi part files aren't written by writeExr
+    if ((get32(data.data() + 4) & 0xFFu) != 2 || (get32(data.data() + 4) & 0x1E00u) != 0) return fail("not a single part scanline exr");
+
+    struct Channel { std::string name; uint32_t type; };
+    std::vector<Channel> channels;
+    int32_t minX = 0, minY = 0, maxX = -1, maxY = -1;
+    int compression = -1;
+
+    size_t p = 8;
+    auto readString = [&](std::string& s) {
+        const auto end = std::find(data.begin() + static_cast<std::ptrdiff_t>(p), data.end(), '\0');
+        if (end == data.end()) return false;
+        s.assign(data.begin() + static_cast<std::ptrdiff_t>(p), end);
+        p = static_cast<size_t>(end - data.begin()) + 1;
+        return true;
+    };
+    for (;;) {
+        std::string name, type;
+        if (!readString(name)) return fail("truncated header");
+        if (name.empty()) break;
+        if (!readString(type) || p + 4 > data.size()) return fail("truncated header");
+        const uint32_t size = get32(data.data() + p);
+        p += 4;
+        if (p + size > data.size()) return fail("truncated header");
+        const char* v = data.data() + p;
+
+        if (name == "channels") {
+            size_t c = 0;
+            while (c < size && v[c] != 0) {
+                const char* end = static_cast<const char*>(std::memchr(v + c, 0, size - c));
+                if (!end || static_cast<size_t>(end - v) + 17 > size) return fail("bad channel list");
+                Channel ch{ std::string(v + c, end), get32(end + 1) };
+                channels.push_back(ch);
+                c = static_cast<size_t>(end - v) + 17;
+            }
+        }
+        else if (name == "compression" && size >= 1) compression = static_cast<uint8_t>(v[0]);
+        else if (name == "dataWindow" && size >= 16) {
+            minX = static_cast<int32_t>(get32(v));
+            minY = static_cast<int32_t>(get32(v + 4));
+            maxX = static_cast<int32_t>(get32(v + 8));
+            maxY = static_cast<int32_t>(get32(v + 12));
+        }
+        p += size;
+    }
+
+    if (compression != 0) return fail("only uncompressed exr is supported");
+    if (maxX < minX || maxY < minY) return fail("empty data window");
+    for (const Channel& ch : channels)
+        if (ch.type != EXR_PIXEL_FLOAT) return fail("only 32 bit float channels are supported");
+
+    width = static_cast<uint32_t>(maxX - minX + 1);
+    height = static_cast<uint32_t>(maxY - minY + 1);
+    rgba.assign(static_cast<size_t>(width) * height * 4, 0.0f);
+
+    const size_t lineBytes = static_cast<size_t>(width) * channels.size() * sizeof(float);
+    for (uint32_t i = 0; i < height; ++i) {
+        if (p + 8 > data.size()) return fail("truncated offset table");
+        const uint64_t offset = get32(data.data() + p) | (static_cast<uint64_t>(get32(data.data() + p + 4)) << 32);
+        p += 8;
+        if (offset + 8 + lineBytes > data.size()) return fail("truncated scanline");
+
+        const char* chunk = data.data() + offset;
+        const int32_t y = static_cast<int32_t>(get32(chunk)) - minY;
+        if (y < 0 || y >= static_cast<int32_t>(height) || get32(chunk + 4) != lineBytes) return fail("bad scanline");
+
+        float* row = rgba.data() + static_cast<size_t>(y) * width * 4;
+        const char* src = chunk + 8;
+        for (const Channel& ch : channels) {
+            const int c = ch.name == "R" ? 0 : ch.name == "G" ? 1 : ch.name == "B" ? 2 : ch.name == "A" ? 3 : -1;
+            if (c >= 0) {
+                for (uint32_t x = 0; x < width; ++x) {
+                    const uint32_t bits = get32(src + x * 4);
+                    std::memcpy(&row[x * 4 + c], &bits, sizeof(float));
+                }
+            }
+            src += static_cast<size_t>(width) * sizeof(float);
+        }
+    }
+    return true;
+}
+
+bool mergeExrParts(const std::string& output, const std::vector<std::string>& parts, std::string* err) {
+    uint32_t width = 0, height = 0;
+    std::vector<float> sum;
+    std::vector<float> part;
+    for (const std::string& path : parts) {
+        uint32_t w = 0, h = 0;
+        std::string readErr;
+        if (!readExr(path, w, h, part, &readErr)) {
+            if (err) *err = path + ": " + readErr;
+            return false;
+        }
+        if (sum.empty()) {
+            width = w;
+            height = h;
+            sum.assign(part.size(), 0.0f);
+        }
+        else if (w != width || h != height) {
+            if (err) *err = path + ": size doesn't match the other parts";
+            return false;
+        }
+        for (size_t i = 0; i < sum.size(); ++i) sum[i] += part[i];
+    }
+    if (sum.empty()) {
+        if (err) *err = "no parts";
+        return false;
+    }
+    if (!writeExr(output, width, height, sum)) {
+        if (err) *err = "couldn't write " + output;
+        return false;
+    }
+    return true;
+}
+
+bool runOfflineWorkers(const std::string& exe, const std::vector<std::string>& args, const OfflineRenderConfig& config) {
+    auto quote = [](const std::string& s) { return "\"" + s + "\""; };
+
+    std::string common = quote(exe);
+    for (const std::string& a : args) common += " " + quote(a);
+
+    // each worker is a whole process with its own device, nothing to share but the parts on disk
+    std::vector<std::string> parts(config.gpus);
+    std::vector<int> results(config.gpus, -1);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < config.gpus; ++i) {
+        parts[i] = config.output + ".part" + std::to_string(i) + ".exr";
+        const std::string cmd = common + " --offline " + quote(parts[i]) + " --offline-device " + std::to_string(i) +
+            " --offline-worker " + std::to_string(i) + " " + std::to_string(config.gpus);
+        threads.emplace_back([&results, i, cmd] { results[i] = std::system(cmd.c_str()); });
+    }
+    for (auto& t : threads) t.join();
+
+    bool ok = true;
+    for (uint32_t i = 0; i < config.gpus; ++i) {
+        if (results[i] != 0) {
+            std::cerr << "Offline: worker " << i << " failed (" << results[i] << ")\n";
+            ok = false;
+        }
+    }
+
+    std::string err;
+    if (ok && !mergeExrParts(config.output, parts, &err)) {
+        std::cerr << "Offline: merge failed: " << err << "\n";
+        ok = false;
+    }
+    if (ok) {
+        std::error_code ec;
+        for (const std::string& part : parts) std::filesystem::remove(part, ec);
+        std::cout << "Offline render written to " << config.output << "\n";
+    }
+    return ok;
+}
+
+}
@@ -0,0 +1,462 @@
+/*
+* File: raycast.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "raycast.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cmath>
+#include <vector>
+
+#include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+
+namespace blok {
+
+namespace {
+
+#if defined(_MSC_VER)
+#define BLOK_RAYCAST_INLINE __forceinline
+#else
+#define BLOK_RAYCAST_INLINE inline __attribute__((always_inline))
+#endif
+
+// deepest svo the packet walk takes, 2^16 voxel chunks are far past anything streamed
+constexpr uint32_t MAX_TRACE_DEPTH = 16;
+
+// axis aligned components are nudged off zero like intersect.rint does, so slab tests never see 0 * inf
+glm::vec3 safeInverse(const glm::vec3& d) {
+    constexpr float EPS = 1e-12f;
+    return { 1.0f / (std::abs(d.x) < EPS ? EPS : d.x), 1.0f / (std::abs(d.y) < EPS ? EPS : d.y),
+             1.0f / (std::abs(d.z) < EPS ? EPS : d.z) };
+}
+
+// 3d dda over a grid of size wide cells, clamped to [lo, hi) cells
+struct GridWalk {
+    glm::ivec3 cell;
+    glm::ivec3 step;
+    glm::vec3 tNext; // where the ray crosses into the next cell on each axis
+    glm::vec3 tDelta;
+    float t; // where the ray entered cell
+
+    GridWalk(const glm::vec3& o, const glm::vec3& d, const glm::vec3& inv, float t0, float size, const glm::ivec3& lo, const glm::ivec3& hi)
+        : cell(glm::clamp(glm::ivec3(glm::floor((o + d * t0) / size)), lo, hi - 1)), t(t0) {
+        for (int a = 0; a < 3; ++a) {
+            step[a] = inv[a] < 0.0f ? -1 : 1;
+            const float boundary = static_cast<float>(cell[a] + (step[a] > 0 ? 1 : 0)) * size;
+            tNext[a] = (boundary - o[a]) * inv[a];
+            tDelta[a] = size * std::abs(inv[a]);
+        }
+    }
+
+    [[nodiscard]] float exit() const { return std::min(std::min(tNext.x, tNext.y), tNext.z); }
+
+    // false once the ray passes tEnd or leaves [lo, hi)
+    bool next(float tEnd, const glm::ivec3& lo, const glm::ivec3& hi) {
+        const int a = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+        t = tNext[a];
+        if (t >= tEnd) return false;
+        cell[a] += step[a];
+        tNext[a] += tDelta[a];
+        return cell[a] >= lo[a] && cell[a] < hi[a];
+    }
+};
+
+// entry t into voxel v and the face it came in through, 0 and no face when o is inside
+void voxelEntry(const glm::vec3& o, const glm::vec3& inv, const glm::ivec3& v, float& t, glm::ivec3& normal) {
+    int axis = 0;
+    t = -1.0f;
+    for (int a = 0; a < 3; ++a) {
+        const float near = (static_cast<float>(v[a] + (inv[a] < 0.0f ? 1 : 0)) - o[a]) * inv[a];
+        if (near > t) { t = near; axis = a; }
+    }
+    normal = glm::ivec3(0);
+    if (t <= 0.0f) { t = 0.0f; return; }
+    normal[axis] = inv[axis] < 0.0f ? 1 : -1;
+}
+
+// what a chunk is traced through, see raycast.hpp
+bool svoCurrent(const Chunk& ch) {
+    return !ch.dirty && !ch.rebuilding && !ch.gpuSvo && ch.svo.maxDepth <= MAX_TRACE_DEPTH;
+}
+
+// first filled voxel of the storage between t0 and t1, chunk-local o. skips unallocated bricks whole
+bool traceStorage(const ChunkStorage& s, const glm::vec3& o, const glm::vec3& d, const glm::vec3& inv, float t0, float t1,
+                  glm::ivec3& voxel, uint32_t& material) {
+    const int B = static_cast<int>(s.brickSize());
+    const glm::ivec3 bricksHi(static_cast<int>(s.bricksPerAxis()));
+    GridWalk bricks(o, d, inv, t0, static_cast<float>(B), glm::ivec3(0), bricksHi);
+    do {
+        const ChunkStorage::Brick* brick = s.brick(bricks.cell.x, bricks.cell.y, bricks.cell.z);
+        if (!brick) continue;
+
+        const glm::ivec3 lo = bricks.cell * B;
+        const glm::ivec3 hi = lo + B;
+        const float tEnd = std::min(bricks.exit(), t1);
+        GridWalk w(o, d, inv, bricks.t, 1.0f, lo, hi);
+        do {
+            const glm::ivec3 in = w.cell - lo;
+            if (brick->density[in.x + (in.y + in.z * B) * B] > 0) {
+                voxel = w.cell;
+                material = s.material(w.cell.x, w.cell.y, w.cell.z);
+                return true;
+            }
+        } while (w.next(tEnd, lo, hi));
+    } while (bricks.next(t1, glm::ivec3(0), bricksHi));
+    return false;
+}
+
+// voxel dda through one 4^3 svo brick, bit tests only
+bool traceSvoBrick(const uint32_t* brick, const glm::ivec3& lo, const glm::vec3& o, const glm::vec3& d, const glm::vec3& inv,
+                   float t0, float t1, glm::ivec3& voxel, uint32_t& material) {
+    const uint64_t bits = svoBrickBits(brick);
+    const glm::ivec3 hi = lo + static_cast<int>(SVO_BRICK_SIZE);
+    GridWalk w(o, d, inv, t0, 1.0f, lo, hi);
+    do {
+        const glm::ivec3 in = w.cell - lo;
+        const uint32_t bit = static_cast<uint32_t>(in.x | (in.y << 2) | (in.z << 4));
+        if ((bits >> bit) & 1u) {
+            voxel = w.cell;
+            material = svoBrickMaterial(brick, bit);
+            return true;
+        }
+    } while (w.next(t1, lo, hi));
+    return false;
+}
+
+// rays of one packet inside one chunk, chunk-local. lanes not in the chunk have tMin > tMax and never pass a test.
+// tMax shrinks to a lane's hit as the walk finds closer ones
+template<uint32_t N>
+struct RayPacket {
+    float ox[N], oy[N], oz[N];
+    float dx[N], dy[N], dz[N];
+    float ix[N], iy[N], iz[N];
+    float tMin[N], tMax[N];
+
+    glm::vec3 origin(uint32_t i) const { return {ox[i], oy[i], oz[i]}; }
+    glm::vec3 dir(uint32_t i) const { return {dx[i], dy[i], dz[i]}; }
+    glm::vec3 inverse(uint32_t i) const { return {ix[i], iy[i], iz[i]}; }
+};
+
+// slab test of the cube [lo, lo + size) against every lane, fixed width so it vectorises. bit i = lane i overlaps it
+template<uint32_t N>
+BLOK_RAYCAST_INLINE uint32_t cubeLanes(const RayPacket<N>& p, const glm::vec3& lo, float size, float* tNear) {
+    float tFar[N];
+    for (uint32_t i = 0; i < N; ++i) {
+        const float x0 = (lo.x - p.ox[i]) * p.ix[i], x1 = (lo.x + size - p.ox[i]) * p.ix[i];
+        const float y0 = (lo.y - p.oy[i]) * p.iy[i], y1 = (lo.y + size - p.oy[i]) * p.iy[i];
+        const float z0 = (lo.z - p.oz[i]) * p.iz[i], z1 = (lo.z + size - p.oz[i]) * p.iz[i];
+        tNear[i] = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), p.tMin[i]));
+        tFar[i] = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), p.tMax[i]));
+    }
+    uint32_t lanes = 0;
+    for (uint32_t i = 0; i < N; ++i) lanes |= (tNear[i] <= tFar[i] ? 1u : 0u) << i;
+    return lanes;
+}
+
+// lane i found voxel v at its entry t, kept if it's the closest so far
+template<uint32_t N>
+BLOK_RAYCAST_INLINE void laneHit(RayPacket<N>& p, uint32_t i, const glm::ivec3& v, uint32_t material,
+                                 glm::ivec3* voxel, uint32_t* materials, uint32_t& hitLanes) {
+    float t;
+    glm::ivec3 normal;
+    voxelEntry(p.origin(i), p.inverse(i), v, t, normal);
+    t = std::max(t, p.tMin[i]);
+    if (t >= p.tMax[i]) return;
+    p.tMax[i] = t;
+    voxel[i] = v;
+    materials[i] = material;
+    hitLanes |= 1u << i;
+}
+
+// whole packet down one chunk's svo. children go on the stack in the packet's octant order, so coherent packets
+// walk front to back and stop descending once every lane has a closer hit. lanes pointing elsewhere are still
+// exact, they just cull less. returns the lanes that hit, their voxels (chunk-local) and materials
+template<uint32_t N>
+BLOK_RAYCAST_INLINE uint32_t traceSvo(const SvoTree& tree, RayPacket<N>& p, uint32_t octantMask, glm::ivec3* voxel, uint32_t* materials) {
+    struct Entry {
+        uint32_t node;
+        glm::ivec3 lo;
+        uint32_t level;
+    };
+    // every pop pushes at most 8, one per level stays behind
+    Entry stack[8 * (MAX_TRACE_DEPTH + 1)];
+    uint32_t sp = 0;
+    stack[sp++] = {tree.rootIndex, glm::ivec3(0), 0};
+
+    float tNear[N];
+    uint32_t hitLanes = 0;
+    while (sp > 0) {
+        const Entry e = stack[--sp];
+        const SvoNode& node = tree.nodes[e.node];
+        const int size = 1 << (tree.maxDepth - e.level);
+        uint32_t lanes = cubeLanes(p, glm::vec3(e.lo), static_cast<float>(size), tNear);
+        if (lanes == 0u) continue;
+
+        if (svoIsBrick(node)) {
+            const uint32_t* brick = tree.brickWords.data() + node.firstChild;
+            for (; lanes; lanes &= lanes - 1u) {
+                const uint32_t i = static_cast<uint32_t>(std::countr_zero(lanes));
+                glm::ivec3 v;
+                uint32_t material;
+                if (traceSvoBrick(brick, e.lo, p.origin(i), p.dir(i), p.inverse(i), tNear[i], p.tMax[i], v, material))
+                    laneHit(p, i, v, material, voxel, materials, hitLanes);
+            }
+            continue;
+        }
+
+        if (svoChildBits(node) == 0u) {
+            // a merged leaf covers its whole cube, the ray's first voxel of it is the one it enters
+            if (node.occupancy <= 0.0f) continue;
+            for (; lanes; lanes &= lanes - 1u) {
+                const uint32_t i = static_cast<uint32_t>(std::countr_zero(lanes));
+                const glm::ivec3 v = glm::clamp(glm::ivec3(glm::floor(p.origin(i) + p.dir(i) * tNear[i])), e.lo, e.lo + size - 1);
+                laneHit(p, i, v, node.materialId, voxel, materials, hitLanes);
+            }
+            continue;
+        }
+
+        // far to near in mirrored child order, the nearest pops first
+        const int half = size >> 1;
+        for (uint32_t k = 8; k-- > 0;) {
+            const uint32_t oct = k ^ octantMask;
+            if ((node.childMask & (1u << oct)) == 0u) continue;
+            const glm::ivec3 off(oct & 1u, (oct >> 1) & 1u, oct >> 2);
+            stack[sp++] = {svoChildIndex(node, oct), e.lo + off * half, e.level + 1};
+        }
+    }
+    return hitLanes;
+}
+
+uint32_t traceSvo4(const SvoTree& t, RayPacket<4>& p, uint32_t m, glm::ivec3* v, uint32_t* mat) { return traceSvo(t, p, m, v, mat); }
+uint32_t traceSvo8(const SvoTree& t, RayPacket<8>& p, uint32_t m, glm::ivec3* v, uint32_t* mat) { return traceSvo(t, p, m, v, mat); }
+uint32_t traceSvo16(const SvoTree& t, RayPacket<16>& p, uint32_t m, glm::ivec3* v, uint32_t* mat) { return traceSvo(t, p, m, v, mat); }
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(_MSC_VER)
+__attribute__((target("avx2,fma")))
+uint32_t traceSvo8Avx2(const SvoTree& t, RayPacket<8>& p, uint32_t m, glm::ivec3* v, uint32_t* mat) { return traceSvo(t, p, m, v, mat); }
+
+__attribute__((target("avx2,fma")))
+uint32_t traceSvo16Avx2(const SvoTree& t, RayPacket<16>& p, uint32_t m, glm::ivec3* v, uint32_t* mat) { return traceSvo(t, p, m, v, mat); }
+#define BLOK_RAYCAST_AVX2
+#endif
+
+// four wide is one sse / neon register already, only the wider packets get an avx2 clone
+struct RaycastKernels {
+    uint32_t (*trace4)(const SvoTree&, RayPacket<4>&, uint32_t, glm::ivec3*, uint32_t*);
+    uint32_t (*trace8)(const SvoTree&, RayPacket<8>&, uint32_t, glm::ivec3*, uint32_t*);
+    uint32_t (*trace16)(const SvoTree&, RayPacket<16>&, uint32_t, glm::ivec3*, uint32_t*);
+};
+
+const RaycastKernels& raycastKernels() {
+    static const RaycastKernels fns = [] {
+#ifdef BLOK_RAYCAST_AVX2
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return RaycastKernels{&traceSvo4, &traceSvo8Avx2, &traceSvo16Avx2};
+#endif
+        return RaycastKernels{&traceSvo4, &traceSvo8, &traceSvo16};
+    }();
+    return fns;
+}
+
+uint32_t dispatchTraceSvo(const SvoTree& t, RayPacket<4>& p, uint32_t m, glm::ivec3* v, uint32_t* mat) { return raycastKernels().trace4(t, p, m, v, mat); }
+uint32_t dispatchTraceSvo(const SvoTree& t, RayPacket<8>& p, uint32_t m, glm::ivec3* v, uint32_t* mat) { return raycastKernels().trace8(t, p, m, v, mat); }
+uint32_t dispatchTraceSvo(const SvoTree& t, RayPacket<16>& p, uint32_t m, glm::ivec3* v, uint32_t* mat) { return raycastKernels().trace16(t, p, m, v, mat); }
+
+// one lane's pass through one chunk, [t0, t1] along its ray
+struct ChunkVisit {
+    const Chunk* chunk;
+    float t0, t1;
+    uint32_t lane;
+};
+
+// every chunk with voxels the ray crosses before maxT, in order
+void collectChunks(const ChunkManager& mgr, const glm::vec3& o, const glm::vec3& d, float maxT, uint32_t lane,
+                   std::vector<ChunkVisit>& out) {
+    const glm::vec3 inv = safeInverse(d);
+    const glm::ivec3 lo(INT_MIN), hi(INT_MAX);
+    GridWalk w(o, d, inv, 0.0f, static_cast<float>(mgr.C), lo, hi);
+    do {
+        const auto it = mgr.chunks.find({w.cell.x, w.cell.y, w.cell.z});
+        if (it != mgr.chunks.end() && it->second->voxels.allocatedBricks() > 0)
+            out.push_back({it->second, w.t, std::min(w.exit(), maxT), lane});
+    } while (w.next(maxT, lo, hi));
+}
+
+template<uint32_t N>
+void tracePacket(const ChunkManager& mgr, const glm::vec3* origins, const glm::vec3* dirs, const float* maxT, uint32_t count, RayHit* out) {
+    // per thread so a batch doesn't allocate per packet
+    thread_local std::vector<ChunkVisit> visits;
+    thread_local std::vector<std::pair<float, uint32_t>> groups; // earliest entry, first visit of the chunk's run
+    visits.clear();
+    groups.clear();
+    for (uint32_t i = 0; i < count; ++i) collectChunks(mgr, origins[i], dirs[i], maxT[i], i, visits);
+
+    // a lane crosses a chunk once, so sorting by chunk gives one run per chunk, walked in order of its first entry
+    std::sort(visits.begin(), visits.end(), [](const ChunkVisit& a, const ChunkVisit& b) { return a.chunk < b.chunk; });
+    for (uint32_t i = 0; i < visits.size();) {
+        float first = visits[i].t0;
+        uint32_t j = i + 1;
+        for (; j < visits.size() && visits[j].chunk == visits[i].chunk; ++j) first = std::min(first, visits[j].t0);
+        groups.emplace_back(first, i);
+        i = j;
+    }
+    std::sort(groups.begin(), groups.end());
+
+    float best[N];
+    glm::ivec3 bestVoxel[N];
+    uint32_t bestMaterial[N];
+    uint32_t hitLanes = 0;
+    for (uint32_t i = 0; i < count; ++i) best[i] = maxT[i];
+
+    const auto C = static_cast<int32_t>(mgr.C);
+    for (const auto& g : groups) {
+        const Chunk& ch = *visits[g.second].chunk;
+        const glm::ivec3 base = glm::ivec3(ch.cx, ch.cy, ch.cz) * C;
+        const glm::vec3 baseF(base);
+        const bool svo = svoCurrent(ch);
+
+        RayPacket<N> p;
+        for (uint32_t i = 0; i < N; ++i) {
+            p.ox[i] = p.oy[i] = p.oz[i] = p.dx[i] = p.dy[i] = p.dz[i] = 0.0f;
+            p.ix[i] = p.iy[i] = p.iz[i] = 1.0f;
+            p.tMin[i] = 1.0f;
+            p.tMax[i] = 0.0f;
+        }
+
+        glm::vec3 dirSum(0.0f);
+        uint32_t lanes = 0;
+        for (uint32_t k = g.second; k < visits.size() && visits[k].chunk == &ch; ++k) {
+            const ChunkVisit& v = visits[k];
+            if (v.t0 >= best[v.lane]) continue;
+            const uint32_t i = v.lane;
+            const glm::vec3 o = origins[i] - baseF;
+            const glm::vec3 inv = safeInverse(dirs[i]);
+            p.ox[i] = o.x; p.oy[i] = o.y; p.oz[i] = o.z;
+            p.dx[i] = dirs[i].x; p.dy[i] = dirs[i].y; p.dz[i] = dirs[i].z;
+            p.ix[i] = inv.x; p.iy[i] = inv.y; p.iz[i] = inv.z;
+            p.tMin[i] = v.t0;
+            p.tMax[i] = std::min(v.t1, best[i]);
+            dirSum += dirs[i];
+            lanes |= 1u << i;
+        }
+        if (lanes == 0u) continue;
+
+        glm::ivec3 voxel[N];
+        uint32_t material[N];
+        uint32_t found = 0;
+        if (svo) {
+            const uint32_t octantMask = (dirSum.x < 0.0f ? 1u : 0u) | (dirSum.y < 0.0f ? 2u : 0u) | (dirSum.z < 0.0f ? 4u : 0u);
+            found = dispatchTraceSvo(ch.svo, p, octantMask, voxel, material);
+        } else {
+            for (; lanes; lanes &= lanes - 1u) {
+                const uint32_t i = static_cast<uint32_t>(std::countr_zero(lanes));
+                if (traceStorage(ch.voxels, p.origin(i), p.dir(i), p.inverse(i), p.tMin[i], p.tMax[i], voxel[i], material[i]))
+                    found |= 1u << i;
+            }
+        }
+
+        for (; found; found &= found - 1u) {
+            const uint32_t i = static_cast<uint32_t>(std::countr_zero(found));
+            float t;
+            glm::ivec3 normal;
+            voxelEntry(p.origin(i), p.inverse(i), voxel[i], t, normal);
+            best[i] = std::max(t, p.tMin[i]);
+            bestVoxel[i] = voxel[i] + base;
+            bestMaterial[i] = material[i];
+            hitLanes |= 1u << i;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        RayHit& h = out[i];
+        h = RayHit{};
+        if ((hitLanes & (1u << i)) == 0u) continue;
+        h.hit = true;
+        h.voxel = bestVoxel[i];
+        h.materialId = bestMaterial[i];
+        voxelEntry(origins[i], safeInverse(dirs[i]), h.voxel, h.t, h.normal);
+    }
+}
+
+}
+
+RayHit raycast(const ChunkManager& mgr, const glm::vec3& origin, const glm::vec3& dir, float maxT) {
+    // chunk by chunk in ray order, the first chunk with a hit has the closest one
+    thread_local std::vector<ChunkVisit> visits;
+    visits.clear();
+    collectChunks(mgr, origin, dir, maxT, 0, visits);
+
+    const glm::vec3 inv = safeInverse(dir);
+    const auto C = static_cast<int32_t>(mgr.C);
+    RayHit hit;
+    for (const ChunkVisit& v : visits) {
+        const glm::ivec3 base = glm::ivec3(v.chunk->cx, v.chunk->cy, v.chunk->cz) * C;
+        const glm::vec3 o = origin - glm::vec3(base);
+        glm::ivec3 voxel;
+        uint32_t material = 0;
+        bool found;
+        if (svoCurrent(*v.chunk)) {
+            RayPacket<1> p{ {o.x}, {o.y}, {o.z}, {dir.x}, {dir.y}, {dir.z}, {inv.x}, {inv.y}, {inv.z}, {v.t0}, {v.t1} };
+            found = traceSvo(v.chunk->svo, p, (inv.x < 0.0f ? 1u : 0u) | (inv.y < 0.0f ? 2u : 0u) | (inv.z < 0.0f ? 4u : 0u),
+                             &voxel, &material) != 0u;
+        } else {
+            found = traceStorage(v.chunk->voxels, o, dir, inv, v.t0, v.t1, voxel, material);
+        }
+        if (!found) continue;
+
+        hit.hit = true;
+        hit.voxel = voxel + base;
+        hit.materialId = material;
+        voxelEntry(origin, inv, hit.voxel, hit.t, hit.normal);
+        break;
+    }
+    return hit;
+}
+
+void raycastPacket(const ChunkManager& mgr, const glm::vec3* origins, const glm::vec3* dirs, const float* maxT, uint32_t count,
+                   RayHit* out) {
+    for (uint32_t first = 0; first < count; first += RAY_PACKET_MAX) {
+        const uint32_t n = std::min(count - first, RAY_PACKET_MAX);
+        if (n <= 4) tracePacket<4>(mgr, origins + first, dirs + first, maxT + first, n, out + first);
+        else if (n <= 8) tracePacket<8>(mgr, origins + first, dirs + first, maxT + first, n, out + first);
+        else tracePacket<16>(mgr, origins + first, dirs + first, maxT + first, n, out + first);
+    }
+}
+
+void raycastBatch(ChunkManager& mgr, std::span<const glm::vec3> origins, std::span<const glm::vec3> dirs, float maxT,
+                  std::span<RayHit> out) {
+    BLOK_PROFILE_SCOPE("raycastBatch");
+    const size_t count = std::min({origins.size(), dirs.size(), out.size()});
+    if (count == 0) return;
+
+    // a job is a handful of packets, enough to cover the submit
+    constexpr size_t RAYS_PER_JOB = RAY_PACKET_MAX * 8;
+    const float limits[RAY_PACKET_MAX] = { maxT, maxT, maxT, maxT, maxT, maxT, maxT, maxT,
+                                           maxT, maxT, maxT, maxT, maxT, maxT, maxT, maxT };
+    const ChunkManager& m = mgr;
+    auto run = [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i += RAY_PACKET_MAX) {
+            const auto n = static_cast<uint32_t>(std::min<size_t>(last - i, RAY_PACKET_MAX));
+            raycastPacket(m, origins.data() + i, dirs.data() + i, limits, n, out.data() + i);
+        }
+    };
+
+    if (count <= RAYS_PER_JOB) {
+        run(0, count);
+        return;
+    }
+
+    JobSystem& jobs = mgr.jobSystem();
+    JobCounter counter;
+    for (size_t first = 0; first < count; first += RAYS_PER_JOB) {
+        const size_t last = std::min(first + RAYS_PER_JOB, count);
+        jobs.submit([&run, first, last] { run(first, last); }, &counter);
+    }
+    jobs.wait(counter);
+}
+
+}
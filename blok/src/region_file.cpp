@@ -0,0 +1,335 @@
+/*
+* File: region_file.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "region_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "cpu_profiler.hpp"
+
+namespace blok {
+
+namespace {
+
+constexpr char REGION_MAGIC[4] = { 'B', 'L', 'K', 'R' };
+constexpr uint32_t REGION_CHUNKS = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+constexpr uint32_t PAYLOAD_ALIGN = 256; // capacity granularity, small edits then fit in place
+constexpr size_t MAX_OPEN_REGIONS = 64;
+
+struct RegionHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t C;
+    uint32_t regionSize;
+};
+
+struct RegionIndexEntry {
+    uint64_t offset; // 0 = nothing stored
+    uint32_t size;
+    uint32_t capacity;
+};
+static_assert(sizeof(RegionIndexEntry) == 16, "index entries are 16 bytes on disk");
+
+constexpr size_t INDEX_START = sizeof(RegionHeader);
+constexpr size_t PAYLOAD_START = INDEX_START + sizeof(RegionIndexEntry) * REGION_CHUNKS;
+
+int32_t floorDiv(int32_t a, int32_t b) {
+    return a >= 0 ? a / b : (a - b + 1) / b;
+}
+
+void put(std::vector<uint8_t>& out, uint32_t v) {
+    const size_t at = out.size();
+    out.resize(at + sizeof(v));
+    std::memcpy(out.data() + at, &v, sizeof(v));
+}
+
+bool get(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    if (static_cast<size_t>(end - p) < sizeof(v)) return false;
+    std::memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return true;
+}
+
+}
+
+struct RegionStore::Region {
+    std::fstream file;
+    RegionIndexEntry index[REGION_CHUNKS]{};
+    uint64_t end = PAYLOAD_START;
+};
+
+RegionStore::RegionStore(std::string directory, uint32_t C)
+    : m_directory(std::move(directory)), m_C(C) {
+    std::error_code ec;
+    std::filesystem::create_directories(m_directory, ec);
+    m_thread = std::thread([this] { ioLoop(); });
+}
+
+RegionStore::~RegionStore() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) m_thread.join();
+}
+
+void RegionStore::requestLoad(const ChunkCoord& c) {
+    {
+        std::lock_guard lock(m_mutex);
+        m_queue.push_back({false, c, {}});
+    }
+    m_cv.notify_one();
+}
+
+void RegionStore::collect(std::vector<LoadedChunk>& out) {
+    std::lock_guard lock(m_mutex);
+    for (auto& l : m_done) out.push_back(std::move(l));
+    m_done.clear();
+}
+
+void RegionStore::store(const Chunk& ch) {
+    Op op{true, ChunkCoord{ch.cx, ch.cy, ch.cz}, encodeChunk(ch.voxels)};
+    {
+        std::lock_guard lock(m_mutex);
+        m_queue.push_back(std::move(op));
+    }
+    m_cv.notify_one();
+}
+
+void RegionStore::flush() {
+    std::unique_lock lock(m_mutex);
+    m_idleCv.wait(lock, [&] { return m_queue.empty() && !m_busy; });
+}
+
+AsyncChunkLoader RegionStore::asyncLoader() {
+    AsyncChunkLoader l;
+    l.request = [this](const ChunkCoord& c) { requestLoad(c); };
+    l.collect = [this](std::vector<LoadedChunk>& out) { collect(out); };
+    return l;
+}
+
+ChunkSaver RegionStore::saver() {
+    return [this](const Chunk& ch) { store(ch); };
+}
+
+void RegionStore::ioLoop() {
+    for (;;) {
+        Op op;
+        {
+            std::unique_lock lock(m_mutex);
+            m_cv.wait(lock, [&] { return m_stop || !m_queue.empty(); });
+            // queued writes still go out on shutdown
+            if (m_queue.empty()) break;
+            op = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_busy = true;
+        }
+
+        runOp(op);
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_busy = false;
+        }
+        m_idleCv.notify_all();
+    }
+
+    m_regions.clear();
+}
+
+RegionStore::Region* RegionStore::region(const ChunkCoord& rc) {
+    auto it = m_regions.find(rc);
+    if (it != m_regions.end()) return it->second.get();
+
+    // streaming only ever touches a few regions around the camera, start over instead of tracking lru
+    if (m_regions.size() >= MAX_OPEN_REGIONS) m_regions.clear();
+
+    const std::string path = m_directory + "/r." + std::to_string(rc.x) + "." + std::to_string(rc.y) + "."
+                           + std::to_string(rc.z) + ".blokregion";
+    auto r = std::make_unique<Region>();
+
+    r->file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (r->file) {
+        RegionHeader header{};
+        r->file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        r->file.read(reinterpret_cast<char*>(r->index), sizeof(r->index));
+        if (!r->file || std::memcmp(header.magic, REGION_MAGIC, 4) != 0 || header.version != REGION_FILE_VERSION ||
+            header.C != m_C || header.regionSize != static_cast<uint32_t>(REGION_SIZE)) {
+            std::cerr << "RegionStore: " << path << " is not a region file for C = " << m_C << ", ignoring it\n";
+            m_regions[rc] = nullptr;
+            return nullptr;
+        }
+        r->file.seekg(0, std::ios::end);
+        r->end = std::max<uint64_t>(static_cast<uint64_t>(r->file.tellg()), PAYLOAD_START);
+    } else {
+        // new region, header + empty index
+        r->file.clear();
+        r->file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!r->file) {
+            std::cerr << "RegionStore: can't create " << path << "\n";
+            m_regions[rc] = nullptr;
+            return nullptr;
+        }
+        RegionHeader header{};
+        std::memcpy(header.magic, REGION_MAGIC, 4);
+        header.version = REGION_FILE_VERSION;
+        header.C = m_C;
+        header.regionSize = REGION_SIZE;
+        r->file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        r->file.write(reinterpret_cast<const char*>(r->index), sizeof(r->index));
+        r->end = PAYLOAD_START;
+    }
+
+    Region* out = r.get();
+    m_regions[rc] = std::move(r);
+    return out;
+}
+
+void RegionStore::runOp(Op& op) {
+    const ChunkCoord rc{ floorDiv(op.coord.x, REGION_SIZE), floorDiv(op.coord.y, REGION_SIZE), floorDiv(op.coord.z, REGION_SIZE) };
+    const uint32_t local = static_cast<uint32_t>(op.coord.x - rc.x * REGION_SIZE)
+                         + static_cast<uint32_t>(op.coord.y - rc.y * REGION_SIZE) * REGION_SIZE
+                         + static_cast<uint32_t>(op.coord.z - rc.z * REGION_SIZE) * REGION_SIZE * REGION_SIZE;
+
+    Region* r = region(rc);
+
+    if (!op.store) {
+        BLOK_PROFILE_SCOPE("RegionStore::load");
+        LoadedChunk loaded{op.coord, std::nullopt};
+        if (r && r->index[local].offset != 0 && r->index[local].size > 0) {
+            const RegionIndexEntry& e = r->index[local];
+            std::vector<uint8_t> payload(e.size);
+            r->file.clear();
+            r->file.seekg(static_cast<std::streamoff>(e.offset));
+            r->file.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+
+            ChunkStorage voxels(m_C);
+            // a stored chunk that was carved empty still comes back engaged, a fallback source mustn't refill it
+            if (r->file && decodeChunk(payload.data(), payload.size(), voxels))
+                loaded.voxels = std::move(voxels);
+        }
+        std::lock_guard lock(m_mutex);
+        m_done.push_back(std::move(loaded));
+        return;
+    }
+
+    BLOK_PROFILE_SCOPE("RegionStore::store");
+    if (!r) return;
+
+    RegionIndexEntry& e = r->index[local];
+    const auto size = static_cast<uint32_t>(op.payload.size());
+    if (e.offset == 0 || size > e.capacity) {
+        e.offset = r->end;
+        e.capacity = (size + PAYLOAD_ALIGN - 1) / PAYLOAD_ALIGN * PAYLOAD_ALIGN;
+        r->end += e.capacity;
+    }
+    e.size = size;
+
+    r->file.clear();
+    r->file.seekp(static_cast<std::streamoff>(e.offset));
+    r->file.write(reinterpret_cast<const char*>(op.payload.data()), static_cast<std::streamsize>(size));
+    // pad the capacity out so the next append lands past it
+    if (e.offset + e.capacity == r->end) {
+        static const char zeros[PAYLOAD_ALIGN] = {};
+        r->file.write(zeros, static_cast<std::streamsize>(e.capacity - size));
+    }
+
+    // index entry last, a crash before this leaves the old payload in place
+    r->file.seekp(static_cast<std::streamoff>(INDEX_START + sizeof(RegionIndexEntry) * local));
+    r->file.write(reinterpret_cast<const char*>(&e), sizeof(e));
+    r->file.flush();
+    if (!r->file) std::cerr << "RegionStore: write failed for chunk (" << op.coord.x << "," << op.coord.y << "," << op.coord.z << ")\n";
+}
+
+// C, brick shift, brick count, then per brick: table index, run count, (density << 24 | material, length) runs
+// in the brick's voxel order. solid or empty-ish bricks come down to a run or two
+std::vector<uint8_t> RegionStore::encodeChunk(const ChunkStorage& voxels) {
+    std::vector<uint8_t> out;
+    const uint32_t shift = voxels.brickShift();
+    const uint32_t bpa = voxels.bricksPerAxis();
+    const uint32_t brickVoxels = 1u << (3 * shift);
+
+    put(out, voxels.size());
+    put(out, shift);
+    const size_t countAt = out.size();
+    put(out, 0u);
+
+    uint32_t bricks = 0;
+    for (uint32_t bz = 0; bz < bpa; bz++)
+    for (uint32_t by = 0; by < bpa; by++)
+    for (uint32_t bx = 0; bx < bpa; bx++) {
+        const ChunkStorage::Brick* b = voxels.brick(bx, by, bz);
+        if (!b) continue;
+
+        put(out, bx + by * bpa + bz * bpa * bpa);
+        const size_t runsAt = out.size();
+        put(out, 0u);
+
+        uint32_t runs = 0;
+        uint32_t value = 0, length = 0;
+        for (uint32_t i = 0; i < brickVoxels; i++) {
+            // empty voxels all encode as 0, whatever material they had
+            const uint32_t v = b->density[i] == 0 ? 0u
+                : (static_cast<uint32_t>(b->density[i]) << 24) | (voxels.paletteMaterial(b->material[i]) & 0xFFFFFFu);
+            if (length > 0 && v == value) { length++; continue; }
+            if (length > 0) { put(out, value); put(out, length); runs++; }
+            value = v;
+            length = 1;
+        }
+        put(out, value);
+        put(out, length);
+        runs++;
+
+        std::memcpy(out.data() + runsAt, &runs, sizeof(runs));
+        bricks++;
+    }
+    std::memcpy(out.data() + countAt, &bricks, sizeof(bricks));
+    return out;
+}
+
+bool RegionStore::decodeChunk(const uint8_t* data, size_t size, ChunkStorage& out) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    uint32_t C, shift, bricks;
+    if (!get(p, end, C) || !get(p, end, shift) || !get(p, end, bricks)) return false;
+    if (C != out.size() || shift != out.brickShift()) return false;
+
+    const uint32_t bpa = out.bricksPerAxis();
+    const uint32_t B = 1u << shift;
+    const uint32_t mask = B - 1u;
+    const uint32_t brickVoxels = 1u << (3 * shift);
+
+    out.clear();
+    std::vector<ChunkStorage::Write> batch;
+    batch.reserve(brickVoxels);
+    for (uint32_t b = 0; b < bricks; b++) {
+        uint32_t table, runs;
+        if (!get(p, end, table) || !get(p, end, runs) || table >= bpa * bpa * bpa) return false;
+        const uint32_t bx = table % bpa, by = (table / bpa) % bpa, bz = table / (bpa * bpa);
+
+        batch.clear();
+        uint32_t i = 0;
+        for (uint32_t r = 0; r < runs; r++) {
+            uint32_t value, length;
+            if (!get(p, end, value) || !get(p, end, length) || length > brickVoxels - i) return false;
+            const uint32_t density = value >> 24;
+            for (uint32_t n = 0; n < length; n++, i++) {
+                if (density == 0) continue;
+                batch.push_back({bx * B + (i & mask), by * B + ((i >> shift) & mask), bz * B + (i >> (2 * shift)),
+                                 value & 0xFFFFFFu, ChunkStorage::dequantizeDensity(static_cast<uint8_t>(density))});
+            }
+        }
+        out.set(batch.data(), batch.size());
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,136 @@
+/*
+* File: render_graph.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "render_graph.hpp"
+
+#include <algorithm>
+
+namespace blok {
+
+namespace {
+
+constexpr vk::AccessFlags2 kWriteAccess =
+    vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eTransferWrite |
+    vk::AccessFlagBits2::eColorAttachmentWrite | vk::AccessFlagBits2::eDepthStencilAttachmentWrite;
+
+}
+
+RenderGraph& RenderGraph::pass(vk::PipelineStageFlags2 s, const char* passName) {
+    stage = queueStages(s);
+    name = passName;
+    uses.clear();
+    return *this;
+}
+
+RenderGraph& RenderGraph::read(Image& img, Role role) { add(&img, nullptr, role, false); return *this; }
+RenderGraph& RenderGraph::write(Image& img, Role role) { add(&img, nullptr, role, true); return *this; }
+RenderGraph& RenderGraph::read(Buffer& buf) { add(nullptr, &buf, Role::General, false); return *this; }
+RenderGraph& RenderGraph::write(Buffer& buf) { add(nullptr, &buf, Role::General, true); return *this; }
+
+RenderGraph& RenderGraph::imported(Image& img, vk::PipelineStageFlags2 waitStage) {
+    img.access = {};
+    importedImages.push_back(&img);
+    importedStages.push_back(waitStage);
+    return *this;
+}
+
+void RenderGraph::add(Image* img, Buffer* buf, Role role, bool write) {
+    // the same resource twice in a pass is one read-write use
+    auto it = std::find_if(uses.begin(), uses.end(), [&](const Use& u) {
+        return img ? u.image == img : u.buffer == buf;
+    });
+    if (it == uses.end()) {
+        uses.push_back({img, buf});
+        it = uses.end() - 1;
+    }
+
+    const ImageState desired = ImageTransitions::toLayout(role);
+    if (img && (write || !it->write)) {
+        it->layout = desired.layout;
+        it->aspect = desired.aspect;
+    }
+    it->write = it->write || write;
+    it->access |= accessFor(write);
+}
+
+vk::AccessFlags2 RenderGraph::accessFor(bool write) const {
+    using S = vk::PipelineStageFlagBits2;
+    using A = vk::AccessFlagBits2;
+
+    vk::AccessFlags2 a{};
+    if (stage & (S::eComputeShader | S::eRayTracingShaderKHR | S::eFragmentShader | S::eVertexShader | S::eAllCommands))
+        a |= write ? (A::eShaderRead | A::eShaderWrite) : A::eShaderRead;
+    if (stage & (S::eTransfer | S::eAllCommands))
+        a |= write ? A::eTransferWrite : A::eTransferRead;
+    if ((stage & (S::eDrawIndirect | S::eAllCommands)) && !write)
+        a |= A::eIndirectCommandRead;
+    if (stage & S::eColorAttachmentOutput)
+        a |= write ? (A::eColorAttachmentRead | A::eColorAttachmentWrite) : A::eColorAttachmentRead;
+    if (stage & (S::eEarlyFragmentTests | S::eLateFragmentTests))
+        a |= write ? (A::eDepthStencilAttachmentRead | A::eDepthStencilAttachmentWrite) : A::eDepthStencilAttachmentRead;
+    return a;
+}
+
+void RenderGraph::flush() {
+    vk::MemoryBarrier2 global{};
+    imageBarriers.clear();
+
+    for (Use& u : uses) {
+        AccessState& st = u.image ? u.image->access : u.buffer->access;
+        const vk::PipelineStageFlags2 prior = st.writeStages | st.readStages;
+
+        if (u.image && u.image->currentLayout != u.layout) {
+            vk::ImageMemoryBarrier2 b{};
+            b.oldLayout = u.image->currentLayout;
+            b.newLayout = u.layout;
+            b.srcStageMask = prior;
+            b.srcAccessMask = st.writeAccess;
+            if (!prior) {
+                // nothing recorded, either a semaphore wait we chain off or a guess from the layout
+                auto imp = std::find(importedImages.begin(), importedImages.end(), u.image);
+                if (imp != importedImages.end()) {
+                    b.srcStageMask = importedStages[imp - importedImages.begin()];
+                    b.srcAccessMask = {};
+                } else {
+                    b.srcStageMask = ImageTransitions::stagesFor(u.image->currentLayout);
+                    b.srcAccessMask = ImageTransitions::accessFor(u.image->currentLayout);
+                }
+            }
+            b.srcStageMask = queueStages(b.srcStageMask);
+            b.dstStageMask = stage;
+            b.dstAccessMask = u.access;
+            b.image = u.image->handle;
+            b.subresourceRange = { u.aspect, 0, u.image->mipLevels, 0, u.image->layers };
+            imageBarriers.push_back(b);
+
+            u.image->currentLayout = u.layout;
+            st = {};
+        } else if (u.write ? bool(prior) : (st.writeStages && (st.readStages & stage) != stage)) {
+            // same layout, a plain memory dependency. all of them share one global barrier
+            global.srcStageMask |= queueStages(u.write ? prior : st.writeStages);
+            global.srcAccessMask |= st.writeAccess;
+            global.dstStageMask |= stage;
+            global.dstAccessMask |= u.access;
+        }
+
+        if (u.write) st = { stage, u.access & kWriteAccess, {} };
+        else st.readStages |= stage;
+    }
+    uses.clear();
+
+    if (imageBarriers.empty() && !global.srcStageMask) return;
+
+    vk::DependencyInfo dep{};
+    if (global.srcStageMask) {
+        dep.memoryBarrierCount = 1;
+        dep.pMemoryBarriers = &global;
+    }
+    dep.setImageMemoryBarriers(imageBarriers);
+    cmd.pipelineBarrier2(dep);
+    barriers++;
+}
+
+}
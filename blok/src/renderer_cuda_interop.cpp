@@ -0,0 +1,276 @@
+/*
+* File: renderer_cuda_interop.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+
+#include "renderer_cuda_interop.hpp"
+#include "render_graph.hpp"
+#include "renderer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <vulkan/vulkan_win32.h>
+#endif
+
+namespace blok {
+
+namespace {
+
+#ifdef _WIN32
+constexpr auto MEMORY_HANDLE = vk::ExternalMemoryHandleTypeFlagBits::eOpaqueWin32;
+constexpr auto SEMAPHORE_HANDLE = vk::ExternalSemaphoreHandleTypeFlagBits::eOpaqueWin32;
+#else
+constexpr auto MEMORY_HANDLE = vk::ExternalMemoryHandleTypeFlagBits::eOpaqueFd;
+constexpr auto SEMAPHORE_HANDLE = vk::ExternalSemaphoreHandleTypeFlagBits::eOpaqueFd;
+#endif
+
+// offsets inside a slot, cuda maps the whole allocation and indexes from these
+constexpr vk::DeviceSize TARGET_ALIGN = 256;
+
+vk::DeviceSize texelBytes(vk::Format format) {
+    switch (format) {
+    case vk::Format::eR32G32B32A32Sfloat: return 16;
+    case vk::Format::eR16G16B16A16Sfloat: return 8;
+    case vk::Format::eR32Sfloat:
+    case vk::Format::eR32Uint:
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR16G16Sfloat: return 4;
+    default: throw std::runtime_error("CudaInterop: unhandled gbuffer format");
+    }
+}
+
+void closeHandle(ExternalHandle& handle) {
+#ifdef _WIN32
+    if (handle) CloseHandle(static_cast<HANDLE>(handle));
+    handle = nullptr;
+#else
+    handle = -1; // an fd handed out is owned by the importer
+#endif
+}
+
+}
+
+std::vector<const char*> CudaInterop::deviceExtensions() {
+#ifdef _WIN32
+    return { VK_KHR_EXTERNAL_MEMORY_WIN32_EXTENSION_NAME, VK_KHR_EXTERNAL_SEMAPHORE_WIN32_EXTENSION_NAME };
+#else
+    return { VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME, VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME };
+#endif
+}
+
+CudaInterop::CudaInterop(Renderer* r) : renderer(r) {
+    for (auto& s : m_frame.slots) closeHandle(s.memory);
+    closeHandle(m_frame.traceDone);
+}
+
+void CudaInterop::init(uint32_t width, uint32_t height) {
+    vk::Device device = renderer->m_device;
+
+    vk::PhysicalDeviceIDProperties idProps{};
+    vk::PhysicalDeviceProperties2 props2{};
+    props2.pNext = &idProps;
+    renderer->m_physicalDevice.getProperties2(&props2);
+    std::copy(std::begin(idProps.deviceUUID), std::end(idProps.deviceUUID), m_frame.deviceUuid);
+
+    vk::ExportSemaphoreCreateInfo esi{};
+    esi.handleTypes = SEMAPHORE_HANDLE;
+    vk::SemaphoreTypeCreateInfo tci{};
+    tci.semaphoreType = vk::SemaphoreType::eTimeline;
+    tci.initialValue = 0;
+    tci.pNext = &esi;
+    vk::SemaphoreCreateInfo sci{};
+    sci.pNext = &tci;
+    m_traceDone = device.createSemaphore(sci);
+    m_frame.value = 0;
+
+    createTargets(width, height);
+}
+
+void CudaInterop::cleanup() {
+    destroyTargets();
+    if (m_traceDone) renderer->m_device.destroySemaphore(m_traceDone);
+    m_traceDone = nullptr;
+}
+
+void CudaInterop::resize(uint32_t width, uint32_t height) {
+    // the renderer waited for idle, and the tracer signals every value it was handed before its copy can run
+    destroyTargets();
+    createTargets(width, height);
+}
+
+void CudaInterop::createTargets(uint32_t width, uint32_t height) {
+    vk::Device device = renderer->m_device;
+    const vk::PhysicalDeviceMemoryProperties memProps = renderer->m_physicalDevice.getMemoryProperties();
+    const vk::DeviceSize texels = vk::DeviceSize(width) * height;
+
+    for (uint32_t i = 0; i < m_slots.size(); i++) {
+        ExternalTraceFrame::Slot& layout = m_frame.slots[i];
+        vk::DeviceSize offset = 0;
+        auto place = [&](vk::Format format) {
+            const vk::DeviceSize at = offset;
+            offset = renderer->alignUp(offset + texels * texelBytes(format), TARGET_ALIGN);
+            return at;
+        };
+        layout.colorOffset = place(GBUFFER_COLOR_FORMAT);
+        layout.positionOffset = place(GBUFFER_POSITION_FORMAT);
+        layout.normalOffset = place(GBUFFER_NORMAL_FORMAT);
+        layout.albedoOffset = place(vk::Format::eR8G8B8A8Unorm);
+        layout.motionOffset = place(vk::Format::eR16G16Sfloat);
+
+        vk::ExternalMemoryBufferCreateInfo ebi{};
+        ebi.handleTypes = MEMORY_HANDLE;
+        vk::BufferCreateInfo bci{};
+        bci.pNext = &ebi;
+        bci.size = offset;
+        bci.usage = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+        bci.sharingMode = vk::SharingMode::eExclusive;
+
+        SlotTargets& slot = m_slots[i];
+        slot.buffer.handle = device.createBuffer(bci);
+        slot.buffer.size = offset;
+        slot.buffer.access = {};
+
+        const vk::MemoryRequirements reqs = device.getBufferMemoryRequirements(slot.buffer.handle);
+        uint32_t typeIndex = UINT32_MAX;
+        for (uint32_t t = 0; t < memProps.memoryTypeCount; t++) {
+            if ((reqs.memoryTypeBits & (1u << t)) && (memProps.memoryTypes[t].propertyFlags & vk::MemoryPropertyFlagBits::eDeviceLocal)) {
+                typeIndex = t;
+                break;
+            }
+        }
+        if (typeIndex == UINT32_MAX) throw std::runtime_error("CudaInterop: no device local memory type for the targets");
+
+        // dedicated, cuda imports it with cudaExternalMemoryDedicated
+        vk::MemoryDedicatedAllocateInfo dedicated{};
+        dedicated.buffer = slot.buffer.handle;
+        vk::ExportMemoryAllocateInfo export_{};
+        export_.handleTypes = MEMORY_HANDLE;
+        export_.pNext = &dedicated;
+        vk::MemoryAllocateInfo mai{};
+        mai.pNext = &export_;
+        mai.allocationSize = reqs.size;
+        mai.memoryTypeIndex = typeIndex;
+        slot.memory = device.allocateMemory(mai);
+        device.bindBufferMemory(slot.buffer.handle, slot.memory, 0);
+
+        layout.size = reqs.size;
+        layout.memory = exportMemory(slot.memory);
+    }
+
+#ifdef _WIN32
+    VkSemaphoreGetWin32HandleInfoKHR info{ VK_STRUCTURE_TYPE_SEMAPHORE_GET_WIN32_HANDLE_INFO_KHR };
+    info.semaphore = static_cast<VkSemaphore>(m_traceDone);
+    info.handleType = static_cast<VkExternalSemaphoreHandleTypeFlagBits>(SEMAPHORE_HANDLE);
+    auto getHandle = reinterpret_cast<PFN_vkGetSemaphoreWin32HandleKHR>(device.getProcAddr("vkGetSemaphoreWin32HandleKHR"));
+    HANDLE handle = nullptr;
+    if (getHandle(static_cast<VkDevice>(device), &info, &handle) != VK_SUCCESS)
+        throw std::runtime_error("CudaInterop: vkGetSemaphoreWin32HandleKHR failed");
+    m_frame.traceDone = handle;
+#else
+    vk::SemaphoreGetFdInfoKHR info{};
+    info.semaphore = m_traceDone;
+    info.handleType = SEMAPHORE_HANDLE;
+    m_frame.traceDone = device.getSemaphoreFdKHR(info);
+#endif
+
+    m_frame.generation++;
+}
+
+void CudaInterop::destroyTargets() {
+    vk::Device device = renderer->m_device;
+    closeHandles();
+    for (auto& slot : m_slots) {
+        if (slot.buffer.handle) device.destroyBuffer(slot.buffer.handle);
+        if (slot.memory) device.freeMemory(slot.memory);
+        slot = {};
+    }
+}
+
+ExternalHandle CudaInterop::exportMemory(vk::DeviceMemory memory) const {
+    vk::Device device = renderer->m_device;
+#ifdef _WIN32
+    VkMemoryGetWin32HandleInfoKHR info{ VK_STRUCTURE_TYPE_MEMORY_GET_WIN32_HANDLE_INFO_KHR };
+    info.memory = static_cast<VkDeviceMemory>(memory);
+    info.handleType = static_cast<VkExternalMemoryHandleTypeFlagBits>(MEMORY_HANDLE);
+    auto getHandle = reinterpret_cast<PFN_vkGetMemoryWin32HandleKHR>(device.getProcAddr("vkGetMemoryWin32HandleKHR"));
+    HANDLE handle = nullptr;
+    if (getHandle(static_cast<VkDevice>(device), &info, &handle) != VK_SUCCESS)
+        throw std::runtime_error("CudaInterop: vkGetMemoryWin32HandleKHR failed");
+    return handle;
+#else
+    vk::MemoryGetFdInfoKHR info{};
+    info.memory = memory;
+    info.handleType = MEMORY_HANDLE;
+    return device.getMemoryFdKHR(info);
+#endif
+}
+
+void CudaInterop::closeHandles() {
+    for (auto& s : m_frame.slots) closeHandle(s.memory);
+    closeHandle(m_frame.traceDone);
+}
+
+uint64_t CudaInterop::trace(const FrameUBO& ubo, uint32_t slot, uint32_t width, uint32_t height) {
+    m_frame.value++;
+    m_frame.slot = slot;
+    m_frame.width = width;
+    m_frame.height = height;
+    m_frame.ubo = &ubo;
+    m_tracer(m_frame);
+    m_frame.ubo = nullptr;
+    return m_frame.value;
+}
+
+void CudaInterop::record(RenderGraph& graph, uint32_t slot) {
+    auto& gbuffer = renderer->m_denoiser.gbuffer;
+    Buffer& src = m_slots[slot].buffer;
+    const ExternalTraceFrame::Slot& layout = m_frame.slots[slot];
+    const vk::Extent2D extent = renderer->m_renderExtent;
+
+    graph.pass(vk::PipelineStageFlagBits2::eTransfer, "External Trace")
+        .read(src)
+        .write(gbuffer.color, Role::TransferDst)
+        .write(gbuffer.currentWorldPosition(), Role::TransferDst)
+        .write(gbuffer.currentNormalRoughness(), Role::TransferDst)
+        .write(gbuffer.albedoMetallic, Role::TransferDst)
+        .write(gbuffer.motionVectors, Role::TransferDst)
+        .run([&](vk::CommandBuffer cmd) {
+            auto copy = [&](vk::DeviceSize offset, Image& dst) {
+                vk::BufferImageCopy region{};
+                region.bufferOffset = offset;
+                region.imageSubresource = { vk::ImageAspectFlagBits::eColor, 0, 0, 1 };
+                region.imageExtent = vk::Extent3D{ extent.width, extent.height, 1 };
+                cmd.copyBufferToImage(src.handle, dst.handle, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+            };
+            copy(layout.colorOffset, gbuffer.color);
+            copy(layout.positionOffset, gbuffer.currentWorldPosition());
+            copy(layout.normalOffset, gbuffer.currentNormalRoughness());
+            copy(layout.albedoOffset, gbuffer.albedoMetallic);
+            copy(layout.motionOffset, gbuffer.motionVectors);
+        });
+}
+
+bool Renderer::setExternalTracer(ExternalTracer tracer) {
+    if (!m_cudaInterop.supported) return false;
+
+    flushPendingPresent();
+    m_device.waitIdle();
+
+    const bool wasActive = m_cudaInterop.active();
+    m_cudaInterop.setTracer(std::move(tracer));
+    if (m_cudaInterop.active() && !wasActive) m_cudaInterop.init(m_swapExtent.width, m_swapExtent.height);
+    if (!m_cudaInterop.active() && wasActive) m_cudaInterop.cleanup();
+    // its slots come in pairs
+    applyFramesInFlight();
+    return true;
+}
+
+}
@@ -6,7 +6,10 @@
 */
 #include "renderer_denoising.hpp"
 
-#include "image_states.hpp"
+#include <algorithm>
+#include <cstddef>
+
+#include "render_graph.hpp"
 #include "renderer.hpp"
 
 namespace blok {
@@ -20,13 +23,20 @@ Denoiser::Denoiser(Renderer *r)
 }
 
 void Denoiser::init(uint32_t width, uint32_t height) {
-    createGBuffer(width, height);
+    const vk::Extent2D pool = renderer->renderTargetExtent({ width, height });
+    createGBuffer(pool.width, pool.height);
     createSamplers();
     createDescriptorSetLayouts();
     allocateDescriptorSets();
-    createTemporalPipeline();
-    createVariancePipeline();
-    createAtrousPipeline();
+    // each pipeline only touches its own members, so they can be built side by side during startup
+    renderer->startupJob([this] { createTemporalPipeline(); });
+    renderer->startupJob([this] { createVariancePipeline(); });
+    renderer->startupJob([this] { createAtrousPipeline(); });
+    renderer->startupJob([this] { createFusedAtrousPipeline(); });
+    renderer->startupJob([this] { createDownsamplePipeline(); });
+    renderer->startupJob([this] { createUpsamplePipeline(); });
+    renderer->startupJob([this] { createClassifyPipeline(); });
+    renderer->startupJob([this] { createProgressivePipeline(); });
 
     // Initialize all per-frame descriptor sets
     for (uint32_t i = 0; i < DenoiserPipeline::MAX_FRAMES_IN_FLIGHT; ++i) {
@@ -80,6 +90,71 @@ void Denoiser::cleanup() {
         pipeline.atrousSetLayout = nullptr;
     }
 
+    if (pipeline.fusedPipeline) {
+        device.destroyPipeline(pipeline.fusedPipeline);
+        pipeline.fusedPipeline = nullptr;
+    }
+    if (pipeline.fusedPipelineLayout) {
+        device.destroyPipelineLayout(pipeline.fusedPipelineLayout);
+        pipeline.fusedPipelineLayout = nullptr;
+    }
+    if (pipeline.fusedSetLayout) {
+        device.destroyDescriptorSetLayout(pipeline.fusedSetLayout);
+        pipeline.fusedSetLayout = nullptr;
+    }
+
+    if (pipeline.downsamplePipeline) {
+        device.destroyPipeline(pipeline.downsamplePipeline);
+        pipeline.downsamplePipeline = nullptr;
+    }
+    if (pipeline.downsamplePipelineLayout) {
+        device.destroyPipelineLayout(pipeline.downsamplePipelineLayout);
+        pipeline.downsamplePipelineLayout = nullptr;
+    }
+    if (pipeline.downsampleSetLayout) {
+        device.destroyDescriptorSetLayout(pipeline.downsampleSetLayout);
+        pipeline.downsampleSetLayout = nullptr;
+    }
+
+    if (pipeline.upsamplePipeline) {
+        device.destroyPipeline(pipeline.upsamplePipeline);
+        pipeline.upsamplePipeline = nullptr;
+    }
+    if (pipeline.upsamplePipelineLayout) {
+        device.destroyPipelineLayout(pipeline.upsamplePipelineLayout);
+        pipeline.upsamplePipelineLayout = nullptr;
+    }
+    if (pipeline.upsampleSetLayout) {
+        device.destroyDescriptorSetLayout(pipeline.upsampleSetLayout);
+        pipeline.upsampleSetLayout = nullptr;
+    }
+
+    if (pipeline.classifyPipeline) {
+        device.destroyPipeline(pipeline.classifyPipeline);
+        pipeline.classifyPipeline = nullptr;
+    }
+    if (pipeline.classifyPipelineLayout) {
+        device.destroyPipelineLayout(pipeline.classifyPipelineLayout);
+        pipeline.classifyPipelineLayout = nullptr;
+    }
+    if (pipeline.classifySetLayout) {
+        device.destroyDescriptorSetLayout(pipeline.classifySetLayout);
+        pipeline.classifySetLayout = nullptr;
+    }
+
+    if (pipeline.progressivePipeline) {
+        device.destroyPipeline(pipeline.progressivePipeline);
+        pipeline.progressivePipeline = nullptr;
+    }
+    if (pipeline.progressivePipelineLayout) {
+        device.destroyPipelineLayout(pipeline.progressivePipelineLayout);
+        pipeline.progressivePipelineLayout = nullptr;
+    }
+    if (pipeline.progressiveSetLayout) {
+        device.destroyDescriptorSetLayout(pipeline.progressiveSetLayout);
+        pipeline.progressiveSetLayout = nullptr;
+    }
+
     // Destroy samplers
     if (pipeline.linearSampler) {
         device.destroySampler(pipeline.linearSampler);
@@ -94,91 +169,98 @@ void Denoiser::cleanup() {
 }
 
 void Denoiser::resize(uint32_t width, uint32_t height) {
-    renderer->m_device.waitIdle();
-
-    destroyGBuffer();
-    createGBuffer(width, height);
-
-    for (uint32_t i = 0; i < DenoiserPipeline::MAX_FRAMES_IN_FLIGHT; ++i) {
-        updateDescriptorSets(i);
+    // the parked set and the stats buffer depend on settings, not just the size
+    const bool fits = width <= capacity.width && height <= capacity.height &&
+        capacityAsync == renderer->m_asyncCompute && capacityStats == renderer->m_raytracer.settings.traversalStats;
+    if (!fits) {
+        renderer->m_device.waitIdle();
+
+        destroyGBuffer();
+        const vk::Extent2D pool = renderer->renderTargetExtent({ width, height });
+        createGBuffer(pool.width, pool.height);
+
+        for (uint32_t i = 0; i < DenoiserPipeline::MAX_FRAMES_IN_FLIGHT; ++i) {
+            updateDescriptorSets(i);
+        }
     }
 
-    // Reset history since we resized
+    // what's in the targets is laid out for the old size. temporal gets that as TemporalPC::historyValid,
+    // restir and adaptive sampling check hasPreviousFrame themselves
     hasPreviousFrame = false;
+    progressiveFrames = 0;
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT_MAX; i++) gbuffer.sampleBudgetWritten[i] = false;
 }
 
 void Denoiser::createGBuffer(uint32_t width, uint32_t height) {
-    // color buffer (raw output)
-    gbuffer.color = renderer->createImage(
-        width, height,
-        vk::Format::eR32G32B32A32Sfloat,
-        vk::ImageUsageFlagBits::eStorage |
-        vk::ImageUsageFlagBits::eSampled |
-        vk::ImageUsageFlagBits::eTransferSrc,
-        vk::ImageTiling::eOptimal,
-        vk::SampleCountFlagBits::e1,
-        1, 1,
-        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-    );
-
-    // world position XYZ + depth W
-    gbuffer.worldPosition = renderer->createImage(
-        width, height,
-        vk::Format::eR32G32B32A32Sfloat,
-        vk::ImageUsageFlagBits::eStorage |
-        vk::ImageUsageFlagBits::eSampled |
-        vk::ImageUsageFlagBits::eTransferSrc,
-        vk::ImageTiling::eOptimal,
-        vk::SampleCountFlagBits::e1,
-        1, 1,
-        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-    );
-
-    // normal XYZ + roughness W
-    gbuffer.normalRoughness = renderer->createImage(
-        width, height,
-        vk::Format::eR16G16B16A16Sfloat,
-        vk::ImageUsageFlagBits::eStorage |
-        vk::ImageUsageFlagBits::eSampled |
-        vk::ImageUsageFlagBits::eTransferSrc,
-        vk::ImageTiling::eOptimal,
-        vk::SampleCountFlagBits::e1,
-        1, 1,
-        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-    );
+    capacity = vk::Extent2D{ width, height };
+    capacityAsync = renderer->m_asyncCompute;
+    capacityStats = renderer->m_raytracer.settings.traversalStats;
+
+    // ray tracing outputs, a second parked set with async compute (see GBuffer::parked).
+    // transfer dst on everything the tracer writes, CudaInterop copies an external tracer's frame in
+    auto createRayTargets = [&](GBuffer::RayTargets& t) {
+        // color buffer (raw output)
+        t.color = renderer->createImage(
+            width, height,
+            GBUFFER_COLOR_FORMAT,
+            vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eSampled |
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst,
+            vk::ImageTiling::eOptimal,
+            vk::SampleCountFlagBits::e1,
+            1, 1,
+            VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        );
 
-    // albedo XYZ + metallic W
-    gbuffer.albedoMetallic = renderer->createImage(
-        width, height,
-        vk::Format::eR8G8B8A8Unorm,
-        vk::ImageUsageFlagBits::eStorage |
-        vk::ImageUsageFlagBits::eSampled,
-        vk::ImageTiling::eOptimal,
-        vk::SampleCountFlagBits::e1,
-        1, 1,
-        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-    );
+        // albedo XYZ + metallic W
+        t.albedoMetallic = renderer->createImage(
+            width, height,
+            vk::Format::eR8G8B8A8Unorm,
+            vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eSampled |
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst,
+            vk::ImageTiling::eOptimal,
+            vk::SampleCountFlagBits::e1,
+            1, 1,
+            VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        );
 
-    // motion vectors
-    gbuffer.motionVectors = renderer->createImage(
-        width, height,
-        vk::Format::eR16G16Sfloat,
-        vk::ImageUsageFlagBits::eStorage |
-        vk::ImageUsageFlagBits::eSampled,
-        vk::ImageTiling::eOptimal,
-        vk::SampleCountFlagBits::e1,
-        1, 1,
-        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-    );
+        // motion vectors
+        t.motionVectors = renderer->createImage(
+            width, height,
+            vk::Format::eR16G16Sfloat,
+            vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eSampled |
+            vk::ImageUsageFlagBits::eTransferDst,
+            vk::ImageTiling::eOptimal,
+            vk::SampleCountFlagBits::e1,
+            1, 1,
+            VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        );
+    };
 
-    // Double-buffered history
-    for (int i = 0; i < 2; i++) {
+    GBuffer::RayTargets live{};
+    createRayTargets(live);
+    gbuffer.color = live.color;
+    gbuffer.albedoMetallic = live.albedoMetallic;
+    gbuffer.motionVectors = live.motionVectors;
+    if (renderer->m_asyncCompute) createRayTargets(gbuffer.parked);
+    gbuffer.targetsFrame = 0;
+
+    // geometry slots, the ray tracer writes the current one and the denoiser reads it back as previous next frame
+    gbuffer.geometrySlots = renderer->m_asyncCompute ? GBuffer::MAX_GEOMETRY_SLOTS : 2;
+    gbuffer.geometryIndex = 0;
+    for (uint32_t i = 0; i < gbuffer.geometrySlots; i++) {
+        // world position XYZ + depth W
         gbuffer.worldPositionHistory[i] = renderer->createImage(
             width, height,
-            vk::Format::eR32G32B32A32Sfloat,
+            GBUFFER_POSITION_FORMAT,
             vk::ImageUsageFlagBits::eStorage |
             vk::ImageUsageFlagBits::eSampled |
-            vk::ImageUsageFlagBits::eTransferDst,  // Destination for copy
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst,
             vk::ImageTiling::eOptimal,
             vk::SampleCountFlagBits::e1,
             1, 1,
@@ -186,12 +268,14 @@ void Denoiser::createGBuffer(uint32_t width, uint32_t height) {
         );
         gbuffer.worldPositionHistory[i].currentLayout = vk::ImageLayout::eUndefined;
 
+        // normal XYZ + roughness W
         gbuffer.normalRoughnessHistory[i] = renderer->createImage(
             width, height,
-            vk::Format::eR16G16B16A16Sfloat,
+            GBUFFER_NORMAL_FORMAT,
             vk::ImageUsageFlagBits::eStorage |
             vk::ImageUsageFlagBits::eSampled |
-            vk::ImageUsageFlagBits::eTransferDst,  // Destination for copy
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst,
             vk::ImageTiling::eOptimal,
             vk::SampleCountFlagBits::e1,
             1, 1,
@@ -235,6 +319,13 @@ void Denoiser::createGBuffer(uint32_t width, uint32_t height) {
             1, 1,
             VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
         );
+
+        gbuffer.reservoirs[i] = renderer->createBuffer(
+            vk::DeviceSize(width) * height * RESTIR_RESERVOIR_BYTES,
+            vk::BufferUsageFlagBits::eStorageBuffer,
+            0,
+            VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        );
     }
 
     // Variance buffer
@@ -249,10 +340,24 @@ void Denoiser::createGBuffer(uint32_t width, uint32_t height) {
         VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
     );
 
+    // Sample budget maps, written by variance estimation and read by the next traces
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT_MAX; i++) {
+        gbuffer.sampleBudget[i] = renderer->createImage(
+            width, height,
+            vk::Format::eR8Unorm,
+            vk::ImageUsageFlagBits::eStorage,
+            vk::ImageTiling::eOptimal,
+            vk::SampleCountFlagBits::e1,
+            1, 1,
+            VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        );
+        gbuffer.sampleBudgetWritten[i] = false;
+    }
+
     // Ping-pong buffers for à-trous filtering
     gbuffer.filterPing = renderer->createImage(
         width, height,
-        vk::Format::eR32G32B32A32Sfloat,
+        GBUFFER_COLOR_FORMAT,
         vk::ImageUsageFlagBits::eStorage |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eTransferSrc,
@@ -263,8 +368,99 @@ void Denoiser::createGBuffer(uint32_t width, uint32_t height) {
     );
 
     gbuffer.filterPong = renderer->createImage(
+        width, height,
+        GBUFFER_COLOR_FORMAT,
+        vk::ImageUsageFlagBits::eStorage |
+        vk::ImageUsageFlagBits::eSampled |
+        vk::ImageUsageFlagBits::eTransferSrc,
+        vk::ImageTiling::eOptimal,
+        vk::SampleCountFlagBits::e1,
+        1, 1,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
+    // Half resolution irradiance + variance, see Settings::halfResolution
+    const uint32_t halfWidth = (width + 1) / 2;
+    const uint32_t halfHeight = (height + 1) / 2;
+    gbuffer.halfPing = renderer->createImage(
+        halfWidth, halfHeight,
+        GBUFFER_COLOR_FORMAT,
+        vk::ImageUsageFlagBits::eStorage |
+        vk::ImageUsageFlagBits::eSampled,
+        vk::ImageTiling::eOptimal,
+        vk::SampleCountFlagBits::e1,
+        1, 1,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
+    gbuffer.halfPong = renderer->createImage(
+        halfWidth, halfHeight,
+        GBUFFER_COLOR_FORMAT,
+        vk::ImageUsageFlagBits::eStorage |
+        vk::ImageUsageFlagBits::eSampled,
+        vk::ImageTiling::eOptimal,
+        vk::SampleCountFlagBits::e1,
+        1, 1,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
+    gbuffer.halfVariance = renderer->createImage(
+        halfWidth, halfHeight,
+        vk::Format::eR32Sfloat,
+        vk::ImageUsageFlagBits::eStorage,
+        vk::ImageTiling::eOptimal,
+        vk::SampleCountFlagBits::e1,
+        1, 1,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
+    // Adaptive a-trous tile lists, room for every tile in both
+    const vk::DeviceSize tileCount = vk::DeviceSize((width + ATROUS_TILE_SIZE - 1) / ATROUS_TILE_SIZE) *
+                                     ((height + ATROUS_TILE_SIZE - 1) / ATROUS_TILE_SIZE);
+    gbuffer.atrousTiles = renderer->createBuffer(
+        ATROUS_TILE_HEADER_BYTES + tileCount * 2 * sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eIndirectBuffer |
+        vk::BufferUsageFlagBits::eTransferDst,
+        0,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
+    // Rasterized primary visibility, the visibility pass renders it and raygen loads it
+    gbuffer.visibility = renderer->createImage(
+        width, height,
+        vk::Format::eR32G32B32A32Uint,
+        vk::ImageUsageFlagBits::eColorAttachment |
+        vk::ImageUsageFlagBits::eStorage,
+        vk::ImageTiling::eOptimal,
+        vk::SampleCountFlagBits::e1,
+        1, 1,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
+    // Traversal stats, per pixel entries + per launch scratch, only sized for the screen while they're on
+    const vk::DeviceSize statsEntries = renderer->m_raytracer.settings.traversalStats ? vk::DeviceSize(width) * height * 2 : 1;
+    gbuffer.traversalStats = renderer->createBuffer(
+        statsEntries * 4 * sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        0,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
+    // Progressive accumulation, full precision sum + the mean post reads
+    gbuffer.accumulation = renderer->createImage(
         width, height,
         vk::Format::eR32G32B32A32Sfloat,
+        vk::ImageUsageFlagBits::eStorage,
+        vk::ImageTiling::eOptimal,
+        vk::SampleCountFlagBits::e1,
+        1, 1,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
+    gbuffer.progressive = renderer->createImage(
+        width, height,
+        GBUFFER_COLOR_FORMAT,
         vk::ImageUsageFlagBits::eStorage |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eTransferSrc,
@@ -273,6 +469,7 @@ void Denoiser::createGBuffer(uint32_t width, uint32_t height) {
         1, 1,
         VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
     );
+    progressiveFrames = 0;
 
     gbuffer.historyIndex = 0;
 }
@@ -288,13 +485,13 @@ void Denoiser::destroyGBuffer() {
     };
 
     destroyImage(gbuffer.color);
-    destroyImage(gbuffer.worldPosition);
-    destroyImage(gbuffer.normalRoughness);
     destroyImage(gbuffer.albedoMetallic);
     destroyImage(gbuffer.motionVectors);
+    destroyImage(gbuffer.parked.color);
+    destroyImage(gbuffer.parked.albedoMetallic);
+    destroyImage(gbuffer.parked.motionVectors);
 
-    // ADD: Destroy geometry history
-    for (int i = 0; i < 2; i++) {
+    for (uint32_t i = 0; i < GBuffer::MAX_GEOMETRY_SLOTS; i++) {
         destroyImage(gbuffer.worldPositionHistory[i]);
         destroyImage(gbuffer.normalRoughnessHistory[i]);
     }
@@ -303,11 +500,24 @@ void Denoiser::destroyGBuffer() {
         destroyImage(gbuffer.historyColor[i]);
         destroyImage(gbuffer.historyMoments[i]);
         destroyImage(gbuffer.historyLength[i]);
+        if (gbuffer.reservoirs[i].handle) vmaDestroyBuffer(allocator, gbuffer.reservoirs[i].handle, gbuffer.reservoirs[i].alloc);
+        gbuffer.reservoirs[i] = {};
     }
 
     destroyImage(gbuffer.variance);
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT_MAX; i++) destroyImage(gbuffer.sampleBudget[i]);
     destroyImage(gbuffer.filterPing);
     destroyImage(gbuffer.filterPong);
+    destroyImage(gbuffer.halfPing);
+    destroyImage(gbuffer.halfPong);
+    destroyImage(gbuffer.halfVariance);
+    if (gbuffer.atrousTiles.handle) vmaDestroyBuffer(allocator, gbuffer.atrousTiles.handle, gbuffer.atrousTiles.alloc);
+    gbuffer.atrousTiles = {};
+    destroyImage(gbuffer.visibility);
+    if (gbuffer.traversalStats.handle) vmaDestroyBuffer(allocator, gbuffer.traversalStats.handle, gbuffer.traversalStats.alloc);
+    gbuffer.traversalStats = {};
+    destroyImage(gbuffer.accumulation);
+    destroyImage(gbuffer.progressive);
 }
 
 void Denoiser::createSamplers() {
@@ -386,7 +596,9 @@ void Denoiser::createDescriptorSetLayouts() {
         // 5: World Position
         {5, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
         // 6: Normal / Roughness
-        {6, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute}
+        {6, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 7: Output sample budget
+        {7, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute}
     };
 
     vk::DescriptorSetLayoutCreateInfo varianceCi{};
@@ -407,11 +619,119 @@ void Denoiser::createDescriptorSetLayouts() {
         {4, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
         // 5: Frame UBO
         {5, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        // 6: Tile lists (adaptive iterations)
+        {6, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
     };
 
     vk::DescriptorSetLayoutCreateInfo atrousCi{};
     atrousCi.setBindings(atrousBindings);
     pipeline.atrousSetLayout = renderer->m_device.createDescriptorSetLayout(atrousCi);
+
+    // Fused Variance + Atrous Layout
+    std::vector<vk::DescriptorSetLayoutBinding> fusedBindings = {
+        // 0: Accumulated color (iteration 0 input)
+        {0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute},
+        // 1: Raw color (variance input)
+        {1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 2: Moments
+        {2, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 3: History length
+        {3, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 4: World position + depth
+        {4, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 5: Normal + roughness
+        {5, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 6: Output variance
+        {6, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 7: Output color (iteration 1 result, pong)
+        {7, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 8: Frame UBO
+        {8, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        // 9: Output sample budget
+        {9, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+    };
+
+    vk::DescriptorSetLayoutCreateInfo fusedCi{};
+    fusedCi.setBindings(fusedBindings);
+    pipeline.fusedSetLayout = renderer->m_device.createDescriptorSetLayout(fusedCi);
+
+    // Adaptive A-Trous Tile Classification Layout
+    std::vector<vk::DescriptorSetLayoutBinding> classifyBindings = {
+        // 0: Variance
+        {0, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 1: History length
+        {1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 2: World position + depth
+        {2, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 3: Output tile lists
+        {3, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+    };
+
+    vk::DescriptorSetLayoutCreateInfo classifyCi{};
+    classifyCi.setBindings(classifyBindings);
+    pipeline.classifySetLayout = renderer->m_device.createDescriptorSetLayout(classifyCi);
+
+    // Half Resolution Downsample Layout
+    std::vector<vk::DescriptorSetLayoutBinding> downsampleBindings = {
+        // 0: Accumulated color
+        {0, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 1: Albedo + metallic
+        {1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 2: Variance
+        {2, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 3: World position + depth
+        {3, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 4: Normal + roughness
+        {4, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 5: Output half res irradiance
+        {5, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 6: Output half res variance
+        {6, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 7: Frame UBO
+        {7, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+    };
+
+    vk::DescriptorSetLayoutCreateInfo downsampleCi{};
+    downsampleCi.setBindings(downsampleBindings);
+    pipeline.downsampleSetLayout = renderer->m_device.createDescriptorSetLayout(downsampleCi);
+
+    // Half Resolution Upsample Layout
+    std::vector<vk::DescriptorSetLayoutBinding> upsampleBindings = {
+        // 0: Filtered half res irradiance
+        {0, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 1: Accumulated color (fallback + sky)
+        {1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 2: Albedo + metallic
+        {2, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 3: World position + depth
+        {3, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 4: Normal + roughness
+        {4, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 5: Output color
+        {5, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 6: Frame UBO
+        {6, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+    };
+
+    vk::DescriptorSetLayoutCreateInfo upsampleCi{};
+    upsampleCi.setBindings(upsampleBindings);
+    pipeline.upsampleSetLayout = renderer->m_device.createDescriptorSetLayout(upsampleCi);
+
+    // Progressive Accumulation Layout
+    std::vector<vk::DescriptorSetLayoutBinding> progressiveBindings = {
+        // 0: Raw color
+        {0, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 1: Accumulation (read + write)
+        {1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 2: Denoised color (a-trous output)
+        {2, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 3: Output mean
+        {3, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+    };
+
+    vk::DescriptorSetLayoutCreateInfo progressiveCi{};
+    progressiveCi.setBindings(progressiveBindings);
+    pipeline.progressiveSetLayout = renderer->m_device.createDescriptorSetLayout(progressiveCi);
 }
 
 void Denoiser::allocateDescriptorSets() {
@@ -425,19 +745,46 @@ void Denoiser::allocateDescriptorSets() {
         for (int iter = 0; iter < DenoiserPipeline::MAX_ATROUS_ITERATIONS; ++iter) {
             pipeline.atrousSets[i][iter] = renderer->m_descAlloc.allocate(
                 renderer->m_device, pipeline.atrousSetLayout);
+            pipeline.halfAtrousSets[i][iter] = renderer->m_descAlloc.allocate(
+                renderer->m_device, pipeline.atrousSetLayout);
         }
+
+        pipeline.classifySets[i] = renderer->m_descAlloc.allocate(
+            renderer->m_device, pipeline.classifySetLayout);
+
+        pipeline.downsampleSets[i] = renderer->m_descAlloc.allocate(
+            renderer->m_device, pipeline.downsampleSetLayout);
+
+        pipeline.upsampleSets[i] = renderer->m_descAlloc.allocate(
+            renderer->m_device, pipeline.upsampleSetLayout);
+
+        pipeline.fusedSets[i] = renderer->m_descAlloc.allocate(
+            renderer->m_device, pipeline.fusedSetLayout);
+
+        pipeline.progressiveSets[i] = renderer->m_descAlloc.allocate(
+            renderer->m_device, pipeline.progressiveSetLayout);
     }
 }
 
 void Denoiser::updateDescriptorSets(uint32_t frameIndex) {
+    // every image here is recreated together on resize, the history ones flip with historyIndex, the geometry
+    // slots rotate with geometryIndex and the ray targets with the frame under async compute. the a-trous outputs
+    // flip between ping and pong with the iteration count
+    const bool changed = pipeline.setKeys[frameIndex].changed({
+        renderer->m_resizeGeneration, gbuffer.historyIndex, gbuffer.geometryIndex, descriptorKey(gbuffer.color.view),
+        descriptorKey(renderer->m_frames[frameIndex].frameUBO.handle), descriptorKey(atrousOutput().view),
+        descriptorKey(halfAtrousOutput().view)
+    });
+    if (!changed) return;
+
     // Temporal Accumulation Descriptor Set
     {
         vk::DescriptorSet set = pipeline.temporalSets[frameIndex];
 
         // Current frame inputs
         vk::DescriptorImageInfo currentColorInfo{nullptr, gbuffer.color.view, vk::ImageLayout::eGeneral};
-        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.worldPosition.view, vk::ImageLayout::eGeneral};
-        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.normalRoughness.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.currentNormalRoughness().view, vk::ImageLayout::eGeneral};
         vk::DescriptorImageInfo motionInfo{nullptr, gbuffer.motionVectors.view, vk::ImageLayout::eGeneral};
 
         // Previous frame inputs (sampled for interpolation)
@@ -489,13 +836,14 @@ void Denoiser::updateDescriptorSets(uint32_t frameIndex) {
         vk::DescriptorImageInfo momentsInfo{nullptr, gbuffer.currentMoments().view, vk::ImageLayout::eGeneral};
         vk::DescriptorImageInfo histLenInfo{nullptr, gbuffer.currentHistoryLength().view, vk::ImageLayout::eGeneral};
         vk::DescriptorImageInfo varianceInfo{nullptr, gbuffer.variance.view, vk::ImageLayout::eGeneral};
-        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.worldPosition.view, vk::ImageLayout::eGeneral};
-        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.normalRoughness.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.currentNormalRoughness().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo budgetInfo{nullptr, gbuffer.sampleBudget[frameIndex].view, vk::ImageLayout::eGeneral};
 
         auto& fr = renderer->m_frames[frameIndex];
         vk::DescriptorBufferInfo uboInfo{fr.frameUBO.handle, 0, sizeof(FrameUBO)};
 
-        std::array<vk::WriteDescriptorSet, 7> writes{};
+        std::array<vk::WriteDescriptorSet, 8> writes{};
         writes[0] = {set, 0, 0, 1, vk::DescriptorType::eStorageImage, &colorInfo};
         writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageImage, &momentsInfo};
         writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &histLenInfo};
@@ -503,6 +851,7 @@ void Denoiser::updateDescriptorSets(uint32_t frameIndex) {
         writes[4] = {set, 4, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &uboInfo};
         writes[5] = {set, 5, 0, 1, vk::DescriptorType::eStorageImage, &worldPosInfo};
         writes[6] = {set, 6, 0, 1, vk::DescriptorType::eStorageImage, &normalInfo};
+        writes[7] = {set, 7, 0, 1, vk::DescriptorType::eStorageImage, &budgetInfo};
 
         renderer->m_device.updateDescriptorSets(writes, {});
     }
@@ -514,8 +863,9 @@ void Denoiser::updateDescriptorSets(uint32_t frameIndex) {
 
         // Common descriptors for all iterations
         vk::DescriptorImageInfo varianceInfo{nullptr, gbuffer.variance.view, vk::ImageLayout::eGeneral};
-        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.worldPosition.view, vk::ImageLayout::eGeneral};
-        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.normalRoughness.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.currentNormalRoughness().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorBufferInfo tilesInfo{gbuffer.atrousTiles.handle, 0, VK_WHOLE_SIZE};
 
         for (int iter = 0; iter < DenoiserPipeline::MAX_ATROUS_ITERATIONS; ++iter) {
             vk::DescriptorSet set = pipeline.atrousSets[frameIndex][iter];
@@ -542,50 +892,214 @@ void Denoiser::updateDescriptorSets(uint32_t frameIndex) {
             };
             vk::DescriptorImageInfo outputInfo{nullptr, outputImage->view, vk::ImageLayout::eGeneral};
 
-            std::array<vk::WriteDescriptorSet, 6> writes{};
+            std::array<vk::WriteDescriptorSet, 7> writes{};
             writes[0] = {set, 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &inputInfo};
             writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageImage, &varianceInfo};
             writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &worldPosInfo};
             writes[3] = {set, 3, 0, 1, vk::DescriptorType::eStorageImage, &normalInfo};
             writes[4] = {set, 4, 0, 1, vk::DescriptorType::eStorageImage, &outputInfo};
             writes[5] = {set, 5, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &uboInfo};
+            writes[6] = {set, 6, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &tilesInfo};
 
             renderer->m_device.updateDescriptorSets(writes, {});
         }
     }
-}
-
-void Denoiser::createTemporalPipeline() {
-    auto shaderModule = renderer->m_shaderManager.loadModule(
-        "assets/shaders/temporal_reproject.comp",
-        vk::ShaderStageFlagBits::eCompute
-    );
 
-    vk::PipelineShaderStageCreateInfo stageInfo{};
-    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
-    stageInfo.module = shaderModule.module;
-    stageInfo.pName = "main";
+    // Half Resolution Atrous Descriptor Sets, the downsample leaves its irradiance in pong
+    {
+        auto& fr = renderer->m_frames[frameIndex];
+        vk::DescriptorBufferInfo uboInfo{fr.frameUBO.handle, 0, sizeof(FrameUBO)};
 
-    vk::PipelineLayoutCreateInfo layoutInfo{};
-    layoutInfo.setLayoutCount = 1;
-    layoutInfo.pSetLayouts = &pipeline.temporalSetLayout;
+        vk::DescriptorImageInfo varianceInfo{nullptr, gbuffer.halfVariance.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.currentNormalRoughness().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorBufferInfo tilesInfo{gbuffer.atrousTiles.handle, 0, VK_WHOLE_SIZE};
 
-    pipeline.temporalPipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+        for (int iter = 0; iter < DenoiserPipeline::MAX_ATROUS_ITERATIONS; ++iter) {
+            vk::DescriptorSet set = pipeline.halfAtrousSets[frameIndex][iter];
 
-    vk::ComputePipelineCreateInfo pipelineInfo{};
-    pipelineInfo.stage = stageInfo;
-    pipelineInfo.layout = pipeline.temporalPipelineLayout;
+            Image& inputImage = iter % 2 == 0 ? gbuffer.halfPong : gbuffer.halfPing;
+            Image& outputImage = iter % 2 == 0 ? gbuffer.halfPing : gbuffer.halfPong;
 
-    auto result = renderer->m_device.createComputePipeline(nullptr, pipelineInfo);
-    pipeline.temporalPipeline = result.value;
+            vk::DescriptorImageInfo inputInfo{pipeline.linearSampler, inputImage.view, vk::ImageLayout::eGeneral};
+            vk::DescriptorImageInfo outputInfo{nullptr, outputImage.view, vk::ImageLayout::eGeneral};
 
-    renderer->m_device.destroyShaderModule(shaderModule.module);
+            std::array<vk::WriteDescriptorSet, 7> writes{};
+            writes[0] = {set, 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &inputInfo};
+            writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageImage, &varianceInfo};
+            writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &worldPosInfo};
+            writes[3] = {set, 3, 0, 1, vk::DescriptorType::eStorageImage, &normalInfo};
+            writes[4] = {set, 4, 0, 1, vk::DescriptorType::eStorageImage, &outputInfo};
+            writes[5] = {set, 5, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &uboInfo};
+            writes[6] = {set, 6, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &tilesInfo};
+
+            renderer->m_device.updateDescriptorSets(writes, {});
+        }
+    }
+
+    // Adaptive A-Trous Tile Classification Descriptor Set
+    {
+        vk::DescriptorSet set = pipeline.classifySets[frameIndex];
+
+        vk::DescriptorImageInfo varianceInfo{nullptr, gbuffer.variance.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo histLenInfo{nullptr, gbuffer.currentHistoryLength().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorBufferInfo tilesInfo{gbuffer.atrousTiles.handle, 0, VK_WHOLE_SIZE};
+
+        std::array<vk::WriteDescriptorSet, 4> writes{};
+        writes[0] = {set, 0, 0, 1, vk::DescriptorType::eStorageImage, &varianceInfo};
+        writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageImage, &histLenInfo};
+        writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &worldPosInfo};
+        writes[3] = {set, 3, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &tilesInfo};
+
+        renderer->m_device.updateDescriptorSets(writes, {});
+    }
+
+    // Half Resolution Downsample Descriptor Set
+    {
+        vk::DescriptorSet set = pipeline.downsampleSets[frameIndex];
+
+        vk::DescriptorImageInfo colorInfo{nullptr, gbuffer.currentHistory().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo albedoInfo{nullptr, gbuffer.albedoMetallic.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo varianceInfo{nullptr, gbuffer.variance.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.currentNormalRoughness().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo outColorInfo{nullptr, gbuffer.halfPong.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo outVarianceInfo{nullptr, gbuffer.halfVariance.view, vk::ImageLayout::eGeneral};
+
+        auto& fr = renderer->m_frames[frameIndex];
+        vk::DescriptorBufferInfo uboInfo{fr.frameUBO.handle, 0, sizeof(FrameUBO)};
+
+        std::array<vk::WriteDescriptorSet, 8> writes{};
+        writes[0] = {set, 0, 0, 1, vk::DescriptorType::eStorageImage, &colorInfo};
+        writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageImage, &albedoInfo};
+        writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &varianceInfo};
+        writes[3] = {set, 3, 0, 1, vk::DescriptorType::eStorageImage, &worldPosInfo};
+        writes[4] = {set, 4, 0, 1, vk::DescriptorType::eStorageImage, &normalInfo};
+        writes[5] = {set, 5, 0, 1, vk::DescriptorType::eStorageImage, &outColorInfo};
+        writes[6] = {set, 6, 0, 1, vk::DescriptorType::eStorageImage, &outVarianceInfo};
+        writes[7] = {set, 7, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &uboInfo};
+
+        renderer->m_device.updateDescriptorSets(writes, {});
+    }
+
+    // Half Resolution Upsample Descriptor Set
+    {
+        vk::DescriptorSet set = pipeline.upsampleSets[frameIndex];
+
+        vk::DescriptorImageInfo irradianceInfo{nullptr, halfAtrousOutput().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo colorInfo{nullptr, gbuffer.currentHistory().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo albedoInfo{nullptr, gbuffer.albedoMetallic.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.currentNormalRoughness().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo outputInfo{nullptr, gbuffer.filterPing.view, vk::ImageLayout::eGeneral};
+
+        auto& fr = renderer->m_frames[frameIndex];
+        vk::DescriptorBufferInfo uboInfo{fr.frameUBO.handle, 0, sizeof(FrameUBO)};
+
+        std::array<vk::WriteDescriptorSet, 7> writes{};
+        writes[0] = {set, 0, 0, 1, vk::DescriptorType::eStorageImage, &irradianceInfo};
+        writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageImage, &colorInfo};
+        writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &albedoInfo};
+        writes[3] = {set, 3, 0, 1, vk::DescriptorType::eStorageImage, &worldPosInfo};
+        writes[4] = {set, 4, 0, 1, vk::DescriptorType::eStorageImage, &normalInfo};
+        writes[5] = {set, 5, 0, 1, vk::DescriptorType::eStorageImage, &outputInfo};
+        writes[6] = {set, 6, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &uboInfo};
+
+        renderer->m_device.updateDescriptorSets(writes, {});
+    }
+
+    // Fused Variance + Atrous Descriptor Set
+    {
+        vk::DescriptorSet set = pipeline.fusedSets[frameIndex];
+
+        vk::DescriptorImageInfo inputInfo{pipeline.linearSampler, gbuffer.currentHistory().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo colorInfo{nullptr, gbuffer.color.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo momentsInfo{nullptr, gbuffer.currentMoments().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo histLenInfo{nullptr, gbuffer.currentHistoryLength().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo worldPosInfo{nullptr, gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo normalInfo{nullptr, gbuffer.currentNormalRoughness().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo varianceInfo{nullptr, gbuffer.variance.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo outputInfo{nullptr, gbuffer.filterPong.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo budgetInfo{nullptr, gbuffer.sampleBudget[frameIndex].view, vk::ImageLayout::eGeneral};
+
+        auto& fr = renderer->m_frames[frameIndex];
+        vk::DescriptorBufferInfo uboInfo{fr.frameUBO.handle, 0, sizeof(FrameUBO)};
+
+        std::array<vk::WriteDescriptorSet, 10> writes{};
+        writes[0] = {set, 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &inputInfo};
+        writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageImage, &colorInfo};
+        writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &momentsInfo};
+        writes[3] = {set, 3, 0, 1, vk::DescriptorType::eStorageImage, &histLenInfo};
+        writes[4] = {set, 4, 0, 1, vk::DescriptorType::eStorageImage, &worldPosInfo};
+        writes[5] = {set, 5, 0, 1, vk::DescriptorType::eStorageImage, &normalInfo};
+        writes[6] = {set, 6, 0, 1, vk::DescriptorType::eStorageImage, &varianceInfo};
+        writes[7] = {set, 7, 0, 1, vk::DescriptorType::eStorageImage, &outputInfo};
+        writes[8] = {set, 8, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &uboInfo};
+        writes[9] = {set, 9, 0, 1, vk::DescriptorType::eStorageImage, &budgetInfo};
+
+        renderer->m_device.updateDescriptorSets(writes, {});
+    }
+
+    // Progressive Accumulation Descriptor Set
+    {
+        vk::DescriptorSet set = pipeline.progressiveSets[frameIndex];
+
+        vk::DescriptorImageInfo colorInfo{nullptr, gbuffer.color.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo accumulationInfo{nullptr, gbuffer.accumulation.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo denoisedInfo{nullptr, atrousOutput().view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo outputInfo{nullptr, gbuffer.progressive.view, vk::ImageLayout::eGeneral};
+
+        std::array<vk::WriteDescriptorSet, 4> writes{};
+        writes[0] = {set, 0, 0, 1, vk::DescriptorType::eStorageImage, &colorInfo};
+        writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageImage, &accumulationInfo};
+        writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &denoisedInfo};
+        writes[3] = {set, 3, 0, 1, vk::DescriptorType::eStorageImage, &outputInfo};
+
+        renderer->m_device.updateDescriptorSets(writes, {});
+    }
+}
+
+void Denoiser::createTemporalPipeline() {
+    auto shaderModule = renderer->m_shaderManager.loadModule(
+        "assets/shaders/temporal_reproject.comp",
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
+    );
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(TemporalPC);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.temporalSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+
+    pipeline.temporalPipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = pipeline.temporalPipelineLayout;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+    pipeline.temporalPipeline = result.value;
+
+    renderer->m_device.destroyShaderModule(shaderModule.module);
 }
 
 void Denoiser::createVariancePipeline() {
     auto shaderModule = renderer->m_shaderManager.loadModule(
         "assets/shaders/variance.comp",
-        vk::ShaderStageFlagBits::eCompute
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
     );
 
     vk::PipelineShaderStageCreateInfo stageInfo{};
@@ -603,7 +1117,7 @@ void Denoiser::createVariancePipeline() {
     pipelineInfo.stage = stageInfo;
     pipelineInfo.layout = pipeline.variancePipelineLayout;
 
-    auto result = renderer->m_device.createComputePipeline(nullptr, pipelineInfo);
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
     pipeline.variancePipeline = result.value;
 
     renderer->m_device.destroyShaderModule(shaderModule.module);
@@ -612,7 +1126,8 @@ void Denoiser::createVariancePipeline() {
 void Denoiser::createAtrousPipeline() {
     auto shaderModule = renderer->m_shaderManager.loadModule(
         "assets/shaders/atrous.comp",
-        vk::ShaderStageFlagBits::eCompute
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
     );
 
     vk::PipelineShaderStageCreateInfo stageInfo{};
@@ -638,12 +1153,185 @@ void Denoiser::createAtrousPipeline() {
     pipelineInfo.stage = stageInfo;
     pipelineInfo.layout = pipeline.atrousPipelineLayout;
 
-    auto result = renderer->m_device.createComputePipeline(nullptr, pipelineInfo);
+    // kernel footprint comes from the quality preset
+    const QualitySpecialization quality = qualitySpecialization(renderer->m_quality);
+    const vk::SpecializationMapEntry radiusEntry{0, offsetof(QualitySpecialization, atrousRadius), sizeof(int32_t)};
+    const vk::SpecializationInfo specInfo{1, &radiusEntry, sizeof(quality), &quality};
+    pipelineInfo.stage.pSpecializationInfo = &specInfo;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
     pipeline.atrousPipeline = result.value;
 
     renderer->m_device.destroyShaderModule(shaderModule.module);
 }
 
+void Denoiser::createFusedAtrousPipeline() {
+    // the tile in atrous_fused.comp stages 32000 bytes, anything under that keeps the separate passes
+    constexpr uint32_t fusedSharedBytes = 32000;
+    pipeline.fusedSupported = renderer->m_physicalDevice.getProperties().limits.maxComputeSharedMemorySize >= fusedSharedBytes;
+    if (!pipeline.fusedSupported) return;
+
+    auto shaderModule = renderer->m_shaderManager.loadModule(
+        "assets/shaders/atrous_fused.comp",
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
+    );
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    // same push constants as the single iteration pass
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(AtrousPC);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.fusedSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+
+    pipeline.fusedPipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = pipeline.fusedPipelineLayout;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+    pipeline.fusedPipeline = result.value;
+
+    renderer->m_device.destroyShaderModule(shaderModule.module);
+}
+
+void Denoiser::createDownsamplePipeline() {
+    auto shaderModule = renderer->m_shaderManager.loadModule(
+        "assets/shaders/denoise_downsample.comp",
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
+    );
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.downsampleSetLayout;
+
+    pipeline.downsamplePipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = pipeline.downsamplePipelineLayout;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+    pipeline.downsamplePipeline = result.value;
+
+    renderer->m_device.destroyShaderModule(shaderModule.module);
+}
+
+void Denoiser::createUpsamplePipeline() {
+    auto shaderModule = renderer->m_shaderManager.loadModule(
+        "assets/shaders/denoise_upsample.comp",
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
+    );
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.upsampleSetLayout;
+
+    pipeline.upsamplePipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = pipeline.upsamplePipelineLayout;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+    pipeline.upsamplePipeline = result.value;
+
+    renderer->m_device.destroyShaderModule(shaderModule.module);
+}
+
+void Denoiser::createClassifyPipeline() {
+    auto shaderModule = renderer->m_shaderManager.loadModule(
+        "assets/shaders/atrous_classify.comp",
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
+    );
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(AtrousClassifyPC);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.classifySetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+
+    pipeline.classifyPipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = pipeline.classifyPipelineLayout;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+    pipeline.classifyPipeline = result.value;
+
+    renderer->m_device.destroyShaderModule(shaderModule.module);
+}
+
+void Denoiser::createProgressivePipeline() {
+    auto shaderModule = renderer->m_shaderManager.loadModule(
+        "assets/shaders/progressive.comp",
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
+    );
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(ProgressivePC);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.progressiveSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+
+    pipeline.progressivePipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = pipeline.progressivePipelineLayout;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+    pipeline.progressivePipeline = result.value;
+
+    renderer->m_device.destroyShaderModule(shaderModule.module);
+}
+
 void Denoiser::updatePreviousFrameData(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& camPos) {
     prevView = view;
     prevProj = proj;
@@ -658,7 +1346,6 @@ void Denoiser::fillFrameUBO(
     const glm::mat4& proj,
     const glm::vec3& camPos,
     float deltaTime,
-    int depth,
     uint32_t frameCount,
     uint32_t screenWidth,
     uint32_t screenHeight,
@@ -677,10 +1364,9 @@ void Denoiser::fillFrameUBO(
     ubo.delta_time = deltaTime;
 
     ubo.prevCamPos = hasPreviousFrame ? prevCamPos : camPos;
-    ubo.depth = depth;
 
     ubo.frame_count = frameCount;
-    ubo.sample_count = 8;
+    ubo.sample_count = qualitySpecialization(renderer->m_quality).sampleCount; // raygen has it baked in, this is for everyone else
     ubo.screen_width = screenWidth;
     ubo.screen_height = screenHeight;
 
@@ -703,68 +1389,223 @@ void Denoiser::fillFrameUBO(
     ubo.stepSize = (1 << atrousIteration);
 }
 
+void Denoiser::reloadShaders(const std::vector<std::string>& changed) {
+    if (shaderChanged(changed, "assets/shaders/temporal_reproject.comp"))
+        renderer->rebuildPipeline(pipeline.temporalPipeline, pipeline.temporalPipelineLayout, [this] { createTemporalPipeline(); });
+    if (shaderChanged(changed, "assets/shaders/variance.comp"))
+        renderer->rebuildPipeline(pipeline.variancePipeline, pipeline.variancePipelineLayout, [this] { createVariancePipeline(); });
+    if (shaderChanged(changed, "assets/shaders/atrous.comp"))
+        renderer->rebuildPipeline(pipeline.atrousPipeline, pipeline.atrousPipelineLayout, [this] { createAtrousPipeline(); });
+    if (shaderChanged(changed, "assets/shaders/atrous_fused.comp"))
+        renderer->rebuildPipeline(pipeline.fusedPipeline, pipeline.fusedPipelineLayout, [this] { createFusedAtrousPipeline(); });
+    if (shaderChanged(changed, "assets/shaders/atrous_classify.comp"))
+        renderer->rebuildPipeline(pipeline.classifyPipeline, pipeline.classifyPipelineLayout, [this] { createClassifyPipeline(); });
+    if (shaderChanged(changed, "assets/shaders/denoise_downsample.comp"))
+        renderer->rebuildPipeline(pipeline.downsamplePipeline, pipeline.downsamplePipelineLayout, [this] { createDownsamplePipeline(); });
+    if (shaderChanged(changed, "assets/shaders/denoise_upsample.comp"))
+        renderer->rebuildPipeline(pipeline.upsamplePipeline, pipeline.upsamplePipelineLayout, [this] { createUpsamplePipeline(); });
+    if (shaderChanged(changed, "assets/shaders/progressive.comp"))
+        renderer->rebuildPipeline(pipeline.progressivePipeline, pipeline.progressivePipelineLayout, [this] { createProgressivePipeline(); });
+}
+
+void Denoiser::rebuildAtrousPipeline() {
+    auto& device = renderer->m_device;
+    if (pipeline.atrousPipeline) device.destroyPipeline(pipeline.atrousPipeline);
+    if (pipeline.atrousPipelineLayout) device.destroyPipelineLayout(pipeline.atrousPipelineLayout);
+    pipeline.atrousPipeline = nullptr;
+    pipeline.atrousPipelineLayout = nullptr;
+    createAtrousPipeline();
+}
+
 Image& Denoiser::getOutputImage() {
+    return progressiveActive() ? gbuffer.progressive : atrousOutput();
+}
+
+Image& Denoiser::atrousOutput() {
+    // the upsample writes ping
+    if (settings.halfResolution) {
+        return gbuffer.filterPing;
+    }
+
+    // iteration 0 writes ping, 1 pong, 2 ping, ...
     if (settings.atrousIterations % 2 == 1) {
-        return gbuffer.filterPong;
-    } else {
         return gbuffer.filterPing;
+    } else {
+        return gbuffer.filterPong;
     }
 }
 
-void Denoiser::denoise(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex) {
+Image& Denoiser::halfAtrousOutput() {
+    // the downsample writes pong, iteration 0 ping, 1 pong, ...
+    return settings.atrousIterations % 2 == 1 ? gbuffer.halfPing : gbuffer.halfPong;
+}
+
+void Denoiser::denoise(RenderGraph& graph, uint32_t width, uint32_t height, uint32_t frameIndex) {
     // i won't ever let this happen, but just in case
     if (settings.atrousIterations > DenoiserPipeline::MAX_ATROUS_ITERATIONS) {
         settings.atrousIterations = DenoiserPipeline::MAX_ATROUS_ITERATIONS;
     }
 
-    ImageTransitions it{cmd};
+    constexpr vk::PipelineStageFlags2 compute = vk::PipelineStageFlagBits2::eComputeShader;
+
+    // converged, post gets gbuffer.progressive as it was left
+    if (!progressiveTracing) return;
 
     // Temporal Accumulation
-    // Transition inputs to readable, outputs to writable
-    it.ensure(gbuffer.color, Role::General);
-    it.ensure(gbuffer.worldPosition, Role::General);
-    it.ensure(gbuffer.normalRoughness, Role::General);
-    it.ensure(gbuffer.motionVectors, Role::General);
-    it.ensure(gbuffer.previousHistory(), Role::ShaderReadOnly);
-    it.ensure(gbuffer.previousMoments(), Role::General);
-    it.ensure(gbuffer.previousHistoryLength(), Role::General);
-    it.ensure(gbuffer.currentHistory(), Role::General);
-    it.ensure(gbuffer.currentMoments(), Role::General);
-    it.ensure(gbuffer.currentHistoryLength(), Role::General);
-
-    dispatchTemporalAccumulation(cmd, width, height, frameIndex);
-
-    // Memory barrier: temporal to variance
-    vk::MemoryBarrier2 barrier{};
-    barrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
-    barrier.srcAccessMask = vk::AccessFlagBits2::eShaderWrite;
-    barrier.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
-    barrier.dstAccessMask = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite;
-
-    vk::DependencyInfo dep{};
-    dep.memoryBarrierCount = 1;
-    dep.pMemoryBarriers = &barrier;
-    cmd.pipelineBarrier2(dep);
-
-    // Variance
-    it.ensure(gbuffer.variance, Role::General);
-
-    dispatchVarianceEstimation(cmd, width, height, frameIndex);
-
-    // Memory barrier: variance to atrous
-    cmd.pipelineBarrier2(dep);
-
-    // Atrous Wavelet Filtering
-    it.ensure(gbuffer.filterPing, Role::General);
-    it.ensure(gbuffer.filterPong, Role::General);
-
-    for (int i = 0; i < settings.atrousIterations; ++i) {
-        dispatchAtrousFilter(cmd, width, height, frameIndex, i);
-
-        // Barrier between iterations
-        if (i < settings.atrousIterations - 1) {
-            cmd.pipelineBarrier2(dep);
+    graph.pass(compute, "Temporal")
+        .read(gbuffer.color)
+        .read(gbuffer.currentWorldPosition())
+        .read(gbuffer.currentNormalRoughness())
+        .read(gbuffer.motionVectors)
+        .read(gbuffer.previousHistory(), Role::ShaderReadOnly)
+        .read(gbuffer.previousMoments())
+        .read(gbuffer.previousHistoryLength())
+        .read(gbuffer.previousWorldPosition())
+        .read(gbuffer.previousNormalRoughness())
+        .write(gbuffer.currentHistory())
+        .write(gbuffer.currentMoments())
+        .write(gbuffer.currentHistoryLength())
+        .run([&](vk::CommandBuffer cmd) { dispatchTemporalAccumulation(cmd, width, height, frameIndex); });
+
+    // past progressiveDenoiseFrames the mean alone goes out, the filters would only be thrown away
+    const bool filter = !progressiveActive() || progressiveFrames < static_cast<uint32_t>(settings.progressiveDenoiseFrames);
+    if (filter) filterAtrous(graph, width, height, frameIndex);
+
+    if (!progressiveActive()) return;
+
+    graph.pass(compute, "Progressive")
+        .read(gbuffer.color)
+        .write(gbuffer.accumulation)
+        .write(gbuffer.progressive);
+    if (filter) graph.read(atrousOutput());
+    graph.run([&](vk::CommandBuffer cmd) { dispatchProgressive(cmd, width, height, frameIndex); });
+}
+
+void Denoiser::filterAtrous(RenderGraph& graph, uint32_t width, uint32_t height, uint32_t frameIndex) {
+    constexpr vk::PipelineStageFlags2 compute = vk::PipelineStageFlagBits2::eComputeShader;
+
+    // Variance + the first two iterations from one shared memory tile, ends in pong like the separate passes
+    int firstIteration = 0;
+    if (!settings.halfResolution && settings.fusedAtrous && pipeline.fusedSupported && settings.atrousIterations >= 2) {
+        graph.pass(compute, "A-Trous Fused")
+            .read(gbuffer.currentHistory())
+            .read(gbuffer.color)
+            .read(gbuffer.currentMoments())
+            .read(gbuffer.currentHistoryLength())
+            .read(gbuffer.currentWorldPosition())
+            .read(gbuffer.currentNormalRoughness())
+            .write(gbuffer.variance)
+            .write(gbuffer.sampleBudget[frameIndex])
+            .write(gbuffer.filterPong)
+            .run([&](vk::CommandBuffer cmd) { dispatchFusedAtrous(cmd, width, height, frameIndex); });
+        firstIteration = 2;
+    } else {
+        // Variance
+        graph.pass(compute, "Variance")
+            .read(gbuffer.color)
+            .read(gbuffer.currentMoments())
+            .read(gbuffer.currentHistoryLength())
+            .read(gbuffer.currentWorldPosition())
+            .read(gbuffer.currentNormalRoughness())
+            .write(gbuffer.variance)
+            .write(gbuffer.sampleBudget[frameIndex])
+            .run([&](vk::CommandBuffer cmd) { dispatchVarianceEstimation(cmd, width, height, frameIndex); });
+    }
+    gbuffer.sampleBudgetWritten[frameIndex] = true;
+
+    // Atrous Wavelet Filtering, same input/output as the per iteration sets
+    static constexpr const char* atrousNames[DenoiserPipeline::MAX_ATROUS_ITERATIONS] = {
+        "A-Trous 0", "A-Trous 1", "A-Trous 2", "A-Trous 3", "A-Trous 4"
+    };
+
+    // Half resolution: demodulated irradiance down into halfPong, the iterations between the half images, then
+    // the guided upsample remodulates into filterPing
+    if (settings.halfResolution) {
+        const uint32_t halfWidth = (width + 1) / 2;
+        const uint32_t halfHeight = (height + 1) / 2;
+
+        graph.pass(compute, "Denoise Downsample")
+            .read(gbuffer.currentHistory())
+            .read(gbuffer.albedoMetallic)
+            .read(gbuffer.variance)
+            .read(gbuffer.currentWorldPosition())
+            .read(gbuffer.currentNormalRoughness())
+            .write(gbuffer.halfPong)
+            .write(gbuffer.halfVariance)
+            .run([&](vk::CommandBuffer cmd) {
+                dispatchResample(cmd, pipeline.downsamplePipeline, pipeline.downsamplePipelineLayout,
+                                 pipeline.downsampleSets[frameIndex], halfWidth, halfHeight);
+            });
+
+        for (int i = 0; i < settings.atrousIterations; ++i) {
+            Image& input = i % 2 == 0 ? gbuffer.halfPong : gbuffer.halfPing;
+            Image& output = i % 2 == 0 ? gbuffer.halfPing : gbuffer.halfPong;
+
+            graph.pass(compute, atrousNames[i])
+                .read(input)
+                .read(gbuffer.halfVariance)
+                .read(gbuffer.currentWorldPosition())
+                .read(gbuffer.currentNormalRoughness())
+                .write(output)
+                .run([&](vk::CommandBuffer cmd) { dispatchAtrousFilter(cmd, halfWidth, halfHeight, frameIndex, i, true); });
         }
+
+        graph.pass(compute, "Denoise Upsample")
+            .read(halfAtrousOutput())
+            .read(gbuffer.currentHistory())
+            .read(gbuffer.albedoMetallic)
+            .read(gbuffer.currentWorldPosition())
+            .read(gbuffer.currentNormalRoughness())
+            .write(gbuffer.filterPing)
+            .run([&](vk::CommandBuffer cmd) {
+                dispatchResample(cmd, pipeline.upsamplePipeline, pipeline.upsamplePipelineLayout,
+                                 pipeline.upsampleSets[frameIndex], width, height);
+            });
+        return;
+    }
+    // Adaptive: tiles classified once the variance is in, the wide iterations from there on only filter the active
+    // ones. iteration 0 reads the history, so at least the first one is always full screen
+    const int adaptiveStart = std::max({firstIteration, settings.adaptiveFromIteration, 1});
+    const bool adaptive = settings.adaptiveAtrous && adaptiveStart < settings.atrousIterations;
+    if (adaptive) {
+        graph.pass(vk::PipelineStageFlagBits2::eTransfer, "A-Trous Tile Reset")
+            .write(gbuffer.atrousTiles)
+            .run([&](vk::CommandBuffer cmd) {
+                const std::array<uint32_t, 8> header = {0, 1, 1, 0, 1, 1, 0, 0};
+                cmd.updateBuffer(gbuffer.atrousTiles.handle, 0, sizeof(header), header.data());
+            });
+
+        graph.pass(compute, "A-Trous Classify")
+            .read(gbuffer.variance)
+            .read(gbuffer.currentHistoryLength())
+            .read(gbuffer.currentWorldPosition())
+            .write(gbuffer.atrousTiles)
+            .run([&](vk::CommandBuffer cmd) { dispatchClassify(cmd, width, height, frameIndex); });
+    }
+
+    for (int i = firstIteration; i < settings.atrousIterations; ++i) {
+        Image& input = i == 0 ? gbuffer.currentHistory() : (i % 2 == 1 ? gbuffer.filterPing : gbuffer.filterPong);
+        Image& output = i % 2 == 0 ? gbuffer.filterPing : gbuffer.filterPong;
+
+        if (adaptive && i >= adaptiveStart) {
+            graph.pass(compute | vk::PipelineStageFlagBits2::eDrawIndirect, atrousNames[i])
+                .read(input)
+                .read(gbuffer.variance)
+                .read(gbuffer.currentWorldPosition())
+                .read(gbuffer.currentNormalRoughness())
+                .read(gbuffer.atrousTiles)
+                .write(output)
+                .run([&](vk::CommandBuffer cmd) { dispatchAtrousTiles(cmd, width, height, frameIndex, i, i == adaptiveStart); });
+            continue;
+        }
+
+        graph.pass(compute, atrousNames[i])
+            .read(input)
+            .read(gbuffer.variance)
+            .read(gbuffer.currentWorldPosition())
+            .read(gbuffer.currentNormalRoughness())
+            .write(output)
+            .run([&](vk::CommandBuffer cmd) { dispatchAtrousFilter(cmd, width, height, frameIndex, i); });
     }
 }
 
@@ -778,6 +1619,10 @@ void Denoiser::dispatchTemporalAccumulation(vk::CommandBuffer cmd, uint32_t widt
         {}
     );
 
+    TemporalPC pc{};
+    pc.historyValid = hasPreviousFrame ? 1u : 0u;
+    cmd.pushConstants(pipeline.temporalPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(TemporalPC), &pc);
+
     uint32_t groupsX = (width + 7) / 8;
     uint32_t groupsY = (height + 7) / 8;
     cmd.dispatch(groupsX, groupsY, 1);
@@ -798,7 +1643,8 @@ void Denoiser::dispatchVarianceEstimation(vk::CommandBuffer cmd, uint32_t width,
     cmd.dispatch(groupsX, groupsY, 1);
 }
 
-void Denoiser::dispatchAtrousFilter(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex, int iteration) {
+void Denoiser::dispatchAtrousFilter(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex, int iteration,
+                                    bool halfRes) {
     cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.atrousPipeline);
 
     // Use pre-configured descriptor set for this iteration
@@ -806,7 +1652,7 @@ void Denoiser::dispatchAtrousFilter(vk::CommandBuffer cmd, uint32_t width, uint3
         vk::PipelineBindPoint::eCompute,
         pipeline.atrousPipelineLayout,
         0,
-        pipeline.atrousSets[frameIndex][iteration],
+        halfRes ? pipeline.halfAtrousSets[frameIndex][iteration] : pipeline.atrousSets[frameIndex][iteration],
         {}
     );
 
@@ -816,6 +1662,7 @@ void Denoiser::dispatchAtrousFilter(vk::CommandBuffer cmd, uint32_t width, uint3
     pc.phiColor = settings.phiColor;
     pc.phiNormal = settings.phiNormal;
     pc.phiDepth = settings.phiDepth;
+    pc.guideScale = halfRes ? 2 : 1;
 
     cmd.pushConstants(
         pipeline.atrousPipelineLayout,
@@ -830,38 +1677,152 @@ void Denoiser::dispatchAtrousFilter(vk::CommandBuffer cmd, uint32_t width, uint3
     cmd.dispatch(groupsX, groupsY, 1);
 }
 
-void Denoiser::copyCurrentGeometryToHistory(vk::CommandBuffer cmd) {
-    // Copy current world position to history buffer (which will become "previous" after swap)
-    vk::ImageCopy copyRegion{};
-    copyRegion.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-    copyRegion.srcSubresource.mipLevel = 0;
-    copyRegion.srcSubresource.baseArrayLayer = 0;
-    copyRegion.srcSubresource.layerCount = 1;
-    copyRegion.dstSubresource = copyRegion.srcSubresource;
-    copyRegion.extent.width = gbuffer.worldPosition.width;
-    copyRegion.extent.height = gbuffer.worldPosition.height;
-    copyRegion.extent.depth = 1;
-
-    // Copy world position
-    cmd.copyImage(
-        gbuffer.worldPosition.handle, vk::ImageLayout::eTransferSrcOptimal,
-        gbuffer.currentWorldPosition().handle, vk::ImageLayout::eTransferDstOptimal,
-        1, &copyRegion
+void Denoiser::dispatchAtrousTiles(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex, int iteration,
+                                   bool copyConverged) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.atrousPipeline);
+    cmd.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute,
+        pipeline.atrousPipelineLayout,
+        0,
+        pipeline.atrousSets[frameIndex][iteration],
+        {}
+    );
+
+    AtrousPC pc{};
+    pc.stepSize = 1 << iteration;
+    pc.phiColor = settings.phiColor;
+    pc.phiNormal = settings.phiNormal;
+    pc.phiDepth = settings.phiDepth;
+
+    // this iteration's input already holds the converged tiles, its output gets them too so both ping and pong
+    // carry them to the end
+    if (copyConverged) {
+        pc.tileMode = 2;
+        pc.tileOffset = ((width + ATROUS_TILE_SIZE - 1) / ATROUS_TILE_SIZE) * ((height + ATROUS_TILE_SIZE - 1) / ATROUS_TILE_SIZE);
+        cmd.pushConstants(pipeline.atrousPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(AtrousPC), &pc);
+        cmd.dispatchIndirect(gbuffer.atrousTiles.handle, ATROUS_CONVERGED_ARGS_OFFSET);
+    }
+
+    pc.tileMode = 1;
+    pc.tileOffset = 0;
+    cmd.pushConstants(pipeline.atrousPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(AtrousPC), &pc);
+    cmd.dispatchIndirect(gbuffer.atrousTiles.handle, 0);
+}
+
+void Denoiser::dispatchClassify(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.classifyPipeline);
+    cmd.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute,
+        pipeline.classifyPipelineLayout,
+        0,
+        pipeline.classifySets[frameIndex],
+        {}
+    );
+
+    // one group per tile
+    uint32_t groupsX = (width + ATROUS_TILE_SIZE - 1) / ATROUS_TILE_SIZE;
+    uint32_t groupsY = (height + ATROUS_TILE_SIZE - 1) / ATROUS_TILE_SIZE;
+
+    AtrousClassifyPC pc{};
+    pc.varianceThreshold = settings.adaptiveVarianceThreshold;
+    pc.minHistoryLength = settings.minHistoryLength;
+    pc.tileCount = groupsX * groupsY;
+    pc.width = width;
+    pc.height = height;
+
+    cmd.pushConstants(
+        pipeline.classifyPipelineLayout,
+        vk::ShaderStageFlagBits::eCompute,
+        0,
+        sizeof(AtrousClassifyPC),
+        &pc
+    );
+
+    cmd.dispatch(groupsX, groupsY, 1);
+}
+
+void Denoiser::dispatchFusedAtrous(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.fusedPipeline);
+    cmd.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute,
+        pipeline.fusedPipelineLayout,
+        0,
+        pipeline.fusedSets[frameIndex],
+        {}
+    );
+
+    // steps are fixed in the shader
+    AtrousPC pc{};
+    pc.stepSize = 1;
+    pc.phiColor = settings.phiColor;
+    pc.phiNormal = settings.phiNormal;
+    pc.phiDepth = settings.phiDepth;
+
+    cmd.pushConstants(
+        pipeline.fusedPipelineLayout,
+        vk::ShaderStageFlagBits::eCompute,
+        0,
+        sizeof(AtrousPC),
+        &pc
+    );
+
+    // one 16x16 tile per group
+    uint32_t groupsX = (width + 15) / 16;
+    uint32_t groupsY = (height + 15) / 16;
+    cmd.dispatch(groupsX, groupsY, 1);
+}
+
+void Denoiser::dispatchResample(vk::CommandBuffer cmd, vk::Pipeline pipe, vk::PipelineLayout layout, vk::DescriptorSet set,
+                                uint32_t width, uint32_t height) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipe);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, set, {});
+
+    uint32_t groupsX = (width + 7) / 8;
+    uint32_t groupsY = (height + 7) / 8;
+    cmd.dispatch(groupsX, groupsY, 1);
+}
+
+void Denoiser::dispatchProgressive(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.progressivePipeline);
+    cmd.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute,
+        pipeline.progressivePipelineLayout,
+        0,
+        pipeline.progressiveSets[frameIndex],
+        {}
     );
 
-    // Copy normal/roughness
-    copyRegion.extent.width = gbuffer.normalRoughness.width;
-    copyRegion.extent.height = gbuffer.normalRoughness.height;
+    // linear fade from the denoised image to the mean over the first progressiveDenoiseFrames
+    const float denoiseFrames = static_cast<float>(std::max(settings.progressiveDenoiseFrames, 1));
+    ProgressivePC pc{};
+    pc.frames = progressiveFrames;
+    pc.denoisedWeight = std::max(1.0f - static_cast<float>(progressiveFrames) / denoiseFrames, 0.0f);
+    pc.width = width;
+    pc.height = height;
 
-    cmd.copyImage(
-        gbuffer.normalRoughness.handle, vk::ImageLayout::eTransferSrcOptimal,
-        gbuffer.currentNormalRoughness().handle, vk::ImageLayout::eTransferDstOptimal,
-        1, &copyRegion
+    cmd.pushConstants(
+        pipeline.progressivePipelineLayout,
+        vk::ShaderStageFlagBits::eCompute,
+        0,
+        sizeof(ProgressivePC),
+        &pc
     );
+
+    uint32_t groupsX = (width + 7) / 8;
+    uint32_t groupsY = (height + 7) / 8;
+    cmd.dispatch(groupsX, groupsY, 1);
 }
 
 void Denoiser::swapHistoryBuffers() {
     gbuffer.swapHistory();
 }
 
+void Denoiser::updateProgressive(bool restart, uint32_t samplesPerFrame) {
+    if (!settings.progressive || restart) progressiveFrames = 0;
+
+    const uint64_t spp = uint64_t(progressiveFrames) * samplesPerFrame;
+    progressiveTracing = !settings.progressive || spp < static_cast<uint64_t>(std::max(settings.progressiveTargetSpp, 1));
+    if (settings.progressive && progressiveTracing) progressiveFrames++;
+}
+
 }
\ No newline at end of file
@@ -4,15 +4,78 @@
 * Author: Collin Longoria
 * Created on: 12/2/2025
 */
-#include "image_states.hpp"
+#include "render_graph.hpp"
 #include "renderer.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <gtc/packing.hpp>
+
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_vulkan.h"
 
 namespace blok {
 
+namespace {
+
+// one semaphore of a submit, value is ignored for binary semaphores and stage for signals
+struct SemaphoreOp {
+    vk::Semaphore semaphore;
+    uint64_t value = 0;
+    vk::PipelineStageFlags stage{};
+};
+
+void submitCommands(vk::Queue queue, vk::CommandBuffer cmd, std::initializer_list<SemaphoreOp> waits,
+                    std::initializer_list<SemaphoreOp> signals, vk::Fence fence = nullptr) {
+    std::array<vk::Semaphore, 4> waitSems{};
+    std::array<uint64_t, 4> waitValues{};
+    std::array<vk::PipelineStageFlags, 4> waitStages{};
+    std::array<vk::Semaphore, 4> signalSems{};
+    std::array<uint64_t, 4> signalValues{};
+
+    uint32_t waitCount = 0;
+    for (const SemaphoreOp& w : waits) {
+        if (!w.semaphore) continue; // optional wait that isn't there this frame
+        waitSems[waitCount] = w.semaphore;
+        waitValues[waitCount] = w.value;
+        waitStages[waitCount] = w.stage;
+        waitCount++;
+    }
+    uint32_t signalCount = 0;
+    for (const SemaphoreOp& s : signals) {
+        signalSems[signalCount] = s.semaphore;
+        signalValues[signalCount] = s.value;
+        signalCount++;
+    }
+
+    vk::TimelineSemaphoreSubmitInfo tsi{};
+    tsi.waitSemaphoreValueCount   = waitCount;
+    tsi.pWaitSemaphoreValues      = waitValues.data();
+    tsi.signalSemaphoreValueCount = signalCount;
+    tsi.pSignalSemaphoreValues    = signalValues.data();
+
+    vk::SubmitInfo si{};
+    si.pNext                = &tsi;
+    si.waitSemaphoreCount   = waitCount;
+    si.pWaitSemaphores      = waitSems.data();
+    si.pWaitDstStageMask    = waitStages.data();
+    si.commandBufferCount   = 1;
+    si.pCommandBuffers      = &cmd;
+    si.signalSemaphoreCount = signalCount;
+    si.pSignalSemaphores    = signalSems.data();
+
+    if (queue.submit(1, &si, fence) != vk::Result::eSuccess)
+        throw std::runtime_error("frame submit failed");
+}
+
+}
+
 bool resizeNeeded = false;
 void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
     resizeNeeded = true;
@@ -26,10 +89,149 @@ void Renderer::render(const Camera& c, float dt) {
     endFrame();
 }
 
-void Renderer::beginFrame() {
-    // reset UBO allocator for this frame
-    m_frames[m_frameIndex].uboHead = 0;
+void Renderer::paceFrame() {
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<float, std::milli>;
+
+    if (m_lowLatency && !m_swapchainDirty && m_swapchain) {
+        const float gpuMs = m_profiler.frameMs();
+        // how long before the gpu needs it the next frame has to start
+        const float leadMs = m_cpuFrameMs + gpuMs + LOW_LATENCY_SLACK_MS;
+        clock::time_point wake{};
+        if (m_presentWait && m_presentId > 0) {
+            // the last frame is on screen, the next one goes out a refresh later
+            vk::Result presented = vk::Result::eTimeout;
+            try {
+                presented = m_device.waitForPresentKHR(m_swapchain, m_presentId, PRESENT_WAIT_TIMEOUT_NS);
+            } catch (const vk::OutOfDateKHRError&) {
+                m_swapchainDirty = true;
+            }
+            if (presented == vk::Result::eSuccess) {
+                const clock::time_point now = clock::now();
+                if (m_lastPresentDone != clock::time_point{}) {
+                    // a missed vblank doubles one interval, so only creep up towards longer ones
+                    const float interval = ms(now - m_lastPresentDone).count();
+                    m_refreshMs = m_refreshMs <= 0.0f || interval < m_refreshMs ? interval : m_refreshMs + (interval - m_refreshMs) * 0.01f;
+                }
+                m_lastPresentDone = now;
+                wake = now + std::chrono::duration_cast<clock::duration>(ms(m_refreshMs - leadMs));
+            }
+        } else if (m_lastSubmit != clock::time_point{}) {
+            // no present timing, the gpu frees up about a gpu frame after the last submit
+            wake = m_lastSubmit + std::chrono::duration_cast<clock::duration>(ms(gpuMs - m_cpuFrameMs - LOW_LATENCY_SLACK_MS));
+        }
+        const clock::time_point now = clock::now();
+        if (wake > now) std::this_thread::sleep_until(std::min(wake, now + std::chrono::milliseconds(50)));
+
+        // nothing left queued in front of the next frame, the input read after this shows up in it
+        waitTimeline(m_timelineValue);
+    }
+
+    waitTimeline(m_frames[m_frameIndex].doneValue);
+    m_paceEnd = clock::now();
+}
+
+void Renderer::resetFrameSeed(uint32_t seed) {
+    std::srand(seed);
+    m_frameCount = seed;
+    m_postProcess.jitterIndex = 0;
+    m_postProcess.hasPreviousFrame = false;
+    m_denoiser.hasPreviousFrame = false;
+}
+
+void Renderer::setOfflineRender(uint32_t targetSpp) {
+    m_denoiser.settings.progressive = true;
+    m_denoiser.settings.progressiveTargetSpp = static_cast<int>(std::max(targetSpp, 1u));
+    // a reference image, the a-trous output never gets blended in
+    m_denoiser.settings.progressiveDenoiseFrames = 1;
+    // tiles are cut at the render extent, it can't move under them
+    m_dynamicResolution.settings.enabled = false;
+}
+
+void Renderer::readProgressiveImage(std::vector<float>& rgba) {
+    m_device.waitIdle();
+
+    // the render extent in the top left of the pooled image
+    Image& img = m_denoiser.gbuffer.progressive;
+    const bool compact = img.format == vk::Format::eR16G16B16A16Sfloat;
+    const vk::DeviceSize texelBytes = compact ? 8 : 16;
+    const size_t texels = static_cast<size_t>(m_renderExtent.width) * m_renderExtent.height;
+    Buffer readback = createBuffer(texels * texelBytes,
+        vk::BufferUsageFlagBits::eTransferDst,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        VMA_MEMORY_USAGE_AUTO_PREFER_HOST, true);
+
+    auto result = m_device.resetFences(1, &m_uploadFence);
+    m_uploadCmd.reset({});
+    vk::CommandBufferBeginInfo bi{};
+    bi.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    m_uploadCmd.begin(bi);
+
+    // the next frame's graph picks the layout up from currentLayout
+    ImageTransitions(m_uploadCmd).ensure(img, Role::TransferSrc);
+    vk::BufferImageCopy region{};
+    region.imageSubresource = { vk::ImageAspectFlagBits::eColor, 0, 0, 1 };
+    region.imageExtent = vk::Extent3D{ m_renderExtent.width, m_renderExtent.height, 1 };
+    m_uploadCmd.copyImageToBuffer(img.handle, vk::ImageLayout::eTransferSrcOptimal, readback.handle, 1, &region);
+
+    vk::MemoryBarrier2 toHost{};
+    toHost.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+    toHost.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+    toHost.dstStageMask = vk::PipelineStageFlagBits2::eHost;
+    toHost.dstAccessMask = vk::AccessFlagBits2::eHostRead;
+    vk::DependencyInfo dep{};
+    dep.memoryBarrierCount = 1;
+    dep.pMemoryBarriers = &toHost;
+    m_uploadCmd.pipelineBarrier2(dep);
+    m_uploadCmd.end();
+
+    vk::SubmitInfo si{};
+    si.commandBufferCount = 1; si.pCommandBuffers = &m_uploadCmd;
+    result = m_graphicsQueue.submit(1, &si, m_uploadFence);
+    result = m_device.waitForFences(1, &m_uploadFence, VK_TRUE, UINT64_MAX);
+
+    // no-op on coherent memory
+    vmaInvalidateAllocation(m_allocator, readback.alloc, 0, texels * texelBytes);
+    rgba.resize(texels * 4);
+    if (compact) {
+        const auto* src = static_cast<const uint64_t*>(readback.mapped);
+        for (size_t i = 0; i < texels; ++i) {
+            const glm::vec4 c = glm::unpackHalf4x16(src[i]);
+            std::memcpy(&rgba[i * 4], &c[0], sizeof(c));
+        }
+    } else {
+        std::memcpy(rgba.data(), readback.mapped, texels * texelBytes);
+    }
+    destroyBuffer(readback);
+}
+
+Renderer::FrameStats Renderer::frameStats() const {
+    FrameStats stats;
+    stats.gpuMs = m_profiler.frameMs();
+    stats.renderExtent = m_renderExtent;
+
+    const VkPhysicalDeviceMemoryProperties* props = nullptr;
+    vmaGetMemoryProperties(m_allocator, &props);
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+    vmaGetHeapBudgets(m_allocator, budgets.data());
+    for (uint32_t i = 0; i < props->memoryHeapCount; i++) stats.deviceBytes += budgets[i].usage;
+    return stats;
+}
+
+size_t Renderer::streamingBudget() const {
+    if (!m_worldMemory) return SIZE_MAX;
+
+    std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+    vmaGetHeapBudgets(m_allocator, budgets.data());
+    const VmaBudget& heap = budgets[m_worldMemoryHeap];
+
+    // a tenth of the heap stays free for the gbuffers, acceleration structures and a heap grow's old + new copy
+    const uint64_t reserve = heap.budget / 10;
+    const uint64_t free = heap.budget > heap.usage + reserve ? heap.budget - heap.usage - reserve : 0;
+    return static_cast<size_t>(m_memoryStats[size_t(MemoryCategory::Svo)].current + free);
+}
 
+void Renderer::beginFrame() {
     // gui
     ImGui_ImplVulkan_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -48,21 +250,36 @@ void Renderer::drawFrame(const Camera& c, float dt) {
 
     auto& fr = m_frames[m_frameIndex];
 
+    // the slot's last frame is done with its command buffers and uniform ring (no-op after paceFrame)
+    waitTimeline(fr.doneValue);
+    resolvePicks(fr);
+    resolveTraversalStats(fr);
+
+    // dynamic resolution, from the gpu time of the last frame that ran in this slot. with it off the
+    // upscaler preset picks the scale. held while accumulating, a converged view's frame time says nothing
+    m_dynamicResolution.settings.baseScale = m_postProcess.upscaleScale();
+    bool rescale = m_profiler.resolve(m_frameIndex) && !m_denoiser.progressiveActive() &&
+        m_dynamicResolution.update(m_profiler.frameMs());
+    if (!m_dynamicResolution.settings.enabled) rescale = m_dynamicResolution.reset() || rescale;
+    if (rescale) applyRenderScale();
+
+    // world buffers/AS that nothing references anymore
+    collectRetired();
+
+    // the gpu is done with this frame's ring, rewind it
+    fr.uboHead = 0;
+
     // FrameUBO
     const float aspect = static_cast<float>(m_swapExtent.width) / static_cast<float>(m_swapExtent.height);
-    const vk::DeviceSize minAlign = m_physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment;
     float nearPlane = 0.1f;
     float farPlane = 10000.0f;
 
-    int depth = 1;
-    while (static_cast<float>(rand()) / RAND_MAX < 0.7) depth++;
-    depth = std::min(depth, 4);
-
     // Get base projection
-    glm::mat4 baseProj = c.projection(aspect, nearPlane, farPlane);
+    glm::mat4 baseProj = m_projectionOverride ? *m_projectionOverride : c.projection(aspect, nearPlane, farPlane);
 
     // Apply TAA jitter to projection
-    glm::mat4 jitteredProj = m_postProcess.getJitteredProjection(baseProj, m_swapExtent.width, m_swapExtent.height);
+    // jitter and everything up to post work in render resolution pixels
+    glm::mat4 jitteredProj = m_postProcess.getJitteredProjection(baseProj, m_renderExtent.width, m_renderExtent.height);
 
     FrameUBO fubo{};
     m_denoiser.fillFrameUBO(
@@ -71,28 +288,94 @@ void Renderer::drawFrame(const Camera& c, float dt) {
         jitteredProj,
         c.position,
         dt,
-        depth,
         m_frameCount,
-        m_swapExtent.width,
-        m_swapExtent.height,
+        m_renderExtent.width,
+        m_renderExtent.height,
         0
     );
     glm::vec2 jitter = m_postProcess.getJitterOffset();
     fubo.jitterOffset = jitter;
 
+    // angle one pixel covers, the ray cone the intersection shader measures nodes against. off the projection
+    // (1 / tan(fov / 2) unless overridden) so an offline tile gets its full image's pixel size
+    fubo.pixelSpreadAngle = std::atan(2.0f / (std::abs(baseProj[1][1]) * static_cast<float>(m_renderExtent.height)));
+    fubo.lodScale = m_raytracer.settings.enableLod ? m_raytracer.settings.lodScale : 0.0f;
+
+    // the previous reservoirs only mean something if last frame wrote them and the denoiser history survived
+    if (m_raytracer.settings.restirDI) {
+        fubo.restirDI = 1u | (m_raytracer.restirLastFrame && m_denoiser.hasPreviousFrame ? 2u : 0u);
+    }
+    m_raytracer.restirLastFrame = m_raytracer.settings.restirDI;
+    fubo.radianceCache = m_raytracer.settings.radianceCache ? 1u : 0u;
+
+    // a budget map from before a resize or a reset history describes other pixels
+    fubo.adaptiveNoiseTarget = m_raytracer.settings.adaptiveNoiseTarget;
+    fubo.adaptiveSampling = m_raytracer.settings.adaptiveSampling && m_denoiser.hasPreviousFrame &&
+        m_denoiser.gbuffer.sampleBudgetWritten[m_raytracer.sampleBudgetSlot(m_frameIndex)] ? 1u : 0u;
+
+    // progressive accumulation starts over whenever the view, the world or what the trace is specialized with moves
+    const RayTracing::Settings& rt = m_raytracer.settings;
+    uint32_t lodScaleBits = 0;
+    std::memcpy(&lodScaleBits, &rt.lodScale, sizeof(lodScaleBits));
+    uint32_t cullDistanceBits = 0;
+    std::memcpy(&cullDistanceBits, &rt.cullDistance, sizeof(cullDistanceBits));
+    uint32_t giRadiusBits = 0;
+    std::memcpy(&giRadiusBits, &rt.giRadius, sizeof(giRadiusBits));
+    fubo.roulette = rt.russianRoulette ? rt.rouletteStartBounce + 1u : 0u;
+    fubo.rayBudget = rt.rayBudget;
+    fubo.environmentIntensity = rt.environmentMap && hasEnvironmentMap() ? std::max(rt.environmentIntensity, 0.0f) : 0.0f;
+    uint32_t environmentBits = 0;
+    std::memcpy(&environmentBits, &fubo.environmentIntensity, sizeof(environmentBits));
+    const bool progressiveRestart = m_progressiveKey.changed({
+        m_worldReadyValue, m_resizeGeneration, m_renderExtent.width, m_renderExtent.height, static_cast<uint64_t>(m_quality),
+        rt.enableLod, lodScaleBits, rt.restirDI, rt.radianceCache, rt.adaptiveSampling, static_cast<uint64_t>(rt.tracePattern),
+        rt.rasterPrimary, rt.tlasCulling, cullDistanceBits, rt.frustumCulling, giRadiusBits,
+        static_cast<uint64_t>(rt.bakedLighting), m_environmentGeneration, environmentBits,
+        rt.russianRoulette, rt.rouletteStartBounce, rt.rayBudget
+    }) || c.cameraChanged || !m_denoiser.hasPreviousFrame;
+    m_denoiser.updateProgressive(progressiveRestart, qualitySpecialization(m_quality).sampleCount);
+
+    // the external tracer fills every pixel itself, a skipped pixel needs history to come back from and
+    // progressive accumulation sums every pixel every frame
+    m_raytracer.framePattern = m_cudaInterop.active() || !m_denoiser.hasPreviousFrame || m_denoiser.progressiveActive()
+        ? TracePattern::Full : m_raytracer.settings.tracePattern;
+    fubo.traceInterleave = static_cast<uint32_t>(m_raytracer.framePattern);
+
+    // the surface mesh stands in for the primary rays only while it matches what was packed
+    m_raytracer.frameRaster = rt.rasterPrimary && m_world && m_world->surfaceDrawable && !m_cudaInterop.active();
+    fubo.rasterPrimary = m_raytracer.frameRaster ? 1u : 0u;
+    m_raytracer.frameQuery = rt.rayQuery && m_raytracer.rtPipeline.queryPipeline;
+    fubo.emptySpaceSkip = rt.emptySpaceSkipping ? 1u : 0u;
+    fubo.bakedLighting = static_cast<uint32_t>(rt.bakedLighting);
+    m_raytracer.visibilityPC.viewProj = fubo.proj * fubo.view;
+    m_raytracer.visibilityPC.camPos = glm::vec4(fubo.camPos, 0.0f);
+
+    // frustum planes of viewProj pointing inwards, 0..1 depth so near is the third row alone
+    {
+        const glm::mat4& m = m_raytracer.visibilityPC.viewProj;
+        auto row = [&](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+        const glm::vec4 planes[6] = {
+            row(3) + row(0), row(3) - row(0), row(3) + row(1), row(3) - row(1), row(2), row(3) - row(2)
+        };
+        TlasCullPC& cull = m_raytracer.cullPC;
+        for (int i = 0; i < 6; ++i) cull.planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+        cull.camPos = glm::vec4(fubo.camPos, rt.cullDistance);
+        cull.giRadius = rt.frustumCulling ? rt.giRadius : -1.0f;
+        cull.enabled = rt.tlasCulling ? 1u : 0u;
+    }
+
     m_frameCount++;
 
     if (c.cameraChanged) {
         c.cameraChanged = false;
     }
 
-    uploadToBuffer(&fubo, sizeof(FrameUBO), fr.frameUBO, 0);
-    fr.uboHead = alignUp(sizeof(FrameUBO), minAlign);
-
-    // wait and reset
-    if (m_device.waitForFences(1, &fr.inFlight, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
-        throw std::runtime_error("waitForFences failed");
-    auto result = m_device.resetFences(1, &fr.inFlight);
+    // first allocation of the frame, the descriptor sets bind offset 0
+    const FrameAllocation ubo = allocateFrameData(sizeof(FrameUBO));
+    std::memcpy(ubo.mapped, &fubo, sizeof(FrameUBO));
+    fr.pickInvView = fubo.invView;
+    fr.pickInvProj = fubo.invProj;
+    fr.pickCamPos = fubo.camPos;
 
     // acquire next image
     uint32_t imageIndex = 0;
@@ -104,17 +387,15 @@ void Renderer::drawFrame(const Camera& c, float dt) {
     if (acq != vk::Result::eSuccess && acq != vk::Result::eSuboptimalKHR)
         throw std::runtime_error("acquireNextImageKHR failed");
 
-    if (m_imagesInFlight[imageIndex]) {
-        result = m_device.waitForFences(1, &m_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
-    }
-    m_imagesInFlight[imageIndex] = fr.inFlight;
+    // with more frames in flight than swapchain images the last frame drawing into this one may still run
+    waitTimeline(m_imageValues[imageIndex]);
 
-    // record
-    fr.cmd.reset({});
-    vk::CommandBufferBeginInfo bi{};
-    fr.cmd.begin(bi);
+    m_denoiser.gbuffer.useFrameTargets(m_frameIndex);
 
-    ImageTransitions it{ fr.cmd };
+    // external tracer gets the frame now, the copy into the gbuffer waits on it. the slot's last copy is behind
+    // the timeline wait above
+    if (m_cudaInterop.active() && m_denoiser.progressiveTracing)
+        m_traceValue = m_cudaInterop.trace(fubo, m_frameIndex, m_renderExtent.width, m_renderExtent.height);
 
     // swapchain image
     Image sw{};
@@ -127,175 +408,112 @@ void Renderer::drawFrame(const Camera& c, float dt) {
     sw.format        = m_colorFormat;
     sw.currentLayout = m_swapImageLayouts[imageIndex];
 
-    // Transition G-buffer images to General for ray tracing write
-    it.ensure(m_denoiser.gbuffer.color, Role::General);
-    it.ensure(m_denoiser.gbuffer.worldPosition, Role::General);
-    it.ensure(m_denoiser.gbuffer.normalRoughness, Role::General);
-    it.ensure(m_denoiser.gbuffer.albedoMetallic, Role::General);
-    it.ensure(m_denoiser.gbuffer.motionVectors, Role::General);
-
-    if (m_world) {
-        m_raytracer.updateDescriptorSet(*m_world, m_frameIndex);
+    // no-op on coherent memory
+    vmaFlushAllocation(m_allocator, fr.frameUBO.alloc, 0, fr.uboHead);
+
+    if (m_asyncCompute) {
+        submitFrameAsync(fr, sw, imageIndex);
+    } else {
+        // record
+        fr.cmd.reset({});
+        vk::CommandBufferBeginInfo bi{};
+        fr.cmd.begin(bi);
+
+        // one graph for the whole frame, the barriers between stages come from what each pass declares
+        // fused post writes the swapchain image from compute, so the acquire wait moves up to there
+        const bool direct = m_swapchainStorage && m_postProcess.fusedActive();
+        RenderGraph graph{ fr.cmd, false, &m_profiler };
+        m_profiler.beginFrame(fr.cmd, m_frameIndex);
+        const uint32_t frameScope = m_profiler.begin(fr.cmd, "Frame");
+        recordRayTracing(graph);
+        recordPicks(graph, fr);
+        if (direct) graph.imported(sw, vk::PipelineStageFlagBits2::eComputeShader);
+        recordDenoiseAndPost(graph, direct ? &sw : nullptr);
+        recordPresent(graph, sw, !direct);
+        m_profiler.end(fr.cmd, frameScope);
+
+        fr.cmd.end();
+
+        // submit
+        // waits on the swapchain image and the latest world update (+ the external tracer), signals present + the timeline
+        std::array<vk::Semaphore, 3> waitSems = { fr.imageAvailable, m_timeline, m_cudaInterop.traceDone() };
+        std::array<vk::PipelineStageFlags, 3> waitStages = {
+            direct ? vk::PipelineStageFlagBits::eComputeShader : vk::PipelineStageFlagBits::eTransfer,
+            // the surface mesh and the instance culling too
+            vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eVertexInput |
+                vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+            vk::PipelineStageFlagBits::eTransfer
+        };
+        std::array<uint64_t, 3> waitValues = { 0, m_worldReadyValue, m_traceValue }; // binary semaphores ignore the value
+        const uint32_t waitCount = m_cudaInterop.active() ? 3 : 2;
+
+        const uint64_t frameValue = ++m_timelineValue;
+        std::array<vk::Semaphore, 2> signalSems = { m_presentSignals[imageIndex], m_timeline };
+        std::array<uint64_t, 2> signalValues = { 0, frameValue };
+
+        vk::TimelineSemaphoreSubmitInfo tsi{};
+        tsi.waitSemaphoreValueCount   = waitCount;
+        tsi.pWaitSemaphoreValues      = waitValues.data();
+        tsi.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+        tsi.pSignalSemaphoreValues    = signalValues.data();
+
+        vk::SubmitInfo si{};
+        si.pNext                = &tsi;
+        si.waitSemaphoreCount   = waitCount;
+        si.pWaitSemaphores      = waitSems.data();
+        si.pWaitDstStageMask    = waitStages.data();
+        si.commandBufferCount   = 1;
+        si.pCommandBuffers      = &fr.cmd;
+        si.signalSemaphoreCount = static_cast<uint32_t>(signalSems.size());
+        si.pSignalSemaphores    = signalSems.data();
+
+        if (m_graphicsQueue.submit(1, &si, nullptr) != vk::Result::eSuccess)
+            throw std::runtime_error("queue submit failed");
+        fr.doneValue = frameValue;
+        m_imageValues[imageIndex] = frameValue;
     }
+    m_swapImageLayouts[imageIndex] = sw.currentLayout;
 
-    m_raytracer.dispatchRayTracing(fr.cmd, m_swapExtent.width, m_swapExtent.height, m_frameIndex);
-
-    // Memory barrier: ray tracing writes -> compute shader reads
-    vk::MemoryBarrier2 rtToComputeBarrier{};
-    rtToComputeBarrier.srcStageMask = vk::PipelineStageFlagBits2::eRayTracingShaderKHR;
-    rtToComputeBarrier.srcAccessMask = vk::AccessFlagBits2::eShaderWrite;
-    rtToComputeBarrier.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
-    rtToComputeBarrier.dstAccessMask = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite;
-
-    vk::DependencyInfo rtToComputeDep{};
-    rtToComputeDep.memoryBarrierCount = 1;
-    rtToComputeDep.pMemoryBarriers = &rtToComputeBarrier;
-    fr.cmd.pipelineBarrier2(rtToComputeDep);
-
-    // Before denoising - ensure history images are in correct layout
-    it.ensure(m_denoiser.gbuffer.previousWorldPosition(), Role::General);
-    it.ensure(m_denoiser.gbuffer.previousNormalRoughness(), Role::General);
-
-    // Run temporal reprojection compute shader
-    m_denoiser.updateDescriptorSets(m_frameIndex);
-    m_denoiser.denoise(fr.cmd, m_swapExtent.width, m_swapExtent.height, m_frameIndex);
-
-    // Memory barrier: compute shader writes -> transfer reads
-    vk::MemoryBarrier2 computeToTransferBarrier{};
-    computeToTransferBarrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
-    computeToTransferBarrier.srcAccessMask = vk::AccessFlagBits2::eShaderWrite;
-    computeToTransferBarrier.dstStageMask = vk::PipelineStageFlagBits2::eTransfer;
-    computeToTransferBarrier.dstAccessMask = vk::AccessFlagBits2::eTransferRead | vk::AccessFlagBits2::eTransferWrite;
-
-    vk::DependencyInfo computeToTransferDep{};
-    computeToTransferDep.memoryBarrierCount = 1;
-    computeToTransferDep.pMemoryBarriers = &computeToTransferBarrier;
-    fr.cmd.pipelineBarrier2(computeToTransferDep);
-
-    // Transition images for copy
-    it.ensure(m_denoiser.gbuffer.worldPosition, Role::TransferSrc);
-    it.ensure(m_denoiser.gbuffer.normalRoughness, Role::TransferSrc);
-    it.ensure(m_denoiser.gbuffer.currentWorldPosition(), Role::TransferDst);
-    it.ensure(m_denoiser.gbuffer.currentNormalRoughness(), Role::TransferDst);
-
-    // Copy current frame's geometry to history (will become "previous" after swap)
-    m_denoiser.copyCurrentGeometryToHistory(fr.cmd);
-
-    // Memory barrier: transfer -> compute for post-processing
-    vk::MemoryBarrier2 transferToComputeBarrier{};
-    transferToComputeBarrier.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
-    transferToComputeBarrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
-    transferToComputeBarrier.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
-    transferToComputeBarrier.dstAccessMask = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite;
-
-    vk::DependencyInfo transferToComputeDep{};
-    transferToComputeDep.memoryBarrierCount = 1;
-    transferToComputeDep.pMemoryBarriers = &transferToComputeBarrier;
-    fr.cmd.pipelineBarrier2(transferToComputeDep);
-
-    // ==================== POST-PROCESSING (TAA + Tonemap + Sharpen) ====================
-    Image& denoisedOutput = m_denoiser.getOutputImage();
-    m_postProcess.process(fr.cmd, denoisedOutput, m_swapExtent.width, m_swapExtent.height, m_frameIndex);
-
-    // Memory barrier: post-process compute -> transfer for blit
-    vk::MemoryBarrier2 postToTransferBarrier{};
-    postToTransferBarrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
-    postToTransferBarrier.srcAccessMask = vk::AccessFlagBits2::eShaderWrite;
-    postToTransferBarrier.dstStageMask = vk::PipelineStageFlagBits2::eTransfer;
-    postToTransferBarrier.dstAccessMask = vk::AccessFlagBits2::eTransferRead;
+    // cpu side of the frame, what low latency pacing has to leave room for
+    m_lastSubmit = std::chrono::steady_clock::now();
+    if (m_paceEnd != std::chrono::steady_clock::time_point{}) {
+        const float ms = std::chrono::duration<float, std::milli>(m_lastSubmit - m_paceEnd).count();
+        m_cpuFrameMs = m_cpuFrameMs > 0.0f ? m_cpuFrameMs + (ms - m_cpuFrameMs) * 0.1f : ms;
+        m_paceEnd = {};
+    }
 
-    vk::DependencyInfo postToTransferDep{};
-    postToTransferDep.memoryBarrierCount = 1;
-    postToTransferDep.pMemoryBarriers = &postToTransferBarrier;
-    fr.cmd.pipelineBarrier2(postToTransferDep);
+    if (!m_asyncCompute)
+        presentImage(imageIndex);
 
-    // Get final post-processed output for blit
-    Image& finalOutput = m_postProcess.getOutputImage();
-    it.ensure(finalOutput, Role::TransferSrc);
-    it.ensure(sw, Role::TransferDst);
-
-    // Blit post-processed output to swapchain
-    vk::ImageBlit blit{};
-    blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-    blit.srcSubresource.mipLevel   = 0;
-    blit.srcSubresource.baseArrayLayer = 0;
-    blit.srcSubresource.layerCount     = 1;
-    blit.srcOffsets[0] = vk::Offset3D{0, 0, 0};
-    blit.srcOffsets[1] = vk::Offset3D{
-        static_cast<int>(finalOutput.width),
-        static_cast<int>(finalOutput.height),
-        1
-    };
-
-    blit.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-    blit.dstSubresource.mipLevel   = 0;
-    blit.dstSubresource.baseArrayLayer = 0;
-    blit.dstSubresource.layerCount     = 1;
-    blit.dstOffsets[0] = vk::Offset3D{0, 0, 0};
-    blit.dstOffsets[1] = vk::Offset3D{
-        static_cast<int>(m_swapExtent.width),
-        static_cast<int>(m_swapExtent.height),
-        1
-    };
-
-    fr.cmd.blitImage(
-        finalOutput.handle, vk::ImageLayout::eTransferSrcOptimal,
-        sw.handle, vk::ImageLayout::eTransferDstOptimal,
-        1, &blit, vk::Filter::eLinear
+    // Store current frame's camera data for next frame's reprojection
+    m_denoiser.updatePreviousFrameData(
+        c.view(),
+        baseProj,  // Use NON-jittered projection for reprojection
+        c.position
     );
 
-    // Transition swapchain image for gui rendering
-    it.ensure(sw, Role::ColorAttachment);
-/*
-    const std::array<float,4> clear{0.0f,0.0f,0.0f,1.0f};
-    cmdBeginRendering(fr.cmd, sw.view, m_depth.view, m_swapExtent, clear, 1.0f, 0);
-    // Can do render stuff here
-    cmdEndRendering(fr.cmd);
-*/
-
-    // imgui
-    {
-        vk::RenderingAttachmentInfo uiColor{};
-        uiColor.imageView   = sw.view;
-        uiColor.imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
-        uiColor.loadOp      = vk::AttachmentLoadOp::eLoad;   // keep scene
-        uiColor.storeOp     = vk::AttachmentStoreOp::eStore;
-        // clearValue ignored with eLoad
-
-        vk::RenderingInfo uiInfo{};
-        uiInfo.renderArea        = vk::Rect2D({0, 0}, m_swapExtent);
-        uiInfo.layerCount        = 1;
-        uiInfo.colorAttachmentCount = 1;
-        uiInfo.pColorAttachments = &uiColor;
-        uiInfo.pDepthAttachment  = nullptr;
-        uiInfo.pStencilAttachment= nullptr;
-
-        fr.cmd.beginRendering(uiInfo);
-
-        ImGui::Render();
-        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), static_cast<VkCommandBuffer>(fr.cmd), VK_NULL_HANDLE);
-
-        fr.cmd.endRendering();
-    }
-
-    it.ensure(sw, Role::Present);
-    m_swapImageLayouts[imageIndex] = sw.currentLayout;
-
-    fr.cmd.end();
+    // Store previous frame data for TAA
+    m_postProcess.updatePreviousFrameData(
+        c.view(),
+        baseProj  // Use NON-jittered projection
+    );
 
-    // submit
-    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    vk::SubmitInfo si{};
-    si.waitSemaphoreCount   = 1;
-    si.pWaitSemaphores      = &fr.imageAvailable;
-    si.pWaitDstStageMask    = &waitStage;
-    si.commandBufferCount   = 1;
-    si.pCommandBuffers      = &fr.cmd;
-    si.signalSemaphoreCount = 1;
-    si.pSignalSemaphores    = &m_presentSignals[imageIndex];
+    // Swap history buffers (current becomes previous for next frame)
+    m_denoiser.swapHistoryBuffers();
+    m_postProcess.swapHistoryBuffers();
+}
 
-    result = m_graphicsQueue.submit(1, &si, fr.inFlight);
+void Renderer::waitTimeline(uint64_t value) {
+    if (value == 0) return;
+    vk::SemaphoreWaitInfo wi{};
+    wi.semaphoreCount = 1;
+    wi.pSemaphores = &m_timeline;
+    wi.pValues = &value;
+    if (m_device.waitSemaphores(wi, UINT64_MAX) != vk::Result::eSuccess)
+        throw std::runtime_error("waitSemaphores failed");
+}
 
+void Renderer::presentImage(uint32_t imageIndex) {
     vk::PresentInfoKHR pi{};
     pi.waitSemaphoreCount = 1;
     pi.pWaitSemaphores    = &m_presentSignals[imageIndex];
@@ -304,28 +522,429 @@ void Renderer::drawFrame(const Camera& c, float dt) {
     pi.pSwapchains        = &scH;
     pi.pImageIndices      = &imageIndex;
 
+    // paceFrame waits for this id to reach the screen
+    vk::PresentIdKHR presentId{};
+    const uint64_t id = m_presentId + 1;
+    if (m_presentWait) {
+        presentId.swapchainCount = 1;
+        presentId.pPresentIds = &id;
+        pi.pNext = &presentId;
+        m_presentId = id;
+    }
+
     const auto pres = m_presentQueue.presentKHR(pi);
     if (pres == vk::Result::eErrorOutOfDateKHR || pres == vk::Result::eSuboptimalKHR)
         m_swapchainDirty = true;
     else if (pres != vk::Result::eSuccess)
         throw std::runtime_error("presentKHR failed");
+}
 
-    // Store current frame's camera data for next frame's reprojection
-    m_denoiser.updatePreviousFrameData(
-        c.view(),
-        baseProj,  // Use NON-jittered projection for reprojection
-        c.position
-    );
+// async compute frame: trace on graphics, denoise + post on m_asyncComputeQueue, blit + gui + present back on graphics.
+// the graphics queue runs trace N, present N-1, trace N+1, present N, ... so each trace overlaps the previous
+// frame's compute chain. the ray targets are per frame for that (GBuffer::parked), the post output is shared
+// and the chain waits for the blit in front of it
+void Renderer::submitFrameAsync(FrameResources& fr, Image& sw, uint32_t imageIndex) {
+    const vk::CommandBufferBeginInfo bi{};
 
-    // Store previous frame data for TAA
-    m_postProcess.updatePreviousFrameData(
-        c.view(),
-        baseProj  // Use NON-jittered projection
-    );
+    fr.cmd.reset({});
+    fr.cmd.begin(bi);
+    RenderGraph traceGraph{ fr.cmd, false, &m_profiler };
+    // one top level scope per submit, the frame time is their sum even though they overlap across queues
+    m_profiler.beginFrame(fr.cmd, m_frameIndex);
+    const uint32_t traceScope = m_profiler.begin(fr.cmd, "Trace");
+    recordRayTracing(traceGraph);
+    recordPicks(traceGraph, fr);
+    m_profiler.end(fr.cmd, traceScope);
+    fr.cmd.end();
 
-    // Swap history buffers (current becomes previous for next frame)
-    m_denoiser.swapHistoryBuffers();
-    m_postProcess.swapHistoryBuffers();
+    // graphics keeps signalling m_timeline, still in submission order for the world update + retire bookkeeping
+    const uint64_t traceValue = ++m_timelineValue;
+    submitCommands(m_graphicsQueue, fr.cmd,
+        {{m_timeline, m_worldReadyValue, vk::PipelineStageFlagBits::eRayTracingShaderKHR | vk::PipelineStageFlagBits::eVertexInput |
+                                          vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR},
+         {m_cudaInterop.traceDone(), m_traceValue, vk::PipelineStageFlagBits::eTransfer}},
+        {{m_timeline, traceValue}});
+
+    flushPendingPresent();
+
+    fr.computeCmd.reset({});
+    fr.computeCmd.begin(bi);
+    RenderGraph computeGraph{ fr.computeCmd, true, &m_profiler };
+    const uint32_t computeScope = m_profiler.begin(fr.computeCmd, "Compute");
+    recordDenoiseAndPost(computeGraph);
+    m_profiler.end(fr.computeCmd, computeScope);
+    fr.computeCmd.end();
+
+    // latest graphics value, covers this trace and the blit just queued
+    const uint64_t postValue = ++m_computeTimelineValue;
+    submitCommands(m_asyncComputeQueue, fr.computeCmd,
+        {{m_timeline, m_timelineValue, vk::PipelineStageFlagBits::eAllCommands}},
+        {{m_computeTimeline, postValue}});
+
+    fr.presentCmd.reset({});
+    fr.presentCmd.begin(bi);
+    RenderGraph presentGraph{ fr.presentCmd, false, &m_profiler };
+    const uint32_t presentScope = m_profiler.begin(fr.presentCmd, "Present");
+    recordPresent(presentGraph, sw);
+    m_profiler.end(fr.presentCmd, presentScope);
+    fr.presentCmd.end();
+
+    m_pendingPresent = { &fr, imageIndex, postValue };
+}
+
+void Renderer::flushPendingPresent() {
+    if (!m_pendingPresent.frame) return;
+    const PendingPresent p = m_pendingPresent;
+    m_pendingPresent = {};
+
+    const uint64_t frameValue = ++m_timelineValue;
+    submitCommands(m_graphicsQueue, p.frame->presentCmd,
+        {{p.frame->imageAvailable, 0, vk::PipelineStageFlagBits::eTransfer},
+         {m_computeTimeline, p.postValue, vk::PipelineStageFlagBits::eTransfer}},
+        {{m_presentSignals[p.imageIndex], 0}, {m_timeline, frameValue}});
+    p.frame->doneValue = frameValue;
+    m_imageValues[p.imageIndex] = frameValue;
+
+    presentImage(p.imageIndex);
+}
+
+void Renderer::recordRayTracing(RenderGraph& graph) {
+    // progressive accumulation reached its target, the last mean is presented again
+    if (!m_denoiser.progressiveTracing) return;
+
+    if (m_cudaInterop.active()) {
+        m_cudaInterop.record(graph, m_frameIndex);
+        return;
+    }
+
+    auto& gbuffer = m_denoiser.gbuffer;
+
+    if (m_world) {
+        m_raytracer.updateDescriptorSet(*m_world, m_frameIndex);
+    }
+
+    const bool restir = m_raytracer.settings.restirDI;
+    Buffer* radianceCache = m_world && m_raytracer.settings.radianceCache ? &m_world->radianceCache : nullptr;
+
+    // once more after culling is turned off, with enabled = 0 it restores every mask
+    if (m_world && m_world->tlas.handle && (m_raytracer.settings.tlasCulling || m_raytracer.tlasCulled)) {
+        graph.pass(vk::PipelineStageFlagBits2::eComputeShader | vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR, "TLAS Cull")
+            .run([&](vk::CommandBuffer cmd) {
+                m_raytracer.recordTlasCull(cmd, *m_world, m_frameIndex);
+            });
+    }
+
+    if (m_raytracer.frameRaster) {
+        graph.pass(vk::PipelineStageFlagBits2::eColorAttachmentOutput | vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+                   vk::PipelineStageFlagBits2::eLateFragmentTests, "Visibility")
+            .write(gbuffer.visibility, Role::ColorAttachment)
+            .write(m_depth, Role::DepthAttachment)
+            .run([&](vk::CommandBuffer cmd) {
+                // clears to 0, the miss raygen checks for
+                const std::array<float, 4> clear{0.0f, 0.0f, 0.0f, 0.0f};
+                cmdBeginRendering(cmd, gbuffer.visibility.view, m_depth.view, m_renderExtent, clear, 1.0f, 0);
+                m_raytracer.drawVisibility(cmd, *m_world);
+                cmdEndRendering(cmd);
+            });
+    }
+
+    graph.pass(m_raytracer.frameQuery ? vk::PipelineStageFlagBits2::eComputeShader : vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+               m_raytracer.frameQuery ? "Ray Query" : "Ray Tracing")
+        .write(gbuffer.color)
+        .write(gbuffer.currentWorldPosition())
+        .write(gbuffer.currentNormalRoughness())
+        .write(gbuffer.albedoMetallic)
+        .write(gbuffer.motionVectors);
+    // the pass stays open until run, so the reservoirs can be added to it conditionally
+    if (restir) graph.write(gbuffer.currentReservoirs()).read(gbuffer.previousReservoirs());
+    if (radianceCache) graph.write(*radianceCache);
+    if (m_raytracer.settings.adaptiveSampling) graph.read(gbuffer.sampleBudget[m_raytracer.sampleBudgetSlot(m_frameIndex)]);
+    if (m_raytracer.frameRaster) graph.read(gbuffer.visibility);
+    const bool stats = m_raytracer.pipelineTraversalStats;
+    if (stats) graph.write(gbuffer.traversalStats);
+    graph.run([&, stats](vk::CommandBuffer cmd) {
+        m_raytracer.dispatchRayTracing(cmd, m_renderExtent.width, m_renderExtent.height, m_frameIndex);
+        if (!stats) return;
+
+        // the totals go straight to host memory, the timeline wait doesn't make them visible on its own
+        vk::MemoryBarrier2 toHost{};
+        toHost.srcStageMask = m_raytracer.frameQuery ? vk::PipelineStageFlagBits2::eComputeShader
+                                                     : vk::PipelineStageFlagBits2::eRayTracingShaderKHR;
+        toHost.srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite;
+        toHost.dstStageMask = vk::PipelineStageFlagBits2::eHost;
+        toHost.dstAccessMask = vk::AccessFlagBits2::eHostRead;
+        vk::DependencyInfo dep{};
+        dep.memoryBarrierCount = 1;
+        dep.pMemoryBarriers = &toHost;
+        cmd.pipelineBarrier2(dep);
+    });
+
+    if (radianceCache) {
+        const uint32_t cells = static_cast<uint32_t>(radianceCache->size / sizeof(RadianceCacheCell));
+        graph.pass(vk::PipelineStageFlagBits2::eRayTracingShaderKHR, "Radiance Cache")
+            .write(*radianceCache)
+            .run([&, cells](vk::CommandBuffer cmd) {
+                m_raytracer.dispatchRadianceCache(cmd, cells, m_frameIndex);
+            });
+    }
+
+    if (!restir) return;
+
+    // neighbours' reservoirs are only complete once the whole trace is done, so the shading is its own dispatch
+    // its shadow rays go through the svo walk too, into the launch scratch of the stats
+    graph.pass(vk::PipelineStageFlagBits2::eRayTracingShaderKHR, "ReSTIR Spatial")
+        .read(gbuffer.currentReservoirs())
+        .write(gbuffer.color);
+    if (m_raytracer.pipelineTraversalStats) graph.write(gbuffer.traversalStats);
+    graph.run([&](vk::CommandBuffer cmd) {
+            m_raytracer.dispatchRestirSpatial(cmd, m_renderExtent.width, m_renderExtent.height, m_frameIndex);
+        });
+}
+
+void Renderer::recordPicks(RenderGraph& graph, FrameResources& fr) {
+    if (m_pickQueue.empty()) return;
+
+    const size_t count = std::min<size_t>(m_pickQueue.size(), PICK_MAX_PER_FRAME);
+    fr.picks.assign(m_pickQueue.begin(), m_pickQueue.begin() + static_cast<std::ptrdiff_t>(count));
+    m_pickQueue.erase(m_pickQueue.begin(), m_pickQueue.begin() + static_cast<std::ptrdiff_t>(count));
+
+    // the render extent can have changed since the request, it's only fixed from here on
+    fr.pickExtent = m_renderExtent;
+    for (auto& p : fr.picks) {
+        p.x = std::min(static_cast<uint32_t>(p.uv.x * static_cast<float>(m_renderExtent.width)), m_renderExtent.width - 1);
+        p.y = std::min(static_cast<uint32_t>(p.uv.y * static_cast<float>(m_renderExtent.height)), m_renderExtent.height - 1);
+    }
+
+    // whatever the trace left in the current slot. when progressive tracing has stopped that's the last traced
+    // frame of an unmoved camera, still the right surface
+    auto& gbuffer = m_denoiser.gbuffer;
+    Image& position = gbuffer.currentWorldPosition();
+    Image& normal = gbuffer.currentNormalRoughness();
+    Image& albedo = gbuffer.albedoMetallic;
+
+    graph.pass(vk::PipelineStageFlagBits2::eTransfer, "Pick Readback")
+        .read(position, Role::TransferSrc)
+        .read(normal, Role::TransferSrc)
+        .read(albedo, Role::TransferSrc)
+        .write(fr.pickReadback)
+        .run([&](vk::CommandBuffer cmd) {
+            for (size_t i = 0; i < fr.picks.size(); ++i) {
+                vk::BufferImageCopy region{};
+                region.bufferOffset = i * PICK_STRIDE;
+                region.imageSubresource = { vk::ImageAspectFlagBits::eColor, 0, 0, 1 };
+                region.imageOffset = vk::Offset3D{ static_cast<int32_t>(fr.picks[i].x), static_cast<int32_t>(fr.picks[i].y), 0 };
+                region.imageExtent = vk::Extent3D{ 1, 1, 1 };
+                cmd.copyImageToBuffer(position.handle, vk::ImageLayout::eTransferSrcOptimal, fr.pickReadback.handle, 1, &region);
+                region.bufferOffset = i * PICK_STRIDE + 16;
+                cmd.copyImageToBuffer(normal.handle, vk::ImageLayout::eTransferSrcOptimal, fr.pickReadback.handle, 1, &region);
+                region.bufferOffset = i * PICK_STRIDE + 32;
+                cmd.copyImageToBuffer(albedo.handle, vk::ImageLayout::eTransferSrcOptimal, fr.pickReadback.handle, 1, &region);
+            }
+
+            // the fence doesn't make the copies visible to the host on its own
+            vk::MemoryBarrier2 toHost{};
+            toHost.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+            toHost.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+            toHost.dstStageMask = vk::PipelineStageFlagBits2::eHost;
+            toHost.dstAccessMask = vk::AccessFlagBits2::eHostRead;
+            vk::DependencyInfo dep{};
+            dep.memoryBarrierCount = 1;
+            dep.pMemoryBarriers = &toHost;
+            cmd.pipelineBarrier2(dep);
+        });
+}
+
+uint64_t Renderer::requestPick(const glm::vec2& windowPixel) {
+    int w = 0, h = 0;
+    glfwGetWindowSize(m_window, &w, &h);
+    PickRequest p{};
+    p.id = m_nextPickId++;
+    p.uv = glm::clamp(windowPixel / glm::max(glm::vec2(static_cast<float>(w), static_cast<float>(h)), glm::vec2(1.0f)),
+                      glm::vec2(0.0f), glm::vec2(1.0f));
+    m_pickQueue.push_back(p);
+    return p.id;
+}
+
+void Renderer::takePickResults(std::vector<PickResult>& out) {
+    const uint64_t done = m_device.getSemaphoreCounterValue(m_timeline);
+    for (auto& fr : m_frames) {
+        // an async frame's doneValue is only set once its present goes out
+        if (fr.picks.empty() || m_pendingPresent.frame == &fr) continue;
+        if (done >= fr.doneValue) resolvePicks(fr);
+    }
+    out.insert(out.end(), m_pickResults.begin(), m_pickResults.end());
+    m_pickResults.clear();
+}
+
+void Renderer::resolvePicks(FrameResources& fr) {
+    if (fr.picks.empty()) return;
+
+    // no-op on coherent memory
+    vmaInvalidateAllocation(m_allocator, fr.pickReadback.alloc, 0, fr.picks.size() * PICK_STRIDE);
+    const auto* bytes = static_cast<const uint8_t*>(fr.pickReadback.mapped);
+
+    for (size_t i = 0; i < fr.picks.size(); ++i) {
+        const PickRequest& p = fr.picks[i];
+        const uint8_t* texel = bytes + i * PICK_STRIDE;
+        PickResult r{};
+        r.id = p.id;
+
+#ifdef BLOK_COMPACT_GBUFFER
+        // same as reconstructWorldPos / unpackNormalRoughness in the shaders
+        float hitT = 0.0f;
+        std::memcpy(&hitT, texel, sizeof(float));
+        const glm::vec2 d = (glm::vec2(static_cast<float>(p.x), static_cast<float>(p.y)) + 0.5f) /
+            glm::vec2(static_cast<float>(fr.pickExtent.width), static_cast<float>(fr.pickExtent.height)) * 2.0f - 1.0f;
+        const glm::vec4 target = fr.pickInvProj * glm::vec4(d.x, d.y, 1.0f, 1.0f);
+        const glm::vec3 dir = glm::normalize(glm::vec3(fr.pickInvView * glm::vec4(glm::normalize(glm::vec3(target)), 0.0f)));
+        r.position = fr.pickCamPos + dir * hitT;
+        r.depth = hitT;
+
+        uint32_t packed = 0;
+        std::memcpy(&packed, texel + 16, sizeof(packed));
+        const glm::vec2 e = glm::vec2(static_cast<float>(packed & 4095u), static_cast<float>((packed >> 12) & 4095u)) / 4095.0f * 2.0f - 1.0f;
+        glm::vec3 n(e, 1.0f - std::abs(e.x) - std::abs(e.y));
+        if (n.z < 0.0f) {
+            n.x = (1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+            n.y = (1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        r.normal = glm::normalize(n);
+#else
+        glm::vec4 position{0.0f};
+        std::memcpy(&position, texel, sizeof(position));
+        r.position = glm::vec3(position);
+        r.depth = position.w;
+
+        uint64_t halfBits = 0;
+        std::memcpy(&halfBits, texel + 16, sizeof(halfBits));
+        r.normal = glm::vec3(glm::unpackHalf4x16(halfBits));
+#endif
+
+        uint32_t albedo = 0;
+        std::memcpy(&albedo, texel + 32, sizeof(albedo));
+        r.albedoMetallic = glm::unpackUnorm4x8(albedo);
+
+        // raygen stores 10000 for sky
+        r.hit = r.depth < 9999.0f;
+        if (r.hit) r.voxel = glm::ivec3(glm::floor(r.position - r.normal * 0.5f));
+        m_pickResults.push_back(r);
+    }
+    fr.picks.clear();
+}
+
+void Renderer::resolveTraversalStats(FrameResources& fr) {
+    // no-op on coherent memory
+    vmaInvalidateAllocation(m_allocator, fr.traversalTotals.alloc, 0, sizeof(TraversalTotalsGpu));
+    auto* totals = static_cast<TraversalTotalsGpu*>(fr.traversalTotals.mapped);
+    // nothing was traced with the stats on, the last totals stay
+    if (totals->pixels == 0) return;
+
+    auto wide = [](const uint32_t (&v)[2]) { return static_cast<uint64_t>(v[1]) << 32 | v[0]; };
+    TraversalStats& s = m_traversalStats;
+    s.pixels = totals->pixels;
+    s.rays = wide(totals->rays);
+    s.nodes = wide(totals->nodes);
+    s.traversals = wide(totals->traversals);
+    s.bounces = wide(totals->bounces);
+    s.cutOff = wide(totals->cutOff);
+    s.maxStack = totals->maxStack;
+    s.maxNodes = totals->maxNodes;
+
+    std::memset(totals, 0, sizeof(TraversalTotalsGpu));
+    vmaFlushAllocation(m_allocator, fr.traversalTotals.alloc, 0, sizeof(TraversalTotalsGpu));
+}
+
+void Renderer::recordDenoiseAndPost(RenderGraph& graph, Image* swapTarget) {
+    // Run temporal reprojection compute shader
+    m_denoiser.updateDescriptorSets(m_frameIndex);
+    m_denoiser.denoise(graph, m_renderExtent.width, m_renderExtent.height, m_frameIndex);
+
+    // ==================== POST-PROCESSING (TAA + Tonemap + Sharpen) ====================
+    Image& denoisedOutput = m_denoiser.getOutputImage();
+    m_postProcess.process(graph, denoisedOutput, m_swapExtent.width, m_swapExtent.height, m_frameIndex, swapTarget);
+}
+
+void Renderer::recordPresent(RenderGraph& graph, Image& sw, bool blitOutput) {
+    // Get final post-processed output for blit
+    Image& finalOutput = m_postProcess.getOutputImage();
+
+    if (blitOutput) {
+        // the acquire semaphore is waited on at transfer, the blit is the first thing touching the image
+        graph.imported(sw, vk::PipelineStageFlagBits2::eTransfer);
+
+        // Blit post-processed output to swapchain
+        graph.pass(vk::PipelineStageFlagBits2::eTransfer, "Blit")
+            .read(finalOutput, Role::TransferSrc)
+            .write(sw, Role::TransferDst)
+            .run([&](vk::CommandBuffer cmd) {
+                vk::ImageBlit blit{};
+                blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+                blit.srcSubresource.mipLevel   = 0;
+                blit.srcSubresource.baseArrayLayer = 0;
+                blit.srcSubresource.layerCount     = 1;
+                // the post images are pooled bigger, only the swap extent of them is this frame
+                blit.srcOffsets[0] = vk::Offset3D{0, 0, 0};
+                blit.srcOffsets[1] = vk::Offset3D{
+                    static_cast<int>(m_swapExtent.width),
+                    static_cast<int>(m_swapExtent.height),
+                    1
+                };
+
+                blit.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+                blit.dstSubresource.mipLevel   = 0;
+                blit.dstSubresource.baseArrayLayer = 0;
+                blit.dstSubresource.layerCount     = 1;
+                blit.dstOffsets[0] = vk::Offset3D{0, 0, 0};
+                blit.dstOffsets[1] = vk::Offset3D{
+                    static_cast<int>(m_swapExtent.width),
+                    static_cast<int>(m_swapExtent.height),
+                    1
+                };
+
+                cmd.blitImage(
+                    finalOutput.handle, vk::ImageLayout::eTransferSrcOptimal,
+                    sw.handle, vk::ImageLayout::eTransferDstOptimal,
+                    1, &blit, vk::Filter::eLinear
+                );
+            });
+    }
+/*
+    const std::array<float,4> clear{0.0f,0.0f,0.0f,1.0f};
+    cmdBeginRendering(cmd, sw.view, m_depth.view, m_swapExtent, clear, 1.0f, 0);
+    // Can do render stuff here
+    cmdEndRendering(cmd);
+*/
+
+    // imgui
+    graph.pass(vk::PipelineStageFlagBits2::eColorAttachmentOutput, "ImGui")
+        .write(sw, Role::ColorAttachment)
+        .run([&](vk::CommandBuffer cmd) {
+            vk::RenderingAttachmentInfo uiColor{};
+            uiColor.imageView   = sw.view;
+            uiColor.imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+            uiColor.loadOp      = vk::AttachmentLoadOp::eLoad;   // keep scene
+            uiColor.storeOp     = vk::AttachmentStoreOp::eStore;
+            // clearValue ignored with eLoad
+
+            vk::RenderingInfo uiInfo{};
+            uiInfo.renderArea        = vk::Rect2D({0, 0}, m_swapExtent);
+            uiInfo.layerCount        = 1;
+            uiInfo.colorAttachmentCount = 1;
+            uiInfo.pColorAttachments = &uiColor;
+            uiInfo.pDepthAttachment  = nullptr;
+            uiInfo.pStencilAttachment= nullptr;
+
+            cmd.beginRendering(uiInfo);
+
+            ImGui::Render();
+            ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), static_cast<VkCommandBuffer>(cmd), VK_NULL_HANDLE);
+
+            cmd.endRendering();
+        });
+
+    graph.pass(vk::PipelineStageFlagBits2::eBottomOfPipe)
+        .read(sw, Role::Present)
+        .flush();
 }
 
 void Renderer::cmdBeginRendering(vk::CommandBuffer cmd, vk::ImageView colorView, vk::ImageView depthView, vk::Extent2D extent, const std::array<float, 4> &clearColor, float clearDepth, uint32_t clearStencil) {
@@ -378,12 +997,17 @@ void Renderer::cmdEndRendering(vk::CommandBuffer cmd) {
 
 void Renderer::endFrame() {
     // advance frame
-    m_frameIndex = (m_frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
+    m_frameIndex = (m_frameIndex + 1) % m_framesInFlight;
 
     if (m_swapchainDirty) {
         recreateSwapChain();
         m_swapchainDirty = false;
     }
+
+    if (m_qualityWanted != m_quality || m_raytracer.settings.slimPayload != m_raytracer.pipelineSlimPayload ||
+        m_raytracer.settings.traversalStats != m_raytracer.pipelineTraversalStats)
+        applyQualityPreset();
+    if (m_shaderHotReload) pollShaderChanges();
 }
 
 
@@ -0,0 +1,395 @@
+/*
+* File: renderer_gl_raster.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "renderer_gl_raster.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <glad/glad.h>
+
+#include "camera.hpp"
+#include "cpu_profiler.hpp"
+
+namespace blok {
+
+namespace {
+
+// unpacks RasterVertex, the chunk origin is an instanced attribute so the base instance picks it per draw
+const char* RASTER_VS = R"(#version 330 core
+    layout(location=0) in uvec2 aVertex;
+    layout(location=1) in vec3 aOrigin;
+    uniform mat4 uViewProj;
+    uniform float uVoxelSize;
+    uniform samplerBuffer uMaterials; // MaterialGpu, two rgba32f texels each
+    flat out vec3 vColor;
+
+    const vec3 NORMALS[6] = vec3[6](vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1));
+    const vec3 SUN = vec3(0.37139, 0.92848, 0.27854);
+
+    void main() {
+        uvec3 p = uvec3(aVertex.x, aVertex.x >> 9u, aVertex.x >> 18u) & 511u;
+        uint face = aVertex.x >> 27u;
+        vec3 albedo = texelFetch(uMaterials, int(aVertex.y) * 2).rgb;
+        vec3 emission = texelFetch(uMaterials, int(aVertex.y) * 2 + 1).rgb;
+        float light = 0.3 + 0.7 * max(dot(NORMALS[face], SUN), 0.0);
+        vColor = albedo * light + emission;
+        gl_Position = uViewProj * vec4(aOrigin + vec3(p) * uVoxelSize, 1.0);
+    })";
+
+const char* RASTER_FS = R"(#version 330 core
+    flat in vec3 vColor;
+    out vec4 frag;
+    void main() {
+        frag = vec4(pow(clamp(vColor, 0.0, 1.0), vec3(1.0 / 2.2)), 1.0);
+    })";
+
+// DrawArraysIndirectCommand
+struct DrawCommand {
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t first;
+    uint32_t baseInstance;
+};
+
+GLuint compileRasterShader(GLenum type, const char* src) {
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    GLint ok = GL_FALSE;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(s, 1024, nullptr, log);
+        glDeleteShader(s);
+        throw std::runtime_error(std::string("Raster shader compile failed: ") + log);
+    }
+    return s;
+}
+
+// the six frustum planes of a view projection (gl clip space), normals pointing inside
+void frustumPlanes(const glm::mat4& m, glm::vec4 planes[6]) {
+    const glm::vec4 r0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    const glm::vec4 r1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    const glm::vec4 r2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    const glm::vec4 r3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = r3 + r0; planes[1] = r3 - r0;
+    planes[2] = r3 + r1; planes[3] = r3 - r1;
+    planes[4] = r3 + r2; planes[5] = r3 - r2;
+}
+
+bool boxInFrustum(const glm::vec4 planes[6], const glm::vec3& lo, const glm::vec3& hi) {
+    for (int i = 0; i < 6; ++i) {
+        // the corner furthest along the plane normal
+        const glm::vec3 p(planes[i].x >= 0.0f ? hi.x : lo.x, planes[i].y >= 0.0f ? hi.y : lo.y, planes[i].z >= 0.0f ? hi.z : lo.z);
+        if (glm::dot(glm::vec3(planes[i]), p) + planes[i].w < 0.0f) return false;
+    }
+    return true;
+}
+
+// greedy quads of one chunk as raster vertices, two triangles per quad
+void meshRasterChunk(const ChunkStorage& storage, std::vector<RasterVertex>& out) {
+    std::vector<GreedyQuad> quads;
+    greedyMeshChunk(storage, storage.size(), quads);
+
+    out.clear();
+    out.reserve(quads.size() * 6);
+    for (const GreedyQuad& q : quads) {
+        const int axis = static_cast<int>(q.face >> 1);
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+        const glm::ivec2 corners[4] = {{q.u, q.v}, {q.u + q.w, q.v}, {q.u + q.w, q.v + q.h}, {q.u, q.v + q.h}};
+
+        // the winding doesn't matter, nothing is culled by facing
+        for (int c : {0, 1, 2, 0, 2, 3}) {
+            glm::ivec3 p(0);
+            p[axis] = q.plane; p[u] = corners[c].x; p[v] = corners[c].y;
+            const uint32_t packed = uint32_t(p.x) | (uint32_t(p.y) << 9) | (uint32_t(p.z) << 18) | (q.face << 27);
+            out.push_back({packed, q.material - 1u});
+        }
+    }
+}
+
+}
+
+ChunkRasterGL::~ChunkRasterGL() {
+    if (m_active) shutdown();
+}
+
+void ChunkRasterGL::init() {
+    GLuint vs = compileRasterShader(GL_VERTEX_SHADER, RASTER_VS);
+    GLuint fs = compileRasterShader(GL_FRAGMENT_SHADER, RASTER_FS);
+    m_prog = glCreateProgram();
+    glAttachShader(m_prog, vs);
+    glAttachShader(m_prog, fs);
+    glLinkProgram(m_prog);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint ok = GL_FALSE;
+    glGetProgramiv(m_prog, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLog(m_prog, 1024, nullptr, log);
+        throw std::runtime_error(std::string("Raster program link failed: ") + log);
+    }
+
+    glGenVertexArrays(1, &m_vao);
+    glGenBuffers(1, &m_originBuffer);
+    glGenBuffers(1, &m_materialBuffer);
+    glGenTextures(1, &m_materialTex);
+    if (GLAD_GL_VERSION_4_3) glGenBuffers(1, &m_indirectBuffer);
+
+    growVertexBuffer(1u << 20);
+    m_active = true;
+}
+
+void ChunkRasterGL::shutdown() {
+    // the jobs only touch their own results, but those point back at this
+    if (m_jobs) m_jobs->wait(m_pending);
+    m_finished.clear();
+    m_meshes.clear();
+
+    if (m_prog) { glDeleteProgram(m_prog); m_prog = 0; }
+    if (m_vao) { glDeleteVertexArrays(1, &m_vao); m_vao = 0; }
+    for (GLuint* buffer : {&m_vertexBuffer, &m_originBuffer, &m_indirectBuffer, &m_materialBuffer}) {
+        if (*buffer) { glDeleteBuffers(1, buffer); *buffer = 0; }
+    }
+    if (m_materialTex) { glDeleteTextures(1, &m_materialTex); m_materialTex = 0; }
+    m_active = false;
+}
+
+void ChunkRasterGL::growVertexBuffer(uint32_t minCapacity) {
+    uint32_t capacity = std::max(m_vertexCapacity, 1u << 16);
+    while (capacity < minCapacity) capacity *= 2;
+    if (capacity == m_vertexCapacity) return;
+
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(capacity) * sizeof(RasterVertex), nullptr, GL_DYNAMIC_DRAW);
+    if (m_vertexTop > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, m_vertexBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(m_vertexTop) * sizeof(RasterVertex));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (m_vertexBuffer) glDeleteBuffers(1, &m_vertexBuffer);
+    m_vertexBuffer = buffer;
+    m_vertexCapacity = capacity;
+
+    // the vao points at the old buffer
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, sizeof(RasterVertex), nullptr);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+uint32_t ChunkRasterGL::allocVertices(uint32_t count) {
+    for (size_t i = 0; i < m_freeVertices.size(); ++i) {
+        GpuRange& r = m_freeVertices[i];
+        if (r.count < count) continue;
+
+        const uint32_t first = r.first;
+        r.first += count;
+        r.count -= count;
+        if (r.count == 0) m_freeVertices.erase(m_freeVertices.begin() + static_cast<std::ptrdiff_t>(i));
+        return first;
+    }
+
+    if (m_vertexTop + count > m_vertexCapacity) growVertexBuffer(m_vertexTop + count);
+    const uint32_t first = m_vertexTop;
+    m_vertexTop += count;
+    return first;
+}
+
+void ChunkRasterGL::freeVertices(uint32_t first, uint32_t count) {
+    if (count == 0) return;
+
+    auto it = std::lower_bound(m_freeVertices.begin(), m_freeVertices.end(), first,
+        [](const GpuRange& r, uint32_t v) { return r.first < v; });
+    it = m_freeVertices.insert(it, {first, count});
+
+    auto next = it + 1;
+    if (next != m_freeVertices.end() && it->first + it->count == next->first) {
+        it->count += next->count;
+        m_freeVertices.erase(next);
+    }
+    if (it != m_freeVertices.begin()) {
+        auto prev = it - 1;
+        if (prev->first + prev->count == it->first) {
+            prev->count += it->count;
+            m_freeVertices.erase(it);
+        }
+    }
+}
+
+void ChunkRasterGL::update(ChunkManager& mgr) {
+    BLOK_PROFILE_SCOPE("ChunkRasterGL::update");
+    m_jobs = &mgr.jobSystem();
+    m_voxelSize = mgr.voxelSize;
+    m_chunkSize = static_cast<float>(mgr.C) * mgr.voxelSize;
+    const auto C = static_cast<int32_t>(mgr.C);
+    // the packed corners have 9 bits per axis
+    if (mgr.C > 256) return;
+
+    // chunks that are gone give their vertices back
+    for (auto it = m_meshes.begin(); it != m_meshes.end();) {
+        auto found = mgr.chunks.find(it->first);
+        if (found != mgr.chunks.end() && found->second == it->second.chunk) { ++it; continue; }
+        if (it->second.meshing) { ++it; continue; } // dropped once its result comes back
+        freeVertices(it->second.first, it->second.count);
+        it = m_meshes.erase(it);
+    }
+
+    // finished meshes, stale ones (the chunk changed or went away meanwhile) are thrown out
+    std::vector<MeshResult> finished;
+    {
+        std::lock_guard lock(m_mutex);
+        finished.swap(m_finished);
+    }
+    for (MeshResult& r : finished) {
+        m_inFlight--;
+        auto it = m_meshes.find(r.coord);
+        if (it == m_meshes.end()) continue;
+        ChunkMesh& mesh = it->second;
+        mesh.meshing = false;
+
+        auto found = mgr.chunks.find(r.coord);
+        if (found == mgr.chunks.end() || found->second != r.chunk) {
+            freeVertices(mesh.first, mesh.count);
+            m_meshes.erase(it);
+            continue;
+        }
+
+        freeVertices(mesh.first, mesh.count);
+        mesh.count = static_cast<uint32_t>(r.vertices.size());
+        mesh.first = mesh.count ? allocVertices(mesh.count) : 0;
+        if (mesh.count) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+            glBufferSubData(GL_ARRAY_BUFFER, GLintptr(mesh.first) * sizeof(RasterVertex),
+                            GLsizeiptr(mesh.count) * sizeof(RasterVertex), r.vertices.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
+
+    // anything new or edited since its mesh was taken gets a job. the storage copy is a snapshot, the
+    // chunk can keep changing while the job reads it
+    for (auto& [coord, ch] : mgr.chunks) {
+        auto [it, isNew] = m_meshes.try_emplace(coord);
+        ChunkMesh& mesh = it->second;
+        if (mesh.meshing) continue;
+        if (!isNew && mesh.chunk == ch && mesh.editCount == ch->voxels.editCount()) continue;
+        if (!isNew && mesh.chunk != ch) {
+            freeVertices(mesh.first, mesh.count);
+            mesh.first = mesh.count = 0;
+        }
+
+        mesh.chunk = ch;
+        mesh.editCount = ch->voxels.editCount();
+        mesh.origin = glm::vec3(glm::ivec3(coord.x, coord.y, coord.z) * C) * mgr.voxelSize;
+        mesh.meshing = true;
+        m_inFlight++;
+
+        m_jobs->submit([this, coord = coord, chunk = ch, editCount = mesh.editCount, voxels = ch->voxels] {
+            MeshResult r{coord, chunk, editCount, {}};
+            meshRasterChunk(voxels, r.vertices);
+            std::lock_guard lock(m_mutex);
+            m_finished.push_back(std::move(r));
+        }, &m_pending);
+    }
+
+    m_vertexCount = 0;
+    for (const auto& kv : m_meshes) m_vertexCount += kv.second.count;
+}
+
+void ChunkRasterGL::updateMaterials(MaterialLibrary& lib) {
+    // the library hands out each change once, so nothing else may pack it meanwhile (the cuda tracer is off in raster mode)
+    lib.packChangedForGpu(m_materials, m_dirtyMaterials);
+    if (m_dirtyMaterials.empty()) return;
+    m_dirtyMaterials.clear();
+
+    // a few thousand materials at most, the whole table goes up
+    glBindBuffer(GL_TEXTURE_BUFFER, m_materialBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(m_materials.size() * sizeof(MaterialGpu)), m_materials.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, m_materialTex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_materialBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void ChunkRasterGL::draw(const Camera& cam, uint32_t width, uint32_t height) {
+    BLOK_PROFILE_SCOPE("ChunkRasterGL::draw");
+    m_drawn = 0;
+    if (width == 0 || height == 0 || m_materials.empty()) return;
+
+    // gl clip space, not the vulkan projection the camera builds
+    const glm::mat4 proj = glm::perspectiveRH_NO(glm::radians(cam.fov), float(width) / float(height), 0.1f, 4096.0f);
+    const glm::mat4 viewProj = proj * cam.view();
+    glm::vec4 planes[6];
+    frustumPlanes(viewProj, planes);
+
+    std::vector<glm::vec3> origins;
+    std::vector<DrawCommand> commands;
+    for (const auto& kv : m_meshes) {
+        const ChunkMesh& mesh = kv.second;
+        if (mesh.count == 0) continue;
+        if (!boxInFrustum(planes, mesh.origin, mesh.origin + glm::vec3(m_chunkSize))) continue;
+
+        commands.push_back({mesh.count, 1u, mesh.first, static_cast<uint32_t>(origins.size())});
+        origins.push_back(mesh.origin);
+    }
+    m_drawn = commands.size();
+    if (commands.empty()) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_originBuffer);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(origins.size() * sizeof(glm::vec3)), origins.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glViewport(0, 0, GLsizei(width), GLsizei(height));
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDisable(GL_CULL_FACE);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    glUseProgram(m_prog);
+    glUniformMatrix4fv(glGetUniformLocation(m_prog, "uViewProj"), 1, GL_FALSE, &viewProj[0][0]);
+    glUniform1f(glGetUniformLocation(m_prog, "uVoxelSize"), m_voxelSize);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, m_materialTex);
+    glUniform1i(glGetUniformLocation(m_prog, "uMaterials"), 0);
+
+    glBindVertexArray(m_vao);
+    if (GLAD_GL_VERSION_4_3) {
+        // the origin per draw comes in as instance attribute baseInstance
+        glBindBuffer(GL_ARRAY_BUFFER, m_originBuffer);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+        glVertexAttribDivisor(1, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, GLsizeiptr(commands.size() * sizeof(DrawCommand)), commands.data(), GL_STREAM_DRAW);
+        glMultiDrawArraysIndirect(GL_TRIANGLES, nullptr, GLsizei(commands.size()), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    } else {
+        // no base instance before 4.2, the origin is a constant attribute per draw instead
+        glDisableVertexAttribArray(1);
+        for (const DrawCommand& c : commands) {
+            glVertexAttrib3fv(1, &origins[c.baseInstance][0]);
+            glDrawArrays(GL_TRIANGLES, GLint(c.first), GLsizei(c.count));
+        }
+    }
+    glBindVertexArray(0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glUseProgram(0);
+    glDisable(GL_DEPTH_TEST);
+}
+
+}
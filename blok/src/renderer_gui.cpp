@@ -5,6 +5,12 @@
 * Created on: 12/1/2025
 */
 #include "renderer.hpp"
+#include "cpu_profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <iterator>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -14,6 +20,16 @@ namespace blok {
 
 static constexpr int HISTORY_SIZE = 120;
 
+static const char* presentModeName(vk::PresentModeKHR mode) {
+    switch (mode) {
+        case vk::PresentModeKHR::eImmediate: return "Immediate";
+        case vk::PresentModeKHR::eMailbox: return "Mailbox";
+        case vk::PresentModeKHR::eFifo: return "FIFO (VSync)";
+        case vk::PresentModeKHR::eFifoRelaxed: return "FIFO Relaxed";
+        default: return nullptr; // shared refresh modes, nothing here presents that way
+    }
+}
+
 static float g_fps = 0;
 static float g_ms = 0.f;
 std::array<float, HISTORY_SIZE> fpsHistory{};
@@ -172,10 +188,181 @@ void Renderer::renderPerformanceData() {
     ImGui::PlotLines("##FrameTime", frameTimeHistory.data(), HISTORY_SIZE, 0, frameTimeOverlay,
                      frameTimeMin * 0.9f, frameTimeMax * 1.1f, graphSize);
 
+    // gpu time from the profiler, a couple of frames behind
+    if (m_profiler.supported()) {
+        const auto& gpuHistory = m_profiler.frameHistory();
+        const float gpuMax = *std::max_element(gpuHistory.begin(), gpuHistory.end());
+        char gpuOverlay[32];
+        snprintf(gpuOverlay, sizeof(gpuOverlay), "GPU: %.2f ms", m_profiler.frameMs());
+
+        ImGui::Spacing();
+        ImGui::PlotLines("##GpuTime", gpuHistory.data(), static_cast<int>(gpuHistory.size()), 0, gpuOverlay,
+                         0.0f, gpuMax * 1.1f, graphSize);
+
+        // per pass, indented under the submit scope it ran in
+        for (const auto& p : m_profiler.passes()) {
+            if (!p.active) continue;
+            ImGui::Text("%*s%-16s %6.2f ms  avg %6.2f", static_cast<int>(p.depth * 2), "",
+                        p.name.c_str(), p.ms[GpuProfiler::HISTORY_SIZE - 1], p.averageMs);
+        }
+    }
+
     ImGui::End();
 }
 
 void Renderer::renderOptionsPanel() {
+    if (ImGui::CollapsingHeader("Ray Tracing")) {
+        ImGui::Indent();
+        // samples, bounces, traversal budget and denoise kernel, baked into the pipelines
+        const char* presets[] = { "Low", "Medium", "High", "Ultra" };
+        int preset = static_cast<int>(qualityPreset());
+        if (ImGui::Combo("Quality", &preset, presets, IM_ARRAYSIZE(presets))) {
+            setQualityPreset(static_cast<QualityPreset>(preset));
+        }
+        // how much of the preset's samples x bounces actually gets traced
+        {
+            const QualitySpecialization q = qualitySpecialization(qualityPreset());
+            ImGui::Checkbox("Russian Roulette", &m_raytracer.settings.russianRoulette);
+            if (m_raytracer.settings.russianRoulette) {
+                int start = static_cast<int>(m_raytracer.settings.rouletteStartBounce);
+                if (ImGui::SliderInt("Roulette From Bounce", &start, 0, static_cast<int>(q.maxBounces)))
+                    m_raytracer.settings.rouletteStartBounce = static_cast<uint32_t>(start);
+            }
+            int budget = static_cast<int>(m_raytracer.settings.rayBudget);
+            if (ImGui::SliderInt("Ray Budget", &budget, 0, static_cast<int>(2u * q.sampleCount * q.maxBounces)))
+                m_raytracer.settings.rayBudget = static_cast<uint32_t>(budget);
+            ImGui::Text("%u samples x %u bounces per pixel, budget %s", q.sampleCount, q.maxBounces,
+                        m_raytracer.settings.rayBudget ? "on" : "off");
+        }
+        ImGui::Checkbox("Enable LOD", &m_raytracer.settings.enableLod);
+        if (m_raytracer.settings.enableLod) {
+            ImGui::SliderFloat("LOD Scale", &m_raytracer.settings.lodScale, 0.25f, 8.0f);
+        }
+        // resampled emissive lighting on the primary hit, one shadow ray per pixel
+        ImGui::Checkbox("ReSTIR DI", &m_raytracer.settings.restirDI);
+        // secondary bounces read the world space cache instead of tracing on
+        ImGui::Checkbox("Radiance Cache", &m_raytracer.settings.radianceCache);
+        // samples follow the denoiser's noise estimate, converged pixels drop to one
+        ImGui::Checkbox("Adaptive Sampling", &m_raytracer.settings.adaptiveSampling);
+        if (m_raytracer.settings.adaptiveSampling) {
+            ImGui::SliderFloat("Noise Target", &m_raytracer.settings.adaptiveNoiseTarget, 0.01f, 0.25f);
+        }
+        // full paths on half or a quarter of the pixels, the temporal pass fills in the rest
+        const char* patterns[] = { "Full", "Checkerboard", "Quarter" };
+        int pattern = static_cast<int>(m_raytracer.settings.tracePattern);
+        if (ImGui::Combo("Trace Pattern", &pattern, patterns, IM_ARRAYSIZE(patterns))) {
+            m_raytracer.settings.tracePattern = static_cast<TracePattern>(pattern);
+        }
+        // primary hits from the rasterized surface mesh, the trace starts at the first bounce
+        ImGui::Checkbox("Raster Primary", &m_raytracer.settings.rasterPrimary);
+        if (m_raytracer.settings.rasterPrimary && m_world && !m_world->surfaceDrawable) {
+            ImGui::Text("no surface mesh, tracing primary rays");
+        }
+        // rays jump the empty bricks around them before walking the svo
+        ImGui::Checkbox("Empty Space Skipping", &m_raytracer.settings.emptySpaceSkipping);
+        // paths stop at voxels with baked ao, needs a world built with --baked-ao
+        const char* bakedModes[] = { "Off", "Bounces", "Preview" };
+        int bakedMode = static_cast<int>(m_raytracer.settings.bakedLighting);
+        if (ImGui::Combo("Baked AO", &bakedMode, bakedModes, IM_ARRAYSIZE(bakedModes))) {
+            m_raytracer.settings.bakedLighting = static_cast<BakedLighting>(bakedMode);
+        }
+        // the hdr sky from --env, light sampled like the emissive voxels
+        if (hasEnvironmentMap()) {
+            ImGui::Checkbox("Environment Map", &m_raytracer.settings.environmentMap);
+            if (m_raytracer.settings.environmentMap)
+                ImGui::SliderFloat("Environment Intensity", &m_raytracer.settings.environmentIntensity, 0.0f, 8.0f);
+        }
+        // the main trace from compute with inline ray queries instead of the rt pipeline + sbt
+        if (rayQueryAvailable()) {
+            ImGui::Checkbox("Ray Query Tracer", &m_raytracer.settings.rayQuery);
+        }
+        // closest hit returns a packed hit record and raygen shades it, rebuilds the rt pipeline
+        ImGui::Checkbox("Slim Payload", &m_raytracer.settings.slimPayload);
+        // per pixel rays, svo node visits, stack depth and MAX_ITER cut offs, rebuilds the rt pipeline
+        ImGui::Checkbox("Traversal Stats", &m_raytracer.settings.traversalStats);
+        if (m_raytracer.settings.traversalStats) {
+            const char* heatmaps[] = { "Off", "Nodes / Ray", "Traversals / Ray", "Stack Depth", "Cut Offs", "Rays", "Bounces" };
+            int heatmap = static_cast<int>(m_postProcess.settings.heatmap);
+            if (ImGui::Combo("Heatmap", &heatmap, heatmaps, IM_ARRAYSIZE(heatmaps))) {
+                m_postProcess.settings.heatmap = static_cast<TraversalHeatmap>(heatmap);
+            }
+            if (m_postProcess.settings.heatmap != TraversalHeatmap::Off) {
+                ImGui::SliderFloat("Heatmap Range", &m_postProcess.settings.heatmapMax, 1.0f, 1024.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+                ImGui::SliderFloat("Heatmap Opacity", &m_postProcess.settings.heatmapOpacity, 0.0f, 1.0f);
+            }
+            const TraversalStats& ts = m_traversalStats;
+            const double rays = static_cast<double>(std::max<uint64_t>(ts.rays, 1));
+            const double pixels = static_cast<double>(std::max<uint64_t>(ts.pixels, 1));
+            ImGui::Text("%.2f rays / px, %.2f bounces / px", double(ts.rays) / pixels, double(ts.bounces) / pixels);
+            ImGui::Text("%.1f nodes / ray, %.2f traversals / ray", double(ts.nodes) / rays, double(ts.traversals) / rays);
+            ImGui::Text("max stack %u, max nodes / px %u", ts.maxStack, ts.maxNodes);
+            ImGui::Text("%llu walks cut off at MAX_ITER (%.3f%%)", (unsigned long long)ts.cutOff,
+                        100.0 * double(ts.cutOff) / static_cast<double>(std::max<uint64_t>(ts.traversals, 1)));
+        }
+        // chunk instances out of range or out of view drop out of the tlas, bounces still see those within the gi radius
+        ImGui::Checkbox("TLAS Culling", &m_raytracer.settings.tlasCulling);
+        if (m_raytracer.settings.tlasCulling) {
+            ImGui::SliderFloat("Cull Distance", &m_raytracer.settings.cullDistance, 0.0f, 2048.0f);
+            ImGui::Checkbox("Frustum Culling", &m_raytracer.settings.frustumCulling);
+            if (m_raytracer.settings.frustumCulling) {
+                ImGui::SliderFloat("GI Radius", &m_raytracer.settings.giRadius, 0.0f, 512.0f);
+            }
+        }
+        // a-trous on half res demodulated irradiance, upsampled along depth and normal edges
+        ImGui::Checkbox("Half Res Denoise", &m_denoiser.settings.halfResolution);
+        // the wide a-trous iterations skip tiles that have settled
+        if (!m_denoiser.settings.halfResolution) {
+            ImGui::Checkbox("Adaptive A-Trous", &m_denoiser.settings.adaptiveAtrous);
+            if (m_denoiser.settings.adaptiveAtrous) {
+                ImGui::SliderFloat("Tile Variance", &m_denoiser.settings.adaptiveVarianceThreshold, 1e-6f, 1e-2f, "%.6f",
+                                   ImGuiSliderFlags_Logarithmic);
+            }
+        }
+        // a still view keeps summing frames past the denoiser and stops tracing once converged
+        ImGui::Checkbox("Progressive", &m_denoiser.settings.progressive);
+        if (m_denoiser.settings.progressive) {
+            ImGui::SliderInt("Denoised Frames", &m_denoiser.settings.progressiveDenoiseFrames, 1, 256);
+            ImGui::SliderInt("Target SPP", &m_denoiser.settings.progressiveTargetSpp, 64, 65536, "%d", ImGuiSliderFlags_Logarithmic);
+            ImGui::Text("%u frames%s", m_denoiser.progressiveFrames, m_denoiser.progressiveTracing ? "" : ", converged");
+        }
+        // overlaps the denoise/post chain with the next frame's trace
+        if (asyncComputeAvailable()) {
+            bool async = m_asyncComputeWanted;
+            if (ImGui::Checkbox("Async Compute", &async)) setAsyncCompute(async);
+        }
+        // throughput against input latency: how far the cpu runs ahead, and whether it waits for the last moment
+        int frames = static_cast<int>(m_framesInFlightWanted);
+        if (ImGui::SliderInt("Frames In Flight", &frames, 1, static_cast<int>(FRAMES_IN_FLIGHT_MAX)))
+            setFramesInFlight(static_cast<uint32_t>(frames));
+        if (m_framesInFlight != m_framesInFlightWanted && !m_swapchainDirty) {
+            ImGui::Text("%u with async compute / external tracer", m_framesInFlight);
+        }
+        ImGui::Checkbox("Low Latency", &m_lowLatency);
+        if (m_lowLatency) {
+            ImGui::Text("%s, %.2f ms cpu", m_presentWait ? "present wait" : "gpu time estimate", m_cpuFrameMs);
+        }
+        if (ImGui::BeginCombo("Present Mode", presentModeName(m_presentModeWanted))) {
+            for (vk::PresentModeKHR mode : m_presentModes) {
+                const char* name = presentModeName(mode);
+                if (name && ImGui::Selectable(name, mode == m_presentModeWanted)) setPresentMode(mode);
+            }
+            ImGui::EndCombo();
+        }
+        // trace + denoise below output resolution to hold a gpu frame time
+        if (m_profiler.supported()) {
+            auto& dr = m_dynamicResolution.settings;
+            ImGui::Checkbox("Dynamic Resolution", &dr.enabled);
+            if (dr.enabled) {
+                ImGui::SliderFloat("Target GPU ms", &dr.targetMs, 4.0f, 50.0f);
+                ImGui::SliderFloat("Min Scale", &dr.minScale, 0.25f, dr.maxScale);
+                ImGui::SliderFloat("Max Scale", &dr.maxScale, dr.minScale, 1.0f);
+                ImGui::Text("%ux%u (%.0f%%), %.2f ms", m_renderExtent.width, m_renderExtent.height,
+                    m_dynamicResolution.scale() * 100.0f, m_dynamicResolution.averageMs());
+            }
+        }
+        ImGui::Unindent();
+    }
+
     if (ImGui::CollapsingHeader("Post-Processing")) {
         ImGui::Indent();
         if (ImGui::CollapsingHeader("Temporal Anti-Aliasing", ImGuiTreeNodeFlags_DefaultOpen)) {
@@ -183,6 +370,12 @@ void Renderer::renderOptionsPanel() {
             if (m_postProcess.settings.enableTAA) {
                 ImGui::SliderFloat("Feedback Min", &m_postProcess.settings.feedbackMin, 0.0f, 1.0f);
                 ImGui::SliderFloat("Feedback Max", &m_postProcess.settings.feedbackMax, 0.0f, 1.0f);
+
+                const char* upscaleModes[] = { "Native", "Quality (67%)", "Balanced (58%)", "Performance (50%)" };
+                int currentMode = static_cast<int>(m_postProcess.settings.upscaleMode);
+                if (ImGui::Combo("Upscaling", &currentMode, upscaleModes, IM_ARRAYSIZE(upscaleModes))) {
+                    m_postProcess.settings.upscaleMode = static_cast<UpscaleMode>(currentMode);
+                }
             }
         }
 
@@ -213,6 +406,84 @@ void Renderer::renderOptionsPanel() {
             }
         }
     }
+
+    if (ImGui::CollapsingHeader("Memory")) {
+        ImGui::Indent();
+        const VkPhysicalDeviceMemoryProperties* props = nullptr;
+        vmaGetMemoryProperties(m_allocator, &props);
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+        vmaGetHeapBudgets(m_allocator, budgets.data());
+        for (uint32_t i = 0; i < props->memoryHeapCount; i++) {
+            if (!(props->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) continue;
+            ImGui::Text("Heap %u: %llu / %llu MB%s", i, (unsigned long long)(budgets[i].usage >> 20),
+                        (unsigned long long)(budgets[i].budget >> 20), m_memoryBudget ? "" : " (estimated)");
+        }
+
+        // Untracked isn't a world buffer, it's only in the heap totals above
+        static const char* NAMES[] = {"", "SVO", "Materials", "Lighting", "AABBs", "BLAS", "TLAS", "Scratch", "Other"};
+        static_assert(std::size(NAMES) == size_t(MemoryCategory::Count));
+        if (ImGui::BeginTable("##MemoryCategories", 3, ImGuiTableFlags_SizingStretchSame)) {
+            ImGui::TableSetupColumn("World");
+            ImGui::TableSetupColumn("Current MB");
+            ImGui::TableSetupColumn("Peak MB");
+            ImGui::TableHeadersRow();
+            for (size_t c = 1; c < m_memoryStats.size(); c++) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn(); ImGui::TextUnformatted(NAMES[c]);
+                ImGui::TableNextColumn(); ImGui::Text("%.1f", double(m_memoryStats[c].current) / (1 << 20));
+                ImGui::TableNextColumn(); ImGui::Text("%.1f", double(m_memoryStats[c].peak) / (1 << 20));
+            }
+            ImGui::EndTable();
+        }
+
+        if (m_worldMemory) {
+            VmaStatistics pool{};
+            vmaGetPoolStatistics(m_allocator, m_worldMemory, &pool);
+            ImGui::Text("World pool: %u blocks, %.1f / %.1f MB used", pool.blockCount,
+                        double(pool.allocationBytes) / (1 << 20), double(pool.blockBytes) / (1 << 20));
+        }
+        if (m_world && m_world->svoSparse) {
+            const size_t bound = m_world->svoPages.size() - std::count(m_world->svoPages.begin(), m_world->svoPages.end(), nullptr);
+            ImGui::Text("Sparse node heap: %zu / %zu pages bound (%llu KB each)", bound, m_world->svoPages.size(),
+                        (unsigned long long)(m_world->svoPageSize >> 10));
+        }
+        if (ImGui::Button("Reset Peaks")) {
+            for (MemoryCategoryStats& s : m_memoryStats) s.peak = s.current;
+        }
+        ImGui::Unindent();
+    }
+
+    if (m_profiler.supported() && ImGui::CollapsingHeader("GPU Profiler")) {
+        ImGui::Indent();
+        const ImVec2 passGraph(180.0f, 30.0f);
+        for (const auto& p : m_profiler.passes()) {
+            char overlay[64];
+            snprintf(overlay, sizeof(overlay), "%s %.2f ms", p.name.c_str(), p.averageMs);
+            ImGui::PushID(&p);
+            ImGui::PlotLines("##Pass", p.ms.data(), static_cast<int>(p.ms.size()), 0, overlay,
+                             0.0f, FLT_MAX, passGraph);
+            ImGui::PopID();
+        }
+        if (ImGui::Button("Export CSV")) {
+            m_profiler.exportCsv("gpu_profile.csv");
+        }
+        ImGui::Unindent();
+    }
+
+#ifndef BLOK_NO_CPU_PROFILER
+    // world pipeline scopes, open the json in ui.perfetto.dev
+    if (ImGui::CollapsingHeader("CPU Trace")) {
+        ImGui::Indent();
+        CpuProfiler& cpu = CpuProfiler::instance();
+        bool recording = cpu.recording();
+        if (ImGui::Checkbox("Record", &recording)) cpu.setRecording(recording);
+        ImGui::Text("%zu / %zu events", cpu.eventCount(), CpuProfiler::MAX_EVENTS);
+        if (ImGui::Button("Export Trace")) cpu.exportChromeTrace("cpu_trace.json");
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) cpu.clear();
+        ImGui::Unindent();
+    }
+#endif
 }
 
 }
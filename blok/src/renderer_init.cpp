@@ -4,6 +4,10 @@
 * Author: Collin Longoria
 * Created on: 12/2/2025
 */
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <set>
 
@@ -21,8 +25,8 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityF
     return VK_FALSE;
 }
 
-Renderer::Renderer(int width, int height)
-    : m_width(width), m_height(height), m_shaderManager(m_device), m_raytracer(this), m_denoiser(this), m_postProcess(this) {
+Renderer::Renderer(int width, int height, int deviceIndex)
+    : m_width(width), m_height(height), m_deviceIndex(deviceIndex), m_shaderManager(m_device), m_raytracer(this), m_denoiser(this), m_postProcess(this), m_svoBuilder(this), m_cudaInterop(this) {
     VULKAN_HPP_DEFAULT_DISPATCHER.init();
 
     createWindow();
@@ -41,6 +45,8 @@ Renderer::Renderer(int width, int height)
     createCommandPoolAndBuffers();
     createSyncObjects();
     createPerFrameUniforms();
+    // raygen always binds one, the analytic sky until a map is set
+    setEnvironmentMap(EnvironmentMap{});
 
     DescriptorAllocatorGrowable::PoolSizeRatio ratios[] = {
         {vk::DescriptorType::eUniformBuffer, 4.0f},
@@ -53,19 +59,29 @@ Renderer::Renderer(int width, int height)
     };
     m_descAlloc.init(m_device, 512, std::span{ratios, std::size(ratios)});
 
-    m_shaderManager = ShaderManager(m_device);
+    m_shaderManager.setDevice(m_device);
+    createPipelineCache();
+
+    // shader compiles and pipeline creation for everything below overlap on this, joined before the sbt
+    m_startupJobs = std::make_unique<JobSystem>();
 
     m_raytracer.createDescriptorSetLayout();
     m_raytracer.allocateDescriptorSet();
 
     queryRayTracingProperties();
 
-    m_raytracer.createPipeline();
-    m_raytracer.createSBT();
+    startupJob([this] { m_raytracer.createPipeline(); });
+    startupJob([this] { m_raytracer.createVisibilityPipeline(); });
+    startupJob([this] { m_raytracer.createCullPipeline(); });
 
-    m_denoiser.init(m_swapExtent.width, m_swapExtent.height);
+    m_renderExtent = m_dynamicResolution.renderExtent(m_swapExtent);
+    m_denoiser.init(m_renderExtent.width, m_renderExtent.height);
 
     m_postProcess.init(m_swapExtent.width, m_swapExtent.height);
+    m_svoBuilder.init();
+
+    finishStartupJobs();
+    m_raytracer.createSBT();
 
     createGui();
 }
@@ -87,24 +103,49 @@ Renderer::~Renderer() {
     // per frame resources
     for (auto& fr : m_frames) {
         if (fr.cmdPool) { m_device.destroyCommandPool(fr.cmdPool); }
+        if (fr.computePool) { m_device.destroyCommandPool(fr.computePool); }
         if (fr.imageAvailable) { m_device.destroySemaphore(fr.imageAvailable); }
         if (fr.renderFinished) { m_device.destroySemaphore(fr.renderFinished); }
-        if (fr.inFlight) { m_device.destroyFence(fr.inFlight); }
         if (fr.frameUBO.handle) { vmaDestroyBuffer(m_allocator, fr.frameUBO.handle, fr.frameUBO.alloc); }
+        if (fr.pickReadback.handle) { vmaDestroyBuffer(m_allocator, fr.pickReadback.handle, fr.pickReadback.alloc); }
+        if (fr.traversalTotals.handle) { vmaDestroyBuffer(m_allocator, fr.traversalTotals.handle, fr.traversalTotals.alloc); }
     }
 
+    // everything is idle now, retired resources can all go
+    for (auto& r : m_retired) {
+        if (r.as) m_device.destroyAccelerationStructureKHR(r.as);
+        destroyBuffer(r.buffer);
+        if (r.pipeline) m_device.destroyPipeline(r.pipeline);
+        if (r.layout) m_device.destroyPipelineLayout(r.layout);
+        if (r.memory) vmaFreeMemory(m_allocator, r.memory);
+    }
+    m_retired.clear();
+
+    if (m_worldPool) { m_device.destroyCommandPool(m_worldPool); }
+    m_worldCmds.clear();
+    if (m_timeline) { m_device.destroySemaphore(m_timeline); }
+    if (m_computeTimeline) { m_device.destroySemaphore(m_computeTimeline); }
+    if (m_sparseBound) { m_device.destroySemaphore(m_sparseBound); }
+    m_profiler.cleanup();
+
+    destroyBuffer(m_environmentBuffer);
+    if (m_staging.buffer.handle) { vmaDestroyBuffer(m_allocator, m_staging.buffer.handle, m_staging.buffer.alloc); }
+    m_staging = {};
     if (m_uploadFence) { m_device.destroyFence(m_uploadFence); }
     if (m_uploadCmd) { m_device.freeCommandBuffers(m_uploadPool, 1, &m_uploadCmd); }
     if (m_uploadPool) { m_device.destroyCommandPool(m_uploadPool); }
 
-    if (m_raytracer.rtSetLayout) { m_device.destroyDescriptorSetLayout(m_raytracer.rtSetLayout); }
-    if (m_raytracer.rtPipeline.layout) { m_device.destroyPipelineLayout(m_raytracer.rtPipeline.layout); }
-    if (m_raytracer.rtPipeline.pipeline) { m_device.destroyPipeline(m_raytracer.rtPipeline.pipeline); }
+    savePipelineCache();
+    if (m_pipelineCache) { m_device.destroyPipelineCache(m_pipelineCache); }
 
-    if (m_raytracer.rtPipeline.rgenSBT.handle) { vmaDestroyBuffer(m_allocator, m_raytracer.rtPipeline.rgenSBT.handle, m_raytracer.rtPipeline.rgenSBT.alloc); }
-    if (m_raytracer.rtPipeline.hitSBT.handle) { vmaDestroyBuffer(m_allocator, m_raytracer.rtPipeline.hitSBT.handle, m_raytracer.rtPipeline.hitSBT.alloc); }
-    if (m_raytracer.rtPipeline.missSBT.handle) { vmaDestroyBuffer(m_allocator, m_raytracer.rtPipeline.missSBT.handle, m_raytracer.rtPipeline.missSBT.alloc); }
+    if (m_raytracer.rtSetLayout) { m_device.destroyDescriptorSetLayout(m_raytracer.rtSetLayout); }
+    if (m_raytracer.cullSetLayout) { m_device.destroyDescriptorSetLayout(m_raytracer.cullSetLayout); }
+    m_raytracer.destroyPipeline();
+    m_raytracer.destroyVisibilityPipeline();
+    m_raytracer.destroyCullPipeline();
 
+    m_cudaInterop.cleanup();
+    m_svoBuilder.cleanup();
     m_postProcess.cleanup();
     m_denoiser.cleanup();
 
@@ -112,6 +153,8 @@ Renderer::~Renderer() {
 
     cleanupSwapChain();
 
+    if (m_worldMemory) vmaDestroyPool(m_allocator, m_worldMemory);
+    m_worldMemory = nullptr;
     if (m_allocator) vmaDestroyAllocator(m_allocator);
     m_allocator = nullptr;
 
@@ -129,43 +172,27 @@ void Renderer::cleanupWorld(WorldSvoGpu& gpuWorld) {
         m_device.destroyAccelerationStructureKHR(gpuWorld.tlas.handle);
         gpuWorld.tlas.handle = nullptr;
     }
-    if (gpuWorld.tlas.buffer.handle && gpuWorld.tlas.buffer.alloc) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.tlas.buffer.handle, gpuWorld.tlas.buffer.alloc);
-        gpuWorld.tlas.buffer = {};
-    }
-    if (gpuWorld.tlasInstanceBuffer.handle && gpuWorld.tlasInstanceBuffer.alloc) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.tlasInstanceBuffer.handle, gpuWorld.tlasInstanceBuffer.alloc);
-        gpuWorld.tlasInstanceBuffer = {};
+    for (Buffer* b : {&gpuWorld.tlas.buffer, &gpuWorld.tlasInstanceBuffer, &gpuWorld.tlasInstanceBounds, &gpuWorld.tlasUpdateScratch})
+        destroyBuffer(*b);
+
+    // Destroy every chunk BLAS and its resources
+    for (auto& kv : gpuWorld.chunkBlas) {
+        ChunkBlas& blas = kv.second;
+        if (blas.as.handle) m_device.destroyAccelerationStructureKHR(blas.as.handle);
+        destroyBuffer(blas.as.buffer);
+        destroyBuffer(blas.aabbBuffer);
     }
+    gpuWorld.chunkBlas.clear();
 
-    // Destroy BLAS and its resources
-    if (gpuWorld.blas.handle && gpuWorld.blas.handle != VK_NULL_HANDLE) {
-        m_device.destroyAccelerationStructureKHR(gpuWorld.blas.handle);
-        gpuWorld.blas.handle = nullptr;
-    }
-    if (gpuWorld.blas.buffer.handle && gpuWorld.blas.buffer.alloc) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.blas.buffer.handle, gpuWorld.blas.buffer.alloc);
-        gpuWorld.blas.buffer = {};
-    }
-    if (gpuWorld.blasAabbBuffer.handle && gpuWorld.blasAabbBuffer.alloc) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.blasAabbBuffer.handle, gpuWorld.blasAabbBuffer.alloc);
-        gpuWorld.blasAabbBuffer = {};
-    }
+    destroyBuffer(gpuWorld.scratchBuffer);
 
     // Destroy SVO and chunk buffers
-    if (gpuWorld.svoBuffer.handle && gpuWorld.svoBuffer.alloc) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.svoBuffer.handle, gpuWorld.svoBuffer.alloc);
-        gpuWorld.svoBuffer = {};
-    }
-    if (gpuWorld.subChunkBuffer.handle && gpuWorld.subChunkBuffer.alloc) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.subChunkBuffer.handle, gpuWorld.subChunkBuffer.alloc);
-        gpuWorld.subChunkBuffer = {};
-    }
+    destroySparseNodeBuffer(gpuWorld);
+    for (Buffer* b : {&gpuWorld.svoBuffer, &gpuWorld.brickBuffer, &gpuWorld.subChunkBuffer, &gpuWorld.svoBuildInput, &gpuWorld.svoBuildScratch})
+        destroyBuffer(*b);
 
-    if (gpuWorld.materialBuffer.handle && gpuWorld.materialBuffer.alloc) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.materialBuffer.handle, gpuWorld.materialBuffer.alloc);
-        gpuWorld.materialBuffer = {};
-    }
+    for (Buffer* b : {&gpuWorld.materialBuffer, &gpuWorld.lightBuffer, &gpuWorld.radianceCache, &gpuWorld.surfaceBuffer, &gpuWorld.emptySpaceBuffer})
+        destroyBuffer(*b);
 }
 
 void Renderer::createWindow() {
@@ -246,6 +273,8 @@ void Renderer::pickPhysicalDevice() {
             const auto& p = qf[i];
             if (!out.graphics && (p.queueFlags & vk::QueueFlagBits::eGraphics)) out.graphics = i;
             if (!out.compute && (p.queueFlags & vk::QueueFlagBits::eCompute)) out.compute = i;
+            if (!out.asyncCompute && (p.queueFlags & vk::QueueFlagBits::eCompute) && !(p.queueFlags & vk::QueueFlagBits::eGraphics))
+                out.asyncCompute = i;
             if (!out.present) {
                 VkBool32 presentSupport = VK_FALSE;
                 auto r = pd.getSurfaceSupportKHR(i, m_surface, &presentSupport);
@@ -257,16 +286,24 @@ void Renderer::pickPhysicalDevice() {
 
     // just choosing first device
     vk::PhysicalDevice best{};
+    int usable = 0;
     for (auto& pd : phys) {
         if (!supportAllExts(pd)) continue;
         auto qfi = findQFI(pd);
         if (!qfi.complete()) continue;
+        // an explicit index (one offline worker per gpu) takes that device whatever its type
+        if (m_deviceIndex >= 0) {
+            if (usable++ == m_deviceIndex) { m_physicalDevice = pd; m_qfi = qfi; return; }
+            continue;
+        }
         auto props = pd.getProperties();
         if (props.deviceType == vk::PhysicalDeviceType::eDiscreteGpu) {
             m_physicalDevice = pd; m_qfi = qfi; return;
         }
         if (!best) { best = pd; m_qfi = qfi; }
     }
+    if (m_deviceIndex >= 0)
+        throw std::runtime_error("Vulkan API found only " + std::to_string(usable) + " suitable devices, asked for device " + std::to_string(m_deviceIndex));
     if (!m_physicalDevice) m_physicalDevice = best; // if couldnt find perfect, get next best.
     if (!m_physicalDevice) throw std::runtime_error("Vulkan API failed to pick a suitable device!");
 }
@@ -286,11 +323,13 @@ void Renderer::chooseSurfaceFormatAndPresentMode() {
     m_colorFormat = chosen.format;
     m_colorSpace = chosen.colorSpace;
 
-    // present mode
+    // present mode, mailbox when there is one. the options panel can switch to any of the others
+    m_presentModes = presentModes;
     m_presentMode = vk::PresentModeKHR::eFifo;
     for (auto pm : presentModes) {
         if (pm == vk::PresentModeKHR::eMailbox) { m_presentMode = pm; break; }
     }
+    m_presentModeWanted = m_presentMode;
 }
 
 void Renderer::createLogicalDevice() {
@@ -299,18 +338,98 @@ void Renderer::createLogicalDevice() {
     unique.insert(*m_qfi.graphics);
     unique.insert(*m_qfi.present);
     unique.insert(*m_qfi.compute);
+    if (m_qfi.asyncCompute) unique.insert(*m_qfi.asyncCompute);
 
-    float priority = 1.0f;
+    // async compute without a compute only family falls back to a second queue of the graphics family
+    const auto families = m_physicalDevice.getQueueFamilyProperties();
+    const bool secondGraphicsQueue = !m_qfi.asyncCompute && families[*m_qfi.graphics].queueCount > 1;
+
+    const float priorities[2] = { 1.0f, 1.0f };
     for (auto idx : unique) {
         vk::DeviceQueueCreateInfo qci{};
         qci.queueFamilyIndex = idx;
-        qci.queueCount = 1;
-        qci.pQueuePriorities = &priority;
+        qci.queueCount = (secondGraphicsQueue && idx == *m_qfi.graphics) ? 2 : 1;
+        qci.pQueuePriorities = priorities;
         qcis.push_back(qci);
     }
 
     auto devExts = getRequiredDeviceExtensions();
 
+    // external memory + semaphores for CudaInterop, only if all of them are there
+    const auto available = m_physicalDevice.enumerateDeviceExtensionProperties();
+    auto hasExtension = [&](const char* ext) {
+        return std::any_of(available.begin(), available.end(), [&](const vk::ExtensionProperties& p) {
+            return std::strcmp(p.extensionName, ext) == 0;
+        });
+    };
+    m_cudaInterop.supported = true;
+    for (const char* ext : CudaInterop::deviceExtensions())
+        m_cudaInterop.supported = m_cudaInterop.supported && hasExtension(ext);
+    if (m_cudaInterop.supported) {
+        for (const char* ext : CudaInterop::deviceExtensions()) devExts.push_back(ext);
+    }
+
+    // shader execution reordering for raygen, the EXT when the headers and device have it, NV otherwise
+    m_invocationReorder = InvocationReorder::None;
+#ifdef VK_EXT_RAY_TRACING_INVOCATION_REORDER_EXTENSION_NAME
+    vk::PhysicalDeviceRayTracingInvocationReorderFeaturesEXT reorderExt{};
+    if (hasExtension(VK_EXT_RAY_TRACING_INVOCATION_REORDER_EXTENSION_NAME)) {
+        vk::PhysicalDeviceFeatures2 query{};
+        query.pNext = &reorderExt;
+        m_physicalDevice.getFeatures2(&query);
+        reorderExt.pNext = nullptr;
+        if (reorderExt.rayTracingInvocationReorder) {
+            m_invocationReorder = InvocationReorder::EXT;
+            devExts.push_back(VK_EXT_RAY_TRACING_INVOCATION_REORDER_EXTENSION_NAME);
+        }
+    }
+#endif
+    vk::PhysicalDeviceRayTracingInvocationReorderFeaturesNV reorderNv{};
+    if (m_invocationReorder == InvocationReorder::None && hasExtension(VK_NV_RAY_TRACING_INVOCATION_REORDER_EXTENSION_NAME)) {
+        vk::PhysicalDeviceFeatures2 query{};
+        query.pNext = &reorderNv;
+        m_physicalDevice.getFeatures2(&query);
+        reorderNv.pNext = nullptr;
+        if (reorderNv.rayTracingInvocationReorder) {
+            m_invocationReorder = InvocationReorder::NV;
+            devExts.push_back(VK_NV_RAY_TRACING_INVOCATION_REORDER_EXTENSION_NAME);
+        }
+    }
+
+    // inline ray queries, RayTracing can then trace from a compute shader instead of the rt pipeline
+    vk::PhysicalDeviceRayQueryFeaturesKHR rayQuery{};
+    m_rayQuery = false;
+    if (hasExtension(VK_KHR_RAY_QUERY_EXTENSION_NAME)) {
+        vk::PhysicalDeviceFeatures2 query{};
+        query.pNext = &rayQuery;
+        m_physicalDevice.getFeatures2(&query);
+        rayQuery.pNext = nullptr;
+        m_rayQuery = rayQuery.rayQuery;
+        if (m_rayQuery) devExts.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+    }
+
+    // present ids + waiting on them, low latency pacing sleeps until the last frame is on screen
+    vk::PhysicalDevicePresentIdFeaturesKHR presentId{};
+    vk::PhysicalDevicePresentWaitFeaturesKHR presentWait{};
+    m_presentWait = false;
+    if (hasExtension(VK_KHR_PRESENT_ID_EXTENSION_NAME) && hasExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+        vk::PhysicalDeviceFeatures2 query{};
+        query.pNext = &presentId;
+        presentId.pNext = &presentWait;
+        m_physicalDevice.getFeatures2(&query);
+        presentId.pNext = nullptr;
+        presentWait.pNext = nullptr;
+        m_presentWait = presentId.presentId && presentWait.presentWait;
+        if (m_presentWait) {
+            devExts.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+            devExts.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+        }
+    }
+
+    // real heap budgets for the memory stats and streaming, vma estimates them from its own allocations otherwise
+    m_memoryBudget = hasExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (m_memoryBudget) devExts.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
     vk::PhysicalDeviceVulkan13Features f13{};
     f13.dynamicRendering = VK_TRUE;
     f13.synchronization2 = VK_TRUE;
@@ -321,19 +440,48 @@ void Renderer::createLogicalDevice() {
     vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rt{};
     rt.rayTracingPipeline = VK_TRUE;
 
-    vk::PhysicalDeviceBufferDeviceAddressFeatures bda{};
-    bda.bufferDeviceAddress = VK_TRUE;
-
-    bda.pNext = &accel;
+    // buffer device address + timeline semaphores (world updates)
+    vk::PhysicalDeviceVulkan12Features f12{};
+    f12.bufferDeviceAddress = VK_TRUE;
+    f12.timelineSemaphore = VK_TRUE;
+
+    // storage writes without a format qualifier, post_fused.comp writes bgra8 or rgba8 swapchain images
+    vk::PhysicalDeviceFeatures2 f2{};
+    const vk::PhysicalDeviceFeatures supported = m_physicalDevice.getFeatures();
+    m_storageWriteWithoutFormat = supported.shaderStorageImageWriteWithoutFormat;
+    f2.features.shaderStorageImageWriteWithoutFormat = m_storageWriteWithoutFormat;
+
+    // partially resident buffers for the svo node heap. the binds go on the world queue, always the graphics family
+    const auto families = m_physicalDevice.getQueueFamilyProperties();
+    m_sparseNodes = supported.sparseBinding && supported.sparseResidencyBuffer &&
+                    (families[*m_qfi.graphics].queueFlags & vk::QueueFlagBits::eSparseBinding);
+    f2.features.sparseBinding = m_sparseNodes;
+    f2.features.sparseResidencyBuffer = m_sparseNodes;
+
+    f2.pNext = &f12;
+    if (m_presentWait) {
+        f2.pNext = &presentId;
+        presentId.pNext = &presentWait;
+        presentWait.pNext = &f12;
+    }
+    f12.pNext = &accel;
     accel.pNext = &rt;
     rt.pNext = &f13;
+    if (m_rayQuery) {
+        rt.pNext = &rayQuery;
+        rayQuery.pNext = &f13;
+    }
+    if (m_invocationReorder == InvocationReorder::NV) f13.pNext = &reorderNv;
+#ifdef VK_EXT_RAY_TRACING_INVOCATION_REORDER_EXTENSION_NAME
+    if (m_invocationReorder == InvocationReorder::EXT) f13.pNext = &reorderExt;
+#endif
 
     vk::DeviceCreateInfo dci{};
     dci.queueCreateInfoCount = static_cast<uint32_t>(qcis.size());
     dci.pQueueCreateInfos = qcis.data();
     dci.enabledExtensionCount = static_cast<uint32_t>(devExts.size());
     dci.ppEnabledExtensionNames = devExts.data();
-    dci.pNext = &bda;
+    dci.pNext = &f2;
 
 #ifndef NDEBUG
     const char* layers[] = { "VK_LAYER_KHRONOS_validation" };
@@ -345,11 +493,24 @@ void Renderer::createLogicalDevice() {
     m_graphicsQueue = m_device.getQueue(*m_qfi.graphics, 0);
     m_presentQueue = m_device.getQueue(*m_qfi.present, 0);
     m_computeQueue = m_device.getQueue(*m_qfi.compute, 0);
+
+    // world updates go to the compute queue when it shares the graphics family,
+    // otherwise the world buffers would need queue family ownership transfers
+    m_worldQueue = (*m_qfi.compute == *m_qfi.graphics) ? m_computeQueue : m_graphicsQueue;
+
+    if (m_qfi.asyncCompute) {
+        m_asyncComputeFamily = *m_qfi.asyncCompute;
+        m_asyncComputeQueue = m_device.getQueue(m_asyncComputeFamily, 0);
+    } else if (secondGraphicsQueue) {
+        m_asyncComputeFamily = *m_qfi.graphics;
+        m_asyncComputeQueue = m_device.getQueue(m_asyncComputeFamily, 1);
+    }
 }
 
 void Renderer::createAllocator() {
     VmaAllocatorCreateInfo ci{};
-    ci.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT | VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    ci.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+    if (m_memoryBudget) ci.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
     ci.physicalDevice = static_cast<VkPhysicalDevice>(m_physicalDevice);
     ci.device = static_cast<VkDevice>(m_device);
     ci.instance = static_cast<VkInstance>(m_instance);
@@ -357,6 +518,36 @@ void Renderer::createAllocator() {
     if (vmaCreateAllocator(&ci, &m_allocator) != VK_SUCCESS) {
         throw std::runtime_error("Vulkan API failed to create VMA!");
     }
+
+    // one memory type for every world buffer usage, found with a stand-in buffer
+    VkBufferCreateInfo bci{};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.size = 1 << 16;
+    bci.usage = static_cast<VkBufferUsageFlags>(
+        vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eVertexBuffer |
+        vk::BufferUsageFlagBits::eTransferSrc |
+        vk::BufferUsageFlagBits::eTransferDst |
+        vk::BufferUsageFlagBits::eShaderDeviceAddress |
+        vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+        vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR);
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VmaAllocationCreateInfo aci{};
+    aci.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    uint32_t typeIndex = 0;
+    if (vmaFindMemoryTypeIndexForBufferInfo(m_allocator, &bci, &aci, &typeIndex) != VK_SUCCESS) return;
+
+    // buffers past a block get their own allocation from vma, everything else shares the blocks
+    VmaPoolCreateInfo pci{};
+    pci.memoryTypeIndex = typeIndex;
+    pci.blockSize = VkDeviceSize(64) << 20;
+    if (vmaCreatePool(m_allocator, &pci, &m_worldMemory) != VK_SUCCESS) {
+        m_worldMemory = nullptr;
+        return;
+    }
+    const VkPhysicalDeviceMemoryProperties* props = nullptr;
+    vmaGetMemoryProperties(m_allocator, &props);
+    m_worldMemoryHeap = props->memoryTypes[typeIndex].heapIndex;
 }
 
 void Renderer::createSwapChain() {
@@ -387,6 +578,13 @@ void Renderer::createSwapChain() {
     sci.imageArrayLayers = 1;
     sci.imageUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferDst;
 
+    // lets the fused post pass write the swapchain image directly instead of blitting into it
+    const auto swapFeatures = m_physicalDevice.getFormatProperties(m_colorFormat).optimalTilingFeatures;
+    m_swapchainStorage = m_storageWriteWithoutFormat &&
+        (caps.supportedUsageFlags & vk::ImageUsageFlagBits::eStorage) &&
+        (swapFeatures & vk::FormatFeatureFlagBits::eStorageImage);
+    if (m_swapchainStorage) sci.imageUsage |= vk::ImageUsageFlagBits::eStorage;
+
     uint32_t qfi[2] = { *m_qfi.graphics, *m_qfi.present };
     if (*m_qfi.graphics != *m_qfi.present) {
         sci.imageSharingMode = vk::SharingMode::eConcurrent;
@@ -424,7 +622,7 @@ void Renderer::createSwapChain() {
     m_presentSignals.resize(m_swapImages.size());
     for (auto &s : m_presentSignals) { s = m_device.createSemaphore({}); }
 
-    m_imagesInFlight.assign(m_swapImages.size(), VK_NULL_HANDLE);
+    m_imageValues.assign(m_swapImages.size(), 0);
     m_swapImageLayouts.assign(m_swapImages.size(), vk::ImageLayout::eUndefined);
 }
 
@@ -480,8 +678,18 @@ void Renderer::createCommandPoolAndBuffers() {
         vk::CommandBufferAllocateInfo cai{};
         cai.commandPool = fr.cmdPool;
         cai.level = vk::CommandBufferLevel::ePrimary;
-        cai.commandBufferCount = 1;
-        fr.cmd = m_device.allocateCommandBuffers(cai).front();
+        cai.commandBufferCount = 2;
+        const auto cmds = m_device.allocateCommandBuffers(cai);
+        fr.cmd = cmds[0];
+        fr.presentCmd = cmds[1];
+
+        if (m_asyncComputeQueue) {
+            pci.queueFamilyIndex = m_asyncComputeFamily;
+            fr.computePool = m_device.createCommandPool(pci);
+            cai.commandPool = fr.computePool;
+            cai.commandBufferCount = 1;
+            fr.computeCmd = m_device.allocateCommandBuffers(cai).front();
+        }
     }
 
     // Upload
@@ -498,6 +706,97 @@ void Renderer::createCommandPoolAndBuffers() {
 
     vk::FenceCreateInfo fci{};
     m_uploadFence = m_device.createFence(fci);
+
+    // staging ring shared by setup and world uploads
+    m_staging.buffer = createBuffer(STAGING_RING_BYTES,
+                                    vk::BufferUsageFlagBits::eTransferSrc,
+                                    VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+                                    VMA_MEMORY_USAGE_AUTO_PREFER_HOST, true);
+
+    // World updates, command buffers are allocated on demand
+    vk::CommandPoolCreateInfo wpci{};
+    wpci.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    wpci.queueFamilyIndex = *m_qfi.graphics;
+    m_worldPool = m_device.createCommandPool(wpci);
+}
+
+void Renderer::createPipelineCache() {
+    std::vector<char> blob;
+    if (!m_shaderManager.cacheDir().empty()) {
+        std::ifstream file(std::filesystem::path(m_shaderManager.cacheDir()) / "pipeline_cache.bin", std::ios::binary | std::ios::ate);
+        if (file.is_open()) {
+            blob.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            if (!file.read(blob.data(), static_cast<std::streamsize>(blob.size()))) blob.clear();
+        }
+    }
+
+    // drivers are supposed to reject foreign blobs themselves, not all of them do
+    const auto props = m_physicalDevice.getProperties();
+    VkPipelineCacheHeaderVersionOne header{};
+    if (blob.size() >= sizeof(header)) std::memcpy(&header, blob.data(), sizeof(header));
+    const bool valid = blob.size() >= sizeof(header)
+        && header.headerSize >= sizeof(header)
+        && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendorID == props.vendorID
+        && header.deviceID == props.deviceID
+        && std::memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+    if (!valid) blob.clear();
+
+    vk::PipelineCacheCreateInfo ci{};
+    ci.initialDataSize = blob.size();
+    ci.pInitialData = blob.empty() ? nullptr : blob.data();
+    m_pipelineCache = m_device.createPipelineCache(ci);
+}
+
+void Renderer::startupJob(std::function<void()> job) {
+    if (!m_startupJobs) {
+        job();
+        return;
+    }
+
+    m_startupJobs->submit([this, job = std::move(job)] {
+        try {
+            job();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_startupErrorMutex);
+            if (!m_startupError) m_startupError = std::current_exception();
+        }
+    }, &m_startupCounter);
+}
+
+void Renderer::finishStartupJobs() {
+    if (!m_startupJobs) return;
+    m_startupJobs->wait(m_startupCounter);
+    m_startupJobs.reset();
+
+    if (m_startupError) {
+        std::exception_ptr error = m_startupError;
+        m_startupError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void Renderer::savePipelineCache() {
+    if (!m_pipelineCache || m_shaderManager.cacheDir().empty()) return;
+
+    const std::vector<uint8_t> blob = m_device.getPipelineCacheData(m_pipelineCache);
+    if (blob.empty()) return;
+
+    std::error_code ec;
+    const std::filesystem::path dir(m_shaderManager.cacheDir());
+    std::filesystem::create_directories(dir, ec);
+    const std::filesystem::path path = dir / "pipeline_cache.bin";
+    std::filesystem::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+        file.write(reinterpret_cast<const char*>(blob.data()), static_cast<std::streamsize>(blob.size()));
+        if (!file) return;
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
 }
 
 void Renderer::createSyncObjects() {
@@ -505,33 +804,77 @@ void Renderer::createSyncObjects() {
         vk::SemaphoreCreateInfo si{};
         fr.imageAvailable = m_device.createSemaphore(si);
         fr.renderFinished = m_device.createSemaphore(si);
-
-        vk::FenceCreateInfo fi{};
-        fi.flags = vk::FenceCreateFlagBits::eSignaled;
-        fr.inFlight = m_device.createFence(fi);
+        fr.doneValue = 0;
     }
+
+    // pass timings, needs timestamps on graphics and the async compute family
+    if (m_asyncComputeQueue)
+        m_profiler.init(m_device, m_physicalDevice, MAX_FRAMES_IN_FLIGHT, { *m_qfi.graphics, m_asyncComputeFamily });
+    else
+        m_profiler.init(m_device, m_physicalDevice, MAX_FRAMES_IN_FLIGHT, { *m_qfi.graphics });
+
+    vk::SemaphoreTypeCreateInfo tci{};
+    tci.semaphoreType = vk::SemaphoreType::eTimeline;
+    tci.initialValue = 0;
+
+    vk::SemaphoreCreateInfo si{};
+    si.pNext = &tci;
+    m_timeline = m_device.createSemaphore(si);
+    m_timelineValue = 0;
+    m_computeTimeline = m_device.createSemaphore(si);
+    m_computeTimelineValue = 0;
+    if (m_sparseNodes) m_sparseBound = m_device.createSemaphore({});
+    m_worldReadyValue = 0;
 }
 
 void Renderer::createPerFrameUniforms() {
     constexpr vk::DeviceSize defaultUBOSize = 64ull * 1024ull;
+    m_uboAlign = std::max<vk::DeviceSize>(m_physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment, 1);
+
+    // read by the async compute queue too once that's on, small enough to always share
+    std::vector<uint32_t> shared;
+    if (m_asyncComputeQueue && m_asyncComputeFamily != *m_qfi.graphics)
+        shared = { *m_qfi.graphics, m_asyncComputeFamily };
+
     for (auto& fr : m_frames) {
         fr.frameUBO = createBuffer(defaultUBOSize,
             vk::BufferUsageFlagBits::eUniformBuffer,
             VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
             VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            VMA_MEMORY_USAGE_AUTO_PREFER_HOST, true, shared
+            );
+        // written by a copy on the graphics queue, only ever read on the cpu
+        fr.pickReadback = createBuffer(PICK_MAX_PER_FRAME * PICK_STRIDE,
+            vk::BufferUsageFlagBits::eTransferDst,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT,
             VMA_MEMORY_USAGE_AUTO_PREFER_HOST, true
             );
+        // raygen's atomics land straight in host memory, a few per traced pixel and only while the stats are on
+        fr.traversalTotals = createBuffer(sizeof(TraversalTotalsGpu),
+            vk::BufferUsageFlagBits::eStorageBuffer,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            VMA_MEMORY_USAGE_AUTO_PREFER_HOST, true
+            );
+        std::memset(fr.traversalTotals.mapped, 0, sizeof(TraversalTotalsGpu));
+        vmaFlushAllocation(m_allocator, fr.traversalTotals.alloc, 0, sizeof(TraversalTotalsGpu));
     }
 }
 
 void Renderer::queryRayTracingProperties() {
     vk::PhysicalDeviceProperties2 props2{};
     vk::PhysicalDeviceRayTracingPipelinePropertiesKHR rtProps{};
+    vk::PhysicalDeviceAccelerationStructurePropertiesKHR asProps{};
     props2.pNext = &rtProps;
+    rtProps.pNext = &asProps;
 
     m_physicalDevice.getProperties2(&props2);
 
+    rtProps.pNext = nullptr;
+    asProps.pNext = nullptr;
     m_rtProps = rtProps;
+    m_asProps = asProps;
 }
 
 void Renderer::cleanupSwapChain() {
@@ -560,22 +903,155 @@ void Renderer::cleanupSwapChain() {
 
     for (auto s : m_presentSignals) if (s) m_device.destroySemaphore(s);
     m_presentSignals.clear();
-    m_imagesInFlight.clear();
+    m_imageValues.clear();
     m_swapImageLayouts.clear();
 }
 
+void Renderer::setAsyncCompute(bool enabled) {
+    enabled = enabled && m_asyncComputeQueue;
+    if (enabled == m_asyncComputeWanted) return;
+
+    // the ray targets get a parked set and images shared with another family need concurrent sharing,
+    // both only happen at creation so it's applied in the resize path
+    m_asyncComputeWanted = enabled;
+    m_swapchainDirty = true;
+}
+
+void Renderer::setFramesInFlight(uint32_t frames) {
+    frames = std::clamp(frames, 1u, FRAMES_IN_FLIGHT_MAX);
+    if (frames == m_framesInFlightWanted) return;
+
+    // the frame slots have to be idle to change how many of them cycle, the resize path already waits for that
+    m_framesInFlightWanted = frames;
+    m_swapchainDirty = true;
+}
+
+void Renderer::applyFramesInFlight() {
+    m_framesInFlight = m_asyncCompute || m_cudaInterop.active() ? 2 : m_framesInFlightWanted;
+    m_frameIndex = 0;
+    // which budget map is the previous frame's depends on the count
+    for (bool& written : m_denoiser.gbuffer.sampleBudgetWritten) written = false;
+}
+
+void Renderer::setPresentMode(vk::PresentModeKHR mode) {
+    if (mode == m_presentModeWanted) return;
+    if (std::find(m_presentModes.begin(), m_presentModes.end(), mode) == m_presentModes.end()) return;
+    m_presentModeWanted = mode;
+    m_swapchainDirty = true;
+}
+
+void Renderer::applyQualityPreset() {
+    flushPendingPresent();
+    m_device.waitIdle();
+
+    // the pipeline cache makes a preset that was used before cheap to come back to
+    m_quality = m_qualityWanted;
+    // the stats buffer is only screen sized while they're on
+    if (m_raytracer.settings.traversalStats != m_raytracer.pipelineTraversalStats) {
+        m_resizeGeneration++;
+        m_denoiser.resize(m_renderExtent.width, m_renderExtent.height);
+    }
+    m_raytracer.destroyPipeline();
+    m_raytracer.createPipeline();
+    m_raytracer.createSBT();
+    m_denoiser.rebuildAtrousPipeline();
+}
+
+bool Renderer::rebuildPipeline(vk::Pipeline &pipeline, vk::PipelineLayout &layout, const std::function<void()> &create) {
+    vk::Pipeline oldPipeline = pipeline;
+    vk::PipelineLayout oldLayout = layout;
+    pipeline = nullptr;
+    layout = nullptr;
+
+    try {
+        create();
+    } catch (const std::exception& e) {
+        std::cerr << "[Shader] " << e.what() << std::endl;
+        if (pipeline) m_device.destroyPipeline(pipeline);
+        if (layout) m_device.destroyPipelineLayout(layout);
+        pipeline = oldPipeline;
+        layout = oldLayout;
+        return false;
+    }
+
+    retirePipeline(oldPipeline, oldLayout);
+    return true;
+}
+
+void Renderer::pollShaderChanges() {
+    const double now = glfwGetTime();
+    if (now - m_shaderPollTime < SHADER_POLL_INTERVAL) return;
+    m_shaderPollTime = now;
+
+    const std::vector<std::string> changed = m_shaderManager.pollChanges();
+    if (changed.empty()) return;
+    for (const std::string& s : changed) std::cout << "[Shader] reloading " << s << std::endl;
+
+    // each owner rebuilds only what uses a changed source, frames in flight keep the old pipelines until they retire
+    m_raytracer.reloadShaders(changed);
+    m_denoiser.reloadShaders(changed);
+    m_postProcess.reloadShaders(changed);
+    m_svoBuilder.reloadShaders(changed);
+}
+
 void Renderer::recreateSwapChain() {
     // wait for the window to be non-zerp (i.e not minimized)
     int w = 0, h = 0; do { glfwGetFramebufferSize(m_window, &w, &h); glfwWaitEventsTimeout(0.016); } while (w == 0 && h == 0);
 
+    // the last async frame still has to go out on the old swapchain
+    flushPendingPresent();
+
     m_device.waitIdle();
+
+    m_asyncCompute = m_asyncComputeWanted;
+    m_imageSharingFamilies.clear();
+    if (m_asyncCompute && m_asyncComputeFamily != *m_qfi.graphics)
+        m_imageSharingFamilies = { *m_qfi.graphics, m_asyncComputeFamily };
+    applyFramesInFlight();
+
+    // present ids count per swapchain
+    m_presentMode = m_presentModeWanted;
+    m_presentId = 0;
+    m_lastPresentDone = {};
+
     cleanupSwapChain();
     createSwapChain();
     createImageResources();
+    m_resizeGeneration++;
 
-    // resize temporal buffers too
+    // the pooled targets only get reallocated when the window outgrows them, otherwise this drops their history
+    m_renderExtent = m_dynamicResolution.renderExtent(m_swapExtent);
     m_postProcess.resize(m_swapExtent.width, m_swapExtent.height);
-    m_denoiser.resize(m_swapExtent.width, m_swapExtent.height);
+    m_denoiser.resize(m_renderExtent.width, m_renderExtent.height);
+    if (m_cudaInterop.active()) m_cudaInterop.resize(m_swapExtent.width, m_swapExtent.height);
+}
+
+void Renderer::applyRenderScale() {
+    const vk::Extent2D extent = m_dynamicResolution.renderExtent(m_swapExtent);
+    if (extent == m_renderExtent) return;
+
+    // post keeps its output size and TAA history, only the traced/denoised rectangle changes.
+    // the scale never goes above 1, so this fits the pool and doesn't wait on the gpu
+    m_renderExtent = extent;
+    m_resizeGeneration++;
+    m_denoiser.resize(m_renderExtent.width, m_renderExtent.height);
+}
+
+vk::Extent2D Renderer::renderTargetExtent(vk::Extent2D wanted) {
+    if (m_targetExtent.width == 0) {
+        int count = 0;
+        GLFWmonitor** monitors = glfwGetMonitors(&count);
+        for (int i = 0; i < count; ++i) {
+            const GLFWvidmode* mode = glfwGetVideoMode(monitors[i]);
+            if (!mode) continue;
+            m_targetExtent.width = std::max(m_targetExtent.width, static_cast<uint32_t>(mode->width));
+            m_targetExtent.height = std::max(m_targetExtent.height, static_cast<uint32_t>(mode->height));
+        }
+    }
+    // a hidpi framebuffer is bigger than the mode, the first resize to it grows the pool for good
+    m_targetExtent.width = std::max(m_targetExtent.width, wanted.width);
+    m_targetExtent.height = std::max(m_targetExtent.height, wanted.height);
+    return m_targetExtent;
 }
 
 std::vector<const char *> Renderer::getRequiredExtensions() {
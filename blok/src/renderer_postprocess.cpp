@@ -6,9 +6,12 @@
 */
 
 #include "renderer_postprocess.hpp"
-#include "image_states.hpp"
+#include "render_graph.hpp"
 #include "renderer.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 namespace blok {
 
 PostProcess::PostProcess(Renderer* r)
@@ -20,13 +23,17 @@ PostProcess::PostProcess(Renderer* r)
 }
 
 void PostProcess::init(uint32_t width, uint32_t height) {
-    createBuffers(width, height);
+    const vk::Extent2D pool = renderer->renderTargetExtent({ width, height });
+    createBuffers(pool.width, pool.height);
     createSamplers();
     createDescriptorSetLayouts();
     allocateDescriptorSets();
-    createTAAPipeline();
-    createTonemapPipeline();
-    createSharpenPipeline();
+    // each pipeline only touches its own members, so they can be built side by side during startup
+    renderer->startupJob([this] { createTAAPipeline(); });
+    renderer->startupJob([this] { createTonemapPipeline(); });
+    renderer->startupJob([this] { createSharpenPipeline(); });
+    renderer->startupJob([this] { createFusedPipeline(); });
+    renderer->startupJob([this] { createHeatmapPipeline(); });
 }
 
 void PostProcess::cleanup() {
@@ -76,6 +83,34 @@ void PostProcess::cleanup() {
         pipeline.sharpenSetLayout = nullptr;
     }
 
+    // Destroy fused pipeline
+    if (pipeline.fusedPipeline) {
+        device.destroyPipeline(pipeline.fusedPipeline);
+        pipeline.fusedPipeline = nullptr;
+    }
+    if (pipeline.fusedPipelineLayout) {
+        device.destroyPipelineLayout(pipeline.fusedPipelineLayout);
+        pipeline.fusedPipelineLayout = nullptr;
+    }
+    if (pipeline.fusedSetLayout) {
+        device.destroyDescriptorSetLayout(pipeline.fusedSetLayout);
+        pipeline.fusedSetLayout = nullptr;
+    }
+
+    // Destroy heatmap pipeline
+    if (pipeline.heatmapPipeline) {
+        device.destroyPipeline(pipeline.heatmapPipeline);
+        pipeline.heatmapPipeline = nullptr;
+    }
+    if (pipeline.heatmapPipelineLayout) {
+        device.destroyPipelineLayout(pipeline.heatmapPipelineLayout);
+        pipeline.heatmapPipelineLayout = nullptr;
+    }
+    if (pipeline.heatmapSetLayout) {
+        device.destroyDescriptorSetLayout(pipeline.heatmapSetLayout);
+        pipeline.heatmapSetLayout = nullptr;
+    }
+
     // Destroy samplers
     if (pipeline.linearSampler) {
         device.destroySampler(pipeline.linearSampler);
@@ -90,17 +125,22 @@ void PostProcess::cleanup() {
 }
 
 void PostProcess::resize(uint32_t width, uint32_t height) {
-    renderer->m_device.waitIdle();
+    if (width > capacity.width || height > capacity.height) {
+        renderer->m_device.waitIdle();
 
-    destroyBuffers();
-    createBuffers(width, height);
+        destroyBuffers();
+        const vk::Extent2D pool = renderer->renderTargetExtent({ width, height });
+        createBuffers(pool.width, pool.height);
+    }
 
-    // Reset history since we resized
+    // Reset history since we resized, the pixels in it are laid out for the old size
     hasPreviousFrame = false;
     jitterIndex = 0;
 }
 
 void PostProcess::createBuffers(uint32_t width, uint32_t height) {
+    capacity = vk::Extent2D{ width, height };
+
     // TAA history buffers
     for (int i = 0; i < 2; i++) {
         buffers.taaHistory[i] = renderer->createImage(
@@ -156,6 +196,18 @@ void PostProcess::createBuffers(uint32_t width, uint32_t height) {
         VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
     );
 
+    // Heatmap output
+    buffers.heatmapOutput = renderer->createImage(
+        width, height,
+        vk::Format::eR8G8B8A8Unorm,
+        vk::ImageUsageFlagBits::eStorage |
+        vk::ImageUsageFlagBits::eTransferSrc,
+        vk::ImageTiling::eOptimal,
+        vk::SampleCountFlagBits::e1,
+        1, 1,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+    );
+
     buffers.historyIndex = 0;
 }
 
@@ -176,6 +228,7 @@ void PostProcess::destroyBuffers() {
     destroyImage(buffers.taaOutput);
     destroyImage(buffers.tonemapOutput);
     destroyImage(buffers.sharpenOutput);
+    destroyImage(buffers.heatmapOutput);
 }
 
 void PostProcess::createSamplers() {
@@ -241,7 +294,23 @@ glm::vec2 PostProcess::getJitterClipSpace(uint32_t width, uint32_t height) const
 }
 
 void PostProcess::advanceJitter() {
-    jitterIndex = (jitterIndex + 1) % JITTER_SEQUENCE_LENGTH;
+    jitterIndex = (jitterIndex + 1) % jitterPhaseCount();
+}
+
+float PostProcess::upscaleScale() const {
+    if (!settings.enableTAA) return 1.0f;
+    switch (settings.upscaleMode) {
+        case UpscaleMode::Quality: return 0.67f;
+        case UpscaleMode::Balanced: return 0.58f;
+        case UpscaleMode::Performance: return 0.5f;
+        default: return 1.0f;
+    }
+}
+
+uint32_t PostProcess::jitterPhaseCount() const {
+    const float ratio = static_cast<float>(renderer->m_swapExtent.width) / static_cast<float>(std::max(renderer->m_renderExtent.width, 1u));
+    const auto phases = static_cast<uint32_t>(std::ceil(8.0f * ratio * ratio));
+    return std::clamp(phases, 16u, static_cast<uint32_t>(JITTER_SEQUENCE_LENGTH));
 }
 
 void PostProcess::updatePreviousFrameData(const glm::mat4& view, const glm::mat4& proj) {
@@ -313,6 +382,42 @@ void PostProcess::createDescriptorSetLayouts() {
     vk::DescriptorSetLayoutCreateInfo sharpenCi{};
     sharpenCi.setBindings(sharpenBindings);
     pipeline.sharpenSetLayout = renderer->m_device.createDescriptorSetLayout(sharpenCi);
+
+    // Fused Layout, TAA's bindings with the final output in place of taaOutput
+    std::vector<vk::DescriptorSetLayoutBinding> fusedBindings = {
+        // 0: Current frame color (after denoising)
+        {0, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 1: Previous TAA history (sampled)
+        {1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute},
+        // 2: Motion vectors
+        {2, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 3: Depth buffer
+        {3, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 4: Output to history (for next frame)
+        {4, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 5: Final output (swapchain image or sharpenOutput)
+        {5, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+        // 6: Frame UBO
+        {6, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+    };
+
+    vk::DescriptorSetLayoutCreateInfo fusedCi{};
+    fusedCi.setBindings(fusedBindings);
+    pipeline.fusedSetLayout = renderer->m_device.createDescriptorSetLayout(fusedCi);
+
+    // Heatmap Layout
+    std::vector<vk::DescriptorSetLayoutBinding> heatmapBindings = {
+        // 0: Post output
+        {0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute},
+        // 1: Per pixel traversal stats
+        {1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        // 2: Output image
+        {2, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute},
+    };
+
+    vk::DescriptorSetLayoutCreateInfo heatmapCi{};
+    heatmapCi.setBindings(heatmapBindings);
+    pipeline.heatmapSetLayout = renderer->m_device.createDescriptorSetLayout(heatmapCi);
 }
 
 void PostProcess::allocateDescriptorSets() {
@@ -325,10 +430,25 @@ void PostProcess::allocateDescriptorSets() {
 
         pipeline.sharpenSets[i] = renderer->m_descAlloc.allocate(
             renderer->m_device, pipeline.sharpenSetLayout);
+
+        pipeline.fusedSets[i] = renderer->m_descAlloc.allocate(
+            renderer->m_device, pipeline.fusedSetLayout);
+
+        pipeline.heatmapSets[i] = renderer->m_descAlloc.allocate(
+            renderer->m_device, pipeline.heatmapSetLayout);
     }
 }
 
 void PostProcess::updateDescriptorSets(uint32_t frameIndex, Image& inputColor) {
+    // inputColor is whichever denoiser image came out last, the tonemap input follows enableTAA
+    const auto& gbuffer = renderer->m_denoiser.gbuffer;
+    const bool changed = pipeline.setKeys[frameIndex].changed({
+        renderer->m_resizeGeneration, descriptorKey(inputColor.view), descriptorKey(gbuffer.motionVectors.view),
+        descriptorKey(gbuffer.worldPositionHistory[gbuffer.geometryIndex].view), buffers.historyIndex,
+        settings.enableTAA ? 1u : 0u, descriptorKey(renderer->m_frames[frameIndex].frameUBO.handle)
+    });
+    if (!changed) return;
+
     // TAA Descriptor Set
     {
         vk::DescriptorSet set = pipeline.taaSets[frameIndex];
@@ -340,7 +460,7 @@ void PostProcess::updateDescriptorSets(uint32_t frameIndex, Image& inputColor) {
             vk::ImageLayout::eShaderReadOnlyOptimal
         };
         vk::DescriptorImageInfo motionInfo{nullptr, renderer->m_denoiser.gbuffer.motionVectors.view, vk::ImageLayout::eGeneral};
-        vk::DescriptorImageInfo depthInfo{nullptr, renderer->m_denoiser.gbuffer.worldPosition.view, vk::ImageLayout::eGeneral};
+        vk::DescriptorImageInfo depthInfo{nullptr, renderer->m_denoiser.gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
         vk::DescriptorImageInfo outputInfo{nullptr, buffers.taaOutput.view, vk::ImageLayout::eGeneral};
         vk::DescriptorImageInfo historyOutInfo{nullptr, buffers.currentHistory().view, vk::ImageLayout::eGeneral};
 
@@ -400,10 +520,82 @@ void PostProcess::updateDescriptorSets(uint32_t frameIndex, Image& inputColor) {
     }
 }
 
+void PostProcess::updateFusedDescriptorSet(uint32_t frameIndex, Image& inputColor, Image& target) {
+    const auto& gbuffer = renderer->m_denoiser.gbuffer;
+    const bool changed = pipeline.fusedSetKeys[frameIndex].changed({
+        renderer->m_resizeGeneration, descriptorKey(inputColor.view), descriptorKey(gbuffer.motionVectors.view),
+        descriptorKey(gbuffer.worldPositionHistory[gbuffer.geometryIndex].view), buffers.historyIndex,
+        descriptorKey(target.view), descriptorKey(renderer->m_frames[frameIndex].frameUBO.handle)
+    });
+    if (!changed) return;
+
+    vk::DescriptorSet set = pipeline.fusedSets[frameIndex];
+
+    vk::DescriptorImageInfo currentColorInfo{nullptr, inputColor.view, vk::ImageLayout::eGeneral};
+    vk::DescriptorImageInfo prevHistoryInfo{
+        pipeline.linearSampler,
+        buffers.previousHistory().view,
+        vk::ImageLayout::eShaderReadOnlyOptimal
+    };
+    vk::DescriptorImageInfo motionInfo{nullptr, gbuffer.motionVectors.view, vk::ImageLayout::eGeneral};
+    vk::DescriptorImageInfo depthInfo{nullptr, renderer->m_denoiser.gbuffer.currentWorldPosition().view, vk::ImageLayout::eGeneral};
+    vk::DescriptorImageInfo historyOutInfo{nullptr, buffers.currentHistory().view, vk::ImageLayout::eGeneral};
+    vk::DescriptorImageInfo outputInfo{nullptr, target.view, vk::ImageLayout::eGeneral};
+
+    auto& fr = renderer->m_frames[frameIndex];
+    vk::DescriptorBufferInfo uboInfo{fr.frameUBO.handle, 0, sizeof(FrameUBO)};
+
+    std::array<vk::WriteDescriptorSet, 7> writes{};
+    writes[0] = {set, 0, 0, 1, vk::DescriptorType::eStorageImage, &currentColorInfo};
+    writes[1] = {set, 1, 0, 1, vk::DescriptorType::eCombinedImageSampler, &prevHistoryInfo};
+    writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &motionInfo};
+    writes[3] = {set, 3, 0, 1, vk::DescriptorType::eStorageImage, &depthInfo};
+    writes[4] = {set, 4, 0, 1, vk::DescriptorType::eStorageImage, &historyOutInfo};
+    writes[5] = {set, 5, 0, 1, vk::DescriptorType::eStorageImage, &outputInfo};
+    writes[6] = {set, 6, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &uboInfo};
+
+    renderer->m_device.updateDescriptorSets(writes, {});
+}
+
+void PostProcess::updateHeatmapDescriptorSet(uint32_t frameIndex, Image& scene) {
+    const Buffer& stats = renderer->m_denoiser.gbuffer.traversalStats;
+    const bool changed = pipeline.heatmapSetKeys[frameIndex].changed({
+        renderer->m_resizeGeneration, descriptorKey(scene.view), descriptorKey(stats.handle)
+    });
+    if (!changed) return;
+
+    vk::DescriptorSet set = pipeline.heatmapSets[frameIndex];
+
+    vk::DescriptorImageInfo sceneInfo{pipeline.nearestSampler, scene.view, vk::ImageLayout::eShaderReadOnlyOptimal};
+    vk::DescriptorBufferInfo statsInfo{stats.handle, 0, VK_WHOLE_SIZE};
+    vk::DescriptorImageInfo outputInfo{nullptr, buffers.heatmapOutput.view, vk::ImageLayout::eGeneral};
+
+    std::array<vk::WriteDescriptorSet, 3> writes{};
+    writes[0] = {set, 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &sceneInfo};
+    writes[1] = {set, 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &statsInfo};
+    writes[2] = {set, 2, 0, 1, vk::DescriptorType::eStorageImage, &outputInfo};
+
+    renderer->m_device.updateDescriptorSets(writes, {});
+}
+
+void PostProcess::reloadShaders(const std::vector<std::string>& changed) {
+    if (shaderChanged(changed, "assets/shaders/taa.comp"))
+        renderer->rebuildPipeline(pipeline.taaPipeline, pipeline.taaPipelineLayout, [this] { createTAAPipeline(); });
+    if (shaderChanged(changed, "assets/shaders/tonemap.comp"))
+        renderer->rebuildPipeline(pipeline.tonemapPipeline, pipeline.tonemapPipelineLayout, [this] { createTonemapPipeline(); });
+    if (shaderChanged(changed, "assets/shaders/sharpen.comp"))
+        renderer->rebuildPipeline(pipeline.sharpenPipeline, pipeline.sharpenPipelineLayout, [this] { createSharpenPipeline(); });
+    if (shaderChanged(changed, "assets/shaders/post_fused.comp"))
+        renderer->rebuildPipeline(pipeline.fusedPipeline, pipeline.fusedPipelineLayout, [this] { createFusedPipeline(); });
+    if (shaderChanged(changed, "assets/shaders/traversal_heatmap.comp"))
+        renderer->rebuildPipeline(pipeline.heatmapPipeline, pipeline.heatmapPipelineLayout, [this] { createHeatmapPipeline(); });
+}
+
 void PostProcess::createTAAPipeline() {
     auto shaderModule = renderer->m_shaderManager.loadModule(
         "assets/shaders/taa.comp",
-        vk::ShaderStageFlagBits::eCompute
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
     );
 
     vk::PipelineShaderStageCreateInfo stageInfo{};
@@ -428,7 +620,7 @@ void PostProcess::createTAAPipeline() {
     pipelineInfo.stage = stageInfo;
     pipelineInfo.layout = pipeline.taaPipelineLayout;
 
-    auto result = renderer->m_device.createComputePipeline(nullptr, pipelineInfo);
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
     pipeline.taaPipeline = result.value;
 
     renderer->m_device.destroyShaderModule(shaderModule.module);
@@ -462,7 +654,7 @@ void PostProcess::createTonemapPipeline() {
     pipelineInfo.stage = stageInfo;
     pipelineInfo.layout = pipeline.tonemapPipelineLayout;
 
-    auto result = renderer->m_device.createComputePipeline(nullptr, pipelineInfo);
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
     pipeline.tonemapPipeline = result.value;
 
     renderer->m_device.destroyShaderModule(shaderModule.module);
@@ -496,65 +688,158 @@ void PostProcess::createSharpenPipeline() {
     pipelineInfo.stage = stageInfo;
     pipelineInfo.layout = pipeline.sharpenPipelineLayout;
 
-    auto result = renderer->m_device.createComputePipeline(nullptr, pipelineInfo);
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
     pipeline.sharpenPipeline = result.value;
 
     renderer->m_device.destroyShaderModule(shaderModule.module);
 }
 
-void PostProcess::process(vk::CommandBuffer cmd, Image& inputColor, uint32_t width, uint32_t height, uint32_t frameIndex) {
-    ImageTransitions it{cmd};
+void PostProcess::createFusedPipeline() {
+    // the output binding has no format so the swapchain image (bgra8 or rgba8) and sharpenOutput both fit
+    if (!renderer->m_storageWriteWithoutFormat) return;
+
+    auto shaderModule = renderer->m_shaderManager.loadModule(
+        "assets/shaders/post_fused.comp",
+        vk::ShaderStageFlagBits::eCompute,
+        GBUFFER_SHADER_DEFINES
+    );
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(FusedPostPushConstants);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.fusedSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+
+    pipeline.fusedPipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = pipeline.fusedPipelineLayout;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+    pipeline.fusedPipeline = result.value;
+
+    renderer->m_device.destroyShaderModule(shaderModule.module);
+}
+
+void PostProcess::createHeatmapPipeline() {
+    auto shaderModule = renderer->m_shaderManager.loadModule(
+        "assets/shaders/traversal_heatmap.comp",
+        vk::ShaderStageFlagBits::eCompute
+    );
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(HeatmapPushConstants);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.heatmapSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+
+    pipeline.heatmapPipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = pipeline.heatmapPipelineLayout;
+
+    auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+    pipeline.heatmapPipeline = result.value;
+
+    renderer->m_device.destroyShaderModule(shaderModule.module);
+}
+
+bool PostProcess::heatmapActive() const {
+    // the per pixel counters only exist while the rt pipeline was built with them
+    return settings.heatmap != TraversalHeatmap::Off && pipeline.heatmapPipeline && renderer->m_raytracer.pipelineTraversalStats;
+}
+
+bool PostProcess::fusedActive() const {
+    // the staged tile assumes render and output pixels line up. the heatmap needs the output in an image of its own
+    return !heatmapActive() && settings.fusedPost && pipeline.fusedPipeline && renderer->m_renderExtent == renderer->m_swapExtent &&
+        settings.enableTAA && settings.enableTonemapping && settings.enableSharpening;
+}
+
+void PostProcess::process(RenderGraph& graph, Image& inputColor, uint32_t width, uint32_t height, uint32_t frameIndex, Image* target) {
+    constexpr vk::PipelineStageFlags2 compute = vk::PipelineStageFlagBits2::eComputeShader;
+    auto& gbuffer = renderer->m_denoiser.gbuffer;
+
+    // one pass, no taaOutput/tonemapOutput round trips. sharpenOutput stays the output for the blit without a target
+    if (fusedActive()) {
+        Image& output = target ? *target : buffers.sharpenOutput;
+        updateFusedDescriptorSet(frameIndex, inputColor, output);
+
+        graph.pass(compute, "Post Fused")
+            .read(inputColor)
+            .read(buffers.previousHistory(), Role::ShaderReadOnly)
+            .read(gbuffer.motionVectors)
+            .read(gbuffer.currentWorldPosition())
+            .write(buffers.currentHistory())
+            .write(output)
+            .run([&](vk::CommandBuffer cmd) { dispatchFused(cmd, width, height, frameIndex); });
+        return;
+    }
 
     // Update descriptor sets with current frame's input
     updateDescriptorSets(frameIndex, inputColor);
 
-    // Memory barrier helper
-    auto insertBarrier = [&cmd]() {
-        vk::MemoryBarrier2 barrier{};
-        barrier.srcStageMask = vk::PipelineStageFlagBits2::eComputeShader;
-        barrier.srcAccessMask = vk::AccessFlagBits2::eShaderWrite;
-        barrier.dstStageMask = vk::PipelineStageFlagBits2::eComputeShader;
-        barrier.dstAccessMask = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite;
-
-        vk::DependencyInfo dep{};
-        dep.memoryBarrierCount = 1;
-        dep.pMemoryBarriers = &barrier;
-        cmd.pipelineBarrier2(dep);
-    };
-
     // TAA Pass
     if (settings.enableTAA) {
-        it.ensure(inputColor, Role::General);
-        it.ensure(buffers.previousHistory(), Role::ShaderReadOnly);
-        it.ensure(buffers.taaOutput, Role::General);
-        it.ensure(buffers.currentHistory(), Role::General);
-
-        dispatchTAA(cmd, inputColor, width, height, frameIndex);
-        insertBarrier();
+        graph.pass(compute, "TAA")
+            .read(inputColor)
+            .read(buffers.previousHistory(), Role::ShaderReadOnly)
+            .read(gbuffer.motionVectors)
+            .read(gbuffer.currentWorldPosition())
+            .write(buffers.taaOutput)
+            .write(buffers.currentHistory())
+            .run([&](vk::CommandBuffer cmd) { dispatchTAA(cmd, inputColor, width, height, frameIndex); });
     }
 
     // Tonemap Pass
     if (settings.enableTonemapping) {
-        if (settings.enableTAA) {
-            it.ensure(buffers.taaOutput, Role::ShaderReadOnly);
-        } else {
-            it.ensure(inputColor, Role::ShaderReadOnly);
-        }
-        it.ensure(buffers.tonemapOutput, Role::General);
-
-        dispatchTonemap(cmd, width, height, frameIndex);
-        insertBarrier();
+        graph.pass(compute, "Tonemap")
+            .read(settings.enableTAA ? buffers.taaOutput : inputColor, Role::ShaderReadOnly)
+            .write(buffers.tonemapOutput)
+            .run([&](vk::CommandBuffer cmd) { dispatchTonemap(cmd, inputColor, width, height, frameIndex); });
     }
 
     // Sharpen Pass
     if (settings.enableSharpening && settings.enableTonemapping) {
-        it.ensure(buffers.tonemapOutput, Role::ShaderReadOnly);
-        it.ensure(buffers.sharpenOutput, Role::General);
+        graph.pass(compute, "Sharpen")
+            .read(buffers.tonemapOutput, Role::ShaderReadOnly)
+            .write(buffers.sharpenOutput)
+            .run([&](vk::CommandBuffer cmd) { dispatchSharpen(cmd, width, height, frameIndex); });
+    }
+
+    // Heatmap Pass
+    if (heatmapActive()) {
+        Image& scene = passOutput();
+        updateHeatmapDescriptorSet(frameIndex, scene);
 
-        dispatchSharpen(cmd, width, height, frameIndex);
-        // Add barrier after sharpen too for safety
-        insertBarrier();
+        graph.pass(compute, "Traversal Heatmap")
+            .read(scene, Role::ShaderReadOnly)
+            .read(gbuffer.traversalStats)
+            .write(buffers.heatmapOutput)
+            .run([&](vk::CommandBuffer cmd) { dispatchHeatmap(cmd, width, height, frameIndex); });
     }
+    // whoever reads the output declares it, the graph puts the barrier there
 }
 
 void PostProcess::dispatchTAA(vk::CommandBuffer cmd, Image& inputColor, uint32_t width, uint32_t height, uint32_t frameIndex) {
@@ -574,6 +859,9 @@ void PostProcess::dispatchTAA(vk::CommandBuffer cmd, Image& inputColor, uint32_t
     pc.jitterY = jitter.y;
     pc.feedbackMin = settings.feedbackMin;
     pc.feedbackMax = settings.feedbackMax;
+    pc.outputWidth = width;
+    pc.outputHeight = height;
+    pc.historyValid = hasPreviousFrame ? 1u : 0u;
 
     cmd.pushConstants(
         pipeline.taaPipelineLayout,
@@ -588,7 +876,7 @@ void PostProcess::dispatchTAA(vk::CommandBuffer cmd, Image& inputColor, uint32_t
     cmd.dispatch(groupsX, groupsY, 1);
 }
 
-void PostProcess::dispatchTonemap(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex) {
+void PostProcess::dispatchTonemap(vk::CommandBuffer cmd, Image& inputColor, uint32_t width, uint32_t height, uint32_t frameIndex) {
     cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.tonemapPipeline);
     cmd.bindDescriptorSets(
         vk::PipelineBindPoint::eCompute,
@@ -603,6 +891,13 @@ void PostProcess::dispatchTonemap(vk::CommandBuffer cmd, uint32_t width, uint32_
     pc.saturationBoost = settings.saturationBoost;
     pc.tonemapOperator = static_cast<int>(settings.tonemapOperator);
     pc.whitePoint = settings.whitePoint;
+    // without TAA it reads the denoiser's output straight, only the render extent of it is in use
+    const Image& input = settings.enableTAA ? buffers.taaOutput : inputColor;
+    const vk::Extent2D used = settings.enableTAA ? vk::Extent2D{ width, height } : renderer->m_renderExtent;
+    pc.inputScaleX = static_cast<float>(used.width) / static_cast<float>(input.width);
+    pc.inputScaleY = static_cast<float>(used.height) / static_cast<float>(input.height);
+    pc.outputWidth = width;
+    pc.outputHeight = height;
 
     cmd.pushConstants(
         pipeline.tonemapPipelineLayout,
@@ -629,6 +924,8 @@ void PostProcess::dispatchSharpen(vk::CommandBuffer cmd, uint32_t width, uint32_
 
     SharpenPushConstants pc{};
     pc.sharpenStrength = settings.sharpenStrength;
+    pc.outputWidth = width;
+    pc.outputHeight = height;
 
     cmd.pushConstants(
         pipeline.sharpenPipelineLayout,
@@ -643,7 +940,84 @@ void PostProcess::dispatchSharpen(vk::CommandBuffer cmd, uint32_t width, uint32_
     cmd.dispatch(groupsX, groupsY, 1);
 }
 
+void PostProcess::dispatchFused(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.fusedPipeline);
+    cmd.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute,
+        pipeline.fusedPipelineLayout,
+        0,
+        pipeline.fusedSets[frameIndex],
+        {}
+    );
+
+    FusedPostPushConstants pc{};
+    glm::vec2 jitter = getJitterOffset();
+    pc.taa.jitterX = jitter.x;
+    pc.taa.jitterY = jitter.y;
+    pc.taa.feedbackMin = settings.feedbackMin;
+    pc.taa.feedbackMax = settings.feedbackMax;
+    pc.taa.outputWidth = width;
+    pc.taa.outputHeight = height;
+    pc.taa.historyValid = hasPreviousFrame ? 1u : 0u;
+    pc.tonemap.exposure = settings.exposure;
+    pc.tonemap.saturationBoost = settings.saturationBoost;
+    pc.tonemap.tonemapOperator = static_cast<int>(settings.tonemapOperator);
+    pc.tonemap.whitePoint = settings.whitePoint;
+    pc.sharpenStrength = settings.sharpenStrength;
+
+    cmd.pushConstants(
+        pipeline.fusedPipelineLayout,
+        vk::ShaderStageFlagBits::eCompute,
+        0,
+        sizeof(FusedPostPushConstants),
+        &pc
+    );
+
+    // one 16x16 tile per group
+    uint32_t groupsX = (width + 15) / 16;
+    uint32_t groupsY = (height + 15) / 16;
+    cmd.dispatch(groupsX, groupsY, 1);
+}
+
+void PostProcess::dispatchHeatmap(vk::CommandBuffer cmd, uint32_t width, uint32_t height, uint32_t frameIndex) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.heatmapPipeline);
+    cmd.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute,
+        pipeline.heatmapPipelineLayout,
+        0,
+        pipeline.heatmapSets[frameIndex],
+        {}
+    );
+
+    // the counters are laid out at render resolution
+    HeatmapPushConstants pc{};
+    pc.renderWidth = renderer->m_renderExtent.width;
+    pc.renderHeight = renderer->m_renderExtent.height;
+    pc.mode = static_cast<uint32_t>(settings.heatmap);
+    pc.maxValue = settings.heatmapMax;
+    pc.opacity = settings.heatmapOpacity;
+    pc.outputWidth = width;
+    pc.outputHeight = height;
+
+    cmd.pushConstants(
+        pipeline.heatmapPipelineLayout,
+        vk::ShaderStageFlagBits::eCompute,
+        0,
+        sizeof(HeatmapPushConstants),
+        &pc
+    );
+
+    uint32_t groupsX = (width + 7) / 8;
+    uint32_t groupsY = (height + 7) / 8;
+    cmd.dispatch(groupsX, groupsY, 1);
+}
+
 Image& PostProcess::getOutputImage() {
+    if (heatmapActive()) return buffers.heatmapOutput;
+    return passOutput();
+}
+
+Image& PostProcess::passOutput() {
     // Return the final output based on which passes are enabled
     if (settings.enableSharpening && settings.enableTonemapping) {
         return buffers.sharpenOutput;
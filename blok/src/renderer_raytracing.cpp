@@ -6,189 +6,363 @@
 */
 #include "renderer_raytracing.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <thread>
 
 #include "renderer.hpp"
+#include "cpu_profiler.hpp"
 
 namespace blok {
 
-vk::AccelerationStructureKHR Renderer::buildChunkBlas(WorldSvoGpu &gpuWorld) {
-    // count primitives
-    uint32_t count = gpuWorld.globalSubChunks.size();
-    if (count == 0) return {};
-
-    // build array of aabbs
-    std::vector<vk::AabbPositionsKHR> aabbs(count);
-    for (uint32_t i = 0; i < count; ++i) {
-        const auto& sub = gpuWorld.globalSubChunks[i];
-        aabbs[i].minX = sub.worldMin.x;
-        aabbs[i].minY = sub.worldMin.y;
-        aabbs[i].minZ = sub.worldMin.z;
-        aabbs[i].maxX = sub.worldMax.x;
-        aabbs[i].maxY = sub.worldMax.y;
-        aabbs[i].maxZ = sub.worldMax.z;
-    }
+// full rebuild after this many refits, refit quality degrades as boxes drift
+static constexpr uint32_t MAX_BLAS_REFITS = 64;
 
-    // clean up old AABB buffer if it exists
-    if (gpuWorld.blasAabbBuffer.handle) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.blasAabbBuffer.handle, gpuWorld.blasAabbBuffer.alloc);
-        gpuWorld.blasAabbBuffer = {};
-    }
+static bool aabbActive(const vk::AabbPositionsKHR& a) {
+    return !std::isnan(a.minX);
+}
 
-    // create aabb buffer
-    gpuWorld.blasAabbBuffer = createBuffer(
-        sizeof(vk::AabbPositionsKHR) * count,
-        vk::BufferUsageFlagBits::eShaderDeviceAddress |
-        vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
-        vk::BufferUsageFlagBits::eStorageBuffer |
-        vk::BufferUsageFlagBits::eTransferDst,
-        0, VMA_MEMORY_USAGE_AUTO
-    );
-    uploadToBuffer(aabbs.data(), sizeof(aabbs[0]) * count, gpuWorld.blasAabbBuffer);
+vk::DeviceAddress Renderer::ensureScratch(WorldSvoGpu& gpuWorld, vk::DeviceSize size) {
+    const vk::DeviceSize align = std::max<vk::DeviceSize>(m_asProps.minAccelerationStructureScratchOffsetAlignment, 1);
+    const vk::DeviceSize needed = size + align;
+
+    if (!gpuWorld.scratchBuffer.handle || gpuWorld.scratchBuffer.size < needed) {
+        retireBuffer(gpuWorld.scratchBuffer);
+        gpuWorld.scratchBuffer = createWorldBuffer(
+            needed,
+            vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            MemoryCategory::Scratch
+        );
+    }
 
-    vk::BufferDeviceAddressInfo ai{gpuWorld.blasAabbBuffer.handle};
-    vk::DeviceAddress addr = m_device.getBufferAddress(ai);
+    const vk::DeviceAddress base = m_device.getBufferAddress({ gpuWorld.scratchBuffer.handle });
+    return alignUp(base, align);
+}
 
-    // build blas geo info
+// everything a blas build needs between recording its aabb upload and the batched build
+struct PendingBlasBuild {
     vk::AccelerationStructureGeometryKHR geom{};
-    geom.geometryType = vk::GeometryTypeKHR::eAabbs;
-    geom.flags = vk::GeometryFlagBitsKHR::eOpaque;
-    geom.geometry.setAabbs({addr, sizeof(vk::AabbPositionsKHR)});
-
     vk::AccelerationStructureBuildRangeInfoKHR range{};
-    range.primitiveCount = count;
-    range.primitiveOffset = 0;
-    range.firstVertex = 0;
-    range.transformOffset = 0;
-
     vk::AccelerationStructureBuildGeometryInfoKHR build{};
-    build.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
-    build.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
-    build.setGeometries(geom);
-    build.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
+    vk::DeviceSize scratchOffset = 0;
+};
+
+void Renderer::buildChunkBlases(WorldSvoGpu &gpuWorld, vk::CommandBuffer cmd) {
+    BLOK_PROFILE_NAMED(timer, "buildChunkBlases");
+    // drop the blas of every chunk the packer removed, the current tlas still points at them
+    for (auto it = gpuWorld.chunkBlas.begin(); it != gpuWorld.chunkBlas.end();) {
+        if (gpuWorld.chunkRanges.count(it->first)) { ++it; continue; }
+
+        retireAccelerationStructure(it->second.as);
+        retireBuffer(it->second.aabbBuffer);
+        it = gpuWorld.chunkBlas.erase(it);
+    }
 
-    // query sizes
-    auto sizes = m_device.getAccelerationStructureBuildSizesKHR(
-        vk::AccelerationStructureBuildTypeKHR::eDevice,
-        build,
-        range.primitiveCount
-    );
+    // primitives per blas, one per sub-chunk slot
+    const uint32_t count = gpuWorld.subChunksPerChunk;
+    if (count == 0) return;
+
+    const vk::DeviceSize scratchAlign = std::max<vk::DeviceSize>(m_asProps.minAccelerationStructureScratchOffsetAlignment, 1);
+
+    std::vector<PendingBlasBuild> pending;
+    vk::DeviceSize scratchTotal = 0;
+    uint32_t refitCount = 0;
+
+    for (auto& kv : gpuWorld.chunkRanges) {
+        const ChunkGpuRange& range = kv.second;
+        ChunkBlas& blas = gpuWorld.chunkBlas[kv.first];
+
+        // not repacked since its last build
+        if (blas.as.handle && blas.packSerial == range.packSerial) continue;
+        blas.packSerial = range.packSerial;
+
+        // SvoBuilder already wrote this chunk's aabbs into a fresh aabbBuffer, nothing on the cpu to compare
+        const bool gpuBuilt = range.gpuBuilt && blas.aabbBuffer.handle;
+
+        // gpu built: always a full build, and no boxes are kept so the next cpu pack can't refit against them
+        std::vector<vk::AabbPositionsKHR> aabbs;
+        bool refit = false;
+        if (!gpuBuilt) {
+            // build array of chunk-local aabbs
+            const SubChunkGpu* block = gpuWorld.globalSubChunks.data() + static_cast<size_t>(range.slot) * count;
+            aabbs.resize(count);
+            for (uint32_t i = 0; i < count; ++i) {
+                const auto& sub = block[i];
+
+                // empty slot, a NaN minX makes the aabb inactive so it never gets hit
+                if (sub.nodeCount == 0) {
+                    aabbs[i] = vk::AabbPositionsKHR{};
+                    aabbs[i].minX = std::numeric_limits<float>::quiet_NaN();
+                    continue;
+                }
+
+                aabbs[i].minX = sub.localMin.x;
+                aabbs[i].minY = sub.localMin.y;
+                aabbs[i].minZ = sub.localMin.z;
+                aabbs[i].maxX = sub.localMax.x;
+                aabbs[i].maxY = sub.localMax.y;
+                aabbs[i].maxZ = sub.localMax.z;
+            }
+
+            // an update has to keep the primitive count and which primitives are active
+            bool sameLayout = blas.as.handle && blas.aabbs.size() == aabbs.size();
+            for (uint32_t i = 0; sameLayout && i < count; ++i)
+                sameLayout = aabbActive(aabbs[i]) == aabbActive(blas.aabbs[i]);
+
+            // edits inside already active sub-chunks don't move any box, nothing to do
+            if (sameLayout && std::memcmp(aabbs.data(), blas.aabbs.data(), sizeof(aabbs[0]) * count) == 0)
+                continue;
+
+            refit = sameLayout && blas.refits < MAX_BLAS_REFITS;
+
+            if (!refit) {
+                // retire old AABB buffer, the previous build may still be in flight
+                retireBuffer(blas.aabbBuffer);
+
+                blas.aabbBuffer = createWorldBuffer(
+                    sizeof(vk::AabbPositionsKHR) * count,
+                    vk::BufferUsageFlagBits::eShaderDeviceAddress |
+                    vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
+                    vk::BufferUsageFlagBits::eStorageBuffer |
+                    vk::BufferUsageFlagBits::eTransferDst,
+                    MemoryCategory::Aabbs
+                );
+            }
+            // a refit overwrites in place, ordered after in-flight frames by the world update wait
+            recordUpload(cmd, aabbs.data(), sizeof(aabbs[0]) * count, blas.aabbBuffer);
+        }
 
-    // cleanup old BLAS if it exists
-    if (gpuWorld.blas.handle) {
-        m_device.destroyAccelerationStructureKHR(gpuWorld.blas.handle);
-        gpuWorld.blas.handle = nullptr;
-    }
-    if (gpuWorld.blas.buffer.handle) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.blas.buffer.handle, gpuWorld.blas.buffer.alloc);
-        gpuWorld.blas.buffer = {};
-    }
+        PendingBlasBuild p{};
 
-    // create blas buffer + as handle
-    gpuWorld.blas.buffer = createBuffer(
-            sizes.accelerationStructureSize,
-            vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
-            0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-            );
+        // build blas geo info
+        p.geom.geometryType = vk::GeometryTypeKHR::eAabbs;
+        p.geom.flags = vk::GeometryFlagBitsKHR::eOpaque;
+        p.geom.geometry.setAabbs({m_device.getBufferAddress({ blas.aabbBuffer.handle }), sizeof(vk::AabbPositionsKHR)});
 
-    vk::AccelerationStructureCreateInfoKHR ci{};
-    ci.buffer = gpuWorld.blas.buffer.handle;
-    ci.size = sizes.accelerationStructureSize;
-    ci.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+        p.range.primitiveCount = count;
 
-    gpuWorld.blas.handle = m_device.createAccelerationStructureKHR(ci);
+        // flags have to match between the build and every update of it
+        p.build.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
+        p.build.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+                        vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+        p.build.setGeometries(p.geom);
+        p.build.mode = refit ? vk::BuildAccelerationStructureModeKHR::eUpdate : vk::BuildAccelerationStructureModeKHR::eBuild;
 
-    // scratch buffer
-    Buffer scratch = createBuffer(
-        sizes.buildScratchSize,
-        vk::BufferUsageFlagBits::eStorageBuffer |
-        vk::BufferUsageFlagBits::eShaderDeviceAddress,
-        0, VMA_MEMORY_USAGE_AUTO
-    );
+        // query sizes
+        auto sizes = m_device.getAccelerationStructureBuildSizesKHR(
+            vk::AccelerationStructureBuildTypeKHR::eDevice,
+            p.build,
+            p.range.primitiveCount
+        );
 
-    vk::DeviceAddress scratchAddr =
-        m_device.getBufferAddress({ scratch.handle });
+        if (refit) {
+            // refit in place
+            p.build.srcAccelerationStructure = blas.as.handle;
+            blas.refits++;
+            refitCount++;
+        } else {
+            // retire old BLAS, the current TLAS still points at it until the new one is built
+            retireAccelerationStructure(blas.as);
+
+            blas.as.buffer = createWorldBuffer(
+                sizes.accelerationStructureSize,
+                vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+                MemoryCategory::Blas
+            );
 
-    build.dstAccelerationStructure = gpuWorld.blas.handle;
-    build.scratchData.deviceAddress = scratchAddr;
+            vk::AccelerationStructureCreateInfoKHR ci{};
+            ci.buffer = blas.as.buffer.handle;
+            ci.size = sizes.accelerationStructureSize;
+            ci.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
 
-    // build blas
-    m_uploadCmd.reset({});
-    m_uploadCmd.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+            blas.as.handle = m_device.createAccelerationStructureKHR(ci);
+            blas.refits = 0;
+        }
 
-    const vk::AccelerationStructureBuildRangeInfoKHR* pRange = &range;
-    m_uploadCmd.buildAccelerationStructuresKHR(
-        build,
-        pRange
-    );
+        p.build.dstAccelerationStructure = blas.as.handle;
 
-    m_uploadCmd.end();
-    vk::SubmitInfo submitInfo({}, {}, m_uploadCmd, {});
-    m_graphicsQueue.submit(submitInfo, {});
-    m_graphicsQueue.waitIdle();
+        // every build in the batch gets its own slice of the shared scratch
+        p.scratchOffset = scratchTotal;
+        scratchTotal += alignUp(refit ? sizes.updateScratchSize : sizes.buildScratchSize, scratchAlign);
 
-    vmaDestroyBuffer(m_allocator, scratch.handle, scratch.alloc);
+        blas.aabbs = std::move(aabbs);
+        pending.push_back(p);
+    }
 
-    std::cout << "BLAS built with " << count << " sub-chunk AABBs\n";
+    if (pending.empty()) return;
+
+    // aabb uploads -> blas builds
+    vk::MemoryBarrier2 uploadBarrier{};
+    uploadBarrier.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+    uploadBarrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+    uploadBarrier.dstStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR;
+    uploadBarrier.dstAccessMask = vk::AccessFlagBits2::eAccelerationStructureReadKHR | vk::AccessFlagBits2::eShaderRead;
+
+    vk::DependencyInfo uploadDep{};
+    uploadDep.memoryBarrierCount = 1;
+    uploadDep.pMemoryBarriers = &uploadBarrier;
+    cmd.pipelineBarrier2(uploadDep);
+
+    const vk::DeviceAddress scratch = ensureScratch(gpuWorld, scratchTotal);
+
+    // geometry pointers are only stable now that pending is done growing
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> builds;
+    std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> ranges;
+    builds.reserve(pending.size());
+    ranges.reserve(pending.size());
+    for (auto& p : pending) {
+        p.build.setGeometries(p.geom);
+        p.build.scratchData.deviceAddress = scratch + p.scratchOffset;
+        builds.push_back(p.build);
+        ranges.push_back(&p.range);
+    }
 
-    return gpuWorld.blas.handle;
-}
+    // build every changed chunk in one go
+    cmd.buildAccelerationStructuresKHR(builds, ranges);
 
-vk::AccelerationStructureKHR Renderer::buildChunkTlas(WorldSvoGpu &gpuWorld) {
-    uint32_t subChunkCount = gpuWorld.globalSubChunks.size();
-    if (subChunkCount == 0)
-        return {};
+    // blas builds -> tlas build (which also reuses the scratch buffer)
+    vk::MemoryBarrier2 buildBarrier{};
+    buildBarrier.srcStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR;
+    buildBarrier.srcAccessMask = vk::AccessFlagBits2::eAccelerationStructureWriteKHR;
+    buildBarrier.dstStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR;
+    buildBarrier.dstAccessMask = vk::AccessFlagBits2::eAccelerationStructureReadKHR | vk::AccessFlagBits2::eAccelerationStructureWriteKHR;
 
-    vk::AccelerationStructureInstanceKHR inst{};
-    inst.accelerationStructureReference =
-        m_device.getAccelerationStructureAddressKHR({ gpuWorld.blas.handle });
+    vk::DependencyInfo buildDep{};
+    buildDep.memoryBarrierCount = 1;
+    buildDep.pMemoryBarriers = &buildBarrier;
+    cmd.pipelineBarrier2(buildDep);
 
-    inst.instanceCustomIndex = 0;  // Not used since gl_PrimitiveID gives us the AABB index
-    inst.mask = 0xFF;
-    inst.instanceShaderBindingTableRecordOffset = 0;
-    inst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    BLOK_PROFILE_DETAIL(timer, std::to_string(pending.size() - refitCount) + " built, " + std::to_string(refitCount)
+        + " refit (" + std::to_string(gpuWorld.chunkBlas.size()) + " chunks)");
+}
 
-    // Identity transform (AABBs are already in world space)
-    std::array<std::array<float, 4>, 3> t = {{
-        {1.0f, 0.0f, 0.0f, 0.0f},
-        {0.0f, 1.0f, 0.0f, 0.0f},
-        {0.0f, 0.0f, 1.0f, 0.0f}
-    }};
-    inst.transform = vk::TransformMatrixKHR{t};
+vk::AccelerationStructureKHR Renderer::buildChunkTlas(WorldSvoGpu &gpuWorld, vk::CommandBuffer cmd) {
+    BLOK_PROFILE_SCOPE("buildChunkTlas");
+    // one instance per chunk blas, placed at the chunk's world origin.
+    // chunks inside an instance set get one instance per placement instead, all on the same blas
+    std::vector<vk::AccelerationStructureInstanceKHR> instances;
+    instances.reserve(gpuWorld.chunkBlas.size());
+    std::vector<TlasInstanceBounds> bounds;
+    bounds.reserve(gpuWorld.chunkBlas.size());
+
+    // rigid transforms only, so hit t matches world space. the hit shader rotates the face normal
+    auto addInstance = [&](const ChunkBlas& blas, const ChunkGpuRange& range, const glm::mat4& toWorld) {
+        vk::AccelerationStructureInstanceKHR inst{};
+        inst.accelerationStructureReference =
+            m_device.getAccelerationStructureAddressKHR({ blas.as.handle });
+
+        // first sub-chunk of the chunk's slot, shaders index subChunks[customIndex + primitiveId].
+        // the packer keeps slots under MAX_PACKED_SUB_CHUNKS, the field would wrap silently past it
+        const uint32_t customIndex = range.slot * gpuWorld.subChunksPerChunk;
+        if (customIndex >= MAX_PACKED_SUB_CHUNKS)
+            throw std::runtime_error("buildChunkTlas: chunk slot " + std::to_string(range.slot) + " is past the 24 bit instance custom index");
+        inst.instanceCustomIndex = customIndex;
+        inst.mask = 0xFF;
+        inst.instanceShaderBindingTableRecordOffset = 0;
+        inst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+
+        // chunk-local -> source world -> world, glm is column major
+        const glm::vec3 o = glm::vec3(toWorld * glm::vec4(range.origin, 1.0f));
+        std::array<std::array<float, 4>, 3> t = {{
+            {toWorld[0][0], toWorld[1][0], toWorld[2][0], o.x},
+            {toWorld[0][1], toWorld[1][1], toWorld[2][1], o.y},
+            {toWorld[0][2], toWorld[1][2], toWorld[2][2], o.z}
+        }};
+        inst.transform = vk::TransformMatrixKHR{t};
+
+        instances.push_back(inst);
+
+        // world box of the active sub-chunks, every corner through the placement. gpu built blases keep no
+        // boxes on the cpu, their instance gets an unbounded one and is never culled
+        const float big = std::numeric_limits<float>::max();
+        glm::vec3 localLo(big);
+        glm::vec3 localHi(-big);
+        for (const vk::AabbPositionsKHR& a : blas.aabbs) {
+            if (!aabbActive(a)) continue;
+            localLo = glm::min(localLo, glm::vec3(a.minX, a.minY, a.minZ));
+            localHi = glm::max(localHi, glm::vec3(a.maxX, a.maxY, a.maxZ));
+        }
+        if (localLo.x > localHi.x) {
+            bounds.push_back({ glm::vec4(-big), glm::vec4(big) });
+            return;
+        }
+        TlasInstanceBounds box{ glm::vec4(big), glm::vec4(-big) };
+        for (int c = 0; c < 8; ++c) {
+            const glm::vec3 local((c & 1) ? localHi.x : localLo.x, (c & 2) ? localHi.y : localLo.y, (c & 4) ? localHi.z : localLo.z);
+            const glm::vec4 p = toWorld * glm::vec4(range.origin + local, 1.0f);
+            box.lo = glm::min(box.lo, p);
+            box.hi = glm::max(box.hi, p);
+        }
+        bounds.push_back(box);
+    };
 
-    // Cleanup old instance buffer if it exists
-    if (gpuWorld.tlasInstanceBuffer.handle) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.tlasInstanceBuffer.handle, gpuWorld.tlasInstanceBuffer.alloc);
-        gpuWorld.tlasInstanceBuffer = {};
+    for (const auto& kv : gpuWorld.chunkBlas) {
+        if (!kv.second.as.handle) continue;
+        const ChunkGpuRange& range = gpuWorld.chunkRanges.at(kv.first);
+
+        bool instanced = false;
+        for (const ChunkInstanceSet& set : gpuWorld.instanceSets) {
+            if (!set.contains(kv.first)) continue;
+            for (const glm::mat4& m : set.transforms) addInstance(kv.second, range, m);
+            instanced = true;
+        }
+        if (!instanced) addInstance(kv.second, range, glm::mat4(1.0f));
     }
 
-    // Create instance buffer
-    gpuWorld.tlasInstanceBuffer = createBuffer(
-        sizeof(vk::AccelerationStructureInstanceKHR),
+    if (instances.empty())
+        return {};
+
+    // Instance buffer, grows with the chunk count
+    const vk::DeviceSize instanceBytes = sizeof(vk::AccelerationStructureInstanceKHR) * instances.size();
+    ensureBufferCapacity(gpuWorld.tlasInstanceBuffer, instanceBytes,
         vk::BufferUsageFlagBits::eTransferDst |
+        vk::BufferUsageFlagBits::eStorageBuffer | // tlas_cull.comp rewrites the masks
         vk::BufferUsageFlagBits::eShaderDeviceAddress |
         vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
-        0, VMA_MEMORY_USAGE_AUTO
-    );
-    uploadToBuffer(&inst, sizeof(inst), gpuWorld.tlasInstanceBuffer);
+        MemoryCategory::Tlas);
+    recordUpload(cmd, instances.data(), instanceBytes, gpuWorld.tlasInstanceBuffer);
+
+    const vk::DeviceSize boundsBytes = sizeof(TlasInstanceBounds) * bounds.size();
+    ensureBufferCapacity(gpuWorld.tlasInstanceBounds, boundsBytes,
+        vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer, MemoryCategory::Tlas);
+    recordUpload(cmd, bounds.data(), boundsBytes, gpuWorld.tlasInstanceBounds);
+    gpuWorld.tlasInstanceCount = static_cast<uint32_t>(instances.size());
+
+    // instance upload -> tlas build
+    vk::MemoryBarrier2 uploadBarrier{};
+    uploadBarrier.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+    uploadBarrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+    uploadBarrier.dstStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR;
+    uploadBarrier.dstAccessMask = vk::AccessFlagBits2::eAccelerationStructureReadKHR | vk::AccessFlagBits2::eShaderRead;
+
+    vk::DependencyInfo uploadDep{};
+    uploadDep.memoryBarrierCount = 1;
+    uploadDep.pMemoryBarriers = &uploadBarrier;
+    cmd.pipelineBarrier2(uploadDep);
 
     vk::DeviceAddress instAddr = m_device.getBufferAddress({ gpuWorld.tlasInstanceBuffer.handle });
 
     // Setup TLAS geometry
-    vk::AccelerationStructureGeometryInstancesDataKHR instances{};
-    instances.arrayOfPointers = VK_FALSE;
-    instances.data.deviceAddress = instAddr;
+    vk::AccelerationStructureGeometryInstancesDataKHR instanceData{};
+    instanceData.arrayOfPointers = VK_FALSE;
+    instanceData.data.deviceAddress = instAddr;
 
     vk::AccelerationStructureGeometryKHR geom{};
     geom.geometryType = vk::GeometryTypeKHR::eInstances;
-    geom.geometry.setInstances(instances);
+    geom.geometry.setInstances(instanceData);
 
     vk::AccelerationStructureBuildRangeInfoKHR range{};
-    range.primitiveCount = 1;
+    range.primitiveCount = static_cast<uint32_t>(instances.size());
 
     vk::AccelerationStructureBuildGeometryInfoKHR build{};
     build.type = vk::AccelerationStructureTypeKHR::eTopLevel;
-    build.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+    // updatable, the instance culling refits it with new masks every frame
+    build.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
     build.setGeometries(geom);
     build.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
 
@@ -198,22 +372,20 @@ vk::AccelerationStructureKHR Renderer::buildChunkTlas(WorldSvoGpu &gpuWorld) {
         range.primitiveCount
     );
 
-    // Cleanup old TLAS if it exists
-    if (gpuWorld.tlas.handle) {
-        m_device.destroyAccelerationStructureKHR(gpuWorld.tlas.handle);
-        gpuWorld.tlas.handle = nullptr;
-    }
-    if (gpuWorld.tlas.buffer.handle) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.tlas.buffer.handle, gpuWorld.tlas.buffer.alloc);
-        gpuWorld.tlas.buffer = {};
-    }
+    const vk::DeviceSize scratchAlign = std::max<vk::DeviceSize>(m_asProps.minAccelerationStructureScratchOffsetAlignment, 1);
+    ensureBufferCapacity(gpuWorld.tlasUpdateScratch, sizes.updateScratchSize + scratchAlign,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress, MemoryCategory::Scratch);
+    gpuWorld.tlasUpdateScratchSize = sizes.updateScratchSize;
+
+    // Retire old TLAS, descriptor sets of frames in flight still reference it
+    retireAccelerationStructure(gpuWorld.tlas);
 
     // Create TLAS buffer
-    gpuWorld.tlas.buffer = createBuffer(
+    gpuWorld.tlas.buffer = createWorldBuffer(
         sizes.accelerationStructureSize,
         vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
         vk::BufferUsageFlagBits::eShaderDeviceAddress,
-        0, VMA_MEMORY_USAGE_AUTO
+        MemoryCategory::Tlas
     );
 
     vk::AccelerationStructureCreateInfoKHR ci{};
@@ -223,32 +395,12 @@ vk::AccelerationStructureKHR Renderer::buildChunkTlas(WorldSvoGpu &gpuWorld) {
 
     gpuWorld.tlas.handle = m_device.createAccelerationStructureKHR(ci);
 
-    // Scratch buffer
-    Buffer scratch = createBuffer(
-        sizes.buildScratchSize,
-        vk::BufferUsageFlagBits::eStorageBuffer |
-        vk::BufferUsageFlagBits::eShaderDeviceAddress,
-        0, VMA_MEMORY_USAGE_AUTO
-    );
-
-    vk::DeviceAddress scratchAddr = m_device.getBufferAddress({ scratch.handle });
-
     build.dstAccelerationStructure = gpuWorld.tlas.handle;
-    build.scratchData.deviceAddress = scratchAddr;
-
-    // Build TLAS
-    m_uploadCmd.reset({});
-    m_uploadCmd.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    build.scratchData.deviceAddress = ensureScratch(gpuWorld, sizes.buildScratchSize);
 
+    // Build TLAS, frames wait on the world update's timeline value before tracing against it
     const vk::AccelerationStructureBuildRangeInfoKHR* pRange = &range;
-    m_uploadCmd.buildAccelerationStructuresKHR(build, pRange);
-
-    m_uploadCmd.end();
-    vk::SubmitInfo submitInfo({}, {}, m_uploadCmd, {});
-    m_graphicsQueue.submit(submitInfo, {});
-    m_graphicsQueue.waitIdle();
-
-    vmaDestroyBuffer(m_allocator, scratch.handle, scratch.alloc);
+    cmd.buildAccelerationStructuresKHR(build, pRange);
 
     return gpuWorld.tlas.handle;
 }
@@ -289,7 +441,7 @@ void RayTracing::createDescriptorSetLayout() {
     frameUBO.binding = 3;
     frameUBO.descriptorCount = 1;
     frameUBO.descriptorType = vk::DescriptorType::eUniformBuffer;
-    frameUBO.stageFlags = vk::ShaderStageFlagBits::eRaygenKHR;
+    frameUBO.stageFlags = vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eIntersectionKHR;
 
     // 4 = Output Image
     vk::DescriptorSetLayoutBinding outImg{};
@@ -331,21 +483,100 @@ void RayTracing::createDescriptorSetLayout() {
     mb.binding = 9;
     mb.descriptorCount = 1;
     mb.descriptorType = vk::DescriptorType::eStorageBuffer;
-    mb.stageFlags = vk::ShaderStageFlagBits::eClosestHitKHR;
-
-    std::array<vk::DescriptorSetLayoutBinding, 10> bindings =
-    { tlas, svoBuf, chunkBuf, frameUBO, outImg, wp, nr, am, mv, mb };
+    // raygen reads the material type for the reorder hint
+    mb.stageFlags = vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR;
+
+    // 10 = Leaf brick words
+    vk::DescriptorSetLayoutBinding brickBuf{};
+    brickBuf.binding = 10;
+    brickBuf.descriptorCount = 1;
+    brickBuf.descriptorType = vk::DescriptorType::eStorageBuffer;
+    brickBuf.stageFlags = vk::ShaderStageFlagBits::eIntersectionKHR;
+
+    // 11 = Emissive light list
+    vk::DescriptorSetLayoutBinding lightBuf{};
+    lightBuf.binding = 11;
+    lightBuf.descriptorCount = 1;
+    lightBuf.descriptorType = vk::DescriptorType::eStorageBuffer;
+    lightBuf.stageFlags = vk::ShaderStageFlagBits::eRaygenKHR;
+
+    // 12 = ReSTIR reservoirs, current frame
+    vk::DescriptorSetLayoutBinding curRes{};
+    curRes.binding = 12;
+    curRes.descriptorCount = 1;
+    curRes.descriptorType = vk::DescriptorType::eStorageBuffer;
+    curRes.stageFlags = vk::ShaderStageFlagBits::eRaygenKHR;
+
+    // 13 = ReSTIR reservoirs, previous frame
+    vk::DescriptorSetLayoutBinding prevRes = curRes;
+    prevRes.binding = 13;
+
+    // 14 = radiance cache cells
+    vk::DescriptorSetLayoutBinding cacheBuf = curRes;
+    cacheBuf.binding = 14;
+
+    // 15 = sample budget map
+    vk::DescriptorSetLayoutBinding budgetImg{};
+    budgetImg.binding = 15;
+    budgetImg.descriptorCount = 1;
+    budgetImg.descriptorType = vk::DescriptorType::eStorageImage;
+    budgetImg.stageFlags = vk::ShaderStageFlagBits::eRaygenKHR;
+
+    // 16 = rasterized primary visibility
+    vk::DescriptorSetLayoutBinding visImg = budgetImg;
+    visImg.binding = 16;
+
+    // 17 = empty space distance field
+    vk::DescriptorSetLayoutBinding emptySpaceBuf = brickBuf;
+    emptySpaceBuf.binding = 17;
+
+    // 18 = hdr environment + its alias table
+    vk::DescriptorSetLayoutBinding envBuf = lightBuf;
+    envBuf.binding = 18;
+
+    // 19 = traversal stats, per pixel + the launch scratch the svo walks add into
+    vk::DescriptorSetLayoutBinding statsBuf{};
+    statsBuf.binding = 19;
+    statsBuf.descriptorCount = 1;
+    statsBuf.descriptorType = vk::DescriptorType::eStorageBuffer;
+    statsBuf.stageFlags = vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eIntersectionKHR;
+
+    // 20 = traversal totals of the frame
+    vk::DescriptorSetLayoutBinding totalsBuf = lightBuf;
+    totalsBuf.binding = 20;
+
+    std::array<vk::DescriptorSetLayoutBinding, 21> bindings =
+    { tlas, svoBuf, chunkBuf, frameUBO, outImg, wp, nr, am, mv, mb, brickBuf, lightBuf, curRes, prevRes, cacheBuf, budgetImg, visImg,
+      emptySpaceBuf, envBuf, statsBuf, totalsBuf };
+
+    // the ray query build of raygen.rgen runs as compute and walks the svo itself
+    if (r->m_rayQuery)
+        for (auto& b : bindings)
+            if (b.stageFlags & (vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eIntersectionKHR))
+                b.stageFlags |= vk::ShaderStageFlagBits::eCompute;
 
     vk::DescriptorSetLayoutCreateInfo ci{};
     ci.bindingCount = static_cast<uint32_t>(bindings.size());
     ci.pBindings = bindings.data();
 
     rtSetLayout = r->m_device.createDescriptorSetLayout(ci);
+
+    // tlas_cull.comp
+    std::array<vk::DescriptorSetLayoutBinding, 2> cullBindings = {{
+        // 0: tlas instances, the masks are rewritten
+        {0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+        // 1: instance world bounds
+        {1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute},
+    }};
+    vk::DescriptorSetLayoutCreateInfo cullCi{};
+    cullCi.setBindings(cullBindings);
+    cullSetLayout = r->m_device.createDescriptorSetLayout(cullCi);
 }
 
 void RayTracing::allocateDescriptorSet() {
     for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
         rtSets[i] = r->m_descAlloc.allocate(r->m_device, rtSetLayout);
+        cullSets[i] = r->m_descAlloc.allocate(r->m_device, cullSetLayout);
     }
 }
 
@@ -353,6 +584,20 @@ void RayTracing::updateDescriptorSet(const WorldSvoGpu& gpu, uint32_t frameIndex
 {
     auto& gbuffer = r->m_denoiser.gbuffer;
     vk::DescriptorSet currentSet = rtSets[frameIndex];
+    auto& fr = r->m_frames[r->m_frameIndex];
+
+    // the world buffers get swapped on growth and the tlas on every world update, the images on resize
+    const bool changed = rtSetKeys[frameIndex].changed({
+        r->m_resizeGeneration, r->m_worldReadyValue, gbuffer.historyIndex,
+        descriptorKey(gpu.tlas.handle), descriptorKey(gpu.svoBuffer.handle), descriptorKey(gpu.subChunkBuffer.handle),
+        descriptorKey(gpu.brickBuffer.handle), descriptorKey(r->m_world->materialBuffer.handle), descriptorKey(fr.frameUBO.handle),
+        descriptorKey(gbuffer.color.view), descriptorKey(gbuffer.currentWorldPosition().view), descriptorKey(gbuffer.currentNormalRoughness().view),
+        descriptorKey(gbuffer.albedoMetallic.view), descriptorKey(gbuffer.motionVectors.view), descriptorKey(gpu.lightBuffer.handle),
+        descriptorKey(gpu.radianceCache.handle), descriptorKey(gbuffer.sampleBudget[sampleBudgetSlot(frameIndex)].view),
+        descriptorKey(gbuffer.visibility.view), descriptorKey(gpu.emptySpaceBuffer.handle), descriptorKey(r->m_environmentBuffer.handle),
+        descriptorKey(gbuffer.traversalStats.handle), descriptorKey(fr.traversalTotals.handle)
+    });
+    if (!changed) return;
 
     // Acceleration structure
     vk::WriteDescriptorSetAccelerationStructureKHR asInfo{};
@@ -392,11 +637,10 @@ void RayTracing::updateDescriptorSet(const WorldSvoGpu& gpu, uint32_t frameIndex
     chunkWrite.setBufferInfo(chunkInfo);
 
     // Frame UBO
-    auto& fr = r->m_frames[r->m_frameIndex];
     vk::DescriptorBufferInfo frameInfo{
         fr.frameUBO.handle,
         0,
-        VK_WHOLE_SIZE
+        sizeof(FrameUBO) // the rest of the ring is other per-frame data
     };
 
     vk::WriteDescriptorSet frameWrite{};
@@ -421,7 +665,7 @@ void RayTracing::updateDescriptorSet(const WorldSvoGpu& gpu, uint32_t frameIndex
     // Temporal Reprojection
     vk::DescriptorImageInfo wpInfo{
         nullptr,
-        gbuffer.worldPosition.view,
+        gbuffer.currentWorldPosition().view,
         vk::ImageLayout::eGeneral
     };
     vk::WriteDescriptorSet wpWrite{};
@@ -432,7 +676,7 @@ void RayTracing::updateDescriptorSet(const WorldSvoGpu& gpu, uint32_t frameIndex
 
     vk::DescriptorImageInfo nrInfo{
         nullptr,
-        gbuffer.normalRoughness.view,
+        gbuffer.currentNormalRoughness().view,
         vk::ImageLayout::eGeneral
     };
     vk::WriteDescriptorSet nrWrite{};
@@ -476,31 +720,176 @@ void RayTracing::updateDescriptorSet(const WorldSvoGpu& gpu, uint32_t frameIndex
     materialWrite.descriptorCount = 1;
     materialWrite.pBufferInfo = &materialInfo;
 
-    std::array<vk::WriteDescriptorSet,10> writes =
-    { asWrite, svoWrite, chunkWrite, frameWrite, imgWrite, wpWrite, nrWrite, amWrite, motionWrite, materialWrite };
+    // Brick SSBO
+    vk::DescriptorBufferInfo brickInfo{
+        gpu.brickBuffer.handle,
+        0, VK_WHOLE_SIZE
+    };
+
+    vk::WriteDescriptorSet brickWrite{};
+    brickWrite.dstSet = currentSet;
+    brickWrite.dstBinding = 10;
+    brickWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+    brickWrite.setBufferInfo(brickInfo);
+
+    // Light list
+    vk::DescriptorBufferInfo lightInfo{
+        gpu.lightBuffer.handle,
+        0, VK_WHOLE_SIZE
+    };
+
+    vk::WriteDescriptorSet lightWrite{};
+    lightWrite.dstSet = currentSet;
+    lightWrite.dstBinding = 11;
+    lightWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+    lightWrite.setBufferInfo(lightInfo);
+
+    // Reservoirs, flip with the history
+    vk::DescriptorBufferInfo curResInfo{ gbuffer.currentReservoirs().handle, 0, VK_WHOLE_SIZE };
+    vk::DescriptorBufferInfo prevResInfo{ gbuffer.previousReservoirs().handle, 0, VK_WHOLE_SIZE };
+
+    vk::WriteDescriptorSet curResWrite{};
+    curResWrite.dstSet = currentSet;
+    curResWrite.dstBinding = 12;
+    curResWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+    curResWrite.setBufferInfo(curResInfo);
+
+    vk::WriteDescriptorSet prevResWrite = curResWrite;
+    prevResWrite.dstBinding = 13;
+    prevResWrite.setBufferInfo(prevResInfo);
+
+    // Radiance cache
+    vk::DescriptorBufferInfo cacheInfo{ gpu.radianceCache.handle, 0, VK_WHOLE_SIZE };
+
+    vk::WriteDescriptorSet cacheWrite = curResWrite;
+    cacheWrite.dstBinding = 14;
+    cacheWrite.setBufferInfo(cacheInfo);
+
+    // Sample budget
+    vk::DescriptorImageInfo budgetInfo{ nullptr, gbuffer.sampleBudget[sampleBudgetSlot(frameIndex)].view, vk::ImageLayout::eGeneral };
+
+    vk::WriteDescriptorSet budgetWrite{};
+    budgetWrite.dstSet = currentSet;
+    budgetWrite.dstBinding = 15;
+    budgetWrite.descriptorType = vk::DescriptorType::eStorageImage;
+    budgetWrite.setImageInfo(budgetInfo);
+
+    // Rasterized primary visibility
+    vk::DescriptorImageInfo visInfo{ nullptr, gbuffer.visibility.view, vk::ImageLayout::eGeneral };
+
+    vk::WriteDescriptorSet visWrite = budgetWrite;
+    visWrite.dstBinding = 16;
+    visWrite.setImageInfo(visInfo);
+
+    // Empty space distance field
+    vk::DescriptorBufferInfo emptySpaceInfo{ gpu.emptySpaceBuffer.handle, 0, VK_WHOLE_SIZE };
+
+    vk::WriteDescriptorSet emptySpaceWrite = curResWrite;
+    emptySpaceWrite.dstBinding = 17;
+    emptySpaceWrite.setBufferInfo(emptySpaceInfo);
+
+    // Environment map
+    vk::DescriptorBufferInfo envInfo{ r->m_environmentBuffer.handle, 0, VK_WHOLE_SIZE };
+
+    vk::WriteDescriptorSet envWrite = curResWrite;
+    envWrite.dstBinding = 18;
+    envWrite.setBufferInfo(envInfo);
+
+    // Traversal stats + this frame's totals
+    vk::DescriptorBufferInfo statsInfo{ gbuffer.traversalStats.handle, 0, VK_WHOLE_SIZE };
+    vk::DescriptorBufferInfo totalsInfo{ fr.traversalTotals.handle, 0, VK_WHOLE_SIZE };
+
+    vk::WriteDescriptorSet statsWrite = curResWrite;
+    statsWrite.dstBinding = 19;
+    statsWrite.setBufferInfo(statsInfo);
+
+    vk::WriteDescriptorSet totalsWrite = curResWrite;
+    totalsWrite.dstBinding = 20;
+    totalsWrite.setBufferInfo(totalsInfo);
+
+    std::array<vk::WriteDescriptorSet,21> writes =
+    { asWrite, svoWrite, chunkWrite, frameWrite, imgWrite, wpWrite, nrWrite, amWrite, motionWrite, materialWrite, brickWrite, lightWrite,
+      curResWrite, prevResWrite, cacheWrite, budgetWrite, visWrite, emptySpaceWrite, envWrite, statsWrite, totalsWrite };
 
     r->m_device.updateDescriptorSets(writes, {});
 }
 
 void RayTracing::createPipeline() {
-    auto load = [&](const std::string& name, vk::ShaderStageFlagBits stage)
-    {
-        return r->m_shaderManager.loadModule("assets/shaders/" + name, stage);
+    // node layout has to match what packChunksToGpuSvo writes
+#ifdef BLOK_COMPACT_SVO_NODES
+    const std::string nodePreamble = "#define BLOK_COMPACT_SVO_NODES\n";
+#else
+    const std::string nodePreamble;
+#endif
+
+    // primary/bounce rays go through a hit object and are reordered by material before closest hit runs
+    std::string rgenPreamble = GBUFFER_SHADER_DEFINES;
+    if (r->m_invocationReorder != InvocationReorder::None) rgenPreamble += "#define BLOK_SER\n";
+    if (r->m_invocationReorder == InvocationReorder::EXT) rgenPreamble += "#define BLOK_SER_EXT\n";
+    // the payload layout has to agree between raygen, miss and closest hit
+    pipelineSlimPayload = settings.slimPayload;
+    const std::string payloadPreamble = pipelineSlimPayload ? "#define BLOK_SLIM_PAYLOAD\n" : "";
+
+    // all eight (nine with ray queries) compile side by side
+    std::vector<ShaderRequest> requests = {
+        {"assets/shaders/raygen.rgen", vk::ShaderStageFlagBits::eRaygenKHR, rgenPreamble + payloadPreamble},
+        {"assets/shaders/miss.rmiss", vk::ShaderStageFlagBits::eMissKHR, payloadPreamble},
+        {"assets/shaders/shadow.rmiss", vk::ShaderStageFlagBits::eMissKHR, {}},
+        {"assets/shaders/intersect.rint", vk::ShaderStageFlagBits::eIntersectionKHR, nodePreamble},
+        {"assets/shaders/intersect.rint", vk::ShaderStageFlagBits::eIntersectionKHR, nodePreamble + "#define BLOK_OCCLUSION_ONLY\n"},
+        {"assets/shaders/hit.rchit", vk::ShaderStageFlagBits::eClosestHitKHR, payloadPreamble},
+        {"assets/shaders/restir_spatial.rgen", vk::ShaderStageFlagBits::eRaygenKHR, GBUFFER_SHADER_DEFINES},
+        {"assets/shaders/radiance_cache.rgen", vk::ShaderStageFlagBits::eRaygenKHR, {}},
     };
-
-    vk::ShaderModule rgen = load("raygen.rgen", vk::ShaderStageFlagBits::eRaygenKHR).module;
-    vk::ShaderModule miss = load("miss.rmiss", vk::ShaderStageFlagBits::eMissKHR).module;
-    vk::ShaderModule missShadow = load("shadow.rmiss", vk::ShaderStageFlagBits::eMissKHR).module;
-    vk::ShaderModule isect = load("intersect.rint", vk::ShaderStageFlagBits::eIntersectionKHR).module;
-    vk::ShaderModule chit = load("hit.rchit", vk::ShaderStageFlagBits::eClosestHitKHR).module;
+    // no hit objects in compute, the ray query build never reorders
+    if (r->m_rayQuery)
+        requests.push_back({"assets/shaders/raygen.rgen", vk::ShaderStageFlagBits::eCompute,
+                            GBUFFER_SHADER_DEFINES + nodePreamble + "#define BLOK_RAY_QUERY\n"});
+    JobSystem* jobs = r->m_startupJobs.get();
+    const auto modules = r->m_shaderManager.loadModules(requests, jobs);
+
+    vk::ShaderModule rgen = modules[0].module;
+    vk::ShaderModule miss = modules[1].module;
+    vk::ShaderModule missShadow = modules[2].module;
+    vk::ShaderModule isect = modules[3].module;
+    vk::ShaderModule isectShadow = modules[4].module;
+    vk::ShaderModule chit = modules[5].module;
+    vk::ShaderModule restir = modules[6].module;
+    vk::ShaderModule cacheResolve = modules[7].module;
+
+    // quality preset, one constant block and every stage picks its own fields out of it
+    QualitySpecialization quality = qualitySpecialization(r->m_quality);
+    pipelineTraversalStats = settings.traversalStats;
+    quality.traversalStats = pipelineTraversalStats ? 1u : 0u;
+    const vk::SpecializationMapEntry rgenEntries[] = {
+        {0, offsetof(QualitySpecialization, sampleCount), sizeof(uint32_t)},
+        {1, offsetof(QualitySpecialization, maxBounces), sizeof(uint32_t)},
+        {2, offsetof(QualitySpecialization, traversalStats), sizeof(uint32_t)},
+    };
+    const vk::SpecializationMapEntry isectEntries[] = {
+        {0, offsetof(QualitySpecialization, maxIter), sizeof(uint32_t)},
+        {3, offsetof(QualitySpecialization, traversalStats), sizeof(uint32_t)},
+    };
+    const vk::SpecializationInfo rgenSpec{3, rgenEntries, sizeof(quality), &quality};
+    const vk::SpecializationMapEntry queryEntries[] = {
+        {0, offsetof(QualitySpecialization, sampleCount), sizeof(uint32_t)},
+        {1, offsetof(QualitySpecialization, maxBounces), sizeof(uint32_t)},
+        {2, offsetof(QualitySpecialization, maxIter), sizeof(uint32_t)},
+        {5, offsetof(QualitySpecialization, traversalStats), sizeof(uint32_t)},
+    };
+    const vk::SpecializationInfo isectSpec{2, isectEntries, sizeof(quality), &quality};
+    const vk::SpecializationInfo querySpec{4, queryEntries, sizeof(quality), &quality};
 
     // Shader stages
     std::vector<vk::PipelineShaderStageCreateInfo> stages = {
-    { {}, vk::ShaderStageFlagBits::eRaygenKHR, rgen, "main" },
+    { {}, vk::ShaderStageFlagBits::eRaygenKHR, rgen, "main", &rgenSpec },
     { {}, vk::ShaderStageFlagBits::eMissKHR, miss, "main" },
     { {}, vk::ShaderStageFlagBits::eMissKHR, missShadow, "main" },
-    { {}, vk::ShaderStageFlagBits::eIntersectionKHR, isect, "main" },
-    { {}, vk::ShaderStageFlagBits::eClosestHitKHR, chit, "main" }
+    { {}, vk::ShaderStageFlagBits::eIntersectionKHR, isect, "main", &isectSpec },
+    { {}, vk::ShaderStageFlagBits::eClosestHitKHR, chit, "main" },
+    { {}, vk::ShaderStageFlagBits::eIntersectionKHR, isectShadow, "main", &isectSpec },
+    { {}, vk::ShaderStageFlagBits::eRaygenKHR, restir, "main" },
+    { {}, vk::ShaderStageFlagBits::eRaygenKHR, cacheResolve, "main" }
     };
 
     // Shader groups
@@ -546,16 +935,36 @@ void RayTracing::createPipeline() {
         .setAnyHitShader(VK_SHADER_UNUSED_KHR)
     );
 
-    // group 4: hit group for shadows
+    // group 4: hit group for shadows, occlusion-only intersection
     groups.push_back(
         vk::RayTracingShaderGroupCreateInfoKHR{}
         .setType(vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup)
         .setGeneralShader(VK_SHADER_UNUSED_KHR)
-        .setIntersectionShader(3)
+        .setIntersectionShader(5)
         .setClosestHitShader(VK_SHADER_UNUSED_KHR)
         .setAnyHitShader(VK_SHADER_UNUSED_KHR)
     );
 
+    // group 5: ReSTIR spatial reuse raygen, traced with its own rgen region
+    groups.push_back(
+        vk::RayTracingShaderGroupCreateInfoKHR{}
+        .setType(vk::RayTracingShaderGroupTypeKHR::eGeneral)
+        .setGeneralShader(6)
+        .setClosestHitShader(VK_SHADER_UNUSED_KHR)
+        .setAnyHitShader(VK_SHADER_UNUSED_KHR)
+        .setIntersectionShader(VK_SHADER_UNUSED_KHR)
+    );
+
+    // group 6: radiance cache resolve raygen
+    groups.push_back(
+        vk::RayTracingShaderGroupCreateInfoKHR{}
+        .setType(vk::RayTracingShaderGroupTypeKHR::eGeneral)
+        .setGeneralShader(7)
+        .setClosestHitShader(VK_SHADER_UNUSED_KHR)
+        .setAnyHitShader(VK_SHADER_UNUSED_KHR)
+        .setIntersectionShader(VK_SHADER_UNUSED_KHR)
+    );
+
     // Layout
     vk::PipelineLayoutCreateInfo lci{};
     lci.setLayoutCount = 1;
@@ -572,16 +981,253 @@ void RayTracing::createPipeline() {
     pci.maxPipelineRayRecursionDepth = 10;
     pci.layout = rtPipeline.layout;
 
+    // as a deferred operation the driver can spread the compile over the startup workers.
+    // everything pci points at has to stay alive until the operation is done, so this blocks until then
+    vk::DeferredOperationKHR deferred{};
+    if (jobs) deferred = r->m_device.createDeferredOperationKHR();
+
     auto res = r->m_device.createRayTracingPipelinesKHR(
-    nullptr, nullptr, pci);
+    deferred, r->m_pipelineCache, pci);
+
+    if (res.result == vk::Result::eOperationDeferredKHR) {
+        auto join = [&] {
+            // idle = nothing to pick up right now but not finished either
+            vk::Result jr;
+            while ((jr = r->m_device.deferredOperationJoinKHR(deferred)) == vk::Result::eThreadIdleKHR)
+                std::this_thread::yield();
+        };
+
+        const uint32_t maxThreads = r->m_device.getDeferredOperationMaxConcurrencyKHR(deferred);
+        const uint32_t helpers = std::max(std::min(maxThreads, jobs->workerCount() + 1), 1u) - 1;
+        JobCounter joined;
+        for (uint32_t i = 0; i < helpers; ++i) jobs->submit(join, &joined);
+        join();
+        jobs->wait(joined);
+
+        const vk::Result dr = r->m_device.getDeferredOperationResultKHR(deferred);
+        if (dr != vk::Result::eSuccess)
+            throw std::runtime_error("Vulkan API: ray tracing pipeline creation failed (" + vk::to_string(dr) + ")");
+    }
+    if (deferred) r->m_device.destroyDeferredOperationKHR(deferred);
 
     rtPipeline.pipeline = res.value[0];
 
+    if (r->m_rayQuery) {
+        vk::ComputePipelineCreateInfo qci{};
+        qci.stage = vk::PipelineShaderStageCreateInfo{ {}, vk::ShaderStageFlagBits::eCompute, modules[8].module, "main", &querySpec };
+        qci.layout = rtPipeline.layout;
+        rtPipeline.queryPipeline = r->m_device.createComputePipeline(r->m_pipelineCache, qci).value;
+        r->m_device.destroyShaderModule(modules[8].module);
+    }
+
     r->m_device.destroyShaderModule(rgen);
     r->m_device.destroyShaderModule(miss);
     r->m_device.destroyShaderModule(isect);
+    r->m_device.destroyShaderModule(isectShadow);
     r->m_device.destroyShaderModule(chit);
     r->m_device.destroyShaderModule(missShadow);
+    r->m_device.destroyShaderModule(restir);
+    r->m_device.destroyShaderModule(cacheResolve);
+}
+
+void RayTracing::destroyPipeline() {
+    auto& device = r->m_device;
+    if (rtPipeline.layout) { device.destroyPipelineLayout(rtPipeline.layout); }
+    if (rtPipeline.pipeline) { device.destroyPipeline(rtPipeline.pipeline); }
+    if (rtPipeline.queryPipeline) { device.destroyPipeline(rtPipeline.queryPipeline); }
+
+    for (Buffer* b : {&rtPipeline.rgenSBT, &rtPipeline.hitSBT, &rtPipeline.missSBT, &rtPipeline.restirSBT, &rtPipeline.radianceCacheSBT})
+        if (b->handle) { vmaDestroyBuffer(r->m_allocator, b->handle, b->alloc); }
+
+    rtPipeline = {};
+}
+
+void RayTracing::reloadShaders(const std::vector<std::string>& changed) {
+    if (shaderChanged(changed, "assets/shaders/visibility.vert") || shaderChanged(changed, "assets/shaders/visibility.frag")) {
+        vk::Pipeline oldPipeline = visibilityPipeline;
+        vk::PipelineLayout oldLayout = visibilityLayout;
+        try {
+            createVisibilityPipeline();
+            r->retirePipeline(oldPipeline, oldLayout);
+        } catch (const std::exception& e) {
+            std::cerr << "[Shader] " << e.what() << std::endl;
+            if (visibilityLayout != oldLayout) r->m_device.destroyPipelineLayout(visibilityLayout);
+            visibilityPipeline = oldPipeline;
+            visibilityLayout = oldLayout;
+        }
+    }
+
+    if (shaderChanged(changed, "assets/shaders/tlas_cull.comp"))
+        r->rebuildPipeline(cullPipeline, cullLayout, [this] { createCullPipeline(); });
+
+    const char* sources[] = {
+        "assets/shaders/raygen.rgen", "assets/shaders/miss.rmiss", "assets/shaders/shadow.rmiss",
+        "assets/shaders/intersect.rint", "assets/shaders/hit.rchit", "assets/shaders/restir_spatial.rgen",
+        "assets/shaders/radiance_cache.rgen",
+    };
+    if (std::none_of(std::begin(sources), std::end(sources), [&](const char* s) { return shaderChanged(changed, s); }))
+        return;
+
+    // the sbt holds this pipeline's group handles, so both are replaced together
+    RayTracingPipeline old = rtPipeline;
+    rtPipeline = {};
+    try {
+        createPipeline();
+        createSBT();
+    } catch (const std::exception& e) {
+        std::cerr << "[Shader] " << e.what() << std::endl;
+        destroyPipeline();
+        rtPipeline = old;
+        return;
+    }
+
+    r->retirePipeline(old.pipeline, old.layout);
+    vk::PipelineLayout sharedLayout{};
+    r->retirePipeline(old.queryPipeline, sharedLayout);
+    r->retireBuffer(old.rgenSBT);
+    r->retireBuffer(old.missSBT);
+    r->retireBuffer(old.hitSBT);
+    r->retireBuffer(old.restirSBT);
+    r->retireBuffer(old.radianceCacheSBT);
+}
+
+void RayTracing::createVisibilityPipeline() {
+    const ShaderRequest requests[] = {
+        {"assets/shaders/visibility.vert", vk::ShaderStageFlagBits::eVertex, {}},
+        {"assets/shaders/visibility.frag", vk::ShaderStageFlagBits::eFragment, {}},
+    };
+    const auto modules = r->m_shaderManager.loadModules(requests, r->m_startupJobs.get());
+
+    std::array<vk::PipelineShaderStageCreateInfo, 2> stages{};
+    stages[0].stage = vk::ShaderStageFlagBits::eVertex;
+    stages[0].module = modules[0].module;
+    stages[0].pName = "main";
+    stages[1].stage = vk::ShaderStageFlagBits::eFragment;
+    stages[1].module = modules[1].module;
+    stages[1].pName = "main";
+
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(VisibilityPC);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    visibilityLayout = r->m_device.createPipelineLayout(layoutInfo);
+
+    vk::VertexInputBindingDescription binding{0, sizeof(SurfaceVertexGpu), vk::VertexInputRate::eVertex};
+    const std::array<vk::VertexInputAttributeDescription, 4> attributes = {{
+        {0, 0, vk::Format::eR32G32B32Sfloat, offsetof(SurfaceVertexGpu, position)},
+        {1, 0, vk::Format::eR32Uint, offsetof(SurfaceVertexGpu, materialFace)},
+        {2, 0, vk::Format::eR32Uint, offsetof(SurfaceVertexGpu, subChunk)},
+        {3, 0, vk::Format::eR32Uint, offsetof(SurfaceVertexGpu, normal)},
+    }};
+
+    vk::PipelineVertexInputStateCreateInfo vertexInput{};
+    vertexInput.setVertexBindingDescriptions(binding);
+    vertexInput.setVertexAttributeDescriptions(attributes);
+
+    vk::PipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.topology = vk::PrimitiveTopology::eTriangleList;
+
+    vk::PipelineViewportStateCreateInfo viewport{};
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+
+    // both sides, the mesher doesn't keep a winding and the depth test picks the nearest face anyway
+    vk::PipelineRasterizationStateCreateInfo raster{};
+    raster.polygonMode = vk::PolygonMode::eFill;
+    raster.cullMode = vk::CullModeFlagBits::eNone;
+    raster.lineWidth = 1.0f;
+
+    vk::PipelineMultisampleStateCreateInfo multisample{};
+    multisample.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+    vk::PipelineDepthStencilStateCreateInfo depth{};
+    depth.depthTestEnable = VK_TRUE;
+    depth.depthWriteEnable = VK_TRUE;
+    depth.depthCompareOp = vk::CompareOp::eLess;
+
+    vk::PipelineColorBlendAttachmentState blendAttachment{};
+    blendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    vk::PipelineColorBlendStateCreateInfo blend{};
+    blend.setAttachments(blendAttachment);
+
+    const std::array<vk::DynamicState, 2> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    vk::PipelineDynamicStateCreateInfo dynamic{};
+    dynamic.setDynamicStates(dynamicStates);
+
+    const vk::Format colorFormat = vk::Format::eR32G32B32A32Uint;
+    vk::PipelineRenderingCreateInfo rendering{};
+    rendering.colorAttachmentCount = 1;
+    rendering.pColorAttachmentFormats = &colorFormat;
+    rendering.depthAttachmentFormat = r->m_depthFormat;
+
+    vk::GraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.pNext = &rendering;
+    pipelineInfo.setStages(stages);
+    pipelineInfo.pVertexInputState = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewport;
+    pipelineInfo.pRasterizationState = &raster;
+    pipelineInfo.pMultisampleState = &multisample;
+    pipelineInfo.pDepthStencilState = &depth;
+    pipelineInfo.pColorBlendState = &blend;
+    pipelineInfo.pDynamicState = &dynamic;
+    pipelineInfo.layout = visibilityLayout;
+
+    auto result = r->m_device.createGraphicsPipeline(r->m_pipelineCache, pipelineInfo);
+    visibilityPipeline = result.value;
+
+    r->m_device.destroyShaderModule(modules[0].module);
+    r->m_device.destroyShaderModule(modules[1].module);
+}
+
+void RayTracing::destroyVisibilityPipeline() {
+    auto& device = r->m_device;
+    if (visibilityPipeline) { device.destroyPipeline(visibilityPipeline); }
+    if (visibilityLayout) { device.destroyPipelineLayout(visibilityLayout); }
+    visibilityPipeline = nullptr;
+    visibilityLayout = nullptr;
+}
+
+void RayTracing::createCullPipeline() {
+    auto shaderModule = r->m_shaderManager.loadModule("assets/shaders/tlas_cull.comp", vk::ShaderStageFlagBits::eCompute, {});
+
+    vk::PipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+    stageInfo.module = shaderModule.module;
+    stageInfo.pName = "main";
+
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(TlasCullPC);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &cullSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    cullLayout = r->m_device.createPipelineLayout(layoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = cullLayout;
+    auto result = r->m_device.createComputePipeline(r->m_pipelineCache, pipelineInfo);
+    cullPipeline = result.value;
+
+    r->m_device.destroyShaderModule(shaderModule.module);
+}
+
+void RayTracing::destroyCullPipeline() {
+    auto& device = r->m_device;
+    if (cullPipeline) { device.destroyPipeline(cullPipeline); }
+    if (cullLayout) { device.destroyPipelineLayout(cullLayout); }
+    cullPipeline = nullptr;
+    cullLayout = nullptr;
 }
 
 void RayTracing::createSBT() {
@@ -591,7 +1237,7 @@ void RayTracing::createSBT() {
     const uint32_t baseAlignment      = props.shaderGroupBaseAlignment;      // e.g. 64
     const uint32_t handleSizeAligned  = (handleSize + baseAlignment - 1) & ~(baseAlignment - 1);
 
-    const uint32_t groupCount = 5; // rgen, miss, hit
+    const uint32_t groupCount = 7; // rgen, miss, hit, restir rgen, cache rgen
 
     std::vector<uint8_t> handles(groupCount * handleSize);
 
@@ -660,10 +1306,115 @@ void RayTracing::createSBT() {
     //Hit (Radiance Hit, Shadow Hit)
     makeSBT(rtPipeline.hitSBT,  rtPipeline.hitRegion,  3, 2);
 
+    // ReSTIR spatial raygen
+    makeSBT(rtPipeline.restirSBT, rtPipeline.restirRegion, 5, 1);
+
+    // radiance cache resolve raygen
+    makeSBT(rtPipeline.radianceCacheSBT, rtPipeline.radianceCacheRegion, 6, 1);
+
     rtPipeline.callRegion = vk::StridedDeviceAddressRegionKHR{};
 }
 
+uint32_t RayTracing::sampleBudgetSlot(uint32_t frameIndex) const {
+    return r->m_asyncCompute ? frameIndex : (frameIndex + r->m_framesInFlight - 1) % r->m_framesInFlight;
+}
+
+void RayTracing::drawVisibility(vk::CommandBuffer cmd, const WorldSvoGpu& gpu) {
+    if (gpu.surfaceDrawCount == 0) return;
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, visibilityPipeline);
+    cmd.pushConstants(visibilityLayout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        0, sizeof(VisibilityPC), &visibilityPC);
+
+    const vk::DeviceSize offset = 0;
+    cmd.bindVertexBuffers(0, 1, &gpu.surfaceBuffer.handle, &offset);
+    cmd.draw(gpu.surfaceDrawCount, 1, 0, 0);
+}
+
+void RayTracing::recordTlasCull(vk::CommandBuffer cmd, WorldSvoGpu& gpu, uint32_t frameIndex) {
+    if (gpu.tlasInstanceCount == 0) return;
+
+    // both buffers are replaced together with the tlas
+    if (cullSetKeys[frameIndex].changed({ descriptorKey(gpu.tlasInstanceBuffer.handle), descriptorKey(gpu.tlasInstanceBounds.handle) })) {
+        vk::DescriptorBufferInfo instanceInfo{ gpu.tlasInstanceBuffer.handle, 0, VK_WHOLE_SIZE };
+        vk::DescriptorBufferInfo boundsInfo{ gpu.tlasInstanceBounds.handle, 0, VK_WHOLE_SIZE };
+        std::array<vk::WriteDescriptorSet, 2> writes{};
+        writes[0] = { cullSets[frameIndex], 0, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &instanceInfo };
+        writes[1] = { cullSets[frameIndex], 1, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &boundsInfo };
+        r->m_device.updateDescriptorSets(writes, {});
+    }
+
+    auto barrier = [&](vk::PipelineStageFlags2 srcStage, vk::AccessFlags2 srcAccess, vk::PipelineStageFlags2 dstStage, vk::AccessFlags2 dstAccess) {
+        vk::MemoryBarrier2 b{};
+        b.srcStageMask = srcStage;
+        b.srcAccessMask = srcAccess;
+        b.dstStageMask = dstStage;
+        b.dstAccessMask = dstAccess;
+        vk::DependencyInfo dep{};
+        dep.memoryBarrierCount = 1;
+        dep.pMemoryBarriers = &b;
+        cmd.pipelineBarrier2(dep);
+    };
+    using S = vk::PipelineStageFlagBits2;
+    using A = vk::AccessFlagBits2;
+
+    // the previous frame's trace and refit are done with the instances before the masks change
+    // (the ray query trace reads it from compute)
+    barrier(S::eRayTracingShaderKHR | S::eComputeShader | S::eAccelerationStructureBuildKHR,
+        A::eAccelerationStructureReadKHR | A::eAccelerationStructureWriteKHR, S::eComputeShader, A::eShaderRead | A::eShaderWrite);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullLayout, 0, 1, &cullSets[frameIndex], 0, nullptr);
+    cullPC.instanceCount = gpu.tlasInstanceCount;
+    cmd.pushConstants(cullLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(TlasCullPC), &cullPC);
+    cmd.dispatch((gpu.tlasInstanceCount + 63) / 64, 1, 1);
+
+    barrier(S::eComputeShader, A::eShaderWrite,
+        S::eAccelerationStructureBuildKHR, A::eAccelerationStructureReadKHR | A::eShaderRead);
+
+    // same instances and flags as buildChunkTlas, only the masks differ, so an update in place is enough
+    vk::AccelerationStructureGeometryInstancesDataKHR instanceData{};
+    instanceData.arrayOfPointers = VK_FALSE;
+    instanceData.data.deviceAddress = r->m_device.getBufferAddress({ gpu.tlasInstanceBuffer.handle });
+
+    vk::AccelerationStructureGeometryKHR geom{};
+    geom.geometryType = vk::GeometryTypeKHR::eInstances;
+    geom.geometry.setInstances(instanceData);
+
+    vk::AccelerationStructureBuildRangeInfoKHR range{};
+    range.primitiveCount = gpu.tlasInstanceCount;
+
+    const vk::DeviceSize scratchAlign = std::max<vk::DeviceSize>(r->m_asProps.minAccelerationStructureScratchOffsetAlignment, 1);
+    vk::AccelerationStructureBuildGeometryInfoKHR build{};
+    build.type = vk::AccelerationStructureTypeKHR::eTopLevel;
+    build.flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+    build.setGeometries(geom);
+    build.mode = vk::BuildAccelerationStructureModeKHR::eUpdate;
+    build.srcAccelerationStructure = gpu.tlas.handle;
+    build.dstAccelerationStructure = gpu.tlas.handle;
+    build.scratchData.deviceAddress = r->alignUp(r->m_device.getBufferAddress({ gpu.tlasUpdateScratch.handle }), scratchAlign);
+
+    const vk::AccelerationStructureBuildRangeInfoKHR* pRange = &range;
+    cmd.buildAccelerationStructuresKHR(build, pRange);
+
+    barrier(S::eAccelerationStructureBuildKHR, A::eAccelerationStructureWriteKHR,
+        S::eRayTracingShaderKHR | S::eComputeShader, A::eAccelerationStructureReadKHR);
+
+    tlasCulled = cullPC.enabled != 0;
+}
+
 void RayTracing::dispatchRayTracing(vk::CommandBuffer cmd, uint32_t w, uint32_t h, uint32_t frameIndex) {
+    const uint32_t launchW = framePattern == TracePattern::Full ? w : (w + 1) / 2;
+    const uint32_t launchH = framePattern == TracePattern::Quarter ? (h + 1) / 2 : h;
+
+    if (frameQuery) {
+        // same set, the layout is shared with the rt pipeline. 8x8 groups, raygen drops the threads past the launch
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, rtPipeline.queryPipeline);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, rtPipeline.layout, 0, rtSets[frameIndex], {});
+        cmd.dispatch((launchW + 7) / 8, (launchH + 7) / 8, 1);
+        return;
+    }
+
     cmd.bindPipeline(
         vk::PipelineBindPoint::eRayTracingKHR,
         rtPipeline.pipeline
@@ -680,6 +1431,58 @@ void RayTracing::dispatchRayTracing(vk::CommandBuffer cmd, uint32_t w, uint32_t
         rtPipeline.missRegion,
         rtPipeline.hitRegion,
         rtPipeline.callRegion,
+        launchW,
+        launchH,
+        1
+    );
+}
+
+void RayTracing::dispatchRestirSpatial(vk::CommandBuffer cmd, uint32_t w, uint32_t h, uint32_t frameIndex) {
+    // same pipeline and set as the trace, only the raygen record differs
+    cmd.bindPipeline(
+        vk::PipelineBindPoint::eRayTracingKHR,
+        rtPipeline.pipeline
+    );
+
+    cmd.bindDescriptorSets(
+        vk::PipelineBindPoint::eRayTracingKHR,
+        rtPipeline.layout,
+        0, rtSets[frameIndex], {}
+    );
+
+    cmd.traceRaysKHR(
+        rtPipeline.restirRegion,
+        rtPipeline.missRegion,
+        rtPipeline.hitRegion,
+        rtPipeline.callRegion,
+        w, h, 1
+    );
+}
+
+void RayTracing::dispatchRadianceCache(vk::CommandBuffer cmd, uint32_t cellCount, uint32_t frameIndex) {
+    if (cellCount == 0) return;
+
+    // rows of RADIANCE_CACHE_ROW cells, a 1d launch would run past maxRayDispatchInvocationCount's width on big worlds
+    constexpr uint32_t RADIANCE_CACHE_ROW = 4096;
+    const uint32_t w = std::min(cellCount, RADIANCE_CACHE_ROW);
+    const uint32_t h = (cellCount + RADIANCE_CACHE_ROW - 1) / RADIANCE_CACHE_ROW;
+
+    cmd.bindPipeline(
+        vk::PipelineBindPoint::eRayTracingKHR,
+        rtPipeline.pipeline
+    );
+
+    cmd.bindDescriptorSets(
+        vk::PipelineBindPoint::eRayTracingKHR,
+        rtPipeline.layout,
+        0, rtSets[frameIndex], {}
+    );
+
+    cmd.traceRaysKHR(
+        rtPipeline.radianceCacheRegion,
+        rtPipeline.missRegion,
+        rtPipeline.hitRegion,
+        rtPipeline.callRegion,
         w, h, 1
     );
 }
@@ -0,0 +1,382 @@
+/*
+* File: renderer_svo_build.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+
+#include "renderer_svo_build.hpp"
+#include "renderer.hpp"
+#include "cpu_profiler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+
+namespace blok {
+
+namespace {
+
+// cells above level l, same as the shader
+uint32_t levelStart(uint32_t l) { return ((1u << (3u * l)) - 1u) / 7u; }
+
+uint32_t groupsFor(uint32_t threads, uint32_t localSize) { return (threads + localSize - 1) / localSize; }
+
+// where one job's data lives in the input + scratch buffers, in words
+struct BuildLayout {
+    SvoBuildPushConstants pc{};
+    uint32_t brickLevel = 0;
+    uint32_t subChunks = 0;
+    uint32_t brushThreads = 0; // one per voxel of the bricks the brushes reach
+};
+
+void passBarrier(vk::CommandBuffer cmd, vk::PipelineStageFlags2 srcStage, vk::AccessFlags2 srcAccess,
+                 vk::PipelineStageFlags2 dstStage, vk::AccessFlags2 dstAccess) {
+    vk::MemoryBarrier2 barrier{};
+    barrier.srcStageMask = srcStage;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = dstStage;
+    barrier.dstAccessMask = dstAccess;
+
+    vk::DependencyInfo dep{};
+    dep.memoryBarrierCount = 1;
+    dep.pMemoryBarriers = &barrier;
+    cmd.pipelineBarrier2(dep);
+}
+
+void computeBarrier(vk::CommandBuffer cmd) {
+    passBarrier(cmd,
+        vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderWrite,
+        vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite);
+}
+
+}
+
+SvoBuilder::SvoBuilder(Renderer* r)
+    : renderer(r) {}
+
+void SvoBuilder::init() {
+    createDescriptorSetLayout();
+    createPipelines();
+}
+
+void SvoBuilder::cleanup() {
+    auto& device = renderer->m_device;
+
+    for (vk::Pipeline* p : {&pipeline.brushPipeline, &pipeline.bricksPipeline, &pipeline.reducePipeline, &pipeline.scanPipeline,
+                            &pipeline.emitPipeline, &pipeline.subChunksPipeline}) {
+        if (*p) {
+            device.destroyPipeline(*p);
+            *p = nullptr;
+        }
+    }
+    if (pipeline.pipelineLayout) {
+        device.destroyPipelineLayout(pipeline.pipelineLayout);
+        pipeline.pipelineLayout = nullptr;
+    }
+    if (pipeline.setLayout) {
+        device.destroyDescriptorSetLayout(pipeline.setLayout);
+        pipeline.setLayout = nullptr;
+    }
+
+    // sets go back with the renderer's descriptor allocator
+    m_sets.clear();
+}
+
+void SvoBuilder::reloadShaders(const std::vector<std::string>& changed) {
+    if (!shaderChanged(changed, "assets/shaders/svo_build.comp")) return;
+
+    auto passes = [](SvoBuildPipeline& p) {
+        return std::array<vk::Pipeline*, 6>{&p.brushPipeline, &p.bricksPipeline, &p.reducePipeline, &p.scanPipeline,
+                                            &p.emitPipeline, &p.subChunksPipeline};
+    };
+
+    SvoBuildPipeline old = pipeline;
+    try {
+        createPipelines();
+    } catch (const std::exception& e) {
+        std::cerr << "[Shader] " << e.what() << std::endl;
+        // whatever got created before the error goes, the old set stays
+        auto& device = renderer->m_device;
+        const auto now = passes(pipeline);
+        const auto before = passes(old);
+        for (size_t i = 0; i < now.size(); ++i)
+            if (*now[i] != *before[i]) device.destroyPipeline(*now[i]);
+        if (pipeline.pipelineLayout != old.pipelineLayout) device.destroyPipelineLayout(pipeline.pipelineLayout);
+        pipeline = old;
+        return;
+    }
+
+    vk::PipelineLayout noLayout{};
+    for (vk::Pipeline* p : passes(old)) renderer->retirePipeline(*p, noLayout);
+    vk::Pipeline noPipeline{};
+    renderer->retirePipeline(noPipeline, old.pipelineLayout);
+}
+
+void SvoBuilder::createDescriptorSetLayout() {
+    // voxel input, scratch, nodes, brick words, sub-chunks
+    std::array<vk::DescriptorSetLayoutBinding, 5> bindings{};
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    pipeline.setLayout = renderer->m_device.createDescriptorSetLayout(layoutInfo);
+}
+
+void SvoBuilder::createPipelines() {
+    vk::PushConstantRange pushRange{};
+    pushRange.stageFlags = vk::ShaderStageFlagBits::eCompute;
+    pushRange.offset = 0;
+    pushRange.size = sizeof(SvoBuildPushConstants);
+
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &pipeline.setLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    pipeline.pipelineLayout = renderer->m_device.createPipelineLayout(layoutInfo);
+
+#ifdef BLOK_COMPACT_SVO_NODES
+    const std::string nodeDefine = "#define BLOK_COMPACT_SVO_NODES\n";
+#else
+    const std::string nodeDefine;
+#endif
+
+    const std::pair<const char*, vk::Pipeline*> passes[] = {
+        {"#define SVO_BUILD_BRUSH\n", &pipeline.brushPipeline},
+        {"#define SVO_BUILD_BRICKS\n", &pipeline.bricksPipeline},
+        {"#define SVO_BUILD_REDUCE\n", &pipeline.reducePipeline},
+        {"#define SVO_BUILD_SCAN\n", &pipeline.scanPipeline},
+        {"#define SVO_BUILD_EMIT\n", &pipeline.emitPipeline},
+        {"#define SVO_BUILD_SUBCHUNKS\n", &pipeline.subChunksPipeline},
+    };
+
+    // one variant per job while the renderer starts up
+    for (const auto& pass : passes) renderer->startupJob([this, out = pass.second, preamble = pass.first + nodeDefine] {
+        auto shaderModule = renderer->m_shaderManager.loadModule(
+            "assets/shaders/svo_build.comp",
+            vk::ShaderStageFlagBits::eCompute,
+            preamble
+        );
+
+        vk::PipelineShaderStageCreateInfo stageInfo{};
+        stageInfo.stage = vk::ShaderStageFlagBits::eCompute;
+        stageInfo.module = shaderModule.module;
+        stageInfo.pName = "main";
+
+        vk::ComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.stage = stageInfo;
+        pipelineInfo.layout = pipeline.pipelineLayout;
+
+        auto result = renderer->m_device.createComputePipeline(renderer->m_pipelineCache, pipelineInfo);
+        *out = result.value;
+
+        renderer->m_device.destroyShaderModule(shaderModule.module);
+    });
+}
+
+vk::DescriptorSet SvoBuilder::acquireSet() {
+    // same reuse rule as the world update command buffers
+    const uint64_t done = renderer->m_device.getSemaphoreCounterValue(renderer->m_timeline);
+    BuildSet* slot = nullptr;
+    for (auto& s : m_sets) {
+        if (s.value <= done) { slot = &s; break; }
+    }
+    if (!slot) {
+        m_sets.push_back({renderer->m_descAlloc.allocate(renderer->m_device, pipeline.setLayout), 0});
+        slot = &m_sets.back();
+    }
+
+    slot->value = renderer->m_timelineValue + 1;
+    return slot->set;
+}
+
+void SvoBuilder::dispatch(vk::CommandBuffer cmd, vk::Pipeline pass, const SvoBuildPushConstants& pc, uint32_t groups) {
+    if (groups == 0) return;
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pass);
+    cmd.pushConstants(pipeline.pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SvoBuildPushConstants), &pc);
+    cmd.dispatch(groups, 1, 1);
+}
+
+void SvoBuilder::record(vk::CommandBuffer cmd, WorldSvoGpu& gpuWorld) {
+    if (gpuWorld.gpuBuilds.empty()) return;
+    BLOK_PROFILE_NAMED(timer, "SvoBuilder::record");
+
+    // chunks evicted or repacked on the cpu since they were queued
+    std::vector<GpuSvoBuildJob> jobs;
+    jobs.reserve(gpuWorld.gpuBuilds.size());
+    for (auto& job : gpuWorld.gpuBuilds) {
+        auto it = gpuWorld.chunkRanges.find(job.coord);
+        if (it == gpuWorld.chunkRanges.end() || !it->second.gpuBuilt) continue;
+        jobs.push_back(std::move(job));
+    }
+    gpuWorld.gpuBuilds.clear();
+    if (jobs.empty()) return;
+
+    if (!gpuWorld.svoBuffer.handle || !gpuWorld.brickBuffer.handle || !gpuWorld.subChunkBuffer.handle)
+        throw std::runtime_error("SvoBuilder: world buffers have to be uploaded before the build");
+
+    const uint32_t divisions = gpuWorld.subChunkLayout.divisions;
+    const uint32_t subChunks = gpuWorld.subChunksPerChunk;
+
+    // lay every job out back to back, scratch blocks 256 byte aligned for the aabb copies
+    std::vector<BuildLayout> layouts(jobs.size());
+    std::vector<uint32_t> input;
+    uint32_t scratchWords = 0;
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        const GpuSvoBuildJob& job = jobs[j];
+        const ChunkGpuRange& range = gpuWorld.chunkRanges.at(job.coord);
+        BuildLayout& l = layouts[j];
+        SvoBuildPushConstants& pc = l.pc;
+
+        l.brickLevel = job.maxDepth - SVO_BRICK_LEVELS;
+        l.subChunks = subChunks;
+        const uint32_t cells = levelStart(l.brickLevel + 1);
+        const uint32_t brickCells = 1u << (3u * l.brickLevel);
+
+        pc.tableOffset = static_cast<uint32_t>(input.size());
+        input.insert(input.end(), job.brickTable.begin(), job.brickTable.end());
+        pc.voxelOffset = static_cast<uint32_t>(input.size());
+        input.insert(input.end(), job.voxels.begin(), job.voxels.end());
+        pc.brushBrickOffset = static_cast<uint32_t>(input.size());
+        input.insert(input.end(), job.brushBricks.begin(), job.brushBricks.end());
+        pc.brushOffset = static_cast<uint32_t>(input.size());
+        pc.brushCount = static_cast<uint32_t>(job.brushes.size());
+        const auto* brushWords = reinterpret_cast<const uint32_t*>(job.brushes.data());
+        input.insert(input.end(), brushWords, brushWords + job.brushes.size() * (sizeof(ChunkBrushOp) / sizeof(uint32_t)));
+        l.brushThreads = static_cast<uint32_t>(job.brushBricks.size()) << (3u * job.storageShift);
+
+        uint32_t w = (scratchWords + 63u) & ~63u;
+        pc.aabbOffset = w; w += 6 * subChunks;
+        pc.boundsOffset = w; w += 6 * subChunks;
+        pc.cellOffset = w; w += 4 * cells;
+        pc.maskOffset = w; w += 2 * brickCells;
+        pc.prefixOffset = w; w += cells;
+        pc.wordPrefixOffset = w; w += brickCells;
+        pc.headerOffset = w; w += l.brickLevel + 3;
+        scratchWords = w;
+
+        pc.nodeOffset = range.nodeOffset;
+        pc.brickOffset = range.brickOffset;
+        pc.subChunkOffset = range.slot * subChunks;
+        pc.maxDepth = job.maxDepth;
+        pc.storageShift = job.storageShift;
+        pc.divisions = divisions;
+        pc.voxelSize = job.voxelSize;
+    }
+
+    auto* r = renderer;
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    r->ensureBufferCapacity(gpuWorld.svoBuildInput, sizeof(uint32_t) * std::max<size_t>(input.size(), 1), usage, MemoryCategory::Svo);
+    r->ensureBufferCapacity(gpuWorld.svoBuildScratch, sizeof(uint32_t) * std::max<uint32_t>(scratchWords, 1),
+                            usage | vk::BufferUsageFlagBits::eTransferSrc, MemoryCategory::Scratch);
+
+    r->recordUpload(cmd, input.data(), sizeof(uint32_t) * input.size(), gpuWorld.svoBuildInput);
+
+    // empty voxel bounds: mins at the top, maxes at zero so the atomics can only shrink/grow them
+    for (const BuildLayout& l : layouts) {
+        const vk::DeviceSize half = sizeof(uint32_t) * 3 * l.subChunks;
+        const vk::DeviceSize boundsStart = sizeof(uint32_t) * l.pc.boundsOffset;
+        cmd.fillBuffer(gpuWorld.svoBuildScratch.handle, boundsStart, half, 0xFFFFFFFFu);
+        cmd.fillBuffer(gpuWorld.svoBuildScratch.handle, boundsStart + half, half, 0u);
+    }
+
+    // uploads (input, and the zeroed sub-chunk slots from the packer) -> build
+    passBarrier(cmd,
+        vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite,
+        vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite);
+
+    vk::DescriptorSet set = acquireSet();
+    {
+        const vk::DescriptorBufferInfo infos[5] = {
+            {gpuWorld.svoBuildInput.handle, 0, VK_WHOLE_SIZE},
+            {gpuWorld.svoBuildScratch.handle, 0, VK_WHOLE_SIZE},
+            {gpuWorld.svoBuffer.handle, 0, VK_WHOLE_SIZE},
+            {gpuWorld.brickBuffer.handle, 0, VK_WHOLE_SIZE},
+            {gpuWorld.subChunkBuffer.handle, 0, VK_WHOLE_SIZE},
+        };
+
+        std::array<vk::WriteDescriptorSet, 5> writes{};
+        for (uint32_t i = 0; i < writes.size(); ++i)
+            writes[i] = {set, i, 0, 1, vk::DescriptorType::eStorageBuffer, nullptr, &infos[i]};
+        r->m_device.updateDescriptorSets(writes, {});
+    }
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.pipelineLayout, 0, 1, &set, 0, nullptr);
+
+    // every job runs the same pass before the next one, one barrier per pass for all of them
+    uint32_t deepest = 0;
+    for (const BuildLayout& l : layouts) deepest = std::max(deepest, l.brickLevel);
+
+    bool brushed = false;
+    for (BuildLayout& l : layouts) {
+        if (l.brushThreads == 0 || l.pc.brushCount == 0) continue;
+        l.pc.cellCount = l.brushThreads;
+        dispatch(cmd, pipeline.brushPipeline, l.pc, groupsFor(l.pc.cellCount, 64));
+        brushed = true;
+    }
+    if (brushed) computeBarrier(cmd);
+
+    for (BuildLayout& l : layouts) {
+        l.pc.cellCount = 1u << (3u * l.brickLevel);
+        dispatch(cmd, pipeline.bricksPipeline, l.pc, groupsFor(l.pc.cellCount, 64));
+    }
+    computeBarrier(cmd);
+
+    for (uint32_t depth = deepest; depth-- > 0;) {
+        // chunks of different depths line up at their brick levels
+        for (BuildLayout& l : layouts) {
+            const uint32_t shift = deepest - l.brickLevel;
+            if (depth < shift) continue;
+            l.pc.level = depth - shift;
+            l.pc.cellCount = 1u << (3u * l.pc.level);
+            dispatch(cmd, pipeline.reducePipeline, l.pc, groupsFor(l.pc.cellCount, 64));
+        }
+        computeBarrier(cmd);
+    }
+
+    for (BuildLayout& l : layouts) dispatch(cmd, pipeline.scanPipeline, l.pc, 1);
+    computeBarrier(cmd);
+
+    // emit + sub-chunks only read what the scan wrote
+    for (BuildLayout& l : layouts) {
+        l.pc.cellCount = levelStart(l.brickLevel + 1);
+        dispatch(cmd, pipeline.emitPipeline, l.pc, groupsFor(l.pc.cellCount, 64));
+        l.pc.cellCount = l.subChunks;
+        dispatch(cmd, pipeline.subChunksPipeline, l.pc, groupsFor(l.pc.cellCount, 64));
+    }
+
+    // heaps -> the frames + the copy below, aabbs -> their blas input buffers
+    passBarrier(cmd,
+        vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderWrite,
+        vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead);
+
+    const vk::DeviceSize aabbBytes = sizeof(vk::AabbPositionsKHR) * subChunks;
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        ChunkBlas& blas = gpuWorld.chunkBlas[jobs[j].coord];
+
+        // buildChunkBlases does a full build from this, the previous build may still be in flight
+        r->retireBuffer(blas.aabbBuffer);
+        blas.aabbBuffer = r->createWorldBuffer(
+            aabbBytes,
+            vk::BufferUsageFlagBits::eShaderDeviceAddress |
+            vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
+            vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eTransferDst,
+            MemoryCategory::Aabbs
+        );
+
+        vk::BufferCopy copy{sizeof(uint32_t) * layouts[j].pc.aabbOffset, 0, aabbBytes};
+        cmd.copyBuffer(gpuWorld.svoBuildScratch.handle, blas.aabbBuffer.handle, 1, &copy);
+    }
+
+    BLOK_PROFILE_DETAIL(timer, std::to_string(jobs.size()) + " chunks, " + std::to_string(input.size() * sizeof(uint32_t))
+        + " input bytes, " + std::to_string(scratchWords * sizeof(uint32_t)) + " scratch bytes");
+}
+
+}
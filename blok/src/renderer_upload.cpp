@@ -4,12 +4,18 @@
 * Author: Collin Longoria
 * Created on: 12/2/2025
 */
+#include <algorithm>
+#include <array>
 #include <iostream>
 
 #include "renderer.hpp"
+#include "cpu_profiler.hpp"
 
 namespace blok {
 
+// address space of the sparse svo node heap, clamped to what a storage binding can reach
+static constexpr vk::DeviceSize SPARSE_NODE_RESERVE = vk::DeviceSize(2) << 30;
+
 static vk::ImageAspectFlags aspectFromFormat(vk::Format fmt) {
     switch (fmt) {
     case vk::Format::eD16Unorm:
@@ -27,7 +33,7 @@ static vk::ImageAspectFlags aspectFromFormat(vk::Format fmt) {
     }
 }
 
-Buffer Renderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaAllocationCreateFlags allocFlags, VmaMemoryUsage memUsage, bool mapped) {
+Buffer Renderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaAllocationCreateFlags allocFlags, VmaMemoryUsage memUsage, bool mapped, std::span<const uint32_t> sharedFamilies) {
     Buffer out{};
     out.size = size;
 
@@ -36,6 +42,11 @@ Buffer Renderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, V
     bci.size = static_cast<VkDeviceSize>(size);
     bci.usage = static_cast<VkBufferUsageFlags>(usage);
     bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (!sharedFamilies.empty()) {
+        bci.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bci.queueFamilyIndexCount = static_cast<uint32_t>(sharedFamilies.size());
+        bci.pQueueFamilyIndices = sharedFamilies.data();
+    }
 
     VmaAllocationCreateInfo aci{};
     aci.flags = allocFlags | (mapped ? VMA_ALLOCATION_CREATE_MAPPED_BIT : 0);
@@ -49,22 +60,111 @@ Buffer Renderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, V
     return out;
 }
 
+Buffer Renderer::createWorldBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryCategory category) {
+    Buffer out{};
+    VkBufferCreateInfo bci{};
+    bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bci.size = static_cast<VkDeviceSize>(size);
+    bci.usage = static_cast<VkBufferUsageFlags>(usage);
+    bci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo aci{};
+    aci.pool = m_worldMemory;
+
+    // the pool's memory type may not take this usage (or it's out of blocks), the default heaps still will
+    if (!m_worldMemory || vmaCreateBuffer(m_allocator, &bci, &aci, reinterpret_cast<VkBuffer*>(&out.handle), &out.alloc, nullptr) != VK_SUCCESS)
+        out = createBuffer(size, usage, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+
+    out.size = size;
+    out.category = category;
+    MemoryCategoryStats& stats = m_memoryStats[size_t(category)];
+    stats.current += size;
+    stats.peak = std::max(stats.peak, stats.current);
+    return out;
+}
+
+void Renderer::destroyBuffer(Buffer& buf) {
+    if (!buf.handle) return;
+    if (buf.category != MemoryCategory::Untracked) m_memoryStats[size_t(buf.category)].current -= buf.size;
+    vmaDestroyBuffer(m_allocator, buf.handle, buf.alloc);
+    buf = {};
+}
+
 void Renderer::uploadToBuffer(const void *src, vk::DeviceSize size, Buffer &dst, vk::DeviceSize dstOffset) {
     if (dst.mapped) {
         std::memcpy(static_cast<char*>(dst.mapped) + dstOffset, src, static_cast<size_t>(size));
         return;
     }
-    // Staging path
+    // Staging path. the copy is waited on right here, so the span is free again as soon as it's done
+    FrameAllocation staging = allocateStaging(size, 0);
+    std::memcpy(staging.mapped, src, static_cast<size_t>(size));
+    Buffer stagingBuffer{};
+    stagingBuffer.handle = staging.buffer;
+    copyBuffer(stagingBuffer, dst, size, dstOffset, staging.offset);
+}
+
+FrameAllocation Renderer::allocateStaging(vk::DeviceSize size, uint64_t value) {
+    StagingRing& ring = m_staging;
+    size = alignUp(size, 16);
+
+    if (ring.buffer.handle && size < ring.buffer.size) {
+        // drop every span the gpu is done with, oldest first
+        const uint64_t done = m_device.getSemaphoreCounterValue(m_timeline);
+        while (!ring.inFlight.empty() && ring.inFlight.front().value <= done) ring.inFlight.pop_front();
+        if (ring.inFlight.empty()) ring.head = 0;
+
+        // live data is [tail, head), or wrapped around the end. strict compares so head never catches up to tail
+        vk::DeviceSize offset = ring.head;
+        bool fits = ring.inFlight.empty();
+        if (!fits) {
+            const vk::DeviceSize tail = ring.inFlight.front().offset;
+            if (ring.head >= tail) {
+                if (ring.head + size <= ring.buffer.size) fits = true;
+                else if (size < tail) { offset = 0; fits = true; }
+            } else {
+                fits = ring.head + size < tail;
+            }
+        }
+
+        if (fits) {
+            ring.head = offset + size;
+            ring.inFlight.push_back({offset, offset + size, value});
+            return { ring.buffer.handle, offset, static_cast<char*>(ring.buffer.mapped) + offset };
+        }
+    }
+
+    // bigger than the ring, or the ring is full of work still in flight
     Buffer staging = createBuffer(size,
                                   vk::BufferUsageFlagBits::eTransferSrc,
                                   VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
                                   VMA_MEMORY_USAGE_AUTO_PREFER_HOST, true);
-    std::memcpy(staging.mapped, src, static_cast<size_t>(size));
-    copyBuffer(staging, dst, size);
-    vmaDestroyBuffer(m_allocator, staging.handle, staging.alloc);
+    FrameAllocation out{ staging.handle, 0, staging.mapped };
+    retireBuffer(staging);
+    return out;
 }
 
-void Renderer::copyBuffer(Buffer &src, Buffer &dst, vk::DeviceSize size) {
+Buffer Renderer::createDirectWriteBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage) {
+    usage |= vk::BufferUsageFlagBits::eTransferDst;
+    if (size > DIRECT_WRITE_MAX_BYTES)
+        return createBuffer(size, usage, 0, VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+
+    // vma picks host visible device memory if there is any, a transfer target otherwise (mapped stays null)
+    return createBuffer(size, usage,
+                        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT,
+                        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, true);
+}
+
+FrameAllocation Renderer::allocateFrameData(vk::DeviceSize size) {
+    auto& fr = m_frames[m_frameIndex];
+    const vk::DeviceSize offset = alignUp(fr.uboHead, m_uboAlign);
+    if (offset + size > fr.frameUBO.size)
+        throw std::runtime_error("allocateFrameData: frame uniform ring is full");
+
+    fr.uboHead = offset + size;
+    return { fr.frameUBO.handle, offset, static_cast<char*>(fr.frameUBO.mapped) + offset };
+}
+
+void Renderer::copyBuffer(Buffer &src, Buffer &dst, vk::DeviceSize size, vk::DeviceSize dstOffset, vk::DeviceSize srcOffset) {
     auto result = m_device.resetFences(1, &m_uploadFence);
     m_uploadCmd.reset({});
 
@@ -72,7 +172,7 @@ void Renderer::copyBuffer(Buffer &src, Buffer &dst, vk::DeviceSize size) {
     bi.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
     m_uploadCmd.begin(bi);
 
-    vk::BufferCopy copy{0, 0, size};
+    vk::BufferCopy copy{srcOffset, dstOffset, size};
     m_uploadCmd.copyBuffer(src.handle, dst.handle, 1, &copy);
 
     m_uploadCmd.end();
@@ -99,6 +199,12 @@ Image Renderer::createImage(uint32_t w, uint32_t h, vk::Format fmt, vk::ImageUsa
     ici.usage = static_cast<VkImageUsageFlags>(usage);
     ici.samples = static_cast<VkSampleCountFlagBits>(samples);
     ici.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // async compute on its own family, concurrent instead of ownership transfers on every hand over
+    if (!m_imageSharingFamilies.empty()) {
+        ici.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        ici.queueFamilyIndexCount = static_cast<uint32_t>(m_imageSharingFamilies.size());
+        ici.pQueueFamilyIndices = m_imageSharingFamilies.data();
+    }
 
     VmaAllocationCreateInfo aci{};
     aci.usage = memUsage;
@@ -234,81 +340,529 @@ vk::Buffer Renderer::uploadIndexBuffer(const uint32_t *data, uint32_t indexCount
     return dst.handle;
 }
 
-void Renderer::uploadSvoBuffers(WorldSvoGpu &gpuWorld) {
-    // destroy previous buffer if needed
-    if (gpuWorld.svoBuffer.handle) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.svoBuffer.handle, gpuWorld.svoBuffer.alloc);
-        gpuWorld.svoBuffer = {};
+// sort + merge so overlapping or touching writes become one copy
+static std::vector<GpuRange> mergeRanges(std::vector<GpuRange> ranges) {
+    std::sort(ranges.begin(), ranges.end(), [](const GpuRange& a, const GpuRange& b) { return a.first < b.first; });
+
+    std::vector<GpuRange> out;
+    for (const GpuRange& r : ranges) {
+        if (r.count == 0) continue;
+        if (!out.empty() && out.back().first + out.back().count >= r.first) {
+            const uint32_t end = std::max(out.back().first + out.back().count, r.first + r.count);
+            out.back().count = end - out.back().first;
+        } else {
+            out.push_back(r);
+        }
+    }
+    return out;
+}
+
+void Renderer::recordUpload(vk::CommandBuffer cmd, const void* src, vk::DeviceSize size, Buffer& dst, vk::DeviceSize dstOffset) {
+    if (size == 0) return;
+
+    // read by the next submit, same as retireBuffer
+    FrameAllocation staging = allocateStaging(size, m_timelineValue + 1);
+    std::memcpy(staging.mapped, src, static_cast<size_t>(size));
+
+    vk::BufferCopy copy{staging.offset, dstOffset, size};
+    cmd.copyBuffer(staging.buffer, dst.handle, 1, &copy);
+}
+
+void Renderer::recordDirectUpload(vk::CommandBuffer cmd, const void* src, vk::DeviceSize size, Buffer& dst) {
+    if (size == 0) return;
+    if (!dst.mapped) {
+        recordUpload(cmd, src, size, dst);
+        return;
+    }
+
+    // host writes before a submit are visible to it, the flush covers non coherent memory
+    std::memcpy(dst.mapped, src, static_cast<size_t>(size));
+    vmaFlushAllocation(m_allocator, dst.alloc, 0, size);
+}
+
+void Renderer::recordRangesUpload(vk::CommandBuffer cmd, const void* base, vk::DeviceSize elemSize, const std::vector<GpuRange>& ranges, Buffer& dst) {
+    std::vector<GpuRange> merged = mergeRanges(ranges);
+    if (merged.empty()) return;
+
+    const auto* src = static_cast<const char*>(base);
+
+    // one staging span + one copy command for every range
+    vk::DeviceSize total = 0;
+    for (const GpuRange& r : merged) total += r.count * elemSize;
+
+    const FrameAllocation staging = allocateStaging(total, m_timelineValue + 1);
+
+    std::vector<vk::BufferCopy> regions;
+    regions.reserve(merged.size());
+    vk::DeviceSize stagingOffset = 0;
+    for (const GpuRange& r : merged) {
+        const vk::DeviceSize bytes = r.count * elemSize;
+        std::memcpy(static_cast<char*>(staging.mapped) + stagingOffset, src + r.first * elemSize, static_cast<size_t>(bytes));
+        regions.push_back({staging.offset + stagingOffset, r.first * elemSize, bytes});
+        stagingOffset += bytes;
+    }
+
+    cmd.copyBuffer(staging.buffer, dst.handle, static_cast<uint32_t>(regions.size()), regions.data());
+}
+
+// (re)creates buf with some headroom if it can't hold 'bytes'. returns true if it was recreated
+bool Renderer::ensureBufferCapacity(Buffer& buf, vk::DeviceSize bytes, vk::BufferUsageFlags usage, MemoryCategory category) {
+    if (buf.handle && buf.size >= bytes) return false;
+
+    // frames in flight may still be reading the old one
+    retireBuffer(buf);
+
+    // grow by half again so a growing world doesn't reallocate every edit
+    const vk::DeviceSize capacity = std::max<vk::DeviceSize>(bytes + bytes / 2, 256);
+    buf = createWorldBuffer(capacity, usage, category);
+    return true;
+}
+
+void Renderer::retireBuffer(Buffer& buf) {
+    if (!buf.handle) return;
+
+    RetiredResource r{};
+    r.value = m_timelineValue + 1;
+    r.buffer = buf;
+    m_retired.push_back(r);
+    buf = {};
+}
+
+void Renderer::retireAccelerationStructure(AccelerationStructure& as) {
+    if (as.handle) {
+        RetiredResource r{};
+        r.value = m_timelineValue + 1;
+        r.as = as.handle;
+        m_retired.push_back(r);
+        as.handle = nullptr;
+    }
+    retireBuffer(as.buffer);
+}
+
+void Renderer::retirePipeline(vk::Pipeline &pipeline, vk::PipelineLayout &layout) {
+    if (!pipeline && !layout) return;
+
+    RetiredResource r{};
+    r.value = m_timelineValue + 1;
+    r.computeValue = m_computeTimelineValue;
+    r.pipeline = pipeline;
+    r.layout = layout;
+    m_retired.push_back(r);
+    pipeline = nullptr;
+    layout = nullptr;
+}
+
+void Renderer::collectRetired() {
+    if (m_retired.empty()) return;
+
+    const uint64_t done = m_device.getSemaphoreCounterValue(m_timeline);
+    const uint64_t computeDone = m_computeTimeline ? m_device.getSemaphoreCounterValue(m_computeTimeline) : 0;
+    for (size_t i = 0; i < m_retired.size();) {
+        RetiredResource& r = m_retired[i];
+        if (r.value > done || r.computeValue > computeDone) { ++i; continue; }
+
+        if (r.as) m_device.destroyAccelerationStructureKHR(r.as);
+        destroyBuffer(r.buffer);
+        if (r.pipeline) m_device.destroyPipeline(r.pipeline);
+        if (r.layout) m_device.destroyPipelineLayout(r.layout);
+        if (r.memory) vmaFreeMemory(m_allocator, r.memory);
+
+        r = m_retired.back();
+        m_retired.pop_back();
     }
-    if (gpuWorld.subChunkBuffer.handle) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.subChunkBuffer.handle, gpuWorld.subChunkBuffer.alloc);
-        gpuWorld.subChunkBuffer = {};
+}
+
+vk::CommandBuffer Renderer::beginWorldUpdate() {
+    // reuse a command buffer the gpu is done with, otherwise grab a new one
+    const uint64_t done = m_device.getSemaphoreCounterValue(m_timeline);
+    WorldUpdateCmd* slot = nullptr;
+    for (auto& wc : m_worldCmds) {
+        if (wc.value <= done) { slot = &wc; break; }
     }
+    if (!slot) {
+        vk::CommandBufferAllocateInfo cai{};
+        cai.commandPool = m_worldPool;
+        cai.level = vk::CommandBufferLevel::ePrimary;
+        cai.commandBufferCount = 1;
+        m_worldCmds.push_back({m_device.allocateCommandBuffers(cai).front(), 0});
+        slot = &m_worldCmds.back();
+    }
+
+    // tagged now so the slot isn't handed out again before it's submitted
+    slot->value = m_timelineValue + 1;
+    slot->cmd.reset({});
+    slot->cmd.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    return slot->cmd;
+}
+
+void Renderer::submitWorldUpdate(vk::CommandBuffer cmd) {
+    cmd.end();
+
+    // wait for every frame submitted so far (in place writes to the node heap), then signal the next value
+    const uint64_t waitValue = m_timelineValue;
+    const uint64_t signalValue = ++m_timelineValue;
+
+    // sparse page binds go first, behind the same frames. nothing submitted after them reads an unbound page
+    const bool sparseBinds = !m_pendingNodeBinds.empty();
+    if (sparseBinds) {
+        vk::SparseBufferMemoryBindInfo bufferBinds{};
+        bufferBinds.buffer = m_pendingNodeBuffer;
+        bufferBinds.bindCount = static_cast<uint32_t>(m_pendingNodeBinds.size());
+        bufferBinds.pBinds = m_pendingNodeBinds.data();
+
+        vk::TimelineSemaphoreSubmitInfo bindTsi{};
+        bindTsi.waitSemaphoreValueCount = 1;
+        bindTsi.pWaitSemaphoreValues = &waitValue;
+
+        vk::BindSparseInfo bsi{};
+        bsi.pNext = &bindTsi;
+        bsi.waitSemaphoreCount = 1;
+        bsi.pWaitSemaphores = &m_timeline;
+        bsi.bufferBindCount = 1;
+        bsi.pBufferBinds = &bufferBinds;
+        bsi.signalSemaphoreCount = 1;
+        bsi.pSignalSemaphores = &m_sparseBound;
+
+        if (m_worldQueue.bindSparse(1, &bsi, nullptr) != vk::Result::eSuccess)
+            throw std::runtime_error("svo node page bind failed");
+        m_pendingNodeBinds.clear();
+    }
+
+    // the binary semaphore's value is ignored
+    const std::array<vk::Semaphore, 2> waitSemaphores = {m_timeline, m_sparseBound};
+    const std::array<uint64_t, 2> waitValues = {waitValue, 0};
+    const std::array<vk::PipelineStageFlags, 2> waitStages = {vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands};
+    const uint32_t waitCount = sparseBinds ? 2u : 1u;
+
+    vk::TimelineSemaphoreSubmitInfo tsi{};
+    tsi.waitSemaphoreValueCount = waitCount;
+    tsi.pWaitSemaphoreValues = waitValues.data();
+    tsi.signalSemaphoreValueCount = 1;
+    tsi.pSignalSemaphoreValues = &signalValue;
+
+    vk::SubmitInfo si{};
+    si.pNext = &tsi;
+    si.waitSemaphoreCount = waitCount;
+    si.pWaitSemaphores = waitSemaphores.data();
+    si.pWaitDstStageMask = waitStages.data();
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &cmd;
+    si.signalSemaphoreCount = 1;
+    si.pSignalSemaphores = &m_timeline;
+
+    auto result = m_worldQueue.submit(1, &si, nullptr);
+    if (result != vk::Result::eSuccess)
+        throw std::runtime_error("world update submit failed");
+
+    m_worldReadyValue = signalValue;
+}
+
+void Renderer::updateWorld() {
+    if (!m_world) return;
+
+    vk::CommandBuffer cmd = beginWorldUpdate();
 
-    // Node buffer
-    const vk::DeviceSize nodeBytes =
-        sizeof(SvoNode) * gpuWorld.globalNodes.size();
+    uploadSvoBuffers(*m_world, cmd);
 
-    gpuWorld.svoBuffer = createBuffer(
-        nodeBytes,
+    // gpu svo builds write the heaps in place and hand their aabbs to the blas builds
+    m_svoBuilder.record(cmd, *m_world);
+
+    // uploads -> blas/tlas build inputs
+    vk::MemoryBarrier2 uploadToBuild{};
+    uploadToBuild.srcStageMask = vk::PipelineStageFlagBits2::eTransfer | vk::PipelineStageFlagBits2::eComputeShader;
+    uploadToBuild.srcAccessMask = vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eShaderWrite;
+    uploadToBuild.dstStageMask = vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR;
+    uploadToBuild.dstAccessMask = vk::AccessFlagBits2::eAccelerationStructureReadKHR | vk::AccessFlagBits2::eShaderRead;
+
+    vk::DependencyInfo dep{};
+    dep.memoryBarrierCount = 1;
+    dep.pMemoryBarriers = &uploadToBuild;
+    cmd.pipelineBarrier2(dep);
+
+    buildChunkBlases(*m_world, cmd);
+    buildChunkTlas(*m_world, cmd);
+
+    submitWorldUpdate(cmd);
+
+    // descriptor sets pick up the new handles in drawFrame, once each frame's fence is done
+}
+
+// grown buffers get the old contents copied over on the gpu, so only ever the ranges the packer touched
+void Renderer::recordHeapUpload(vk::CommandBuffer cmd, Buffer& buf, vk::DeviceSize bytes, const void* data, vk::DeviceSize elemSize, const std::vector<GpuRange>& dirty, MemoryCategory category) {
+    const vk::BufferUsageFlags usage =
         vk::BufferUsageFlagBits::eStorageBuffer |
-        vk::BufferUsageFlagBits::eTransferDst,
-        0,
-        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-    );
-    uploadToBuffer(gpuWorld.globalNodes.data(), nodeBytes, gpuWorld.svoBuffer);
+        vk::BufferUsageFlagBits::eTransferDst |
+        vk::BufferUsageFlagBits::eTransferSrc;
+
+    const Buffer old = buf;
+    if (ensureBufferCapacity(buf, bytes, usage, category) && old.handle) {
+        // the old buffer is retired, not freed, so it's still valid for this update
+        vk::BufferCopy copy{0, 0, std::min(old.size, buf.size)};
+        cmd.copyBuffer(old.handle, buf.handle, 1, &copy);
+
+        vk::MemoryBarrier2 barrier{};
+        barrier.srcStageMask = vk::PipelineStageFlagBits2::eTransfer;
+        barrier.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+        barrier.dstStageMask = vk::PipelineStageFlagBits2::eTransfer;
+        barrier.dstAccessMask = vk::AccessFlagBits2::eTransferWrite;
+
+        vk::DependencyInfo dep{};
+        dep.memoryBarrierCount = 1;
+        dep.pMemoryBarriers = &barrier;
+        cmd.pipelineBarrier2(dep);
+    } else if (!old.handle) {
+        // brand new, nothing on the gpu to keep
+        if (bytes > 0 && data) recordUpload(cmd, data, bytes, buf);
+        return;
+    }
+    recordRangesUpload(cmd, data, elemSize, dirty, buf);
+}
+
+void Renderer::uploadSvoBuffers(WorldSvoGpu &gpuWorld, vk::CommandBuffer cmd) {
+    BLOK_PROFILE_NAMED(timer, "uploadSvoBuffers");
+    auto upload = [&](Buffer& buf, vk::DeviceSize bytes, const void* data, vk::DeviceSize elemSize, const std::vector<GpuRange>& dirty) {
+        recordHeapUpload(cmd, buf, bytes, data, elemSize, dirty, MemoryCategory::Svo);
+    };
+
+    // Node buffer, sparse when the device has it so growing never reallocates + copies the heap
+    const vk::DeviceSize nodeBytes = sizeof(GpuSvoNode) * gpuWorld.globalNodes.size();
+    if (nodeBytes > 0 && !recordSparseNodeUpload(gpuWorld, cmd, nodeBytes))
+        upload(gpuWorld.svoBuffer, nodeBytes, gpuWorld.globalNodes.data(), sizeof(GpuSvoNode), gpuWorld.dirtyNodeRanges);
+
+    // Leaf brick words. always allocated, even a world without bricks needs something to bind
+    const vk::DeviceSize brickBytes = sizeof(uint32_t) * gpuWorld.globalBrickWords.size();
+    upload(gpuWorld.brickBuffer, brickBytes, gpuWorld.globalBrickWords.data(), sizeof(uint32_t), gpuWorld.dirtyBrickRanges);
 
     // Chunk meta buffer
     const vk::DeviceSize subChunkBytes = sizeof(SubChunkGpu) * gpuWorld.globalSubChunks.size();
+    if (subChunkBytes > 0)
+        upload(gpuWorld.subChunkBuffer, subChunkBytes, gpuWorld.globalSubChunks.data(), sizeof(SubChunkGpu), gpuWorld.dirtySubChunkRanges);
 
-    gpuWorld.subChunkBuffer = createBuffer(
-    subChunkBytes,
-    vk::BufferUsageFlagBits::eStorageBuffer |
-    vk::BufferUsageFlagBits::eTransferDst,
-    0,
-    VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
-    );
+    BLOK_PROFILE_DETAIL(timer, std::to_string(gpuWorld.dirtyNodeRanges.size()) + " node ranges, "
+        + std::to_string(gpuWorld.dirtyBrickRanges.size()) + " brick ranges, "
+        + std::to_string(gpuWorld.dirtySubChunkRanges.size()) + " sub-chunk ranges ("
+        + std::to_string(gpuWorld.globalNodes.size()) + " nodes, " + std::to_string(gpuWorld.globalSubChunks.size()) + " sub-chunk slots)");
 
-    uploadToBuffer(gpuWorld.globalSubChunks.data(), subChunkBytes, gpuWorld.subChunkBuffer);
+    resetRadianceCache(gpuWorld, cmd);
 
-    std::cout << "SVO Uploaded: " << gpuWorld.globalNodes.size() << " nodes, " << gpuWorld.globalSubChunks.size() << " chunks.\n";
+    gpuWorld.dirtyNodeRanges.clear();
+    gpuWorld.dirtyBrickRanges.clear();
+    gpuWorld.dirtySubChunkRanges.clear();
 
-    uploadMaterialBuffer(gpuWorld);
+    uploadMaterialBuffer(gpuWorld, cmd);
+    uploadLightBuffer(gpuWorld, cmd);
+    uploadSurfaceBuffer(gpuWorld, cmd);
+    uploadEmptySpaceBuffer(gpuWorld, cmd);
 }
 
-void Renderer::uploadMaterialBuffer(WorldSvoGpu& gpuWorld) {
-    // Pack materials from the library
-    gpuWorld.materials = m_materialLib.packForGpu();
+bool Renderer::recordSparseNodeUpload(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd, vk::DeviceSize bytes) {
+    if (!m_sparseNodes) return false;
+
+    bool fresh = false;
+    if (!gpuWorld.svoSparse) {
+        // a heap that already fell back to a dense buffer stays dense
+        if (gpuWorld.svoBuffer.handle) return false;
+
+        // as much address space as a storage binding can see, pages cost nothing until they're bound
+        const vk::PhysicalDeviceProperties props = m_physicalDevice.getProperties();
+        const vk::DeviceSize reserve = std::min<vk::DeviceSize>({
+            SPARSE_NODE_RESERVE, props.limits.maxStorageBufferRange, props.limits.sparseAddressSpaceSize
+        }) & ~vk::DeviceSize(0xFFFF);
+
+        vk::BufferCreateInfo bci{};
+        bci.flags = vk::BufferCreateFlagBits::eSparseBinding | vk::BufferCreateFlagBits::eSparseResidency;
+        bci.size = reserve;
+        bci.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc;
+        bci.sharingMode = vk::SharingMode::eExclusive;
+
+        Buffer buf{};
+        buf.handle = m_device.createBuffer(bci);
+        buf.size = reserve;
+        const vk::MemoryRequirements req = m_device.getBufferMemoryRequirements(buf.handle);
+
+        gpuWorld.svoBuffer = buf;
+        gpuWorld.svoPageSize = req.alignment;
+        gpuWorld.svoPageTypeBits = req.memoryTypeBits;
+        gpuWorld.svoPages.assign(static_cast<size_t>(req.size / req.alignment), nullptr);
+        gpuWorld.svoSparse = true;
+        fresh = true;
+    }
 
-    // Ensure we have at least one material (the default)
-    if (gpuWorld.materials.empty()) {
-        // Add default material
-        Material defaultMat;
-        defaultMat.albedo = glm::vec3(0.8f);
-        defaultMat.roughness = 0.5f;
-        gpuWorld.materials.push_back(MaterialGpu::pack(defaultMat));
+    const vk::DeviceSize page = gpuWorld.svoPageSize;
+    MemoryCategoryStats& stats = m_memoryStats[size_t(MemoryCategory::Svo)];
+    auto unbind = [&](size_t p) {
+        m_pendingNodeBinds.push_back({p * page, page, nullptr, 0, {}});
+        RetiredResource r{};
+        r.value = m_timelineValue + 1; // the update the unbind goes ahead of
+        r.memory = gpuWorld.svoPages[p];
+        m_retired.push_back(r);
+        gpuWorld.svoPages[p] = nullptr;
+        stats.current -= page;
+    };
+
+    if (bytes > gpuWorld.svoBuffer.size) {
+        // past the reservation, the dense path starts a new buffer with all of the heap
+        BLOK_PROFILE_NAMED(timer, "sparseNodeFallback");
+        BLOK_PROFILE_DETAIL(timer, std::to_string(bytes >> 20) + " MB heap past the "
+            + std::to_string(gpuWorld.svoBuffer.size >> 20) + " MB reservation");
+        for (size_t p = 0; p < gpuWorld.svoPages.size(); ++p)
+            if (gpuWorld.svoPages[p]) unbind(p);
+        m_pendingNodeBinds.clear(); // the buffer is retired, nothing to unbind it from
+        retireBuffer(gpuWorld.svoBuffer);
+        gpuWorld.svoPages.clear();
+        gpuWorld.svoSparse = false;
+        return false;
     }
 
-    vk::DeviceSize materialSize = gpuWorld.materials.size() * sizeof(MaterialGpu);
+    // every page below the heap's end except the ones entirely inside a free range, nothing points at those
+    const size_t usedPages = static_cast<size_t>((bytes + page - 1) / page);
+    std::vector<uint8_t> wanted(gpuWorld.svoPages.size(), 0);
+    std::fill_n(wanted.begin(), usedPages, uint8_t(1));
+    for (const GpuRange& r : gpuWorld.freeNodeRanges) {
+        const vk::DeviceSize first = (r.first * sizeof(GpuSvoNode) + page - 1) / page;
+        const vk::DeviceSize end = (vk::DeviceSize(r.first + r.count) * sizeof(GpuSvoNode)) / page;
+        for (vk::DeviceSize p = first; p < end && p < usedPages; ++p) wanted[p] = 0;
+    }
+
+    std::vector<size_t> toBind;
+    for (size_t p = 0; p < gpuWorld.svoPages.size(); ++p) {
+        if (wanted[p] && !gpuWorld.svoPages[p]) toBind.push_back(p);
+        else if (!wanted[p] && gpuWorld.svoPages[p]) unbind(p);
+    }
 
-    // Cleanup old buffer if exists
-    if (gpuWorld.materialBuffer.handle) {
-        vmaDestroyBuffer(m_allocator, gpuWorld.materialBuffer.handle, gpuWorld.materialBuffer.alloc);
-        gpuWorld.materialBuffer = {};
+    if (!toBind.empty()) {
+        VkMemoryRequirements req{};
+        req.size = page;
+        req.alignment = page;
+        req.memoryTypeBits = gpuWorld.svoPageTypeBits;
+        VmaAllocationCreateInfo aci{};
+        aci.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+        std::vector<VmaAllocation> allocs(toBind.size());
+        std::vector<VmaAllocationInfo> infos(toBind.size());
+        if (vmaAllocateMemoryPages(m_allocator, &req, &aci, allocs.size(), allocs.data(), infos.data()) != VK_SUCCESS)
+            throw std::runtime_error("Vulkan API: out of memory for svo node pages");
+
+        for (size_t i = 0; i < toBind.size(); ++i) {
+            const size_t p = toBind[i];
+            m_pendingNodeBinds.push_back({p * page, page, infos[i].deviceMemory, infos[i].offset, {}});
+            gpuWorld.svoPages[p] = allocs[i];
+        }
+        stats.current += page * toBind.size();
+        stats.peak = std::max(stats.peak, stats.current);
     }
+    if (!m_pendingNodeBinds.empty()) m_pendingNodeBuffer = gpuWorld.svoBuffer.handle;
+
+    // newly bound pages have nothing in them, a fresh reservation gets the whole heap
+    if (fresh) recordUpload(cmd, gpuWorld.globalNodes.data(), bytes, gpuWorld.svoBuffer);
+    else recordRangesUpload(cmd, gpuWorld.globalNodes.data(), sizeof(GpuSvoNode), gpuWorld.dirtyNodeRanges, gpuWorld.svoBuffer);
+    return true;
+}
+
+void Renderer::destroySparseNodeBuffer(WorldSvoGpu& gpuWorld) {
+    if (!gpuWorld.svoSparse) return;
+    destroyBuffer(gpuWorld.svoBuffer);
+    for (VmaAllocation& a : gpuWorld.svoPages) {
+        if (!a) continue;
+        vmaFreeMemory(m_allocator, a);
+        m_memoryStats[size_t(MemoryCategory::Svo)].current -= gpuWorld.svoPageSize;
+    }
+    gpuWorld.svoPages.clear();
+    gpuWorld.svoSparse = false;
+    m_pendingNodeBinds.clear();
+}
+
+void Renderer::uploadMaterialBuffer(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd) {
+    BLOK_PROFILE_NAMED(timer, "uploadMaterialBuffer");
+    // only what was added or changed since the last update, the buffer keeps the rest
+    m_materialLib.packChangedForGpu(gpuWorld.materials, gpuWorld.dirtyMaterialRanges);
+    if (gpuWorld.dirtyMaterialRanges.empty() && gpuWorld.materialBuffer.handle) return;
+
+    // the library always has its default material, the buffer is never empty
+    const vk::DeviceSize materialSize = gpuWorld.materials.size() * sizeof(MaterialGpu);
+    recordHeapUpload(cmd, gpuWorld.materialBuffer, materialSize, gpuWorld.materials.data(), sizeof(MaterialGpu), gpuWorld.dirtyMaterialRanges, MemoryCategory::Materials);
+
+    BLOK_PROFILE_DETAIL(timer, std::to_string(gpuWorld.dirtyMaterialRanges.size()) + " ranges ("
+        + std::to_string(gpuWorld.materials.size()) + " materials)");
+    gpuWorld.dirtyMaterialRanges.clear();
+}
 
-    // Create new buffer
-    gpuWorld.materialBuffer = createBuffer(
-        materialSize,
-        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
-        0, VMA_MEMORY_USAGE_AUTO
-    );
+void Renderer::uploadLightBuffer(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd) {
+    if (!gpuWorld.lightsDirty && gpuWorld.lightBuffer.handle) return;
 
-    // Upload data
-    uploadToBuffer(gpuWorld.materials.data(), materialSize, gpuWorld.materialBuffer);
+    // the list is rebuilt whole, so it goes up whole. a world without lights still binds the header
+    std::vector<uint8_t> bytes(sizeof(EmissiveLightHeader) + gpuWorld.lights.size() * sizeof(EmissiveLightGpu));
+    std::memcpy(bytes.data(), &gpuWorld.lightHeader, sizeof(EmissiveLightHeader));
+    if (!gpuWorld.lights.empty())
+        std::memcpy(bytes.data() + sizeof(EmissiveLightHeader), gpuWorld.lights.data(), gpuWorld.lights.size() * sizeof(EmissiveLightGpu));
+
+    ensureBufferCapacity(gpuWorld.lightBuffer, bytes.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, MemoryCategory::Lighting);
+    recordUpload(cmd, bytes.data(), bytes.size(), gpuWorld.lightBuffer);
+    gpuWorld.lightsDirty = false;
+}
+
+void Renderer::uploadSurfaceBuffer(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd) {
+    if (!gpuWorld.surfaceDirty) return;
+
+    // rebuilt whole like the lights. an invalid mesh keeps its buffer, the trace just stops reading it
+    const vk::DeviceSize bytes = gpuWorld.surfaceVertices.size() * sizeof(SurfaceVertexGpu);
+    if (bytes > 0) {
+        ensureBufferCapacity(gpuWorld.surfaceBuffer, bytes, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, MemoryCategory::Other);
+        recordUpload(cmd, gpuWorld.surfaceVertices.data(), bytes, gpuWorld.surfaceBuffer);
+    }
+    gpuWorld.surfaceDrawCount = static_cast<uint32_t>(gpuWorld.surfaceVertices.size());
+    gpuWorld.surfaceDrawable = gpuWorld.surfaceValid;
+    gpuWorld.surfaceDirty = false;
+}
+
+void Renderer::uploadEmptySpaceBuffer(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd) {
+    if (!gpuWorld.emptySpaceDirty && gpuWorld.emptySpaceBuffer.handle) return;
+
+    // same as the lights, a world without a field still binds the header
+    std::vector<uint8_t> bytes(sizeof(EmptySpaceHeader) + gpuWorld.emptySpaceWords.size() * sizeof(uint32_t));
+    std::memcpy(bytes.data(), &gpuWorld.emptySpaceHeader, sizeof(EmptySpaceHeader));
+    if (!gpuWorld.emptySpaceWords.empty())
+        std::memcpy(bytes.data() + sizeof(EmptySpaceHeader), gpuWorld.emptySpaceWords.data(), gpuWorld.emptySpaceWords.size() * sizeof(uint32_t));
+
+    ensureBufferCapacity(gpuWorld.emptySpaceBuffer, bytes.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, MemoryCategory::Other);
+    recordUpload(cmd, bytes.data(), bytes.size(), gpuWorld.emptySpaceBuffer);
+    gpuWorld.emptySpaceDirty = false;
+}
+
+void Renderer::setEnvironmentMap(const EnvironmentMap& env) {
+    std::vector<EnvironmentTexelGpu> texels;
+    buildEnvironmentTexels(env, texels);
+    m_environmentHeader = {};
+    m_environmentHeader.width = texels.empty() ? 0u : env.width;
+    m_environmentHeader.height = texels.empty() ? 0u : env.height;
+
+    std::vector<uint8_t> bytes(sizeof(EnvironmentHeader) + texels.size() * sizeof(EnvironmentTexelGpu));
+    std::memcpy(bytes.data(), &m_environmentHeader, sizeof(EnvironmentHeader));
+    if (!texels.empty())
+        std::memcpy(bytes.data() + sizeof(EnvironmentHeader), texels.data(), texels.size() * sizeof(EnvironmentTexelGpu));
+
+    // frames in flight still read the old one, it goes once the timeline passes them.
+    // the handle change rewrites each frame's rt set after that frame's own timeline wait
+    retireBuffer(m_environmentBuffer);
+    m_environmentBuffer = createWorldBuffer(bytes.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, MemoryCategory::Lighting);
+    uploadToBuffer(bytes.data(), bytes.size(), m_environmentBuffer);
+    m_environmentGeneration++;
+}
+
+// the cells of every sub-chunk the packer rewrote are cleared, the rest keeps its lighting.
+// the fills are ordered before the frames by the world update's timeline signal like the uploads
+void Renderer::resetRadianceCache(WorldSvoGpu& gpuWorld, vk::CommandBuffer cmd) {
+    const vk::DeviceSize slotBytes = sizeof(RadianceCacheCell) * RADIANCE_CACHE_FACES;
+    const vk::DeviceSize bytes = slotBytes * std::max<size_t>(gpuWorld.globalSubChunks.size(), 1);
+
+    if (ensureBufferCapacity(gpuWorld.radianceCache, bytes, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, MemoryCategory::Lighting)) {
+        // a grown cache starts over, the paths refill it within a few frames
+        cmd.fillBuffer(gpuWorld.radianceCache.handle, 0, VK_WHOLE_SIZE, 0);
+        return;
+    }
 
-    std::cout << "Uploaded material buffer: " << gpuWorld.materials.size()
-              << " materials (" << materialSize << " bytes)\n";
+    for (const GpuRange& r : mergeRanges(gpuWorld.dirtySubChunkRanges))
+        cmd.fillBuffer(gpuWorld.radianceCache.handle, r.first * slotBytes, r.count * slotBytes, 0);
 }
 
 }
\ No newline at end of file
@@ -6,6 +6,10 @@
 */
 #include "shader_manager.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <glslang/Public/ShaderLang.h>
@@ -151,8 +155,49 @@ static EShLanguage vkShaderStageToGslang(vk::ShaderStageFlagBits s) {
     } // not sure what else to default to
 };
 
-ShaderManager::ShaderManager(vk::Device device)
-    : m_device(device) {
+// has to match what compileShader sets up, bump it when that changes
+static constexpr int SHADER_CACHE_VERSION = 1;
+static constexpr int SHADER_GLSL_VERSION = 460;
+static constexpr auto SHADER_VULKAN_TARGET = glslang::EShTargetVulkan_1_4;
+static constexpr auto SHADER_SPV_TARGET = glslang::EShTargetSpv_1_6;
+
+static uint64_t fnv1a(const void* data, size_t size, uint64_t h) {
+    const auto* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static uint64_t fnv1a(const std::string& s, uint64_t h) {
+    // length first so "ab"+"c" and "a"+"bc" differ
+    const uint64_t n = s.size();
+    return fnv1a(s.data(), s.size(), fnv1a(&n, sizeof(n), h));
+}
+
+// #include "..." relative to the including file, the same files hashSource folds into the cache key
+class LocalIncluder : public glslang::TShader::Includer {
+public:
+    IncludeResult* includeLocal(const char* headerName, const char* includerName, size_t) override {
+        const std::string path = (std::filesystem::path(includerName).parent_path() / headerName).lexically_normal().string();
+        std::ifstream file(path);
+        if (!file.is_open()) return nullptr;
+        std::stringstream buff;
+        buff << file.rdbuf();
+        auto* text = new std::string(buff.str());
+        return new IncludeResult(path, text->data(), text->size(), text);
+    }
+
+    void releaseInclude(IncludeResult* result) override {
+        if (!result) return;
+        delete static_cast<std::string*>(result->userData);
+        delete result;
+    }
+};
+
+ShaderManager::ShaderManager(vk::Device device, std::string cacheDir)
+    : m_device(device), m_cacheDir(std::move(cacheDir)) {
     glslang::InitializeProcess();
 }
 
@@ -174,38 +219,210 @@ std::string ShaderManager::loadFile(const std::string &path) {
     return buff.str();
 }
 
-const ShaderModuleEntry &ShaderManager::loadModule(const std::string &glslPath, vk::ShaderStageFlagBits stage) {
-    ShaderKey key{glslPath, stage};
-    auto it = m_cache.find(key);
-    if (it != m_cache.end()) return it->second;
+uint64_t ShaderManager::hashSource(const std::string &path, const std::string &source, uint64_t h, std::unordered_set<std::string> &seen) {
+    h = fnv1a(source, h);
+
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+        const size_t hashPos = line.find_first_not_of(" \t");
+        if (hashPos == std::string::npos || line.compare(hashPos, 8, "#include") != 0) continue;
+        const size_t open = line.find('"', hashPos + 8);
+        const size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+        if (close == std::string::npos) continue;
+
+        const std::string name = line.substr(open + 1, close - open - 1);
+        const std::string incPath = (std::filesystem::path(path).parent_path() / name).lexically_normal().string();
+        if (!seen.insert(incPath).second) continue;
+
+        std::ifstream file(incPath);
+        if (!file.is_open()) {
+            // compiling will fail on it anyway, just keep the name in the hash
+            h = fnv1a(incPath, h);
+            continue;
+        }
+        std::stringstream buff;
+        buff << file.rdbuf();
+        h = hashSource(incPath, buff.str(), h, seen);
+    }
+    return h;
+}
+
+bool ShaderManager::loadCachedSpirv(uint64_t hash, std::vector<uint32_t> &out) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(hash));
+
+    std::ifstream file(std::filesystem::path(m_cacheDir) / name, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return false;
+    const std::streamsize size = file.tellg();
+    if (size <= 0 || size % 4 != 0) return false;
+
+    std::vector<uint32_t> words(static_cast<size_t>(size) / 4);
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(words.data()), size)) return false;
+    if (words[0] != 0x07230203u) return false; // spir-v magic, anything else is a broken file
+
+    out = std::move(words);
+    return true;
+}
+
+void ShaderManager::storeCachedSpirv(uint64_t hash, const std::vector<uint32_t> &spirv) const {
+    std::error_code ec;
+    std::filesystem::create_directories(m_cacheDir, ec);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(hash));
+    const std::filesystem::path path = std::filesystem::path(m_cacheDir) / name;
+    std::filesystem::path tmp = path;
+    tmp += ".tmp";
+
+    // a missing cache entry only costs a compile, so failures here are not errors
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+        file.write(reinterpret_cast<const char*>(spirv.data()), static_cast<std::streamsize>(spirv.size() * sizeof(uint32_t)));
+        if (!file) return;
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
+}
 
+ShaderModuleEntry ShaderManager::loadModule(const std::string &glslPath, vk::ShaderStageFlagBits stage, const std::string &preamble) {
+    ShaderKey key{glslPath, stage, preamble};
     ShaderModuleEntry ent{};
-    std::string src = loadFile(glslPath);
-    ent.data = compileShader(src, stage);
     vk::ShaderModuleCreateInfo ci{};
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        auto it = m_cache.find(key);
+        if (it != m_cache.end()) {
+            ent.data = it->second;
+            ci.setCodeSize(ent.data.size()*sizeof(uint32_t)).setPCode(ent.data.data());
+            ent.module = m_device.createShaderModule(ci);
+            return ent;
+        }
+    }
+
+    std::string src = loadFile(glslPath);
+
+    const glslang::Version gv = glslang::GetVersion();
+    const int settings[] = {
+        SHADER_CACHE_VERSION, gv.major, gv.minor, gv.patch,
+        SHADER_GLSL_VERSION, static_cast<int>(SHADER_VULKAN_TARGET), static_cast<int>(SHADER_SPV_TARGET),
+        static_cast<int>(stage),
+    };
+    uint64_t hash = fnv1a(settings, sizeof(settings), 14695981039346656037ull);
+    hash = fnv1a(gv.flavor ? std::string(gv.flavor) : std::string(), hash);
+    hash = fnv1a(preamble, hash);
+    std::unordered_set<std::string> seen{std::filesystem::path(glslPath).lexically_normal().string()};
+    hash = hashSource(glslPath, src, hash, seen);
+
+    {
+        // watch list for pollChanges, stamps start at what was just read
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        std::vector<std::string>& deps = m_dependencies[glslPath];
+        deps.assign(seen.begin(), seen.end());
+        for (const std::string& dep : deps) {
+            std::error_code ec;
+            const auto stamp = std::filesystem::last_write_time(dep, ec);
+            if (!ec) m_stamps.try_emplace(dep, stamp);
+        }
+    }
+
+    if (m_cacheDir.empty() || !loadCachedSpirv(hash, ent.data)) {
+        ent.data = compileShader(glslPath, src, stage, preamble);
+        if (!m_cacheDir.empty()) storeCachedSpirv(hash, ent.data);
+    }
     ci.setCodeSize(ent.data.size()*sizeof(uint32_t)).setPCode(ent.data.data());
     ent.module = m_device.createShaderModule(ci);
-    auto [ins, _] = m_cache.emplace(key, std::move(ent));
-    return ins->second;
+
+    // someone else may have compiled the same key meanwhile, same spir-v either way
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    m_cache.try_emplace(key, ent.data);
+    return ent;
+}
+
+std::vector<ShaderModuleEntry> ShaderManager::loadModules(std::span<const ShaderRequest> requests, JobSystem *jobs) {
+    std::vector<ShaderModuleEntry> out(requests.size());
+    if (!jobs) {
+        for (size_t i = 0; i < requests.size(); ++i)
+            out[i] = loadModule(requests[i].path, requests[i].stage, requests[i].preamble);
+        return out;
+    }
+
+    // a throwing job would take its worker down with it, so errors are parked and rethrown here
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    JobCounter counter;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        jobs->submit([&, i] {
+            try {
+                out[i] = loadModule(requests[i].path, requests[i].stage, requests[i].preamble);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+            }
+        }, &counter);
+    }
+    jobs->wait(counter);
+
+    if (error) {
+        for (const ShaderModuleEntry& e : out)
+            if (e.module) m_device.destroyShaderModule(e.module);
+        std::rethrow_exception(error);
+    }
+    return out;
+}
+
+std::vector<std::string> ShaderManager::pollChanges() {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+    std::unordered_set<std::string> touched;
+    for (auto& [file, stamp] : m_stamps) {
+        std::error_code ec;
+        const auto now = std::filesystem::last_write_time(file, ec);
+        // mid save the file can be briefly gone, try again next poll
+        if (ec || now == stamp) continue;
+        stamp = now;
+        touched.insert(file);
+    }
+
+    std::vector<std::string> changed;
+    if (touched.empty()) return changed;
+
+    for (const auto& [source, deps] : m_dependencies) {
+        const bool dirty = std::any_of(deps.begin(), deps.end(), [&](const std::string& d) { return touched.count(d) != 0; });
+        if (dirty) changed.push_back(source);
+    }
+    for (auto it = m_cache.begin(); it != m_cache.end();) {
+        if (std::find(changed.begin(), changed.end(), it->first.path) != changed.end()) it = m_cache.erase(it);
+        else ++it;
+    }
+    return changed;
 }
 
-std::vector<uint32_t> ShaderManager::compileShader(const std::string &source, vk::ShaderStageFlagBits stage) {
+std::vector<uint32_t> ShaderManager::compileShader(const std::string &path, const std::string &source, vk::ShaderStageFlagBits stage,
+                                                  const std::string &preamble) {
     const char* glslSource = source.c_str();
+    const char* glslName = path.c_str();
 
     auto sStage = vkShaderStageToGslang(stage);
     glslang::TShader shader(sStage);
-    shader.setStrings(&glslSource, 1);
+    // the name is what includes resolve against
+    shader.setStringsWithLengthsAndNames(&glslSource, nullptr, &glslName, 1);
+    if (!preamble.empty())
+        shader.setPreamble(preamble.c_str());
 
-    int glslVersion = 460;
-    const auto vulkanVersion = glslang::EShTargetVulkan_1_4;
-    const auto spvVersion = glslang::EShTargetSpv_1_6;
+    int glslVersion = SHADER_GLSL_VERSION;
+    const auto vulkanVersion = SHADER_VULKAN_TARGET;
+    const auto spvVersion = SHADER_SPV_TARGET;
 
     shader.setEnvInput(glslang::EShSourceGlsl, sStage, glslang::EShClientVulkan, glslVersion);
     shader.setEnvClient(glslang::EShClientVulkan, vulkanVersion);
     shader.setEnvTarget(glslang::EShTargetSpv, spvVersion);
 
     EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
-    if (!shader.parse(&DefaultTBuiltInResource, 460, false, messages)) {
+    LocalIncluder includer;
+    if (!shader.parse(&DefaultTBuiltInResource, 460, false, messages, includer)) {
         throw std::runtime_error(shader.getInfoLog());
     }
 
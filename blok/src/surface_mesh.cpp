@@ -0,0 +1,215 @@
+/*
+* File: surface_mesh.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+
+#include <gtc/packing.hpp>
+
+#include <string>
+
+namespace blok {
+
+namespace {
+
+// hit.rchit's face order, +X -X +Y -Y +Z -Z
+const glm::vec3 FACE_NORMALS[6] = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}
+};
+
+// material id + 1 per voxel, 0 empty
+std::vector<uint32_t> denseMaterials(const ChunkStorage& storage) {
+    const uint32_t C = storage.size();
+    const uint32_t shift = storage.brickShift();
+    const uint32_t B = storage.brickSize();
+    const uint32_t mask = B - 1u;
+    const uint32_t perAxis = storage.bricksPerAxis();
+
+    std::vector<uint32_t> dense(size_t(C) * C * C, 0u);
+    for (uint32_t bz = 0; bz < perAxis; ++bz)
+        for (uint32_t by = 0; by < perAxis; ++by)
+            for (uint32_t bx = 0; bx < perAxis; ++bx) {
+                const ChunkStorage::Brick* brick = storage.brick(bx, by, bz);
+                if (!brick) continue;
+
+                for (uint32_t i = 0; i < B * B * B; ++i) {
+                    if (brick->density[i] == 0) continue;
+                    const uint32_t x = bx * B + (i & mask);
+                    const uint32_t y = by * B + ((i >> shift) & mask);
+                    const uint32_t z = bz * B + (i >> (2 * shift));
+                    dense[x + y * C + size_t(z) * C * C] = storage.paletteMaterial(brick->material[i]) + 1u;
+                }
+            }
+    return dense;
+}
+
+// quads in (u, v) on the plane, six vertices each. the sub-chunk comes from the quad's min corner
+void meshChunk(const ChunkStorage& storage, uint32_t divisions, float voxelSize, std::vector<SurfaceVertexGpu>& out) {
+    out.clear();
+    const int cell = static_cast<int>(storage.size() / divisions); // voxels per sub-chunk edge
+    std::vector<GreedyQuad> quads;
+    greedyMeshChunk(storage, static_cast<uint32_t>(cell), quads);
+
+    out.reserve(quads.size() * 6);
+    for (const GreedyQuad& q : quads) {
+        const int axis = static_cast<int>(q.face >> 1);
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+
+        glm::ivec3 s(0);
+        s[axis] = (q.plane - (q.face & 1u ? 0 : 1)) / cell; s[u] = q.u / cell; s[v] = q.v / cell;
+        const uint32_t subChunk = uint32_t(s.x) + uint32_t(s.y) * divisions + uint32_t(s.z) * divisions * divisions;
+
+        const glm::vec2 corners[4] = {
+            {float(q.u), float(q.v)}, {float(q.u + q.w), float(q.v)}, {float(q.u + q.w), float(q.v + q.h)}, {float(q.u), float(q.v + q.h)}
+        };
+        auto corner = [&](int c) {
+            glm::vec3 p(0.0f);
+            p[axis] = float(q.plane); p[u] = corners[c].x; p[v] = corners[c].y;
+            return SurfaceVertexGpu{p * voxelSize, q.material | (q.face << 29), subChunk, 0u};
+        };
+        for (int c : {0, 1, 2, 0, 2, 3}) out.push_back(corner(c));
+    }
+}
+
+}
+
+// outside the chunk counts as open like gatherEmissiveLights, the faces against a filled neighbour chunk are
+// hidden behind it anyway
+void greedyMeshChunk(const ChunkStorage& storage, uint32_t cellSize, std::vector<GreedyQuad>& out) {
+    out.clear();
+    if (storage.allocatedBricks() == 0) return;
+
+    const int C = static_cast<int>(storage.size());
+    const int cell = std::max(1, static_cast<int>(cellSize));
+    const std::vector<uint32_t> dense = denseMaterials(storage);
+    auto at = [&](const glm::ivec3& p) -> uint32_t {
+        if (p.x < 0 || p.y < 0 || p.z < 0 || p.x >= C || p.y >= C || p.z >= C) return 0u;
+        return dense[p.x + p.y * C + size_t(p.z) * C * C];
+    };
+
+    std::vector<uint32_t> mask(size_t(C) * C);
+    for (int axis = 0; axis < 3; ++axis) {
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+
+        for (int side = 0; side < 2; ++side) {
+            const uint32_t face = uint32_t(axis * 2 + side);
+            const int step = side == 0 ? 1 : -1;
+
+            for (int slice = 0; slice < C; ++slice) {
+                // material of every voxel in the slice whose face this way is open
+                for (int j = 0; j < C; ++j)
+                    for (int i = 0; i < C; ++i) {
+                        glm::ivec3 p(0);
+                        p[axis] = slice; p[u] = i; p[v] = j;
+                        const uint32_t m = at(p);
+                        p[axis] += step;
+                        mask[i + size_t(j) * C] = m && !at(p) ? m : 0u;
+                    }
+
+                // greedy rectangles of one material, cut at the cell edges
+                for (int j = 0; j < C; ++j)
+                    for (int i = 0; i < C;) {
+                        const uint32_t key = mask[i + size_t(j) * C];
+                        if (!key) { ++i; continue; }
+
+                        const int uEnd = (i / cell + 1) * cell;
+                        const int vEnd = (j / cell + 1) * cell;
+                        int w = 1;
+                        while (i + w < uEnd && mask[i + w + size_t(j) * C] == key) ++w;
+                        int h = 1;
+                        for (; j + h < vEnd; ++h) {
+                            bool row = true;
+                            for (int k = 0; k < w && row; ++k) row = mask[i + k + size_t(j + h) * C] == key;
+                            if (!row) break;
+                        }
+                        for (int b = 0; b < h; ++b)
+                            for (int k = 0; k < w; ++k) mask[i + k + size_t(j + b) * C] = 0u;
+
+                        // the plane sits on the open side of the slice
+                        out.push_back({key, face, slice + (side == 0 ? 1 : 0), i, j, w, h});
+                        i += w;
+                    }
+            }
+        }
+    }
+}
+
+void buildSurfaceMesh(const ChunkManager& mgr, WorldSvoGpu& gpuWorld) {
+    BLOK_PROFILE_NAMED(timer, "buildSurfaceMesh");
+
+    // the adaptive layout's cells come out of the svo, there's no voxel -> sub-chunk rule to cut quads at.
+    // gpu brushes only exist in the device svo until they're flushed
+    bool valid = !mgr.subChunks.adaptive;
+    for (const auto& kv : gpuWorld.chunkRanges) {
+        const Chunk* found = mgr.packedChunk(kv.first);
+        if (found && !found->gpuBrushes.empty()) valid = false;
+    }
+
+    bool changed = valid != gpuWorld.surfaceValid;
+    gpuWorld.surfaceValid = valid;
+    if (!valid) {
+        if (changed) {
+            gpuWorld.chunkSurfaces.clear();
+            gpuWorld.surfaceVertices.clear();
+            gpuWorld.surfaceDirty = true;
+        }
+        return;
+    }
+
+    for (auto it = gpuWorld.chunkSurfaces.begin(); it != gpuWorld.chunkSurfaces.end();) {
+        if (gpuWorld.chunkRanges.count(it->first)) { ++it; continue; }
+        it = gpuWorld.chunkSurfaces.erase(it);
+        changed = true;
+    }
+
+    for (const auto& kv : gpuWorld.chunkRanges) {
+        const Chunk* ch = mgr.packedChunk(kv.first);
+        if (!ch) continue;
+
+        // flushGpuBrushes writes the voxels without a new svo, so the edit count is part of the key
+        auto [it, isNew] = gpuWorld.chunkSurfaces.try_emplace(kv.first);
+        if (!isNew && it->second.svoVersion == ch->svoVersion && it->second.editCount == ch->voxels.editCount()) continue;
+
+        it->second.svoVersion = ch->svoVersion;
+        it->second.editCount = ch->voxels.editCount();
+        meshChunk(ch->voxels, mgr.subChunks.divisions, ch->svo.voxelSize, it->second.vertices);
+        changed = true;
+    }
+    if (!changed) return;
+
+    std::vector<SurfaceVertexGpu>& vertices = gpuWorld.surfaceVertices;
+    vertices.clear();
+    for (const auto& kv : gpuWorld.chunkSurfaces) {
+        if (kv.second.vertices.empty()) continue;
+        const ChunkGpuRange& range = gpuWorld.chunkRanges.at(kv.first);
+        const uint32_t subChunkBase = range.slot * gpuWorld.subChunksPerChunk;
+
+        const ChunkInstanceSet* set = nullptr;
+        for (const ChunkInstanceSet& s : gpuWorld.instanceSets)
+            if (s.contains(kv.first)) { set = &s; break; }
+
+        // placements share the source chunk's sub-chunks and so its radiance cache cells, same as the blas instances
+        auto place = [&](const glm::mat4& t) {
+            for (const SurfaceVertexGpu& v : kv.second.vertices) {
+                SurfaceVertexGpu placed = v;
+                placed.position = glm::vec3(t * glm::vec4(range.origin + v.position, 1.0f));
+                placed.subChunk = subChunkBase + v.subChunk;
+                const glm::vec3 n = glm::mat3(t) * FACE_NORMALS[v.materialFace >> 29];
+                placed.normal = glm::packSnorm4x8(glm::vec4(n, 0.0f));
+                vertices.push_back(placed);
+            }
+        };
+        if (!set) { place(glm::mat4(1.0f)); continue; }
+        for (const glm::mat4& t : set->transforms) place(t);
+    }
+
+    gpuWorld.surfaceDirty = true;
+    BLOK_PROFILE_DETAIL(timer, std::to_string(vertices.size() / 6) + " quads");
+}
+
+}
@@ -6,6 +6,12 @@
 */
 #include "svo.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+#include "chunk_storage.hpp"
+
 namespace blok {
 
 // helper to make a blank node
@@ -20,45 +26,188 @@ static SvoNode makeEmptyNode() {
 
 SvoTree::SvoTree(uint32_t maxDepth_, const glm::vec3 &origin_, float voxelSize_)
     : rootIndex(0), maxDepth(maxDepth_), origin(origin_), voxelSize(voxelSize_) {
-    nodes.reserve(1024);
-    nodes.clear();
+    // no up front reserve, rebuilt trees get their capacity from SvoStoragePool
     nodes.push_back(makeEmptyNode());
 }
 
 void SvoTree::clear() {
     nodes.clear();
     nodes.push_back(makeEmptyNode());
+    brickWords.clear();
+    brickCount = 0;
+    staleNodes = 0;
+    staleWords = 0;
+    aoBaked = false;
     rootIndex = 0;
 }
 
-// ensures node at nodeIndex has its 8 children allocated.
-// returns firstChild index
-static uint32_t ensureChildren(std::vector<SvoNode>& nodes, uint32_t nodeIndex) {
-    // Check if children already exist BEFORE any modification
-    if (nodes[nodeIndex].firstChild != INVALID_NODE_INDEX)
-        return nodes[nodeIndex].firstChild;
+void SvoStoragePool::acquire(SvoTree& tree) {
+    if (m_free.empty()) {
+        tree.clear();
+        return;
+    }
 
-    const auto firstChild = static_cast<uint32_t>(nodes.size());
+    // the last one in is the warmest
+    Entry& e = m_free.back();
+    m_bytes -= capacityBytes(e);
+    tree.nodes.swap(e.nodes);
+    tree.brickWords.swap(e.brickWords);
+    m_free.pop_back();
+    tree.clear();
+}
+
+void SvoStoragePool::release(SvoTree& tree) {
+    Entry e;
+    e.nodes.swap(tree.nodes);
+    e.brickWords.swap(tree.brickWords);
+    tree.brickCount = 0;
+    tree.rootIndex = 0;
+    if (e.nodes.capacity() == 0 && e.brickWords.capacity() == 0) return;
+
+    e.nodes.clear();
+    e.brickWords.clear();
+    m_bytes += capacityBytes(e);
+    m_free.push_back(std::move(e));
+    trim(MAX_POOLED_BYTES);
+}
 
-    // Reserve space to avoid multiple reallocations
-    if (nodes.capacity() < nodes.size() + 8) {
-        nodes.reserve(nodes.capacity() * 2 + 8);
+size_t SvoStoragePool::trim(size_t maxBytes) {
+    size_t dropped = 0;
+    while (m_bytes > maxBytes && !m_free.empty()) {
+        const size_t bytes = capacityBytes(m_free.front());
+        m_free.erase(m_free.begin());
+        m_bytes -= bytes;
+        dropped += bytes;
     }
+    return dropped;
+}
 
-    nodes.resize(nodes.size() + 8);
+// returns the index of child 'oct' of nodeIndex, adding it if it isn't stored yet.
+// children are packed, so a new octant means a new block of count + 1 at the end of nodes[].
+// the old block is left behind unreferenced, grandchildren stay where they are
+static uint32_t ensureChild(std::vector<SvoNode>& nodes, uint32_t nodeIndex, uint32_t oct) {
+    const SvoNode parent = nodes[nodeIndex];
+    const uint32_t bit = 1u << oct;
+    if (parent.childMask & bit)
+        return svoChildIndex(parent, oct);
 
-    // initialize new children as empty
-    for (uint32_t i = 0; i < 8; ++i)
-        nodes[firstChild + i] = makeEmptyNode();
+    const auto count = static_cast<uint32_t>(std::popcount(parent.childMask));
+    const auto first = static_cast<uint32_t>(nodes.size());
+    nodes.resize(nodes.size() + count + 1);
 
     // Access by index AFTER resize, not via cached reference
-    nodes[nodeIndex].firstChild = firstChild;
-    return firstChild;
+    uint32_t src = parent.firstChild;
+    uint32_t dst = first;
+    uint32_t added = first;
+    for (uint32_t o = 0; o < 8; ++o) {
+        if (o == oct) {
+            added = dst;
+            nodes[dst++] = makeEmptyNode();
+        } else if (parent.childMask & (1u << o)) {
+            nodes[dst++] = nodes[src++];
+        }
+    }
+
+    nodes[nodeIndex].childMask |= bit;
+    nodes[nodeIndex].firstChild = first;
+    return added;
+}
+
+// a filled leaf above the leaf level (see insertVoxel's merge) covers its whole cell.
+// it's turned back into 8 copies of itself one level down so one of them can change
+static void splitLeaf(std::vector<SvoNode>& nodes, uint32_t index) {
+    SvoNode child = nodes[index];
+    const auto first = static_cast<uint32_t>(nodes.size());
+    nodes.insert(nodes.end(), 8, child);
+    nodes[index].childMask = 0xFFu;
+    nodes[index].firstChild = first;
+}
+
+// takes child 'oct' out of the parent's packed block, the later siblings close the gap and the last slot goes stale.
+// a parent left without children becomes an empty leaf. returns the siblings that moved
+static SvoSpan dropChild(std::vector<SvoNode>& nodes, uint32_t parentIndex, uint32_t oct) {
+    SvoNode& parent = nodes[parentIndex];
+    const uint32_t at = svoChildIndex(parent, oct);
+    const uint32_t last = parent.firstChild + static_cast<uint32_t>(std::popcount(svoChildBits(parent))) - 1u;
+    for (uint32_t i = at; i < last; ++i) nodes[i] = nodes[i + 1];
+
+    nodes[parentIndex].childMask &= ~(1u << oct);
+    if (nodes[parentIndex].childMask == 0u) nodes[parentIndex] = makeEmptyNode();
+    return {at, last - at};
+}
+
+static bool isEmptyLeaf(const SvoNode& n) {
+    return !svoIsBrick(n) && n.childMask == 0u && n.occupancy <= 0.0f;
+}
+
+// emitGroup's aggregate, redone in place for a node whose children changed
+static void aggregateChildren(std::vector<SvoNode>& nodes, uint32_t index) {
+    SvoNode& n = nodes[index];
+    const auto count = static_cast<uint32_t>(std::popcount(svoChildBits(n)));
+
+    float occupancy = 0.0f;
+    float fullest = 0.0f;
+    n.materialId = 0u;
+    for (uint32_t i = 0; i < count; ++i) {
+        const SvoNode& child = nodes[n.firstChild + i];
+        occupancy += child.occupancy;
+        if (child.occupancy > fullest) {
+            fullest = child.occupancy;
+            n.materialId = child.materialId;
+        }
+    }
+    n.occupancy = occupancy * 0.125f;
+}
+
+// 8 plain leaves with the same material and occupancy, the parent can stand in for all of them
+static bool mergeableChildren(const std::vector<SvoNode>& nodes, const SvoNode& n) {
+    if (svoIsBrick(n) || svoChildBits(n) != 0xFFu) return false;
+    const SvoNode& first = nodes[n.firstChild];
+    for (uint32_t i = 0; i < 8; ++i) {
+        const SvoNode& c = nodes[n.firstChild + i];
+        if (svoIsBrick(c) || c.childMask != 0u || c.materialId != first.materialId || c.occupancy != first.occupancy)
+            return false;
+    }
+    return true;
+}
+
+// walks the path up from 'level' after the node there changed: empty nodes are dropped from their parents,
+// uniform parents are merged into one leaf, the rest get new aggregates. path[] is the node index per level
+void SvoTree::collapsePath(const uint32_t* path, uint32_t level, uint64_t code, SvoPatch* patch) {
+    auto touch = [&](uint32_t first, uint32_t count) {
+        if (patch && count > 0) patch->nodes.push_back({first, count});
+    };
+
+    for (uint32_t l = level; l-- > 0;) {
+        const uint32_t parentIndex = path[l];
+        if (isEmptyLeaf(nodes[path[l + 1]])) {
+            const SvoSpan moved = dropChild(nodes, parentIndex, morton3d::octantFromCode(code, maxDepth, l));
+            touch(moved.first, moved.count);
+            touch(parentIndex, 1);
+            staleNodes++;
+            if (nodes[parentIndex].childMask == 0u) continue; // went empty too, its own parent drops it next
+        }
+
+        SvoNode& parent = nodes[parentIndex];
+        if (mergeableChildren(nodes, parent)) {
+            const SvoNode leaf = nodes[parent.firstChild];
+            parent.childMask = 0u;
+            parent.firstChild = INVALID_NODE_INDEX;
+            parent.materialId = leaf.materialId;
+            parent.occupancy = leaf.occupancy;
+            staleNodes += 8;
+        } else {
+            aggregateChildren(nodes, parentIndex);
+        }
+        touch(parentIndex, 1);
+    }
 }
 
 void SvoTree::insertVoxel(uint32_t x, uint32_t y, uint32_t z, uint32_t materialId, float density) {
-    if (density <= 0.0f)
-        return; // TODO: ignoring empty writes for now
+    if (density <= 0.0f) {
+        removeVoxel(x, y, z);
+        return;
+    }
 
     // clamp to valid range
     const uint32_t dim = 1u << maxDepth;
@@ -67,66 +216,606 @@ void SvoTree::insertVoxel(uint32_t x, uint32_t y, uint32_t z, uint32_t materialI
 
     const uint64_t code = morton3d::encode(x, y, z);
 
-    uint32_t nodeIndex = rootIndex;
-
-    // record the path to propagate childMask upwards
-    uint32_t pathNodeIndices[32]; // TODO: maxDepth <= 32 assumed
-    uint32_t pathChildOctants[32];
+    uint32_t path[33];
+    path[0] = rootIndex;
 
-    // descend from root to leaf parent
+    // descend from root to leaf, setting childMask bits on the way (the leaf is always filled)
     for (uint32_t level = 0; level < maxDepth; ++level) {
-        pathNodeIndices[level] = nodeIndex;
+        const SvoNode node = nodes[path[level]];
+        if (node.childMask == 0u && node.occupancy > 0.0f) {
+            // a merged leaf, already holds the voxel or has to be split to change it
+            if (node.materialId == materialId && node.occupancy == density) return;
+            splitLeaf(nodes, path[level]);
+        }
 
         const uint32_t oct = morton3d::octantFromCode(code, maxDepth, level);
-        pathChildOctants[level] = oct;
-
-        const uint32_t firstChild = ensureChildren(nodes, nodeIndex);
-        const uint32_t childIndex = firstChild + oct;
-
-        nodeIndex = childIndex;
+        path[level + 1] = ensureChild(nodes, path[level], oct);
     }
 
-    // nodeIndex is now leaf node
-    SvoNode& leaf = nodes[nodeIndex];
+    SvoNode& leaf = nodes[path[maxDepth]];
     leaf.materialId = materialId;
     leaf.occupancy = density;
+    collapsePath(path, maxDepth, code, nullptr);
+}
+
+bool SvoTree::removeVoxel(uint32_t x, uint32_t y, uint32_t z, SvoPatch* patch) {
+    const uint32_t dim = 1u << maxDepth;
+    if (x >= dim || y >= dim || z >= dim)
+        return false; // OUT OF BOUNDS
+
+    const uint64_t code = morton3d::encode(x, y, z);
+
+    uint32_t path[33];
+    path[0] = rootIndex;
+    uint32_t level = 0;
+    for (; level < maxDepth; ++level) {
+        SvoNode node = nodes[path[level]];
+        if (svoIsBrick(node)) break;
+        if (node.childMask == 0u) {
+            if (node.occupancy <= 0.0f) return false; // empty subtree
+            // a merged leaf, the rest of its cell stays filled
+            splitLeaf(nodes, path[level]);
+            if (patch) patch->nodes.push_back({nodes[path[level]].firstChild, 8});
+            node = nodes[path[level]];
+        }
+
+        const uint32_t oct = morton3d::octantFromCode(code, maxDepth, level);
+        if ((node.childMask & (1u << oct)) == 0u) return false;
+        path[level + 1] = svoChildIndex(node, oct);
+    }
+
+    SvoNode& n = nodes[path[level]];
+    if (svoIsBrick(n)) {
+        const uint32_t mask = SVO_BRICK_SIZE - 1u;
+        const uint32_t bit = (x & mask) | ((y & mask) << 2) | ((z & mask) << 4);
+        uint32_t* brick = brickWords.data() + n.firstChild;
+        uint64_t bits = svoBrickBits(brick);
+        if ((bits & (uint64_t{1} << bit)) == 0) return false;
+
+        // the voxel's material word goes, the ones after it move down and the last goes stale
+        const auto filled = static_cast<uint32_t>(std::popcount(bits));
+        const auto rank = static_cast<uint32_t>(std::popcount(bits & ((uint64_t{1} << bit) - 1u)));
+        for (uint32_t i = 2 + rank; i + 1 < 2 + filled; ++i) brick[i] = brick[i + 1];
+        bits &= ~(uint64_t{1} << bit);
+        brick[0] = static_cast<uint32_t>(bits);
+        brick[1] = static_cast<uint32_t>(bits >> 32);
+        staleWords++;
+        if (patch) patch->words.push_back({n.firstChild, 2 + filled - 1});
+
+        if (bits == 0) {
+            staleWords += 2;
+            brickCount--;
+            n = makeEmptyNode();
+        } else {
+            // densities aren't kept in the brick, the removed voxel is taken as an average one
+            n.occupancy *= static_cast<float>(filled - 1) / static_cast<float>(filled);
+            // lod material is still the most common one
+            uint32_t best = 0;
+            for (uint32_t i = 0; i + 1 < filled; ++i) {
+                uint32_t same = 0;
+                const uint32_t material = brick[2 + i] & SVO_MATERIAL_MASK;
+                for (uint32_t j = 0; j + 1 < filled; ++j) same += (brick[2 + j] & SVO_MATERIAL_MASK) == material ? 1u : 0u;
+                if (same > best) {
+                    best = same;
+                    n.materialId = material;
+                }
+            }
+        }
+    } else {
+        n = makeEmptyNode();
+    }
+    if (patch) patch->nodes.push_back({path[level], 1});
+
+    collapsePath(path, level, code, patch);
+    return true;
+}
+
+// a group of 8 siblings waiting for their parent
+struct PendingGroup {
+    SvoNode children[8];
+    uint32_t count = 0;
+    uint32_t mask = 0;
+};
+
+// writes the non empty siblings out (packed, octant order) and returns their parent.
+// the parent gets the aggregate of its children for lod: occupancy = filled fraction of its volume,
+// material = the material of its fullest child
+static SvoNode emitGroup(std::vector<SvoNode>& nodes, const SvoNode* children, uint32_t mask) {
+    SvoNode parent = makeEmptyNode();
+    if (mask == 0u)
+        return parent; // nothing below, parent stays an empty leaf
+
+    parent.childMask = mask;
+    parent.firstChild = static_cast<uint32_t>(nodes.size());
+
+    float occupancy = 0.0f;
+    float fullest = 0.0f;
+    for (uint32_t oct = 0; oct < 8; ++oct) {
+        if ((mask & (1u << oct)) == 0u) continue;
+        const SvoNode& child = children[oct];
+        nodes.push_back(child);
+
+        occupancy += child.occupancy;
+        if (child.occupancy > fullest) {
+            fullest = child.occupancy;
+            parent.materialId = child.materialId;
+        }
+    }
+    parent.occupancy = occupancy * 0.125f;
+    return parent;
+}
+
+// the bottom-up build: finished nodes come in in morton order, pending[level] collects the ones at that level
+// until all 8 siblings are in and their parent moves up. one group per level down to the deepest one pushed at
+class PendingLevels {
+public:
+    PendingLevels(std::vector<SvoNode>& nodes, uint32_t rootIndex, uint32_t deepestLevel)
+        : m_nodes(nodes), m_rootIndex(rootIndex), m_pending(deepestLevel + 1) {}
+
+    // adds a finished node at 'level' to its sibling group and pushes the parent up
+    // for as long as groups complete. a node at level 0 is the root
+    void push(uint32_t level, SvoNode node) {
+        assert(level < m_pending.size());
+        while (level > 0) {
+            PendingGroup& p = m_pending[level];
+            if (node.childMask != 0u)
+                p.mask |= (1u << p.count);
+            p.children[p.count++] = node;
+
+            if (p.count < 8)
+                return;
+
+            node = emitGroup(m_nodes, p.children, p.mask);
+            p.count = 0;
+            p.mask = 0;
+            --level;
+        }
+
+        m_nodes[m_rootIndex] = node;
+    }
+
+private:
+    std::vector<SvoNode>& m_nodes;
+    uint32_t m_rootIndex;
+    std::vector<PendingGroup> m_pending;
+};
+
+// writes one 4^3 brick (voxels in brick bit order) and returns the node that points at it.
+// an all-empty brick is just an empty leaf. the node carries the lod aggregate like emitGroup's parents
+static SvoNode emitBrick(std::vector<uint32_t>& words, uint32_t& brickCount, const uint32_t* materials, const float* density) {
+    uint64_t bits = 0;
+    float occupancy = 0.0f;
+    for (uint32_t i = 0; i < SVO_BRICK_VOXELS; ++i) {
+        if (density[i] <= 0.0f) continue;
+        bits |= uint64_t{1} << i;
+        occupancy += density[i];
+    }
+
+    SvoNode node = makeEmptyNode();
+    if (bits == 0)
+        return node;
+
+    node.childMask = SVO_BRICK_FLAG;
+    node.firstChild = static_cast<uint32_t>(words.size());
+    node.occupancy = occupancy / static_cast<float>(SVO_BRICK_VOXELS);
+
+    words.push_back(static_cast<uint32_t>(bits));
+    words.push_back(static_cast<uint32_t>(bits >> 32));
+
+    // lod material is the most common one, bricks rarely hold more than a couple
+    uint32_t best = 0;
+    for (uint32_t i = 0; i < SVO_BRICK_VOXELS; ++i) {
+        if ((bits & (uint64_t{1} << i)) == 0) continue;
+        words.push_back(materials[i]);
+
+        uint32_t same = 0;
+        for (uint32_t j = 0; j < SVO_BRICK_VOXELS; ++j)
+            if ((bits & (uint64_t{1} << j)) && materials[j] == materials[i]) same++;
+        if (same > best) {
+            best = same;
+            node.materialId = materials[i];
+        }
+    }
 
-    // propogate childMask bits up along the path
-    for (int level = static_cast<int>(maxDepth) - 1; level >= 0; --level) {
-        const uint32_t parentIndex = pathNodeIndices[level];
-        const uint32_t oct = pathChildOctants[level];
+    brickCount++;
+    return node;
+}
+
+void SvoTree::buildFromDense(const float* density, const uint32_t* materialIds, uint32_t C) {
+    assert(C == (1u << maxDepth));
+
+    clear();
+
+    if (maxDepth < SVO_BRICK_LEVELS) {
+        // smaller than one brick, a handful of voxels at most
+        for (uint32_t z = 0; z < C; ++z)
+            for (uint32_t y = 0; y < C; ++y)
+                for (uint32_t x = 0; x < C; ++x) {
+                    const size_t idx = x + y * static_cast<size_t>(C) + z * static_cast<size_t>(C) * C;
+                    if (density[idx] > 0.0f) insertVoxel(x, y, z, materialIds[idx], density[idx]);
+                }
+        return;
+    }
+
+    // morton order guarantees siblings arrive back to back in octant order
+    const uint32_t brickLevel = maxDepth - SVO_BRICK_LEVELS;
+    PendingLevels pending(nodes, rootIndex, brickLevel);
+    const size_t CC = static_cast<size_t>(C) * C;
+    const uint32_t perAxis = C >> SVO_BRICK_LEVELS;
+    const uint64_t brickTotal = static_cast<uint64_t>(perAxis) * perAxis * perAxis;
+
+    for (uint64_t g = 0; g < brickTotal; ++g) {
+        // base corner of this brick
+        const uint32_t bx = morton3d::compactBits(g     ) << SVO_BRICK_LEVELS;
+        const uint32_t by = morton3d::compactBits(g >> 1) << SVO_BRICK_LEVELS;
+        const uint32_t bz = morton3d::compactBits(g >> 2) << SVO_BRICK_LEVELS;
+
+        uint32_t materials[SVO_BRICK_VOXELS];
+        float densities[SVO_BRICK_VOXELS];
+        for (uint32_t i = 0; i < SVO_BRICK_VOXELS; ++i) {
+            const size_t idx = (bx + (i & 3u))
+                             + (by + ((i >> 2) & 3u)) * static_cast<size_t>(C)
+                             + (bz + (i >> 4)) * CC;
+            materials[i] = materialIds[idx];
+            densities[i] = density[idx];
+        }
+
+        pending.push(brickLevel, emitBrick(brickWords, brickCount, materials, densities));
+    }
+}
+
+// buildFromStorage's brick walk. Depth is the chunk's maxDepth for the common chunk edges (32, 64, 128), the loop
+// bounds and the storage index maths are then constants the compiler can unroll and vectorise.
+// Depth 0 reads maxDepth and the storage's brick shift at runtime
+template<uint32_t Depth>
+static void buildStorageBricks(SvoTree& tree, const ChunkStorage& storage) {
+    static_assert(Depth == 0 || Depth >= ChunkStorage::MAX_BRICK_SHIFT, "fixed depths hold whole 8^3 storage bricks");
+    const uint32_t maxDepth = Depth ? Depth : tree.maxDepth;
+    assert(Depth == 0 || (maxDepth == tree.maxDepth && storage.brickShift() == ChunkStorage::MAX_BRICK_SHIFT));
+
+    // storage bricks and svo bricks are both aligned octree subtrees (storage ones 4^3 or bigger here),
+    // so walking storage bricks in morton order and the svo bricks inside each in morton order
+    // visits them in the same order as buildFromDense
+    const uint32_t shift = Depth ? ChunkStorage::MAX_BRICK_SHIFT : storage.brickShift();
+    const uint32_t storageLevel = maxDepth - shift;
+    const uint32_t brickLevel = maxDepth - SVO_BRICK_LEVELS;
+    const uint32_t perAxis = 1u << (maxDepth - shift);
+    const uint64_t storageBricks = static_cast<uint64_t>(perAxis) * perAxis * perAxis;
+    const uint32_t subPerAxis = 1u << (shift - SVO_BRICK_LEVELS);
+    const uint64_t subBricks = static_cast<uint64_t>(subPerAxis) * subPerAxis * subPerAxis;
+    PendingLevels pending(tree.nodes, tree.rootIndex, brickLevel);
+
+    for (uint64_t g = 0; g < storageBricks; ++g) {
+        const uint32_t bx = morton3d::compactBits(g     );
+        const uint32_t by = morton3d::compactBits(g >> 1);
+        const uint32_t bz = morton3d::compactBits(g >> 2);
+
+        const ChunkStorage::Brick* brick = storage.brick(bx, by, bz);
+        if (!brick) {
+            // the whole subtree is empty, its root is an empty leaf
+            pending.push(storageLevel, makeEmptyNode());
+            continue;
+        }
+
+        for (uint64_t h = 0; h < subBricks; ++h) {
+            const uint32_t lx = morton3d::compactBits(h     ) << SVO_BRICK_LEVELS;
+            const uint32_t ly = morton3d::compactBits(h >> 1) << SVO_BRICK_LEVELS;
+            const uint32_t lz = morton3d::compactBits(h >> 2) << SVO_BRICK_LEVELS;
+
+            uint32_t materials[SVO_BRICK_VOXELS];
+            float densities[SVO_BRICK_VOXELS];
+            for (uint32_t i = 0; i < SVO_BRICK_VOXELS; ++i) {
+                const uint32_t idx = (lx + (i & 3u))
+                                   | ((ly + ((i >> 2) & 3u)) << shift)
+                                   | ((lz + (i >> 4)) << (2 * shift));
+
+                const uint8_t d = brick->density[idx];
+                materials[i] = d != 0 ? storage.paletteMaterial(brick->material[idx]) : 0u;
+                densities[i] = ChunkStorage::dequantizeDensity(d);
+            }
+
+            pending.push(brickLevel, emitBrick(tree.brickWords, tree.brickCount, materials, densities));
+        }
+    }
+}
+
+void SvoTree::buildFromStorage(const ChunkStorage& storage) {
+    assert(storage.size() == (1u << maxDepth));
+
+    clear();
+
+    const uint32_t C = storage.size();
+    if (maxDepth < SVO_BRICK_LEVELS) {
+        for (uint32_t z = 0; z < C; ++z)
+            for (uint32_t y = 0; y < C; ++y)
+                for (uint32_t x = 0; x < C; ++x) {
+                    const float d = storage.density(x, y, z);
+                    if (d > 0.0f) insertVoxel(x, y, z, storage.material(x, y, z), d);
+                }
+        return;
+    }
+
+    if (maxDepth == 5) buildStorageBricks<5>(*this, storage);
+    else if (maxDepth == 6) buildStorageBricks<6>(*this, storage);
+    else if (maxDepth == 7) buildStorageBricks<7>(*this, storage);
+    else buildStorageBricks<0>(*this, storage);
+}
+
+bool SvoTree::patchFromStorage(const ChunkStorage& storage, uint32_t x, uint32_t y, uint32_t z, SvoPatch& patch) {
+    if (maxDepth < SVO_BRICK_LEVELS || storage.size() != (1u << maxDepth) || nodes.empty())
+        return false;
+    const uint32_t dim = 1u << maxDepth;
+    if (x >= dim || y >= dim || z >= dim)
+        return true; // OUT OF BOUNDS, nothing changed
+
+    // the brick the way buildFromStorage would emit it
+    const uint32_t cornerMask = ~(SVO_BRICK_SIZE - 1u);
+    const uint32_t bx = x & cornerMask, by = y & cornerMask, bz = z & cornerMask;
+    uint32_t materials[SVO_BRICK_VOXELS];
+    float densities[SVO_BRICK_VOXELS];
+    for (uint32_t i = 0; i < SVO_BRICK_VOXELS; ++i) {
+        const uint32_t vx = bx + (i & 3u), vy = by + ((i >> 2) & 3u), vz = bz + (i >> 4);
+        densities[i] = storage.density(vx, vy, vz);
+        materials[i] = densities[i] > 0.0f ? storage.material(vx, vy, vz) : 0u;
+    }
+    std::vector<uint32_t> words;
+    uint32_t emitted = 0;
+    const SvoNode brick = emitBrick(words, emitted, materials, densities); // firstChild is 0, relative to words
+    const bool filled = svoIsBrick(brick);
+
+    const uint64_t code = morton3d::encode(x, y, z);
+    const uint32_t brickLevel = maxDepth - SVO_BRICK_LEVELS;
+    uint32_t path[33]; // node index per level, root first
+    path[0] = rootIndex;
+
+    for (uint32_t level = 0; level < brickLevel; ++level) {
+        const SvoNode node = nodes[path[level]];
+        const uint32_t oct = morton3d::octantFromCode(code, maxDepth, level);
+        if (node.childMask & (1u << oct)) {
+            path[level + 1] = svoChildIndex(node, oct);
+            continue;
+        }
+        if (!filled)
+            return true; // empty before, empty now
+
+        // the sibling block moves to the end with room for the new child
+        const auto stale = static_cast<uint32_t>(std::popcount(node.childMask));
+        path[level + 1] = ensureChild(nodes, path[level], oct);
+        patch.nodes.push_back({nodes[path[level]].firstChild, stale + 1});
+        staleNodes += stale;
+    }
+
+    const uint32_t index = path[brickLevel];
+    const SvoNode old = nodes[index];
+    const uint32_t oldWords = svoIsBrick(old)
+        ? 2u + static_cast<uint32_t>(std::popcount(svoBrickBits(brickWords.data() + old.firstChild))) : 0u;
+
+    // nodes above level 'top' on the path get new aggregates
+    uint32_t top = brickLevel;
+    if (filled) {
+        const auto count = static_cast<uint32_t>(words.size());
+        SvoNode n = brick;
+        if (oldWords >= count) {
+            // same size or smaller, rewritten where it is
+            n.firstChild = old.firstChild;
+            staleWords += oldWords - count;
+        } else {
+            n.firstChild = static_cast<uint32_t>(brickWords.size());
+            brickWords.resize(brickWords.size() + count);
+            staleWords += oldWords;
+            if (oldWords == 0) brickCount++;
+        }
+        std::copy(words.begin(), words.end(), brickWords.begin() + n.firstChild);
+        patch.words.push_back({n.firstChild, count});
+        nodes[index] = n;
+        patch.nodes.push_back({index, 1});
+    } else {
+        if (oldWords == 0)
+            return true; // wasn't a brick, nothing to drop
+        staleWords += oldWords;
+        brickCount--;
+        nodes[index] = makeEmptyNode();
+        if (brickLevel == 0) patch.nodes.push_back({index, 1});
+
+        // take the emptied node out of its parent's block, the later siblings close the gap.
+        // a parent left without children is emptied too and goes the same way
+        while (top > 0) {
+            const uint32_t parentIndex = path[top - 1];
+            const SvoSpan moved = dropChild(nodes, parentIndex, morton3d::octantFromCode(code, maxDepth, top - 1));
+            if (moved.count > 0) patch.nodes.push_back(moved);
+            patch.nodes.push_back({parentIndex, 1});
+            staleNodes++;
+            if (nodes[parentIndex].childMask != 0u) break;
+            --top;
+        }
+        if (top == 0)
+            return true; // emptied all the way up, no aggregates left to fix
+    }
+
+    for (uint32_t level = top; level-- > 0;) {
+        aggregateChildren(nodes, path[level]);
+        patch.nodes.push_back({path[level], 1});
+    }
+    return true;
+}
+
+// dense occupancy bits of a whole chunk for the ao bake, index x | y << depth | z << 2*depth.
+// Depth = the chunk's maxDepth for the common chunk edges (32, 64, 128) so the lookups are constant shifts,
+// 0 = the depth member
+template<uint32_t Depth>
+struct OccupancyGrid {
+    uint32_t depth;
+    std::vector<uint64_t> bits;
+
+    [[nodiscard]] uint32_t shift() const { return Depth ? Depth : depth; }
+
+    void set(uint32_t x, uint32_t y, uint32_t z) {
+        const size_t i = static_cast<size_t>(x) | (static_cast<size_t>(y) << shift()) | (static_cast<size_t>(z) << (2 * shift()));
+        bits[i >> 6] |= uint64_t{1} << (i & 63u);
+    }
+
+    // outside the chunk counts as open, the neighbour chunk isn't looked at
+    [[nodiscard]] bool filled(int x, int y, int z) const {
+        // negative coords wrap around past the edge too
+        const uint32_t C = 1u << shift();
+        if (static_cast<uint32_t>(x) >= C || static_cast<uint32_t>(y) >= C || static_cast<uint32_t>(z) >= C) return false;
+        const size_t i = static_cast<size_t>(x) | (static_cast<size_t>(y) << shift()) | (static_cast<size_t>(z) << (2 * shift()));
+        return ((bits[i >> 6] >> (i & 63u)) & 1u) != 0;
+    }
+};
+
+// every neighbour direction, faces edges and corners
+static const std::array<glm::ivec3, 26>& aoDirections() {
+    static const std::array<glm::ivec3, 26> dirs = [] {
+        std::array<glm::ivec3, 26> out{};
+        uint32_t n = 0;
+        for (int z = -1; z <= 1; ++z)
+            for (int y = -1; y <= 1; ++y)
+                for (int x = -1; x <= 1; ++x)
+                    if (x != 0 || y != 0 || z != 0) out[n++] = glm::ivec3(x, y, z);
+        return out;
+    }();
+    return dirs;
+}
 
-        nodes[parentIndex].childMask |= (1u << oct);
+// 0..SVO_BAKED_AO_LEVELS, how many of the 26 directions get SVO_BAKED_AO_RADIUS voxels out without hitting anything
+template<uint32_t Depth>
+static uint32_t bakeVoxelAo(const OccupancyGrid<Depth>& grid, const glm::ivec3& p) {
+    // enclosed, no ray can reach it
+    if (grid.filled(p.x - 1, p.y, p.z) && grid.filled(p.x + 1, p.y, p.z) &&
+        grid.filled(p.x, p.y - 1, p.z) && grid.filled(p.x, p.y + 1, p.z) &&
+        grid.filled(p.x, p.y, p.z - 1) && grid.filled(p.x, p.y, p.z + 1))
+        return 0;
+
+    uint32_t open = 0;
+    for (const glm::ivec3& d : aoDirections()) {
+        bool blocked = false;
+        for (int k = 1; k <= static_cast<int>(SVO_BAKED_AO_RADIUS) && !blocked; ++k)
+            blocked = grid.filled(p.x + d.x * k, p.y + d.y * k, p.z + d.z * k);
+        if (!blocked) open++;
     }
+    // a voxel in an open flat floor sees the 9 directions above it, that counts as fully open
+    return std::min(open * SVO_BAKED_AO_LEVELS / 9u, SVO_BAKED_AO_LEVELS);
 }
 
-const SvoNode *SvoTree::findLeaf(uint32_t x, uint32_t y, uint32_t z) const {
+// walks down to every brick below index, cell = its size in voxels
+template<uint32_t Depth>
+static void bakeNodeAo(const std::vector<SvoNode>& nodes, std::vector<uint32_t>& words, const OccupancyGrid<Depth>& grid,
+                       uint32_t index, const glm::ivec3& corner, uint32_t cell) {
+    const SvoNode& node = nodes[index];
+    if (svoIsBrick(node)) {
+        uint32_t* brick = words.data() + node.firstChild;
+        const uint64_t bits = svoBrickBits(brick);
+        uint32_t rank = 0;
+        for (uint32_t i = 0; i < SVO_BRICK_VOXELS; ++i) {
+            if ((bits & (uint64_t{1} << i)) == 0) continue;
+            const glm::ivec3 p = corner + glm::ivec3(i & 3u, (i >> 2) & 3u, i >> 4);
+            uint32_t& word = brick[2 + rank++];
+            word = (word & SVO_MATERIAL_MASK) | SVO_BAKED_AO_FLAG | (bakeVoxelAo(grid, p) << SVO_BAKED_AO_SHIFT);
+        }
+        return;
+    }
+
+    const uint32_t half = cell >> 1;
+    for (uint32_t oct = 0; oct < 8; ++oct) {
+        if ((svoChildBits(node) & (1u << oct)) == 0u) continue;
+        const glm::ivec3 offset(oct & 1u, (oct >> 1) & 1u, oct >> 2);
+        bakeNodeAo(nodes, words, grid, svoChildIndex(node, oct), corner + offset * static_cast<int>(half), half);
+    }
+}
+
+template<uint32_t Depth>
+static void bakeTreeAo(SvoTree& tree, const ChunkStorage& storage) {
+    OccupancyGrid<Depth> grid{tree.maxDepth, {}};
+    const uint32_t C = 1u << grid.shift();
+    grid.bits.assign((static_cast<size_t>(C) * C * C + 63u) / 64u, 0);
+
+    const uint32_t shift = storage.brickShift();
+    const uint32_t B = storage.brickSize();
+    const uint32_t mask = B - 1u;
+    const uint32_t perAxis = storage.bricksPerAxis();
+    for (uint32_t bz = 0; bz < perAxis; ++bz)
+        for (uint32_t by = 0; by < perAxis; ++by)
+            for (uint32_t bx = 0; bx < perAxis; ++bx) {
+                const ChunkStorage::Brick* brick = storage.brick(bx, by, bz);
+                if (!brick) continue;
+
+                for (uint32_t i = 0; i < B * B * B; ++i) {
+                    if (brick->density[i] == 0) continue;
+                    grid.set(bx * B + (i & mask), by * B + ((i >> shift) & mask), bz * B + (i >> (2 * shift)));
+                }
+            }
+
+    bakeNodeAo(tree.nodes, tree.brickWords, grid, tree.rootIndex, glm::ivec3(0), C);
+}
+
+void SvoTree::bakeAmbientOcclusion(const ChunkStorage& storage) {
+    assert(storage.size() == (1u << maxDepth));
+
+    if (maxDepth == 5) bakeTreeAo<5>(*this, storage);
+    else if (maxDepth == 6) bakeTreeAo<6>(*this, storage);
+    else if (maxDepth == 7) bakeTreeAo<7>(*this, storage);
+    else bakeTreeAo<0>(*this, storage);
+    aoBaked = true;
+}
+
+// findVoxel's descent, Depth = maxDepth for the common chunk edges so it unrolls, 0 = read it at runtime
+template<uint32_t Depth>
+static bool findVoxelIn(const SvoTree& tree, uint32_t x, uint32_t y, uint32_t z, uint32_t* materialId) {
+    const uint32_t maxDepth = Depth ? Depth : tree.maxDepth;
+    const std::vector<SvoNode>& nodes = tree.nodes;
+
     const uint32_t dim = 1u << maxDepth;
     if (x >= dim || y >= dim || z >= dim)
-        return nullptr;
+        return false;
 
     const uint64_t code = morton3d::encode(x, y, z);
 
-    uint32_t nodeIndex = rootIndex;
+    uint32_t nodeIndex = tree.rootIndex;
 
     for (uint32_t level = 0; level < maxDepth; ++level) {
-        const uint32_t oct = morton3d::octantFromCode(code, maxDepth, level);
         const SvoNode& node = nodes[nodeIndex];
 
+        if (svoIsBrick(node)) {
+            const uint32_t mask = SVO_BRICK_SIZE - 1u;
+            const uint32_t bit = (x & mask) | ((y & mask) << 2) | ((z & mask) << 4);
+            const uint32_t* brick = tree.brickWords.data() + node.firstChild;
+            if ((svoBrickBits(brick) & (uint64_t{1} << bit)) == 0)
+                return false;
+            if (materialId) *materialId = svoBrickMaterial(brick, bit);
+            return true;
+        }
+
+        if (node.childMask == 0u) {
+            // a merged leaf covers its whole cell
+            if (node.occupancy <= 0.0f) return false;
+            if (materialId) *materialId = node.materialId;
+            return true;
+        }
+
+        const uint32_t oct = morton3d::octantFromCode(code, maxDepth, level);
         if ((node.childMask & (1u << oct)) == 0u)
-            return nullptr; // this subtree is empty
+            return false; // this subtree is empty
 
         if (node.firstChild == INVALID_NODE_INDEX)
-            return nullptr; // logically shouldn't happen?
+            return false; // logically shouldn't happen?
 
-        nodeIndex = node.firstChild + oct;
+        nodeIndex = svoChildIndex(node, oct);
     }
 
     const SvoNode& leaf = nodes[nodeIndex];
     if (leaf.occupancy <= 0.0f)
-        return nullptr;
+        return false;
+
+    if (materialId) *materialId = leaf.materialId;
+    return true;
+}
 
-    return &leaf;
+bool SvoTree::findVoxel(uint32_t x, uint32_t y, uint32_t z, uint32_t* materialId) const {
+    if (maxDepth == 5) return findVoxelIn<5>(*this, x, y, z, materialId);
+    if (maxDepth == 6) return findVoxelIn<6>(*this, x, y, z, materialId);
+    if (maxDepth == 7) return findVoxelIn<7>(*this, x, y, z, materialId);
+    return findVoxelIn<0>(*this, x, y, z, materialId);
 }
 
 
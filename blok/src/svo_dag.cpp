@@ -0,0 +1,238 @@
+/*
+* File: svo_dag.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace blok {
+
+namespace {
+
+struct WordsHash {
+    size_t operator()(const std::vector<uint32_t>& words) const {
+        uint64_t h = 1469598103934665603ull; // fnv-1a
+        for (uint32_t w : words) {
+            h ^= w;
+            h *= 1099511628211ull;
+        }
+        return static_cast<size_t>(h);
+    }
+};
+
+// the shared dag, built up one chunk at a time.
+// dag nodes keep only geometry: materialId holds the filled voxel count below the node
+// and occupancy the filled fraction, so identical shapes hash the same whatever their materials
+struct DagBuilder {
+    std::vector<SvoNode> nodes;
+    std::vector<uint32_t> brickMasks; // 2 words per unique brick
+    std::vector<uint32_t> materials; // side channel, every chunk's voxels in octant order
+
+    std::unordered_map<std::vector<uint32_t>, uint32_t, WordsHash> blocks; // sibling records -> first node
+    std::unordered_map<uint64_t, uint32_t> masks; // brick occupancy -> word offset
+    std::vector<uint32_t> key;
+};
+
+// per tree node: its record in the dag and, for interior nodes, where its children block went
+struct ChunkDagState {
+    std::vector<SvoNode> records;
+    std::vector<uint32_t> childBlock;
+    std::vector<uint32_t> dagIndex; // where the node's own record lives in the dag
+    std::vector<uint32_t> rank; // filled voxels before the node in octant order
+};
+
+void appendRecord(std::vector<uint32_t>& key, const SvoNode& n) {
+    uint32_t occ;
+    std::memcpy(&occ, &n.occupancy, sizeof(occ));
+    key.push_back(n.childMask);
+    key.push_back(n.firstChild);
+    key.push_back(n.materialId);
+    key.push_back(occ);
+}
+
+// stores a block of sibling records once, returns the dag index of its first record
+uint32_t internBlock(DagBuilder& dag, const SvoNode* records, uint32_t count) {
+    dag.key.clear();
+    for (uint32_t i = 0; i < count; ++i)
+        appendRecord(dag.key, records[i]);
+
+    auto it = dag.blocks.find(dag.key);
+    if (it != dag.blocks.end())
+        return it->second;
+
+    const auto first = static_cast<uint32_t>(dag.nodes.size());
+    dag.nodes.insert(dag.nodes.end(), records, records + count);
+    dag.blocks.emplace(dag.key, first);
+    return first;
+}
+
+// bottom-up, fills state.records[index] with the node's geometry-only dag record
+void buildRecord(DagBuilder& dag, const SvoTree& tree, ChunkDagState& state, uint32_t index, uint32_t level) {
+    const SvoNode& node = tree.nodes[index];
+    const float cellVoxels = std::ldexp(1.0f, 3 * static_cast<int>(tree.maxDepth - level));
+    SvoNode rec{0u, INVALID_NODE_INDEX, 0u, 0.0f};
+
+    if (svoIsBrick(node)) {
+        const uint32_t* brick = tree.brickWords.data() + node.firstChild;
+        const uint64_t bits = svoBrickBits(brick);
+
+        auto it = dag.masks.find(bits);
+        if (it == dag.masks.end()) {
+            it = dag.masks.emplace(bits, static_cast<uint32_t>(dag.brickMasks.size())).first;
+            dag.brickMasks.push_back(brick[0]);
+            dag.brickMasks.push_back(brick[1]);
+        }
+
+        rec.childMask = SVO_BRICK_FLAG;
+        rec.firstChild = it->second;
+        rec.materialId = static_cast<uint32_t>(std::popcount(bits));
+    } else if (svoChildBits(node) == 0u) {
+        rec.materialId = node.occupancy > 0.0f ? 1u : 0u;
+    } else {
+        SvoNode children[8];
+        uint32_t count = 0;
+        uint32_t voxels = 0;
+        for (uint32_t oct = 0; oct < 8; ++oct) {
+            if ((node.childMask & (1u << oct)) == 0u) continue;
+            const uint32_t child = svoChildIndex(node, oct);
+            buildRecord(dag, tree, state, child, level + 1);
+            children[count++] = state.records[child];
+            voxels += state.records[child].materialId;
+        }
+
+        rec.childMask = svoChildBits(node);
+        rec.firstChild = internBlock(dag, children, count);
+        rec.materialId = voxels;
+        state.childBlock[index] = rec.firstChild;
+    }
+
+    rec.occupancy = static_cast<float>(rec.materialId) / cellVoxels;
+    state.records[index] = rec;
+}
+
+// top-down, places every node in the dag and appends the chunk's materials in the same octant order
+void placeNode(DagBuilder& dag, const SvoTree& tree, ChunkDagState& state, uint32_t index, uint32_t dagIndex, uint32_t rank) {
+    const SvoNode& node = tree.nodes[index];
+    state.dagIndex[index] = dagIndex;
+    state.rank[index] = rank;
+
+    if (svoIsBrick(node)) {
+        const uint32_t* brick = tree.brickWords.data() + node.firstChild;
+        const auto count = static_cast<uint32_t>(std::popcount(svoBrickBits(brick)));
+        dag.materials.insert(dag.materials.end(), brick + 2, brick + 2 + count);
+        return;
+    }
+
+    if (svoChildBits(node) == 0u) {
+        if (node.occupancy > 0.0f) dag.materials.push_back(node.materialId);
+        return;
+    }
+
+    uint32_t stored = 0;
+    for (uint32_t oct = 0; oct < 8; ++oct) {
+        if ((node.childMask & (1u << oct)) == 0u) continue;
+        const uint32_t child = svoChildIndex(node, oct);
+        placeNode(dag, tree, state, child, state.childBlock[index] + stored, rank);
+        rank += state.records[child].materialId;
+        stored++;
+    }
+}
+
+}
+
+void compressGpuSvoDag(const ChunkManager& mgr, WorldSvoGpu& gpuWorld) {
+    if (gpuWorld.dagPacked || gpuWorld.chunkRanges.empty()) return;
+    BLOK_PROFILE_NAMED(timer, "compressGpuSvoDag");
+
+    // gpu built trees have no cpu copy to hash
+    for (const auto& kv : gpuWorld.chunkRanges) {
+        if (!kv.second.gpuBuilt) continue;
+        BLOK_PROFILE_DETAIL(timer, "skipped, some chunks are built on the gpu");
+        return;
+    }
+
+    DagBuilder dag;
+    // only read by the profiler detail
+    [[maybe_unused]] size_t treeNodes = 0;
+    [[maybe_unused]] size_t treeWords = 0;
+
+    for (auto& kv : gpuWorld.chunkRanges) {
+        const Chunk* found = mgr.packedChunk(kv.first);
+        if (!found) continue;
+
+        const SvoTree& tree = found->svo;
+        const ChunkGpuRange& range = kv.second;
+        treeNodes += tree.nodes.size();
+        treeWords += tree.brickWords.size();
+
+        ChunkDagState state;
+        state.records.resize(tree.nodes.size());
+        state.childBlock.assign(tree.nodes.size(), INVALID_NODE_INDEX);
+        state.dagIndex.assign(tree.nodes.size(), INVALID_NODE_INDEX);
+        state.rank.assign(tree.nodes.size(), 0u);
+
+        buildRecord(dag, tree, state, tree.rootIndex, 0);
+        const uint32_t root = internBlock(dag, &state.records[tree.rootIndex], 1);
+
+        const auto materialBase = static_cast<uint32_t>(dag.materials.size());
+        placeNode(dag, tree, state, tree.rootIndex, root, 0);
+
+        // point the chunk's sub-chunks into the dag. the brick words offset gets fixed up below
+        SubChunkGpu* block = gpuWorld.globalSubChunks.data() + static_cast<size_t>(range.slot) * gpuWorld.subChunksPerChunk;
+        for (uint32_t i = 0; i < gpuWorld.subChunksPerChunk; ++i) {
+            SubChunkGpu& sub = block[i];
+            if (sub.nodeCount == 0) continue;
+
+            const uint32_t localRoot = sub.rootNodeIndex;
+            sub.nodeOffset = 0;
+            sub.rootNodeIndex = state.dagIndex[localRoot];
+            sub.brickOffset = 0;
+            sub.materialBase = materialBase + state.rank[localRoot];
+        }
+    }
+
+    const auto dagNodes = static_cast<uint32_t>(dag.nodes.size());
+    const auto maskWords = static_cast<uint32_t>(dag.brickMasks.size());
+
+#ifdef BLOK_COMPACT_SVO_NODES
+    if (dagNodes > COMPACT_MAX_CHILD || maskWords + COMPACT_BRICK_BIAS > COMPACT_MAX_CHILD)
+        throw std::runtime_error("compressGpuSvoDag: dag has too many nodes for 24 bit child pointers");
+#endif
+
+    // masks first, the material side channel right after them
+    for (auto& sub : gpuWorld.globalSubChunks) {
+        if (sub.nodeCount == 0) continue;
+        sub.nodeCount = dagNodes;
+        if (sub.materialBase != NO_DAG_MATERIALS) sub.materialBase += maskWords;
+    }
+
+    gpuWorld.globalNodes.resize(dag.nodes.size());
+    std::transform(dag.nodes.begin(), dag.nodes.end(), gpuWorld.globalNodes.begin(), toGpuSvoNode);
+
+    gpuWorld.globalBrickWords = std::move(dag.brickMasks);
+    gpuWorld.globalBrickWords.insert(gpuWorld.globalBrickWords.end(), dag.materials.begin(), dag.materials.end());
+
+    // everything moved, upload it all
+    gpuWorld.freeNodeRanges.clear();
+    gpuWorld.freeBrickRanges.clear();
+    gpuWorld.dirtyNodeRanges = {{0, dagNodes}};
+    gpuWorld.dirtyBrickRanges = {{0, static_cast<uint32_t>(gpuWorld.globalBrickWords.size())}};
+    gpuWorld.dirtySubChunkRanges = {{0, static_cast<uint32_t>(gpuWorld.globalSubChunks.size())}};
+    gpuWorld.dagPacked = true;
+
+    BLOK_PROFILE_DETAIL(timer, std::to_string(treeNodes) + " -> " + std::to_string(dagNodes) + " nodes, "
+        + std::to_string(dag.masks.size()) + " unique bricks, " + std::to_string(dag.materials.size()) + " materials, "
+        + std::to_string(treeNodes * sizeof(GpuSvoNode) + treeWords * sizeof(uint32_t)) + " -> "
+        + std::to_string(gpuWorld.globalNodes.size() * sizeof(GpuSvoNode) + gpuWorld.globalBrickWords.size() * sizeof(uint32_t)) + " bytes");
+}
+
+}
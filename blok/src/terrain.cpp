@@ -0,0 +1,301 @@
+/*
+* File: terrain.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "terrain.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "cpu_profiler.hpp"
+#include "material.hpp"
+
+namespace blok {
+
+namespace {
+
+// what the noise kernels read out of the settings
+struct TerrainKernel {
+    uint32_t seed;
+    float baseHeight;
+    float heightScale;
+    float frequency;
+    uint32_t octaves;
+    float moistureFrequency;
+    float caveFrequency;
+    float step; // voxels between samples, 2^lod
+};
+
+#if defined(_MSC_VER)
+#define BLOK_TERRAIN_INLINE __forceinline
+#else
+#define BLOK_TERRAIN_INLINE inline __attribute__((always_inline))
+#endif
+
+// lattice hash, integer only so it vectorises. the seed picks a different lattice per noise
+BLOK_TERRAIN_INLINE float latticeValue(uint32_t seed, int32_t x, int32_t y, int32_t z) {
+    uint32_t h = seed ^ static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(y) * 0xd8163841u ^ static_cast<uint32_t>(z) * 0xcb1ab31fu;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    h *= 0x297a2d39u;
+    h ^= h >> 15;
+    return static_cast<float>(h & 0xFFFFu) * (2.0f / 65535.0f) - 1.0f;
+}
+
+BLOK_TERRAIN_INLINE float smooth(float t) { return t * t * (3.0f - 2.0f * t); }
+BLOK_TERRAIN_INLINE float lerp(float a, float b, float t) { return a + (b - a) * t; }
+
+// bilinear value noise in [-1, 1]
+BLOK_TERRAIN_INLINE float valueNoise2(uint32_t seed, float x, float z) {
+    const float fx = std::floor(x), fz = std::floor(z);
+    const auto ix = static_cast<int32_t>(fx), iz = static_cast<int32_t>(fz);
+    const float tx = smooth(x - fx), tz = smooth(z - fz);
+    return lerp(lerp(latticeValue(seed, ix, 0, iz), latticeValue(seed, ix + 1, 0, iz), tx),
+                lerp(latticeValue(seed, ix, 0, iz + 1), latticeValue(seed, ix + 1, 0, iz + 1), tx), tz);
+}
+
+// trilinear value noise in [-1, 1]
+BLOK_TERRAIN_INLINE float valueNoise3(uint32_t seed, float x, float y, float z) {
+    const float fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+    const auto ix = static_cast<int32_t>(fx), iy = static_cast<int32_t>(fy), iz = static_cast<int32_t>(fz);
+    const float tx = smooth(x - fx), ty = smooth(y - fy), tz = smooth(z - fz);
+
+    const float x00 = lerp(latticeValue(seed, ix, iy, iz), latticeValue(seed, ix + 1, iy, iz), tx);
+    const float x10 = lerp(latticeValue(seed, ix, iy + 1, iz), latticeValue(seed, ix + 1, iy + 1, iz), tx);
+    const float x01 = lerp(latticeValue(seed, ix, iy, iz + 1), latticeValue(seed, ix + 1, iy, iz + 1), tx);
+    const float x11 = lerp(latticeValue(seed, ix, iy + 1, iz + 1), latticeValue(seed, ix + 1, iy + 1, iz + 1), tx);
+    return lerp(lerp(x00, x10, ty), lerp(x01, x11, ty), tz);
+}
+
+constexpr uint32_t ROW = 8; // lanes per row, one avx2 register of floats
+
+// heights and moisture of one row of columns, the cells at (gx0 + i * step, gz) for i < count, sampled at their
+// centers. fixed width loops the compiler vectorises (sse / neon as built, avx2 in the clone below).
+// octaves stay the outer loop so every lane does the same work
+BLOK_TERRAIN_INLINE void columnRow(const TerrainKernel& k, int32_t gx0, int32_t gz, uint32_t count, float* height, float* moisture) {
+    const float x0 = static_cast<float>(gx0) + 0.5f * k.step;
+    const float z = static_cast<float>(gz) + 0.5f * k.step;
+
+    float h[ROW] = {};
+    float amplitude = 1.0f, frequency = k.frequency, total = 0.0f;
+    for (uint32_t o = 0; o < k.octaves; ++o) {
+        const uint32_t seed = k.seed + o * 0x9e3779b9u;
+        for (uint32_t i = 0; i < ROW; ++i) {
+            const float x = x0 + static_cast<float>(i) * k.step;
+            h[i] += valueNoise2(seed, x * frequency, z * frequency) * amplitude;
+        }
+        total += amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+
+    float m[ROW];
+    const uint32_t moistureSeed = k.seed ^ 0x6c8e9cf5u;
+    for (uint32_t i = 0; i < ROW; ++i) {
+        const float x = x0 + static_cast<float>(i) * k.step;
+        m[i] = valueNoise2(moistureSeed, x * k.moistureFrequency, z * k.moistureFrequency);
+    }
+
+    const float scale = total > 0.0f ? k.heightScale / total : 0.0f;
+    for (uint32_t i = 0; i < ROW; ++i) h[i] = k.baseHeight + h[i] * scale;
+    for (uint32_t i = 0; i < count; ++i) {
+        height[i] = h[i];
+        moisture[i] = m[i];
+    }
+}
+
+// cave noise along one x row of cell centers, the cells at (gx0 + i * step, gy, gz)
+BLOK_TERRAIN_INLINE void caveRow(const TerrainKernel& k, int32_t gx0, int32_t gy, int32_t gz, uint32_t count, float* out) {
+    const uint32_t seed = k.seed ^ 0x1b873593u;
+    const float x0 = static_cast<float>(gx0) + 0.5f * k.step;
+    const float y = (static_cast<float>(gy) + 0.5f * k.step) * k.caveFrequency;
+    const float z = (static_cast<float>(gz) + 0.5f * k.step) * k.caveFrequency;
+
+    float c[ROW];
+    for (uint32_t i = 0; i < ROW; ++i) {
+        const float x = (x0 + static_cast<float>(i) * k.step) * k.caveFrequency;
+        c[i] = valueNoise3(seed, x, y, z);
+    }
+    for (uint32_t i = 0; i < count; ++i) out[i] = c[i];
+}
+
+// every column of a chunk, C cells of step voxels along each axis. height / moisture index x + z*C
+BLOK_TERRAIN_INLINE void columns(const TerrainKernel& k, int32_t gx0, int32_t gz0, uint32_t C, float* height, float* moisture) {
+    const auto step = static_cast<int32_t>(k.step);
+    for (uint32_t z = 0; z < C; ++z)
+        for (uint32_t x = 0; x < C; x += ROW)
+            columnRow(k, gx0 + static_cast<int32_t>(x) * step, gz0 + static_cast<int32_t>(z) * step, std::min(ROW, C - x),
+                      height + x + z * C, moisture + x + z * C);
+}
+
+// one full x row of a chunk
+BLOK_TERRAIN_INLINE void caves(const TerrainKernel& k, int32_t gx0, int32_t gy, int32_t gz, uint32_t C, float* out) {
+    const auto step = static_cast<int32_t>(k.step);
+    for (uint32_t x = 0; x < C; x += ROW)
+        caveRow(k, gx0 + static_cast<int32_t>(x) * step, gy, gz, std::min(ROW, C - x), out + x);
+}
+
+void columnsDefault(const TerrainKernel& k, int32_t gx0, int32_t gz0, uint32_t C, float* height, float* moisture) {
+    columns(k, gx0, gz0, C, height, moisture);
+}
+
+void cavesDefault(const TerrainKernel& k, int32_t gx0, int32_t gy, int32_t gz, uint32_t C, float* out) {
+    caves(k, gx0, gy, gz, C, out);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(_MSC_VER)
+__attribute__((target("avx2,fma")))
+void columnsAvx2(const TerrainKernel& k, int32_t gx0, int32_t gz0, uint32_t C, float* height, float* moisture) {
+    columns(k, gx0, gz0, C, height, moisture);
+}
+
+__attribute__((target("avx2,fma")))
+void cavesAvx2(const TerrainKernel& k, int32_t gx0, int32_t gy, int32_t gz, uint32_t C, float* out) {
+    caves(k, gx0, gy, gz, C, out);
+}
+#define BLOK_TERRAIN_AVX2
+#endif
+
+struct TerrainKernels {
+    void (*columns)(const TerrainKernel&, int32_t, int32_t, uint32_t, float*, float*);
+    void (*caves)(const TerrainKernel&, int32_t, int32_t, int32_t, uint32_t, float*);
+};
+
+const TerrainKernels& terrainKernels() {
+    static const TerrainKernels fns = [] {
+#ifdef BLOK_TERRAIN_AVX2
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return TerrainKernels{&columnsAvx2, &cavesAvx2};
+#endif
+        return TerrainKernels{&columnsDefault, &cavesDefault};
+    }();
+    return fns;
+}
+
+}
+
+TerrainGenerator::TerrainGenerator(const TerrainSettings& settings, MaterialLibrary& lib, uint32_t C, JobSystem& jobs)
+    : m_settings(settings), m_C(C), m_jobs(jobs) {
+    for (const TerrainBiome& b : settings.biomes)
+        m_biomes.push_back({b.maxMoisture, lib.getOrCreateFromColor(b.surfaceColor), lib.getOrCreateFromColor(b.soilColor)});
+    m_stone = lib.getOrCreateFromColor(settings.stoneColor);
+    m_snow = lib.getOrCreateFromColor(settings.snowColor);
+}
+
+TerrainGenerator::~TerrainGenerator() {
+    m_jobs.wait(m_inFlight);
+}
+
+int32_t TerrainGenerator::minY() const {
+    return static_cast<int32_t>(std::floor(m_settings.baseHeight - m_settings.heightScale)) - static_cast<int32_t>(m_settings.crustDepth);
+}
+
+int32_t TerrainGenerator::maxY() const {
+    return static_cast<int32_t>(std::ceil(m_settings.baseHeight + m_settings.heightScale));
+}
+
+bool TerrainGenerator::generate(const ChunkCoord& coord, ChunkStorage& out, uint32_t lod) const {
+    const auto full = static_cast<int32_t>(m_C);
+    const glm::ivec3 g0 = glm::ivec3(coord.x, coord.y, coord.z) * full;
+    // most of the world is air or buried, those chunks never touch the noise
+    if (g0.y > maxY() || g0.y + full <= minY()) return false;
+
+    // C cells of step voxels each, sampled at their centers. at lod 0 a cell is a voxel
+    const auto C = static_cast<int32_t>(m_C >> lod);
+    const auto step = static_cast<int32_t>(1u << lod);
+    const float cell = static_cast<float>(step);
+    assert(out.size() == m_C >> lod);
+
+    BLOK_PROFILE_SCOPE("generateTerrain");
+    const TerrainSettings& s = m_settings;
+    const TerrainKernel k{s.seed, s.baseHeight, s.heightScale, s.frequency, s.octaves, s.moistureFrequency, s.caveFrequency, cell};
+    const TerrainKernels& kernels = terrainKernels();
+
+    std::vector<float> height(size_t(C) * C), moisture(size_t(C) * C);
+    kernels.columns(k, g0.x, g0.z, static_cast<uint32_t>(C), height.data(), moisture.data());
+
+    // the chunk-local y band (in cells) any column fills, from the deepest crust bottom to the highest surface
+    const int32_t crustCells = (static_cast<int32_t>(s.crustDepth) + step - 1) / step + 1;
+    int32_t bandLo = C, bandHi = 0;
+    for (float h : height) {
+        const int32_t top = static_cast<int32_t>(std::ceil((h - static_cast<float>(g0.y)) / cell));
+        bandLo = std::min(bandLo, top - crustCells);
+        bandHi = std::max(bandHi, top);
+    }
+    bandLo = std::max(bandLo, 0);
+    bandHi = std::min(bandHi, C);
+    if (bandLo >= bandHi) return false;
+
+    // the biome's materials per column, only the top soilDepth + 1 voxels use them
+    std::vector<uint32_t> surface(size_t(C) * C), soil(size_t(C) * C);
+    for (size_t i = 0; i < surface.size(); ++i) {
+        const BiomeMaterials* biome = m_biomes.empty() ? nullptr : &m_biomes.back();
+        for (const BiomeMaterials& b : m_biomes)
+            if (moisture[i] <= b.maxMoisture) { biome = &b; break; }
+        surface[i] = height[i] > s.snowHeight ? m_snow : biome ? biome->surface : m_stone;
+        soil[i] = biome ? biome->soil : m_stone;
+    }
+
+    std::vector<float> cave(static_cast<size_t>(C));
+    std::vector<ChunkStorage::Write> writes;
+    writes.reserve(size_t(C));
+    bool any = false;
+    for (int32_t z = 0; z < C; ++z)
+        for (int32_t y = bandLo; y < bandHi; ++y) {
+            const int32_t gy = g0.y + y * step;
+            const float* rowHeight = height.data() + size_t(z) * C;
+            kernels.caves(k, g0.x, gy, g0.z + z * step, static_cast<uint32_t>(C), cave.data());
+
+            writes.clear();
+            for (int32_t x = 0; x < C; ++x) {
+                // the cell spans [gy, gy + step), partly covered at the surface. filled if any voxel of it would be,
+                // a coarse cell at the surface takes the surface material so the horizon keeps its biomes
+                const float depth = rowHeight[x] - static_cast<float>(gy);
+                if (depth <= 0.0f || depth - (cell - 1.0f) > static_cast<float>(s.crustDepth)) continue;
+                if (cave[x] > s.caveThreshold) continue;
+
+                const size_t column = size_t(x) + size_t(z) * C;
+                const uint32_t material = depth <= cell ? surface[column]
+                                        : depth <= cell + static_cast<float>(s.soilDepth) ? soil[column] : m_stone;
+                writes.push_back({uint32_t(x), uint32_t(y), uint32_t(z), material, std::min(depth / cell, 1.0f)});
+            }
+            if (writes.empty()) continue;
+            out.set(writes.data(), writes.size());
+            any = true;
+        }
+    return any;
+}
+
+void TerrainGenerator::request(const ChunkCoord& coord, uint32_t lod) {
+    m_jobs.submit([this, coord, lod] {
+        LoadedChunk loaded{coord, std::nullopt, lod};
+        ChunkStorage voxels(m_C >> lod);
+        if (generate(coord, voxels, lod)) loaded.voxels = std::move(voxels);
+
+        std::lock_guard lock(m_mutex);
+        m_finished.push_back(std::move(loaded));
+    }, &m_inFlight);
+}
+
+void TerrainGenerator::collect(std::vector<LoadedChunk>& out) {
+    std::lock_guard lock(m_mutex);
+    for (LoadedChunk& l : m_finished) out.push_back(std::move(l));
+    m_finished.clear();
+}
+
+ChunkLoader TerrainGenerator::loader() {
+    return [this](Chunk& ch) { return generate({ch.cx, ch.cy, ch.cz}, ch.voxels); };
+}
+
+AsyncChunkLoader TerrainGenerator::asyncLoader() {
+    AsyncChunkLoader l;
+    l.request = [this](const ChunkCoord& c) { request(c); };
+    l.collect = [this](std::vector<LoadedChunk>& out) { collect(out); };
+    l.requestLod = [this](const ChunkCoord& c, uint32_t lod) { request(c, lod); };
+    return l;
+}
+
+}
@@ -11,11 +11,16 @@
 
 #include "vox_loader.hpp"
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <unordered_map>
 
 #include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+#include "mapped_file.hpp"
 
 namespace blok {
 
@@ -56,34 +61,48 @@ static const uint32_t DEFAULT_PALETTE[256] = {
     0xffbbbbbb, 0xffaaaaaa, 0xff888888, 0xff777777, 0xff555555, 0xff444444, 0xff222222, 0xff111111
 };
 
-// file helpers
-template<typename T>
-static bool readValue(std::ifstream& file, T& value) {
-    file.read(reinterpret_cast<char*>(&value), sizeof(T));
-    return file.good();
-}
+// bounds checked cursor over the mapped file, reads never go past end and fail from then on
+struct VoxReader {
+    const uint8_t* p = nullptr;
+    const uint8_t* end = nullptr;
+    bool ok = true;
 
-static bool readBytes(std::ifstream& file, void* buffer, size_t count) {
-    file.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(count));
-    return file.good();
-}
+    [[nodiscard]] size_t remaining() const { return static_cast<size_t>(end - p); }
+
+    template<typename T>
+    bool read(T& value) {
+        if (!ok || remaining() < sizeof(T)) return ok = false;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    // zero copy, the span stays valid as long as the mapping
+    const uint8_t* take(size_t count) {
+        if (!ok || remaining() < count) { ok = false; return nullptr; }
+        const uint8_t* start = p;
+        p += count;
+        return start;
+    }
+
+    void skipTo(const uint8_t* target) { p = target < end ? target : end; }
+};
 
-static std::string readString(std::ifstream& file) {
+static std::string readString(VoxReader& r) {
     int32_t len;
-    if (!readValue(file, len) || len <= 0 || len > 1024) return "";
-    std::string str(len, '\0');
-    readBytes(file, str.data(), len);
-    return str;
+    if (!r.read(len) || len <= 0 || len > 1024) return "";
+    const uint8_t* bytes = r.take(static_cast<size_t>(len));
+    return bytes ? std::string(reinterpret_cast<const char*>(bytes), static_cast<size_t>(len)) : std::string();
 }
 
-static std::unordered_map<std::string, std::string> readDict(std::ifstream& file) {
+static std::unordered_map<std::string, std::string> readDict(VoxReader& r) {
     std::unordered_map<std::string, std::string> dict;
     int32_t numPairs;
-    if (!readValue(file, numPairs)) return dict;
+    if (!r.read(numPairs)) return dict;
 
-    for (int32_t i = 0; i < numPairs; ++i) {
-        std::string key = readString(file);
-        std::string value = readString(file);
+    for (int32_t i = 0; i < numPairs && r.ok; ++i) {
+        std::string key = readString(r);
+        std::string value = readString(r);
         if (!key.empty()) {
             dict[key] = value;
         }
@@ -113,6 +132,40 @@ static float parseFloat(const std::string& str, float defaultVal = 0.0f) {
     }
 }
 
+// _r: bits 0-1 column of row 0's nonzero entry, bits 2-3 row 1's, row 2 gets the one left.
+// bits 4-6 are the signs of rows 0-2 (set = -1)
+static glm::mat3 decodeVoxRotation(uint8_t r) {
+    const int c0 = r & 3;
+    const int c1 = (r >> 2) & 3;
+    if (c0 > 2 || c1 > 2 || c0 == c1) return glm::mat3(1.0f);
+    const int c2 = 3 - c0 - c1;
+
+    glm::mat3 m(0.0f);
+    m[c0][0] = (r & (1 << 4)) ? -1.0f : 1.0f; // glm is [column][row]
+    m[c1][1] = (r & (1 << 5)) ? -1.0f : 1.0f;
+    m[c2][2] = (r & (1 << 6)) ? -1.0f : 1.0f;
+    return m;
+}
+
+static void readVoxFrame(const std::unordered_map<std::string, std::string>& frame, VoxSceneNode& node) {
+    auto rIt = frame.find("_r");
+    if (rIt != frame.end()) {
+        try {
+            node.rotation = decodeVoxRotation(static_cast<uint8_t>(std::stoi(rIt->second)));
+        } catch (...) {}
+    }
+    auto tIt = frame.find("_t");
+    if (tIt != frame.end()) {
+        int x = 0, y = 0, z = 0;
+        if (std::sscanf(tIt->second.c_str(), "%d %d %d", &x, &y, &z) == 3) node.translation = glm::ivec3(x, y, z);
+    }
+}
+
+static bool readVoxHidden(const std::unordered_map<std::string, std::string>& attribs) {
+    auto it = attribs.find("_hidden");
+    return it != attribs.end() && it->second == "1";
+}
+
 Material VoxFile::getMaterial(uint8_t paletteIndex) const {
     Material mat;
 
@@ -148,23 +201,75 @@ Material VoxFile::getMaterial(uint8_t paletteIndex) const {
     return mat;
 }
 
-bool loadVoxFile(const std::string &filepath, VoxFile &outVox, std::string &errorMsg) {
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file.is_open()) {
-        errorMsg = "Failed to open file " + filepath;
-        return false;
+static void applyVoxMaterialProps(VoxMaterial& mat, const std::unordered_map<std::string, std::string>& props) {
+    mat.hasProperties = true;
+
+    // Parse type
+    auto typeIt = props.find("_type");
+    if (typeIt != props.end()) {
+        mat.type = parseVoxMaterialType(typeIt->second);
     }
 
+    // Parse properties
+    auto roughIt = props.find("_rough");
+    if (roughIt != props.end()) {
+        mat.roughness = parseFloat(roughIt->second, 0.5f);
+    }
+
+    auto metalIt = props.find("_metal");
+    if (metalIt != props.end()) {
+        mat.metallic = parseFloat(metalIt->second, 0.0f);
+    }
+
+    auto iorIt = props.find("_ior");
+    if (iorIt != props.end()) {
+        mat.ior = parseFloat(iorIt->second, 1.5f);
+    }
+
+    auto emitIt = props.find("_emit");
+    if (emitIt != props.end()) {
+        mat.emission = parseFloat(emitIt->second, 0.0f);
+    }
+
+    auto fluxIt = props.find("_flux");
+    if (fluxIt != props.end()) {
+        mat.flux = parseFloat(fluxIt->second, 0.0f);
+    }
+
+    auto alphaIt = props.find("_alpha");
+    if (alphaIt != props.end()) {
+        mat.alpha = parseFloat(alphaIt->second, 1.0f);
+    }
+
+    auto specIt = props.find("_sp");
+    if (specIt != props.end()) {
+        mat.specular = parseFloat(specIt->second, 0.5f);
+    }
+
+    auto glowIt = props.find("_g");
+    if (glowIt != props.end()) {
+        mat.glow = parseFloat(glowIt->second, 0.0f);
+    }
+}
+
+bool loadVoxFile(const std::string &filepath, VoxFile &outVox, std::string &errorMsg) {
+    BLOK_PROFILE_NAMED(timer, "loadVoxFile");
+    BLOK_PROFILE_DETAIL(timer, filepath);
+    MappedFile mapped;
+    if (!mapped.open(filepath, errorMsg)) return false;
+
+    VoxReader file{ mapped.data(), mapped.data() + mapped.size() };
+
     // read magic number
-    char magic[4];
-    if (!readBytes(file, magic, 4) || std::memcmp(magic, "VOX ", 4) != 0) {
+    const uint8_t* magic = file.take(4);
+    if (!magic || std::memcmp(magic, "VOX ", 4) != 0) {
         errorMsg = "Invalid VOX file: bad magic number";
         return false;
     }
 
     // read version
     int32_t version;
-    if (!readValue(file, version)) {
+    if (!file.read(version)) {
         errorMsg = "Failed to read VOX version";
         return false;
     }
@@ -177,6 +282,7 @@ bool loadVoxFile(const std::string &filepath, VoxFile &outVox, std::string &erro
     // init with default palette
     std::memcpy(outVox.palette, DEFAULT_PALETTE, sizeof(DEFAULT_PALETTE));
     outVox.models.clear();
+    outVox.sceneNodes.clear();
 
     // current model being parsed
     VoxModel currentModel{};
@@ -184,45 +290,49 @@ bool loadVoxFile(const std::string &filepath, VoxFile &outVox, std::string &erro
 
     // read MAIN chunk header
     VoxChunkHeader mainHeader;
-    if (!readBytes(file, mainHeader.id, 4) || std::memcmp(mainHeader.id, "MAIN", 4) != 0) {
+    const uint8_t* mainId = file.take(4);
+    if (!mainId || std::memcmp(mainId, "MAIN", 4) != 0) {
         errorMsg = "Invalid VOX file: missing MAIN chunk";
         return false;
     }
-    if (!readValue(file, mainHeader.contentSize) || !readValue(file, mainHeader.childrenSize)) {
+    if (!file.read(mainHeader.contentSize) || !file.read(mainHeader.childrenSize)) {
         errorMsg = "Failed to read MAIN chunk header";
         return false;
     }
 
     // Skip MAIN content (should be 0)
     if (mainHeader.contentSize > 0) {
-        file.seekg(mainHeader.contentSize, std::ios::cur);
+        file.skipTo(file.p + mainHeader.contentSize);
     }
     // Read child chunks
-    std::streampos endPos = file.tellg();
-    endPos += mainHeader.childrenSize;
+    const uint8_t* endPos = file.p + std::min<size_t>(file.remaining(), static_cast<size_t>(std::max(mainHeader.childrenSize, 0)));
 
-    while (file.tellg() < endPos && file.good()) {
+    while (file.p < endPos && file.ok) {
         VoxChunkHeader chunkHeader;
-        if (!readBytes(file, chunkHeader.id, 4)) break;
-        if (!readValue(file, chunkHeader.contentSize)) break;
-        if (!readValue(file, chunkHeader.childrenSize)) break;
+        const uint8_t* id = file.take(4);
+        if (!id) break;
+        std::memcpy(chunkHeader.id, id, 4);
+        if (!file.read(chunkHeader.contentSize)) break;
+        if (!file.read(chunkHeader.childrenSize)) break;
+        if (chunkHeader.contentSize < 0 || chunkHeader.childrenSize < 0) break;
 
-        std::streampos chunkEnd = file.tellg();
-        chunkEnd += chunkHeader.contentSize;
+        const uint8_t* chunkEnd = file.p + std::min<size_t>(file.remaining(), static_cast<size_t>(chunkHeader.contentSize));
+        // content is read through its own cursor, a short or corrupt chunk can't run into the next one
+        VoxReader content{ file.p, chunkEnd };
 
         // Handle chunk types
         if (std::memcmp(chunkHeader.id, "SIZE", 4) == 0) {
-            // New model size
-            if (hasSize && !currentModel.voxels.empty()) {
+            // New model size. empty models are kept too, shape nodes index models by position
+            if (hasSize) {
                 // Save previous model
                 outVox.models.push_back(std::move(currentModel));
                 currentModel = VoxModel{};
             }
 
-            int32_t x, y, z;
-            readValue(file, x);
-            readValue(file, y);
-            readValue(file, z);
+            int32_t x = 0, y = 0, z = 0;
+            content.read(x);
+            content.read(y);
+            content.read(z);
 
             currentModel.sizeX = static_cast<uint32_t>(x);
             currentModel.sizeY = static_cast<uint32_t>(y);
@@ -230,110 +340,84 @@ bool loadVoxFile(const std::string &filepath, VoxFile &outVox, std::string &erro
             hasSize = true;
         }
         else if (std::memcmp(chunkHeader.id, "XYZI", 4) == 0) {
-            // Voxel data
+            // Voxel data, the file layout is VoxVoxel's so it's one copy
             int32_t numVoxels;
-            if (!readValue(file, numVoxels)) {
+            if (!content.read(numVoxels) || numVoxels < 0) {
                 errorMsg = "Failed to read voxel count";
                 return false;
             }
 
-            currentModel.voxels.reserve(static_cast<size_t>(numVoxels));
-
-            for (int32_t i = 0; i < numVoxels; ++i) {
-                uint8_t x, y, z, colorIndex;
-                readValue(file, x);
-                readValue(file, y);
-                readValue(file, z);
-                readValue(file, colorIndex);
-
-                VoxVoxel v;
-                v.x = x;
-                v.y = y;
-                v.z = z;
-                v.colorIndex = colorIndex;
-                currentModel.voxels.push_back(v);
-            }
+            const size_t count = std::min(static_cast<size_t>(numVoxels), content.remaining() / sizeof(VoxVoxel));
+            currentModel.voxels.resize(count);
+            std::memcpy(currentModel.voxels.data(), content.take(count * sizeof(VoxVoxel)), count * sizeof(VoxVoxel));
         }
         else if (std::memcmp(chunkHeader.id, "RGBA", 4) == 0) {
             // Custom palette
             // index 0 is unused
-            for (int i = 0; i < 255; ++i) {
-                uint32_t rgba;
-                readValue(file, rgba);
-                outVox.palette[i + 1] = rgba;
-            }
-            uint32_t unused;
-            readValue(file, unused);
+            const uint8_t* rgba = content.take(255 * sizeof(uint32_t));
+            if (rgba) std::memcpy(outVox.palette + 1, rgba, 255 * sizeof(uint32_t));
         }
         else if (std::memcmp(chunkHeader.id, "MATL", 4) == 0) {
             // Material properties - NEW
             int32_t materialId;
-            if (!readValue(file, materialId)) {
-                file.seekg(chunkEnd);
-                continue;
-            }
-
-            auto props = readDict(file);
-
-            if (materialId >= 0 && materialId < 256) {
-                VoxMaterial& mat = outVox.materials[materialId];
-                mat.hasProperties = true;
-
-                // Parse type
-                auto typeIt = props.find("_type");
-                if (typeIt != props.end()) {
-                    mat.type = parseVoxMaterialType(typeIt->second);
-                }
-
-                // Parse properties
-                auto roughIt = props.find("_rough");
-                if (roughIt != props.end()) {
-                    mat.roughness = parseFloat(roughIt->second, 0.5f);
-                }
-
-                auto metalIt = props.find("_metal");
-                if (metalIt != props.end()) {
-                    mat.metallic = parseFloat(metalIt->second, 0.0f);
+            if (content.read(materialId)) {
+                auto props = readDict(content);
+                if (materialId >= 0 && materialId < 256) {
+                    applyVoxMaterialProps(outVox.materials[materialId], props);
                 }
-
-                auto iorIt = props.find("_ior");
-                if (iorIt != props.end()) {
-                    mat.ior = parseFloat(iorIt->second, 1.5f);
-                }
-
-                auto emitIt = props.find("_emit");
-                if (emitIt != props.end()) {
-                    mat.emission = parseFloat(emitIt->second, 0.0f);
-                }
-
-                auto fluxIt = props.find("_flux");
-                if (fluxIt != props.end()) {
-                    mat.flux = parseFloat(fluxIt->second, 0.0f);
-                }
-
-                auto alphaIt = props.find("_alpha");
-                if (alphaIt != props.end()) {
-                    mat.alpha = parseFloat(alphaIt->second, 1.0f);
+            }
+        }
+        else if (std::memcmp(chunkHeader.id, "nTRN", 4) == 0) {
+            // node id, attribs, child, reserved (-1), layer, frame count, frame attribs
+            int32_t nodeId, child, reserved, layer, numFrames;
+            if (content.read(nodeId)) {
+                VoxSceneNode node;
+                node.type = VoxSceneNode::Type::Transform;
+                node.hidden = readVoxHidden(readDict(content));
+                if (content.read(child) && content.read(reserved) && content.read(layer) && content.read(numFrames)) {
+                    node.child = child;
+                    if (numFrames > 0) readVoxFrame(readDict(content), node);
                 }
-
-                auto specIt = props.find("_sp");
-                if (specIt != props.end()) {
-                    mat.specular = parseFloat(specIt->second, 0.5f);
+                outVox.sceneNodes[nodeId] = std::move(node);
+            }
+        }
+        else if (std::memcmp(chunkHeader.id, "nGRP", 4) == 0) {
+            // node id, attribs, child count, child ids
+            int32_t nodeId, numChildren;
+            if (content.read(nodeId)) {
+                VoxSceneNode node;
+                node.type = VoxSceneNode::Type::Group;
+                node.hidden = readVoxHidden(readDict(content));
+                if (content.read(numChildren) && numChildren > 0) {
+                    node.children.resize(std::min(static_cast<size_t>(numChildren), content.remaining() / sizeof(int32_t)));
+                    for (auto& c : node.children) content.read(c);
                 }
-
-                auto glowIt = props.find("_g");
-                if (glowIt != props.end()) {
-                    mat.glow = parseFloat(glowIt->second, 0.0f);
+                outVox.sceneNodes[nodeId] = std::move(node);
+            }
+        }
+        else if (std::memcmp(chunkHeader.id, "nSHP", 4) == 0) {
+            // node id, attribs, model count, (model id, model attribs) per model
+            int32_t nodeId, numModels;
+            if (content.read(nodeId)) {
+                VoxSceneNode node;
+                node.type = VoxSceneNode::Type::Shape;
+                node.hidden = readVoxHidden(readDict(content));
+                if (content.read(numModels)) {
+                    for (int32_t i = 0; i < numModels && content.ok; ++i) {
+                        int32_t modelId;
+                        if (!content.read(modelId)) break;
+                        readDict(content);
+                        if (modelId >= 0) node.models.push_back(static_cast<uint32_t>(modelId));
+                    }
                 }
+                outVox.sceneNodes[nodeId] = std::move(node);
             }
         }
 
-        // Seek to end of chunk
-        file.seekg(chunkEnd);
-
-        // Skip children
+        // Seek to end of chunk, then skip children
+        file.skipTo(chunkEnd);
         if (chunkHeader.childrenSize > 0) {
-            file.seekg(chunkHeader.childrenSize, std::ios::cur);
+            file.skipTo(file.p + std::min<size_t>(file.remaining(), static_cast<size_t>(chunkHeader.childrenSize)));
         }
     }
 
@@ -349,6 +433,9 @@ bool loadVoxFile(const std::string &filepath, VoxFile &outVox, std::string &erro
 
     std::cout << "Loaded VOX file: " << filepath << "\n";
     std::cout << "  Models: " << outVox.models.size() << "\n";
+    if (!outVox.sceneNodes.empty()) {
+        std::cout << "  Scene nodes: " << outVox.sceneNodes.size() << "\n";
+    }
     for (size_t i = 0; i < outVox.models.size(); ++i) {
         const auto& m = outVox.models[i];
         std::cout << "  Model " << i << ": " << m.sizeX << "x" << m.sizeY << "x" << m.sizeZ
@@ -387,57 +474,254 @@ void importVoxMaterials(
     paletteToMaterial[0] = 0; // Empty maps to default
 }
 
+// palette index -> material id, resolved once instead of per voxel
+static std::array<uint32_t, 256> resolveVoxPalette(const VoxFile& vox, const MaterialLibrary* matLib) {
+    std::array<uint32_t, 256> paletteMaterial{};
+    for (int i = 0; i < 256; ++i) {
+        if (matLib) {
+            // Use material system
+            paletteMaterial[i] = matLib->getMaterialFromVoxPalette(static_cast<uint8_t>(i));
+        } else {
+            // Fallback: use color directly, same packing as setVoxel
+            uint8_t r, g, b;
+            vox.getPaletteRGB(static_cast<uint8_t>(i), r, g, b);
+            paletteMaterial[i] = (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | b;
+        }
+    }
+    return paletteMaterial;
+}
+
+static void appendVoxModelWrites(const VoxModel& model, const glm::vec3& worldOffset, const ChunkManager& chunkMgr,
+                                 const std::array<uint32_t, 256>& paletteMaterial, std::vector<VoxelWrite>& writes) {
+    writes.reserve(writes.size() + model.voxels.size());
+    for (const auto& v : model.voxels) {
+        // VOX uses Y-up, Z-forward coordinate system
+        glm::vec3 worldPos = worldOffset + glm::vec3(
+            static_cast<float>(v.x),
+            static_cast<float>(v.z),  // VOX Z -> our Y (up)
+            static_cast<float>(v.y)   // VOX Y -> our Z (forward)
+        );
+        writes.push_back({chunkMgr.worldToGlobalVoxel(worldPos), paletteMaterial[v.colorIndex], 1.0f});
+    }
+}
+
 uint32_t importVoxToChunks(
     const VoxFile& vox,
     ChunkManager& chunkMgr,
     const glm::vec3& worldOffset,
     uint32_t modelIndex
 ) {
+    BLOK_PROFILE_SCOPE("importVoxToChunks");
     if (modelIndex >= vox.models.size()) {
         std::cerr << "Invalid model index: " << modelIndex << " (only " << vox.models.size() << " models)\n";
         return 0;
     }
 
-    const VoxModel& model = vox.models[modelIndex];
-    uint32_t count = 0;
+    const std::array<uint32_t, 256> paletteMaterial = resolveVoxPalette(vox, chunkMgr.materialLib);
+
+    std::vector<VoxelWrite> writes;
+    appendVoxModelWrites(vox.models[modelIndex], worldOffset, chunkMgr, paletteMaterial, writes);
+
+    // one pass per chunk instead of a chunk lookup per voxel
+    chunkMgr.writeVoxels(writes);
+    const auto count = static_cast<uint32_t>(writes.size());
+
+    std::cout << "Imported " << count << " voxels from model " << modelIndex << "\n";
+    return count;
+}
+
+uint32_t importVoxModelsToChunks(
+    const VoxFile& vox,
+    ChunkManager& chunkMgr,
+    std::span<const glm::vec3> offsets
+) {
+    BLOK_PROFILE_SCOPE("importVoxModelsToChunks");
+    const size_t modelCount = std::min(offsets.size(), vox.models.size());
+    if (modelCount == 0) return 0;
+
+    const std::array<uint32_t, 256> paletteMaterial = resolveVoxPalette(vox, chunkMgr.materialLib);
+
+    // models convert independently, only worldToGlobalVoxel is shared and that's const
+    std::vector<std::vector<VoxelWrite>> perModel(modelCount);
+    JobSystem& jobs = chunkMgr.jobSystem();
+    JobCounter counter;
+    for (size_t i = 0; i < modelCount; ++i) {
+        jobs.submit([&, i] {
+            appendVoxModelWrites(vox.models[i], offsets[i], chunkMgr, paletteMaterial, perModel[i]);
+        }, &counter);
+    }
+    jobs.wait(counter);
+
+    // model order, so overlapping models resolve the same way as importing them one by one
+    size_t total = 0;
+    for (const auto& w : perModel) total += w.size();
+    std::vector<VoxelWrite> writes;
+    writes.reserve(total);
+    for (auto& w : perModel) {
+        writes.insert(writes.end(), w.begin(), w.end());
+        std::vector<VoxelWrite>().swap(w);
+    }
+    chunkMgr.writeVoxels(writes);
 
-    // Check if we have material library access via chunk manager
-    MaterialLibrary* matLib = chunkMgr.materialLib;
+    std::cout << "Imported " << writes.size() << " voxels from " << modelCount << " models\n";
+    return static_cast<uint32_t>(writes.size());
+}
 
+std::vector<VoxPlacement> flattenVoxScene(const VoxFile& vox) {
+    std::vector<VoxPlacement> placements;
+    if (vox.sceneNodes.empty()) {
+        for (uint32_t i = 0; i < vox.models.size(); ++i) placements.push_back({i});
+        return placements;
+    }
+
+    // depth cap so a broken file with a cycle can't recurse forever
+    auto visit = [&](auto& self, int32_t id, const glm::mat3& rotation, const glm::ivec3& translation, uint32_t depth) -> void {
+        auto it = vox.sceneNodes.find(id);
+        if (it == vox.sceneNodes.end() || depth > 64) return;
+        const VoxSceneNode& node = it->second;
+        if (node.hidden) return;
+
+        switch (node.type) {
+            case VoxSceneNode::Type::Transform:
+                self(self, node.child, rotation * node.rotation,
+                     translation + glm::ivec3(rotation * glm::vec3(node.translation)), depth + 1);
+                break;
+            case VoxSceneNode::Type::Group:
+                for (int32_t c : node.children) self(self, c, rotation, translation, depth + 1);
+                break;
+            case VoxSceneNode::Type::Shape:
+                for (uint32_t m : node.models) {
+                    if (m >= vox.models.size()) continue;
+                    // magicavoxel centers a model on its transform, pivot is size / 2 rounded down
+                    const VoxModel& model = vox.models[m];
+                    const glm::vec3 pivot(model.sizeX / 2, model.sizeY / 2, model.sizeZ / 2);
+                    placements.push_back({m, rotation, translation - glm::ivec3(rotation * pivot)});
+                }
+                break;
+        }
+    };
+    visit(visit, 0, glm::mat3(1.0f), glm::ivec3(0), 0);
+    return placements;
+}
+
+// vox (z up) <-> engine (y up) is a y/z swap, same as appendVoxModelWrites
+static glm::vec3 voxToEngine(const glm::vec3& v) { return glm::vec3(v.x, v.z, v.y); }
+
+static void appendVoxPlacementWrites(const VoxModel& model, const VoxPlacement& placement, const glm::vec3& worldOffset,
+                                     const ChunkManager& chunkMgr, const std::array<uint32_t, 256>& paletteMaterial,
+                                     std::vector<VoxelWrite>& writes) {
+    writes.reserve(writes.size() + model.voxels.size());
+    const glm::vec3 translation(placement.translation);
     for (const auto& v : model.voxels) {
-        // VOX uses Y-up, Z-forward coordinate system
-        glm::vec3 worldPos = worldOffset + glm::vec3(
-            static_cast<float>(v.x),
-            static_cast<float>(v.z),  // VOX Z -> our Y (up)
-            static_cast<float>(v.y)   // VOX Y -> our Z (forward)
-        );
+        // the rotated cell's min corner, rotating the center keeps it on the grid
+        const glm::vec3 center = glm::vec3(v.x, v.y, v.z) + 0.5f;
+        const glm::vec3 corner = placement.rotation * center + translation - 0.5f;
+        writes.push_back({chunkMgr.worldToGlobalVoxel(worldOffset + voxToEngine(corner)), paletteMaterial[v.colorIndex], 1.0f});
+    }
+}
 
-        if (matLib) {
-            // Use material system
-            uint32_t materialId = matLib->getMaterialFromVoxPalette(v.colorIndex);
-            chunkMgr.setVoxelMaterial(worldPos, materialId, 1.0f);
-        } else {
-            // Fallback: use color directly
-            uint8_t r, g, b;
-            vox.getPaletteRGB(v.colorIndex, r, g, b);
-            chunkMgr.setVoxel(worldPos, r, g, b, 1.0f);
+uint32_t importVoxScene(
+    const VoxFile& vox,
+    ChunkManager& chunkMgr,
+    const glm::vec3& worldOffset,
+    VoxSceneImport mode
+) {
+    BLOK_PROFILE_SCOPE("importVoxScene");
+    const std::vector<VoxPlacement> placements = flattenVoxScene(vox);
+    if (placements.empty()) return 0;
+
+    std::vector<uint32_t> uses(vox.models.size(), 0);
+    for (const auto& p : placements) uses[p.modelIndex]++;
+
+    // what gets written: (placement, offset) pairs. instanced models are written once, untransformed,
+    // into a parked source block and their placements become tlas transforms
+    struct Work {
+        VoxPlacement placement;
+        glm::vec3 offset;
+    };
+    std::vector<Work> work;
+    std::vector<int32_t> instanceSet(vox.models.size(), -1);
+
+    const float chunkWorld = static_cast<float>(chunkMgr.C) * chunkMgr.voxelSize;
+    // y/z swap as a matrix, engine rotation = swap * vox rotation * swap
+    const glm::mat3 swapYZ(1, 0, 0, 0, 0, 1, 0, 1, 0);
+
+    for (const auto& p : placements) {
+        const VoxModel& model = vox.models[p.modelIndex];
+        if (model.voxels.empty()) continue;
+
+        if (mode == VoxSceneImport::Copy || uses[p.modelIndex] < 2) {
+            work.push_back({p, worldOffset});
+            continue;
+        }
+
+        int32_t& setIndex = instanceSet[p.modelIndex];
+        if (setIndex < 0) {
+            // engine-space extent in chunks, y/z swapped
+            const glm::ivec3 extent(
+                static_cast<int32_t>(std::ceil(static_cast<float>(model.sizeX) / chunkWorld)),
+                static_cast<int32_t>(std::ceil(static_cast<float>(model.sizeZ) / chunkWorld)),
+                static_cast<int32_t>(std::ceil(static_cast<float>(model.sizeY) / chunkWorld)));
+            const ChunkCoord min = chunkMgr.allocateInstanceSource(extent);
+
+            ChunkInstanceSet set;
+            set.sourceMin = min;
+            set.sourceMax = { min.x + std::max(extent.x, 1) - 1, min.y + std::max(extent.y, 1) - 1, min.z + std::max(extent.z, 1) - 1 };
+            setIndex = static_cast<int32_t>(chunkMgr.instanceSets.size());
+            chunkMgr.instanceSets.push_back(std::move(set));
+
+            const glm::vec3 sourceOrigin = glm::vec3(min.x, min.y, min.z) * chunkWorld;
+            work.push_back({VoxPlacement{p.modelIndex}, sourceOrigin});
         }
-        count++;
+
+        // source world -> world: back to vox space at the source, place, then out to engine space at worldOffset
+        ChunkInstanceSet& set = chunkMgr.instanceSets[setIndex];
+        const glm::vec3 sourceOrigin = glm::vec3(set.sourceMin.x, set.sourceMin.y, set.sourceMin.z) * chunkWorld;
+        glm::mat4 m(swapYZ * p.rotation * swapYZ);
+        m[3] = glm::vec4(worldOffset + voxToEngine(glm::vec3(p.translation)), 1.0f);
+        m = m * glm::mat4(glm::vec4(1, 0, 0, 0), glm::vec4(0, 1, 0, 0), glm::vec4(0, 0, 1, 0), glm::vec4(-sourceOrigin, 1.0f));
+        set.transforms.push_back(m);
     }
 
-    std::cout << "Imported " << count << " voxels from model " << modelIndex << "\n";
-    return count;
+    const std::array<uint32_t, 256> paletteMaterial = resolveVoxPalette(vox, chunkMgr.materialLib);
+
+    // same as importVoxModelsToChunks, convert in parallel, write in order
+    std::vector<std::vector<VoxelWrite>> perWork(work.size());
+    JobSystem& jobs = chunkMgr.jobSystem();
+    JobCounter counter;
+    for (size_t i = 0; i < work.size(); ++i) {
+        jobs.submit([&, i] {
+            appendVoxPlacementWrites(vox.models[work[i].placement.modelIndex], work[i].placement, work[i].offset,
+                                     chunkMgr, paletteMaterial, perWork[i]);
+        }, &counter);
+    }
+    jobs.wait(counter);
+
+    size_t total = 0;
+    for (const auto& w : perWork) total += w.size();
+    std::vector<VoxelWrite> writes;
+    writes.reserve(total);
+    for (auto& w : perWork) {
+        writes.insert(writes.end(), w.begin(), w.end());
+        std::vector<VoxelWrite>().swap(w);
+    }
+    chunkMgr.writeVoxels(writes);
+
+    size_t instanced = 0;
+    for (size_t m = 0; m < instanceSet.size(); ++m) if (instanceSet[m] >= 0) instanced += uses[m];
+    std::cout << "Imported " << writes.size() << " voxels from " << placements.size() << " placements ("
+              << instanced << " instanced)\n";
+    return static_cast<uint32_t>(writes.size());
 }
 
-bool loadAndImportVox(
+// load + materials, shared by the loadAndImport helpers
+static bool loadVoxForImport(
     const std::string& filepath,
     ChunkManager& chunkMgr,
     MaterialLibrary* materialLib,
-    const glm::vec3& worldOffset,
-    uint32_t modelIndex,
+    VoxFile& vox,
     std::string* errorMsg
 ) {
-    VoxFile vox;
     std::string err;
 
     if (!loadVoxFile(filepath, vox, err)) {
@@ -454,10 +738,38 @@ bool loadAndImportVox(
         // Ensure chunk manager knows about the material library
         chunkMgr.setMaterialLibrary(materialLib);
     }
+    return true;
+}
+
+bool loadAndImportVox(
+    const std::string& filepath,
+    ChunkManager& chunkMgr,
+    MaterialLibrary* materialLib,
+    const glm::vec3& worldOffset,
+    uint32_t modelIndex,
+    std::string* errorMsg
+) {
+    VoxFile vox;
+    if (!loadVoxForImport(filepath, chunkMgr, materialLib, vox, errorMsg)) return false;
 
     uint32_t count = importVoxToChunks(vox, chunkMgr, worldOffset, modelIndex);
     return count > 0;
 }
 
+bool loadAndImportVoxScene(
+    const std::string& filepath,
+    ChunkManager& chunkMgr,
+    MaterialLibrary* materialLib,
+    const glm::vec3& worldOffset,
+    VoxSceneImport mode,
+    std::string* errorMsg
+) {
+    VoxFile vox;
+    if (!loadVoxForImport(filepath, chunkMgr, materialLib, vox, errorMsg)) return false;
+
+    uint32_t count = importVoxScene(vox, chunkMgr, worldOffset, mode);
+    return count > 0;
+}
+
 
 }
\ No newline at end of file
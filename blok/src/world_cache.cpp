@@ -0,0 +1,361 @@
+/*
+* File: world_cache.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "world_cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+#include "mapped_file.hpp"
+#include "vox_loader.hpp"
+
+namespace blok {
+
+namespace {
+
+constexpr char WORLD_CACHE_MAGIC[4] = { 'B', 'L', 'K', 'W' };
+constexpr size_t SECTION_ALIGN = 16;
+
+struct WorldCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t paramsHash;
+
+    uint32_t nodeCount;
+    uint32_t brickWordCount;
+    uint32_t subChunkCount;
+    uint32_t chunkCount;
+    uint32_t instanceSetCount;
+    uint32_t transformCount;
+    uint32_t freeNodeRangeCount;
+    uint32_t freeBrickRangeCount;
+    uint32_t freeSlotCount;
+    uint32_t subChunksPerChunk;
+    uint32_t packSerial;
+    uint32_t dagPacked;
+};
+
+struct WorldCacheChunk {
+    ChunkCoord coord;
+    ChunkGpuRange range;
+};
+
+struct WorldCacheInstanceSet {
+    ChunkCoord sourceMin;
+    ChunkCoord sourceMax;
+    uint32_t firstTransform;
+    uint32_t transformCount;
+};
+
+// everything in the file is dumped and read back as raw bytes
+static_assert(std::is_trivially_copyable_v<GpuSvoNode>);
+static_assert(std::is_trivially_copyable_v<SubChunkGpu>);
+static_assert(std::is_trivially_copyable_v<WorldCacheChunk>);
+static_assert(std::is_trivially_copyable_v<VoxMaterial>);
+
+uint64_t fnv1a(const uint8_t* data, size_t size, uint64_t h = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+template<typename T>
+uint64_t hashValue(uint64_t h, const T& v) {
+    return fnv1a(reinterpret_cast<const uint8_t*>(&v), sizeof(T), h);
+}
+
+// anything that changes what packChunksToGpuSvo writes
+uint64_t packingParamsHash(const ChunkManager& mgr) {
+    uint64_t h = 14695981039346656037ull;
+    h = hashValue(h, mgr.C);
+    h = hashValue(h, mgr.maxDepth);
+    h = hashValue(h, mgr.voxelSize);
+    h = hashValue(h, mgr.subChunks.divisions);
+    h = hashValue(h, static_cast<uint32_t>(mgr.subChunks.adaptive));
+    h = hashValue(h, mgr.subChunks.leafThreshold);
+    h = hashValue(h, static_cast<uint32_t>(mgr.svoDag));
+    h = hashValue(h, static_cast<uint32_t>(mgr.bakeAmbientOcclusion));
+    h = hashValue(h, static_cast<uint32_t>(sizeof(GpuSvoNode)));
+    h = hashValue(h, static_cast<uint32_t>(sizeof(SubChunkGpu)));
+    h = hashValue(h, static_cast<uint32_t>(sizeof(ChunkGpuRange)));
+    return h;
+}
+
+class CacheWriter {
+public:
+    explicit CacheWriter(std::ofstream& out) : m_out(out) {}
+
+    template<typename T>
+    void section(const T* data, size_t count) {
+        static constexpr char zeros[SECTION_ALIGN] = {};
+        const size_t bytes = sizeof(T) * count;
+        if (bytes > 0) m_out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+        m_offset += bytes;
+        const size_t pad = (SECTION_ALIGN - m_offset % SECTION_ALIGN) % SECTION_ALIGN;
+        m_out.write(zeros, static_cast<std::streamsize>(pad));
+        m_offset += pad;
+    }
+
+private:
+    std::ofstream& m_out;
+    size_t m_offset = 0;
+};
+
+// bounds checked walk over the mapped sections, same padding as CacheWriter
+class CacheReader {
+public:
+    CacheReader(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+    template<typename T>
+    const T* section(size_t count) {
+        const size_t bytes = sizeof(T) * count;
+        if (!m_ok || m_size - m_offset < bytes) { m_ok = false; return nullptr; }
+        const T* p = reinterpret_cast<const T*>(m_data + m_offset);
+        m_offset += bytes;
+        m_offset = std::min(m_size, m_offset + (SECTION_ALIGN - m_offset % SECTION_ALIGN) % SECTION_ALIGN);
+        return p;
+    }
+
+    template<typename T>
+    void section(std::vector<T>& out, size_t count) {
+        const T* p = section<T>(count);
+        if (!p) return;
+        out.resize(count);
+        if (count > 0) std::memcpy(out.data(), p, sizeof(T) * count);
+    }
+
+    [[nodiscard]] bool ok() const { return m_ok; }
+
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_offset = 0;
+    bool m_ok = true;
+};
+
+}
+
+uint64_t hashWorldSource(const std::string& path) {
+    BLOK_PROFILE_SCOPE("hashWorldSource");
+    MappedFile file;
+    std::string err;
+    if (!file.open(path, err)) return 0;
+    return fnv1a(file.data(), file.size());
+}
+
+std::string worldCachePath(const std::string& sourcePath) {
+    return sourcePath + ".blokcache";
+}
+
+bool saveWorldCache(
+    const std::string& path,
+    uint64_t sourceHash,
+    const ChunkManager& mgr,
+    const WorldSvoGpu& world,
+    const VoxFile& vox,
+    const std::array<uint32_t, 256>& paletteToMaterial,
+    std::string& errorMsg
+) {
+    BLOK_PROFILE_SCOPE("saveWorldCache");
+    std::vector<WorldCacheChunk> chunks;
+    chunks.reserve(world.chunkRanges.size());
+    for (const auto& kv : world.chunkRanges) {
+        if (kv.second.gpuBuilt) {
+            errorMsg = "world has gpu built chunks, the cpu heaps are stale";
+            return false;
+        }
+        chunks.push_back({kv.first, kv.second});
+    }
+
+    std::vector<WorldCacheInstanceSet> sets;
+    std::vector<glm::mat4> transforms;
+    for (const ChunkInstanceSet& set : world.instanceSets) {
+        sets.push_back({set.sourceMin, set.sourceMax, static_cast<uint32_t>(transforms.size()), static_cast<uint32_t>(set.transforms.size())});
+        transforms.insert(transforms.end(), set.transforms.begin(), set.transforms.end());
+    }
+
+    WorldCacheHeader header{};
+    std::memcpy(header.magic, WORLD_CACHE_MAGIC, 4);
+    header.version = WORLD_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.paramsHash = packingParamsHash(mgr);
+    header.nodeCount = static_cast<uint32_t>(world.globalNodes.size());
+    header.brickWordCount = static_cast<uint32_t>(world.globalBrickWords.size());
+    header.subChunkCount = static_cast<uint32_t>(world.globalSubChunks.size());
+    header.chunkCount = static_cast<uint32_t>(chunks.size());
+    header.instanceSetCount = static_cast<uint32_t>(sets.size());
+    header.transformCount = static_cast<uint32_t>(transforms.size());
+    header.freeNodeRangeCount = static_cast<uint32_t>(world.freeNodeRanges.size());
+    header.freeBrickRangeCount = static_cast<uint32_t>(world.freeBrickRanges.size());
+    header.freeSlotCount = static_cast<uint32_t>(world.freeSlots.size());
+    header.subChunksPerChunk = world.subChunksPerChunk;
+    header.packSerial = world.packSerial;
+    header.dagPacked = world.dagPacked ? 1u : 0u;
+
+    // written next to the target and renamed over it, so a crash never leaves half a cache behind
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            errorMsg = "can't open " + tmpPath + " for writing";
+            return false;
+        }
+
+        CacheWriter w(out);
+        w.section(&header, 1);
+        w.section(vox.palette, 256);
+        w.section(vox.materials, 256);
+        w.section(paletteToMaterial.data(), paletteToMaterial.size());
+        w.section(chunks.data(), chunks.size());
+        w.section(sets.data(), sets.size());
+        w.section(transforms.data(), transforms.size());
+        w.section(world.freeNodeRanges.data(), world.freeNodeRanges.size());
+        w.section(world.freeBrickRanges.data(), world.freeBrickRanges.size());
+        w.section(world.freeSlots.data(), world.freeSlots.size());
+        w.section(world.globalNodes.data(), world.globalNodes.size());
+        w.section(world.globalBrickWords.data(), world.globalBrickWords.size());
+        w.section(world.globalSubChunks.data(), world.globalSubChunks.size());
+
+        if (!out) {
+            errorMsg = "failed writing " + tmpPath;
+            return false;
+        }
+    }
+
+    std::remove(path.c_str());
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        errorMsg = "can't move the cache into place at " + path;
+        return false;
+    }
+    return true;
+}
+
+bool loadWorldCache(
+    const std::string& path,
+    uint64_t sourceHash,
+    ChunkManager& mgr,
+    WorldSvoGpu& world,
+    MaterialLibrary* materialLib,
+    std::string& errorMsg
+) {
+    BLOK_PROFILE_NAMED(timer, "loadWorldCache");
+    BLOK_PROFILE_DETAIL(timer, path);
+    MappedFile file;
+    if (!file.open(path, errorMsg)) return false;
+
+    CacheReader r(file.data(), file.size());
+    const WorldCacheHeader* header = r.section<WorldCacheHeader>(1);
+    if (!header || std::memcmp(header->magic, WORLD_CACHE_MAGIC, 4) != 0) {
+        errorMsg = "not a world cache";
+        return false;
+    }
+    if (header->version != WORLD_CACHE_VERSION) {
+        errorMsg = "world cache version " + std::to_string(header->version) + ", need " + std::to_string(WORLD_CACHE_VERSION);
+        return false;
+    }
+    if (sourceHash == 0 || header->sourceHash != sourceHash) {
+        errorMsg = "source changed since the cache was written";
+        return false;
+    }
+    if (header->paramsHash != packingParamsHash(mgr)) {
+        errorMsg = "packing parameters changed since the cache was written";
+        return false;
+    }
+
+    VoxFile vox;
+    std::array<uint32_t, 256> savedMapping{};
+    const uint32_t* palette = r.section<uint32_t>(256);
+    const VoxMaterial* materials = r.section<VoxMaterial>(256);
+    const uint32_t* mapping = r.section<uint32_t>(256);
+    if (!r.ok()) {
+        errorMsg = "world cache is truncated";
+        return false;
+    }
+    std::memcpy(vox.palette, palette, sizeof(vox.palette));
+    std::memcpy(vox.materials, materials, sizeof(vox.materials));
+    std::memcpy(savedMapping.data(), mapping, sizeof(uint32_t) * 256);
+
+    // material ids are handed out in order, the nodes only match if the import starts where it did last time
+    if (materialLib && materialLib->size() != savedMapping[1]) {
+        errorMsg = "material library doesn't match the cache";
+        return false;
+    }
+
+    std::vector<WorldCacheChunk> chunks;
+    std::vector<WorldCacheInstanceSet> sets;
+    std::vector<glm::mat4> transforms;
+    WorldSvoGpu loaded;
+    r.section(chunks, header->chunkCount);
+    r.section(sets, header->instanceSetCount);
+    r.section(transforms, header->transformCount);
+    r.section(loaded.freeNodeRanges, header->freeNodeRangeCount);
+    r.section(loaded.freeBrickRanges, header->freeBrickRangeCount);
+    r.section(loaded.freeSlots, header->freeSlotCount);
+    r.section(loaded.globalNodes, header->nodeCount);
+    r.section(loaded.globalBrickWords, header->brickWordCount);
+    r.section(loaded.globalSubChunks, header->subChunkCount);
+    if (!r.ok()) {
+        errorMsg = "world cache is truncated";
+        return false;
+    }
+
+    std::vector<ChunkInstanceSet> instanceSets;
+    for (const auto& s : sets) {
+        if (static_cast<size_t>(s.firstTransform) + s.transformCount > transforms.size()) {
+            errorMsg = "world cache has a bad instance set";
+            return false;
+        }
+        ChunkInstanceSet set;
+        set.sourceMin = s.sourceMin;
+        set.sourceMax = s.sourceMax;
+        set.transforms.assign(transforms.begin() + s.firstTransform, transforms.begin() + s.firstTransform + s.transformCount);
+        instanceSets.push_back(std::move(set));
+    }
+
+    // everything checked out, commit
+    if (materialLib) {
+        std::array<uint32_t, 256> paletteMapping;
+        importVoxMaterials(vox, *materialLib, paletteMapping);
+        mgr.setMaterialLibrary(materialLib);
+    }
+
+    world.globalNodes = std::move(loaded.globalNodes);
+    world.globalBrickWords = std::move(loaded.globalBrickWords);
+    world.globalSubChunks = std::move(loaded.globalSubChunks);
+    world.freeNodeRanges = std::move(loaded.freeNodeRanges);
+    world.freeBrickRanges = std::move(loaded.freeBrickRanges);
+    world.freeSlots = std::move(loaded.freeSlots);
+    world.chunkRanges.clear();
+    for (const auto& c : chunks) world.chunkRanges[c.coord] = c.range;
+    world.subChunksPerChunk = header->subChunksPerChunk;
+    world.subChunkLayout = mgr.subChunks;
+    world.packSerial = header->packSerial;
+    world.dagPacked = header->dagPacked != 0;
+    world.instanceSets = instanceSets;
+    mgr.instanceSets = std::move(instanceSets);
+
+    // fresh buffers upload whole, nothing to track
+    world.dirtyNodeRanges.clear();
+    world.dirtyBrickRanges.clear();
+    world.dirtySubChunkRanges.clear();
+
+    std::cout << "Loaded world cache: " << path << " (" << chunks.size() << " chunks, "
+              << world.globalNodes.size() << " nodes)\n";
+    return true;
+}
+
+}
@@ -0,0 +1,216 @@
+/*
+* File: world_thread.cpp
+* Project: blok
+* Author: Collin Longoria
+* Created on: 12/2/2025
+*/
+#include "world_thread.hpp"
+#include "chunk_manager.hpp"
+#include "cpu_profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace blok {
+
+namespace {
+
+// how long the world thread sleeps when a pass had nothing to do, or the render thread is behind on deltas
+constexpr auto IDLE_WAIT = std::chrono::milliseconds(1);
+
+// the dirty ranges' contents back to back. the ranges move out, the packer starts a fresh list
+template <typename T>
+void gatherRanges(const std::vector<T>& heap, std::vector<GpuRange>& dirty, std::vector<GpuRange>& ranges, std::vector<T>& out) {
+    for (GpuRange r : dirty) {
+        if (r.first >= heap.size()) continue;
+        r.count = std::min<uint32_t>(r.count, static_cast<uint32_t>(heap.size() - r.first));
+        out.insert(out.end(), heap.begin() + r.first, heap.begin() + r.first + r.count);
+        ranges.push_back(r);
+    }
+    dirty.clear();
+}
+
+template <typename T>
+void scatterRanges(const std::vector<T>& data, const std::vector<GpuRange>& ranges, std::vector<T>& heap, std::vector<GpuRange>& dirty) {
+    size_t at = 0;
+    for (const GpuRange& r : ranges) {
+        std::copy_n(data.begin() + at, r.count, heap.begin() + r.first);
+        at += r.count;
+        dirty.push_back(r);
+    }
+}
+
+// a full repack can shrink a heap under ranges an earlier delta left for the renderer
+void clampRanges(std::vector<GpuRange>& ranges, size_t size) {
+    std::erase_if(ranges, [&](const GpuRange& r) { return r.first >= size; });
+    for (GpuRange& r : ranges) r.count = std::min<uint32_t>(r.count, static_cast<uint32_t>(size - r.first));
+}
+
+}
+
+void applyWorldDelta(WorldDelta& delta, WorldSvoGpu& gpuWorld) {
+    BLOK_PROFILE_SCOPE("applyWorldDelta");
+    gpuWorld.globalNodes.resize(delta.nodeCount);
+    gpuWorld.globalBrickWords.resize(delta.brickWordCount);
+    gpuWorld.globalSubChunks.resize(delta.subChunkCount);
+    clampRanges(gpuWorld.dirtyNodeRanges, delta.nodeCount);
+    clampRanges(gpuWorld.dirtyBrickRanges, delta.brickWordCount);
+    clampRanges(gpuWorld.dirtySubChunkRanges, delta.subChunkCount);
+
+    scatterRanges(delta.nodes, delta.nodeRanges, gpuWorld.globalNodes, gpuWorld.dirtyNodeRanges);
+    scatterRanges(delta.brickWords, delta.brickRanges, gpuWorld.globalBrickWords, gpuWorld.dirtyBrickRanges);
+    scatterRanges(delta.subChunks, delta.subChunkRanges, gpuWorld.globalSubChunks, gpuWorld.dirtySubChunkRanges);
+
+    gpuWorld.chunkRanges = std::move(delta.chunkRanges);
+    gpuWorld.freeNodeRanges = std::move(delta.freeNodeRanges);
+    gpuWorld.subChunksPerChunk = delta.subChunksPerChunk;
+    gpuWorld.subChunkLayout = delta.subChunkLayout;
+    gpuWorld.instanceSets = std::move(delta.instanceSets);
+    // jobs of chunks a later delta dropped again are skipped by SvoBuilder, their range is gone
+    for (GpuSvoBuildJob& job : delta.gpuBuilds) gpuWorld.gpuBuilds.push_back(std::move(job));
+
+    if (delta.lights) {
+        gpuWorld.lightHeader = delta.lightHeader;
+        gpuWorld.lights = std::move(delta.lightList);
+        gpuWorld.lightsDirty = true;
+    }
+    if (delta.surface) {
+        gpuWorld.surfaceVertices = std::move(delta.surfaceVertices);
+        gpuWorld.surfaceValid = delta.surfaceValid;
+        gpuWorld.surfaceDirty = true;
+    }
+    if (delta.emptySpace) {
+        gpuWorld.emptySpaceHeader = delta.emptySpaceHeader;
+        gpuWorld.emptySpaceWords = std::move(delta.emptySpaceWords);
+        gpuWorld.emptySpaceDirty = true;
+    }
+}
+
+WorldThread::WorldThread(ChunkManager& mgr, const WorldSvoGpu& gpuWorld) : m_mgr(mgr) {
+    // the packing state carries on from the startup pack, the renderer already has everything it wrote
+    m_packed.globalNodes = gpuWorld.globalNodes;
+    m_packed.globalBrickWords = gpuWorld.globalBrickWords;
+    m_packed.globalSubChunks = gpuWorld.globalSubChunks;
+    m_packed.chunkRanges = gpuWorld.chunkRanges;
+    m_packed.freeNodeRanges = gpuWorld.freeNodeRanges;
+    m_packed.freeBrickRanges = gpuWorld.freeBrickRanges;
+    m_packed.freeSlots = gpuWorld.freeSlots;
+    m_packed.subChunksPerChunk = gpuWorld.subChunksPerChunk;
+    m_packed.subChunkLayout = gpuWorld.subChunkLayout;
+    m_packed.packSerial = gpuWorld.packSerial;
+    m_packed.dagPacked = gpuWorld.dagPacked;
+    m_packed.instanceSets = gpuWorld.instanceSets;
+    m_packed.chunkLights = gpuWorld.chunkLights;
+    m_packed.lightHeader = gpuWorld.lightHeader;
+    m_packed.lights = gpuWorld.lights;
+    m_packed.chunkSurfaces = gpuWorld.chunkSurfaces;
+    m_packed.surfaceVertices = gpuWorld.surfaceVertices;
+    m_packed.surfaceValid = gpuWorld.surfaceValid;
+    m_packed.chunkDistanceFields = gpuWorld.chunkDistanceFields;
+    m_packed.emptySpaceHeader = gpuWorld.emptySpaceHeader;
+    m_packed.emptySpaceWords = gpuWorld.emptySpaceWords;
+    m_packed.lightsDirty = false;
+    m_packed.surfaceDirty = false;
+    m_packed.emptySpaceDirty = false;
+
+    m_thread = std::thread([this] { run(); });
+}
+
+WorldThread::~WorldThread() {
+    m_running.store(false, std::memory_order_release);
+    if (m_thread.joinable()) m_thread.join();
+}
+
+void WorldThread::setCamera(const glm::vec3& position) {
+    // the components can come from different frames for one pass, residency doesn't care
+    m_cameraX.store(position.x, std::memory_order_relaxed);
+    m_cameraY.store(position.y, std::memory_order_relaxed);
+    m_cameraZ.store(position.z, std::memory_order_relaxed);
+}
+
+bool WorldThread::consume(WorldSvoGpu& gpuWorld) {
+    bool changed = false;
+    while (std::optional<std::unique_ptr<WorldDelta>> delta = m_deltas.pop()) {
+        applyWorldDelta(**delta, gpuWorld);
+        changed = true;
+    }
+    return changed;
+}
+
+std::unique_ptr<WorldDelta> WorldThread::takeDelta() {
+    auto delta = std::make_unique<WorldDelta>();
+    WorldSvoGpu& w = m_packed;
+
+    delta->nodeCount = w.globalNodes.size();
+    delta->brickWordCount = w.globalBrickWords.size();
+    delta->subChunkCount = w.globalSubChunks.size();
+    gatherRanges(w.globalNodes, w.dirtyNodeRanges, delta->nodeRanges, delta->nodes);
+    gatherRanges(w.globalBrickWords, w.dirtyBrickRanges, delta->brickRanges, delta->brickWords);
+    gatherRanges(w.globalSubChunks, w.dirtySubChunkRanges, delta->subChunkRanges, delta->subChunks);
+
+    delta->chunkRanges = w.chunkRanges;
+    delta->freeNodeRanges = w.freeNodeRanges;
+    delta->subChunksPerChunk = w.subChunksPerChunk;
+    delta->subChunkLayout = w.subChunkLayout;
+    delta->instanceSets = w.instanceSets;
+    delta->gpuBuilds = std::move(w.gpuBuilds);
+    w.gpuBuilds.clear();
+
+    if (w.lightsDirty) {
+        delta->lights = true;
+        delta->lightHeader = w.lightHeader;
+        delta->lightList = w.lights;
+        w.lightsDirty = false;
+    }
+    if (w.surfaceDirty) {
+        delta->surface = true;
+        delta->surfaceValid = w.surfaceValid;
+        delta->surfaceVertices = w.surfaceVertices;
+        w.surfaceDirty = false;
+    }
+    if (w.emptySpaceDirty) {
+        delta->emptySpace = true;
+        delta->emptySpaceHeader = w.emptySpaceHeader;
+        delta->emptySpaceWords = w.emptySpaceWords;
+        w.emptySpaceDirty = false;
+    }
+    return delta;
+}
+
+void WorldThread::run() {
+    while (m_running.load(std::memory_order_acquire)) {
+        // edits first, their chunks are marked dirty and go into this pass's rebuilds
+        bool changed = false;
+        while (std::optional<Edit> edit = m_edits.pop()) {
+            (*edit)(m_mgr);
+            changed = true;
+        }
+
+        if (m_mgr.streaming.enabled) {
+            BLOK_PROFILE_SCOPE("worldResidency");
+            m_mgr.streaming.deviceBudgetBytes = m_deviceBudget.load(std::memory_order_relaxed);
+            const glm::vec3 camera(m_cameraX.load(std::memory_order_relaxed), m_cameraY.load(std::memory_order_relaxed),
+                                   m_cameraZ.load(std::memory_order_relaxed));
+            if (updateChunkResidency(m_mgr, camera)) changed = true;
+        }
+        rebuildDirtyChunksAsync(m_mgr, 8);
+        if (collectRebuiltChunks(m_mgr) > 0) changed = true;
+
+        if (!changed) {
+            std::this_thread::sleep_for(IDLE_WAIT);
+            continue;
+        }
+
+        packChunksToGpuSvo(m_mgr, m_packed);
+        if (m_mgr.svoDag) compressGpuSvoDag(m_mgr, m_packed);
+
+        // the render thread is MAX_DELTAS packs behind, hold off until it catches up so edits stay bounded
+        std::unique_ptr<WorldDelta> delta = takeDelta();
+        while (!m_deltas.push(std::move(delta))) {
+            if (!m_running.load(std::memory_order_acquire)) return;
+            std::this_thread::sleep_for(IDLE_WAIT);
+        }
+    }
+}
+
+}